@@ -0,0 +1,500 @@
+#ifndef ESP32_CSI_CAPTURE_COMPONENT_H
+#define ESP32_CSI_CAPTURE_COMPONENT_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <vector>
+
+#include "csi_packet_component.h"
+
+/*
+ * Chunked binary CSI capture file, written by the station to the SD card and read on Linux.
+ *
+ *   file:    header chunk | data chunk * n | index | footer
+ *   header:  magic "CSIC" (4) | version (2) | record_version (2) | chunk_size (4) | device_id (2)
+ *            | ap_count (2) | created_us (8) | ap names (CAPTURE_MAX_APS * CAPTURE_AP_NAME_LEN) | crc32 (4),
+ *            zero padded to chunk_size
+ *   chunk:   magic "CHNK" (4) | chunk_no (4) | records (4) | payload_bytes (4) | first_ts_us (8)
+ *            | last_ts_us (8) | crc32 (4) | reserved (4) | records, encoded as in csi_packet_component.h,
+ *            zero padded to chunk_size
+ *   index:   magic "CIDX" (4) | count (4) | ap_count (2) | reserved (2) | ap names
+ *            | entry * count, entry = offset (8) | first_ts_us (8) | last_ts_us (8) | records (4) | chunk_no (4)
+ *   footer:  index_offset (8) | index crc32 (4) | magic "CEND" (4)
+ *
+ * All fields are little endian. The chunk CRC covers the first 32 header bytes and the payload.
+ * Every chunk has the same size, so chunk i starts at (i + 1) * chunk_size and full chunks line up with
+ * the FAT allocation units. The AP table in the header holds the APs known when the capture started, the
+ * one in the index the final table.
+ *
+ * A capture cut short (power loss, no capture_writer_finish()) has no index. The reader then scans the
+ * chunks from the start and stops at the first one that is incomplete or fails its CRC.
+ *
+ * The writer keeps the index in RAM until the capture ends. Room for CONFIG_CAPTURE_INDEX_RESERVE entries
+ * is reserved when it starts, so sealing a chunk in the CSI callback does not allocate; a longer capture
+ * grows the index by doubling.
+ */
+
+#define CAPTURE_MAGIC 0x43495343 // "CSIC"
+#define CAPTURE_CHUNK_MAGIC 0x4B4E4843 // "CHNK"
+#define CAPTURE_INDEX_MAGIC 0x58444943 // "CIDX"
+#define CAPTURE_FOOTER_MAGIC 0x444E4543 // "CEND"
+#define CAPTURE_VERSION 1
+#define CAPTURE_CHUNK_SIZE (16 * 1024) // One FAT allocation unit
+#define CAPTURE_MAX_APS 16
+#define CAPTURE_AP_NAME_LEN 32
+#define CAPTURE_HEADER_USED (24 + CAPTURE_MAX_APS * CAPTURE_AP_NAME_LEN + 4)
+#define CAPTURE_CHUNK_HEADER_SIZE 40
+#define CAPTURE_INDEX_HEADER_SIZE (12 + CAPTURE_MAX_APS * CAPTURE_AP_NAME_LEN)
+#define CAPTURE_INDEX_ENTRY_SIZE 32
+#define CAPTURE_FOOTER_SIZE 16
+
+#ifndef CONFIG_CAPTURE_INDEX_RESERVE
+#define CONFIG_CAPTURE_INDEX_RESERVE 256 // Index entries reserved per capture, 4 MiB of chunks in 8 KiB
+#endif
+
+// Receives the bytes of the file in order. Returns false if they could not be stored.
+typedef bool (*capture_sink_t)(void *ctx, const void *data, size_t size);
+
+typedef struct {
+    uint64_t offset;
+    int64_t first_ts_us;
+    int64_t last_ts_us;
+    uint32_t records;
+    uint32_t chunk_no;
+} capture_index_entry_t;
+
+typedef struct {
+    capture_sink_t sink;
+    void *ctx;
+
+    uint32_t chunk_size;
+    std::vector<uint8_t> chunk; // Chunk being filled
+    size_t fill;
+    uint32_t records;
+    int64_t first_ts_us;
+    int64_t last_ts_us;
+
+    uint64_t offset; // Bytes handed to the sink so far
+    uint32_t chunk_no;
+    uint16_t ap_count;
+    char ap_names[CAPTURE_MAX_APS][CAPTURE_AP_NAME_LEN];
+    std::vector<capture_index_entry_t> index;
+
+    uint64_t records_written;
+    uint64_t dropped_chunks; // Chunks the sink refused
+    uint64_t dropped_records; // Records larger than a chunk
+} capture_writer_t;
+
+typedef struct {
+    int fd;
+    uint64_t file_size;
+    uint16_t version;
+    uint32_t chunk_size;
+    uint16_t device_id;
+    int64_t created_us;
+    uint16_t ap_count;
+    char ap_names[CAPTURE_MAX_APS][CAPTURE_AP_NAME_LEN];
+    std::vector<capture_index_entry_t> index;
+    bool recovered; // Index rebuilt by scanning, the capture was not finished
+    std::vector<uint8_t> chunk; // Last chunk loaded
+} capture_reader_t;
+
+typedef struct {
+    const uint8_t *buf;
+    size_t offset;
+    size_t end;
+    uint32_t remaining;
+} capture_chunk_t;
+
+// CRC-32 (IEEE 802.3, as in zlib), table built on first use
+inline uint32_t capture_crc32(uint32_t crc, const void *data, size_t size) {
+    static uint32_t table[256];
+    static bool table_ready = false;
+    if (!table_ready) {
+        for (uint32_t i = 0; i < 256; i++) {
+            uint32_t c = i;
+            for (int k = 0; k < 8; k++) {
+                c = (c & 1) ? 0xEDB88320 ^ (c >> 1) : c >> 1;
+            }
+            table[i] = c;
+        }
+        table_ready = true;
+    }
+
+    const uint8_t *p = (const uint8_t *) data;
+    crc = ~crc;
+    for (size_t i = 0; i < size; i++) {
+        crc = table[(crc ^ p[i]) & 0xFF] ^ (crc >> 8);
+    }
+    return ~crc;
+}
+
+inline void _capture_put_ap_names(uint8_t *p, const char names[][CAPTURE_AP_NAME_LEN]) {
+    memcpy(p, names, CAPTURE_MAX_APS * CAPTURE_AP_NAME_LEN);
+}
+
+inline void _capture_get_ap_names(const uint8_t *p, char names[][CAPTURE_AP_NAME_LEN]) {
+    memcpy(names, p, CAPTURE_MAX_APS * CAPTURE_AP_NAME_LEN);
+    for (int i = 0; i < CAPTURE_MAX_APS; i++) {
+        names[i][CAPTURE_AP_NAME_LEN - 1] = '\0';
+    }
+}
+
+inline bool _capture_emit(capture_writer_t *w, const void *data, size_t size) {
+    if (!w->sink(w->ctx, data, size)) {
+        return false;
+    }
+    w->offset += size;
+    return true;
+}
+
+// Seal the current chunk and hand it to the sink
+inline void _capture_emit_chunk(capture_writer_t *w) {
+    if (w->records == 0) {
+        return;
+    }
+
+    uint8_t *h = w->chunk.data();
+    _csi_put_u32(h, CAPTURE_CHUNK_MAGIC);
+    _csi_put_u32(h + 4, w->chunk_no);
+    _csi_put_u32(h + 8, w->records);
+    _csi_put_u32(h + 12, (uint32_t) (w->fill - CAPTURE_CHUNK_HEADER_SIZE));
+    _csi_put_u64(h + 16, (uint64_t) w->first_ts_us);
+    _csi_put_u64(h + 24, (uint64_t) w->last_ts_us);
+    uint32_t crc = capture_crc32(0, h, 32);
+    crc = capture_crc32(crc, h + CAPTURE_CHUNK_HEADER_SIZE, w->fill - CAPTURE_CHUNK_HEADER_SIZE);
+    _csi_put_u32(h + 32, crc);
+    _csi_put_u32(h + 36, 0);
+    memset(h + w->fill, 0, w->chunk_size - w->fill);
+
+    capture_index_entry_t entry = {w->offset, w->first_ts_us, w->last_ts_us, w->records, w->chunk_no};
+    if (_capture_emit(w, h, w->chunk_size)) {
+        w->index.push_back(entry);
+        w->records_written += w->records;
+    } else {
+        w->dropped_chunks++;
+    }
+
+    w->chunk_no++;
+    w->fill = CAPTURE_CHUNK_HEADER_SIZE;
+    w->records = 0;
+}
+
+/*
+ * Start a capture and write its header. `chunk_size` is normally CAPTURE_CHUNK_SIZE and must leave room
+ * for at least one record of CSI_RECORD_MAX_LEN.
+ */
+inline bool capture_writer_begin(capture_writer_t *w, uint32_t chunk_size, uint16_t device_id, int64_t created_us,
+                                 capture_sink_t sink, void *ctx) {
+    if (chunk_size < CAPTURE_HEADER_USED || chunk_size < CAPTURE_CHUNK_HEADER_SIZE + csi_record_wire_size(CSI_RECORD_MAX_LEN) + CSI_RECORD_LABEL_SIZE) {
+        printf("ERROR: capture chunk size %u is too small\n", (unsigned) chunk_size);
+        return false;
+    }
+
+    w->sink = sink;
+    w->ctx = ctx;
+    w->chunk_size = chunk_size;
+    w->chunk.assign(chunk_size, 0);
+    w->fill = CAPTURE_CHUNK_HEADER_SIZE;
+    w->records = 0;
+    w->offset = 0;
+    w->chunk_no = 0;
+    w->ap_count = 0;
+    memset(w->ap_names, 0, sizeof(w->ap_names));
+    w->index.clear();
+    w->index.reserve(CONFIG_CAPTURE_INDEX_RESERVE);
+    w->records_written = 0;
+    w->dropped_chunks = 0;
+    w->dropped_records = 0;
+
+    // The header uses the chunk buffer, which is cleared again for the first data chunk
+    uint8_t *h = w->chunk.data();
+    _csi_put_u32(h, CAPTURE_MAGIC);
+    _csi_put_u16(h + 4, CAPTURE_VERSION);
+    _csi_put_u16(h + 6, CSI_PACKET_VERSION);
+    _csi_put_u32(h + 8, chunk_size);
+    _csi_put_u16(h + 12, device_id);
+    _csi_put_u16(h + 14, w->ap_count);
+    _csi_put_u64(h + 16, (uint64_t) created_us);
+    _capture_put_ap_names(h + 24, w->ap_names);
+    _csi_put_u32(h + CAPTURE_HEADER_USED - 4, capture_crc32(0, h, CAPTURE_HEADER_USED - 4));
+    bool ok = _capture_emit(w, h, chunk_size);
+    memset(h, 0, CAPTURE_HEADER_USED);
+    return ok;
+}
+
+// Name AP `id`, the name ends up in the index. Cheap when the name is already known.
+inline void capture_writer_set_ap(capture_writer_t *w, uint8_t id, const char *name) {
+    if (id >= CAPTURE_MAX_APS || strncmp(w->ap_names[id], name, CAPTURE_AP_NAME_LEN - 1) == 0) {
+        return;
+    }
+    strncpy(w->ap_names[id], name, CAPTURE_AP_NAME_LEN - 1);
+    w->ap_names[id][CAPTURE_AP_NAME_LEN - 1] = '\0';
+    if (id >= w->ap_count) {
+        w->ap_count = id + 1;
+    }
+}
+
+// Append a record, sealing the current chunk when it is full. Returns false if the record was dropped.
+inline bool capture_writer_append(capture_writer_t *w, const csi_record_t *r) {
+    if (r->len > CSI_RECORD_MAX_LEN) {
+        w->dropped_records++;
+        return false;
+    }
+
+    size_t size = csi_record_encoded_size(r);
+    if (w->fill + size > w->chunk_size) {
+        _capture_emit_chunk(w);
+    }
+
+    csi_record_put(w->chunk.data() + w->fill, r);
+    w->fill += size;
+    if (w->records == 0) {
+        w->first_ts_us = r->timestamp_us;
+    }
+    w->last_ts_us = r->timestamp_us;
+    w->records++;
+    return true;
+}
+
+// Seal the partially filled chunk so everything appended so far can be synced to the card
+inline void capture_writer_flush(capture_writer_t *w) {
+    _capture_emit_chunk(w);
+}
+
+// Seal the last chunk and write the index and footer
+inline bool capture_writer_finish(capture_writer_t *w) {
+    _capture_emit_chunk(w);
+
+    uint64_t index_offset = w->offset;
+    std::vector<uint8_t> index(CAPTURE_INDEX_HEADER_SIZE + w->index.size() * CAPTURE_INDEX_ENTRY_SIZE + CAPTURE_FOOTER_SIZE);
+    uint8_t *p = index.data();
+    _csi_put_u32(p, CAPTURE_INDEX_MAGIC);
+    _csi_put_u32(p + 4, (uint32_t) w->index.size());
+    _csi_put_u16(p + 8, w->ap_count);
+    _csi_put_u16(p + 10, 0);
+    _capture_put_ap_names(p + 12, w->ap_names);
+    p += CAPTURE_INDEX_HEADER_SIZE;
+    for (const capture_index_entry_t &e : w->index) {
+        _csi_put_u64(p, e.offset);
+        _csi_put_u64(p + 8, (uint64_t) e.first_ts_us);
+        _csi_put_u64(p + 16, (uint64_t) e.last_ts_us);
+        _csi_put_u32(p + 24, e.records);
+        _csi_put_u32(p + 28, e.chunk_no);
+        p += CAPTURE_INDEX_ENTRY_SIZE;
+    }
+
+    size_t index_size = p - index.data();
+    _csi_put_u64(p, index_offset);
+    _csi_put_u32(p + 8, capture_crc32(0, index.data(), index_size));
+    _csi_put_u32(p + 12, CAPTURE_FOOTER_MAGIC);
+
+    // Pieces of at most a chunk, so a sink with bounded buffers can take a long index
+    for (size_t done = 0; done < index.size(); done += w->chunk_size) {
+        size_t size = index.size() - done < w->chunk_size ? index.size() - done : w->chunk_size;
+        if (!_capture_emit(w, index.data() + done, size)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+inline bool _capture_pread(int fd, void *buf, size_t size, uint64_t offset) {
+    if (lseek(fd, (off_t) offset, SEEK_SET) == (off_t) -1) {
+        return false;
+    }
+    size_t done = 0;
+    while (done < size) {
+        ssize_t n = read(fd, (uint8_t *) buf + done, size - done);
+        if (n <= 0) {
+            return false;
+        }
+        done += n;
+    }
+    return true;
+}
+
+// Checks the chunk in `buf` (chunk_size bytes) and fills in its index entry
+inline bool _capture_check_chunk(const uint8_t *buf, uint32_t chunk_size, uint64_t offset, capture_index_entry_t *e) {
+    if (_csi_get_u32(buf) != CAPTURE_CHUNK_MAGIC) {
+        return false;
+    }
+    uint32_t payload = _csi_get_u32(buf + 12);
+    if (payload > chunk_size - CAPTURE_CHUNK_HEADER_SIZE) {
+        return false;
+    }
+    uint32_t crc = capture_crc32(0, buf, 32);
+    crc = capture_crc32(crc, buf + CAPTURE_CHUNK_HEADER_SIZE, payload);
+    if (crc != _csi_get_u32(buf + 32)) {
+        return false;
+    }
+
+    e->offset = offset;
+    e->chunk_no = _csi_get_u32(buf + 4);
+    e->records = _csi_get_u32(buf + 8);
+    e->first_ts_us = (int64_t) _csi_get_u64(buf + 16);
+    e->last_ts_us = (int64_t) _csi_get_u64(buf + 24);
+    return true;
+}
+
+// Load the index from the footer. Returns false if the capture was not finished.
+inline bool _capture_read_index(capture_reader_t *r) {
+    if (r->file_size < r->chunk_size + CAPTURE_INDEX_HEADER_SIZE + CAPTURE_FOOTER_SIZE) {
+        return false;
+    }
+    uint8_t footer[CAPTURE_FOOTER_SIZE];
+    if (!_capture_pread(r->fd, footer, sizeof(footer), r->file_size - CAPTURE_FOOTER_SIZE) ||
+        _csi_get_u32(footer + 12) != CAPTURE_FOOTER_MAGIC) {
+        return false;
+    }
+
+    uint64_t index_offset = _csi_get_u64(footer);
+    if (index_offset < r->chunk_size || index_offset > r->file_size - CAPTURE_FOOTER_SIZE - CAPTURE_INDEX_HEADER_SIZE) {
+        return false;
+    }
+    std::vector<uint8_t> index(r->file_size - CAPTURE_FOOTER_SIZE - index_offset);
+    if (!_capture_pread(r->fd, index.data(), index.size(), index_offset) ||
+        capture_crc32(0, index.data(), index.size()) != _csi_get_u32(footer + 8) ||
+        _csi_get_u32(index.data()) != CAPTURE_INDEX_MAGIC) {
+        return false;
+    }
+
+    uint32_t count = _csi_get_u32(index.data() + 4);
+    if (CAPTURE_INDEX_HEADER_SIZE + (uint64_t) count * CAPTURE_INDEX_ENTRY_SIZE != index.size()) {
+        return false;
+    }
+    r->ap_count = _csi_get_u16(index.data() + 8);
+    _capture_get_ap_names(index.data() + 12, r->ap_names);
+
+    const uint8_t *p = index.data() + CAPTURE_INDEX_HEADER_SIZE;
+    r->index.resize(count);
+    for (uint32_t i = 0; i < count; i++, p += CAPTURE_INDEX_ENTRY_SIZE) {
+        r->index[i].offset = _csi_get_u64(p);
+        r->index[i].first_ts_us = (int64_t) _csi_get_u64(p + 8);
+        r->index[i].last_ts_us = (int64_t) _csi_get_u64(p + 16);
+        r->index[i].records = _csi_get_u32(p + 24);
+        r->index[i].chunk_no = _csi_get_u32(p + 28);
+    }
+    return true;
+}
+
+// Rebuild the index of an unfinished capture from the chunks that are complete and intact
+inline void _capture_scan(capture_reader_t *r) {
+    r->index.clear();
+    for (uint64_t offset = r->chunk_size; offset + r->chunk_size <= r->file_size; offset += r->chunk_size) {
+        capture_index_entry_t e;
+        if (!_capture_pread(r->fd, r->chunk.data(), r->chunk_size, offset) ||
+            !_capture_check_chunk(r->chunk.data(), r->chunk_size, offset, &e)) {
+            break;
+        }
+        r->index.push_back(e);
+    }
+    r->recovered = true;
+}
+
+// Open a capture for reading. Returns false if the file is missing or its header is invalid.
+inline bool capture_reader_open(capture_reader_t *r, const char *path) {
+    r->fd = open(path, O_RDONLY);
+    if (r->fd < 0) {
+        printf("ERROR: cannot open %s [%s]\n", path, strerror(errno));
+        return false;
+    }
+
+    struct stat st;
+    uint8_t h[CAPTURE_HEADER_USED];
+    if (fstat(r->fd, &st) != 0 || !_capture_pread(r->fd, h, sizeof(h), 0) || _csi_get_u32(h) != CAPTURE_MAGIC ||
+        capture_crc32(0, h, CAPTURE_HEADER_USED - 4) != _csi_get_u32(h + CAPTURE_HEADER_USED - 4)) {
+        printf("ERROR: %s is not a CSI capture\n", path);
+        close(r->fd);
+        r->fd = -1;
+        return false;
+    }
+
+    r->file_size = st.st_size;
+    r->version = _csi_get_u16(h + 4);
+    r->chunk_size = _csi_get_u32(h + 8);
+    r->device_id = _csi_get_u16(h + 12);
+    r->ap_count = _csi_get_u16(h + 14);
+    r->created_us = (int64_t) _csi_get_u64(h + 16);
+    _capture_get_ap_names(h + 24, r->ap_names);
+    r->chunk.assign(r->chunk_size, 0);
+    r->recovered = false;
+
+    if (r->version != CAPTURE_VERSION || r->chunk_size < CAPTURE_HEADER_USED) {
+        printf("ERROR: %s has unsupported version %u\n", path, (unsigned) r->version);
+        close(r->fd);
+        r->fd = -1;
+        return false;
+    }
+
+    if (!_capture_read_index(r)) {
+        _capture_scan(r);
+    }
+    return true;
+}
+
+inline size_t capture_reader_chunks(const capture_reader_t *r) {
+    return r->index.size();
+}
+
+// Load chunk `i` (an index position) and verify it. `c` then iterates over its records.
+inline bool capture_reader_load_chunk(capture_reader_t *r, size_t i, capture_chunk_t *c) {
+    if (i >= r->index.size()) {
+        return false;
+    }
+    capture_index_entry_t e;
+    if (!_capture_pread(r->fd, r->chunk.data(), r->chunk_size, r->index[i].offset) ||
+        !_capture_check_chunk(r->chunk.data(), r->chunk_size, r->index[i].offset, &e)) {
+        return false;
+    }
+
+    c->buf = r->chunk.data();
+    c->offset = CAPTURE_CHUNK_HEADER_SIZE;
+    c->end = CAPTURE_CHUNK_HEADER_SIZE + _csi_get_u32(c->buf + 12);
+    c->remaining = e.records;
+    return true;
+}
+
+// Next record of a loaded chunk, the payload points into the reader's chunk buffer
+inline bool capture_chunk_next(capture_chunk_t *c, csi_record_t *record) {
+    if (c->remaining == 0) {
+        return false;
+    }
+    size_t size = csi_record_get(c->buf + c->offset, c->end - c->offset, record);
+    if (size == 0) {
+        c->remaining = 0;
+        return false;
+    }
+    c->offset += size;
+    c->remaining--;
+    return true;
+}
+
+// Index position of the first chunk that may hold records at or after `ts_us` (chunks() if none)
+inline size_t capture_reader_find(const capture_reader_t *r, int64_t ts_us) {
+    size_t lo = 0;
+    size_t hi = r->index.size();
+    while (lo < hi) {
+        size_t mid = (lo + hi) / 2;
+        if (r->index[mid].last_ts_us < ts_us) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    return lo;
+}
+
+inline void capture_reader_close(capture_reader_t *r) {
+    if (r->fd >= 0) {
+        close(r->fd);
+        r->fd = -1;
+    }
+}
+
+#endif //ESP32_CSI_CAPTURE_COMPONENT_H
@@ -0,0 +1,218 @@
+#ifndef ESP32_CSI_CASCADE_COMPONENT_H
+#define ESP32_CSI_CASCADE_COMPONENT_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+
+#include "hal_component.h"
+#include "model_store_component.h"
+
+/*
+ * Two-stage localization for deployments that cover several rooms: a small room model (a softmax over the
+ * rooms) runs first, then only the fine model of the room it picked, a regressor or a kNN
+ * (knn_component.h) trained on that room's survey points alone. One model over every room grows with
+ * them and gets slower and less accurate; here each inference runs the room model and one small fine
+ * model.
+ *
+ * Models are model_store_component.h containers, addressed through a registry: a table of the rooms, the
+ * room model's labels, with where each fine container lies (a flash partition, a file on the SD card, or
+ * built into the sketch). tools/csi_cascade fit writes the containers and the registry. The room model stays
+ * loaded; the fine slot holds the last room's model and is reloaded only when the room changes, so a
+ * station that stays in a room maps nothing. Loading a partition only maps it, a file is copied into RAM.
+ *
+ * Each stage runs with the normalization table of its own container: the activate hook installs it (the
+ * sketch's csi_set_normalization) before the stage reads its features. When the fine model was fitted with
+ * the room model's table the features are read once.
+ *
+ * cascade_run() times every stage and reports the model memory resident: the two containers (in flash when
+ * mapped from a partition or built in, in RAM when loaded from a file) and the cascade's own working memory.
+ * Everything runs on one task.
+ */
+
+#define CASCADE_MAX_ROOMS MODEL_MAX_OUTPUTS
+
+typedef struct {
+    const char *room;  // The room model's label
+    const char *source;  // Partition label, or a path starting with '/'; only a name when `data` is set
+    const uint8_t *data;  // A container built in
+    size_t size;
+} cascade_entry_t;
+
+typedef struct {
+    const char *room;  // NULL if the room model failed
+    float room_confidence;
+    bool located;  // `fine` holds the room's fine model output
+    model_result_t fine;
+    int64_t room_us;
+    int64_t load_us;  // 0 unless the room changed
+    int64_t fine_us;
+    int64_t total_us;  // Including the feature reads
+} cascade_result_t;
+
+typedef struct {
+    uint32_t runs;
+    uint32_t loads;  // Fine models loaded, on room changes
+    uint32_t load_failures;
+    uint32_t unregistered;  // Rooms without a fine model in the registry
+    size_t resident_bytes;  // Containers of the room model and the loaded fine model
+    size_t working_bytes;
+} cascade_stats_t;
+
+typedef struct {
+    model_slot_t room;
+    model_slot_t fine;
+    const cascade_entry_t *registry;
+    size_t registry_count;
+    const cascade_entry_t *fine_of[CASCADE_MAX_ROOMS];  // By room model output
+    const cascade_entry_t *loaded;  // Entry in the fine slot
+    bool shared_norm;  // The fine model reads the room model's features
+    model_store_activate_t activate;
+    int16_t input[MODEL_MAX_WIDTH];
+    cascade_stats_t stats;
+} cascade_t;
+
+inline size_t _cascade_container_size(const model_slot_t *slot) {
+    return slot->map.data != NULL ? _csi_get_u32(slot->map.data + 12) : 0;
+}
+
+// Map an entry's container into `slot` and load it
+inline bool _cascade_load(model_slot_t *slot, const cascade_entry_t *e) {
+    hal_unmap(&slot->map);
+    snprintf(slot->source, sizeof(slot->source), "%s", e->source);
+    bool ok;
+    if (e->data != NULL) {
+        slot->map.data = e->data;
+        slot->map.size = e->size;
+        ok = true;
+    } else if (e->source[0] == '/') {
+        ok = hal_map_file(e->source, &slot->map);
+    } else {
+        ok = hal_map_partition(e->source, &slot->map);
+    }
+    ok = ok && model_store_parse(slot);
+    if (!ok) {
+        hal_unmap(&slot->map);
+    }
+    return ok;
+}
+
+inline bool _cascade_same_norm(const norm_table_t *a, const norm_table_t *b) {
+    return a->features == b->features &&
+           (a->features == 0 || (memcmp(a->mul, b->mul, 4 * (size_t) a->features) == 0 &&
+                                 memcmp(a->add, b->add, 4 * (size_t) a->features) == 0));
+}
+
+// Load the room model and look its rooms up in the registry. Rooms missing from the registry only get the
+// room stage; a registry entry that is no room of the model is reported and ignored.
+inline bool cascade_init(cascade_t *c, const cascade_entry_t *room_model, const cascade_entry_t *registry,
+                         size_t registry_count, model_store_activate_t activate) {
+    memset(&c->room.map, 0, sizeof(c->room.map));
+    memset(&c->fine.map, 0, sizeof(c->fine.map));
+    c->registry = registry;
+    c->registry_count = registry_count;
+    c->loaded = NULL;
+    c->shared_norm = false;
+    c->activate = activate;
+    memset(&c->stats, 0, sizeof(c->stats));
+    c->stats.working_bytes = sizeof(cascade_t);
+    if (!_cascade_load(&c->room, room_model)) {
+        return false;
+    }
+    uint16_t rooms = model_slot_outputs(&c->room);
+    if (c->room.knn.count > 0 || c->room.model.output_kind != MODEL_OUTPUT_SOFTMAX) {
+        printf("ERROR: room model %s does not classify\n", room_model->source);
+        return false;
+    }
+    for (uint16_t r = 0; r < rooms; r++) {
+        c->fine_of[r] = NULL;
+        for (size_t i = 0; i < registry_count; i++) {
+            if (strcmp(registry[i].room, c->room.model.labels[r]) == 0) {
+                c->fine_of[r] = &registry[i];
+            }
+        }
+        if (c->fine_of[r] == NULL) {
+            printf("ERROR: room %s has no fine model in the registry\n", c->room.model.labels[r]);
+        }
+    }
+    for (size_t i = 0; i < registry_count; i++) {
+        bool known = false;
+        for (uint16_t r = 0; r < rooms; r++) {
+            known = known || c->fine_of[r] == &registry[i];
+        }
+        if (!known) {
+            printf("ERROR: registry entry %s is no room of the room model\n", registry[i].room);
+        }
+    }
+    c->stats.resident_bytes = _cascade_container_size(&c->room);
+    return true;
+}
+
+// run_classifier for the cascade: the room, then the room's fine model, on features read through
+// `get_data` (csi_complete_q). Returns 0 if the room model ran, even when the room has no fine model
+// (result->located false).
+inline int cascade_run(cascade_t *c, int (*get_data)(size_t, size_t, int16_t *), cascade_result_t *result) {
+    int64_t start = hal_monotonic_us();
+    result->room = NULL;
+    result->located = false;
+    result->load_us = 0;
+    result->fine_us = 0;
+    c->stats.runs++;
+
+    uint16_t inputs = model_slot_inputs(&c->room);
+    model_result_t room;
+    if ((c->activate != NULL && !c->activate(&c->room)) || get_data(0, inputs, c->input) != 0 ||
+        model_slot_run(&c->room, c->input, &room) != 0) {
+        result->total_us = hal_monotonic_us() - start;
+        return -1;
+    }
+    result->room_us = room.timing_us;
+    uint16_t best = 0;
+    for (uint16_t r = 1; r < room.count; r++) {
+        best = room.classification[r].value > room.classification[best].value ? r : best;
+    }
+    result->room = room.classification[best].label;
+    result->room_confidence = room.classification[best].value;
+
+    const cascade_entry_t *e = c->fine_of[best];
+    if (e == NULL) {
+        c->stats.unregistered++;
+        result->total_us = hal_monotonic_us() - start;
+        return 0;
+    }
+    if (e != c->loaded) {
+        int64_t load_start = hal_monotonic_us();
+        c->loaded = NULL;
+        bool ok = _cascade_load(&c->fine, e);
+        c->stats.loads++;
+        c->stats.load_failures += !ok;
+        c->loaded = ok ? e : NULL;
+        c->shared_norm = ok && _cascade_same_norm(&c->room.norm, &c->fine.norm) &&
+                         model_slot_inputs(&c->fine) == inputs;
+        c->stats.resident_bytes = _cascade_container_size(&c->room) + _cascade_container_size(&c->fine);
+        result->load_us = hal_monotonic_us() - load_start;
+        if (!ok) {
+            result->total_us = hal_monotonic_us() - start;
+            return 0;
+        }
+    }
+
+    bool ran = c->activate == NULL || c->activate(&c->fine);
+    if (ran && !c->shared_norm) {
+        ran = get_data(0, model_slot_inputs(&c->fine), c->input) == 0;
+    }
+    ran = ran && model_slot_run(&c->fine, c->input, &result->fine) == 0;
+    result->located = ran;
+    result->fine_us = ran ? result->fine.timing_us : 0;
+    result->total_us = hal_monotonic_us() - start;
+    return 0;
+}
+
+inline void cascade_close(cascade_t *c) {
+    hal_unmap(&c->room.map);
+    hal_unmap(&c->fine.map);
+    c->loaded = NULL;
+}
+
+#endif //ESP32_CSI_CASCADE_COMPONENT_H
@@ -1,18 +1,23 @@
 #ifndef ESP32_CSI_CSI_COMPONENT_H
 #define ESP32_CSI_CSI_COMPONENT_H
 
+#include "hal_component.h"
 #include "time_component.h"
+#include "csi_packet_component.h"
+#include "log_component.h"
+#include "norm_component.h"
+#include "arena_component.h"
+#include "metrics_component.h"
 #include <cmath>
-#include <sstream>
-#include <iostream>
 #include <mutex>
-#include <thread>
-#include <vector>
+#include <atomic>
+#include <algorithm>
 
 // External definitions and declarations for Arduino
 extern size_t csi_buffer_size;  // External variable for buffer size
 extern int csi_buffer_index;    // Current buffer index
 extern int csi_buffer[];        // Buffer to store CSI data
+extern int rssi_chain[];        // RSSI of each AP visited in the cycle
 
 std::mutex mutex;
 char *project_type;
@@ -27,9 +32,53 @@ int x = 0;
 int y = 0;
 const char *current_AP = "";  // Currently connected AP
 
-extern int rssi_value = 0;
+#define CSI_MAX_APS 16  // Maximum number of distinct APs in the AP table
+#define CSI_STREAM_QUEUE_LEN 32  // Number of CSI records buffered for the socket transmitter
+#define CSI_STREAM_LEN 128  // Bytes of each CSI buffer that are streamed (LLTF)
+
+const char *ap_table[CSI_MAX_APS];  // Names of the APs seen so far, indexed by AP id
+uint8_t ap_count = 0;
+uint8_t current_AP_id = 0;
+uint16_t csi_device_id = 0;  // Station identifier sent with every CSI record
+
+// A CSI record together with its own copy of the payload
+typedef struct {
+    csi_record_t record;
+    int8_t payload[CSI_RECORD_MAX_LEN];
+} csi_stream_entry_t;
+
+csi_stream_entry_t csi_stream_queue[CSI_STREAM_QUEUE_LEN];  // Ring of records waiting to be sent
+size_t csi_stream_head = 0;
+size_t csi_stream_count = 0;
+uint32_t csi_stream_seq = 0;
+uint32_t csi_stream_dropped = 0;  // Records overwritten before the transmitter picked them up
+
+METRICS_COUNTER(csi_rx_metric, "csi.rx", CSI_MAX_APS);  // Frames the callback got, per AP id
+METRICS_COUNTER(csi_accepted_metric, "csi.accepted", CSI_MAX_APS);  // Queued for the transmitter
+METRICS_COUNTER(csi_dropped_metric, "csi.dropped", CSI_MAX_APS);  // Overwritten in the queue, by their AP
+METRICS_COUNTER(csi_skipped_metric, "csi.skipped", CSI_MAX_APS);  // Not in csi_buffer, the AP's frame was taken
+METRICS_COUNTER(csi_line_busy_metric, "csi.line_busy", 1);  // First frames passed over, the log task was behind
+METRICS_COUNTER(csi_lines_lost_metric, "csi.lines_lost", 1);  // Text lines that did not fit the arena
+METRICS_COUNTER(csi_overflows_metric, "csi.overflows", 1);  // Frames that did not fit csi_buffer
+METRICS_GAUGE(csi_queue_metric, "csi.queue");  // Records waiting for the transmitter
+METRICS_HISTOGRAM(csi_cb_metric, "csi.cb_us");  // Time in _wifi_csi_cb
+
+int rssi_value = 0;  // RSSI of the last frame stored in csi_buffer
+
+#define CSI_MAX_LINES CSI_MAX_APS  // Text lines stored per cycle, one per AP visit
+#define CSI_TEXT_LINE_MAX 704  // Longest text line: RSSI, length and 128 values of up to 4 characters
+#ifndef CONFIG_CSI_ARENA_SIZE
+#define CONFIG_CSI_ARENA_SIZE (8 * 1024)  // Per-cycle memory: the text lines of CSI_MAX_APS visits with typical values
+#endif
+
+// The cycle's text lines live in csi_arena, released by csi_cycle_reset
+alignas(ARENA_ALIGN) uint8_t csi_arena_buffer[CONFIG_CSI_ARENA_SIZE];
+arena_t csi_arena = ARENA_INITIALIZER("csi", csi_arena_buffer);
+const char *csi_lines[CSI_MAX_LINES];  // Text line of each AP's first frame this cycle
+size_t csi_line_count = 0;
+uint32_t csi_cycle = 0;  // Counts csi_cycle_reset calls, a deferred line from an earlier cycle is not stored
+char csi_text_line[CSI_TEXT_LINE_MAX];  // Formatting scratch of the log task
 
-std::vector<std::string> csi_data_vector;  // Vector to store CSI data
 bool data_collected = false;  // Flag to indicate if data has been collected
 
 // Structure to store CSI data
@@ -55,6 +104,77 @@ int get_csi_data(size_t offset, size_t length, float *out_ptr) {
     return 0;  // Return 0 if successful
 }
 
+#define CSI_FEATURES_PER_AP (1 + CSI_STREAM_LEN)  // The AP's RSSI, then its CSI values
+
+const norm_table_t *csi_norm = NULL;  // Standardization csi_complete applies, NULL for the raw values
+
+// Number of features csi_complete can assemble: every AP that fits in csi_buffer
+size_t csi_feature_count() {
+    return csi_buffer_size / CSI_FEATURES_PER_AP * CSI_FEATURES_PER_AP;
+}
+
+// Have csi_complete standardize the features with a table fitted by tools/csi_norm (csi_norm_table.h), or pass
+// the raw values with NULL. Returns false if the table was fitted for a different number of features.
+bool csi_set_normalization(const norm_table_t *table) {
+    if (table != NULL && table->features != csi_feature_count()) {
+        printf("ERROR: normalization table has %u features, the signal %u\n", (unsigned) table->features,
+               (unsigned) csi_feature_count());
+        return false;
+    }
+    csi_norm = table;
+    return true;
+}
+
+// Write `convert(i, x)` for the raw value x of every feature i in [offset, offset + length)
+template <typename T, typename F>
+int _csi_assemble(size_t offset, size_t length, T *out, F convert) {
+    if (offset + length > csi_feature_count()) {
+        return -1;  // Past the last AP that fits in csi_buffer
+    }
+
+    size_t i = 0;
+    while (i < length) {
+        size_t ap = (offset + i) / CSI_FEATURES_PER_AP;
+        size_t within = (offset + i) % CSI_FEATURES_PER_AP;
+        if (within == 0) {
+            out[i] = convert(offset + i, rssi_chain[ap]);
+            i++;
+            within++;
+        }
+
+        // The AP's CSI values are contiguous in csi_buffer, a loop without branches the compiler vectorizes
+        size_t run = std::min(length - i, CSI_FEATURES_PER_AP - within);
+        const int *values = csi_buffer + ap * CSI_STREAM_LEN + within - 1;
+        for (size_t k = 0; k < run; k++) {
+            out[i + k] = convert(offset + i + k, values[k]);
+        }
+        i += run;
+    }
+    return 0;
+}
+
+// signal_t::get_data for run_classifier: for every AP visited in the cycle its RSSI (rssi_chain) followed by
+// the CSI_STREAM_LEN values the callback stored in csi_buffer. Writes features [offset, offset + length),
+// standardized in the same pass if csi_set_normalization was given a table.
+int csi_complete(size_t offset, size_t length, float *out_ptr) {
+    const norm_table_t *norm = csi_norm;
+    if (norm == NULL) {
+        return _csi_assemble(offset, length, out_ptr, [](size_t, int32_t x) { return (float) x; });
+    }
+    return _csi_assemble(offset, length, out_ptr, [norm](size_t i, int32_t x) {
+        return norm_apply(norm, i, x) * NORM_Q_TO_FLOAT;
+    });
+}
+
+// csi_complete for integer models: the standardized features with NORM_FRAC_BITS fraction bits. Needs a table.
+int csi_complete_q(size_t offset, size_t length, int16_t *out_ptr) {
+    const norm_table_t *norm = csi_norm;
+    if (norm == NULL) {
+        return -1;
+    }
+    return _csi_assemble(offset, length, out_ptr, [norm](size_t i, int32_t x) { return norm_apply(norm, i, x); });
+}
+
 // Function to retrieve location and update coordinates
 void get_location(int &ub_x, int &ub_y) {
     x = ub_x;
@@ -68,66 +188,214 @@ void get_AP(const char* ACCESS_POINT) {
         current_AP = ACCESS_POINT;
         data_collected = false;  // Reset flag when AP changes
     }
+
+    // Look the AP up in the AP table, adding it if it is new
+    uint8_t id = 0;
+    while (id < ap_count && strcmp(ap_table[id], ACCESS_POINT) != 0) {
+        id++;
+    }
+    if (id == ap_count && ap_count < CSI_MAX_APS) {
+        ap_table[ap_count++] = ACCESS_POINT;
+    }
+    current_AP_id = id;
+}
+
+// Capture time of a CSI frame in microseconds: the collector's timebase once time_sync has a fit
+int64_t _csi_timestamp_us() {
+    return time_now_us();
+}
+
+// Queue a raw CSI record for the socket transmitter (the caller must hold the mutex)
+void _csi_stream_push(wifi_csi_info_t *data) {
+    size_t slot;
+    if (csi_stream_count == CSI_STREAM_QUEUE_LEN) {
+        slot = csi_stream_head;  // Overwrite the oldest record, the collector sees the gap in seq
+        csi_stream_head = (csi_stream_head + 1) % CSI_STREAM_QUEUE_LEN;
+        csi_stream_dropped++;
+        metric_add(&csi_dropped_metric, csi_stream_queue[slot].record.ap_id);
+    } else {
+        slot = (csi_stream_head + csi_stream_count) % CSI_STREAM_QUEUE_LEN;
+        csi_stream_count++;
+    }
+    metric_add(&csi_accepted_metric, current_AP_id);
+    metric_set(&csi_queue_metric, (int32_t) csi_stream_count);
+
+    csi_stream_entry_t *e = &csi_stream_queue[slot];
+    uint16_t len = data->len < CSI_STREAM_LEN ? data->len : CSI_STREAM_LEN;
+    memcpy(e->payload, data->buf, len);
+
+    e->record.seq = csi_stream_seq++;
+    e->record.timestamp_us = _csi_timestamp_us();
+    e->record.device_id = csi_device_id;
+    e->record.ap_id = current_AP_id;
+    e->record.rssi = data->rx_ctrl.rssi;
+    e->record.flags = CSI_RECORD_FLAG_RAW;
+    e->record.len = len;
+    e->record.data = e->payload;
 }
 
-// Callback function for WiFi CSI data
-void _wifi_csi_cb(void *ctx, wifi_csi_info_t *data) {
+// Take the oldest queued CSI record. Returns false if there is none.
+bool csi_stream_pop(csi_stream_entry_t *out) {
     std::lock_guard<std::mutex> lock(mutex);  // Lock mutex
+    if (csi_stream_count == 0) {
+        return false;
+    }
+
+    csi_stream_entry_t *e = &csi_stream_queue[csi_stream_head];
+    out->record = e->record;
+    memcpy(out->payload, e->payload, e->record.len);
+    out->record.data = out->payload;
+
+    csi_stream_head = (csi_stream_head + 1) % CSI_STREAM_QUEUE_LEN;
+    csi_stream_count--;
+    metric_set(&csi_queue_metric, (int32_t) csi_stream_count);
+    return true;
+}
+
+#define CSI_TEXT_SLOTS 4  // First frames per AP waiting for the log task to format them
+
+// Copy of a frame whose text line is formatted on the log task
+typedef struct {
+    std::atomic<bool> busy;
+    uint32_t cycle;  // csi_cycle when the frame was captured
+    int rssi;
+    uint16_t len;
+    int8_t buf[CSI_STREAM_LEN];
+} csi_text_slot_t;
+
+csi_text_slot_t csi_text_slots[CSI_TEXT_SLOTS];
+
+// Append v and a space to the line in `out` (snprintf without its cost, the line is formatted per frame)
+inline void _csi_append_int(char *out, size_t size, size_t *len, int v) {
+    char digits[12];
+    size_t n = 0;
+    unsigned u = v < 0 ? 0u - (unsigned) v : (unsigned) v;
+    do {
+        digits[n++] = (char) ('0' + u % 10);
+        u /= 10;
+    } while (u > 0);
+    if (v < 0) {
+        digits[n++] = '-';
+    }
+    if (*len + n + 1 >= size) {
+        return;  // Does not fit, CSI_TEXT_LINE_MAX is sized so that it always does
+    }
+    while (n > 0) {
+        out[(*len)++] = digits[--n];
+    }
+    out[(*len)++] = ' ';
+}
+
+// The values of a frame as the text lines show them (CSI_TYPE), each followed by a space
+inline size_t _csi_format_values(char *out, size_t size, size_t len, const int8_t *my_ptr) {
+    int data_len = CSI_STREAM_LEN;
+    #if CSI_RAW
+        for (int i = 0; i < data_len; i++) {
+            _csi_append_int(out, size, &len, my_ptr[i]);
+        }
+    #endif
+    #if CSI_AMPLITUDE
+        for (int i = 0; i < data_len / 2; i++) {
+            _csi_append_int(out, size, &len, (int) sqrt(pow(my_ptr[i * 2], 2) + pow(my_ptr[(i * 2) + 1], 2)));
+        }
+    #endif
+    #if CSI_PHASE
+        for (int i = 0; i < data_len / 2; i++) {
+            _csi_append_int(out, size, &len, (int) atan2(my_ptr[i*2], my_ptr[(i*2)+1]));
+        }
+    #endif
+    return len;
+}
+
+// Keep a text line of cycle `cycle` in the arena (the caller must hold the mutex)
+void _csi_store_line(const char *line, size_t len, uint32_t cycle) {
+    if (cycle != csi_cycle) {
+        return;  // Formatted after csi_cycle_reset, the line belongs to a cycle that is gone
+    }
+    char *copy = csi_line_count < CSI_MAX_LINES ? arena_strndup(&csi_arena, line, len) : NULL;
+    if (copy == NULL) {
+        metric_add(&csi_lines_lost_metric);
+        LOG_E("csi", "no room for the text line of %s, %u of %u arena bytes used", current_AP,
+              (unsigned) csi_arena.used, (unsigned) csi_arena.size);
+        return;
+    }
+    csi_lines[csi_line_count++] = copy;
+}
 
-    if (!data_collected) {
-        std::stringstream ss;
+// Format, store and print the text line of a captured frame (runs on the log task)
+size_t _csi_text_render(void *ctx, char *out, size_t size) {
+    ARENA_NO_HEAP;
+    csi_text_slot_t *slot = (csi_text_slot_t *) ctx;
+    char *line = csi_text_line;
+    int prefix = snprintf(line, CSI_TEXT_LINE_MAX, "CSI packet: %d, %u, [", slot->rssi, (unsigned) slot->len);
+    size_t len = std::min((size_t) prefix, (size_t) CSI_TEXT_LINE_MAX - 3);
+    len = _csi_format_values(line, CSI_TEXT_LINE_MAX - 2, len, slot->buf);  // Leaves room for "]\n"
+    line[len++] = ']';
+    line[len++] = '\n';
+    line[len] = '\0';
+    uint32_t cycle = slot->cycle;
+    slot->busy = false;
+
+    {
+        std::lock_guard<std::mutex> lock(mutex);  // Lock mutex
+        _csi_store_line(line, len, cycle);  // Store CSI data for the cycle
+    }
 
-        wifi_csi_info_t d = data[0];
-        char mac[20] = {0};
-        sprintf(mac, "%02X:%02X:%02X:%02X:%02X:%02X", d.mac[0], d.mac[1], d.mac[2], d.mac[3], d.mac[4], d.mac[5]);
+    len = len < size ? len : size - 1;
+    memcpy(out, line, len);  // Printed as is, without a log prefix
+    return len;
+}
 
-        rssi_value = d.rx_ctrl.rssi;
+// Callback function for WiFi CSI data. Runs on the Wi-Fi task: the text line is left to the log task.
+void _wifi_csi_cb(void *, wifi_csi_info_t *data) {
+    ARENA_NO_HEAP;
+    METRICS_SCOPE(csi_cb_metric);
+    std::lock_guard<std::mutex> lock(mutex);  // Lock mutex
+    metric_add(&csi_rx_metric, current_AP_id);
+
+    _csi_stream_push(data);  // Every frame is streamed, not only the first one per AP
+
+    if (data_collected) {
+        metric_add(&csi_skipped_metric, current_AP_id);
+    } else {
+        csi_text_slot_t *slot = NULL;
+        for (int i = 0; i < CSI_TEXT_SLOTS && slot == NULL; i++) {
+            bool expected = false;
+            if (csi_text_slots[i].busy.compare_exchange_strong(expected, true)) {
+                slot = &csi_text_slots[i];
+            }
+        }
+        if (slot == NULL) {
+            metric_add(&csi_line_busy_metric);
+            return;  // The log task is behind, take a later frame
+        }
 
-        ss << "CSI packet: "
-           << d.rx_ctrl.rssi << ", "
-           << data->len << ", [";
+        rssi_value = data->rx_ctrl.rssi;
 
         int data_len = 128;
 
         // Store CSI data in the global buffer
-        if (csi_buffer_index + data_len <= csi_buffer_size) {
+        if ((size_t) (csi_buffer_index + data_len) <= csi_buffer_size) {
             for (int i = 0; i < data_len; i++) {
                 csi_buffer[csi_buffer_index++] = data->buf[i];
             }
         } else {
-            std::cerr << "ERROR: Buffer overflow\n";
+            metric_add(&csi_overflows_metric);
+            LOG_E("csi", "buffer overflow, %d of %u values used", csi_buffer_index, (unsigned) csi_buffer_size);
         }
 
-        int8_t *my_ptr;
-        #if CSI_RAW
-            my_ptr = data->buf;
-            for (int i = 0; i < data_len; i++) {
-                ss << (int) my_ptr[i] << " ";
-            }
-        #endif
-        #if CSI_AMPLITUDE
-            my_ptr = data->buf;
-            for (int i = 0; i < data_len / 2; i++) {
-                ss << (int) sqrt(pow(my_ptr[i * 2], 2) + pow(my_ptr[(i * 2) + 1], 2)) << " ";
-            }
-        #endif
-        #if CSI_PHASE
-            my_ptr = data->buf;
-            for (int i = 0; i < data_len / 2; i++) {
-                ss << (int) atan2(my_ptr[i*2], my_ptr[(i*2)+1]) << " ";
-            }
-        #endif
-        ss << "]\n";
-
-        csi_data_vector.push_back(ss.str());  // Store CSI data in vector
-
-        printf(ss.str().c_str());
-        fflush(stdout);
+        uint16_t len = data->len < CSI_STREAM_LEN ? data->len : CSI_STREAM_LEN;
+        memcpy(slot->buf, data->buf, len);
+        memset(slot->buf + len, 0, CSI_STREAM_LEN - len);
+        slot->cycle = csi_cycle;
+        slot->rssi = data->rx_ctrl.rssi;
+        slot->len = data->len;
+        if (!log_deferred(&log_ring, LOG_LEVEL_INFO, &_csi_text_render, slot)) {
+            slot->busy = false;  // Ring full, the line is lost but the buffer has the frame
+        }
 
         data_collected = true;  // Set flag to true after data collection
     }
-
-    std::this_thread::sleep_for(std::chrono::milliseconds(10));  // Simulate delay
 }
 
 // Function to print CSV header for CSI data
@@ -136,46 +404,20 @@ void _print_csi_csv_header() {
     printf(header_str);
 }
 
-// Function to collect CSI data and store it in a vector
-void collect_csi_data(wifi_csi_info_t *data) {
+// Function to print all stored CSI data
+void print_stored_csi_data() {
     std::lock_guard<std::mutex> lock(mutex);  // Lock mutex
-
-    if (!data_collected) {
-        std::stringstream ss;
-
-        int data_len = 128;  // Adjust length as needed
-
-        int8_t *my_ptr;
-        #if CSI_RAW
-            my_ptr = data->buf;
-            for (int i = 0; i < data_len; i++) {
-                ss << (int) my_ptr[i] << " ";
-            }
-        #endif
-        #if CSI_AMPLITUDE
-            my_ptr = data->buf;
-            for (int i = 0; i < data_len / 2; i++) {
-                ss << (int) sqrt(pow(my_ptr[i * 2], 2) + pow(my_ptr[(i * 2) + 1], 2)) << " ";
-            }
-        #endif
-        #if CSI_PHASE
-            my_ptr = data->buf;
-            for (int i = 0; i < data_len / 2; i++) {
-                ss << (int) atan2(my_ptr[i * 2], my_ptr[(i * 2) + 1]) << " ";
-            }
-        #endif
-        ss << "]";
-
-        csi_data_vector.push_back(ss.str());  // Store CSI data in vector
+    for (size_t i = 0; i < csi_line_count; i++) {
+        printf("%s\n", csi_lines[i]);
     }
 }
 
-// Function to print all stored CSI data
-void print_stored_csi_data() {
+// Release the cycle's text lines, before the next cycle's first frame
+void csi_cycle_reset() {
     std::lock_guard<std::mutex> lock(mutex);  // Lock mutex
-    for (const auto &data : csi_data_vector) {
-        printf("%s\n", data.c_str());
-    }
+    arena_reset(&csi_arena);
+    csi_line_count = 0;
+    csi_cycle++;
 }
 
 // Function to reset data collection flag
@@ -188,26 +430,18 @@ void reset_data_collected_flag() {
 void csi_init(char *type) {
     project_type = type;
 
-    ESP_ERROR_CHECK(esp_wifi_set_csi(1));
-
-    wifi_csi_config_t configuration_csi;
-    configuration_csi.lltf_en = 1;
-    configuration_csi.htltf_en = 1;
-    configuration_csi.stbc_htltf2_en = 1;
-    configuration_csi.ltf_merge_en = 1;
-    configuration_csi.channel_filter_en = 0;
-    configuration_csi.manu_scale = 0;
+    uint8_t sta_mac[6];
+    hal_station_mac(sta_mac);
+    csi_device_id = (sta_mac[4] << 8) | sta_mac[5];  // Low bytes of the station MAC
 
-    ESP_ERROR_CHECK(esp_wifi_set_csi_config(&configuration_csi));
-    ESP_ERROR_CHECK(esp_wifi_set_csi_rx_cb(&_wifi_csi_cb, NULL));
+    hal_csi_start(&_wifi_csi_cb, NULL);
 
     _print_csi_csv_header();
 }
 
 // Deinitialization function for CSI settings
 void csi_deinit() {
-    ESP_ERROR_CHECK(esp_wifi_set_csi(0));
-    ESP_ERROR_CHECK(esp_wifi_set_csi_rx_cb(NULL, NULL));
+    hal_csi_stop();
 }
 
-#endif // ESP32_CSI_CSI_COMPONENT_H
\ No newline at end of file
+#endif // ESP32_CSI_CSI_COMPONENT_H
\ No newline at end of file
@@ -1,4 +1,60 @@
-void run_ei() {
+#include "mqtt_publisher_component.h"
+#include "command_component.h"
+#include "log_component.h"
+
+#define MQTT_BROKER_IP "192.168.1.100"  // Broker reachable from the network joined by setup_wifi()
+#define MQTT_BROKER_PORT 1883
+#define MQTT_TOPIC "csi/inference"
+
+mqtt_publisher_t publisher;  // Publishes inference results in the background
+command_channel_t commands;  // UDP commands; serial lines are fed from loop()
+command_reader_t serial_commands;  // Bounded line buffer for commands typed on the serial monitor
+std::atomic<float> inference_threshold{0.0f};  // Results below this confidence are not published (THRESHOLD)
+METRICS_HISTOGRAM(ei_cycle_metric, "ei.cycle_us");  // run_ei(), inference and submit to the publisher
+
+// THRESHOLD <0..1>
+bool command_threshold(int argc, char **argv, char *reply, size_t reply_size) {
+    float threshold;
+    if (argc != 2 || !command_parse_float(argv[1], 0.0f, 1.0f, &threshold)) {
+        return false;
+    }
+    inference_threshold = threshold;
+    snprintf(reply, reply_size, "threshold %.3f", threshold);
+    return true;
+}
+
+// HEAP: the cycle's arena and the heap's low-water mark
+bool command_heap(int, char **, char *reply, size_t reply_size) {
+    std::lock_guard<std::mutex> lock(mutex);
+    arena_report(&csi_arena, reply, reply_size);
+    return true;
+}
+
+// The log task writes to the serial port, run_ei() only queues its messages
+void serial_log_output(void *, const char *text, size_t len) {
+    Serial.write((const uint8_t *) text, len);
+}
+
+void serial_reply(void *, const char *reply) {
+    Serial.println(reply);
+}
+
+// Wait `ms` while answering commands that arrive on the serial port, and export the metrics when due
+void serial_commands_wait(unsigned long ms) {
+    unsigned long start = millis();
+    do {
+        metrics_exporter_poll(&metrics_exporter);  // Once METRICS <ip> started it
+        while (Serial.available() > 0) {
+            char c = (char) Serial.read();
+            command_feed(&serial_commands, &c, 1, &serial_reply, NULL);
+        }
+        delay(10);
+    } while (millis() - start < ms);
+}
+
+// Classify the cycle's CSI and queue the result for the broker. Returns early when there is nothing to
+// publish; run_ei() resets the cycle either way.
+void classify_and_publish() {
     signal_t signal;
     signal.total_length = SIZE_SUB_ARRAY;  // Set the total length of the signal to the size of the sub-array
     // signal.get_data = &csi_complete;  // Set the function to get CSI data (commented out)
@@ -8,48 +64,59 @@ void run_ei() {
     EI_IMPULSE_ERROR err = run_classifier(&signal, &result, true);  // Run the classifier on the signal
     
     if (err != EI_IMPULSE_OK) {  // Check if there was an error during classification
-        Serial.println("Classification error.");
+        LOG_E("ei", "classification error %d", (int) err);
         return;
     }
 
-    Serial.println("Predictions:");  // Print the predictions
     float max_value = -1.0;  // Initialize the maximum value to a very low number
     const char* max_label = nullptr;  // Initialize the label for the highest value
+    size_t max_index = 0;  // Label id sent to the broker
 
     // Iterate through all classification labels and values
     for (size_t ix = 0; ix < EI_CLASSIFIER_LABEL_COUNT; ix++) {
-        Serial.print(result.classification[ix].label);  // Print the label
-        Serial.print(": ");
-        Serial.print(result.classification[ix].value * 100, 2);  // Print the confidence value as percentage
-        Serial.println("%");
+        LOG_I("ei", "prediction %s: %.2f%%", result.classification[ix].label, result.classification[ix].value * 100);
 
         // Update the maximum label and value if a higher value is found
         if (result.classification[ix].value > max_value) {
             max_value = result.classification[ix].value;
             max_label = result.classification[ix].label;
+            max_index = ix;
         }
     }
 
     // Print the highest classification label and confidence
-    Serial.print("Classification: ");
-    Serial.print(max_label);
-    Serial.print(" with a confidence of ");
-    Serial.print(max_value * 100, 2);  // Print the maximum confidence percentage
-    Serial.println("%");
+    LOG_I("ei", "classification: %s with a confidence of %.2f%%", max_label, max_value * 100);
 
-    setup_wifi();  // Setup WiFi connection
-    send_inference(max_label, max_value);  // Send the inference result
+    if (max_value < inference_threshold) {
+        LOG_I("ei", "below the threshold %.2f, not published", (float) inference_threshold);
+        return;
+    }
 
-    reset_csi_buffer();  // Reset the CSI data buffer
-    csi_data_vector.clear();  // Clear the stored CSI data
+    // Queue the result, the publisher task sends it without blocking the next cycle
+    inference_result_t inference;
+    inference.timestamp_us = _mqtt_now_us();
+    inference.label_id = (uint8_t) max_index;
+    inference.flags = INFERENCE_FLAG_GROUND_TRUTH;  // The classifier infers a label only, x/y are the test's position
+    inference.confidence_q15 = (uint16_t) (max_value * 32767.0f + 0.5f);
+    inference.x = (int16_t) x_location;
+    inference.y = (int16_t) y_location;
+    mqtt_publisher_submit(&publisher, &inference);
 }
 
 void reset_csi_buffer() {
     csi_buffer_index = 0;  // Reset the index for the CSI buffer
 }
 
+// One inference; the next cycle starts from an empty buffer and arena whatever the classifier did
+void run_ei() {
+    classify_and_publish();
+    reset_csi_buffer();  // Reset the CSI data buffer
+    csi_cycle_reset();  // Release the stored CSI data
+}
+
 void setup() {
   Serial.begin(115200);  // Start serial communication at 115200 baud rate
+  log_start(&log_ring, &serial_log_output, NULL);
 
   WiFi.mode(WIFI_STA);  // Set WiFi mode to station (STA)
   Serial.println("------------------------------------------------------------------------------");
@@ -70,6 +137,15 @@ void setup() {
   }
 
   csi_buffer_index = 0;  // Initialize CSI buffer index
+
+  setup_wifi();  // Connect once, the publisher reconnects to the broker on its own
+  mqtt_publisher_start(&publisher, MQTT_BROKER_IP, MQTT_BROKER_PORT, MQTT_TOPIC,
+                       WiFi.macAddress().c_str(), 0, &isWiFiConnected);
+
+  command_register("THRESHOLD", "<confidence 0..1>", &command_threshold);
+  command_register("HEAP", "", &command_heap);
+  command_register("METRICS", "[ip [port] [interval ms] | OFF]", &metrics_command);
+  command_start(&commands, -1, -1, COMMAND_UDP_PORT);
 }
 
 void loop() {
@@ -120,7 +196,10 @@ void loop() {
   */
 
   // Run the Edge Impulse classifier
-  run_ei();
+  {
+    METRICS_SCOPE(ei_cycle_metric);
+    run_ei();
+  }
 
   Serial.println("ENDING TEST");
   Serial.println("------------------------------------------------------------------------------");
@@ -129,7 +208,7 @@ void loop() {
   Serial.println("|                                 reset?                                     |");
   Serial.println("|                                                                            |");
   Serial.println("------------------------------------------------------------------------------");
-  delay(5000);  // Wait for 5 seconds before ending the test
+  serial_commands_wait(5000);  // Wait for 5 seconds before ending the test, answering commands meanwhile
 
   /*
   The following commented-out section was designed to allow for a reset after the test.
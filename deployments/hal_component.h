@@ -0,0 +1,407 @@
+#ifndef ESP32_CSI_HAL_COMPONENT_H
+#define ESP32_CSI_HAL_COMPONENT_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <sys/stat.h>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <thread>
+
+#ifdef ESP_PLATFORM
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "esp_err.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "esp_wifi.h"
+#include "nvs_flash.h"
+#include "esp_vfs_fat.h"
+#include "esp_partition.h"
+#include "esp_heap_caps.h"
+#include "esp_idf_version.h"
+#include "driver/sdmmc_host.h"
+#include "driver/sdspi_host.h"
+#include "sdmmc_cmd.h"
+#else
+#include <fcntl.h>
+#include <unistd.h>
+#include <malloc.h>
+#include <sys/mman.h>
+#endif
+
+/*
+ * The little the components need from the platform, so that they build on the station (ESP-IDF, and the
+ * Arduino sketches, which run on top of it) and natively on Linux for tools and benchmarks:
+ *   - CSI source: hal_csi_start() has the Wi-Fi driver call a callback with every wifi_csi_info_t. On Linux
+ *     nothing receives frames, hal_csi_inject() calls the callback on the caller's thread the way the Wi-Fi
+ *     task would (tools/csi_synth.h generates the frames).
+ *   - clock and delays: hal_monotonic_us(), hal_delay_ms() and hal_sleep_us(), the latter rounded down to
+ *     whole FreeRTOS ticks on the station.
+ *   - NVS: hal_nvs_init(), nothing to do on Linux.
+ *   - file system: hal_fs_mount() mounts the SD card at HAL_FS_ROOT. On Linux HAL_FS_ROOT is a directory
+ *     (CONFIG_HAL_FS_ROOT), created if missing.
+ *   - read-only mappings: hal_map_partition() maps a data partition of the flash into the address space,
+ *     hal_map_file() loads a file (FAT on the SD card cannot be mapped) into a heap buffer aligned to
+ *     HAL_MAP_ALIGN. On Linux both mmap a file, a partition being CONFIG_HAL_PARTITION_DIR/<label>.bin.
+ *   - heap: hal_heap_info() gives the free heap, its low-water mark since boot and the largest free block.
+ *     On Linux the allocator's free bytes (mallinfo2), the low-water mark being the lowest any call saw.
+ * Threads, mutexes and condition variables are the std:: ones, which ESP-IDF runs as FreeRTOS tasks through
+ * its pthread layer, and sockets are BSD sockets on both (lwIP on the station), so they need no shim.
+ */
+
+#ifdef ESP_PLATFORM
+#define HAL_FS_ROOT "/sdcard"
+#define HAL_SLEEP_RESOLUTION_US (portTICK_PERIOD_MS * 1000)
+#else
+#ifndef CONFIG_HAL_FS_ROOT
+#define CONFIG_HAL_FS_ROOT "sdcard"
+#endif
+#ifndef CONFIG_HAL_PARTITION_DIR
+#define CONFIG_HAL_PARTITION_DIR "partitions"
+#endif
+#define HAL_FS_ROOT CONFIG_HAL_FS_ROOT
+#define HAL_SLEEP_RESOLUTION_US 100
+#endif
+#define HAL_MAP_ALIGN 16
+
+// A read-only region from hal_map_partition or hal_map_file, released by hal_unmap
+typedef struct {
+    const uint8_t *data;
+    size_t size;
+    void *buffer; // Heap copy of a file, or NULL
+#ifdef ESP_PLATFORM
+    bool mapped;
+#if ESP_IDF_VERSION >= ESP_IDF_VERSION_VAL(5, 0, 0)
+    esp_partition_mmap_handle_t handle;
+#else
+    spi_flash_mmap_handle_t handle;
+#endif
+#else
+    void *mapping; // mmap'd file, or NULL
+#endif
+} hal_map_t;
+
+// Heap of 8-bit capable memory, from hal_heap_info
+typedef struct {
+    size_t free_bytes;
+    size_t min_free_bytes; // Low-water mark
+    size_t largest_free_block;
+} hal_heap_t;
+
+// SPI pins of the SD card slot
+typedef struct {
+    int miso;
+    int mosi;
+    int clk;
+    int cs;
+} hal_sd_pins_t;
+
+#ifndef ESP_PLATFORM
+// Layout of the esp_wifi types the CSI callback receives (ESP-IDF 4.4 / 5.x, ESP32)
+typedef struct {
+    signed rssi : 8;
+    unsigned rate : 5;
+    unsigned : 1;
+    unsigned sig_mode : 2;
+    unsigned : 16;
+    unsigned mcs : 7;
+    unsigned cwb : 1;
+    unsigned : 16;
+    unsigned smoothing : 1;
+    unsigned not_sounding : 1;
+    unsigned : 1;
+    unsigned aggregation : 1;
+    unsigned stbc : 2;
+    unsigned fec_coding : 1;
+    unsigned sgi : 1;
+    signed noise_floor : 8;
+    unsigned ampdu_cnt : 8;
+    unsigned channel : 4;
+    unsigned secondary_channel : 4;
+    unsigned : 8;
+    unsigned timestamp : 32;
+    unsigned : 32;
+    unsigned : 31;
+    unsigned ant : 1;
+    unsigned sig_len : 12;
+    unsigned : 12;
+    unsigned rx_state : 8;
+} wifi_pkt_rx_ctrl_t;
+
+typedef struct {
+    wifi_pkt_rx_ctrl_t rx_ctrl;
+    uint8_t mac[6];
+    uint8_t dmac[6];
+    bool first_word_invalid;
+    int8_t *buf;
+    uint16_t len;
+} wifi_csi_info_t;
+#endif
+
+typedef void (*hal_csi_cb_t)(void *ctx, wifi_csi_info_t *data);
+
+#ifdef ESP_PLATFORM
+
+inline int64_t hal_monotonic_us() {
+    return esp_timer_get_time();
+}
+
+inline void hal_delay_ms(uint32_t ms) {
+    vTaskDelay(ms / portTICK_PERIOD_MS);
+}
+
+inline void hal_sleep_us(int64_t duration_us) {
+    TickType_t ticks = (TickType_t) (duration_us / HAL_SLEEP_RESOLUTION_US);
+    if (ticks > 0) {
+        vTaskDelay(ticks);
+    }
+}
+
+inline void hal_station_mac(uint8_t mac[6]) {
+    ESP_ERROR_CHECK(esp_wifi_get_mac(WIFI_IF_STA, mac));
+}
+
+// LLTF, HT-LTF and STBC HT-LTF merged into one buffer per frame, delivered to `cb` on the Wi-Fi task
+inline void hal_csi_start(hal_csi_cb_t cb, void *ctx) {
+    ESP_ERROR_CHECK(esp_wifi_set_csi(1));
+
+    wifi_csi_config_t configuration_csi;
+    configuration_csi.lltf_en = 1;
+    configuration_csi.htltf_en = 1;
+    configuration_csi.stbc_htltf2_en = 1;
+    configuration_csi.ltf_merge_en = 1;
+    configuration_csi.channel_filter_en = 0;
+    configuration_csi.manu_scale = 0;
+
+    ESP_ERROR_CHECK(esp_wifi_set_csi_config(&configuration_csi));
+    ESP_ERROR_CHECK(esp_wifi_set_csi_rx_cb(cb, ctx));
+}
+
+inline void hal_csi_stop() {
+    ESP_ERROR_CHECK(esp_wifi_set_csi(0));
+    ESP_ERROR_CHECK(esp_wifi_set_csi_rx_cb(NULL, NULL));
+}
+
+inline void hal_nvs_init() {
+    esp_err_t ret = nvs_flash_init();
+    if (ret == ESP_ERR_NVS_NO_FREE_PAGES || ret == ESP_ERR_NVS_NEW_VERSION_FOUND) {
+        ESP_ERROR_CHECK(nvs_flash_erase());
+        ret = nvs_flash_init();
+    }
+    ESP_ERROR_CHECK(ret);
+}
+
+inline bool hal_fs_mount(const hal_sd_pins_t *pins, size_t allocation_unit_size) {
+    sdmmc_host_t host = SDSPI_HOST_DEFAULT();
+    sdspi_slot_config_t slot_config = SDSPI_SLOT_CONFIG_DEFAULT();
+    slot_config.gpio_miso = (gpio_num_t) pins->miso;
+    slot_config.gpio_mosi = (gpio_num_t) pins->mosi;
+    slot_config.gpio_sck = (gpio_num_t) pins->clk;
+    slot_config.gpio_cs = (gpio_num_t) pins->cs;
+
+    esp_vfs_fat_sdmmc_mount_config_t mount_config = {
+            .format_if_mount_failed = false,
+            .max_files = 1,
+            .allocation_unit_size = allocation_unit_size
+    };
+
+    sdmmc_card_t *card;
+    esp_err_t ret = esp_vfs_fat_sdmmc_mount(HAL_FS_ROOT, &host, &slot_config, &mount_config, &card);
+
+    if (ret != ESP_OK) {
+        if (ret == ESP_FAIL) {
+            ESP_LOGE("sd.h",
+                     "Failed to mount filesystem. "
+                     "  If you want the card to be formatted, set format_if_mount_failed = true."
+            );
+        } else {
+            ESP_LOGE("sd.h",
+                     "Failed to initialize the card (%s). "
+                     "  If you do not have an SD card attached, please ignore this message."
+                     "  Make sure SD card lines have pull-up resistors in place.", esp_err_to_name(ret));
+        }
+        return false;
+    }
+    sdmmc_card_print_info(stdout, card);
+    return true;
+}
+
+// The whole data partition `label`, without copying it (flash is mapped in 64 KB pages)
+inline bool hal_map_partition(const char *label, hal_map_t *m) {
+    memset(m, 0, sizeof(*m));
+    const esp_partition_t *part = esp_partition_find_first(ESP_PARTITION_TYPE_DATA, ESP_PARTITION_SUBTYPE_ANY, label);
+    if (part == NULL) {
+        printf("ERROR: no data partition %s\n", label);
+        return false;
+    }
+    const void *data;
+#if ESP_IDF_VERSION >= ESP_IDF_VERSION_VAL(5, 0, 0)
+    esp_err_t ret = esp_partition_mmap(part, 0, part->size, ESP_PARTITION_MMAP_DATA, &data, &m->handle);
+#else
+    esp_err_t ret = esp_partition_mmap(part, 0, part->size, SPI_FLASH_MMAP_DATA, &data, &m->handle);
+#endif
+    if (ret != ESP_OK) {
+        printf("ERROR: cannot map partition %s [%s]\n", label, esp_err_to_name(ret));
+        return false;
+    }
+    m->data = (const uint8_t *) data;
+    m->size = part->size;
+    m->mapped = true;
+    return true;
+}
+
+inline bool hal_map_file(const char *path, hal_map_t *m) {
+    memset(m, 0, sizeof(*m));
+    FILE *f = fopen(path, "rb");
+    if (f == NULL) {
+        printf("ERROR: cannot open %s [%s]\n", path, strerror(errno));
+        return false;
+    }
+    struct stat st = {};
+    bool ok = fstat(fileno(f), &st) == 0 && st.st_size > 0;
+    if (ok) {
+        m->buffer = heap_caps_aligned_alloc(HAL_MAP_ALIGN, st.st_size, MALLOC_CAP_8BIT);
+        ok = m->buffer != NULL && fread(m->buffer, 1, st.st_size, f) == (size_t) st.st_size;
+    }
+    fclose(f);
+    if (!ok) {
+        printf("ERROR: cannot read %s (%ld bytes)\n", path, (long) st.st_size);
+        heap_caps_free(m->buffer);
+        m->buffer = NULL;
+        return false;
+    }
+    m->data = (const uint8_t *) m->buffer;
+    m->size = st.st_size;
+    return true;
+}
+
+inline void hal_unmap(hal_map_t *m) {
+    if (m->mapped) {
+#if ESP_IDF_VERSION >= ESP_IDF_VERSION_VAL(5, 0, 0)
+        esp_partition_munmap(m->handle);
+#else
+        spi_flash_munmap(m->handle);
+#endif
+    }
+    heap_caps_free(m->buffer);
+    memset(m, 0, sizeof(*m));
+}
+
+inline void hal_heap_info(hal_heap_t *heap) {
+    heap->free_bytes = heap_caps_get_free_size(MALLOC_CAP_8BIT);
+    heap->min_free_bytes = heap_caps_get_minimum_free_size(MALLOC_CAP_8BIT);
+    heap->largest_free_block = heap_caps_get_largest_free_block(MALLOC_CAP_8BIT);
+}
+
+#else
+
+// Where hal_csi_inject delivers frames
+typedef struct {
+    hal_csi_cb_t cb;
+    void *ctx;
+    uint8_t mac[6]; // Station MAC reported by hal_station_mac
+} hal_csi_source_t;
+
+hal_csi_source_t hal_csi_source = {NULL, NULL, {0x02, 0x00, 0x00, 0x00, 0x00, 0x01}};
+
+inline int64_t hal_monotonic_us() {
+    return std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+inline void hal_delay_ms(uint32_t ms) {
+    std::this_thread::sleep_for(std::chrono::milliseconds(ms));
+}
+
+inline void hal_sleep_us(int64_t duration_us) {
+    std::this_thread::sleep_for(std::chrono::microseconds(duration_us));
+}
+
+inline void hal_station_mac(uint8_t mac[6]) {
+    memcpy(mac, hal_csi_source.mac, 6);
+}
+
+inline void hal_csi_start(hal_csi_cb_t cb, void *ctx) {
+    hal_csi_source.ctx = ctx;
+    hal_csi_source.cb = cb;
+}
+
+inline void hal_csi_stop() {
+    hal_csi_source.cb = NULL;
+    hal_csi_source.ctx = NULL;
+}
+
+// Deliver a frame to the callback registered by hal_csi_start. Returns false if there is none.
+inline bool hal_csi_inject(const wifi_csi_info_t *data) {
+    if (hal_csi_source.cb == NULL) {
+        return false;
+    }
+    hal_csi_source.cb(hal_csi_source.ctx, (wifi_csi_info_t *) data);
+    return true;
+}
+
+inline void hal_nvs_init() {
+}
+
+inline bool hal_fs_mount(const hal_sd_pins_t *, size_t) {
+    if (mkdir(HAL_FS_ROOT, 0755) != 0 && errno != EEXIST) {
+        printf("ERROR: cannot create %s [%s]\n", HAL_FS_ROOT, strerror(errno));
+        return false;
+    }
+    return true;
+}
+
+// mmap, page aligned
+inline bool hal_map_file(const char *path, hal_map_t *m) {
+    memset(m, 0, sizeof(*m));
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        printf("ERROR: cannot open %s [%s]\n", path, strerror(errno));
+        return false;
+    }
+    struct stat st = {};
+    void *mapping = MAP_FAILED;
+    if (fstat(fd, &st) == 0 && st.st_size > 0) {
+        mapping = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    }
+    close(fd);
+    if (mapping == MAP_FAILED) {
+        printf("ERROR: cannot map %s [%s]\n", path, st.st_size > 0 ? strerror(errno) : "empty");
+        return false;
+    }
+    m->mapping = mapping;
+    m->data = (const uint8_t *) mapping;
+    m->size = st.st_size;
+    return true;
+}
+
+inline bool hal_map_partition(const char *label, hal_map_t *m) {
+    char path[256];
+    snprintf(path, sizeof(path), "%s/%s.bin", CONFIG_HAL_PARTITION_DIR, label);
+    return hal_map_file(path, m);
+}
+
+inline void hal_unmap(hal_map_t *m) {
+    if (m->mapping != NULL) {
+        munmap(m->mapping, m->size);
+    }
+    memset(m, 0, sizeof(*m));
+}
+
+inline void hal_heap_info(hal_heap_t *heap) {
+    static std::atomic<size_t> min_free{SIZE_MAX};
+    struct mallinfo2 info = mallinfo2();
+    heap->free_bytes = info.fordblks;
+    heap->largest_free_block = info.fordblks;
+    size_t seen = min_free;
+    while (info.fordblks < seen && !min_free.compare_exchange_weak(seen, info.fordblks)) {
+    }
+    heap->min_free_bytes = std::min(seen, (size_t) info.fordblks);
+}
+
+#endif
+
+#endif //ESP32_CSI_HAL_COMPONENT_H
@@ -0,0 +1,230 @@
+#ifndef ESP32_CSI_KERNEL_COMPONENT_H
+#define ESP32_CSI_KERNEL_COMPONENT_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+/*
+ * Integer kernels over CSI-sized vectors (128 to a few hundred int8 values): dot products, the int8 x int16
+ * GEMV of the model engine's int8 layers, L1 and squared L2 distance between fingerprints, per-subcarrier
+ * power and saturating add. Named the way ESP-NN names its kernels:
+ *   _ansi     plain C reference, never vectorized, what the others are checked against
+ *   _opt      C shaped for the auto-vectorizer: intermediates as narrow as the values allow (int8 products
+ *             in int16) and int32 accumulators, no early exits. GCC and Clang turn it into SSE/AVX/NEON on
+ *             the host; on the ESP32, which has no SIMD, it is the same scalar code. (GCC vector extensions
+ *             widened everything to 32 bit lanes and measured 1.3 to 4 times slower on x86.)
+ *   _esp32s3  PIE (ee.vmulas.*) versions for the ESP32-S3, meant to go in assembly next to the sketch like
+ *             ESP-NN's *_esp32s3.S. They are not written yet: the dispatchers keep their place (any
+ *             alignment through ee.ld.128.usar.ip, a multiple of 16 values, the rest finished with _ansi),
+ *             and CONFIG_KERNEL_ESP32S3_PIE stops the build until the .S files exist.
+ * The unsuffixed functions dispatch at compile time: _esp32s3 where enabled, else _opt, or _ansi with
+ * CONFIG_KERNEL_ANSI. All are exact, so every path gives the same result (tools/csi_kernel_bench checks it
+ * on random vectors).
+ */
+
+#if defined(__GNUC__) && !defined(__clang__)
+#define KERNEL_NO_VECTORIZE __attribute__((optimize("no-tree-vectorize")))
+#else
+#define KERNEL_NO_VECTORIZE
+#endif
+
+#define KERNEL_LANES 16 // int8 values in a 128 bit PIE register
+#define KERNEL_BLOCK 128 // int8 x int16 products summed in int32 before widening, 128 * 2^22 = 2^29
+
+#ifdef CONFIG_KERNEL_ESP32S3_PIE
+#error "CONFIG_KERNEL_ESP32S3_PIE: the _esp32s3 kernels (*_esp32s3.S) are not written yet, build without it"
+#endif
+
+#if defined(CONFIG_IDF_TARGET_ESP32S3) && defined(CONFIG_KERNEL_ESP32S3_PIE)
+#define KERNEL_PATH "esp32s3"
+extern "C" int32_t kernel_dot_s8_esp32s3(const int8_t *a, const int8_t *b, size_t n);
+extern "C" int32_t kernel_dot_s8s16_esp32s3(const int8_t *w, const int16_t *x, size_t n); // n <= KERNEL_BLOCK
+#elif defined(CONFIG_KERNEL_ANSI)
+#define KERNEL_PATH "ansi"
+#else
+#define KERNEL_PATH "opt"
+#endif
+
+inline int16_t _kernel_sat16(int32_t v) {
+    return (int16_t) (v > INT16_MAX ? INT16_MAX : (v < INT16_MIN ? INT16_MIN : v));
+}
+
+inline int32_t _kernel_sat32(int64_t v) {
+    return (int32_t) (v > INT32_MAX ? INT32_MAX : (v < INT32_MIN ? INT32_MIN : v));
+}
+
+// ---- _ansi
+
+KERNEL_NO_VECTORIZE inline int32_t kernel_dot_s8_ansi(const int8_t *a, const int8_t *b, size_t n) {
+    int32_t sum = 0;
+    for (size_t i = 0; i < n; i++) {
+        sum += (int32_t) a[i] * b[i];
+    }
+    return sum;
+}
+
+KERNEL_NO_VECTORIZE inline int64_t kernel_dot_s8s16_ansi(const int8_t *w, const int16_t *x, size_t n) {
+    int64_t sum = 0;
+    for (size_t i = 0; i < n; i++) {
+        sum += (int32_t) w[i] * x[i];
+    }
+    return sum;
+}
+
+KERNEL_NO_VECTORIZE inline uint32_t kernel_l1_s8_ansi(const int8_t *a, const int8_t *b, size_t n) {
+    uint32_t sum = 0;
+    for (size_t i = 0; i < n; i++) {
+        int32_t d = (int32_t) a[i] - b[i];
+        sum += (uint32_t) (d < 0 ? -d : d);
+    }
+    return sum;
+}
+
+KERNEL_NO_VECTORIZE inline uint32_t kernel_l2_s8_ansi(const int8_t *a, const int8_t *b, size_t n) {
+    uint32_t sum = 0;
+    for (size_t i = 0; i < n; i++) {
+        int32_t d = (int32_t) a[i] - b[i];
+        sum += (uint32_t) (d * d);
+    }
+    return sum;
+}
+
+// I^2 + Q^2 of interleaved pairs, as the CSI buffer holds them
+KERNEL_NO_VECTORIZE inline void kernel_power_s8_ansi(const int8_t *iq, uint16_t *out, size_t pairs) {
+    for (size_t i = 0; i < pairs; i++) {
+        out[i] = (uint16_t) ((int32_t) iq[2 * i] * iq[2 * i] + (int32_t) iq[2 * i + 1] * iq[2 * i + 1]);
+    }
+}
+
+KERNEL_NO_VECTORIZE inline void kernel_add_sat_s16_ansi(const int16_t *a, const int16_t *b, int16_t *out, size_t n) {
+    for (size_t i = 0; i < n; i++) {
+        out[i] = _kernel_sat16((int32_t) a[i] + b[i]);
+    }
+}
+
+// ---- _opt
+
+// Products of int8 fit int16, so the vectorizer multiplies 8 or 16 lanes at a time (pmaddwd, NEON smlal)
+inline int32_t kernel_dot_s8_opt(const int8_t *a, const int8_t *b, size_t n) {
+    int32_t sum = 0;
+    for (size_t i = 0; i < n; i++) {
+        sum += (int16_t) (a[i] * b[i]);
+    }
+    return sum;
+}
+
+// Summed in int32 per block, which the vectorizer keeps in 32 bit lanes, and only then widened
+inline int64_t kernel_dot_s8s16_opt(const int8_t *w, const int16_t *x, size_t n) {
+    int64_t sum = 0;
+    for (size_t i = 0; i < n; i += KERNEL_BLOCK) {
+        size_t end = i + KERNEL_BLOCK < n ? i + KERNEL_BLOCK : n;
+        int32_t block = 0;
+        for (size_t j = i; j < end; j++) {
+            block += (int32_t) w[j] * x[j];
+        }
+        sum += block;
+    }
+    return sum;
+}
+
+inline uint32_t kernel_l1_s8_opt(const int8_t *a, const int8_t *b, size_t n) {
+    uint32_t sum = 0;
+    for (size_t i = 0; i < n; i++) {
+        int16_t d = (int16_t) (a[i] - b[i]);
+        sum += (uint16_t) (d < 0 ? -d : d);
+    }
+    return sum;
+}
+
+inline uint32_t kernel_l2_s8_opt(const int8_t *a, const int8_t *b, size_t n) {
+    uint32_t sum = 0;
+    for (size_t i = 0; i < n; i++) {
+        int16_t d = (int16_t) (a[i] - b[i]);
+        sum += (uint32_t) (d * d);
+    }
+    return sum;
+}
+
+inline void kernel_power_s8_opt(const int8_t *iq, uint16_t *out, size_t pairs) {
+    for (size_t i = 0; i < pairs; i++) {
+        out[i] = (uint16_t) ((int16_t) (iq[2 * i] * iq[2 * i]) + (int16_t) (iq[2 * i + 1] * iq[2 * i + 1]));
+    }
+}
+
+inline void kernel_add_sat_s16_opt(const int16_t *a, const int16_t *b, int16_t *out, size_t n) {
+    for (size_t i = 0; i < n; i++) {
+        out[i] = _kernel_sat16((int32_t) a[i] + b[i]);
+    }
+}
+
+// ---- dispatch
+
+inline int32_t kernel_dot_s8(const int8_t *a, const int8_t *b, size_t n) {
+#if defined(CONFIG_IDF_TARGET_ESP32S3) && defined(CONFIG_KERNEL_ESP32S3_PIE)
+    size_t head = n & ~(size_t) (KERNEL_LANES - 1);
+    return kernel_dot_s8_esp32s3(a, b, head) + kernel_dot_s8_ansi(a + head, b + head, n - head);
+#elif defined(CONFIG_KERNEL_ANSI)
+    return kernel_dot_s8_ansi(a, b, n);
+#else
+    return kernel_dot_s8_opt(a, b, n);
+#endif
+}
+
+inline int64_t kernel_dot_s8s16(const int8_t *w, const int16_t *x, size_t n) {
+#if defined(CONFIG_IDF_TARGET_ESP32S3) && defined(CONFIG_KERNEL_ESP32S3_PIE)
+    int64_t sum = 0;
+    size_t i = 0;
+    while (n - i >= KERNEL_LANES) {
+        size_t len = n - i < KERNEL_BLOCK ? (n - i) & ~(size_t) (KERNEL_LANES - 1) : KERNEL_BLOCK;
+        sum += kernel_dot_s8s16_esp32s3(w + i, x + i, len);
+        i += len;
+    }
+    return sum + kernel_dot_s8s16_ansi(w + i, x + i, n - i);
+#elif defined(CONFIG_KERNEL_ANSI)
+    return kernel_dot_s8s16_ansi(w, x, n);
+#else
+    return kernel_dot_s8s16_opt(w, x, n);
+#endif
+}
+
+inline uint32_t kernel_l1_s8(const int8_t *a, const int8_t *b, size_t n) {
+#ifdef CONFIG_KERNEL_ANSI
+    return kernel_l1_s8_ansi(a, b, n);
+#else
+    return kernel_l1_s8_opt(a, b, n);
+#endif
+}
+
+inline uint32_t kernel_l2_s8(const int8_t *a, const int8_t *b, size_t n) {
+#ifdef CONFIG_KERNEL_ANSI
+    return kernel_l2_s8_ansi(a, b, n);
+#else
+    return kernel_l2_s8_opt(a, b, n);
+#endif
+}
+
+inline void kernel_power_s8(const int8_t *iq, uint16_t *out, size_t pairs) {
+#ifdef CONFIG_KERNEL_ANSI
+    kernel_power_s8_ansi(iq, out, pairs);
+#else
+    kernel_power_s8_opt(iq, out, pairs);
+#endif
+}
+
+inline void kernel_add_sat_s16(const int16_t *a, const int16_t *b, int16_t *out, size_t n) {
+#ifdef CONFIG_KERNEL_ANSI
+    kernel_add_sat_s16_ansi(a, b, out, n);
+#else
+    kernel_add_sat_s16_opt(a, b, out, n);
+#endif
+}
+
+// out[r] = bias[r] + w[r] . x for `rows` rows of `cols` int8 weights, saturated to int32
+inline void kernel_gemv_s8s16(const int8_t *w, const int16_t *x, size_t rows, size_t cols, const int32_t *bias,
+                              int32_t *out) {
+    for (size_t r = 0; r < rows; r++) {
+        out[r] = _kernel_sat32((int64_t) bias[r] + kernel_dot_s8s16(w + r * cols, x, cols));
+    }
+}
+
+#endif //ESP32_CSI_KERNEL_COMPONENT_H
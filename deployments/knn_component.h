@@ -0,0 +1,131 @@
+#ifndef ESP32_CSI_KNN_COMPONENT_H
+#define ESP32_CSI_KNN_COMPONENT_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+
+#include "hal_component.h"
+#include "model_component.h"  // model_result_t, the labels
+#include "kernel_component.h"
+
+/*
+ * k nearest neighbours over stored fingerprints, the other kind of fine model of a room
+ * (cascade_component.h): the room's survey samples with the location of each, written by tools/csi_cascade.
+ * A room has few survey points close together, and matching the fingerprint often places the station
+ * better than a regression over them.
+ *
+ *   blob:    header | label * outputs | targets | fingerprints
+ *   header:  magic "CSKN" (4) | version (2) | count (2) | features (2) | outputs (2) | k (1) | input_shift (1)
+ *            | reserved (2)
+ *   label:   name, zero padded to MODEL_LABEL_LEN
+ *   targets: outputs floats per fingerprint, the values knn_run reports (x, y in plan units)
+ *   fingerprints: features int8 each, zero padded to 4 bytes
+ *
+ * Like a model blob the kNN is used where it lies, 4-byte aligned. The inputs are the standardized
+ * features of csi_complete_q, shifted right by input_shift into int8 (4 fraction bits cover +-8 standard
+ * deviations). knn_run takes the k fingerprints nearest in squared L2 distance (kernel_l2_s8) and averages
+ * their targets weighted by the inverse distance.
+ */
+
+#define KNN_MAGIC 0x4E4B5343  // "CSKN"
+#define KNN_VERSION 1
+#define KNN_HEADER_SIZE 16
+#define KNN_MAX_K 8
+
+typedef struct {
+    uint16_t count;
+    uint16_t features;
+    uint16_t outputs;
+    uint8_t k;
+    uint8_t input_shift;
+    const char *labels[MODEL_MAX_OUTPUTS];  // Point into the blob
+    const float *targets;
+    const int8_t *fingerprints;
+    size_t blob_size;
+    int8_t query[MODEL_MAX_WIDTH];
+} knn_t;
+
+// Check a blob and point `n` into it. Returns false, printing why, if it is not a kNN this engine runs.
+inline bool knn_load(knn_t *n, const uint8_t *blob, size_t size) {
+    if (((uintptr_t) blob & 3) != 0 || size < KNN_HEADER_SIZE || _csi_get_u32(blob) != KNN_MAGIC ||
+        _csi_get_u16(blob + 4) != KNN_VERSION) {
+        printf("ERROR: not a kNN blob\n");
+        return false;
+    }
+    n->count = _csi_get_u16(blob + 6);
+    n->features = _csi_get_u16(blob + 8);
+    n->outputs = _csi_get_u16(blob + 10);
+    n->k = blob[12];
+    n->input_shift = blob[13];
+    n->blob_size = size;
+    size_t labels = KNN_HEADER_SIZE + (size_t) MODEL_LABEL_LEN * n->outputs;
+    size_t targets = labels + 4 * (size_t) n->count * n->outputs;
+    size_t fingerprints = ((size_t) n->count * n->features + 3) & ~(size_t) 3;
+    if (n->count == 0 || n->features == 0 || n->features > MODEL_MAX_WIDTH || n->outputs == 0 ||
+        n->outputs > MODEL_MAX_OUTPUTS || n->k == 0 || n->k > KNN_MAX_K || n->input_shift > 15 ||
+        targets + fingerprints != size) {
+        printf("ERROR: kNN of %u fingerprints (%u features, %u outputs, k %u) does not fit its %u bytes\n",
+               (unsigned) n->count, (unsigned) n->features, (unsigned) n->outputs, (unsigned) n->k, (unsigned) size);
+        return false;
+    }
+    for (uint16_t i = 0; i < n->outputs; i++) {
+        n->labels[i] = (const char *) blob + KNN_HEADER_SIZE + MODEL_LABEL_LEN * i;
+        if (blob[KNN_HEADER_SIZE + MODEL_LABEL_LEN * (i + 1) - 1] != 0) {
+            printf("ERROR: kNN label %u is truncated\n", (unsigned) i);
+            return false;
+        }
+    }
+    n->targets = (const float *) (blob + labels);
+    n->fingerprints = (const int8_t *) (blob + targets);
+    return true;
+}
+
+// Run the kNN on n->features values with NORM_FRAC_BITS fraction bits
+inline int knn_run(knn_t *n, const int16_t *input, model_result_t *result) {
+    int64_t start = hal_monotonic_us();
+    for (uint16_t i = 0; i < n->features; i++) {
+        int32_t v = input[i] >> n->input_shift;
+        n->query[i] = (int8_t) (v > INT8_MAX ? INT8_MAX : (v < INT8_MIN ? INT8_MIN : v));
+    }
+
+    // The k nearest so far, nearest first
+    uint32_t best[KNN_MAX_K];
+    uint16_t index[KNN_MAX_K];
+    uint8_t found = 0;
+    for (uint16_t f = 0; f < n->count; f++) {
+        uint32_t d = kernel_l2_s8(n->query, n->fingerprints + (size_t) f * n->features, n->features);
+        if (found == n->k && d >= best[found - 1]) {
+            continue;
+        }
+        uint8_t at = found < n->k ? found++ : found - 1;
+        for (; at > 0 && best[at - 1] > d; at--) {
+            best[at] = best[at - 1];
+            index[at] = index[at - 1];
+        }
+        best[at] = d;
+        index[at] = f;
+    }
+
+    float weight_sum = 0;
+    result->count = n->outputs;
+    for (uint16_t o = 0; o < n->outputs; o++) {
+        result->classification[o].label = n->labels[o];
+        result->classification[o].value = 0;
+    }
+    for (uint8_t i = 0; i < found; i++) {
+        float w = 1.0f / (1.0f + (float) best[i]);
+        weight_sum += w;
+        for (uint16_t o = 0; o < n->outputs; o++) {
+            result->classification[o].value += w * n->targets[(size_t) index[i] * n->outputs + o];
+        }
+    }
+    for (uint16_t o = 0; o < n->outputs; o++) {
+        result->classification[o].value /= weight_sum;
+    }
+    result->timing_us = hal_monotonic_us() - start;
+    return 0;
+}
+
+#endif //ESP32_CSI_KNN_COMPONENT_H
@@ -0,0 +1,479 @@
+#ifndef ESP32_CSI_METRICS_COMPONENT_H
+#define ESP32_CSI_METRICS_COMPONENT_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <atomic>
+#include <mutex>
+
+#include "hal_component.h"
+#include "csi_packet_component.h" // _csi_put_*, _csi_get_*
+#include "histogram_component.h"
+
+/*
+ * Runtime metrics of the station, for the failures that otherwise only show up as a printed line or not at
+ * all: frames the CSI callback dropped or left out of the text lines, datagrams the transmitter could not
+ * send, Wi-Fi retries, results the MQTT publisher lost.
+ *
+ *   METRICS_COUNTER(csi_rx_metric, "csi.rx", CSI_MAX_APS);   a counter per slot, here per AP id
+ *   metric_add(&csi_rx_metric, current_AP_id);
+ *   METRICS_GAUGE(csi_queue_metric, "csi.queue");
+ *   metric_set(&csi_queue_metric, csi_stream_count);         also keeps the largest value set
+ *   METRICS_HISTOGRAM(csi_cb_metric, "csi.cb_us");
+ *   METRICS_SCOPE(csi_cb_metric);                            microseconds to the end of the block
+ *   metric_observe(&csi_cb_metric, us);                      a value measured elsewhere
+ *
+ * A metric is a global defined next to the code that records it. Its constructor adds it to a fixed table of
+ * METRICS_MAX before app_main / setup() runs, so nothing is allocated and nothing is looked up at runtime.
+ * Recording is a relaxed atomic add on 32 bits, lock-free on the ESP32 where 64-bit atomics are not, from any
+ * task or the Wi-Fi callback. Counters and sums wrap: readers take differences modulo 2^32. Histograms have
+ * the buckets of histogram_component.h, exact below 16 and then four per power of two, so a percentile is
+ * within 25 %. Reads are no consistent cut: a snapshot taken while a value is recorded may count it in the
+ * total and not yet in its bucket.
+ *
+ * Exports: metrics_print() writes a line per metric to the console, metrics_encode() the compact snapshot
+ * below. metrics_exporter_t sends one every interval to a collector, where tools/csi_metrics listen prints
+ * the rates; METRICS on the command channel does both (metrics_command).
+ *
+ *   snapshot:  magic "CSMT" (4) | version (1) | metric_count (1) | device_id (2) | seq (4) | uptime_us (8)
+ *              | metric * metric_count
+ *   metric:    kind (1) | slots (1) | name_len (1) | name | values
+ *   counter:   value (4) * slots, the slots after the last one that is not zero are left out
+ *   gauge:     value (4) | max (4), signed
+ *   histogram: count (4) | sum (4) | max (4) | bucket_count (1) | (bucket (1) | count (4)) * bucket_count,
+ *              only the buckets that are not empty
+ *
+ * All fields are little endian and count since boot. Metrics that do not fit METRICS_SNAPSHOT_MAX are left
+ * out of the snapshot. With CONFIG_METRICS 0 the metrics hold nothing and recording compiles to nothing.
+ */
+
+#ifndef CONFIG_METRICS
+#define CONFIG_METRICS 1
+#endif
+
+#ifndef CONFIG_METRICS_INTERVAL_MS
+#define CONFIG_METRICS_INTERVAL_MS 5000 // Between the snapshots of the exporter
+#endif
+
+#define METRICS_MAGIC 0x544D5343 // "CSMT"
+#define METRICS_VERSION 1
+#define METRICS_MAX 40 // Metrics in the table
+#define METRICS_MAX_SLOTS 16
+#define METRICS_NAME_MAX 31
+#define METRICS_BUCKETS HISTOGRAM_BUCKETS
+#define METRICS_HEADER_SIZE 20
+#define METRICS_SNAPSHOT_MAX 1472 // One datagram
+#define METRICS_UDP_PORT 2227
+
+#define METRIC_COUNTER 0
+#define METRIC_GAUGE 1
+#define METRIC_HISTOGRAM 2
+
+// values of a histogram
+#define METRIC_HISTOGRAM_COUNT 0
+#define METRIC_HISTOGRAM_SUM 1
+#define METRIC_HISTOGRAM_MAX 2
+#define METRIC_HISTOGRAM_BUCKETS 3
+
+// A metric as metrics_decode() gives it back, on the collector
+typedef struct {
+    uint8_t kind;
+    uint8_t slots;
+    char name[METRICS_NAME_MAX + 1];
+    uint32_t values[METRICS_MAX_SLOTS]; // Counter slots; gauge value and max; histogram count, sum and max
+    uint32_t buckets[METRICS_BUCKETS];
+} metric_value_t;
+
+typedef struct {
+    uint16_t device_id;
+    uint32_t seq;
+    uint64_t uptime_us;
+    uint8_t metric_count;
+    metric_value_t metrics[METRICS_MAX];
+} metrics_snapshot_t;
+
+#if CONFIG_METRICS
+
+struct metric_t {
+    const char *name;
+    uint8_t kind;
+    uint8_t slots;
+    std::atomic<uint32_t> *values;
+
+    metric_t(const char *name, uint8_t kind, uint8_t slots, std::atomic<uint32_t> *values);
+};
+
+metric_t *metrics_table[METRICS_MAX]; // In the order the metrics are defined
+size_t metrics_count = 0;
+
+inline metric_t::metric_t(const char *name, uint8_t kind, uint8_t slots, std::atomic<uint32_t> *values)
+    : name(name), kind(kind), slots(slots), values(values) {
+    if (metrics_count == METRICS_MAX || strlen(name) > METRICS_NAME_MAX || slots == 0 || slots > METRICS_MAX_SLOTS) {
+        printf("ERROR: metric %s not registered\n", name);
+        return;
+    }
+    metrics_table[metrics_count++] = this;
+}
+
+#define METRICS_COUNTER(var, name, slots) \
+    std::atomic<uint32_t> var##_values[slots]; \
+    metric_t var(name, METRIC_COUNTER, slots, var##_values)
+#define METRICS_GAUGE(var, name) \
+    std::atomic<uint32_t> var##_values[2]; \
+    metric_t var(name, METRIC_GAUGE, 1, var##_values)
+#define METRICS_HISTOGRAM(var, name) \
+    std::atomic<uint32_t> var##_values[METRIC_HISTOGRAM_BUCKETS + METRICS_BUCKETS]; \
+    metric_t var(name, METRIC_HISTOGRAM, 1, var##_values)
+
+// Add n to a counter's slot, slots it does not have are ignored
+inline void metric_add(metric_t *m, uint8_t slot = 0, uint32_t n = 1) {
+    if (slot < m->slots) {
+        m->values[slot].fetch_add(n, std::memory_order_relaxed);
+    }
+}
+
+inline void metric_set(metric_t *m, int32_t v) {
+    m->values[0].store((uint32_t) v, std::memory_order_relaxed);
+    uint32_t max = m->values[1].load(std::memory_order_relaxed);
+    while ((int32_t) max < v && !m->values[1].compare_exchange_weak(max, (uint32_t) v, std::memory_order_relaxed)) {
+    }
+}
+
+inline void metric_observe(metric_t *m, uint32_t v) {
+    m->values[METRIC_HISTOGRAM_COUNT].fetch_add(1, std::memory_order_relaxed);
+    m->values[METRIC_HISTOGRAM_SUM].fetch_add(v, std::memory_order_relaxed);
+    m->values[METRIC_HISTOGRAM_BUCKETS + histogram_bucket(v)].fetch_add(1, std::memory_order_relaxed);
+    uint32_t max = m->values[METRIC_HISTOGRAM_MAX].load(std::memory_order_relaxed);
+    while (max < v && !m->values[METRIC_HISTOGRAM_MAX].compare_exchange_weak(max, v, std::memory_order_relaxed)) {
+    }
+}
+
+// Observes the microseconds until the enclosing block ends
+class metric_scope_t {
+public:
+    explicit metric_scope_t(metric_t *m) : m(m), start(hal_monotonic_us()) {}
+    ~metric_scope_t() {
+        int64_t us = hal_monotonic_us() - start;
+        metric_observe(m, us > 0 ? (uint32_t) us : 0);
+    }
+
+private:
+    metric_t *m;
+    int64_t start;
+};
+
+#define _METRICS_CONCAT(a, b) a##b
+#define _METRICS_NAME(line) _METRICS_CONCAT(_metric_scope_, line)
+#define METRICS_SCOPE(var) metric_scope_t _METRICS_NAME(__LINE__)(&var)
+
+inline void metrics_reset() {
+    for (size_t i = 0; i < metrics_count; i++) {
+        metric_t *m = metrics_table[i];
+        size_t n = m->kind == METRIC_COUNTER ? m->slots : (m->kind == METRIC_GAUGE ? 2 : METRIC_HISTOGRAM_BUCKETS + METRICS_BUCKETS);
+        for (size_t v = 0; v < n; v++) {
+            m->values[v].store(0, std::memory_order_relaxed);
+        }
+    }
+}
+
+// Slots of a counter up to the last one that is not zero, at least one
+inline uint8_t _metrics_used_slots(const metric_t *m) {
+    uint8_t used = 1;
+    for (uint8_t s = 0; s < m->slots; s++) {
+        used = m->values[s].load(std::memory_order_relaxed) != 0 ? s + 1 : used;
+    }
+    return used;
+}
+
+// A line per metric
+inline void metrics_print(FILE *out) {
+    for (size_t i = 0; i < metrics_count; i++) {
+        const metric_t *m = metrics_table[i];
+        if (m->kind == METRIC_COUNTER) {
+            fprintf(out, "%s", m->name);
+            for (uint8_t s = 0, used = _metrics_used_slots(m); s < used; s++) {
+                fprintf(out, " %u", (unsigned) m->values[s].load(std::memory_order_relaxed));
+            }
+            fprintf(out, "\n");
+        } else if (m->kind == METRIC_GAUGE) {
+            fprintf(out, "%s %d max %d\n", m->name, (int) (int32_t) m->values[0].load(std::memory_order_relaxed),
+                    (int) (int32_t) m->values[1].load(std::memory_order_relaxed));
+        } else {
+            uint32_t count = m->values[METRIC_HISTOGRAM_COUNT].load(std::memory_order_relaxed);
+            uint32_t sum = m->values[METRIC_HISTOGRAM_SUM].load(std::memory_order_relaxed);
+            uint32_t max = m->values[METRIC_HISTOGRAM_MAX].load(std::memory_order_relaxed);
+            const std::atomic<uint32_t> *buckets = m->values + METRIC_HISTOGRAM_BUCKETS;
+            fprintf(out, "%s count %u mean %.1f p50 %u p90 %u p99 %u max %u\n", m->name, (unsigned) count,
+                    count > 0 ? (double) sum / count : 0.0, (unsigned) histogram_percentile(buckets, count, max, 0.5),
+                    (unsigned) histogram_percentile(buckets, count, max, 0.9),
+                    (unsigned) histogram_percentile(buckets, count, max, 0.99), (unsigned) max);
+        }
+    }
+}
+
+// Binary snapshot, returns its size (0 if `size` cannot hold the header)
+inline size_t metrics_encode(uint8_t *buf, size_t size, uint16_t device_id, uint32_t seq) {
+    if (size < METRICS_HEADER_SIZE) {
+        return 0;
+    }
+    size_t o = METRICS_HEADER_SIZE;
+    uint8_t metric_count = 0;
+    for (size_t i = 0; i < metrics_count; i++) {
+        const metric_t *m = metrics_table[i];
+        size_t name_len = strlen(m->name);
+        uint8_t slots = m->kind == METRIC_COUNTER ? _metrics_used_slots(m) : 1;
+        uint8_t bucket_count = 0;
+        size_t values_size = 4 * (size_t) slots;
+        if (m->kind == METRIC_GAUGE) {
+            values_size = 8;
+        } else if (m->kind == METRIC_HISTOGRAM) {
+            for (int b = 0; b < METRICS_BUCKETS; b++) {
+                bucket_count += m->values[METRIC_HISTOGRAM_BUCKETS + b].load(std::memory_order_relaxed) != 0;
+            }
+            values_size = 13 + 5 * (size_t) bucket_count;
+        }
+        if (o + 3 + name_len + values_size > size) {
+            continue; // Left out of this snapshot
+        }
+
+        buf[o] = m->kind;
+        buf[o + 1] = slots;
+        buf[o + 2] = (uint8_t) name_len;
+        memcpy(buf + o + 3, m->name, name_len);
+        uint8_t *p = buf + o + 3 + name_len;
+        if (m->kind == METRIC_HISTOGRAM) {
+            for (int v = 0; v < METRIC_HISTOGRAM_BUCKETS; v++) {
+                _csi_put_u32(p + 4 * v, m->values[v].load(std::memory_order_relaxed));
+            }
+            p[12] = 0;
+            uint8_t *q = p + 13;
+            for (int b = 0; b < METRICS_BUCKETS && p[12] < bucket_count; b++) {
+                uint32_t count = m->values[METRIC_HISTOGRAM_BUCKETS + b].load(std::memory_order_relaxed);
+                if (count != 0) {
+                    q[0] = (uint8_t) b;
+                    _csi_put_u32(q + 1, count);
+                    q += 5;
+                    p[12]++;
+                }
+            }
+            values_size = (size_t) (q - p); // A bucket that filled since it was counted waits for the next snapshot
+        } else {
+            for (size_t v = 0; v < values_size / 4; v++) {
+                _csi_put_u32(p + 4 * v, m->values[v].load(std::memory_order_relaxed));
+            }
+        }
+        o += 3 + name_len + values_size;
+        metric_count++;
+    }
+    _csi_put_u32(buf, METRICS_MAGIC);
+    buf[4] = METRICS_VERSION;
+    buf[5] = metric_count;
+    _csi_put_u16(buf + 6, device_id);
+    _csi_put_u32(buf + 8, seq);
+    _csi_put_u64(buf + 12, (uint64_t) hal_monotonic_us());
+    return o;
+}
+
+#else
+
+struct metric_t {};
+size_t metrics_count = 0;
+
+#define METRICS_COUNTER(var, name, slots) metric_t var
+#define METRICS_GAUGE(var, name) metric_t var
+#define METRICS_HISTOGRAM(var, name) metric_t var
+#define METRICS_SCOPE(var)
+
+inline void metric_add(metric_t *, uint8_t = 0, uint32_t = 1) {}
+inline void metric_set(metric_t *, int32_t) {}
+inline void metric_observe(metric_t *, uint32_t) {}
+inline void metrics_reset() {}
+inline void metrics_print(FILE *out) {
+    fprintf(out, "metrics compiled out (CONFIG_METRICS 0)\n");
+}
+inline size_t metrics_encode(uint8_t *, size_t, uint16_t, uint32_t) { return 0; }
+
+#endif
+
+// Parse a snapshot from metrics_encode, on the collector
+inline bool metrics_decode(const uint8_t *buf, size_t size, metrics_snapshot_t *out) {
+    if (size < METRICS_HEADER_SIZE || _csi_get_u32(buf) != METRICS_MAGIC || buf[4] != METRICS_VERSION ||
+        buf[5] > METRICS_MAX) {
+        return false;
+    }
+    out->metric_count = buf[5];
+    out->device_id = _csi_get_u16(buf + 6);
+    out->seq = _csi_get_u32(buf + 8);
+    out->uptime_us = _csi_get_u64(buf + 12);
+    size_t o = METRICS_HEADER_SIZE;
+    for (uint8_t i = 0; i < out->metric_count; i++) {
+        metric_value_t *m = &out->metrics[i];
+        if (o + 3 > size) {
+            return false;
+        }
+        m->kind = buf[o];
+        m->slots = buf[o + 1];
+        uint8_t name_len = buf[o + 2];
+        o += 3;
+        if (m->kind > METRIC_HISTOGRAM || m->slots == 0 || m->slots > METRICS_MAX_SLOTS ||
+            name_len > METRICS_NAME_MAX || o + name_len > size) {
+            return false;
+        }
+        memcpy(m->name, buf + o, name_len);
+        m->name[name_len] = '\0';
+        o += name_len;
+        memset(m->values, 0, sizeof(m->values));
+        memset(m->buckets, 0, sizeof(m->buckets));
+        size_t values = m->kind == METRIC_COUNTER ? m->slots : (m->kind == METRIC_GAUGE ? 2 : 3);
+        if (o + 4 * values > size) {
+            return false;
+        }
+        for (size_t v = 0; v < values; v++, o += 4) {
+            m->values[v] = _csi_get_u32(buf + o);
+        }
+        if (m->kind != METRIC_HISTOGRAM) {
+            continue;
+        }
+        if (o + 1 > size || o + 1 + 5 * (size_t) buf[o] > size) {
+            return false;
+        }
+        uint8_t bucket_count = buf[o++];
+        for (uint8_t b = 0; b < bucket_count; b++, o += 5) {
+            if (buf[o] >= METRICS_BUCKETS) {
+                return false;
+            }
+            m->buckets[buf[o]] = _csi_get_u32(buf + o + 1);
+        }
+    }
+    return o == size;
+}
+
+// Sends a snapshot to a collector every interval, from a loop that already runs (metrics_exporter_poll)
+typedef struct {
+    std::mutex mutex;
+    int fd;
+    bool has_socket;
+    struct sockaddr_in to;
+    bool enabled;
+    uint32_t interval_ms;
+    int64_t next_us;
+    uint16_t device_id;
+    uint32_t seq; // Snapshots encoded
+    uint32_t sent;
+    uint32_t errors;
+    uint8_t buf[METRICS_SNAPSHOT_MAX];
+} metrics_exporter_t;
+
+metrics_exporter_t metrics_exporter; // The station's, retargeted by METRICS
+
+// Send snapshots to ip:port from the next poll on, every interval_ms
+inline bool metrics_exporter_start(metrics_exporter_t *e, const char *ip, int port, uint32_t interval_ms,
+                                   uint16_t device_id) {
+    std::lock_guard<std::mutex> lock(e->mutex);
+    struct sockaddr_in to = {};
+    to.sin_family = AF_INET;
+    to.sin_port = htons(port);
+    if (inet_aton(ip, &to.sin_addr) == 0) {
+        printf("ERROR: inet_aton\n");
+        return false;
+    }
+    if (!e->has_socket) {
+        e->fd = socket(PF_INET, SOCK_DGRAM, 0);
+        if (e->fd < 0) {
+            printf("ERROR: metrics socket creation error\n");
+            return false;
+        }
+        e->has_socket = true;
+    }
+    e->to = to;
+    e->interval_ms = interval_ms > 0 ? interval_ms : CONFIG_METRICS_INTERVAL_MS;
+    e->next_us = hal_monotonic_us();
+    e->device_id = device_id;
+    e->enabled = true;
+    return true;
+}
+
+inline void metrics_exporter_stop(metrics_exporter_t *e) {
+    std::lock_guard<std::mutex> lock(e->mutex);
+    e->enabled = false;
+}
+
+inline bool _metrics_exporter_send(metrics_exporter_t *e) {
+    size_t len = metrics_encode(e->buf, sizeof(e->buf), e->device_id, e->seq++);
+    if (len == 0 || sendto(e->fd, e->buf, len, 0, (const struct sockaddr *) &e->to, sizeof(e->to)) != (ssize_t) len) {
+        e->errors++;
+        return false;
+    }
+    e->sent++;
+    return true;
+}
+
+// Send a snapshot now
+inline bool metrics_exporter_send(metrics_exporter_t *e) {
+    std::lock_guard<std::mutex> lock(e->mutex);
+    return e->enabled && _metrics_exporter_send(e);
+}
+
+// Send a snapshot if one is due. Returns true if one was sent.
+inline bool metrics_exporter_poll(metrics_exporter_t *e) {
+    std::lock_guard<std::mutex> lock(e->mutex);
+    int64_t now = hal_monotonic_us();
+    if (!e->enabled || now < e->next_us) {
+        return false;
+    }
+    e->next_us += (int64_t) e->interval_ms * 1000;
+    if (e->next_us <= now) {
+        e->next_us = now + (int64_t) e->interval_ms * 1000; // Polled late, do not catch up
+    }
+    return _metrics_exporter_send(e);
+}
+
+/*
+ * METRICS: every metric on the console. METRICS <ip> [port] [interval ms]: snapshots to a collector from now
+ * on. METRICS OFF: no more snapshots. A command_handler_t.
+ */
+inline bool metrics_command(int argc, char **argv, char *reply, size_t reply_size) {
+    metrics_exporter_t *e = &metrics_exporter;
+    if (argc == 1) {
+        metrics_print(stdout);
+        fflush(stdout);
+        std::lock_guard<std::mutex> lock(e->mutex);
+        snprintf(reply, reply_size, "%u metrics printed, %u snapshots sent, %u failed", (unsigned) metrics_count,
+                 (unsigned) e->sent, (unsigned) e->errors);
+        return true;
+    }
+    if (argc == 2 && strcasecmp(argv[1], "OFF") == 0) {
+        metrics_exporter_stop(e);
+        snprintf(reply, reply_size, "snapshots off");
+        return true;
+    }
+    char *end;
+    unsigned long port = argc >= 3 ? strtoul(argv[2], &end, 10) : METRICS_UDP_PORT;
+    if (argc > 4 || port == 0 || port > 65535 || (argc >= 3 && *end != '\0')) {
+        return false;
+    }
+    unsigned long interval_ms = argc == 4 ? strtoul(argv[3], &end, 10) : CONFIG_METRICS_INTERVAL_MS;
+    if (interval_ms < 100 || interval_ms > 3600000 || (argc == 4 && *end != '\0')) {
+        return false;
+    }
+    uint16_t device_id;
+    {
+        std::lock_guard<std::mutex> lock(e->mutex);
+        device_id = e->device_id;
+    }
+    if (!metrics_exporter_start(e, argv[1], (int) port, (uint32_t) interval_ms, device_id)) {
+        return false;
+    }
+    snprintf(reply, reply_size, "snapshots to %.15s:%lu every %lu ms", argv[1], port, interval_ms);
+    return true;
+}
+
+#endif //ESP32_CSI_METRICS_COMPONENT_H
@@ -0,0 +1,231 @@
+#ifndef ESP32_CSI_MODEL_COMPONENT_H
+#define ESP32_CSI_MODEL_COMPONENT_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+#include <math.h>
+
+#include "hal_component.h"
+#include "capture_component.h"  // capture_crc32
+#include "norm_component.h"
+#include "kernel_component.h"
+
+/*
+ * Fixed-point inference for the location models: dense layers (a linear regression is one, a small MLP
+ * a few with ReLU between them) with int8 or int16 weights, run straight from a flat weight blob written
+ * by tools/csi_model, without the Edge Impulse / TFLM runtime.
+ *
+ *   blob:    header | label * outputs | layer * layer_count | crc32 (4) of everything before
+ *   header:  magic "CSIM" (4) | version (2) | layer_count (2) | inputs (2) | outputs (2) | input_frac (1)
+ *            | output_kind (1) | reserved (2)
+ *   label:   name, zero padded to MODEL_LABEL_LEN
+ *   layer:   inputs (2) | outputs (2) | weight_bits (1) | activation (1) | shift (1) | output_frac (1)
+ *            | bias (4 * outputs) | weights (outputs rows of inputs values), zero padded to 4 bytes
+ *
+ * All fields are little endian and every section is a multiple of 4 bytes, so a 4-byte aligned blob (in
+ * flash, or a file loaded into RAM) is used in place: model_load only checks it and points into it.
+ *
+ * Values are int16 with a per-layer number of fraction bits. Inputs are the standardized features of
+ * csi_complete_q (input_frac = NORM_FRAC_BITS). A layer sums bias + w * x exactly (int8 rows through
+ * kernel_dot_s8s16), saturates the sum to 32 bits instead of wrapping, and shifts it right by `shift` (with
+ * rounding) into its output_frac, saturated to int16. The outputs of the last layer are the regression
+ * values, or the logits of a softmax over the labels.
+ */
+
+#define MODEL_MAGIC 0x4D495343  // "CSIM"
+#define MODEL_VERSION 1
+#define MODEL_HEADER_SIZE 16
+#define MODEL_LAYER_HEADER_SIZE 8
+#define MODEL_LABEL_LEN 16
+#define MODEL_MAX_LAYERS 4
+#define MODEL_MAX_WIDTH 512  // Inputs and outputs of any layer
+#define MODEL_MAX_OUTPUTS 32
+
+#define MODEL_OUTPUT_REGRESSION 0
+#define MODEL_OUTPUT_SOFTMAX 1
+
+#define MODEL_ACTIVATION_NONE 0
+#define MODEL_ACTIVATION_RELU 1
+
+typedef struct {
+    uint16_t inputs;
+    uint16_t outputs;
+    uint8_t weight_bits;  // 8 or 16
+    uint8_t activation;  // MODEL_ACTIVATION_*
+    uint8_t shift;  // Accumulator fraction bits minus output_frac
+    uint8_t output_frac;
+    const int32_t *bias;  // Accumulator scale
+    const void *weights;  // int8_t or int16_t, row per output
+} model_layer_t;
+
+typedef struct {
+    uint16_t inputs;
+    uint16_t outputs;
+    uint8_t input_frac;
+    uint8_t output_kind;  // MODEL_OUTPUT_*
+    uint16_t layer_count;
+    model_layer_t layers[MODEL_MAX_LAYERS];
+    const char *labels[MODEL_MAX_OUTPUTS];  // Point into the blob
+    size_t blob_size;
+    int16_t scratch[2][MODEL_MAX_WIDTH];  // Activations of consecutive layers
+} model_t;
+
+// Same shape as ei_impulse_result_t's classification: a value per label, the regression value itself or
+// the label's probability
+typedef struct {
+    const char *label;
+    float value;
+} model_classification_t;
+
+typedef struct {
+    model_classification_t classification[MODEL_MAX_OUTPUTS];
+    uint16_t count;
+    int64_t timing_us;
+} model_result_t;
+
+// Check a blob and point `m` into it. Returns false, printing why, if the blob is not a model this engine runs.
+inline bool model_load(model_t *m, const uint8_t *blob, size_t size) {
+    if (((uintptr_t) blob & 3) != 0 || size < MODEL_HEADER_SIZE + 4 || size % 4 != 0) {
+        printf("ERROR: model blob must be 4 byte aligned and sized, %u bytes\n", (unsigned) size);
+        return false;
+    }
+    if (_csi_get_u32(blob) != MODEL_MAGIC || _csi_get_u16(blob + 4) != MODEL_VERSION) {
+        printf("ERROR: not a model blob (version %u)\n", (unsigned) _csi_get_u16(blob + 4));
+        return false;
+    }
+    if (capture_crc32(0, blob, size - 4) != _csi_get_u32(blob + size - 4)) {
+        printf("ERROR: model blob fails its CRC\n");
+        return false;
+    }
+
+    m->layer_count = _csi_get_u16(blob + 6);
+    m->inputs = _csi_get_u16(blob + 8);
+    m->outputs = _csi_get_u16(blob + 10);
+    m->input_frac = blob[12];
+    m->output_kind = blob[13];
+    m->blob_size = size;
+    if (m->layer_count == 0 || m->layer_count > MODEL_MAX_LAYERS || m->outputs > MODEL_MAX_OUTPUTS) {
+        printf("ERROR: model has %u layers and %u outputs, at most %d and %d are supported\n",
+               (unsigned) m->layer_count, (unsigned) m->outputs, MODEL_MAX_LAYERS, MODEL_MAX_OUTPUTS);
+        return false;
+    }
+
+    size_t offset = MODEL_HEADER_SIZE;
+    for (uint16_t i = 0; i < m->outputs; i++) {
+        m->labels[i] = (const char *) blob + offset;
+        if (offset + MODEL_LABEL_LEN > size - 4 || blob[offset + MODEL_LABEL_LEN - 1] != 0) {
+            printf("ERROR: model label %u is truncated\n", (unsigned) i);
+            return false;
+        }
+        offset += MODEL_LABEL_LEN;
+    }
+
+    uint16_t width = m->inputs;
+    for (uint16_t i = 0; i < m->layer_count; i++) {
+        model_layer_t *l = &m->layers[i];
+        if (offset + MODEL_LAYER_HEADER_SIZE > size - 4) {
+            printf("ERROR: model layer %u is truncated\n", (unsigned) i);
+            return false;
+        }
+        const uint8_t *p = blob + offset;
+        l->inputs = _csi_get_u16(p);
+        l->outputs = _csi_get_u16(p + 2);
+        l->weight_bits = p[4];
+        l->activation = p[5];
+        l->shift = p[6];
+        l->output_frac = p[7];
+        size_t weight_bytes = ((size_t) l->inputs * l->outputs * (l->weight_bits / 8) + 3) & ~(size_t) 3;
+        if (l->inputs != width || l->outputs == 0 || l->outputs > MODEL_MAX_WIDTH ||
+            (l->weight_bits != 8 && l->weight_bits != 16) || l->shift > 62 ||
+            offset + MODEL_LAYER_HEADER_SIZE + 4 * l->outputs + weight_bytes > size - 4) {
+            printf("ERROR: model layer %u (%u -> %u, %u bit) does not fit the model\n", (unsigned) i,
+                   (unsigned) l->inputs, (unsigned) l->outputs, (unsigned) l->weight_bits);
+            return false;
+        }
+        l->bias = (const int32_t *) (p + MODEL_LAYER_HEADER_SIZE);
+        l->weights = p + MODEL_LAYER_HEADER_SIZE + 4 * l->outputs;
+        offset += MODEL_LAYER_HEADER_SIZE + 4 * l->outputs + weight_bytes;
+        width = l->outputs;
+    }
+    if (m->inputs > MODEL_MAX_WIDTH || width != m->outputs || offset != size - 4) {
+        printf("ERROR: model has %u inputs and %u outputs, its layers %u bytes\n", (unsigned) m->inputs,
+               (unsigned) m->outputs, (unsigned) offset);
+        return false;
+    }
+    return true;
+}
+
+// bias + w . x for one output, saturated to int32
+inline int32_t _model_dot(const model_layer_t *l, size_t o, const int16_t *in) {
+    size_t n = l->inputs;
+    if (l->weight_bits == 8) {
+        return _kernel_sat32(l->bias[o] + kernel_dot_s8s16((const int8_t *) l->weights + o * n, in, n));
+    }
+
+    // int16 products reach 2^30, so they are summed in 64 bits
+    const int16_t *w = (const int16_t *) l->weights + o * n;
+    int64_t sum = l->bias[o];
+    for (size_t j = 0; j < n; j++) {
+        sum += (int32_t) w[j] * in[j];
+    }
+    return _kernel_sat32(sum);
+}
+
+inline void _model_dense(const model_layer_t *l, const int16_t *in, int16_t *out) {
+    int64_t round = l->shift > 0 ? (int64_t) 1 << (l->shift - 1) : 0;
+    for (size_t o = 0; o < l->outputs; o++) {
+        int64_t y = ((int64_t) _model_dot(l, o, in) + round) >> l->shift;
+        if (l->activation == MODEL_ACTIVATION_RELU && y < 0) {
+            y = 0;
+        }
+        out[o] = (int16_t) (y > INT16_MAX ? INT16_MAX : (y < INT16_MIN ? INT16_MIN : y));
+    }
+}
+
+// Run the model on m->inputs values with m->input_frac fraction bits
+inline int model_run(model_t *m, const int16_t *input, model_result_t *result) {
+    int64_t start = hal_monotonic_us();
+    const int16_t *in = input;
+    int16_t *out = m->scratch[0];
+    for (uint16_t i = 0; i < m->layer_count; i++) {
+        _model_dense(&m->layers[i], in, out);
+        in = out;
+        out = m->scratch[(i + 1) % 2];
+    }
+
+    const model_layer_t *last = &m->layers[m->layer_count - 1];
+    float scale = 1.0f / (float) (1 << last->output_frac);
+    result->count = m->outputs;
+    float max = -INFINITY;
+    for (uint16_t o = 0; o < m->outputs; o++) {
+        result->classification[o].label = m->labels[o];
+        result->classification[o].value = in[o] * scale;
+        max = result->classification[o].value > max ? result->classification[o].value : max;
+    }
+    if (m->output_kind == MODEL_OUTPUT_SOFTMAX) {
+        float sum = 0;
+        for (uint16_t o = 0; o < m->outputs; o++) {
+            result->classification[o].value = expf(result->classification[o].value - max);
+            sum += result->classification[o].value;
+        }
+        for (uint16_t o = 0; o < m->outputs; o++) {
+            result->classification[o].value /= sum;
+        }
+    }
+    result->timing_us = hal_monotonic_us() - start;
+    return 0;
+}
+
+// run_classifier for the native engine: reads the features through `get_data` (csi_complete_q)
+inline int model_run_signal(model_t *m, int (*get_data)(size_t, size_t, int16_t *), model_result_t *result) {
+    int16_t *input = m->scratch[1];
+    if (get_data(0, m->inputs, input) != 0) {
+        return -1;
+    }
+    // The first layer writes scratch[0], the input stays in scratch[1] until the second reuses it
+    return model_run(m, input, result);
+}
+
+#endif //ESP32_CSI_MODEL_COMPONENT_H
@@ -0,0 +1,344 @@
+#ifndef ESP32_CSI_MODEL_STORE_COMPONENT_H
+#define ESP32_CSI_MODEL_STORE_COMPONENT_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+#include <math.h>
+#include <atomic>
+#include <mutex>
+
+#include "hal_component.h"
+#include "model_component.h"
+#include "knn_component.h"
+
+/*
+ * Models the sketch swaps at run time, without regenerating a library and reflashing: tools/csi_model
+ * writes a container with the model blob, the normalization table its inputs need and a few probe inputs
+ * with the outputs it must produce on them.
+ *
+ *   container: header | section * section_count | sections, each at a multiple of MODEL_STORE_ALIGN
+ *   header:    magic "CSMC" (4) | format version (2) | section_count (2) | model version (4) | size (4)
+ *              | crc32 (4) of bytes MODEL_STORE_HEADER_SIZE..size | crc32 (4) of the header before it
+ *   section:   type (2) | reserved (2) | offset (4) | size (4)
+ *   MODEL_STORE_SECTION_MODEL  the blob of model_component.h
+ *   MODEL_STORE_SECTION_NORM   features (2) | reserved (2) | mul (4 * features) | add (4 * features)
+ *   MODEL_STORE_SECTION_PROBE  count (2) | reserved (2) | count * (inputs int16, zero padded to 4 bytes
+ *                              | outputs float, the model_run values)
+ *   MODEL_STORE_SECTION_KNN    the blob of knn_component.h, in place of a model
+ * Sections of other types are skipped, so newer tools can add some.
+ *
+ * A container is used where it lies: mapped from a flash partition (hal_map_partition, written with
+ * parttool.py), or a file copied into RAM (hal_map_file, the SD card), or built into the sketch. The store
+ * has two slots. model_store_stage_*() loads a container into the slot that is not running, checks both
+ * CRCs, loads the model and runs the probes, and on any failure leaves the running model alone.
+ * model_store_run() swaps a staged model in before the inference, never during one; the swap calls the
+ * sketch's activate hook (which installs the normalization table) and keeps the old model if it fails. The
+ * old model stays loaded until the next stage: model_store_rollback() goes back to it, which
+ * model_store_run() does by itself if the new model fails within its first MODEL_STORE_PROBATION runs.
+ * Staging may run on any task, commits and inferences on one.
+ */
+
+#define MODEL_STORE_MAGIC 0x434D5343 // "CSMC"
+#define MODEL_STORE_VERSION 1
+#define MODEL_STORE_HEADER_SIZE 24
+#define MODEL_STORE_SECTION_SIZE 12
+#define MODEL_STORE_MAX_SECTIONS 8
+#define MODEL_STORE_ALIGN HAL_MAP_ALIGN
+#define MODEL_STORE_SOURCE_LEN 48
+#define MODEL_STORE_PROBATION 3
+#define MODEL_STORE_PROBE_TOLERANCE 1e-3f // Relative, for expf in the softmax of another libm
+
+#define MODEL_STORE_SECTION_MODEL 1
+#define MODEL_STORE_SECTION_NORM 2
+#define MODEL_STORE_SECTION_PROBE 3
+#define MODEL_STORE_SECTION_KNN 4
+
+typedef struct {
+    hal_map_t map;
+    model_t model;
+    knn_t knn; // 0 count for a model
+    norm_table_t norm; // 0 features without a normalization section
+    uint32_t version;
+    uint16_t probes;
+    char source[MODEL_STORE_SOURCE_LEN];
+} model_slot_t;
+
+// Called on the inference task when a model is swapped in or rolled back to, false refuses it
+typedef bool (*model_store_activate_t)(const model_slot_t *slot);
+
+typedef struct {
+    model_slot_t slots[2];
+    std::atomic<model_slot_t *> active;
+    model_slot_t *previous; // Kept for model_store_rollback
+    model_slot_t *staged; // Checked, swapped in by the next model_store_commit
+    bool loading;
+    uint16_t probation; // Runs left in which a failure rolls back
+    model_store_activate_t activate;
+    std::mutex mutex;
+    uint32_t swaps;
+    uint32_t rollbacks;
+    uint32_t rejected;
+} model_store_t;
+
+inline void model_store_init(model_store_t *s, model_store_activate_t activate) {
+    for (model_slot_t &slot : s->slots) {
+        memset(&slot.map, 0, sizeof(slot.map));
+        slot.version = 0;
+        slot.source[0] = 0;
+    }
+    s->active = NULL;
+    s->previous = NULL;
+    s->staged = NULL;
+    s->loading = false;
+    s->probation = 0;
+    s->activate = activate;
+    s->swaps = 0;
+    s->rollbacks = 0;
+    s->rejected = 0;
+}
+
+inline uint16_t model_slot_inputs(const model_slot_t *slot) {
+    return slot->knn.count > 0 ? slot->knn.features : slot->model.inputs;
+}
+
+inline uint16_t model_slot_outputs(const model_slot_t *slot) {
+    return slot->knn.count > 0 ? slot->knn.outputs : slot->model.outputs;
+}
+
+// Run the slot's model or kNN on model_slot_inputs() values with NORM_FRAC_BITS fraction bits
+inline int model_slot_run(model_slot_t *slot, const int16_t *input, model_result_t *result) {
+    if (slot->knn.count > 0) {
+        return knn_run(&slot->knn, input, result);
+    }
+    return model_run(&slot->model, input, result);
+}
+
+// run_classifier for a slot: reads the features through `get_data` (csi_complete_q)
+inline int model_slot_run_signal(model_slot_t *slot, int (*get_data)(size_t, size_t, int16_t *),
+                                 model_result_t *result) {
+    if (slot->knn.count == 0) {
+        return model_run_signal(&slot->model, get_data, result);
+    }
+    int16_t *input = slot->model.scratch[1]; // A kNN slot does not use the model's scratch
+    if (get_data(0, slot->knn.features, input) != 0) {
+        return -1;
+    }
+    return knn_run(&slot->knn, input, result);
+}
+
+inline bool _model_store_probe(model_slot_t *slot, const uint8_t *p, size_t size) {
+    uint16_t inputs = model_slot_inputs(slot), outputs = model_slot_outputs(slot);
+    size_t input_bytes = ((size_t) inputs * 2 + 3) & ~(size_t) 3;
+    size_t probe_bytes = input_bytes + 4 * (size_t) outputs;
+    slot->probes = _csi_get_u16(p);
+    if (4 + slot->probes * probe_bytes != size) {
+        printf("ERROR: %u model probes do not fit their %u bytes\n", (unsigned) slot->probes, (unsigned) size);
+        return false;
+    }
+    model_result_t result;
+    for (uint16_t i = 0; i < slot->probes; i++) {
+        const uint8_t *probe = p + 4 + i * probe_bytes;
+        model_slot_run(slot, (const int16_t *) probe, &result);
+        for (uint16_t o = 0; o < outputs; o++) {
+            float expected;
+            memcpy(&expected, probe + input_bytes + 4 * o, 4);
+            float value = result.classification[o].value;
+            if (!(fabsf(value - expected) <= MODEL_STORE_PROBE_TOLERANCE * (1 + fabsf(expected)))) {
+                printf("ERROR: model probe %u gives %s = %g instead of %g\n", (unsigned) i,
+                       result.classification[o].label, value, expected);
+                return false;
+            }
+        }
+    }
+    return true;
+}
+
+// Check the container in slot->map and load its model into the slot
+inline bool model_store_parse(model_slot_t *slot) {
+    const uint8_t *data = slot->map.data;
+    size_t size = slot->map.size; // A partition is larger than the container in it
+    if (((uintptr_t) data & 3) != 0 || size < MODEL_STORE_HEADER_SIZE || _csi_get_u32(data) != MODEL_STORE_MAGIC) {
+        printf("ERROR: %s holds no model container\n", slot->source);
+        return false;
+    }
+    if (capture_crc32(0, data, MODEL_STORE_HEADER_SIZE - 4) != _csi_get_u32(data + MODEL_STORE_HEADER_SIZE - 4)) {
+        printf("ERROR: model container header of %s fails its CRC\n", slot->source);
+        return false;
+    }
+    uint16_t sections = _csi_get_u16(data + 6);
+    slot->version = _csi_get_u32(data + 8);
+    size_t container_size = _csi_get_u32(data + 12);
+    size_t table_end = MODEL_STORE_HEADER_SIZE + (size_t) sections * MODEL_STORE_SECTION_SIZE;
+    if (_csi_get_u16(data + 4) != MODEL_STORE_VERSION || sections > MODEL_STORE_MAX_SECTIONS ||
+        container_size > size || container_size < table_end) {
+        printf("ERROR: model container of %s: format %u, %u sections, %u of %u bytes\n", slot->source,
+               (unsigned) _csi_get_u16(data + 4), (unsigned) sections, (unsigned) container_size, (unsigned) size);
+        return false;
+    }
+    if (capture_crc32(0, data + MODEL_STORE_HEADER_SIZE, container_size - MODEL_STORE_HEADER_SIZE) !=
+        _csi_get_u32(data + 16)) {
+        printf("ERROR: model container %s (version %u) fails its CRC\n", slot->source, (unsigned) slot->version);
+        return false;
+    }
+
+    const uint8_t *model = NULL, *norm = NULL, *probe = NULL, *knn = NULL;
+    size_t model_size = 0, norm_size = 0, probe_size = 0, knn_size = 0;
+    for (uint16_t i = 0; i < sections; i++) {
+        const uint8_t *entry = data + MODEL_STORE_HEADER_SIZE + i * MODEL_STORE_SECTION_SIZE;
+        size_t offset = _csi_get_u32(entry + 4), section_size = _csi_get_u32(entry + 8);
+        if (offset % MODEL_STORE_ALIGN != 0 || offset < table_end || offset > container_size ||
+            section_size > container_size - offset) {
+            printf("ERROR: model container section %u of %s is out of place\n", (unsigned) i, slot->source);
+            return false;
+        }
+        switch (_csi_get_u16(entry)) {
+            case MODEL_STORE_SECTION_MODEL: model = data + offset; model_size = section_size; break;
+            case MODEL_STORE_SECTION_NORM: norm = data + offset; norm_size = section_size; break;
+            case MODEL_STORE_SECTION_PROBE: probe = data + offset; probe_size = section_size; break;
+            case MODEL_STORE_SECTION_KNN: knn = data + offset; knn_size = section_size; break;
+        }
+    }
+    slot->knn.count = 0;
+    if (knn != NULL ? !knn_load(&slot->knn, knn, knn_size) : model == NULL || !model_load(&slot->model, model, model_size)) {
+        slot->knn.count = 0;
+        printf("ERROR: model container %s has no model this engine runs\n", slot->source);
+        return false;
+    }
+
+    slot->norm.features = 0;
+    if (norm != NULL) {
+        slot->norm.features = norm_size >= 4 ? _csi_get_u16(norm) : 0;
+        if (slot->norm.features != model_slot_inputs(slot) || norm_size != 4 + 8 * (size_t) slot->norm.features) {
+            printf("ERROR: normalization of %u features for a model of %u inputs\n", (unsigned) slot->norm.features,
+                   (unsigned) model_slot_inputs(slot));
+            return false;
+        }
+        slot->norm.mul = (const int32_t *) (norm + 4);
+        slot->norm.add = slot->norm.mul + slot->norm.features;
+    }
+    slot->probes = 0;
+    return probe == NULL || (probe_size >= 4 && _model_store_probe(slot, probe, probe_size));
+}
+
+// Load a container into the slot that is not running with `map`, which fills slot->map
+template<typename F>
+inline bool _model_store_stage(model_store_t *s, const char *source, F map) {
+    model_slot_t *slot;
+    {
+        std::lock_guard<std::mutex> lock(s->mutex);
+        if (s->loading) {
+            printf("ERROR: a model is already being loaded\n");
+            return false;
+        }
+        slot = s->active.load() == &s->slots[0] ? &s->slots[1] : &s->slots[0];
+        s->previous = s->previous == slot ? NULL : s->previous;
+        s->staged = NULL;
+        s->loading = true;
+    }
+    // Nothing runs this slot, it is read without the lock
+    hal_unmap(&slot->map);
+    snprintf(slot->source, sizeof(slot->source), "%s", source);
+    bool ok = map(&slot->map) && model_store_parse(slot);
+    if (!ok) {
+        hal_unmap(&slot->map);
+    }
+
+    std::lock_guard<std::mutex> lock(s->mutex);
+    s->loading = false;
+    s->staged = ok ? slot : NULL;
+    s->rejected += !ok;
+    return ok;
+}
+
+// A container built into the sketch, or anywhere else that outlives the store
+inline bool model_store_stage_memory(model_store_t *s, const uint8_t *data, size_t size, const char *name) {
+    return _model_store_stage(s, name, [&](hal_map_t *m) {
+        m->data = data;
+        m->size = size;
+        return true;
+    });
+}
+
+inline bool model_store_stage_partition(model_store_t *s, const char *label) {
+    char source[MODEL_STORE_SOURCE_LEN];
+    snprintf(source, sizeof(source), "partition %s", label);
+    return _model_store_stage(s, source, [&](hal_map_t *m) { return hal_map_partition(label, m); });
+}
+
+inline bool model_store_stage_file(model_store_t *s, const char *path) {
+    return _model_store_stage(s, path, [&](hal_map_t *m) { return hal_map_file(path, m); });
+}
+
+// Swap the staged model in. Returns true if the running model changed.
+inline bool model_store_commit(model_store_t *s) {
+    std::lock_guard<std::mutex> lock(s->mutex);
+    model_slot_t *next = s->staged;
+    if (next == NULL) {
+        return false;
+    }
+    s->staged = NULL;
+    model_slot_t *current = s->active.load();
+    if (s->activate != NULL && !s->activate(next)) {
+        printf("ERROR: model %s (version %u) does not fit the sketch, keeping the running one\n", next->source,
+               (unsigned) next->version);
+        if (current != NULL) {
+            s->activate(current);
+        }
+        hal_unmap(&next->map);
+        s->rejected++;
+        return false;
+    }
+    s->previous = current;
+    s->active = next;
+    s->probation = MODEL_STORE_PROBATION;
+    s->swaps++;
+    return true;
+}
+
+// Go back to the model before the last swap and release the current one
+inline bool model_store_rollback(model_store_t *s) {
+    std::lock_guard<std::mutex> lock(s->mutex);
+    model_slot_t *back = s->previous, *current = s->active.load();
+    if (back == NULL || (s->activate != NULL && !s->activate(back))) {
+        return false;
+    }
+    s->active = back;
+    s->previous = NULL;
+    s->probation = 0;
+    s->rollbacks++;
+    hal_unmap(&current->map);
+    return true;
+}
+
+// The running model, NULL before the first commit. Valid on the inference task until its next commit.
+inline const model_slot_t *model_store_active(model_store_t *s) {
+    return s->active.load();
+}
+
+// run_classifier for the store: swaps in a staged model, then runs the current one. The result's labels
+// point into the model and are valid until the next run.
+inline int model_store_run(model_store_t *s, int (*get_data)(size_t, size_t, int16_t *), model_result_t *result) {
+    model_store_commit(s);
+    model_slot_t *slot = s->active.load();
+    if (slot == NULL) {
+        return -1;
+    }
+    int rc = model_slot_run_signal(slot, get_data, result);
+    bool on_probation;
+    {
+        std::lock_guard<std::mutex> lock(s->mutex);
+        on_probation = s->probation > 0;
+        s->probation -= on_probation;
+    }
+    if (rc != 0 && on_probation && model_store_rollback(s)) {
+        model_slot_t *back = s->active.load();
+        printf("ERROR: model version %u failed, rolled back to version %u\n", (unsigned) slot->version,
+               (unsigned) back->version);
+        rc = model_slot_run_signal(back, get_data, result);
+    }
+    return rc;
+}
+
+#endif //ESP32_CSI_MODEL_STORE_COMPONENT_H
@@ -0,0 +1,412 @@
+#ifndef MQTT_PUBLISHER_COMPONENT_H
+#define MQTT_PUBLISHER_COMPONENT_H
+
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+
+#include "metrics_component.h"
+
+/*
+ * Asynchronous MQTT publisher for inference results.
+ *
+ * run_ei() hands each result to mqtt_publisher_submit(), which only copies 16 bytes into a bounded
+ * queue. A publisher thread keeps the broker connection open (reconnecting in the background with
+ * backoff), and publishes queued results in batches of up to MQTT_BATCH per PUBLISH:
+ *
+ *   payload:  version (1) | count (1) | device_id (2) | result * count
+ *   result:   timestamp_us (8) | label_id (1) | flags (1) | confidence_q15 (2) | x (2) | y (2)
+ *
+ * Little endian. If the queue fills up (broker slow or unreachable) a new result replaces the newest
+ * queued one when they carry the same label, otherwise the oldest result is dropped.
+ *
+ * Only the MQTT 3.1.1 packets needed for QoS 0 publishing are implemented (CONNECT, PUBLISH, PINGREQ).
+ *
+ * Besides `stats`, the publisher records the mqtt.* metrics (metrics_component.h): a PUBLISH or PINGREQ
+ * that fails counts in mqtt.publish_failures and its batch in mqtt.lost.
+ */
+
+#define MQTT_QUEUE_LEN 32 // Results waiting to be published
+#define MQTT_BATCH 8 // Results per PUBLISH
+#define MQTT_BATCH_WAIT_MS 20 // How long to wait for a batch to fill once the first result is queued
+#define MQTT_KEEPALIVE_S 60
+#define MQTT_RECONNECT_MIN_MS 250
+#define MQTT_RECONNECT_MAX_MS 8000
+#define MQTT_RESULT_SIZE 16
+#define MQTT_PAYLOAD_HEADER_SIZE 4
+#define MQTT_PAYLOAD_VERSION 1
+
+#ifndef MSG_NOSIGNAL
+#define MSG_NOSIGNAL 0
+#endif
+
+// What x/y carry. At most one of the flags is set; with neither, x/y are 0 and mean nothing.
+#define INFERENCE_FLAG_HAS_XY 0x01 // The position the model inferred
+#define INFERENCE_FLAG_GROUND_TRUTH 0x02 // The surveyed position the station was placed at (typed in at setup),
+                                         // not an inference: for scoring results against it
+
+METRICS_COUNTER(mqtt_published_metric, "mqtt.published", 1); // Results that went out
+METRICS_COUNTER(mqtt_publish_failures_metric, "mqtt.publish_failures", 1); // PUBLISH or PINGREQ that failed
+METRICS_COUNTER(mqtt_lost_metric, "mqtt.lost", 1); // Results in the batches of those
+METRICS_COUNTER(mqtt_dropped_metric, "mqtt.dropped", 1); // Replaced in a full queue
+METRICS_COUNTER(mqtt_connect_failures_metric, "mqtt.connect_failures", 1);
+METRICS_HISTOGRAM(mqtt_latency_metric, "mqtt.latency_us"); // Submit to PUBLISH of a batch's newest result
+
+typedef struct {
+    int64_t timestamp_us;
+    uint8_t label_id;
+    uint8_t flags;
+    uint16_t confidence_q15; // Confidence * 32767
+    int16_t x;
+    int16_t y;
+} inference_result_t;
+
+typedef struct {
+    uint64_t submitted;
+    uint64_t published; // Results that went out in a PUBLISH
+    uint64_t batches;
+    uint64_t dropped; // Oldest result dropped because the queue was full
+    uint64_t coalesced; // Result replaced by a newer one with the same label
+    uint32_t connects;
+    uint32_t connect_failures;
+    int64_t last_latency_us; // Submit to PUBLISH written, newest result of the last batch
+    int64_t max_latency_us;
+} mqtt_publisher_stats_t;
+
+typedef struct {
+    struct sockaddr_in broker;
+    char topic[64];
+    char client_id[24];
+    uint16_t device_id;
+    bool (*is_connected)();
+
+    int socket_fd;
+    int64_t last_packet_us; // For keepalive pings
+
+    inference_result_t queue[MQTT_QUEUE_LEN];
+    size_t head;
+    size_t count;
+
+    std::mutex mutex;
+    std::condition_variable cv;
+    std::thread thread;
+    bool running;
+
+    mqtt_publisher_stats_t stats;
+} mqtt_publisher_t;
+
+inline int64_t _mqtt_now_us() {
+    return std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::system_clock::now().time_since_epoch()).count();
+}
+
+// MQTT remaining length, returns the number of bytes written (at most 4)
+inline size_t _mqtt_put_length(uint8_t *p, size_t length) {
+    size_t n = 0;
+    do {
+        uint8_t b = length % 128;
+        length /= 128;
+        p[n++] = length > 0 ? (b | 0x80) : b;
+    } while (length > 0 && n < 4);
+    return n;
+}
+
+inline size_t _mqtt_put_string(uint8_t *p, const char *s) {
+    size_t len = strlen(s);
+    p[0] = (uint8_t) (len >> 8);
+    p[1] = (uint8_t) len;
+    memcpy(p + 2, s, len);
+    return len + 2;
+}
+
+inline bool _mqtt_write_all(int fd, const uint8_t *buf, size_t size) {
+    while (size > 0) {
+        ssize_t n = send(fd, buf, size, MSG_NOSIGNAL);
+        if (n <= 0) {
+            return false;
+        }
+        buf += n;
+        size -= n;
+    }
+    return true;
+}
+
+inline void _mqtt_close(mqtt_publisher_t *p) {
+    if (p->socket_fd != -1) {
+        close(p->socket_fd);
+        p->socket_fd = -1;
+    }
+}
+
+// TCP connect, CONNECT, wait for a successful CONNACK
+inline bool _mqtt_connect(mqtt_publisher_t *p) {
+    p->socket_fd = socket(AF_INET, SOCK_STREAM, 0);
+    if (p->socket_fd == -1) {
+        return false;
+    }
+
+    struct timeval timeout = {.tv_sec = 2, .tv_usec = 0};
+    setsockopt(p->socket_fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+    setsockopt(p->socket_fd, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+    int nodelay = 1;
+    setsockopt(p->socket_fd, IPPROTO_TCP, TCP_NODELAY, &nodelay, sizeof(nodelay));
+
+    if (connect(p->socket_fd, (const struct sockaddr *) &p->broker, sizeof(p->broker)) == -1) {
+        _mqtt_close(p);
+        return false;
+    }
+
+    uint8_t body[64];
+    size_t n = _mqtt_put_string(body, "MQTT");
+    body[n++] = 4; // Protocol level 3.1.1
+    body[n++] = 0x02; // Clean session
+    body[n++] = MQTT_KEEPALIVE_S >> 8;
+    body[n++] = MQTT_KEEPALIVE_S & 0xFF;
+    n += _mqtt_put_string(body + n, p->client_id);
+
+    uint8_t packet[72];
+    packet[0] = 0x10; // CONNECT
+    size_t h = 1 + _mqtt_put_length(packet + 1, n);
+    memcpy(packet + h, body, n);
+
+    uint8_t connack[4];
+    if (!_mqtt_write_all(p->socket_fd, packet, h + n) ||
+        recv(p->socket_fd, connack, sizeof(connack), MSG_WAITALL) != sizeof(connack) ||
+        connack[0] != 0x20 || connack[3] != 0) {
+        _mqtt_close(p);
+        return false;
+    }
+
+    p->last_packet_us = _mqtt_now_us();
+    return true;
+}
+
+inline void _mqtt_encode_result(uint8_t *p, const inference_result_t *r) {
+    uint64_t ts = (uint64_t) r->timestamp_us;
+    for (int i = 0; i < 8; i++) {
+        p[i] = (uint8_t) (ts >> (8 * i));
+    }
+    p[8] = r->label_id;
+    p[9] = r->flags;
+    p[10] = (uint8_t) r->confidence_q15;
+    p[11] = (uint8_t) (r->confidence_q15 >> 8);
+    p[12] = (uint8_t) r->x;
+    p[13] = (uint8_t) ((uint16_t) r->x >> 8);
+    p[14] = (uint8_t) r->y;
+    p[15] = (uint8_t) ((uint16_t) r->y >> 8);
+}
+
+// One QoS 0 PUBLISH carrying `count` results
+inline bool _mqtt_publish(mqtt_publisher_t *p, const inference_result_t *results, size_t count) {
+    uint8_t probe;
+    if (recv(p->socket_fd, &probe, 1, MSG_DONTWAIT) == 0) {
+        return false; // Broker closed the connection, reconnect before losing the batch
+    }
+
+    uint8_t packet[5 + 2 + sizeof(p->topic) + MQTT_PAYLOAD_HEADER_SIZE + MQTT_BATCH * MQTT_RESULT_SIZE];
+    uint8_t body[sizeof(packet)];
+
+    size_t n = _mqtt_put_string(body, p->topic);
+    body[n++] = MQTT_PAYLOAD_VERSION;
+    body[n++] = (uint8_t) count;
+    body[n++] = (uint8_t) p->device_id;
+    body[n++] = (uint8_t) (p->device_id >> 8);
+    for (size_t i = 0; i < count; i++) {
+        _mqtt_encode_result(body + n, &results[i]);
+        n += MQTT_RESULT_SIZE;
+    }
+
+    packet[0] = 0x30; // PUBLISH, QoS 0
+    size_t h = 1 + _mqtt_put_length(packet + 1, n);
+    memcpy(packet + h, body, n);
+    if (!_mqtt_write_all(p->socket_fd, packet, h + n)) {
+        return false;
+    }
+    p->last_packet_us = _mqtt_now_us();
+    return true;
+}
+
+inline bool _mqtt_ping(mqtt_publisher_t *p) {
+    uint8_t ping[2] = {0xC0, 0x00};
+    if (!_mqtt_write_all(p->socket_fd, ping, sizeof(ping))) {
+        return false;
+    }
+    uint8_t discard[16];
+    while (recv(p->socket_fd, discard, sizeof(discard), MSG_DONTWAIT) > 0) {
+        // PINGRESP, nothing else is expected for QoS 0
+    }
+    p->last_packet_us = _mqtt_now_us();
+    return true;
+}
+
+inline void _mqtt_publisher_loop(mqtt_publisher_t *p) {
+    inference_result_t batch[MQTT_BATCH];
+    int backoff_ms = MQTT_RECONNECT_MIN_MS;
+
+    while (true) {
+        // Keep the session up in the background, independently of the inference cycle
+        if (p->socket_fd == -1) {
+            bool ok = p->is_connected() && _mqtt_connect(p);
+            {
+                std::lock_guard<std::mutex> lock(p->mutex);
+                if (ok) {
+                    p->stats.connects++;
+                } else {
+                    p->stats.connect_failures++;
+                    metric_add(&mqtt_connect_failures_metric);
+                }
+            }
+            if (!ok) {
+                std::unique_lock<std::mutex> lock(p->mutex);
+                p->cv.wait_for(lock, std::chrono::milliseconds(backoff_ms), [p] { return !p->running; });
+                if (!p->running) {
+                    break;
+                }
+                backoff_ms = backoff_ms * 2 > MQTT_RECONNECT_MAX_MS ? MQTT_RECONNECT_MAX_MS : backoff_ms * 2;
+                continue;
+            }
+            backoff_ms = MQTT_RECONNECT_MIN_MS;
+        }
+
+        size_t count = 0;
+        {
+            std::unique_lock<std::mutex> lock(p->mutex);
+            p->cv.wait_for(lock, std::chrono::seconds(MQTT_KEEPALIVE_S / 2), [p] { return p->count > 0 || !p->running; });
+            if (!p->running) {
+                break;
+            }
+            if (p->count > 0 && p->count < MQTT_BATCH) {
+                // Give the batch a moment to fill
+                p->cv.wait_for(lock, std::chrono::milliseconds(MQTT_BATCH_WAIT_MS),
+                               [p] { return p->count >= MQTT_BATCH || !p->running; });
+            }
+            while (count < MQTT_BATCH && p->count > 0) {
+                batch[count++] = p->queue[p->head];
+                p->head = (p->head + 1) % MQTT_QUEUE_LEN;
+                p->count--;
+            }
+        }
+
+        bool ok;
+        if (count > 0) {
+            ok = _mqtt_publish(p, batch, count);
+        } else {
+            ok = _mqtt_now_us() - p->last_packet_us < MQTT_KEEPALIVE_S * 500000LL || _mqtt_ping(p);
+        }
+
+        if (!ok) {
+            metric_add(&mqtt_publish_failures_metric);
+            metric_add(&mqtt_lost_metric, 0, (uint32_t) count);
+            _mqtt_close(p); // Results of this batch are lost, the next loop reconnects
+            continue;
+        }
+
+        if (count > 0) {
+            int64_t latency = _mqtt_now_us() - batch[count - 1].timestamp_us;
+            metric_add(&mqtt_published_metric, 0, (uint32_t) count);
+            metric_observe(&mqtt_latency_metric, latency < 0 ? 0 : (latency > UINT32_MAX ? UINT32_MAX : (uint32_t) latency));
+            std::lock_guard<std::mutex> lock(p->mutex);
+            p->stats.published += count;
+            p->stats.batches++;
+            p->stats.last_latency_us = latency;
+            if (latency > p->stats.max_latency_us) {
+                p->stats.max_latency_us = latency;
+            }
+        }
+    }
+
+    _mqtt_close(p);
+}
+
+/*
+ * Start the publisher thread. `is_connected` tells it whether the network is up, so it does not
+ * try to reach the broker while the radio is busy elsewhere.
+ */
+inline bool mqtt_publisher_start(mqtt_publisher_t *p, const char *broker_ip, int port, const char *topic,
+                                 const char *client_id, uint16_t device_id, bool (*is_connected)()) {
+    memset(&p->broker, 0, sizeof(p->broker));
+    p->broker.sin_family = AF_INET;
+    p->broker.sin_port = htons(port);
+    if (inet_aton(broker_ip, &p->broker.sin_addr) == 0) {
+        printf("ERROR: inet_aton\n");
+        return false;
+    }
+
+    strncpy(p->topic, topic, sizeof(p->topic) - 1);
+    p->topic[sizeof(p->topic) - 1] = '\0';
+    strncpy(p->client_id, client_id, sizeof(p->client_id) - 1);
+    p->client_id[sizeof(p->client_id) - 1] = '\0';
+    p->device_id = device_id;
+    p->is_connected = is_connected;
+    p->socket_fd = -1;
+    p->head = 0;
+    p->count = 0;
+    memset(&p->stats, 0, sizeof(p->stats));
+    p->running = true;
+    p->thread = std::thread(_mqtt_publisher_loop, p);
+    return true;
+}
+
+// Queue a result without blocking
+inline void mqtt_publisher_submit(mqtt_publisher_t *p, const inference_result_t *r) {
+    {
+        std::lock_guard<std::mutex> lock(p->mutex);
+        p->stats.submitted++;
+
+        if (p->count == MQTT_QUEUE_LEN) {
+            size_t newest = (p->head + p->count - 1) % MQTT_QUEUE_LEN;
+            if (p->queue[newest].label_id == r->label_id) {
+                p->queue[newest] = *r; // Same answer as the stale one, only the newest matters
+                p->stats.coalesced++;
+                return;
+            }
+            p->head = (p->head + 1) % MQTT_QUEUE_LEN;
+            p->count--;
+            p->stats.dropped++;
+            metric_add(&mqtt_dropped_metric);
+        }
+
+        p->queue[(p->head + p->count) % MQTT_QUEUE_LEN] = *r;
+        p->count++;
+    }
+    p->cv.notify_one();
+}
+
+// Convenience wrapper for classification results
+inline void mqtt_publisher_submit_label(mqtt_publisher_t *p, uint8_t label_id, float confidence) {
+    inference_result_t r;
+    r.timestamp_us = _mqtt_now_us();
+    r.label_id = label_id;
+    r.flags = 0;
+    float c = confidence < 0 ? 0 : (confidence > 1 ? 1 : confidence);
+    r.confidence_q15 = (uint16_t) (c * 32767.0f + 0.5f);
+    r.x = 0;
+    r.y = 0;
+    mqtt_publisher_submit(p, &r);
+}
+
+inline void mqtt_publisher_get_stats(mqtt_publisher_t *p, mqtt_publisher_stats_t *stats) {
+    std::lock_guard<std::mutex> lock(p->mutex);
+    *stats = p->stats;
+}
+
+inline void mqtt_publisher_stop(mqtt_publisher_t *p) {
+    {
+        std::lock_guard<std::mutex> lock(p->mutex);
+        p->running = false;
+    }
+    p->cv.notify_all();
+    if (p->thread.joinable()) {
+        p->thread.join();
+    }
+}
+
+#endif // MQTT_PUBLISHER_COMPONENT_H
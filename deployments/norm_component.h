@@ -0,0 +1,51 @@
+#ifndef ESP32_CSI_NORM_COMPONENT_H
+#define ESP32_CSI_NORM_COMPONENT_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <math.h>
+
+/*
+ * Per-feature standardization, (x - mean) / scale, in fixed point. The mean and scale of every feature are
+ * fitted offline on a training capture by tools/csi_norm, which writes them as a header (csi_norm_table.h,
+ * next to the sketch) so the tables live in flash.
+ *
+ * Every feature costs one multiply-add and a shift on int32:
+ *   q = (x * mul + add) >> NORM_SHIFT     mul = round(2^(NORM_SHIFT + NORM_FRAC_BITS) / scale)
+ *                                         add = round(-mean * mul) + 2^(NORM_SHIFT - 1)
+ * q is the standardized value with NORM_FRAC_BITS fraction bits, saturated to int16. With |x| and |mean| at
+ * most NORM_MAX_INPUT (int8 CSI, RSSI in dBm) and scale >= NORM_MIN_SCALE the sum stays below 2^29, and q is
+ * within NORM_ERROR_BOUND of the exact value.
+ */
+
+#define NORM_SHIFT 12
+#define NORM_FRAC_BITS 8
+#define NORM_Q_TO_FLOAT (1.0f / (1 << NORM_FRAC_BITS))
+#define NORM_MAX_INPUT 128
+#define NORM_MIN_SCALE 1.0f // One step of the raw value, constant features (null subcarriers) stay at 0
+// Rounding of q plus the rounding of mul and add carried through |x - mean| <= 2 * NORM_MAX_INPUT,
+// in standardized units
+#define NORM_ERROR_BOUND ((0.5f + (NORM_MAX_INPUT + 0.5f) / (1 << NORM_SHIFT)) * NORM_Q_TO_FLOAT)
+
+typedef struct {
+    uint16_t features;
+    const int32_t *mul;
+    const int32_t *add;
+} norm_table_t;
+
+// Fixed-point coefficients of one feature
+inline void norm_coefficients(float mean, float scale, int32_t *mul, int32_t *add) {
+    if (!(scale >= NORM_MIN_SCALE)) {
+        scale = NORM_MIN_SCALE;
+    }
+    *mul = (int32_t) lrint((double) (1 << (NORM_SHIFT + NORM_FRAC_BITS)) / scale);
+    *add = (int32_t) lrint(-(double) mean * *mul) + (1 << (NORM_SHIFT - 1));
+}
+
+// Standardized value of feature `i` with NORM_FRAC_BITS fraction bits
+inline int16_t norm_apply(const norm_table_t *t, size_t i, int32_t x) {
+    int32_t q = (x * t->mul[i] + t->add[i]) >> NORM_SHIFT;
+    return (int16_t) (q < INT16_MIN ? INT16_MIN : (q > INT16_MAX ? INT16_MAX : q));
+}
+
+#endif //ESP32_CSI_NORM_COMPONENT_H
@@ -0,0 +1,340 @@
+#ifndef ESP32_CSI_PROFILE_COMPONENT_H
+#define ESP32_CSI_PROFILE_COMPONENT_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <mutex>
+
+#include "hal_component.h"
+#include "csi_packet_component.h"  // _csi_put_*, _csi_get_*
+#include "histogram_component.h"
+
+/*
+ * Per-stage timing of the localization cycle: how long run_ei() spends fetching features (signal.get_data),
+ * in the DSP, the classifier and the anomaly block (ei_impulse_result_t.timing), in the whole
+ * run_classifier, in post-processing and in printing or publishing the result.
+ *
+ *   PROFILE_SCOPE(PROFILE_PUBLISH);                            time the rest of the block
+ *   signal.get_data = PROFILE_GET_DATA(float, csi_complete);   time and count every call
+ *   profile_add(PROFILE_DSP, result.timing.dsp_us);            a duration measured elsewhere
+ *   profile_cycle_end();                                       once per cycle
+ *
+ * A stage can run several times in a cycle (get_data is called once per block of features): its calls are
+ * summed, and profile_cycle_end() adds the cycle's total to the stage's rolling histogram of the last
+ * PROFILE_WINDOW cycles. Buckets are those of histogram_component.h, exact below 16 us, then four per power
+ * of two, so a percentile is within 25 % of the true value. Durations are whole microseconds (esp_timer): a call shorter than one reads
+ * as 0, so the fetch total is a lower bound when get_data is called in many small blocks.
+ *
+ * Recording takes no lock and belongs to the task running the cycle; profile_cycle_end() and the exports
+ * lock, so another task may export at any time.
+ *
+ * Exports, on demand: profile_write_csv() for the serial console, a row per stage with its percentiles,
+ * and profile_encode() / profile_send() for a compact binary snapshot over UDP (tools/csi_profile listen):
+ *
+ *   snapshot: magic "CSPF" (4) | version (1) | stage_count (1) | window (2) | seq (4) | uptime_us (8)
+ *             | stage * stage_count
+ *   stage:    id (1) | bucket_count (1) | samples (2) | cycles (4) | calls (4) | min_us (4) | max_us (4)
+ *             | sum_us (8) | (bucket (1) | count (1)) * bucket_count, only the buckets that are not empty
+ *
+ * cycles and calls count since boot, the rest covers the window. All fields are little endian.
+ *
+ * With CONFIG_PROFILE 0 the macros and profile_add() compile to nothing, PROFILE_GET_DATA is the bare
+ * function and no state is allocated.
+ */
+
+#ifndef CONFIG_PROFILE
+#define CONFIG_PROFILE 1
+#endif
+
+#define PROFILE_MAGIC 0x46505343  // "CSPF"
+#define PROFILE_VERSION 1
+#define PROFILE_WINDOW 128  // Cycles in the rolling histograms, so a bucket count fits a byte
+#define PROFILE_BUCKETS HISTOGRAM_BUCKETS
+#define PROFILE_HEADER_SIZE 20
+#define PROFILE_STAGE_HEADER_SIZE 28
+#define PROFILE_UDP_PORT 2226
+
+#define PROFILE_FETCH 0  // signal.get_data, inside the DSP
+#define PROFILE_DSP 1
+#define PROFILE_INFERENCE 2  // The classifier itself: the NN, or the native model
+#define PROFILE_ANOMALY 3
+#define PROFILE_CLASSIFIER 4  // The whole run_classifier / model_store_run
+#define PROFILE_POST 5  // Picking the result
+#define PROFILE_PUBLISH 6  // Printing or sending it
+#define PROFILE_CYCLE 7  // All of run_ei()
+#define PROFILE_STAGES 8
+
+#define PROFILE_SNAPSHOT_MAX (PROFILE_HEADER_SIZE + PROFILE_STAGES * (PROFILE_STAGE_HEADER_SIZE + 2 * PROFILE_BUCKETS))
+
+const char *const profile_stage_names[PROFILE_STAGES] = {"fetch", "dsp", "inference", "anomaly", "classifier",
+                                                          "post", "publish", "cycle"};
+
+// Rolling histogram of one stage, and what the current cycle has added so far
+typedef struct {
+    uint8_t counts[PROFILE_BUCKETS];
+    uint32_t window[PROFILE_WINDOW];  // Per-cycle totals, oldest overwritten
+    uint16_t head;
+    uint16_t samples;
+    uint32_t cycles;  // Cycles the stage ran in
+    uint32_t calls;
+    uint32_t pending_us;  // This cycle
+    uint32_t pending_calls;
+} profile_stage_t;
+
+// A stage as exported, also what profile_decode() gives back
+typedef struct {
+    uint8_t id;
+    uint16_t samples;
+    uint32_t cycles;
+    uint32_t calls;
+    uint32_t min_us;
+    uint32_t max_us;
+    uint64_t sum_us;
+    uint8_t counts[PROFILE_BUCKETS];
+} profile_summary_t;
+
+typedef struct {
+    uint32_t seq;
+    uint16_t window;
+    uint64_t uptime_us;
+    uint8_t stage_count;
+    profile_summary_t stages[PROFILE_STAGES];
+} profile_snapshot_t;
+
+// Upper bound of the q quantile of a stage (within 25 %), clipped to its maximum
+inline uint32_t profile_percentile(const profile_summary_t *s, double q) {
+    return histogram_percentile(s->counts, s->samples, s->max_us, q);
+}
+
+#if CONFIG_PROFILE
+
+typedef struct {
+    profile_stage_t stages[PROFILE_STAGES];
+    uint32_t seq;  // Snapshots encoded
+    std::mutex mutex;  // Between profile_cycle_end and the exports
+} profile_t;
+
+profile_t profile;
+
+inline void profile_add(uint8_t stage, int64_t us) {
+    profile_stage_t *s = &profile.stages[stage];
+    s->pending_us += us > 0 ? (uint32_t) us : 0;
+    s->pending_calls++;
+}
+
+// Times the enclosing block
+class profile_scope_t {
+public:
+    explicit profile_scope_t(uint8_t stage) : stage(stage), start(hal_monotonic_us()) {}
+    ~profile_scope_t() {
+        profile_add(stage, hal_monotonic_us() - start);
+    }
+
+private:
+    uint8_t stage;
+    int64_t start;
+};
+
+#define _PROFILE_CONCAT(a, b) a##b
+#define _PROFILE_NAME(line) _PROFILE_CONCAT(_profile_scope_, line)
+#define PROFILE_SCOPE(stage) profile_scope_t _PROFILE_NAME(__LINE__)(stage)
+
+// signal_t::get_data that times and counts every call of F
+template <typename T, int (*F)(size_t, size_t, T *)>
+int profile_get_data(size_t offset, size_t length, T *out) {
+    int64_t start = hal_monotonic_us();
+    int rc = F(offset, length, out);
+    profile_add(PROFILE_FETCH, hal_monotonic_us() - start);
+    return rc;
+}
+
+#define PROFILE_GET_DATA(T, f) (&profile_get_data<T, f>)
+
+// Move the stages that ran in this cycle into their histograms
+inline void profile_cycle_end() {
+    std::lock_guard<std::mutex> lock(profile.mutex);
+    for (profile_stage_t &s : profile.stages) {
+        if (s.pending_calls == 0) {
+            continue;
+        }
+        if (s.samples == PROFILE_WINDOW) {
+            s.counts[histogram_bucket(s.window[s.head])]--;
+        } else {
+            s.samples++;
+        }
+        s.window[s.head] = s.pending_us;
+        s.counts[histogram_bucket(s.pending_us)]++;
+        s.head = (s.head + 1) % PROFILE_WINDOW;
+        s.cycles++;
+        s.calls += s.pending_calls;
+        s.pending_us = 0;
+        s.pending_calls = 0;
+    }
+}
+
+inline void profile_reset() {
+    std::lock_guard<std::mutex> lock(profile.mutex);
+    for (profile_stage_t &s : profile.stages) {
+        memset(&s, 0, sizeof(s));
+    }
+}
+
+inline void _profile_summarize(uint8_t id, profile_summary_t *out) {
+    const profile_stage_t *s = &profile.stages[id];
+    out->id = id;
+    out->samples = s->samples;
+    out->cycles = s->cycles;
+    out->calls = s->calls;
+    out->min_us = s->samples > 0 ? UINT32_MAX : 0;
+    out->max_us = 0;
+    out->sum_us = 0;
+    for (uint16_t i = 0; i < s->samples; i++) {
+        uint32_t v = s->window[i];
+        out->min_us = v < out->min_us ? v : out->min_us;
+        out->max_us = v > out->max_us ? v : out->max_us;
+        out->sum_us += v;
+    }
+    memcpy(out->counts, s->counts, sizeof(out->counts));
+}
+
+// Binary snapshot of the stages that have run, returns its size (0 if `size` is too small)
+inline size_t profile_encode(uint8_t *buf, size_t size) {
+    std::lock_guard<std::mutex> lock(profile.mutex);
+    if (size < PROFILE_HEADER_SIZE) {
+        return 0;
+    }
+    size_t o = PROFILE_HEADER_SIZE;
+    uint8_t stage_count = 0;
+    for (uint8_t id = 0; id < PROFILE_STAGES; id++) {
+        if (profile.stages[id].samples == 0) {
+            continue;
+        }
+        profile_summary_t s;
+        _profile_summarize(id, &s);
+        uint8_t bucket_count = 0;
+        for (uint8_t c : s.counts) {
+            bucket_count += c != 0;
+        }
+        if (o + PROFILE_STAGE_HEADER_SIZE + 2 * bucket_count > size) {
+            return 0;
+        }
+        uint8_t *p = buf + o;
+        p[0] = id;
+        p[1] = bucket_count;
+        _csi_put_u16(p + 2, s.samples);
+        _csi_put_u32(p + 4, s.cycles);
+        _csi_put_u32(p + 8, s.calls);
+        _csi_put_u32(p + 12, s.min_us);
+        _csi_put_u32(p + 16, s.max_us);
+        _csi_put_u64(p + 20, s.sum_us);
+        o += PROFILE_STAGE_HEADER_SIZE;
+        for (int b = 0; b < PROFILE_BUCKETS; b++) {
+            if (s.counts[b] != 0) {
+                buf[o++] = (uint8_t) b;
+                buf[o++] = s.counts[b];
+            }
+        }
+        stage_count++;
+    }
+    _csi_put_u32(buf, PROFILE_MAGIC);
+    buf[4] = PROFILE_VERSION;
+    buf[5] = stage_count;
+    _csi_put_u16(buf + 6, PROFILE_WINDOW);
+    _csi_put_u32(buf + 8, profile.seq++);
+    _csi_put_u64(buf + 12, (uint64_t) hal_monotonic_us());
+    return o;
+}
+
+// Send a snapshot as one datagram
+inline bool profile_send(int fd, const struct sockaddr_in *to) {
+    uint8_t buf[PROFILE_SNAPSHOT_MAX];
+    size_t len = profile_encode(buf, sizeof(buf));
+    if (len == 0 || sendto(fd, buf, len, 0, (const struct sockaddr *) to, sizeof(*to)) != (ssize_t) len) {
+        printf("ERROR: profile snapshot not sent\n");
+        return false;
+    }
+    return true;
+}
+
+// A CSV header and a row per stage that has run, returns the length written (truncated to fit `size`)
+inline size_t profile_write_csv(char *buf, size_t size) {
+    std::lock_guard<std::mutex> lock(profile.mutex);
+    size_t o = 0;
+    auto append = [&](int n) { o = n < 0 ? o : (o + n < size ? o + n : size - 1); };
+    append(snprintf(buf, size, "stage,cycles,calls,samples,min_us,p50_us,p90_us,p99_us,max_us,mean_us\n"));
+    for (uint8_t id = 0; id < PROFILE_STAGES; id++) {
+        if (profile.stages[id].samples == 0) {
+            continue;
+        }
+        profile_summary_t s;
+        _profile_summarize(id, &s);
+        append(snprintf(buf + o, size - o, "%s,%u,%u,%u,%u,%u,%u,%u,%u,%.1f\n", profile_stage_names[id],
+                        (unsigned) s.cycles, (unsigned) s.calls, (unsigned) s.samples, (unsigned) s.min_us,
+                        (unsigned) profile_percentile(&s, 0.5), (unsigned) profile_percentile(&s, 0.9),
+                        (unsigned) profile_percentile(&s, 0.99), (unsigned) s.max_us,
+                        (double) s.sum_us / s.samples));
+    }
+    return o;
+}
+
+#else
+
+#define PROFILE_SCOPE(stage)
+#define PROFILE_GET_DATA(T, f) (&f)
+
+inline void profile_add(uint8_t, int64_t) {}
+inline void profile_cycle_end() {}
+inline void profile_reset() {}
+inline size_t profile_encode(uint8_t *, size_t) { return 0; }
+inline bool profile_send(int, const struct sockaddr_in *) { return false; }
+inline size_t profile_write_csv(char *buf, size_t size) {
+    return size > 0 ? (size_t) snprintf(buf, size, "profiling compiled out (CONFIG_PROFILE 0)\n") : 0;
+}
+
+#endif
+
+// Parse a snapshot from profile_encode, on the collector
+inline bool profile_decode(const uint8_t *buf, size_t size, profile_snapshot_t *out) {
+    if (size < PROFILE_HEADER_SIZE || _csi_get_u32(buf) != PROFILE_MAGIC || buf[4] != PROFILE_VERSION ||
+        buf[5] > PROFILE_STAGES) {
+        return false;
+    }
+    out->stage_count = buf[5];
+    out->window = _csi_get_u16(buf + 6);
+    out->seq = _csi_get_u32(buf + 8);
+    out->uptime_us = _csi_get_u64(buf + 12);
+    size_t o = PROFILE_HEADER_SIZE;
+    for (uint8_t i = 0; i < out->stage_count; i++) {
+        if (o + PROFILE_STAGE_HEADER_SIZE > size) {
+            return false;
+        }
+        const uint8_t *p = buf + o;
+        profile_summary_t *s = &out->stages[i];
+        uint8_t bucket_count = p[1];
+        s->id = p[0];
+        s->samples = _csi_get_u16(p + 2);
+        s->cycles = _csi_get_u32(p + 4);
+        s->calls = _csi_get_u32(p + 8);
+        s->min_us = _csi_get_u32(p + 12);
+        s->max_us = _csi_get_u32(p + 16);
+        s->sum_us = _csi_get_u64(p + 20);
+        o += PROFILE_STAGE_HEADER_SIZE;
+        if (s->id >= PROFILE_STAGES || o + 2 * bucket_count > size) {
+            return false;
+        }
+        memset(s->counts, 0, sizeof(s->counts));
+        for (uint8_t b = 0; b < bucket_count; b++, o += 2) {
+            if (buf[o] >= PROFILE_BUCKETS) {
+                return false;
+            }
+            s->counts[buf[o]] = buf[o + 1];
+        }
+    }
+    return o == size;
+}
+
+#endif //ESP32_CSI_PROFILE_COMPONENT_H
@@ -0,0 +1,406 @@
+#ifndef ESP32_CSI_SD_WRITER_COMPONENT_H
+#define ESP32_CSI_SD_WRITER_COMPONENT_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+
+#ifdef ESP_PLATFORM
+#include "esp_heap_caps.h"
+#endif
+
+/*
+ * Double-buffered asynchronous file writer.
+ *
+ * Producers format or copy records into the active buffer under a short lock and never wait for the
+ * card. When the active buffer is full it is handed to the writer thread, which writes it with a single
+ * write() while producers fill the other one. If both buffers are busy the record is dropped and counted.
+ *
+ * Buffers are a whole number of FAT allocation units, so while only full buffers are written every write
+ * covers whole clusters. Durability is a policy: every `sync_interval_ms` the writer also takes the
+ * partially filled buffer and calls sync() on the backend. sd_writer_flush() does the same on demand and
+ * waits for it. The writes after such a partial one are no longer cluster aligned; nothing is padded, so
+ * the file holds exactly what was appended. A producer that holds data of its own (an open capture chunk)
+ * can hand it over first from sd_writer_on_sync().
+ *
+ * The backend is a set of function pointers, sd_writer_open_file() provides the POSIX one, which works
+ * both on the ESP-IDF FAT VFS and on a Linux file.
+ */
+
+#ifndef CONFIG_SD_BUFFER_UNITS
+#define CONFIG_SD_BUFFER_UNITS 2
+#endif
+
+#ifndef CONFIG_SD_FSYNC_INTERVAL_MS
+#define CONFIG_SD_FSYNC_INTERVAL_MS 1000
+#endif
+
+#define SD_ALLOCATION_UNIT_SIZE (16 * 1024) // Matches allocation_unit_size in the mount config
+#define SD_WRITER_BUFFER_SIZE (CONFIG_SD_BUFFER_UNITS * SD_ALLOCATION_UNIT_SIZE)
+#define SD_WRITER_ALIGNMENT 64
+
+typedef struct {
+    void *ctx;
+    ssize_t (*write)(void *ctx, const void *buf, size_t size);
+    int (*sync)(void *ctx);
+    void (*close)(void *ctx);
+} sd_writer_backend_t;
+
+typedef struct {
+    uint64_t appended_bytes;
+    uint64_t written_bytes;
+    uint64_t writes;
+    uint64_t syncs;
+    uint64_t dropped_records; // Both buffers were busy, or the record was larger than a buffer
+    uint64_t write_errors;
+    int64_t max_write_us;
+    int64_t max_sync_us;
+} sd_writer_stats_t;
+
+typedef struct {
+    sd_writer_backend_t backend;
+    int64_t sync_interval_ms;
+
+    uint8_t *buffers[2];
+    size_t fill[2];
+    int active; // Buffer producers append to
+    bool pending; // The other buffer is waiting for, or in, write()
+    uint64_t unsynced_bytes;
+
+    bool flush_requested;
+    uint64_t flush_generation; // Incremented every time a requested flush completes
+    void (*on_sync)(void *ctx); // Called on the writer thread before every sync, may append
+    void *on_sync_ctx;
+
+    std::mutex mutex;
+    std::condition_variable cv;
+    std::condition_variable flushed_cv;
+    std::thread thread;
+    bool running;
+
+    sd_writer_stats_t stats;
+} sd_writer_t;
+
+inline void *_sd_writer_alloc(size_t size) {
+#ifdef ESP_PLATFORM
+    return heap_caps_aligned_alloc(SD_WRITER_ALIGNMENT, size, MALLOC_CAP_DMA); // Internal RAM the SPI DMA can read
+#else
+    void *p = NULL;
+    return posix_memalign(&p, SD_WRITER_ALIGNMENT, size) == 0 ? p : NULL;
+#endif
+}
+
+inline void _sd_writer_free(void *p) {
+#ifdef ESP_PLATFORM
+    heap_caps_free(p);
+#else
+    free(p);
+#endif
+}
+
+inline int64_t _sd_writer_now_us() {
+    return std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+// POSIX backend
+inline ssize_t _sd_file_write(void *ctx, const void *buf, size_t size) {
+    int fd = (int) (intptr_t) ctx;
+    size_t done = 0;
+    while (done < size) {
+        ssize_t n = write(fd, (const uint8_t *) buf + done, size - done);
+        if (n <= 0) {
+            if (n < 0 && errno == EINTR) {
+                continue;
+            }
+            return done > 0 ? (ssize_t) done : n;
+        }
+        done += n;
+    }
+    return (ssize_t) done;
+}
+
+inline int _sd_file_sync(void *ctx) {
+    return fsync((int) (intptr_t) ctx);
+}
+
+inline void _sd_file_close(void *ctx) {
+    close((int) (intptr_t) ctx);
+}
+
+// Open `path` for appending and fill `backend`. Returns false if the file cannot be opened.
+inline bool sd_writer_open_file(sd_writer_backend_t *backend, const char *path) {
+    int fd = open(path, O_WRONLY | O_CREAT | O_APPEND, 0644);
+    if (fd < 0) {
+        printf("ERROR: cannot open %s [%s]\n", path, strerror(errno));
+        return false;
+    }
+    backend->ctx = (void *) (intptr_t) fd;
+    backend->write = &_sd_file_write;
+    backend->sync = &_sd_file_sync;
+    backend->close = &_sd_file_close;
+    return true;
+}
+
+// Write one buffer, outside the lock
+inline void _sd_writer_write(sd_writer_t *w, const uint8_t *buf, size_t size) {
+    if (size == 0) {
+        return;
+    }
+    int64_t start = _sd_writer_now_us();
+    ssize_t n = w->backend.write(w->backend.ctx, buf, size);
+    int64_t elapsed = _sd_writer_now_us() - start;
+
+    std::lock_guard<std::mutex> lock(w->mutex);
+    w->stats.writes++;
+    if (n == (ssize_t) size) {
+        w->stats.written_bytes += size;
+        w->unsynced_bytes += size;
+    } else {
+        w->stats.write_errors++;
+    }
+    if (elapsed > w->stats.max_write_us) {
+        w->stats.max_write_us = elapsed;
+    }
+}
+
+inline void _sd_writer_sync(sd_writer_t *w) {
+    int64_t start = _sd_writer_now_us();
+    w->backend.sync(w->backend.ctx);
+    int64_t elapsed = _sd_writer_now_us() - start;
+
+    std::lock_guard<std::mutex> lock(w->mutex);
+    w->stats.syncs++;
+    w->unsynced_bytes = 0;
+    if (elapsed > w->stats.max_sync_us) {
+        w->stats.max_sync_us = elapsed;
+    }
+}
+
+// Hand the active buffer to the writer. Caller holds the lock and has checked !pending.
+inline void _sd_writer_swap(sd_writer_t *w) {
+    w->pending = true;
+    w->active = 1 - w->active;
+    w->fill[w->active] = 0;
+}
+
+// Write the buffer handed over by the producers, if any. Returns false if there was none.
+inline bool _sd_writer_write_pending(sd_writer_t *w, bool take_active) {
+    int full;
+    {
+        std::lock_guard<std::mutex> lock(w->mutex);
+        if (!w->pending) {
+            if (!take_active || w->fill[w->active] == 0) {
+                return false;
+            }
+            _sd_writer_swap(w);
+        }
+        full = 1 - w->active; // Producers cannot swap again until `pending` is cleared
+    }
+
+    _sd_writer_write(w, w->buffers[full], w->fill[full]);
+    std::lock_guard<std::mutex> lock(w->mutex);
+    w->pending = false;
+    return true;
+}
+
+inline void _sd_writer_loop(sd_writer_t *w) {
+    int64_t next_sync = _sd_writer_now_us() + w->sync_interval_ms * 1000;
+
+    while (true) {
+        bool sync;
+        bool flush;
+        bool stop;
+        void (*on_sync)(void *ctx);
+        void *on_sync_ctx;
+        {
+            std::unique_lock<std::mutex> lock(w->mutex);
+            while (!w->pending && !w->flush_requested && w->running) {
+                if (w->sync_interval_ms > 0) {
+                    if (w->cv.wait_for(lock, std::chrono::microseconds(next_sync - _sd_writer_now_us())) ==
+                        std::cv_status::timeout) {
+                        break;
+                    }
+                } else {
+                    w->cv.wait(lock);
+                }
+            }
+            flush = w->flush_requested;
+            stop = !w->running;
+            sync = flush || stop || (w->sync_interval_ms > 0 && _sd_writer_now_us() >= next_sync);
+            on_sync = w->on_sync;
+            on_sync_ctx = w->on_sync_ctx;
+        }
+
+        if (sync && on_sync != NULL) {
+            _sd_writer_write_pending(w, false); // Frees the other buffer for what the callback appends
+            on_sync(on_sync_ctx);
+        }
+
+        // A full buffer goes out alone; a sync also takes the partially filled one
+        if (_sd_writer_write_pending(w, sync) && sync) {
+            // The active buffer may hold records appended before the sync while the other one was pending
+            _sd_writer_write_pending(w, true);
+        }
+
+        if (sync) {
+            if (w->unsynced_bytes > 0 || flush) {
+                _sd_writer_sync(w);
+            }
+            next_sync = _sd_writer_now_us() + w->sync_interval_ms * 1000;
+        }
+
+        if (flush) {
+            std::lock_guard<std::mutex> lock(w->mutex);
+            w->flush_requested = false;
+            w->flush_generation++;
+            w->flushed_cv.notify_all();
+        }
+        if (stop) {
+            break;
+        }
+    }
+}
+
+/*
+ * Start the writer on an opened backend. `sync_interval_ms` <= 0 disables periodic syncs, data then
+ * only reaches the card when a buffer fills up or on sd_writer_flush().
+ */
+inline bool sd_writer_start(sd_writer_t *w, const sd_writer_backend_t *backend, int64_t sync_interval_ms) {
+    w->buffers[0] = (uint8_t *) _sd_writer_alloc(SD_WRITER_BUFFER_SIZE);
+    w->buffers[1] = (uint8_t *) _sd_writer_alloc(SD_WRITER_BUFFER_SIZE);
+    if (w->buffers[0] == NULL || w->buffers[1] == NULL) {
+        printf("ERROR: cannot allocate 2 x %d bytes of SD buffers\n", SD_WRITER_BUFFER_SIZE);
+        _sd_writer_free(w->buffers[0]);
+        _sd_writer_free(w->buffers[1]);
+        return false;
+    }
+
+    w->backend = *backend;
+    w->sync_interval_ms = sync_interval_ms;
+    w->fill[0] = 0;
+    w->fill[1] = 0;
+    w->active = 0;
+    w->pending = false;
+    w->unsynced_bytes = 0;
+    w->flush_requested = false;
+    w->flush_generation = 0;
+    w->on_sync = NULL;
+    w->on_sync_ctx = NULL;
+    memset(&w->stats, 0, sizeof(w->stats));
+    w->running = true;
+    w->thread = std::thread(_sd_writer_loop, w);
+    return true;
+}
+
+// Reserve `size` bytes in the active buffer, swapping if needed. Caller holds the lock.
+inline uint8_t *_sd_writer_reserve(sd_writer_t *w, size_t size) {
+    if (w->fill[w->active] + size > SD_WRITER_BUFFER_SIZE) {
+        if (w->pending || size > SD_WRITER_BUFFER_SIZE) {
+            return NULL;
+        }
+        _sd_writer_swap(w);
+        w->cv.notify_one();
+    }
+    return w->buffers[w->active] + w->fill[w->active];
+}
+
+// Append a binary record. Returns false if it had to be dropped.
+inline bool sd_writer_append(sd_writer_t *w, const void *data, size_t size) {
+    std::lock_guard<std::mutex> lock(w->mutex);
+    uint8_t *dst = _sd_writer_reserve(w, size);
+    if (dst == NULL) {
+        w->stats.dropped_records++;
+        return false;
+    }
+    memcpy(dst, data, size);
+    w->fill[w->active] += size;
+    w->stats.appended_bytes += size;
+    return true;
+}
+
+// Format straight into the active buffer. Returns false if the record had to be dropped.
+inline bool sd_writer_vprintf(sd_writer_t *w, const char *format, va_list args) {
+    std::lock_guard<std::mutex> lock(w->mutex);
+    size_t space = SD_WRITER_BUFFER_SIZE - w->fill[w->active];
+
+    va_list copy;
+    va_copy(copy, args);
+    int n = vsnprintf((char *) w->buffers[w->active] + w->fill[w->active], space, format, copy);
+    va_end(copy);
+    if (n < 0) {
+        w->stats.dropped_records++;
+        return false;
+    }
+
+    if ((size_t) n >= space) {
+        // Did not fit (vsnprintf needs room for the terminator): retry at the start of the other buffer
+        uint8_t *dst = _sd_writer_reserve(w, n + 1);
+        if (dst == NULL) {
+            w->stats.dropped_records++;
+            return false;
+        }
+        vsnprintf((char *) dst, SD_WRITER_BUFFER_SIZE, format, args);
+    }
+    w->fill[w->active] += n;
+    w->stats.appended_bytes += n;
+    return true;
+}
+
+inline bool sd_writer_printf(sd_writer_t *w, const char *format, ...) {
+    va_list args;
+    va_start(args, format);
+    bool ok = sd_writer_vprintf(w, format, args);
+    va_end(args);
+    return ok;
+}
+
+// Call `on_sync` on the writer thread before every periodic or requested sync, NULL to stop
+inline void sd_writer_on_sync(sd_writer_t *w, void (*on_sync)(void *ctx), void *ctx) {
+    std::lock_guard<std::mutex> lock(w->mutex);
+    w->on_sync = on_sync;
+    w->on_sync_ctx = ctx;
+}
+
+// Write everything appended so far and sync it. Blocks until the data is on the card.
+inline void sd_writer_flush(sd_writer_t *w) {
+    std::unique_lock<std::mutex> lock(w->mutex);
+    if (!w->running) {
+        return; // Stopped: sd_writer_stop() already wrote and synced everything, and no thread would answer
+    }
+    uint64_t generation = w->flush_generation;
+    w->flush_requested = true;
+    w->cv.notify_one();
+    w->flushed_cv.wait(lock, [w, generation] { return w->flush_generation != generation; });
+}
+
+inline void sd_writer_get_stats(sd_writer_t *w, sd_writer_stats_t *stats) {
+    std::lock_guard<std::mutex> lock(w->mutex);
+    *stats = w->stats;
+}
+
+// Write and sync what is buffered, stop the thread and close the backend
+inline void sd_writer_stop(sd_writer_t *w) {
+    {
+        std::lock_guard<std::mutex> lock(w->mutex);
+        w->running = false;
+    }
+    w->cv.notify_one();
+    if (w->thread.joinable()) {
+        w->thread.join();
+    }
+    w->backend.close(w->backend.ctx);
+    _sd_writer_free(w->buffers[0]);
+    _sd_writer_free(w->buffers[1]);
+    w->buffers[0] = NULL;
+    w->buffers[1] = NULL;
+}
+
+#endif //ESP32_CSI_SD_WRITER_COMPONENT_H
@@ -0,0 +1,235 @@
+#ifndef ESP32_CSI_SESSION_COMPONENT_H
+#define ESP32_CSI_SESSION_COMPONENT_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <sys/stat.h>
+
+#include "capture_component.h"
+
+/*
+ * Numbered capture sessions (<dir>/<n>.<ext>) without scanning the card at boot.
+ *
+ * A manifest keeps the next session number, the oldest session still on the card and the total size of
+ * the sessions before the last one. It is stored twice, in <dir>/SESSION.A and <dir>/SESSION.B, and every
+ * update overwrites the older copy, so a power cut during the write leaves the other one intact:
+ *
+ *   manifest:  magic "CSIS" (4) | generation (4) | next (4) | oldest (4) | stored_bytes (8) | crc32 (4)
+ *
+ * Picking the next session costs two manifest reads, one stat() of the previous session and one manifest
+ * write, however many sessions the card holds. Only when both copies are lost is the directory scanned
+ * once to rebuild the manifest.
+ *
+ * With `max_bytes` set, the oldest sessions are deleted at session start until the sessions on the card
+ * (plus `reserve_bytes` for the new one) fit.
+ */
+
+#define SESSION_MANIFEST_MAGIC 0x53495343 // "CSIS"
+#define SESSION_MANIFEST_SIZE 28
+#define SESSION_PATH_LEN 48
+
+typedef struct {
+    uint32_t generation;
+    uint32_t next; // Number of the next session to create
+    uint32_t oldest; // Lowest session number that may still exist
+    uint64_t stored_bytes; // Total size of sessions oldest .. next - 2, the last one is stat()ed at boot
+} session_manifest_t;
+
+typedef struct {
+    char dir[24];
+    char ext[8];
+    uint64_t max_bytes; // 0 = never delete
+    uint64_t reserve_bytes;
+    session_manifest_t manifest;
+    int slot; // Manifest copy written last (0 = A, 1 = B)
+
+    // What the last session_open() had to do
+    bool rebuilt; // Manifest was missing and the directory was scanned
+    uint32_t deleted; // Sessions deleted by the rotation
+    uint64_t total_bytes; // Size of all sessions on the card before the new one
+} session_store_t;
+
+inline void _session_manifest_path(const session_store_t *s, int slot, char *path) {
+    snprintf(path, SESSION_PATH_LEN, "%s/SESSION.%c", s->dir, slot == 0 ? 'A' : 'B');
+}
+
+inline void session_path(const session_store_t *s, uint32_t session, char *path) {
+    snprintf(path, SESSION_PATH_LEN, "%s/%u.%s", s->dir, (unsigned) session, s->ext);
+}
+
+inline bool _session_read_manifest(const session_store_t *s, int slot, session_manifest_t *m) {
+    char path[SESSION_PATH_LEN];
+    _session_manifest_path(s, slot, path);
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        return false;
+    }
+    uint8_t buf[SESSION_MANIFEST_SIZE];
+    bool ok = read(fd, buf, sizeof(buf)) == (ssize_t) sizeof(buf);
+    close(fd);
+    if (!ok || _csi_get_u32(buf) != SESSION_MANIFEST_MAGIC ||
+        capture_crc32(0, buf, SESSION_MANIFEST_SIZE - 4) != _csi_get_u32(buf + SESSION_MANIFEST_SIZE - 4)) {
+        return false;
+    }
+
+    m->generation = _csi_get_u32(buf + 4);
+    m->next = _csi_get_u32(buf + 8);
+    m->oldest = _csi_get_u32(buf + 12);
+    m->stored_bytes = _csi_get_u64(buf + 16);
+    return true;
+}
+
+// Overwrite the older manifest copy and sync it
+inline bool _session_write_manifest(session_store_t *s) {
+    s->manifest.generation++;
+    int slot = 1 - s->slot;
+
+    uint8_t buf[SESSION_MANIFEST_SIZE];
+    _csi_put_u32(buf, SESSION_MANIFEST_MAGIC);
+    _csi_put_u32(buf + 4, s->manifest.generation);
+    _csi_put_u32(buf + 8, s->manifest.next);
+    _csi_put_u32(buf + 12, s->manifest.oldest);
+    _csi_put_u64(buf + 16, s->manifest.stored_bytes);
+    _csi_put_u32(buf + SESSION_MANIFEST_SIZE - 4, capture_crc32(0, buf, SESSION_MANIFEST_SIZE - 4));
+
+    char path[SESSION_PATH_LEN];
+    _session_manifest_path(s, slot, path);
+    int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) {
+        printf("ERROR: cannot write %s [%s]\n", path, strerror(errno));
+        return false;
+    }
+    bool ok = write(fd, buf, sizeof(buf)) == (ssize_t) sizeof(buf) && fsync(fd) == 0;
+    close(fd);
+    if (ok) {
+        s->slot = slot;
+    }
+    return ok;
+}
+
+// Session number of a file name like "12.csi", or -1
+inline long _session_number(const char *name, const char *ext) {
+    char *end;
+    long n = strtol(name, &end, 10);
+    if (end == name || n < 0 || *end != '.' || strcasecmp(end + 1, ext) != 0) {
+        return -1;
+    }
+    return n;
+}
+
+// Rebuild the manifest from the directory, used only when both copies are lost
+inline void _session_rebuild(session_store_t *s) {
+    long lowest = -1;
+    long highest = -1;
+    uint64_t bytes = 0;
+    uint64_t highest_size = 0;
+
+    DIR *dir = opendir(s->dir);
+    if (dir != NULL) {
+        struct dirent *entry;
+        while ((entry = readdir(dir)) != NULL) {
+            long n = _session_number(entry->d_name, s->ext);
+            if (n < 0) {
+                continue;
+            }
+            char path[SESSION_PATH_LEN];
+            session_path(s, (uint32_t) n, path);
+            struct stat st;
+            uint64_t size = stat(path, &st) == 0 ? (uint64_t) st.st_size : 0;
+            bytes += size;
+            if (lowest < 0 || n < lowest) {
+                lowest = n;
+            }
+            if (n > highest) {
+                highest = n;
+                highest_size = size;
+            }
+        }
+        closedir(dir);
+    }
+
+    s->manifest.next = (uint32_t) (highest + 1);
+    s->manifest.oldest = lowest < 0 ? 0 : (uint32_t) lowest;
+    s->manifest.stored_bytes = bytes - highest_size;
+    s->rebuilt = true;
+}
+
+/*
+ * Pick the next session, apply the rotation and persist the manifest. `path` receives the file to open
+ * (SESSION_PATH_LEN bytes). Returns false if the manifest cannot be written.
+ */
+inline bool session_open(session_store_t *s, const char *dir, const char *ext, uint64_t max_bytes,
+                         uint64_t reserve_bytes, char *path) {
+    strncpy(s->dir, dir, sizeof(s->dir) - 1);
+    s->dir[sizeof(s->dir) - 1] = '\0';
+    strncpy(s->ext, ext, sizeof(s->ext) - 1);
+    s->ext[sizeof(s->ext) - 1] = '\0';
+    s->max_bytes = max_bytes;
+    s->reserve_bytes = reserve_bytes;
+    s->rebuilt = false;
+    s->deleted = 0;
+
+    session_manifest_t a;
+    session_manifest_t b;
+    bool has_a = _session_read_manifest(s, 0, &a);
+    bool has_b = _session_read_manifest(s, 1, &b);
+    if (has_a && (!has_b || a.generation >= b.generation)) {
+        s->manifest = a;
+        s->slot = 0;
+    } else if (has_b) {
+        s->manifest = b;
+        s->slot = 1;
+    } else {
+        s->manifest.generation = 0;
+        s->slot = 1;
+        _session_rebuild(s);
+    }
+
+    // The previous session was still open when the manifest was written, its size is only known now
+    uint64_t total = s->manifest.stored_bytes;
+    if (s->manifest.next > s->manifest.oldest) {
+        char previous[SESSION_PATH_LEN];
+        session_path(s, s->manifest.next - 1, previous);
+        struct stat st;
+        if (stat(previous, &st) == 0) {
+            total += st.st_size;
+        }
+    }
+
+    // Rotation: drop the oldest sessions until the new one fits
+    while (s->max_bytes > 0 && total + s->reserve_bytes > s->max_bytes && s->manifest.oldest < s->manifest.next) {
+        char oldest[SESSION_PATH_LEN];
+        session_path(s, s->manifest.oldest, oldest);
+        struct stat st;
+        if (stat(oldest, &st) == 0) {
+            total = total > (uint64_t) st.st_size ? total - st.st_size : 0;
+            unlink(oldest);
+            s->deleted++;
+        }
+        s->manifest.oldest++;
+    }
+    s->total_bytes = total;
+
+    // Persist before the file exists: a crash in between only skips a number
+    uint32_t session = s->manifest.next;
+    s->manifest.next++;
+    s->manifest.stored_bytes = total;
+    if (s->manifest.oldest > session) {
+        s->manifest.oldest = session;
+    }
+    if (!_session_write_manifest(s)) {
+        return false;
+    }
+
+    session_path(s, session, path);
+    return true;
+}
+
+#endif //ESP32_CSI_SESSION_COMPONENT_H
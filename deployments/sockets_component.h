@@ -10,101 +10,125 @@
 #include <sys/socket.h>
 #include <netinet/in.h>
 #include <arpa/inet.h>
-#include "freertos/event_groups.h"
-#include "freertos/task.h"
-#include "esp_system.h"
-#include "esp_wifi.h"
-#include <esp_http_server.h>
+#include "hal_component.h"
 #include "time_component.h"
 #include "csi_component.h"
+#include "csi_packet_component.h"
+#include "csi_codec_component.h"
+#include "pacer_component.h"
+#include "transmitter_component.h"
+#ifdef ARDUINO
 #include <WiFi.h>
+#endif
+
+#define TX_DESTINATION_IP "192.168.4.1" // IP address of the target device
+#define TX_DESTINATION_PORT 2223 // Port to communicate with the target device
+
+#if defined CONFIG_PACKET_RATE && (CONFIG_PACKET_RATE > 0)
+#define TX_PACKET_RATE CONFIG_PACKET_RATE
+#else
+#define TX_PACKET_RATE 100 // Default TX rate (packets per second)
+#endif
+#define TX_PACKET_BURST 4 // Packets that may go out back to back after a stall
 
 extern bool send_csi; // Declare the external variable send_csi for use in this file
 
-char *data = (char *) "1\n"; // Data to be sent over the socket (a simple string "1\n")
+uint8_t packet_buffer[CSI_PACKET_MTU]; // Datagram being assembled from queued CSI records
+csi_stream_entry_t stream_entry; // Record taken from the CSI stream queue
+csi_record_t wire_record; // stream_entry as it goes on the wire (possibly delta coded)
+bool wire_record_pending = false; // wire_record did not fit in the previous datagram
 
-// Function to manage the socket transmission in station mode
-void socket_transmitter_sta_loop(bool (*is_wifi_connected)()) {
-    int socket_fd = -1; // File descriptor for the socket
-    int num_packages_sent = 0; // Counter to track the number of data packages sent
-    int num_packages_to_send = 1; // Desired number of data packages to send
-    bool flag = 1; // Flag to control the transmission loop
-
-    while (flag) {
-        close(socket_fd); // Close any existing socket before reinitializing
-        char *ip = (char *) "192.168.4.1"; // IP address of the target device
-        struct sockaddr_in caddr; // Structure to store the socket address
-        caddr.sin_family = AF_INET; // Address family is IPv4
-        caddr.sin_port = htons(2223); // Port to communicate with the target device
-
-        // Wait until WiFi is connected
-        while (!is_wifi_connected()) {
-            printf("wifi not connected. waiting...\n");
-            vTaskDelay(1000 / portTICK_PERIOD_MS); // Wait for 1 second
-        }
-        printf("initial wifi connection established.\n"); // WiFi connection established
+transmitter_t transmitter; // Owns the UDP socket across Wi-Fi reconnects and AP cycles
+pacer_t tx_pacer; // Paces the datagrams to TX_PACKET_RATE, kept across calls
+bool transmitter_ready = false;
 
-        // Convert the target IP address to a socket address
-        if (inet_aton(ip, &caddr.sin_addr) == 0) {
-            printf("ERROR: inet_aton\n");
-            continue; // If there is an error converting the IP, retry
-        }
+// Define CONFIG_CSI_COMPRESSION before including this header to send frames delta coded
+#ifdef CONFIG_CSI_COMPRESSION
+csi_codec_t codec; // Delta encoder state, one channel per AP
+uint8_t codec_buffer[CSI_CODEC_MAX_ENCODED]; // Encoded payload of wire_record
+bool codec_ready = false;
+#endif
 
-        // Create the socket for communication
-        socket_fd = socket(PF_INET, SOCK_DGRAM, 0); // UDP socket creation
-        if (socket_fd == -1) {
-            printf("ERROR: Socket creation error [%s]\n", strerror(errno));
-            continue; // Retry if socket creation fails
-        }
+// Take the next queued CSI record and prepare it for the wire. Returns false if none is queued.
+bool _next_wire_record() {
+    if (!csi_stream_pop(&stream_entry)) {
+        return false;
+    }
+#ifdef CONFIG_CSI_COMPRESSION
+    if (!codec_ready) {
+        csi_codec_init(&codec, CONFIG_CSI_KEYFRAME_INTERVAL);
+        codec_ready = true;
+    }
+    csi_codec_encode(&codec, &stream_entry.record, &wire_record, codec_buffer);
+#else
+    wire_record = stream_entry.record;
+#endif
+    return true;
+}
 
-        // Connect the socket to the target IP and port
-        if (connect(socket_fd, (const struct sockaddr *) &caddr, sizeof(struct sockaddr)) == -1) {
-            printf("ERROR: socket connection error [%s]\n", strerror(errno));
-            continue; // Retry if socket connection fails
-        }
+// Batch queued CSI records into packet_buffer and return the datagram length.
+// With nothing queued an empty packet is built, which still makes the AP answer with CSI.
+size_t _build_csi_packet() {
+    csi_packet_writer_t writer;
+    csi_packet_begin(&writer, packet_buffer, sizeof(packet_buffer), csi_device_id);
 
-        printf("sending frames.\n"); // Indicate that the transmission process has started
-        double lag = 0.0; // Variable to track the transmission lag
+    while (wire_record_pending || _next_wire_record()) {
+        if (!csi_packet_append(&writer, &wire_record)) {
+            wire_record_pending = true; // Goes first in the next datagram
+            break;
+        }
+        wire_record_pending = false;
+    }
 
-        // Loop to send the data packages while the conditions are met
-        while (send_csi && num_packages_sent < num_packages_to_send) { // Check if data should be sent
-            double start_time = get_steady_clock_timestamp(); // Record the start time
+    return csi_packet_finish(&writer);
+}
 
-            if (!is_wifi_connected()) {
-                printf("ERROR: wifi is not connected\n");
-                break; // Exit the loop if WiFi is disconnected
-            }
+// Start the transmitter the first time it is needed, it then lives across AP cycles
+bool _ensure_transmitter(bool (*is_wifi_connected)()) {
+    if (!transmitter_ready) {
+        if (!transmitter_start(&transmitter, TX_DESTINATION_IP, TX_DESTINATION_PORT, is_wifi_connected)) {
+            return false;
+        }
+        pacer_init(&tx_pacer, TX_PACKET_RATE, TX_PACKET_BURST);
+        metrics_exporter_start(&metrics_exporter, TX_DESTINATION_IP, METRICS_UDP_PORT, CONFIG_METRICS_INTERVAL_MS,
+                               csi_device_id); // tools/csi_metrics listen
+        transmitter_ready = true;
+    }
+    return true;
+}
 
-            // Send the data over the socket
-            if (sendto(socket_fd, &data, strlen(data), 0, (const struct sockaddr *) &caddr, sizeof(caddr)) !=
-                strlen(data)) {
-                vTaskDelay(1); // Retry after a short delay if the send fails
-                continue;
-            }
+// Function to manage the socket transmission in station mode
+void socket_transmitter_sta_loop(bool (*is_wifi_connected)()) {
+    int num_packages_sent = 0; // Counter to track the number of data packages sent
+    int num_packages_to_send = 1; // Desired number of data packages to send
 
-            num_packages_sent++; // Increment the counter for each successful transmission
+    // Wait until WiFi is connected
+    while (!is_wifi_connected()) {
+        printf("wifi not connected. waiting...\n");
+        hal_delay_ms(1000); // Wait for 1 second
+    }
 
-            // If a custom packet rate is defined, adjust the transmission rate
-#if defined CONFIG_PACKET_RATE && (CONFIG_PACKET_RATE > 0)
-            double wait_duration = (1000.0 / CONFIG_PACKET_RATE) - lag; // Calculate the wait time
-            int w = floor(wait_duration); // Round down to the nearest whole number
-            vTaskDelay(w); // Delay before sending the next package
-#else
-            vTaskDelay(10); // Default delay to limit the TX rate (approximately 100 per second)
-#endif
+    // The socket is created once and kept, later calls only queue datagrams
+    if (!_ensure_transmitter(is_wifi_connected)) {
+        return;
+    }
+    metrics_exporter_poll(&metrics_exporter); // A snapshot every CONFIG_METRICS_INTERVAL_MS
 
-            double end_time = get_steady_clock_timestamp(); // Record the end time
-            lag = end_time - start_time; // Update the lag based on the elapsed time
+    // Loop to send the data packages while the conditions are met
+    while (send_csi && num_packages_sent < num_packages_to_send) { // Check if data should be sent
+        if (!is_wifi_connected()) {
+            printf("ERROR: wifi is not connected\n");
+            break; // Exit the loop if WiFi is disconnected
         }
 
-        close(socket_fd); // Close the socket after sending the data
-        if (num_packages_sent == num_packages_to_send) { 
-            flag = 0; // Stop the loop if the desired number of packages has been sent
-        }
+        pacer_wait(&tx_pacer); // Wait for this packet's slot (absolute deadlines, no drift)
+
+        // Queue the CSI captured so far as one batched datagram, the sender thread does the I/O
+        size_t packet_size = _build_csi_packet();
+        transmitter_submit(&transmitter, packet_buffer, packet_size);
 
-        // Deinitialize CSI after the data package has been sent
-        csi_deinit();
+        num_packages_sent++; // Increment the counter for each transmission
     }
 }
 
-#endif // SOCKET_COMPONENT_H
\ No newline at end of file
+#endif // SOCKET_COMPONENT_H
\ No newline at end of file
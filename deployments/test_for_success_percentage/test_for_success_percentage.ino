@@ -2,7 +2,21 @@
 #include <WiFi.h>
 #include "sockets_component.h"
 #include "csi_component.h"
+#include "profile_component.h" // Per-stage timing of run_ei(), compiled out by defining CONFIG_PROFILE 0 before it
+#if __has_include("csi_norm_table.h")
+#include "csi_norm_table.h" // tools/csi_norm fit, for models trained on standardized features
+#endif
+#if __has_include("csi_cascade_registry.h")
+#include "csi_cascade_registry.h" // tools/csi_cascade fit -x: a room model, then the fine model of the room
+#define NATIVE_MODEL 2
+#elif __has_include("csi_model_container.h")
+#include "model_store_component.h"
+#include "csi_model_container.h" // tools/csi_model fit -x, run natively instead of through Edge Impulse
+#define NATIVE_MODEL 1
+#else
 #include <regresion_lineal_pasillo_habtprinc_inferencing.h>
+#define NATIVE_MODEL 0
+#endif
 
 #define SIZE_SUB_ARRAY 387 // Adjust as needed
 #define NUM_SSIDS 3        
@@ -29,92 +43,179 @@ bool isWiFiConnected() {
     return WiFi.isConnected();
 }
 
-int rssi_chain[NUM_SSIDS]; // Array for storing RSSI values of each network
+int rssi_chain[NUM_SSIDS]; // RSSI of each network, read by csi_complete (csi_component.h)
 
-// Function to fill an output buffer with CSI data and add RSSI values at specific intervals
-int csi_complete_a(unsigned int start_index, unsigned int max_size, float* out_ptr) {
-    int rssi_time = 0; // Interval for adding RSSI data
-    int j = 0; // Counter for RSSI data
-    size_t flag_rssi = 1; // Not used in the code, but declared
+#if NATIVE_MODEL
+static bool sd_mounted = false;
 
-    // Calculate the maximum data to copy based on buffer limits
-    size_t size_to_copy = (start_index + max_size <= csi_buffer_size) ? max_size : (csi_buffer_size - start_index);
+// A model runs only if it takes this sketch's features, standardized with the table it comes with
+bool activate_model(const model_slot_t *slot) {
+    return model_slot_inputs(slot) == SIZE_SUB_ARRAY && csi_set_normalization(&slot->norm);
+}
 
-    for (size_t i = 0; i < size_to_copy; i++) {
-      x++;
-        if (i == rssi_time && j < 3) {  // Condition to insert RSSI values without exceeding bounds
-            out_ptr[i] = rssi_chain[j];
-            rssi_time += 129;
-            j++;
-        }
-        out_ptr[i] = csi_buffer[i + start_index];
+bool mount_sd() {
+    hal_sd_pins_t pins = {2, 15, 14, 13}; // As sd_component.h
+    sd_mounted = sd_mounted || hal_fs_mount(&pins, 16 * 1024);
+    return sd_mounted;
+}
+#endif
+
+#if NATIVE_MODEL == 2
+static cascade_t cascade; // The room model, and the fine model of the last room, loaded when the room changes
+#elif NATIVE_MODEL
+#define MODEL_PARTITION "model" // partitions.csv, written with parttool.py write_partition
+static model_store_t model_store; // The model runs from the container where it lies, swapped between cycles
+
+// "MODEL <partition>" or "MODEL /sdcard/<file>": staged now, running from the next inference
+bool stage_model(const char *source) {
+    if (source[0] != '/') {
+        return model_store_stage_partition(&model_store, source);
     }
-
-    return size_to_copy; // Return the amount of data copied
+    return mount_sd() && model_store_stage_file(&model_store, source);
 }
-
-// Similar function to fill output buffer, adding RSSI values at specific intervals and avoiding index overflows
-int csi_complete(unsigned int start_index, unsigned int max_size, float* out_ptr) {
-    int rssi_time = 0; // Interval for adding RSSI data
-    int j = 0; // Counter for RSSI data
-    size_t flag_rssi = 1;
-    size_t avanza = 0; // Variable to track buffer index
-
-    // Calculate the maximum data to copy based on buffer limits
-    size_t size_to_copy = (start_index + max_size <= csi_buffer_size) ? max_size : (csi_buffer_size - start_index);
-
-    for (size_t i = 0; i < size_to_copy; i++) {
-        if (i == rssi_time && j < 3) {  // Condition to insert RSSI values
-            out_ptr[i] = rssi_chain[j];
-            rssi_time += 129;
-            j++;
-            i++; // Adjust index after adding RSSI
-        }
-        out_ptr[i] = csi_buffer[avanza + start_index];
-        avanza++;
+#endif
+
+// "PROFILE": the stage timings as CSV on the console. "PROFILE <ip> [port]": a binary snapshot to
+// tools/csi_profile listen.
+void export_profile(const char *args) {
+    char ip[16];
+    unsigned port = PROFILE_UDP_PORT;
+    if (sscanf(args, "%15s %u", ip, &port) < 1) {
+        static char csv[1024];
+        profile_write_csv(csv, sizeof(csv));
+        Serial.print(csv);
+        return;
     }
+    struct sockaddr_in to = {};
+    to.sin_family = AF_INET;
+    to.sin_port = htons(port);
+    int fd = socket(PF_INET, SOCK_DGRAM, 0);
+    if (fd < 0 || inet_aton(ip, &to.sin_addr) == 0) {
+        Serial.println("ERROR: cannot send the profile there");
+    } else if (profile_send(fd, &to)) {
+        Serial.println("Profile sent");
+    }
+    if (fd >= 0) {
+        close(fd);
+    }
+}
 
-    return size_to_copy;
+METRICS_HISTOGRAM(wifi_connect_metric, "wifi.connect_ms"); // WiFi.begin until connected, per AP
+METRICS_COUNTER(wifi_failures_metric, "wifi.failures", 1); // Gave up on an AP and restarted
+METRICS_HISTOGRAM(ei_cycle_metric, "ei.cycle_us"); // run_ei()
+
+// "METRICS": every metric on the console. "METRICS <ip> [port] [interval ms]" or "METRICS OFF": snapshots to
+// tools/csi_metrics listen, as the METRICS command of the stations.
+void metrics_serial(const char *input) {
+    char line[64];
+    snprintf(line, sizeof(line), "%s", input);
+    char *argv[5];
+    int argc = 0;
+    char *save = NULL;
+    for (char *tok = strtok_r(line, " ", &save); tok != NULL && argc < 5; tok = strtok_r(NULL, " ", &save)) {
+        argv[argc++] = tok;
+    }
+    char reply[128];
+    if (metrics_command(argc, argv, reply, sizeof(reply))) {
+        Serial.println(reply);
+    } else {
+        Serial.println("ERROR: usage: METRICS [<ip> [port] [interval ms] | OFF]");
+    }
 }
 
-// Run the Edge Impulse model for inference on CSI data
-void run_ei() {
+// Run the Edge Impulse model for inference on CSI data and print the result. Returns early when there is
+// none; run_ei() resets the cycle either way.
+void classify_csi() {
+#if NATIVE_MODEL == 2
+    cascade_result_t cascade_result;
+    int rc;
+    {
+        PROFILE_SCOPE(PROFILE_CLASSIFIER);
+        rc = cascade_run(&cascade, PROFILE_GET_DATA(int16_t, csi_complete_q), &cascade_result);
+    }
+    if (rc != 0) {
+        Serial.println("Classification error.");
+        return;
+    }
+    profile_add(PROFILE_INFERENCE, cascade_result.room_us + cascade_result.fine_us);
+    if (!cascade_result.located) {
+        Serial.printf("Room %s, no fine model for it\n", cascade_result.room);
+        return;
+    }
+    model_result_t &result = cascade_result.fine;
+    size_t label_count = result.count;
+#elif NATIVE_MODEL
+    model_result_t result;
+    int rc;
+    {
+        PROFILE_SCOPE(PROFILE_CLASSIFIER);
+        rc = model_store_run(&model_store, PROFILE_GET_DATA(int16_t, csi_complete_q), &result);
+    }
+    if (rc != 0) {
+        Serial.println("Classification error.");
+        return;
+    }
+    profile_add(PROFILE_INFERENCE, result.timing_us);
+    size_t label_count = result.count;
+#else
     signal_t signal;
     signal.total_length = SIZE_SUB_ARRAY;
-    signal.get_data = &csi_complete;
+    signal.get_data = PROFILE_GET_DATA(float, csi_complete);
 
     ei_impulse_result_t result;
-    EI_IMPULSE_ERROR err = run_classifier(&signal, &result, true);
+    EI_IMPULSE_ERROR err;
+    {
+        PROFILE_SCOPE(PROFILE_CLASSIFIER);
+        err = run_classifier(&signal, &result, true);
+    }
     if (err != EI_IMPULSE_OK) {
         Serial.println("Classification error.");
         return;
     }
-
-    Serial.println("Predictions:");
+    profile_add(PROFILE_DSP, result.timing.dsp_us);
+    profile_add(PROFILE_INFERENCE, result.timing.classification_us);
+#if EI_CLASSIFIER_HAS_ANOMALY
+    profile_add(PROFILE_ANOMALY, result.timing.anomaly_us);
+#endif
+    size_t label_count = EI_CLASSIFIER_LABEL_COUNT;
+#endif
+
+    // Find the label with highest confidence
     float max_value = -1.0;
     const char* max_label = nullptr;
-
-    // Print each classification result and find the label with highest confidence
-    for (size_t ix = 0; ix < EI_CLASSIFIER_LABEL_COUNT; ix++) {
-        Serial.print(result.classification[ix].label);
-        Serial.print(": ");
-        Serial.print(result.classification[ix].value * 100, 2);
-        Serial.println("%");
-
-        if (result.classification[ix].value > max_value) {
-            max_value = result.classification[ix].value;
-            max_label = result.classification[ix].label;
+    {
+        PROFILE_SCOPE(PROFILE_POST);
+        for (size_t ix = 0; ix < label_count; ix++) {
+            if (result.classification[ix].value > max_value) {
+                max_value = result.classification[ix].value;
+                max_label = result.classification[ix].label;
+            }
         }
     }
 
-    Serial.print("Classification: ");
-    Serial.print(max_label);
-    Serial.print(" with confidence ");
-    Serial.print(max_value * 100, 2);
-    Serial.println("%");
+    // Print each classification result
+    {
+        PROFILE_SCOPE(PROFILE_PUBLISH);
+#if NATIVE_MODEL == 2
+        Serial.printf("Room %s with confidence %.2f%%\n", cascade_result.room, cascade_result.room_confidence * 100);
+#elif NATIVE_MODEL
+        Serial.printf("Model version %u (%s)\n", (unsigned) model_store_active(&model_store)->version,
+                      model_store_active(&model_store)->source);
+#endif
+        Serial.println("Predictions:");
+        for (size_t ix = 0; ix < label_count; ix++) {
+            Serial.print(result.classification[ix].label);
+            Serial.print(": ");
+            Serial.print(result.classification[ix].value * 100, 2);
+            Serial.println("%");
+        }
 
-    reset_csi_buffer(); // Reset CSI data buffer
-    csi_data_vector.clear();  // Clear stored CSI data
+        Serial.print("Classification: ");
+        Serial.print(max_label);
+        Serial.print(" with confidence ");
+        Serial.print(max_value * 100, 2);
+        Serial.println("%");
+    }
 }
 
 // Reset the CSI data buffer index
@@ -122,6 +223,14 @@ void reset_csi_buffer() {
     csi_buffer_index = 0;
 }
 
+// One inference on the cycle's CSI. The next cycle starts from an empty buffer and arena whatever the
+// classifier did, so "MODEL" can run the test again without a restart.
+void run_ei() {
+    classify_csi();
+    reset_csi_buffer(); // Reset CSI data buffer
+    csi_cycle_reset();  // Release stored CSI data
+}
+
 void setup() {
   Serial.begin(115200);
 
@@ -143,6 +252,37 @@ void setup() {
       delay(100);
   }
 
+#ifdef CSI_NORM_TABLE_H
+  if (!csi_set_normalization(&csi_norm_table)) {
+    Serial.println("Normalization table does not match SIZE_SUB_ARRAY, features stay raw");
+  }
+#endif
+#if NATIVE_MODEL == 2
+  // Fine models on the SD card need it mounted; the others are mapped where they lie
+  for (size_t i = 0; i < sizeof(csi_cascade_registry) / sizeof(csi_cascade_registry[0]); i++) {
+    if (csi_cascade_registry[i].data == NULL && csi_cascade_registry[i].source[0] == '/') {
+      mount_sd();
+    }
+  }
+  if (!cascade_init(&cascade, &csi_cascade_room_model, csi_cascade_registry,
+                    sizeof(csi_cascade_registry) / sizeof(csi_cascade_registry[0]), &activate_model)) {
+    Serial.println("Room model does not load");
+    while (true) {
+      delay(1000);
+    }
+  }
+#elif NATIVE_MODEL
+  // The model flashed into the partition if there is one, else the one built in. model_store_run swaps it in.
+  model_store_init(&model_store, &activate_model);
+  if (!model_store_stage_partition(&model_store, MODEL_PARTITION) &&
+      !model_store_stage_memory(&model_store, csi_model_container, sizeof(csi_model_container), "built in")) {
+    Serial.println("Model container does not load");
+    while (true) {
+      delay(1000);
+    }
+  }
+#endif
+
   csi_buffer_index = 0;
 }
 
@@ -157,6 +297,7 @@ void loop() {
       unsigned long start = millis();
       while (WiFi.status() != WL_CONNECTED) {
           if (millis() - start > 50000) {
+              metric_add(&wifi_failures_metric);
               Serial.println("Failed to connect");
               ESP.restart();
               break;
@@ -166,6 +307,7 @@ void loop() {
       }
 
       if (WiFi.status() == WL_CONNECTED) {
+          metric_observe(&wifi_connect_metric, millis() - start);
           Serial.println("Connected");
           get_AP(ssid_list[i]);
 
@@ -189,16 +331,47 @@ void loop() {
   }
 
   // Run the Edge Impulse classifier
-  run_ei();
+  {
+    PROFILE_SCOPE(PROFILE_CYCLE);
+    METRICS_SCOPE(ei_cycle_metric);
+    run_ei();
+  }
+  profile_cycle_end();
 
   Serial.println("TEST COMPLETED");
   Serial.println("------------------------------------------------------------------------------");
 
-  // Ask for a reset confirmation
+  // Ask for a reset confirmation. With the native model, "MODEL <source>" loads another one and runs the test
+  // again with it instead. "PROFILE" exports the stage timings, "HEAP" prints the arena and heap use and
+  // "METRICS" prints or exports the metrics, all three keep waiting.
   while (!reset) {
+    metrics_exporter_poll(&metrics_exporter);
     if (Serial.available() > 0) {
         String input = Serial.readStringUntil('\n');
-        input.c_str();
+        input.trim();
+        if (input.startsWith("PROFILE")) {
+            export_profile(input.c_str() + 7);
+            continue;
+        }
+        if (input.startsWith("METRICS")) {
+            metrics_serial(input.c_str());
+            continue;
+        }
+        if (input == "HEAP") {
+            char report[256];
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                arena_report(&csi_arena, report, sizeof(report));
+            }
+            Serial.println(report);
+            continue;
+        }
+#if NATIVE_MODEL == 1
+        if (input.startsWith("MODEL ")) {
+            Serial.println(stage_model(input.c_str() + 6) ? "Model staged" : "Model rejected, keeping the current one");
+            return;
+        }
+#endif
         ESP.restart();
         reset = true;
         }
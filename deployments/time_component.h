@@ -1,7 +1,20 @@
 #ifndef ESP32_CSI_TIME_COMPONENT_H
 #define ESP32_CSI_TIME_COMPONENT_H
 
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/time.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
 #include <chrono>
+#include <mutex>
+
+#include "hal_component.h"
+#include "csi_packet_component.h"
 
 static char *SET_TIMESTAMP_SIMPLE_TEMPLATE = (char *) "%li.%li";
 static char *SET_TIMESTAMP_TEMPLATE = (char *) "SETTIME: %li.%li";
@@ -30,14 +43,315 @@ void time_set(char *timestamp_string) {
     }
 }
 
+// Microseconds since boot, never goes backwards
+inline int64_t time_monotonic_us() {
+    return hal_monotonic_us();
+}
+
+// Microseconds since the epoch, as set by time_set() (or 1970 plus uptime if it never was)
+inline int64_t time_system_us() {
+    return std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::system_clock::now().time_since_epoch()).count();
+}
+
 double get_system_clock_timestamp() {
     // returns timestamp in seconds (with decimal places)
-    return std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::system_clock::now().time_since_epoch()).count() / 1000000.0;
+    return time_system_us() / 1000000.0;
 }
 
 double get_steady_clock_timestamp() {
     // returns timestamp in seconds (with decimal places)
-    return std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now().time_since_epoch()).count() / 1000000.0;
+    return time_monotonic_us() / 1000000.0;
+}
+
+/*
+ * NTP-style time sync against a reference server on the collector host (tools/csi_time_sync serve).
+ *
+ *   message:  magic "CSTS" (4) | type (1) | reserved (3) | seq (4) | reserved (4)
+ *             | t1 (8) | t2 (8) | t3 (8)
+ *
+ * The station sends a request stamped t1 with its monotonic clock; the server stamps t2 on receive and t3
+ * on send with its reference clock (epoch microseconds) and echoes t1. With t4 the arrival time back at
+ * the station:
+ *
+ *   offset = ((t2 - t1) + (t3 - t4)) / 2      rtt = (t4 - t1) - (t3 - t2)
+ *
+ * The offset is exact when both directions take equally long, so a round sends a burst of requests and
+ * keeps only the one with the smallest RTT, the one least disturbed by queueing. The last rounds are fitted
+ * with a line, offset(local) = offset + drift * (local - local_ref), which also follows the crystal drift
+ * between rounds. All fields are little endian.
+ */
+
+#define TIME_SYNC_MAGIC 0x53545343 // "CSTS"
+#define TIME_SYNC_MESSAGE_SIZE 40
+#define TIME_SYNC_REQUEST 1
+#define TIME_SYNC_RESPONSE 2
+#define TIME_SYNC_PORT 2224
+#define TIME_SYNC_BURST 8 // Requests per round, the one with the smallest RTT is kept
+#define TIME_SYNC_POINTS 8 // Rounds the drift is fitted over
+#define TIME_SYNC_TIMEOUT_MS 50 // Wait for one response
+
+#ifndef CONFIG_TIME_SYNC_INTERVAL_MS
+#define CONFIG_TIME_SYNC_INTERVAL_MS 10000
+#endif
+
+typedef int64_t (*time_clock_t)(void *ctx); // Local clock in microseconds
+
+typedef struct {
+    int64_t local_us; // Local time the offset applies to (midpoint of t1 and t4)
+    int64_t offset_us; // Reference minus local
+    int64_t rtt_us;
+} time_sync_point_t;
+
+typedef struct {
+    uint64_t rounds;
+    uint64_t failed_rounds; // No response at all
+    uint64_t requests;
+    uint64_t timeouts;
+    int64_t last_rtt_us; // RTT of the sample kept in the last round
+    int64_t last_offset_us;
+    double drift_ppm;
+    int64_t round_us; // Time the last round took
+} time_sync_stats_t;
+
+typedef struct {
+    time_clock_t clock;
+    void *clock_ctx;
+    struct sockaddr_in server;
+    int socket_fd;
+    uint32_t seq;
+    int64_t last_round_us;
+
+    time_sync_point_t points[TIME_SYNC_POINTS];
+    size_t point_count;
+    size_t point_next;
+
+    std::mutex mutex; // Guards the fit, read from the CSI callback
+    bool synced;
+    int64_t fit_local_us;
+    int64_t fit_offset_us;
+    double drift; // Seconds of offset gained per second of local time
+    int64_t last_now_us; // time_sync_now_us() never goes backwards
+
+    time_sync_stats_t stats;
+} time_sync_t;
+
+time_sync_t time_sync; // Shared timebase of the station, used for the CSI record timestamps
+
+inline int64_t _time_default_clock(void *) {
+    return time_monotonic_us();
+}
+
+inline void _time_sync_encode(uint8_t *buf, uint8_t type, uint32_t seq, int64_t t1, int64_t t2, int64_t t3) {
+    memset(buf, 0, TIME_SYNC_MESSAGE_SIZE);
+    _csi_put_u32(buf, TIME_SYNC_MAGIC);
+    buf[4] = type;
+    _csi_put_u32(buf + 8, seq);
+    _csi_put_u64(buf + 16, (uint64_t) t1);
+    _csi_put_u64(buf + 24, (uint64_t) t2);
+    _csi_put_u64(buf + 32, (uint64_t) t3);
+}
+
+inline bool _time_sync_decode(const uint8_t *buf, ssize_t len, uint8_t type, uint32_t *seq, int64_t *t1, int64_t *t2,
+                              int64_t *t3) {
+    if (len != TIME_SYNC_MESSAGE_SIZE || _csi_get_u32(buf) != TIME_SYNC_MAGIC || buf[4] != type) {
+        return false;
+    }
+    *seq = _csi_get_u32(buf + 8);
+    *t1 = (int64_t) _csi_get_u64(buf + 16);
+    *t2 = (int64_t) _csi_get_u64(buf + 24);
+    *t3 = (int64_t) _csi_get_u64(buf + 32);
+    return true;
+}
+
+/*
+ * Prepare a sync against `server_ip`:`port`. `clock` is the local clock (NULL = time_monotonic_us), a
+ * host can pass a simulated one.
+ */
+inline bool time_sync_init(time_sync_t *s, const char *server_ip, uint16_t port, time_clock_t clock, void *clock_ctx) {
+    s->clock = clock != NULL ? clock : &_time_default_clock;
+    s->clock_ctx = clock_ctx;
+    s->seq = 0;
+    s->last_round_us = 0;
+    s->point_count = 0;
+    s->point_next = 0;
+    s->synced = false;
+    s->last_now_us = 0;
+    memset(&s->stats, 0, sizeof(s->stats));
+
+    memset(&s->server, 0, sizeof(s->server));
+    s->server.sin_family = AF_INET;
+    s->server.sin_port = htons(port);
+    s->server.sin_addr.s_addr = inet_addr(server_ip);
+
+    s->socket_fd = socket(PF_INET, SOCK_DGRAM, 0);
+    if (s->socket_fd == -1) {
+        printf("ERROR: Socket creation error [%s]\n", strerror(errno));
+        return false;
+    }
+    struct timeval timeout = {0, TIME_SYNC_TIMEOUT_MS * 1000};
+    setsockopt(s->socket_fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+    return true;
+}
+
+// Least squares line through the kept points (the caller holds the mutex)
+inline void _time_sync_fit(time_sync_t *s) {
+    const time_sync_point_t *last = &s->points[(s->point_next + TIME_SYNC_POINTS - 1) % TIME_SYNC_POINTS];
+    double mean_x = 0, mean_y = 0;
+    for (size_t i = 0; i < s->point_count; i++) {
+        mean_x += (double) (s->points[i].local_us - last->local_us);
+        mean_y += (double) (s->points[i].offset_us - last->offset_us);
+    }
+    mean_x /= s->point_count;
+    mean_y /= s->point_count;
+
+    double sxx = 0, sxy = 0;
+    for (size_t i = 0; i < s->point_count; i++) {
+        double dx = (double) (s->points[i].local_us - last->local_us) - mean_x;
+        double dy = (double) (s->points[i].offset_us - last->offset_us) - mean_y;
+        sxx += dx * dx;
+        sxy += dx * dy;
+    }
+    s->drift = sxx > 0 ? sxy / sxx : 0;
+
+    // Anchor the line at the newest point, where it matters most
+    s->fit_local_us = last->local_us;
+    s->fit_offset_us = last->offset_us + (int64_t) (mean_y - s->drift * mean_x);
+    s->synced = true;
+}
+
+/*
+ * One sync round: a burst of requests, the sample with the smallest RTT is added to the fit. Blocks for
+ * at most TIME_SYNC_BURST * TIME_SYNC_TIMEOUT_MS. Returns false if no response came back.
+ */
+inline bool time_sync_round(time_sync_t *s) {
+    int64_t start = s->clock(s->clock_ctx);
+    time_sync_point_t best = {0, 0, INT64_MAX};
+    uint8_t buf[TIME_SYNC_MESSAGE_SIZE];
+    uint64_t timeouts = 0;
+
+    for (int i = 0; i < TIME_SYNC_BURST; i++) {
+        uint32_t seq = ++s->seq;
+        int64_t t1 = s->clock(s->clock_ctx);
+        _time_sync_encode(buf, TIME_SYNC_REQUEST, seq, t1, 0, 0);
+        if (sendto(s->socket_fd, buf, sizeof(buf), 0, (const struct sockaddr *) &s->server, sizeof(s->server)) !=
+            (ssize_t) sizeof(buf)) {
+            continue;
+        }
+
+        // Responses to earlier requests that timed out may still arrive, skip them
+        while (true) {
+            ssize_t len = recv(s->socket_fd, buf, sizeof(buf), 0);
+            int64_t t4 = s->clock(s->clock_ctx);
+            uint32_t got_seq;
+            int64_t echo, t2, t3;
+            if (len < 0) {
+                timeouts++;
+                break;
+            }
+            if (!_time_sync_decode(buf, len, TIME_SYNC_RESPONSE, &got_seq, &echo, &t2, &t3) || got_seq != seq ||
+                echo != t1) {
+                continue;
+            }
+            int64_t rtt = (t4 - t1) - (t3 - t2);
+            if (rtt < best.rtt_us) {
+                best.rtt_us = rtt;
+                best.local_us = t1 + (t4 - t1) / 2;
+                best.offset_us = ((t2 - t1) + (t3 - t4)) / 2;
+            }
+            break;
+        }
+    }
+    s->last_round_us = s->clock(s->clock_ctx);
+
+    std::lock_guard<std::mutex> lock(s->mutex);
+    s->stats.rounds++;
+    s->stats.requests += TIME_SYNC_BURST;
+    s->stats.timeouts += timeouts;
+    s->stats.round_us = s->last_round_us - start;
+    if (best.rtt_us == INT64_MAX) {
+        s->stats.failed_rounds++;
+        return false;
+    }
+
+    s->points[s->point_next] = best;
+    s->point_next = (s->point_next + 1) % TIME_SYNC_POINTS;
+    if (s->point_count < TIME_SYNC_POINTS) {
+        s->point_count++;
+    }
+    _time_sync_fit(s);
+    s->stats.last_rtt_us = best.rtt_us;
+    s->stats.last_offset_us = best.offset_us;
+    s->stats.drift_ppm = -s->drift * 1e6; // Positive: the local clock runs fast
+    return true;
+}
+
+// Run a round if CONFIG_TIME_SYNC_INTERVAL_MS has passed since the last one (0 disables the sync)
+inline bool time_sync_maybe_round(time_sync_t *s) {
+    if (CONFIG_TIME_SYNC_INTERVAL_MS == 0 || s->clock == NULL || s->socket_fd == -1 ||
+        (s->last_round_us != 0 && s->clock(s->clock_ctx) - s->last_round_us < CONFIG_TIME_SYNC_INTERVAL_MS * 1000LL)) {
+        return false;
+    }
+    return time_sync_round(s);
+}
+
+inline int64_t _time_sync_apply(const time_sync_t *s, int64_t local_us) {
+    return local_us + s->fit_offset_us + (int64_t) (s->drift * (double) (local_us - s->fit_local_us));
+}
+
+// Reference time of a local clock reading, or -1 before the first successful round
+inline int64_t time_sync_to_reference(time_sync_t *s, int64_t local_us) {
+    std::lock_guard<std::mutex> lock(s->mutex);
+    return s->synced ? _time_sync_apply(s, local_us) : -1;
+}
+
+// Current reference time or -1 if not synced; a refit can move the line, but the result never goes backwards
+inline int64_t time_sync_now_us(time_sync_t *s) {
+    std::lock_guard<std::mutex> lock(s->mutex);
+    if (!s->synced) {
+        return -1;
+    }
+    int64_t now = _time_sync_apply(s, s->clock(s->clock_ctx));
+    if (now < s->last_now_us) {
+        now = s->last_now_us;
+    }
+    s->last_now_us = now;
+    return now;
+}
+
+inline void time_sync_get_stats(time_sync_t *s, time_sync_stats_t *out) {
+    std::lock_guard<std::mutex> lock(s->mutex);
+    *out = s->stats;
+}
+
+inline void time_sync_close(time_sync_t *s) {
+    if (s->socket_fd != -1) {
+        close(s->socket_fd);
+        s->socket_fd = -1;
+    }
+}
+
+// Timestamp for captured data: the synced reference time once a round succeeded, the system clock before
+inline int64_t time_now_us() {
+    int64_t now = time_sync_now_us(&time_sync);
+    return now >= 0 ? now : time_system_us();
+}
+
+// Reference server side: answer one request on `fd`, stamping with `clock` (epoch microseconds by default)
+inline bool time_server_handle(int fd, time_clock_t clock, void *clock_ctx) {
+    uint8_t buf[TIME_SYNC_MESSAGE_SIZE];
+    struct sockaddr_in from;
+    socklen_t from_len = sizeof(from);
+    ssize_t len = recvfrom(fd, buf, sizeof(buf), 0, (struct sockaddr *) &from, &from_len);
+    int64_t t2 = clock != NULL ? clock(clock_ctx) : time_system_us();
+
+    uint32_t seq;
+    int64_t t1, unused2, unused3;
+    if (!_time_sync_decode(buf, len, TIME_SYNC_REQUEST, &seq, &t1, &unused2, &unused3)) {
+        return false;
+    }
+    int64_t t3 = clock != NULL ? clock(clock_ctx) : time_system_us();
+    _time_sync_encode(buf, TIME_SYNC_RESPONSE, seq, t1, t2, t3);
+    return sendto(fd, buf, sizeof(buf), 0, (const struct sockaddr *) &from, from_len) == (ssize_t) sizeof(buf);
 }
 
 #endif //ESP32_CSI_TIME_COMPONENT_H
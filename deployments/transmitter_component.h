@@ -0,0 +1,246 @@
+#ifndef ESP32_CSI_TRANSMITTER_COMPONENT_H
+#define ESP32_CSI_TRANSMITTER_COMPONENT_H
+
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+
+#include "metrics_component.h"
+
+/*
+ * Long-lived UDP transmitter.
+ *
+ * The destination is resolved and the socket created once, then kept across Wi-Fi disconnects and
+ * AP changes. When the link comes back the existing socket is only re-connect()ed, which is enough
+ * for lwIP to pick the new source address; a new socket is created only if that fails.
+ *
+ * Producers call transmitter_submit(), which copies the datagram into a bounded queue and returns
+ * immediately. A sender thread drains the queue. When the queue is full the oldest datagram is
+ * dropped, since fresh CSI is worth more than stale CSI. A datagram leaves the queue only once the
+ * socket is bound, so every submitted datagram ends up sent, dropped or a send error.
+ *
+ * Besides the per-transmitter stats, every transmitter counts into the tx.* metrics (metrics_component.h).
+ */
+
+#define TRANSMITTER_QUEUE_LEN 8 // Datagrams waiting to be sent
+#define TRANSMITTER_MAX_DATAGRAM 1472
+#define TRANSMITTER_LINK_POLL_MS 100 // How often a sender waiting for Wi-Fi checks the link again
+
+typedef struct {
+    uint64_t submitted;
+    uint64_t sent;
+    uint64_t dropped; // Overwritten in the queue, or still queued at transmitter_stop()
+    uint64_t send_errors;
+    uint32_t sockets_opened;
+    uint32_t rebinds; // connect() calls after the link came back
+} transmitter_stats_t;
+
+METRICS_COUNTER(tx_sent_metric, "tx.sent", 1);
+METRICS_COUNTER(tx_dropped_metric, "tx.dropped", 1); // Overwritten in the queue or discarded at stop
+METRICS_COUNTER(tx_send_errors_metric, "tx.send_errors", 1);
+METRICS_COUNTER(tx_socket_errors_metric, "tx.socket_errors", 1); // Bad address, socket() or connect() failed
+METRICS_COUNTER(tx_rebinds_metric, "tx.rebinds", 1);
+METRICS_GAUGE(tx_queue_metric, "tx.queue");
+
+typedef struct {
+    struct sockaddr_in addr;
+    int socket_fd;
+    bool (*is_connected)();
+    bool link_up;
+
+    uint8_t queue[TRANSMITTER_QUEUE_LEN][TRANSMITTER_MAX_DATAGRAM];
+    uint8_t sending[TRANSMITTER_MAX_DATAGRAM]; // Datagram being sent, kept off the thread's small stack
+    size_t sizes[TRANSMITTER_QUEUE_LEN];
+    size_t head;
+    size_t count;
+
+    std::mutex mutex;
+    std::condition_variable cv;
+    std::thread thread;
+    bool running;
+
+    transmitter_stats_t stats;
+} transmitter_t;
+
+// Create (or re-create) the socket and connect it to the destination
+inline bool _transmitter_open(transmitter_t *t) {
+    if (t->socket_fd != -1) {
+        close(t->socket_fd);
+    }
+
+    t->socket_fd = socket(PF_INET, SOCK_DGRAM, 0);
+    if (t->socket_fd == -1) {
+        metric_add(&tx_socket_errors_metric);
+        printf("ERROR: Socket creation error [%s]\n", strerror(errno));
+        return false;
+    }
+    {
+        std::lock_guard<std::mutex> lock(t->mutex);
+        t->stats.sockets_opened++;
+    }
+
+    if (connect(t->socket_fd, (const struct sockaddr *) &t->addr, sizeof(t->addr)) == -1) {
+        metric_add(&tx_socket_errors_metric);
+        printf("ERROR: socket connection error [%s]\n", strerror(errno));
+        close(t->socket_fd);
+        t->socket_fd = -1;
+        return false;
+    }
+    return true;
+}
+
+// Called when the link comes back: reuse the socket if a new connect() is accepted
+inline bool _transmitter_rebind(transmitter_t *t) {
+    if (t->socket_fd != -1 && connect(t->socket_fd, (const struct sockaddr *) &t->addr, sizeof(t->addr)) == 0) {
+        std::lock_guard<std::mutex> lock(t->mutex);
+        t->stats.rebinds++;
+        metric_add(&tx_rebinds_metric);
+        return true;
+    }
+    return _transmitter_open(t);
+}
+
+inline void _transmitter_loop(transmitter_t *t) {
+    while (true) {
+        {
+            std::unique_lock<std::mutex> lock(t->mutex);
+            t->cv.wait(lock, [t] { return t->count > 0 || !t->running; });
+            if (!t->running) {
+                break;
+            }
+
+            // Hold the datagram in the queue while the link is down
+            if (!t->is_connected()) {
+                t->link_up = false;
+                t->cv.wait_for(lock, std::chrono::milliseconds(TRANSMITTER_LINK_POLL_MS));
+                continue;
+            }
+        }
+
+        // Bind before taking the datagram, so it stays queued (and is retried) if that fails
+        if (!t->link_up || t->socket_fd == -1) {
+            if (!_transmitter_rebind(t)) {
+                std::this_thread::sleep_for(std::chrono::milliseconds(TRANSMITTER_LINK_POLL_MS));
+                continue;
+            }
+            t->link_up = true;
+        }
+
+        size_t size;
+        {
+            std::lock_guard<std::mutex> lock(t->mutex);
+            size = t->sizes[t->head];
+            memcpy(t->sending, t->queue[t->head], size);
+            t->head = (t->head + 1) % TRANSMITTER_QUEUE_LEN;
+            t->count--;
+            metric_set(&tx_queue_metric, (int32_t) t->count);
+        }
+
+        bool ok = send(t->socket_fd, t->sending, size, 0) == (ssize_t) size;
+        if (!ok) {
+            t->link_up = false; // Rebind before the next datagram
+        }
+
+        std::lock_guard<std::mutex> lock(t->mutex);
+        if (ok) {
+            t->stats.sent++;
+            metric_add(&tx_sent_metric);
+        } else {
+            t->stats.send_errors++;
+            metric_add(&tx_send_errors_metric);
+        }
+    }
+}
+
+// Resolve the destination once and start the sender thread. Returns false for an invalid address.
+inline bool transmitter_start(transmitter_t *t, const char *ip, int port, bool (*is_connected)()) {
+    memset(&t->addr, 0, sizeof(t->addr));
+    t->addr.sin_family = AF_INET;
+    t->addr.sin_port = htons(port);
+    if (inet_aton(ip, &t->addr.sin_addr) == 0) {
+        metric_add(&tx_socket_errors_metric);
+        printf("ERROR: inet_aton\n");
+        return false;
+    }
+
+    t->socket_fd = -1;
+    t->is_connected = is_connected;
+    t->link_up = false;
+    t->head = 0;
+    t->count = 0;
+    memset(&t->stats, 0, sizeof(t->stats));
+    t->running = true;
+    t->thread = std::thread(_transmitter_loop, t);
+    return true;
+}
+
+// Queue a datagram without blocking. Returns false if it is too large to send.
+inline bool transmitter_submit(transmitter_t *t, const void *buffer, size_t size) {
+    if (size > TRANSMITTER_MAX_DATAGRAM) {
+        return false;
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(t->mutex);
+        size_t slot;
+        if (t->count == TRANSMITTER_QUEUE_LEN) {
+            slot = t->head; // Overwrite the oldest datagram
+            t->head = (t->head + 1) % TRANSMITTER_QUEUE_LEN;
+            t->stats.dropped++;
+            metric_add(&tx_dropped_metric);
+        } else {
+            slot = (t->head + t->count) % TRANSMITTER_QUEUE_LEN;
+            t->count++;
+        }
+        metric_set(&tx_queue_metric, (int32_t) t->count);
+        memcpy(t->queue[slot], buffer, size);
+        t->sizes[slot] = size;
+        t->stats.submitted++;
+    }
+    t->cv.notify_one();
+    return true;
+}
+
+// Number of datagrams waiting in the queue
+inline size_t transmitter_pending(transmitter_t *t) {
+    std::lock_guard<std::mutex> lock(t->mutex);
+    return t->count;
+}
+
+inline void transmitter_get_stats(transmitter_t *t, transmitter_stats_t *stats) {
+    std::lock_guard<std::mutex> lock(t->mutex);
+    *stats = t->stats;
+}
+
+// Stop the sender thread and close the socket. Queued datagrams are discarded and counted as dropped.
+inline void transmitter_stop(transmitter_t *t) {
+    {
+        std::lock_guard<std::mutex> lock(t->mutex);
+        t->running = false;
+    }
+    t->cv.notify_one();
+    if (t->thread.joinable()) {
+        t->thread.join();
+    }
+    {
+        std::lock_guard<std::mutex> lock(t->mutex);
+        t->stats.dropped += t->count;
+        metric_add(&tx_dropped_metric, 0, (uint32_t) t->count);
+        t->count = 0;
+        metric_set(&tx_queue_metric, 0);
+    }
+    if (t->socket_fd != -1) {
+        close(t->socket_fd);
+        t->socket_fd = -1;
+    }
+}
+
+#endif //ESP32_CSI_TRANSMITTER_COMPONENT_H
@@ -0,0 +1,257 @@
+/*
+ * Checks that the station's steady state leaves the heap alone (arena_component.h). The station components
+ * build natively with CONFIG_ARENA_CHECK_HEAP, and this tool replaces malloc and its siblings with counting
+ * versions, the host's stand-in for ESP-IDF's heap hooks (operator new allocates through malloc). It then
+ * runs rounds as app_main does: per AP get_AP and a burst of synthetic frames (csi_synth.h) through
+ * _wifi_csi_cb, which queues them for UDP, writes them to the SD capture and hands the first one's text line
+ * to the log task, and a datagram built from the queue; then collect_all_csi_data and csi_cycle_reset.
+ *
+ *   hook      an allocation inside an ARENA_NO_HEAP scope is counted, one outside is not
+ *   rounds    heap allocations per round inside the scopes and in the whole process, and the arena's use.
+ *             After CONFIG_ARENA_WARMUP_CYCLES rounds the scopes must make none (arena_reset aborts
+ *             otherwise) and nothing may overflow the arena.
+ *   before    what a round's text lines and their parsing cost the heap as std::string, std::stringstream
+ *             and std::vector, the way csi_component.h kept them before the arena
+ *
+ * usage: csi_alloc_check [-r rounds] [-a aps] [-f frames per AP] [-S seed]
+ */
+#define CONFIG_CSI_DEVICE_ID 7
+#define CONFIG_SEND_CSI_TO_SD 1
+#define CONFIG_SD_BINARY_CAPTURE 1
+#define CONFIG_SD_MAX_CAPTURE_MB 64
+#define CONFIG_HAL_FS_ROOT "csi_alloc_sdcard"
+#define CONFIG_ARENA_CHECK_HEAP 1
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <atomic>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "csi_synth.h"
+#include "sockets_component.h"
+#include "sd_component.h"
+
+extern "C" void *__libc_malloc(size_t size);
+extern "C" void *__libc_calloc(size_t count, size_t size);
+extern "C" void *__libc_realloc(void *p, size_t size);
+extern "C" void *__libc_memalign(size_t alignment, size_t size);
+
+std::atomic<uint64_t> process_allocs{0}; // Every heap allocation, on any thread
+
+inline void count_alloc() {
+    process_allocs++;
+    arena_count_heap_alloc();
+}
+
+extern "C" void *malloc(size_t size) {
+    count_alloc();
+    return __libc_malloc(size);
+}
+
+extern "C" void *calloc(size_t count, size_t size) {
+    count_alloc();
+    return __libc_calloc(count, size);
+}
+
+extern "C" void *realloc(void *p, size_t size) {
+    count_alloc();
+    return __libc_realloc(p, size);
+}
+
+extern "C" void *aligned_alloc(size_t alignment, size_t size) {
+    count_alloc();
+    return __libc_memalign(alignment, size);
+}
+
+extern "C" int posix_memalign(void **p, size_t alignment, size_t size) {
+    count_alloc();
+    *p = __libc_memalign(alignment, size);
+    return *p != NULL ? 0 : ENOMEM;
+}
+
+typedef struct {
+    wifi_csi_info_t info;
+    int8_t buf[3 * SYNTH_LTF_BYTES];
+} frame_t;
+
+void *volatile sink_ptr; // Keeps the compiler from eliding the hook check's allocations
+
+void count_output(void *ctx, const char *, size_t len) {
+    *(uint64_t *) ctx += len;
+}
+
+// The round's lines and their parsing as csi_component.h did them with the standard containers
+uint32_t heap_allocs_before_arena(const std::vector<frame_t> &frames, int aps) {
+    uint32_t start = arena_heap_allocs;
+    ARENA_NO_HEAP;
+    std::vector<std::string> csi_data_vector;
+    for (int a = 0; a < aps; a++) {
+        const frame_t &f = frames[a];
+        std::stringstream ss;
+        ss << "AP" << a + 1 << "," << (int) f.info.rx_ctrl.rssi << "," << f.info.len << ",[";
+        for (int i = 0; i < CSI_STREAM_LEN; i++) {
+            ss << (int) f.buf[i] << " ";
+        }
+        ss << "]\n";
+        std::string line = ss.str();
+        csi_data_vector.push_back(line);
+    }
+    std::vector<int> all_csi_data;
+    for (const auto &data_str : csi_data_vector) {
+        std::stringstream ss(data_str);
+        std::string item;
+        std::getline(ss, item, '[');
+        while (std::getline(ss, item, ' ')) {
+            int value;
+            if (!item.empty() && std::istringstream(item) >> value) {
+                all_csi_data.push_back(value);
+            }
+        }
+    }
+    std::stringstream final_ss;
+    final_ss << "CSI_DATA ";
+    for (int v : all_csi_data) {
+        final_ss << v << " ";
+    }
+    std::string final_str = final_ss.str();
+    sink_ptr = (void *) final_str.data();
+    return arena_heap_allocs - start;
+}
+
+int main(int argc, char **argv) {
+    int rounds = 50;
+    int aps = 3;
+    int frames_per_ap = 60;
+    uint64_t seed = 1;
+
+    int opt;
+    while ((opt = getopt(argc, argv, "r:a:f:S:")) != -1) {
+        switch (opt) {
+            case 'r': rounds = std::max(CONFIG_ARENA_WARMUP_CYCLES + 1, atoi(optarg)); break;
+            case 'a': aps = std::max(1, std::min(std::min(SYNTH_MAX_APS, CSI_MAX_LINES), atoi(optarg))); break;
+            case 'f': frames_per_ap = std::max(1, atoi(optarg)); break;
+            case 'S': seed = strtoull(optarg, NULL, 10); break;
+            default:
+                fprintf(stderr, "usage: %s [-r rounds] [-a aps] [-f frames per AP] [-S seed]\n", argv[0]);
+                return 1;
+        }
+    }
+
+    synth_t *s = new synth_t();
+    synth_init(s, seed);
+    for (int i = 0; i < aps; i++) {
+        char name[16];
+        snprintf(name, sizeof(name), "AP%d", i + 1);
+        synth_add_ap(s, name, 4 * cos(2 * M_PI * i / aps), 4 * sin(2 * M_PI * i / aps), 6, 100);
+    }
+    synth_add_scatterers(s, 12, 0.6, -5, -5, 5, 5);
+    synth_set_position(s, 0.5, 0.5);
+    std::vector<frame_t> frames(aps * frames_per_ap);
+    for (frame_t &f : frames) {
+        const wifi_csi_info_t *info = synth_next(s);
+        f.info = *info;
+        memcpy(f.buf, info->buf, info->len);
+        f.info.buf = f.buf;
+    }
+    printf("%d rounds of %d APs, %d frames each (seed %llu), %u byte arena, %d warm-up rounds\n", rounds, aps,
+           frames_per_ap, (unsigned long long) seed, (unsigned) CONFIG_CSI_ARENA_SIZE, CONFIG_ARENA_WARMUP_CYCLES);
+
+    printf("\nhook\n");
+    uint32_t scoped = arena_heap_allocs;
+    uint64_t all = process_allocs;
+    {
+        ARENA_NO_HEAP;
+        sink_ptr = malloc(32);
+        free(sink_ptr);
+        sink_ptr = new std::string(64, 'x');
+        delete (std::string *) sink_ptr;
+    }
+    sink_ptr = malloc(32);
+    free(sink_ptr);
+    scoped = arena_heap_allocs - scoped;
+    all = process_allocs - all;
+    bool hook_ok = scoped == 3 && all == 4; // malloc, new and the string's buffer inside, malloc outside
+    printf("  %u allocations counted inside a scope, %llu in the process %s\n", (unsigned) scoped,
+           (unsigned long long) all, hook_ok ? "OK" : "FAILED");
+
+    uint64_t log_bytes = 0;
+    log_start(&log_ring, &count_output, &log_bytes);
+    sd_init();
+    csi_record_sink = sd_writer_ready ? &sd_capture_record : NULL;
+    csi_sinks = CSI_SINK_SERIAL | CSI_SINK_UDP | CSI_SINK_SD;
+
+    fflush(stdout);
+    int saved_stdout = dup(STDOUT_FILENO);
+    int null_fd = open("/dev/null", O_WRONLY);
+    std::vector<uint32_t> scoped_per_round;
+    std::vector<uint64_t> process_per_round;
+    std::vector<size_t> arena_used;
+    scoped_per_round.reserve(rounds);
+    process_per_round.reserve(rounds);
+    arena_used.reserve(rounds);
+    for (int r = 0; r < rounds; r++) {
+        csi_cycle_reset(); // Aborts if the last round allocated past the warm-up
+        fflush(stdout);
+        dup2(null_fd, STDOUT_FILENO); // The station's own output: CSV header, CSI_DATA lines
+        scoped = arena_heap_allocs;
+        all = process_allocs;
+        for (int a = 0; a < aps; a++) {
+            get_AP(s->aps[a].name);
+            csi_init((char *) "STA");
+            for (int f = 0; f < frames_per_ap; f++) {
+                hal_csi_inject(&frames[a * frames_per_ap + f].info);
+            }
+            ARENA_NO_HEAP;
+            while (csi_stream_count > 0) {
+                _build_csi_packet();
+            }
+        }
+        mark_all_aps_collected();
+        collect_all_csi_data();
+        reset_data_collected_flag();
+        fflush(stdout);
+        dup2(saved_stdout, STDOUT_FILENO);
+        scoped_per_round.push_back(arena_heap_allocs - scoped);
+        process_per_round.push_back(process_allocs - all);
+        arena_used.push_back(csi_arena.used);
+    }
+    char report[COMMAND_REPLY_MAX];
+    arena_report(&csi_arena, report, sizeof(report));
+    csi_cycle_reset();
+    close(null_fd);
+    close(saved_stdout);
+
+    printf("\nrounds\n  %-10s %16s %18s %12s\n", "round", "scoped allocs", "process allocs", "arena B");
+    uint32_t steady_scoped = 0;
+    for (int r = 0; r < rounds; r++) {
+        if (r >= CONFIG_ARENA_WARMUP_CYCLES) {
+            steady_scoped += scoped_per_round[r];
+        }
+        if (r < CONFIG_ARENA_WARMUP_CYCLES + 2 || r == rounds - 1) {
+            printf("  %-10d %16u %18llu %12zu%s\n", r + 1, (unsigned) scoped_per_round[r],
+                   (unsigned long long) process_per_round[r], arena_used[r],
+                   r < CONFIG_ARENA_WARMUP_CYCLES ? "  warm-up" : "");
+        } else if (r == CONFIG_ARENA_WARMUP_CYCLES + 2) {
+            printf("  ...\n");
+        }
+    }
+    printf("  %s\n", report);
+    bool rounds_ok = steady_scoped == 0 && csi_arena.failures == 0;
+    printf("  after the warm-up: %u allocations in the scopes, %u allocations that did not fit the arena %s\n",
+           (unsigned) steady_scoped, (unsigned) csi_arena.failures, rounds_ok ? "OK" : "FAILED");
+
+    printf("\nbefore\n  %u heap allocations for a round's %d text lines kept as std::string and parsed with "
+           "std::stringstream\n", heap_allocs_before_arena(frames, aps), aps);
+
+    sd_deinit();
+    log_stop(&log_ring);
+    delete s;
+    bool ok = hook_ok && rounds_ok;
+    printf("\n%s\n", ok ? "OK" : "FAILED");
+    return ok ? 0 : 1;
+}
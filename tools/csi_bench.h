@@ -0,0 +1,63 @@
+#ifndef CSI_TOOLS_BENCH_H
+#define CSI_TOOLS_BENCH_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <algorithm>
+#include <chrono>
+#include <vector>
+
+/*
+ * Timing for the component benchmarks (csi_station_bench, csi_deployment_bench), which run the station's
+ * own code natively through hal_component.h. Every call is timed on its own, so a row shows the tail as
+ * well as the mean; the ~20-40 ns a steady_clock read costs is part of every sample.
+ */
+
+inline int64_t bench_now_ns() {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+inline int64_t bench_percentile(std::vector<int64_t> &v, double q) {
+    if (v.empty()) {
+        return 0;
+    }
+    size_t i = (size_t) (q * (v.size() - 1));
+    std::nth_element(v.begin(), v.begin() + i, v.end());
+    return v[i];
+}
+
+inline void bench_header(const char *title) {
+    printf("\n%s\n  %-34s %10s %10s %10s %12s\n", title, "", "mean ns", "p50 ns", "p99 ns", "calls/s");
+}
+
+inline void bench_report(const char *name, std::vector<int64_t> &ns, const char *note) {
+    int64_t sum = 0;
+    for (int64_t v : ns) {
+        sum += v;
+    }
+    double mean = ns.empty() ? 0 : (double) sum / ns.size();
+    printf("  %-34s %10.0f %10lld %10lld %12.0f  %s\n", name, mean, (long long) bench_percentile(ns, 0.5),
+           (long long) bench_percentile(ns, 0.99), mean > 0 ? 1e9 / mean : 0, note);
+}
+
+// Time `body(i)` for i in [0, n)
+template <typename F>
+std::vector<int64_t> bench_samples(long n, F body) {
+    std::vector<int64_t> ns;
+    ns.reserve(n);
+    for (long i = 0; i < n; i++) {
+        int64_t t0 = bench_now_ns();
+        body(i);
+        ns.push_back(bench_now_ns() - t0);
+    }
+    return ns;
+}
+
+// Time `body(i)` for i in [0, n) and print a row
+template <typename F>
+void bench_run(const char *name, long n, F body, const char *note = "") {
+    std::vector<int64_t> ns = bench_samples(n, body);
+    bench_report(name, ns, note);
+}
+
+#endif //CSI_TOOLS_BENCH_H
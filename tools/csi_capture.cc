@@ -0,0 +1,250 @@
+/*
+ * Inspects and benchmarks chunked binary CSI captures (capture_component.h, /sdcard/N.csi).
+ *
+ *   csi_capture info <file.csi>     header, AP table, chunks, records and time range
+ *   csi_capture verify <file.csi>   checks every chunk CRC and record, exit status 1 on damage
+ *   csi_capture bench [-n records] [-s seeks] [-o dir]
+ *       append throughput through the SD writer on a Linux file, sequential read throughput,
+ *       random time-seek throughput, and recovery of copies truncated at random offsets
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <random>
+#include <string>
+
+#include "capture_component.h"
+#include "sd_writer_component.h"
+
+double now_s() {
+    return _sd_writer_now_us() / 1e6;
+}
+
+int info(const char *path) {
+    capture_reader_t r;
+    if (!capture_reader_open(&r, path)) {
+        return 1;
+    }
+
+    uint64_t records = 0;
+    for (const capture_index_entry_t &e : r.index) {
+        records += e.records;
+    }
+    printf("%s: version %u, device %u, chunk size %u, %llu bytes\n", path, (unsigned) r.version,
+           (unsigned) r.device_id, (unsigned) r.chunk_size, (unsigned long long) r.file_size);
+    printf("index: %s, %zu chunks, %llu records\n", r.recovered ? "rebuilt by scanning (capture not finished)" : "footer",
+           capture_reader_chunks(&r), (unsigned long long) records);
+    if (!r.index.empty()) {
+        printf("time: %lld .. %lld us (%.1f s)\n", (long long) r.index.front().first_ts_us,
+               (long long) r.index.back().last_ts_us,
+               (r.index.back().last_ts_us - r.index.front().first_ts_us) / 1e6);
+    }
+    for (int i = 0; i < r.ap_count && i < CAPTURE_MAX_APS; i++) {
+        printf("ap %d: %s\n", i, r.ap_names[i]);
+    }
+    capture_reader_close(&r);
+    return 0;
+}
+
+int verify(const char *path) {
+    capture_reader_t r;
+    if (!capture_reader_open(&r, path)) {
+        return 1;
+    }
+
+    size_t bad = 0;
+    uint64_t records = 0;
+    for (size_t i = 0; i < capture_reader_chunks(&r); i++) {
+        capture_chunk_t c;
+        csi_record_t record;
+        uint32_t n = 0;
+        if (capture_reader_load_chunk(&r, i, &c)) {
+            while (capture_chunk_next(&c, &record)) {
+                n++;
+            }
+        }
+        if (n != r.index[i].records) {
+            printf("chunk %zu at offset %llu: %u of %u records readable\n", i,
+                   (unsigned long long) r.index[i].offset, n, r.index[i].records);
+            bad++;
+        }
+        records += n;
+    }
+    printf("%zu chunks, %llu records, %zu damaged%s\n", capture_reader_chunks(&r), (unsigned long long) records, bad,
+           r.recovered ? " (unfinished capture, index rebuilt)" : "");
+    capture_reader_close(&r);
+    return bad > 0 ? 1 : 0;
+}
+
+// Waits for a free buffer instead of dropping, so the benchmark measures sustained throughput
+bool file_sink(void *ctx, const void *data, size_t size) {
+    while (!sd_writer_append((sd_writer_t *) ctx, data, size)) {
+        std::this_thread::yield();
+    }
+    return true;
+}
+
+int bench(int argc, char **argv) {
+    int records = 500000;
+    int seeks = 20000;
+    std::string dir = "/tmp";
+
+    int opt;
+    while ((opt = getopt(argc, argv, "n:s:o:")) != -1) {
+        switch (opt) {
+            case 'n': records = atoi(optarg); break;
+            case 's': seeks = atoi(optarg); break;
+            case 'o': dir = optarg; break;
+            default:
+                fprintf(stderr, "usage: csi_capture bench [-n records] [-s seeks] [-o dir]\n");
+                return 1;
+        }
+    }
+
+    std::string path = dir + "/csi_capture_bench.csi";
+    unlink(path.c_str());
+    sd_writer_backend_t backend;
+    if (!sd_writer_open_file(&backend, path.c_str())) {
+        return 1;
+    }
+    sd_writer_t *w = new sd_writer_t();
+    sd_writer_start(w, &backend, CONFIG_SD_FSYNC_INTERVAL_MS);
+
+    // 100 frames/s from 3 APs, 128 byte LLTF payloads
+    std::mt19937 rng(7);
+    int8_t payload[128];
+    csi_record_t r = {0, 1700000000000000LL, 42, 0, -50, CSI_RECORD_FLAG_RAW, sizeof(payload), payload, 0, 0, 0, 0};
+    capture_writer_t *cw = new capture_writer_t();
+    capture_writer_begin(cw, CAPTURE_CHUNK_SIZE, r.device_id, r.timestamp_us, &file_sink, w);
+    capture_writer_set_ap(cw, 0, "AP1");
+    capture_writer_set_ap(cw, 1, "AP2");
+    capture_writer_set_ap(cw, 2, "AP3");
+
+    double start = now_s();
+    for (int i = 0; i < records; i++) {
+        for (size_t k = 0; k < sizeof(payload); k++) {
+            payload[k] = (int8_t) (rng() & 0x3F) - 32;
+        }
+        r.seq = i;
+        r.timestamp_us += 10000;
+        r.ap_id = i % 3;
+        capture_writer_append(cw, &r);
+    }
+    capture_writer_finish(cw);
+    sd_writer_flush(w);
+    double write_s = now_s() - start;
+    sd_writer_stats_t ws;
+    sd_writer_get_stats(w, &ws);
+    sd_writer_stop(w);
+    delete w;
+    printf("append: %d records, %.1f MB in %zu chunks, %.0f records/s, %.1f MB/s (dropped chunks %llu)\n",
+           records, ws.written_bytes / 1e6, cw->index.size(), records / write_s, ws.written_bytes / 1e6 / write_s,
+           (unsigned long long) cw->dropped_chunks);
+
+    // Sequential read of every record
+    capture_reader_t rd;
+    if (!capture_reader_open(&rd, path.c_str())) {
+        return 1;
+    }
+    start = now_s();
+    uint64_t read_records = 0;
+    int64_t checksum = 0;
+    for (size_t i = 0; i < capture_reader_chunks(&rd); i++) {
+        capture_chunk_t c;
+        csi_record_t record;
+        if (!capture_reader_load_chunk(&rd, i, &c)) {
+            printf("ERROR: chunk %zu failed verification\n", i);
+            return 1;
+        }
+        while (capture_chunk_next(&c, &record)) {
+            checksum += record.data[0];
+            read_records++;
+        }
+    }
+    double read_s = now_s() - start;
+    printf("sequential read: %llu records, %.0f records/s, %.1f MB/s (checksum %lld)\n",
+           (unsigned long long) read_records, read_records / read_s, rd.file_size / 1e6 / read_s, (long long) checksum);
+
+    // Random seeks: find the record at a random time
+    int64_t t0 = rd.index.front().first_ts_us;
+    int64_t t1 = rd.index.back().last_ts_us;
+    std::uniform_int_distribution<int64_t> when(t0, t1);
+    int found = 0;
+    start = now_s();
+    for (int i = 0; i < seeks; i++) {
+        int64_t ts = when(rng);
+        size_t chunk = capture_reader_find(&rd, ts);
+        capture_chunk_t c;
+        csi_record_t record;
+        if (chunk < capture_reader_chunks(&rd) && capture_reader_load_chunk(&rd, chunk, &c)) {
+            while (capture_chunk_next(&c, &record)) {
+                if (record.timestamp_us >= ts) {
+                    found++;
+                    break;
+                }
+            }
+        }
+    }
+    double seek_s = now_s() - start;
+    printf("random seek: %d lookups, %.0f seeks/s, %.1f us/seek, %d found\n", seeks, seeks / seek_s,
+           seek_s * 1e6 / seeks, found);
+    uint64_t file_size = rd.file_size;
+    uint32_t chunk_size = rd.chunk_size;
+    std::vector<capture_index_entry_t> index = rd.index;
+    capture_reader_close(&rd);
+
+    // Truncated copies: everything in complete chunks before the cut must come back
+    std::string cut_path = dir + "/csi_capture_bench_cut.csi";
+    std::vector<uint8_t> data(file_size);
+    FILE *f = fopen(path.c_str(), "rb");
+    if (f == NULL || fread(data.data(), 1, data.size(), f) != data.size()) {
+        printf("ERROR: cannot read %s back\n", path.c_str());
+        return 1;
+    }
+    fclose(f);
+    std::uniform_int_distribution<uint64_t> cut_at(chunk_size, file_size - 1);
+    int trials = 20;
+    int exact = 0;
+    for (int t = 0; t < trials; t++) {
+        uint64_t cut = cut_at(rng);
+        f = fopen(cut_path.c_str(), "wb");
+        fwrite(data.data(), 1, cut, f);
+        fclose(f);
+
+        uint64_t expected = 0;
+        for (const capture_index_entry_t &e : index) {
+            if (e.offset + chunk_size <= cut) {
+                expected += e.records;
+            }
+        }
+        capture_reader_t cr;
+        uint64_t recovered = 0;
+        if (capture_reader_open(&cr, cut_path.c_str())) {
+            for (const capture_index_entry_t &e : cr.index) {
+                recovered += e.records;
+            }
+            capture_reader_close(&cr);
+        }
+        exact += recovered == expected;
+    }
+    unlink(cut_path.c_str());
+    printf("truncated tail: %d/%d random cuts recovered every record of the complete chunks\n", exact, trials);
+
+    delete cw;
+    return 0;
+}
+
+int main(int argc, char **argv) {
+    if (argc >= 3 && strcmp(argv[1], "info") == 0) {
+        return info(argv[2]);
+    }
+    if (argc >= 3 && strcmp(argv[1], "verify") == 0) {
+        return verify(argv[2]);
+    }
+    if (argc >= 2 && strcmp(argv[1], "bench") == 0) {
+        return bench(argc - 1, argv + 1);
+    }
+    fprintf(stderr, "usage: %s info <file.csi> | verify <file.csi> | bench [-n records] [-s seeks] [-o dir]\n", argv[0]);
+    return 1;
+}
@@ -0,0 +1,560 @@
+/*
+ * Trains and evaluates the two-stage room cascade of cascade_component.h on labeled multi-room captures: a
+ * room model (a linear softmax over the rooms) and a fine model per room, trained on that room's samples
+ * alone. Survey points belong to the rooms given with -R, rectangles in plan units (inclusive); points in
+ * none are left out.
+ *
+ *   csi_cascade fit [-R name:x0,y0,x1,y1;...] [-k neighbours] [-m fingerprints] [-a AP1,AP2,...] [-H hidden]
+ *                   [-b 8|16] [-e epochs] [-S seed] [-V version] [-o dir] [-x csi_cascade_registry.h] <train.csi>
+ *       train the room model and each room's fine model, a regressor of x and y (linear, or one hidden ReLU
+ *       layer of -H units) or with -k a kNN over at most -m of the room's samples, and write the
+ *       containers to dir/room.csmc and dir/<room>.csmc (for parttool.py or the SD card); -x writes them as a
+ *       header with the registry, for the sketch to build in
+ *   csi_cascade bench [fit options] <train.csi> [test.csi]
+ *       fit on train.csi and run the cascade over test.csi (by default every 4th sample of train.csi, left out
+ *       of training) in capture order, the fine models mapped from csi_cascade_bench/ as the sketch maps flash
+ *       partitions. Next to one regressor over every room, the way the deployments locate now: room
+ *       accuracy, location error, latency of each stage, and model memory. Fails if a container does not
+ *       load, if the fine model is reloaded without a room change, or if a cascade result differs from the
+ *       room's fine model run on its own.
+ */
+#define CONFIG_HAL_PARTITION_DIR "csi_cascade_bench"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <math.h>
+#include <time.h>
+#include <sys/stat.h>
+#include <string>
+#include <vector>
+
+#include "csi_model.h"
+#include "cascade_component.h"
+#include "csi_bench.h"
+
+#define CASCADE_DEFAULT_ROOMS "pasillo:0,0,0,40;habtprinc:20,0,40,40" // The corridor and main room of the sketch
+#define CASCADE_INPUT_SHIFT (NORM_FRAC_BITS - 4) // kNN fingerprints with 4 fraction bits
+
+typedef struct {
+    std::string name;
+    int x0, y0, x1, y1;
+} room_t;
+
+typedef struct {
+    options_t model;
+    std::vector<room_t> rooms;
+    int k; // 0 for regressors
+    int max_fingerprints;
+    const char *dir;
+} cascade_options_t;
+
+typedef struct {
+    std::vector<uint8_t> room;
+    std::vector<std::vector<uint8_t>> fine; // By room
+    std::vector<size_t> fine_samples;
+} cascade_fit_t;
+
+bool parse_rooms(const char *spec, std::vector<room_t> *rooms) {
+    rooms->clear();
+    std::string s(spec);
+    size_t start = 0;
+    while (start < s.size()) {
+        size_t end = s.find(';', start);
+        std::string item = s.substr(start, end == std::string::npos ? std::string::npos : end - start);
+        start = end == std::string::npos ? s.size() : end + 1;
+        size_t colon = item.find(':');
+        room_t r;
+        if (colon == std::string::npos || colon == 0 || colon >= MODEL_LABEL_LEN ||
+            sscanf(item.c_str() + colon + 1, "%d,%d,%d,%d", &r.x0, &r.y0, &r.x1, &r.y1) != 4) {
+            printf("ERROR: room \"%s\" is not name:x0,y0,x1,y1 with a name of at most %d characters\n", item.c_str(),
+                   MODEL_LABEL_LEN - 1);
+            return false;
+        }
+        r.name = item.substr(0, colon);
+        rooms->push_back(r);
+    }
+    if (rooms->size() < 2 || rooms->size() > CASCADE_MAX_ROOMS) {
+        printf("ERROR: %zu rooms, a cascade takes 2 to %d\n", rooms->size(), CASCADE_MAX_ROOMS);
+        return false;
+    }
+    return true;
+}
+
+int room_of(const std::vector<room_t> &rooms, const sample_t *s) {
+    for (size_t i = 0; i < rooms.size(); i++) {
+        const room_t &r = rooms[i];
+        if (s->target[0] >= r.x0 && s->target[0] <= r.x1 && s->target[1] >= r.y0 && s->target[1] <= r.y1) {
+            return (int) i;
+        }
+    }
+    return -1;
+}
+
+bool parse_options(int argc, char **argv, cascade_options_t *o) {
+    options_t *m = &o->model;
+    m->classify = false;
+    m->hidden = 0;
+    m->bits = 8;
+    m->epochs = 30;
+    m->seed = 1;
+    m->version = (uint32_t) time(NULL);
+    m->container_header = NULL;
+    o->k = 0;
+    o->max_fingerprints = 128;
+    o->dir = "csi_cascade";
+    const char *rooms = CASCADE_DEFAULT_ROOMS;
+    int opt;
+    while ((opt = getopt(argc, argv, "R:k:m:a:H:b:e:S:V:o:x:")) != -1) {
+        switch (opt) {
+            case 'R': rooms = optarg; break;
+            case 'k': o->k = std::max(0, std::min(KNN_MAX_K, atoi(optarg))); break;
+            case 'm': o->max_fingerprints = std::max(1, std::min(UINT16_MAX, atoi(optarg))); break;
+            case 'a': norm_parse_aps(optarg, &m->aps); break;
+            case 'H': m->hidden = std::max(0, std::min(MODEL_MAX_WIDTH, atoi(optarg))); break;
+            case 'b': m->bits = atoi(optarg) == 16 ? 16 : 8; break;
+            case 'e': m->epochs = std::max(1, atoi(optarg)); break;
+            case 'S': m->seed = strtoull(optarg, NULL, 10); break;
+            case 'V': m->version = (uint32_t) strtoul(optarg, NULL, 10); break;
+            case 'o': o->dir = optarg; break;
+            case 'x': m->container_header = optarg; break;
+            default: return false;
+        }
+    }
+    return parse_rooms(rooms, &o->rooms) && optind < argc;
+}
+
+// Standardization (one table for every model, so the sketch reads the features once) and samples
+bool prepare(const char *capture, cascade_options_t *o, norm_result_t *norm, points_t *points,
+             std::vector<sample_t> *samples) {
+    norm_fit_t fit;
+    fit.aps = o->model.aps;
+    fit.robust = false;
+    if (!norm_fit_capture(capture, &fit, norm)) {
+        return false;
+    }
+    o->model.aps = fit.aps;
+    if (o->model.aps.size() > 16 || norm->table.features > MODEL_MAX_WIDTH) {
+        printf("ERROR: %zu APs, the engine takes at most %d inputs\n", o->model.aps.size(), MODEL_MAX_WIDTH);
+        return false;
+    }
+    return load_samples(capture, o->model.aps, &norm->table, points, true, samples);
+}
+
+// Every 4th sample or so of the room's, at most `max`
+std::vector<const sample_t *> spread(const std::vector<const sample_t *> &samples, size_t max) {
+    std::vector<const sample_t *> out;
+    for (size_t i = 0; i < std::min(max, samples.size()); i++) {
+        out.push_back(samples[i * samples.size() / std::min(max, samples.size())]);
+    }
+    return out;
+}
+
+// The kNN blob of knn_component.h over `samples`
+std::vector<uint8_t> knn_blob(const std::vector<const sample_t *> &samples, int k) {
+    uint16_t count = (uint16_t) samples.size(), features = (uint16_t) samples[0]->q.size();
+    size_t targets = KNN_HEADER_SIZE + 2 * MODEL_LABEL_LEN;
+    size_t fingerprints = targets + 8 * (size_t) count;
+    std::vector<uint8_t> blob(fingerprints + (((size_t) count * features + 3) & ~(size_t) 3), 0);
+    _csi_put_u32(&blob[0], KNN_MAGIC);
+    _csi_put_u16(&blob[4], KNN_VERSION);
+    _csi_put_u16(&blob[6], count);
+    _csi_put_u16(&blob[8], features);
+    _csi_put_u16(&blob[10], 2);
+    blob[12] = (uint8_t) std::min(k, (int) count);
+    blob[13] = CASCADE_INPUT_SHIFT;
+    strcpy((char *) &blob[KNN_HEADER_SIZE], "x");
+    strcpy((char *) &blob[KNN_HEADER_SIZE + MODEL_LABEL_LEN], "y");
+    for (size_t i = 0; i < count; i++) {
+        for (int t = 0; t < 2; t++) {
+            uint32_t bits;
+            memcpy(&bits, &samples[i]->target[t], 4);
+            _csi_put_u32(&blob[targets + 8 * i + 4 * t], bits);
+        }
+        for (size_t f = 0; f < features; f++) {
+            int32_t v = samples[i]->q[f] >> CASCADE_INPUT_SHIFT;
+            blob[fingerprints + i * features + f] = (uint8_t) (int8_t) std::max(-128, std::min(127, v));
+        }
+    }
+    return blob;
+}
+
+// Train and pack the room model and every room's fine model
+bool fit_cascade(const cascade_options_t *o, const std::vector<const sample_t *> &samples, const norm_table_t *norm,
+                 cascade_fit_t *out) {
+    std::vector<std::vector<const sample_t *>> by_room(o->rooms.size());
+    std::vector<sample_t> room_samples;
+    room_samples.reserve(samples.size());
+    for (const sample_t *s : samples) {
+        int r = room_of(o->rooms, s);
+        if (r >= 0) {
+            by_room[r].push_back(s);
+            room_samples.push_back(*s);
+            room_samples.back().point = r;
+        }
+    }
+    std::vector<const sample_t *> room_set;
+    std::vector<std::string> room_labels;
+    for (const sample_t &s : room_samples) {
+        room_set.push_back(&s);
+    }
+    for (size_t r = 0; r < o->rooms.size(); r++) {
+        room_labels.push_back(o->rooms[r].name);
+        if (by_room[r].size() < 8) {
+            printf("ERROR: room %s has %zu samples\n", o->rooms[r].name.c_str(), by_room[r].size());
+            return false;
+        }
+    }
+
+    options_t room_options = o->model;
+    room_options.classify = true;
+    room_options.hidden = 0;
+    mlp_t room;
+    train(&room, room_set, &room_options, (int) o->rooms.size());
+    std::vector<uint8_t> blob = convert(&room, o->model.bits, true, room_labels, room_set);
+    out->room = pack(MODEL_STORE_SECTION_MODEL, blob, norm, spread(room_set, FIT_PROBES), o->model.version);
+
+    out->fine.clear();
+    out->fine_samples.clear();
+    options_t fine_options = o->model;
+    fine_options.classify = false;
+    for (size_t r = 0; r < o->rooms.size(); r++) {
+        std::vector<const sample_t *> probes = spread(by_room[r], FIT_PROBES);
+        if (o->k > 0) {
+            std::vector<const sample_t *> kept = spread(by_room[r], (size_t) o->max_fingerprints);
+            out->fine.push_back(pack(MODEL_STORE_SECTION_KNN, knn_blob(kept, o->k), norm, probes, o->model.version));
+            out->fine_samples.push_back(kept.size());
+        } else {
+            mlp_t fine;
+            train(&fine, by_room[r], &fine_options, 2);
+            std::vector<uint8_t> b = convert(&fine, o->model.bits, false, {"x", "y"}, by_room[r]);
+            out->fine.push_back(pack(MODEL_STORE_SECTION_MODEL, b, norm, probes, o->model.version));
+            out->fine_samples.push_back(by_room[r].size());
+        }
+    }
+    return true;
+}
+
+bool write_file(const std::string &path, const std::vector<uint8_t> &data) {
+    FILE *f = fopen(path.c_str(), "wb");
+    if (f == NULL || fwrite(data.data(), 1, data.size(), f) != data.size() || fclose(f) != 0) {
+        printf("ERROR: cannot write %s [%s]\n", path.c_str(), strerror(errno));
+        return false;
+    }
+    return true;
+}
+
+void write_array(FILE *f, const char *name, const std::vector<uint8_t> &data) {
+    fprintf(f, "alignas(%d) const uint8_t %s[%zu] = {", MODEL_STORE_ALIGN, name, data.size());
+    for (size_t i = 0; i < data.size(); i++) {
+        fprintf(f, "%s0x%02x,", i % 16 == 0 ? "\n    " : " ", data[i]);
+    }
+    fprintf(f, "\n};\n\n");
+}
+
+bool write_registry_header(const char *path, const char *capture, const cascade_options_t *o,
+                           const cascade_fit_t *fit) {
+    FILE *f = fopen(path, "w");
+    if (f == NULL) {
+        printf("ERROR: cannot create %s [%s]\n", path, strerror(errno));
+        return false;
+    }
+    fprintf(f, "// Generated by csi_cascade fit from %s, run with cascade_component.h\n", capture);
+    fprintf(f, "#ifndef CSI_CASCADE_REGISTRY_H\n#define CSI_CASCADE_REGISTRY_H\n\n#include <stdint.h>\n\n");
+    fprintf(f, "#include \"cascade_component.h\"\n\n");
+    write_array(f, "csi_cascade_room", fit->room);
+    for (size_t r = 0; r < o->rooms.size(); r++) {
+        write_array(f, ("csi_cascade_" + o->rooms[r].name).c_str(), fit->fine[r]);
+    }
+    fprintf(f, "const cascade_entry_t csi_cascade_room_model = {\"room\", \"built in room model\", csi_cascade_room,\n"
+               "                                                sizeof(csi_cascade_room)};\n\n");
+    fprintf(f, "// A fine model in a flash partition or on the SD card: {\"room\", \"partition label\" or \"/sdcard/file\", "
+               "NULL, 0}\n");
+    fprintf(f, "const cascade_entry_t csi_cascade_registry[] = {\n");
+    for (const room_t &r : o->rooms) {
+        fprintf(f, "    {\"%s\", \"built in %s\", csi_cascade_%s, sizeof(csi_cascade_%s)},\n", r.name.c_str(),
+                r.name.c_str(), r.name.c_str(), r.name.c_str());
+    }
+    fprintf(f, "};\n\n#endif //CSI_CASCADE_REGISTRY_H\n");
+    bool ok = fclose(f) == 0;
+    if (!ok) {
+        printf("ERROR: cannot write %s [%s]\n", path, strerror(errno));
+    }
+    return ok;
+}
+
+int fit(int argc, char **argv) {
+    cascade_options_t o;
+    if (!parse_options(argc, argv, &o) || optind != argc - 1) {
+        return -1;
+    }
+    const char *capture = argv[optind];
+    norm_result_t norm;
+    points_t points;
+    std::vector<sample_t> samples;
+    if (!prepare(capture, &o, &norm, &points, &samples)) {
+        return 1;
+    }
+    std::vector<const sample_t *> all;
+    for (const sample_t &s : samples) {
+        all.push_back(&s);
+    }
+    cascade_fit_t fitted;
+    if (!fit_cascade(&o, all, &norm.table, &fitted)) {
+        return 1;
+    }
+
+    mkdir(o.dir, 0755);
+    bool ok = write_file(std::string(o.dir) + "/room.csmc", fitted.room);
+    printf("%s: %zu samples of %zu APs, %zu points, %u inputs\n", capture, samples.size(), o.model.aps.size(),
+           points.size(), (unsigned) norm.table.features);
+    printf("room model over %zu rooms, %zu byte container: %s/room.csmc\n", o.rooms.size(), fitted.room.size(), o.dir);
+    for (size_t r = 0; r < o.rooms.size(); r++) {
+        std::string path = std::string(o.dir) + "/" + o.rooms[r].name + ".csmc";
+        ok = write_file(path, fitted.fine[r]) && ok;
+        printf("  %-15s %s of %zu samples, %zu byte container: %s\n", o.rooms[r].name.c_str(),
+               o.k > 0 ? "kNN" : (o.model.hidden > 0 ? "MLP" : "linear model"), fitted.fine_samples[r],
+               fitted.fine[r].size(), path.c_str());
+    }
+    if (o.model.container_header != NULL) {
+        ok = write_registry_header(o.model.container_header, capture, &o, &fitted) && ok;
+        printf("wrote %s\n", o.model.container_header);
+    }
+    return ok ? 0 : 1;
+}
+
+// The sample cascade_run and the models read, already standardized
+const sample_t *bench_sample = NULL;
+
+int bench_get_data(size_t offset, size_t length, int16_t *out) {
+    if (offset + length > bench_sample->q.size()) {
+        return -1;
+    }
+    memcpy(out, bench_sample->q.data() + offset, length * sizeof(int16_t));
+    return 0;
+}
+
+bool bench_activate(const model_slot_t *slot) {
+    return model_slot_inputs(slot) == bench_sample->q.size();
+}
+
+// A container loaded the way cascade_run loads it
+model_slot_t *bench_load(const cascade_entry_t *e) {
+    model_slot_t *slot = new model_slot_t();
+    memset(&slot->map, 0, sizeof(slot->map));
+    if (!_cascade_load(slot, e)) {
+        delete slot;
+        return NULL;
+    }
+    return slot;
+}
+
+int bench(int argc, char **argv) {
+    cascade_options_t o;
+    if (!parse_options(argc, argv, &o) || argc - optind > 2) {
+        return -1;
+    }
+    const char *capture = argv[optind];
+    const char *test_capture = optind + 1 < argc ? argv[optind + 1] : NULL;
+    norm_result_t norm;
+    points_t points;
+    std::vector<sample_t> samples, test_samples;
+    if (!prepare(capture, &o, &norm, &points, &samples)) {
+        return 1;
+    }
+    std::vector<const sample_t *> train_set, test_set;
+    if (test_capture != NULL) {
+        if (!load_samples(test_capture, o.model.aps, &norm.table, &points, false, &test_samples)) {
+            return 1;
+        }
+        for (const sample_t &s : samples) {
+            train_set.push_back(&s);
+        }
+        for (const sample_t &s : test_samples) {
+            if (room_of(o.rooms, &s) >= 0) {
+                test_set.push_back(&s);
+            }
+        }
+    } else {
+        for (size_t i = 0; i < samples.size(); i++) {
+            if (i % 4 != 3) {
+                train_set.push_back(&samples[i]);
+            } else if (room_of(o.rooms, &samples[i]) >= 0) {
+                test_set.push_back(&samples[i]);
+            }
+        }
+    }
+    if (test_set.empty()) {
+        printf("ERROR: no test samples in the rooms\n");
+        return 1;
+    }
+
+    int64_t start = bench_now_ns();
+    cascade_fit_t fitted;
+    if (!fit_cascade(&o, train_set, &norm.table, &fitted)) {
+        return 1;
+    }
+    // The flat model: one regressor over every room, as the deployments run now
+    std::vector<const sample_t *> flat_set;
+    for (const sample_t *s : train_set) {
+        if (room_of(o.rooms, s) >= 0) {
+            flat_set.push_back(s);
+        }
+    }
+    options_t flat_options = o.model;
+    mlp_t flat_mlp;
+    train(&flat_mlp, flat_set, &flat_options, 2);
+    std::vector<uint8_t> flat = pack(MODEL_STORE_SECTION_MODEL, convert(&flat_mlp, o.model.bits, false, {"x", "y"}, flat_set),
+                                     &norm.table, spread(flat_set, FIT_PROBES), o.model.version);
+    printf("%s: %zu training and %zu test samples in %zu rooms, %u inputs; fine models: %s; trained in %.1f s\n",
+           capture, train_set.size(), test_set.size(), o.rooms.size(), (unsigned) norm.table.features,
+           o.k > 0 ? "kNN" : (o.model.hidden > 0 ? "MLP" : "linear"), (bench_now_ns() - start) / 1e9);
+
+    // Fine models in the partitions, the room model and the flat one built in
+    mkdir(CONFIG_HAL_PARTITION_DIR, 0755);
+    bool ok = true;
+    std::vector<cascade_entry_t> registry;
+    for (size_t r = 0; r < o.rooms.size(); r++) {
+        ok = write_file(std::string(CONFIG_HAL_PARTITION_DIR "/") + o.rooms[r].name + ".bin", fitted.fine[r]) && ok;
+        registry.push_back({o.rooms[r].name.c_str(), o.rooms[r].name.c_str(), NULL, 0});
+    }
+    cascade_entry_t room_entry = {"room", "room model", fitted.room.data(), fitted.room.size()};
+    cascade_entry_t flat_entry = {"flat", "flat model", flat.data(), flat.size()};
+    bench_sample = test_set[0];
+    cascade_t *c = new cascade_t();
+    model_slot_t *flat_slot = bench_load(&flat_entry);
+    if (!ok || flat_slot == NULL || !cascade_init(c, &room_entry, registry.data(), registry.size(), &bench_activate)) {
+        printf("ERROR: containers do not load\n");
+        return 1;
+    }
+    std::vector<model_slot_t *> alone; // Every fine model loaded on its own
+    for (const cascade_entry_t &e : registry) {
+        alone.push_back(bench_load(&e));
+        ok = ok && alone.back() != NULL;
+    }
+    if (!ok) {
+        printf("ERROR: fine models do not load FAILED\n");
+        return 1;
+    }
+
+    std::vector<int64_t> room_ns, fine_ns, cascade_ns, changed_ns, flat_ns;
+    size_t room_hits = 0, located = 0, changes = 0, mismatches = 0;
+    double cascade_error = 0, flat_error = 0, cascade_located_error = 0;
+    std::vector<double> room_error(o.rooms.size(), 0), room_flat_error(o.rooms.size(), 0);
+    std::vector<size_t> room_count(o.rooms.size(), 0);
+    const char *last_room = NULL;
+    cascade_result_t result;
+    model_result_t single, room_result;
+    for (const sample_t *s : test_set) {
+        bench_sample = s;
+        int truth = room_of(o.rooms, s);
+        uint32_t loads = c->stats.loads;
+        int64_t t0 = bench_now_ns();
+        cascade_run(c, &bench_get_data, &result);
+        int64_t ns = bench_now_ns() - t0;
+        (c->stats.loads != loads ? changed_ns : cascade_ns).push_back(ns);
+        if (result.room != NULL && last_room != NULL && strcmp(result.room, last_room) != 0) {
+            changes++;
+        }
+        last_room = result.room != NULL ? result.room : last_room;
+
+        // The stages on their own, and the flat model
+        room_ns.push_back(bench_samples(1, [&](long) { model_slot_run(&c->room, s->q.data(), &room_result); })[0]);
+        flat_ns.push_back(bench_samples(1, [&](long) { model_slot_run(flat_slot, s->q.data(), &single); })[0]);
+        double flat_d = hypot(single.classification[0].value - s->target[0], single.classification[1].value - s->target[1]);
+        flat_error += flat_d;
+        room_flat_error[truth] += flat_d;
+        room_count[truth]++;
+
+        bool right_room = result.room != NULL && o.rooms[truth].name == result.room;
+        room_hits += right_room;
+        if (!result.located) {
+            cascade_error += flat_d; // Nothing better to report
+            continue;
+        }
+        located++;
+        fine_ns.push_back(bench_samples(1, [&](long) { model_slot_run(&c->fine, s->q.data(), &single); })[0]);
+        size_t picked = 0;
+        while (o.rooms[picked].name != result.room) {
+            picked++;
+        }
+        model_slot_run(alone[picked], s->q.data(), &single);
+        mismatches += single.classification[0].value != result.fine.classification[0].value ||
+                      single.classification[1].value != result.fine.classification[1].value;
+        double d = hypot(result.fine.classification[0].value - s->target[0],
+                         result.fine.classification[1].value - s->target[1]);
+        cascade_error += d;
+        cascade_located_error += d;
+        room_error[truth] += d;
+    }
+
+    size_t n = test_set.size();
+    bench_header("latency per inference");
+    bench_report("flat model", flat_ns, "one regressor over every room");
+    bench_report("room model", room_ns, "");
+    bench_report(o.k > 0 ? "fine model (kNN)" : "fine model", fine_ns, "");
+    bench_report("cascade_run, same room", cascade_ns, "room + fine model, features read once");
+    char note[64];
+    snprintf(note, sizeof(note), "%zu loads, mapped from %s/", changed_ns.size(), CONFIG_HAL_PARTITION_DIR);
+    bench_report("cascade_run, room changed", changed_ns, note);
+
+    size_t largest = 0, all_fine = 0;
+    for (const std::vector<uint8_t> &f : fitted.fine) {
+        largest = std::max(largest, f.size());
+        all_fine += f.size();
+    }
+    printf("\nmemory                              containers B   working B\n");
+    printf("  %-32s %13zu %11zu\n", "flat model", flat.size(), sizeof(model_slot_t));
+    printf("  %-32s %13zu %11zu\n", "cascade, room + largest fine", fitted.room.size() + largest,
+           c->stats.working_bytes);
+    printf("  %-32s %13zu\n", "cascade, every fine model", all_fine);
+    printf("  %-32s %13zu\n", "cascade, resident after the run", c->stats.resident_bytes);
+
+    printf("\naccuracy on %zu test samples\n", n);
+    printf("  room model                       %5.1f%% right room\n", 100.0 * room_hits / n);
+    printf("  %-32s mean error %7.3f\n", "flat model", flat_error / n);
+    printf("  %-32s mean error %7.3f\n", "cascade", cascade_error / n);
+    for (size_t r = 0; r < o.rooms.size(); r++) {
+        if (room_count[r] > 0) {
+            printf("    in %-27s %4zu samples, cascade %7.3f, flat %7.3f\n", o.rooms[r].name.c_str(), room_count[r],
+                   room_error[r] / room_count[r], room_flat_error[r] / room_count[r]);
+        }
+    }
+
+    bool loads_ok = c->stats.load_failures == 0 && c->stats.loads == changes + 1;
+    printf("\nchecks\n");
+    printf("  every sample located             %zu of %zu %s\n", located, n, located == n ? "OK" : "FAILED");
+    printf("  fine model loaded on room change %u loads, %zu room changes %s\n", (unsigned) c->stats.loads, changes,
+           loads_ok ? "OK" : "FAILED");
+    printf("  cascade equals the fine model    %zu mismatches %s\n", mismatches, mismatches == 0 ? "OK" : "FAILED");
+    ok = located == n && loads_ok && mismatches == 0;
+
+    cascade_close(c);
+    delete c;
+    hal_unmap(&flat_slot->map);
+    delete flat_slot;
+    for (model_slot_t *slot : alone) {
+        hal_unmap(&slot->map);
+        delete slot;
+    }
+    printf("\n%s\n", ok ? "OK" : "FAILED");
+    return ok ? 0 : 1;
+}
+
+int main(int argc, char **argv) {
+    int rc = -1;
+    if (argc >= 2 && strcmp(argv[1], "fit") == 0) {
+        rc = fit(argc - 1, argv + 1);
+    } else if (argc >= 2 && strcmp(argv[1], "bench") == 0) {
+        rc = bench(argc - 1, argv + 1);
+    }
+    if (rc < 0) {
+        fprintf(stderr, "usage: %s fit [-R name:x0,y0,x1,y1;...] [-k neighbours] [-m fingerprints] [-a AP1,AP2,...] "
+                        "[-H hidden] [-b 8|16] [-e epochs] [-S seed] [-V version] [-o dir] "
+                        "[-x csi_cascade_registry.h] <train.csi>\n"
+                        "       %s bench [fit options] <train.csi> [test.csi]\n", argv[0], argv[0]);
+        return 1;
+    }
+    return rc;
+}
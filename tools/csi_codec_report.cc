@@ -0,0 +1,211 @@
+/*
+ * Reports how well the CSI delta codec compresses recorded captures, and how fast it encodes.
+ *
+ * Input is either a collector store (csi-w<N>.bin) or a serial/SD text log with lines in the
+ * `AP,rssi,len,[v v v ...]` shape printed by _wifi_csi_cb. Every frame is re-encoded per device and
+ * AP, decoded again and compared with the original, so the report doubles as a round-trip check.
+ *
+ * usage: csi_codec_report [-k keyframe_interval] capture...
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <chrono>
+#include <map>
+#include <string>
+#include <vector>
+
+#include "csi_packet_component.h"
+#include "csi_codec_component.h"
+
+typedef struct {
+    csi_record_t record;
+    std::vector<int8_t> payload;
+} frame_t;
+
+// Frames of one device in capture order
+typedef std::map<uint16_t, std::vector<frame_t>> capture_t;
+
+void add_frame(capture_t *capture, const csi_record_t *r) {
+    frame_t f;
+    f.record = *r;
+    f.payload.assign(r->data, r->data + r->len);
+    (*capture)[r->device_id].push_back(std::move(f));
+}
+
+// Collector store: recv_us (8) | length (4) | datagram, repeated
+bool load_store(const char *path, capture_t *capture) {
+    FILE *fp = fopen(path, "rb");
+    if (fp == NULL) {
+        return false;
+    }
+
+    std::map<uint16_t, csi_codec_t> decoders; // Captures may already be delta coded
+    int8_t decoded[CSI_RECORD_MAX_LEN];
+    uint8_t header[12];
+    std::vector<uint8_t> datagram;
+    while (fread(header, 1, sizeof(header), fp) == sizeof(header)) {
+        uint32_t len = _csi_get_u32(header + 8);
+        datagram.resize(len);
+        if (fread(datagram.data(), 1, len, fp) != len) {
+            break; // Truncated tail
+        }
+
+        csi_packet_reader_t rd;
+        csi_record_t r, raw;
+        if (!csi_packet_open(&rd, datagram.data(), len)) {
+            continue;
+        }
+        while (csi_packet_next(&rd, &r)) {
+            if (decoders.find(r.device_id) == decoders.end()) {
+                csi_codec_init(&decoders[r.device_id], 1);
+            }
+            if (csi_codec_decode(&decoders[r.device_id], &r, &raw, decoded)) {
+                add_frame(capture, &raw);
+            }
+        }
+    }
+
+    fclose(fp);
+    return true;
+}
+
+// Text log: AP,rssi,len,[v v v ...], AP names become AP ids in order of appearance
+bool load_text(const char *path, capture_t *capture) {
+    FILE *fp = fopen(path, "r");
+    if (fp == NULL) {
+        return false;
+    }
+
+    std::map<std::string, uint8_t> ap_ids;
+    std::map<uint8_t, uint32_t> seqs;
+    char line[8192];
+    int8_t values[CSI_RECORD_MAX_LEN];
+    while (fgets(line, sizeof(line), fp) != NULL) {
+        char *open = strchr(line, '[');
+        char *comma = strchr(line, ',');
+        if (open == NULL || comma == NULL || comma > open) {
+            continue;
+        }
+
+        std::string ap(line, comma - line);
+        if (ap_ids.find(ap) == ap_ids.end()) {
+            uint8_t id = (uint8_t) ap_ids.size();
+            ap_ids[ap] = id;
+        }
+
+        csi_record_t r;
+        memset(&r, 0, sizeof(r));
+        r.ap_id = ap_ids[ap];
+        r.rssi = (int8_t) atoi(comma + 1);
+
+        char *p = open + 1;
+        char *end;
+        uint16_t n = 0;
+        while (n < CSI_RECORD_MAX_LEN) {
+            long v = strtol(p, &end, 10);
+            if (end == p) {
+                break;
+            }
+            values[n++] = (int8_t) v;
+            p = end;
+        }
+        if (n == 0) {
+            continue;
+        }
+
+        r.seq = seqs[r.ap_id]++;
+        r.len = n;
+        r.data = values;
+        add_frame(capture, &r);
+    }
+
+    fclose(fp);
+    return true;
+}
+
+int main(int argc, char **argv) {
+    uint32_t keyframe_interval = CONFIG_CSI_KEYFRAME_INTERVAL;
+
+    int opt;
+    while ((opt = getopt(argc, argv, "k:")) != -1) {
+        switch (opt) {
+            case 'k': keyframe_interval = (uint32_t) atoi(optarg); break;
+            default:
+                fprintf(stderr, "usage: %s [-k keyframe_interval] capture...\n", argv[0]);
+                return 1;
+        }
+    }
+    if (optind >= argc) {
+        fprintf(stderr, "usage: %s [-k keyframe_interval] capture...\n", argv[0]);
+        return 1;
+    }
+
+    capture_t capture;
+    for (int i = optind; i < argc; i++) {
+        size_t len = strlen(argv[i]);
+        bool is_store = len > 4 && strcmp(argv[i] + len - 4, ".bin") == 0;
+        if (!(is_store ? load_store(argv[i], &capture) : load_text(argv[i], &capture))) {
+            fprintf(stderr, "ERROR: cannot read %s\n", argv[i]);
+            return 1;
+        }
+    }
+
+    uint64_t frames = 0, mismatches = 0;
+    uint64_t raw_bytes = 0, coded_bytes = 0, keyframes = 0;
+    double encode_ns = 0.0;
+    std::vector<csi_record_t> coded;
+    std::vector<std::vector<uint8_t>> coded_payloads;
+
+    for (auto &it : capture) {
+        std::vector<frame_t> &device_frames = it.second;
+        coded.resize(device_frames.size());
+        coded_payloads.resize(device_frames.size());
+        for (size_t i = 0; i < device_frames.size(); i++) {
+            device_frames[i].record.data = device_frames[i].payload.data();
+            coded_payloads[i].resize(CSI_CODEC_MAX_ENCODED);
+        }
+
+        csi_codec_t encoder;
+        csi_codec_init(&encoder, keyframe_interval);
+        auto start = std::chrono::steady_clock::now();
+        for (size_t i = 0; i < device_frames.size(); i++) {
+            csi_codec_encode(&encoder, &device_frames[i].record, &coded[i], coded_payloads[i].data());
+        }
+        encode_ns += std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count();
+
+        csi_codec_t decoder;
+        csi_codec_init(&decoder, keyframe_interval);
+        int8_t decoded[CSI_RECORD_MAX_LEN];
+        for (size_t i = 0; i < device_frames.size(); i++) {
+            csi_record_t out;
+            if (!csi_codec_decode(&decoder, &coded[i], &out, decoded) ||
+                out.len != device_frames[i].record.len ||
+                memcmp(out.data, device_frames[i].payload.data(), out.len) != 0) {
+                mismatches++;
+            }
+        }
+
+        frames += device_frames.size();
+        raw_bytes += encoder.raw_bytes;
+        coded_bytes += encoder.coded_bytes;
+        keyframes += encoder.keyframes;
+    }
+
+    if (frames == 0) {
+        fprintf(stderr, "no CSI frames found\n");
+        return 1;
+    }
+
+    // Ratio on the wire includes the fixed record header
+    double wire_raw = raw_bytes + frames * (double) CSI_RECORD_HEADER_SIZE;
+    double wire_coded = coded_bytes + frames * (double) CSI_RECORD_HEADER_SIZE;
+    printf("devices %zu  frames %llu  keyframes %llu  (interval %u)\n", capture.size(),
+           (unsigned long long) frames, (unsigned long long) keyframes, keyframe_interval);
+    printf("payload %.1f -> %.1f bytes/frame  ratio %.2fx  (on the wire %.2fx)\n",
+           (double) raw_bytes / frames, (double) coded_bytes / frames,
+           (double) raw_bytes / coded_bytes, wire_raw / wire_coded);
+    printf("encode %.1f ns/frame  round-trip mismatches %llu\n", encode_ns / frames, (unsigned long long) mismatches);
+    return mismatches == 0 ? 0 : 2;
+}
@@ -0,0 +1,408 @@
+/*
+ * CSI collector: receives the batched CSI datagrams the stations send to UDP port 2223.
+ *
+ * One receiver thread drains the socket with recvmmsg and hands each datagram to a worker picked by
+ * device id, so every station is decoded by exactly one worker and its records stay in order.
+ * Workers track sequence numbers per device (gaps, reordering, duplicates), append the datagrams
+ * to their own store file and keep the per-device interarrival jitter. A stats line is printed periodically.
+ *
+ * Station clocks are not synchronized to this host, so receive time minus capture time says nothing on its
+ * own. The jitter is the RFC 3550 estimate instead: the mean change of that difference from one datagram
+ * to the next, in which the clock offset cancels.
+ *
+ * usage: csi_collector [-p port] [-w workers] [-o dir] [-i stats_interval_s]
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <map>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "csi_packet_component.h"
+
+#define COLLECTOR_BATCH 64 // Datagrams per recvmmsg call
+#define COLLECTOR_QUEUE_LIMIT 65536 // Datagrams a worker may have pending before the receiver drops
+#define COLLECTOR_RESTART_WINDOW 65536 // A seq this far behind means the station restarted
+#define COLLECTOR_SEQ_WINDOW 4096 // Seqs behind the newest whose arrival is remembered, a power of two
+
+static std::atomic<bool> running(true);
+
+int64_t now_us() {
+    return std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::system_clock::now().time_since_epoch()).count();
+}
+
+// Sequence tracking for one station
+typedef struct {
+    uint32_t next_seq;
+    uint64_t records;
+    uint64_t lost;
+    uint64_t reordered;
+    uint64_t duplicates;
+    uint64_t late; // Arrived further behind than the window, or before the first record seen
+    uint64_t restarts;
+    uint32_t span; // Seqs from the first record seen to next_seq, up to COLLECTOR_SEQ_WINDOW
+    uint64_t received[COLLECTOR_SEQ_WINDOW / 64]; // Bit seq % COLLECTOR_SEQ_WINDOW: seq arrived
+    int64_t transit_us; // Receive time minus capture time of the previous datagram
+    double jitter_us;
+    bool seen;
+    bool timed; // transit_us holds a datagram
+} device_state_t;
+
+typedef struct {
+    int64_t recv_us;
+    std::vector<uint8_t> data;
+} datagram_t;
+
+typedef struct {
+    std::mutex mutex;
+    std::condition_variable cv;
+    std::vector<datagram_t> queue;
+    std::map<uint16_t, device_state_t> devices; // Guarded by mutex, read by the stats thread
+    std::atomic<uint64_t> packets{0};
+    std::atomic<uint64_t> malformed{0};
+    FILE *store = NULL;
+} worker_t;
+
+inline bool seq_received(const device_state_t *d, uint32_t seq) {
+    uint32_t bit = seq % COLLECTOR_SEQ_WINDOW;
+    return (d->received[bit / 64] >> (bit % 64)) & 1;
+}
+
+inline void seq_mark(device_state_t *d, uint32_t seq, bool received) {
+    uint32_t bit = seq % COLLECTOR_SEQ_WINDOW;
+    if (received) {
+        d->received[bit / 64] |= 1ull << (bit % 64);
+    } else {
+        d->received[bit / 64] &= ~(1ull << (bit % 64));
+    }
+}
+
+// Start the window over at `seq`, after the first record or a restart
+void seq_restart(device_state_t *d, uint32_t seq) {
+    memset(d->received, 0, sizeof(d->received));
+    d->next_seq = seq + 1;
+    d->span = 1;
+    seq_mark(d, seq, true);
+}
+
+// Move next_seq up to seq + 1. The seqs skipped enter the window as missing and push the oldest out.
+void seq_advance(device_state_t *d, uint32_t seq) {
+    uint32_t ahead = seq + 1 - d->next_seq;
+    if (ahead >= COLLECTOR_SEQ_WINDOW) {
+        memset(d->received, 0, sizeof(d->received));
+    } else {
+        for (uint32_t s = d->next_seq; s != seq; s++) {
+            seq_mark(d, s, false);
+        }
+    }
+    seq_mark(d, seq, true);
+    d->next_seq = seq + 1;
+    d->span = ahead >= COLLECTOR_SEQ_WINDOW - d->span ? COLLECTOR_SEQ_WINDOW : d->span + ahead;
+}
+
+void track_record(device_state_t *d, const csi_record_t *r) {
+    d->records++;
+
+    if (!d->seen) {
+        d->seen = true;
+        seq_restart(d, r->seq);
+        return;
+    }
+
+    uint32_t ahead = r->seq - d->next_seq; // Modulo 2^32
+    uint32_t behind = d->next_seq - r->seq;
+    if (ahead < COLLECTOR_RESTART_WINDOW) {
+        d->lost += ahead; // Everything in between is missing, for now
+        seq_advance(d, r->seq);
+    } else if (behind <= d->span) {
+        if (seq_received(d, r->seq)) {
+            d->duplicates++;
+        } else {
+            seq_mark(d, r->seq, true);
+            d->lost--; // It fills a gap counted when a later seq arrived
+            d->reordered++;
+        }
+    } else if (behind <= COLLECTOR_RESTART_WINDOW) {
+        d->late++; // Too old to tell a reordered record from a duplicate
+    } else {
+        d->restarts++;
+        seq_restart(d, r->seq);
+    }
+}
+
+// RFC 3550 interarrival jitter over the datagrams of a device, `r` being the last record of one
+void track_transit(device_state_t *d, const csi_record_t *r, int64_t recv_us) {
+    int64_t transit_us = recv_us - r->timestamp_us;
+    if (d->timed) {
+        int64_t change = transit_us - d->transit_us;
+        d->jitter_us += ((double) (change < 0 ? -change : change) - d->jitter_us) / 16;
+    }
+    d->transit_us = transit_us;
+    d->timed = true;
+}
+
+// Append one datagram to the worker's store: recv_us (8) | length (4) | datagram
+void store_datagram(worker_t *w, const datagram_t *dg) {
+    if (w->store == NULL) {
+        return;
+    }
+    uint8_t header[12];
+    _csi_put_u64(header, (uint64_t) dg->recv_us);
+    _csi_put_u32(header + 8, (uint32_t) dg->data.size());
+    fwrite(header, 1, sizeof(header), w->store);
+    fwrite(dg->data.data(), 1, dg->data.size(), w->store);
+}
+
+void worker_loop(worker_t *w) {
+    std::vector<datagram_t> batch;
+    while (true) {
+        {
+            std::unique_lock<std::mutex> lock(w->mutex);
+            w->cv.wait(lock, [w] { return !w->queue.empty() || !running; });
+            if (w->queue.empty() && !running) {
+                break;
+            }
+            batch.swap(w->queue);
+        }
+
+        for (const datagram_t &dg : batch) {
+            csi_packet_reader_t rd;
+            csi_record_t r;
+            if (!csi_packet_open(&rd, dg.data.data(), dg.data.size())) {
+                w->malformed++;
+                continue;
+            }
+
+            std::lock_guard<std::mutex> lock(w->mutex);
+            device_state_t *d = NULL;
+            while (csi_packet_next(&rd, &r)) {
+                d = &w->devices[r.device_id];
+                track_record(d, &r);
+            }
+            if (d != NULL) {
+                track_transit(d, &r, dg.recv_us);
+            }
+            if (rd.remaining != 0) {
+                w->malformed++;
+            }
+            w->packets++;
+        }
+
+        for (const datagram_t &dg : batch) {
+            store_datagram(w, &dg);
+        }
+        batch.clear();
+    }
+
+    if (w->store != NULL) {
+        fclose(w->store);
+    }
+}
+
+void receiver_loop(int socket_fd, std::vector<worker_t> *workers, std::atomic<uint64_t> *queue_drops) {
+    static uint8_t buffers[COLLECTOR_BATCH][CSI_PACKET_MTU];
+    struct mmsghdr msgs[COLLECTOR_BATCH];
+    struct iovec iovecs[COLLECTOR_BATCH];
+    std::vector<std::vector<datagram_t>> pending(workers->size());
+
+    memset(msgs, 0, sizeof(msgs));
+    for (int i = 0; i < COLLECTOR_BATCH; i++) {
+        iovecs[i].iov_base = buffers[i];
+        iovecs[i].iov_len = CSI_PACKET_MTU;
+        msgs[i].msg_hdr.msg_iov = &iovecs[i];
+        msgs[i].msg_hdr.msg_iovlen = 1;
+    }
+
+    while (running) {
+        int n = recvmmsg(socket_fd, msgs, COLLECTOR_BATCH, MSG_WAITFORONE, NULL);
+        if (n <= 0) {
+            continue; // Timeout (SO_RCVTIMEO) or EINTR, re-check running
+        }
+
+        int64_t recv_us = now_us();
+        for (int i = 0; i < n; i++) {
+            size_t len = msgs[i].msg_len;
+            uint16_t device = len >= CSI_PACKET_HEADER_SIZE ? _csi_get_u16(buffers[i] + 4) : 0;
+            datagram_t dg;
+            dg.recv_us = recv_us;
+            dg.data.assign(buffers[i], buffers[i] + len);
+            pending[device % workers->size()].push_back(std::move(dg));
+        }
+
+        for (size_t i = 0; i < workers->size(); i++) {
+            if (pending[i].empty()) {
+                continue;
+            }
+            worker_t *w = &(*workers)[i];
+            {
+                std::lock_guard<std::mutex> lock(w->mutex);
+                if (w->queue.size() + pending[i].size() > COLLECTOR_QUEUE_LIMIT) {
+                    *queue_drops += pending[i].size();
+                } else {
+                    for (datagram_t &dg : pending[i]) {
+                        w->queue.push_back(std::move(dg));
+                    }
+                }
+            }
+            w->cv.notify_one();
+            pending[i].clear();
+        }
+    }
+}
+
+void print_stats(std::vector<worker_t> *workers, std::atomic<uint64_t> *queue_drops, double interval_s) {
+    static uint64_t last_packets = 0;
+    static uint64_t last_records = 0;
+
+    uint64_t packets = 0, malformed = 0, records = 0, lost = 0, reordered = 0, duplicates = 0, late = 0;
+    double max_jitter_us = 0;
+    uint16_t max_jitter_device = 0;
+    size_t devices = 0;
+
+    for (worker_t &w : *workers) {
+        packets += w.packets;
+        malformed += w.malformed;
+        std::lock_guard<std::mutex> lock(w.mutex);
+        for (auto &it : w.devices) {
+            const device_state_t &d = it.second;
+            devices++;
+            records += d.records;
+            lost += d.lost;
+            reordered += d.reordered;
+            duplicates += d.duplicates;
+            late += d.late;
+            if (d.jitter_us > max_jitter_us) {
+                max_jitter_us = d.jitter_us;
+                max_jitter_device = it.first;
+            }
+        }
+    }
+
+    printf("devices %zu  packets/s %.0f  records/s %.0f  lost %llu  reordered %llu  dup %llu  late %llu  malformed %llu  queue_drops %llu  max_jitter %.2f ms (device %u)\n",
+           devices,
+           (packets - last_packets) / interval_s,
+           (records - last_records) / interval_s,
+           (unsigned long long) lost, (unsigned long long) reordered, (unsigned long long) duplicates,
+           (unsigned long long) late, (unsigned long long) malformed, (unsigned long long) queue_drops->load(),
+           max_jitter_us / 1000.0, max_jitter_device);
+    fflush(stdout);
+
+    last_packets = packets;
+    last_records = records;
+}
+
+void print_devices(std::vector<worker_t> *workers) {
+    printf("device  records  lost  reordered  dup  late  restarts  jitter_ms\n");
+    for (worker_t &w : *workers) {
+        std::lock_guard<std::mutex> lock(w.mutex);
+        for (auto &it : w.devices) {
+            const device_state_t &d = it.second;
+            printf("%6u  %7llu  %4llu  %9llu  %3llu  %4llu  %8llu  %9.2f\n", it.first,
+                   (unsigned long long) d.records, (unsigned long long) d.lost,
+                   (unsigned long long) d.reordered, (unsigned long long) d.duplicates,
+                   (unsigned long long) d.late, (unsigned long long) d.restarts, d.jitter_us / 1000.0);
+        }
+    }
+}
+
+void handle_signal(int) {
+    running = false;
+}
+
+int main(int argc, char **argv) {
+    int port = 2223;
+    int num_workers = 4;
+    const char *out_dir = NULL;
+    double interval_s = 1.0;
+
+    int opt;
+    while ((opt = getopt(argc, argv, "p:w:o:i:")) != -1) {
+        switch (opt) {
+            case 'p': port = atoi(optarg); break;
+            case 'w': num_workers = atoi(optarg); break;
+            case 'o': out_dir = optarg; break;
+            case 'i': interval_s = atof(optarg); break;
+            default:
+                fprintf(stderr, "usage: %s [-p port] [-w workers] [-o dir] [-i stats_interval_s]\n", argv[0]);
+                return 1;
+        }
+    }
+    if (num_workers < 1) {
+        num_workers = 1;
+    }
+
+    int socket_fd = socket(AF_INET, SOCK_DGRAM, 0);
+    if (socket_fd == -1) {
+        fprintf(stderr, "ERROR: Socket creation error [%s]\n", strerror(errno));
+        return 1;
+    }
+
+    int rcvbuf = 8 * 1024 * 1024;
+    setsockopt(socket_fd, SOL_SOCKET, SO_RCVBUF, &rcvbuf, sizeof(rcvbuf));
+    struct timeval timeout = {.tv_sec = 0, .tv_usec = 200000};
+    setsockopt(socket_fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_ANY);
+    addr.sin_port = htons(port);
+    if (bind(socket_fd, (const struct sockaddr *) &addr, sizeof(addr)) == -1) {
+        fprintf(stderr, "ERROR: bind to port %d failed [%s]\n", port, strerror(errno));
+        return 1;
+    }
+
+    std::vector<worker_t> workers(num_workers);
+    if (out_dir != NULL) {
+        for (int i = 0; i < num_workers; i++) {
+            char path[512];
+            snprintf(path, sizeof(path), "%s/csi-w%d.bin", out_dir, i);
+            workers[i].store = fopen(path, "ab");
+            if (workers[i].store == NULL) {
+                fprintf(stderr, "ERROR: cannot open %s [%s]\n", path, strerror(errno));
+                return 1;
+            }
+        }
+    }
+
+    signal(SIGINT, handle_signal);
+    signal(SIGTERM, handle_signal);
+
+    std::atomic<uint64_t> queue_drops(0);
+    std::vector<std::thread> threads;
+    for (int i = 0; i < num_workers; i++) {
+        threads.emplace_back(worker_loop, &workers[i]);
+    }
+    std::thread receiver(receiver_loop, socket_fd, &workers, &queue_drops);
+
+    printf("listening on UDP %d with %d workers\n", port, num_workers);
+    auto next_report = std::chrono::steady_clock::now();
+    while (running) {
+        next_report += std::chrono::microseconds((int64_t) (interval_s * 1e6));
+        std::this_thread::sleep_until(next_report);
+        print_stats(&workers, &queue_drops, interval_s);
+    }
+
+    receiver.join();
+    for (worker_t &w : workers) {
+        w.cv.notify_all();
+    }
+    for (std::thread &t : threads) {
+        t.join();
+    }
+    close(socket_fd);
+
+    print_devices(&workers);
+    return 0;
+}
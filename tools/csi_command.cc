@@ -0,0 +1,347 @@
+/*
+ * Client and self-test for the station command channel (command_component.h).
+ *
+ *   csi_command send [-p port] <station ip> <command...>
+ *       send one command over UDP (2225 by default) and print the reply, e.g. "RATE 200", "SINK udp,sd"
+ *   csi_command selftest [-n fuzz_kb]
+ *       run the channel in-process on a pty (standing in for the console UART) and on UDP loopback, with
+ *       RATE/WINDOW/SINK handlers driving a paced capture loop. Checks a live rate change without restarting
+ *       the loop, over-long and unknown commands, a bad SETTIME, fragmented and CRLF input, multi-line
+ *       datagrams and random bytes, then reports the round-trip latency of a command on both transports. Exits 1 on a failure.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <poll.h>
+#include <pty.h>
+#include <termios.h>
+#include <algorithm>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "command_component.h"
+#include "pacer_component.h"
+
+int64_t now_us() {
+    return std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+int send_command(int argc, char **argv) {
+    int port = COMMAND_UDP_PORT;
+    int opt;
+    while ((opt = getopt(argc, argv, "p:")) != -1) {
+        switch (opt) {
+            case 'p': port = atoi(optarg); break;
+            default: return -1;
+        }
+    }
+    if (optind + 2 > argc) {
+        return -1;
+    }
+    std::string line;
+    for (int i = optind + 1; i < argc; i++) {
+        line += (i > optind + 1 ? " " : "") + std::string(argv[i]);
+    }
+
+    int fd = socket(PF_INET, SOCK_DGRAM, 0);
+    struct sockaddr_in to;
+    memset(&to, 0, sizeof(to));
+    to.sin_family = AF_INET;
+    to.sin_port = htons((uint16_t) port);
+    if (inet_pton(AF_INET, argv[optind], &to.sin_addr) != 1) {
+        printf("ERROR: bad address %s\n", argv[optind]);
+        return 1;
+    }
+    struct timeval timeout = {1, 0};
+    setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+    sendto(fd, line.data(), line.size(), 0, (const struct sockaddr *) &to, sizeof(to));
+    char reply[COMMAND_REPLY_MAX + 1];
+    ssize_t n = recv(fd, reply, sizeof(reply) - 1, 0);
+    close(fd);
+    if (n < 0) {
+        printf("ERROR: no reply from %s:%d\n", argv[optind], port);
+        return 1;
+    }
+    reply[n] = '\0';
+    printf("%s\n", reply);
+    return strncmp(reply, "OK", 2) == 0 ? 0 : 1;
+}
+
+// The capture loop being retuned: paced packets in windows, like socket_transmitter_sta_loop
+std::atomic<uint32_t> test_rate{100};
+std::atomic<int> test_window{10};
+std::atomic<uint8_t> test_sinks{7};
+std::atomic<uint64_t> test_packets{0};
+std::atomic<uint64_t> test_restarts{0}; // Times the loop was (re)started, must stay 1
+std::atomic<bool> test_running{true};
+
+bool test_command_rate(int argc, char **argv, char *reply, size_t reply_size) {
+    long rate;
+    if (argc != 2 || !command_parse_int(argv[1], 1, 1000, &rate)) {
+        return false;
+    }
+    test_rate = (uint32_t) rate;
+    snprintf(reply, reply_size, "rate %ld/s", rate);
+    return true;
+}
+
+bool test_command_window(int argc, char **argv, char *reply, size_t reply_size) {
+    long packets;
+    if (argc != 2 || !command_parse_int(argv[1], 1, 10000, &packets)) {
+        return false;
+    }
+    test_window = (int) packets;
+    snprintf(reply, reply_size, "window %ld", packets);
+    return true;
+}
+
+bool test_command_sink(int argc, char **argv, char *reply, size_t reply_size) {
+    if (argc != 2) {
+        return false;
+    }
+    test_sinks = strcasecmp(argv[1], "none") == 0 ? 0 : 7;
+    snprintf(reply, reply_size, "sinks %u", (unsigned) test_sinks);
+    return true;
+}
+
+void capture_loop() {
+    test_restarts++;
+    pacer_t pacer;
+    uint32_t applied = test_rate;
+    pacer_init(&pacer, applied, 4);
+    while (test_running) {
+        for (int i = 0; i < test_window && test_running; i++) {
+            if (test_rate != applied) {
+                applied = test_rate;
+                pacer_set_rate(&pacer, applied);
+            }
+            pacer_wait(&pacer);
+            test_packets++;
+        }
+    }
+}
+
+// Reads reply lines from a pty master or a UDP socket
+typedef struct {
+    int fd;
+    bool udp;
+    std::string pending;
+} test_client_t;
+
+bool read_line(test_client_t *t, std::string *line, int timeout_ms) {
+    int64_t deadline = now_us() + timeout_ms * 1000LL;
+    while (true) {
+        size_t eol = t->pending.find('\n');
+        if (eol != std::string::npos) {
+            *line = t->pending.substr(0, eol);
+            t->pending.erase(0, eol + 1);
+            return true;
+        }
+        int left_ms = (int) ((deadline - now_us()) / 1000);
+        struct pollfd p = {t->fd, POLLIN, 0};
+        if (left_ms <= 0 || poll(&p, 1, left_ms) <= 0) {
+            return false;
+        }
+        char buf[4096];
+        ssize_t n = read(t->fd, buf, sizeof(buf));
+        if (n <= 0) {
+            return false;
+        }
+        t->pending.append(buf, n);
+        if (t->udp) {
+            t->pending += '\n'; // One reply per datagram
+        }
+    }
+}
+
+void drain(test_client_t *t, int quiet_ms) {
+    std::string line;
+    while (read_line(t, &line, quiet_ms)) {
+    }
+    t->pending.clear();
+}
+
+void send_bytes(test_client_t *t, const std::string &bytes) {
+    if (write(t->fd, bytes.data(), bytes.size()) != (ssize_t) bytes.size()) {
+        printf("ERROR: short write [%s]\n", strerror(errno));
+    }
+}
+
+int failures = 0;
+
+void check(bool ok, const char *what, const std::string &detail = "") {
+    printf("%-4s %s%s%s\n", ok ? "ok" : "FAIL", what, detail.empty() ? "" : ": ", detail.c_str());
+    failures += ok ? 0 : 1;
+}
+
+// Send `bytes`, expect `lines` replies, the last one starting with `prefix`
+bool exchange(test_client_t *t, const std::string &bytes, int lines, const char *prefix, std::string *last) {
+    send_bytes(t, bytes);
+    for (int i = 0; i < lines; i++) {
+        if (!read_line(t, last, 1000)) {
+            *last = "(no reply)";
+            return false;
+        }
+    }
+    return strncmp(last->c_str(), prefix, strlen(prefix)) == 0;
+}
+
+double packets_per_second(int ms) {
+    uint64_t start = test_packets;
+    std::this_thread::sleep_for(std::chrono::milliseconds(ms));
+    return (test_packets - start) * 1000.0 / ms;
+}
+
+double latency_p50_us(test_client_t *t, int rounds) {
+    std::vector<int64_t> us;
+    std::string line;
+    for (int i = 0; i < rounds; i++) {
+        int64_t start = now_us();
+        send_bytes(t, t->udp ? "WINDOW 10" : "WINDOW 10\n");
+        if (read_line(t, &line, 1000)) {
+            us.push_back(now_us() - start);
+        }
+    }
+    if (us.empty()) {
+        return -1;
+    }
+    std::sort(us.begin(), us.end());
+    return (double) us[us.size() / 2];
+}
+
+int selftest(int argc, char **argv) {
+    int fuzz_kb = 64;
+    int opt;
+    while ((opt = getopt(argc, argv, "n:")) != -1) {
+        switch (opt) {
+            case 'n': fuzz_kb = atoi(optarg); break;
+            default: return -1;
+        }
+    }
+
+    int master, slave;
+    if (openpty(&master, &slave, NULL, NULL, NULL) == -1) {
+        printf("ERROR: openpty [%s]\n", strerror(errno));
+        return 1;
+    }
+    struct termios raw;
+    tcgetattr(slave, &raw);
+    cfmakeraw(&raw); // Byte stream like the UART: no echo, no line editing
+    tcsetattr(slave, TCSANOW, &raw);
+
+    command_register("RATE", "<packets per second>", &test_command_rate);
+    command_register("WINDOW", "<packets per AP visit>", &test_command_window);
+    command_register("SINK", "all | none", &test_command_sink);
+    command_channel_t *channel = new command_channel_t();
+    if (!command_start(channel, slave, slave, 0)) {
+        return 1;
+    }
+    int udp = socket(PF_INET, SOCK_DGRAM, 0);
+    struct sockaddr_in to;
+    memset(&to, 0, sizeof(to));
+    to.sin_family = AF_INET;
+    to.sin_port = htons(channel->udp_port);
+    to.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    connect(udp, (const struct sockaddr *) &to, sizeof(to));
+
+    test_client_t uart = {master, false, ""};
+    test_client_t net = {udp, true, ""};
+    std::thread capture(capture_loop);
+    std::string reply;
+
+    check(exchange(&uart, "HELP\n", 1, "OK RATE, WINDOW, SINK, HELP, SETTIME", &reply), "HELP lists the table", reply);
+
+    double before = packets_per_second(1000);
+    check(exchange(&uart, "RATE 300\n", 1, "OK rate 300", &reply), "RATE on the console", reply);
+    packets_per_second(100); // The pacer settles on the new interval
+    double after = packets_per_second(1000);
+    char rates[96];
+    snprintf(rates, sizeof(rates), "%.0f/s -> %.0f/s, loop started %llu time(s)", before, after,
+             (unsigned long long) test_restarts);
+    check(std::fabs(before - 100) < 15 && std::fabs(after - 300) < 30 && test_restarts == 1,
+          "capture rate follows RATE without a restart", rates);
+
+    std::string too_long(3 * COMMAND_LINE_MAX, 'x');
+    check(exchange(&uart, "RATE " + too_long + "\n", 1, "ERR line too long", &reply), "over-long line rejected", reply);
+    check(exchange(&uart, "RATE 120\n", 1, "OK rate 120", &reply) && test_rate == 120,
+          "next line after an over-long one", reply);
+    check(exchange(&uart, "FROB 1\n", 1, "ERR unknown command", &reply), "unknown command", reply);
+    check(exchange(&uart, "RATE 0\n", 1, "ERR usage: RATE", &reply) && test_rate == 120, "out of range keeps the rate",
+          reply);
+    uint64_t failed_before = command_stats.failed;
+    check(exchange(&uart, "RATE 1 2 3 4 5 6 7 8 9\n", 1, "ERR too many", &reply) &&
+          command_stats.failed == failed_before + 1, "too many arguments, counted as failed", reply);
+    real_time_set = true; // As after an earlier SETTIME; a good one is not sent, it would set the host clock
+    check(exchange(&uart, "SETTIME abc\n", 1, "ERR usage: SETTIME", &reply) && real_time_set,
+          "bad SETTIME keeps the time set", reply);
+
+    // Fragmented: one byte per write, with CRLF endings and a blank line in between
+    std::string fragmented = "window 25\r\n\r\nsink: none\r\n";
+    for (char c : fragmented) {
+        send_bytes(&uart, std::string(1, c));
+        std::this_thread::sleep_for(std::chrono::microseconds(200));
+    }
+    bool ok = read_line(&uart, &reply, 1000) && reply == "OK window 25";
+    ok = ok && read_line(&uart, &reply, 1000) && reply == "OK sinks 0";
+    check(ok && test_window == 25 && test_sinks == 0, "byte-by-byte, CRLF, lower case, trailing ':'", reply);
+
+    // UDP: a datagram per command, the last line needs no newline
+    check(exchange(&net, "RATE 200", 1, "OK rate 200", &reply) && test_rate == 200, "RATE over UDP", reply);
+    send_bytes(&net, "SINK all\nWINDOW 5\nHELP");
+    ok = read_line(&net, &reply, 1000) && reply == "OK sinks 7";
+    ok = ok && read_line(&net, &reply, 1000) && reply == "OK window 5";
+    ok = ok && read_line(&net, &reply, 1000) && reply.compare(0, 7, "OK RATE") == 0;
+    check(ok && test_sinks == 7 && test_window == 5, "three commands in one datagram", reply);
+
+    // Random bytes on the console: replies are drained, then the channel must still answer
+    std::mt19937 rng(3);
+    uint64_t overflows_before = command_stats.overflows;
+    for (int k = 0; k < fuzz_kb * 4; k++) {
+        std::string junk(256, '\0');
+        for (char &c : junk) {
+            c = (char) (rng() % 4 == 0 ? "\n\r \t"[rng() % 4] : rng() % 256);
+        }
+        if (k % 16 == 0) {
+            junk += std::string(2 * COMMAND_LINE_MAX, 'y'); // Some lines that are too long
+        }
+        send_bytes(&uart, junk);
+        drain(&uart, 1);
+    }
+    send_bytes(&uart, "\n"); // Ends the partial line the junk left behind
+    drain(&uart, 200);
+    check(exchange(&uart, "WINDOW 7\n", 1, "OK window 7", &reply) && test_window == 7, "responsive after random bytes",
+          reply);
+    check(command_stats.overflows > overflows_before, "random long lines counted as overflows");
+
+    double uart_us = latency_p50_us(&uart, 200);
+    double udp_us = latency_p50_us(&net, 200);
+    test_running = false;
+    capture.join();
+    command_stop(channel);
+    printf("round trip p50: pty %.0f us, udp %.0f us; %llu lines, %llu failed, %llu too long\n", uart_us, udp_us,
+           (unsigned long long) command_stats.lines, (unsigned long long) command_stats.failed,
+           (unsigned long long) command_stats.overflows);
+
+    close(udp);
+    close(master);
+    close(slave);
+    delete channel;
+    printf("%s\n", failures == 0 ? "all checks passed" : "FAILED");
+    return failures == 0 ? 0 : 1;
+}
+
+int main(int argc, char **argv) {
+    int rc = -1;
+    if (argc >= 2 && strcmp(argv[1], "send") == 0) {
+        rc = send_command(argc - 1, argv + 1);
+    } else if (argc >= 2 && strcmp(argv[1], "selftest") == 0) {
+        rc = selftest(argc - 1, argv + 1);
+    }
+    if (rc < 0) {
+        fprintf(stderr, "usage: %s send [-p port] <station ip> <command...> | selftest [-n fuzz_kb]\n", argv[0]);
+        return 1;
+    }
+    return rc;
+}
@@ -0,0 +1,277 @@
+/*
+ * Converts serial/SD text CSI logs to the columnar training store (csi_store.h).
+ *
+ *   csi_convert [-j threads] -o out.csit log[:label]...
+ *       parse the logs in parallel and write one store; `:label` tags every row of that log
+ *   csi_convert info <store.csit>
+ *       tables, rows, widths, label and time ranges
+ *   csi_convert bench [-m MB] [-j threads] [-o dir]
+ *       generate a synthetic log, convert it with the old line-by-line parsing (fgets + strtol, as
+ *       csi_codec_report does) and with the converter, report GB/s and check that all three agree on
+ *       the row counts and values; then convert a few edge rows: amplitudes past int8 must be kept, and a
+ *       row that does not parse or does not fit int16 must be rejected without leaving an empty table
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "csi_store.h"
+
+int info(const char *path) {
+    csi_store_t s;
+    if (!csi_store_open(&s, path)) {
+        return 1;
+    }
+    printf("%s: %zu tables, %llu rows, %zu bytes\n", path, s.tables.size(), (unsigned long long) s.total_rows, s.size);
+    for (const csi_store_table_t &t : s.tables) {
+        int16_t label_min = INT16_MAX, label_max = INT16_MIN;
+        int64_t ts_min = INT64_MAX, ts_max = -1;
+        for (uint64_t r = 0; r < t.rows; r++) {
+            label_min = std::min(label_min, t.label[r]);
+            label_max = std::max(label_max, t.label[r]);
+            if (t.timestamp_us[r] >= 0) {
+                ts_min = std::min(ts_min, t.timestamp_us[r]);
+                ts_max = std::max(ts_max, t.timestamp_us[r]);
+            }
+        }
+        printf("  %-12s %10llu rows x %4u values", t.name, (unsigned long long) t.rows, (unsigned) t.width);
+        if (t.rows > 0) {
+            printf("  labels %d..%d", label_min, label_max);
+        }
+        if (ts_max >= 0) {
+            printf("  time %.3f..%.3f s", ts_min / 1e6, ts_max / 1e6);
+        }
+        printf("\n");
+    }
+    csi_store_close(&s);
+    return 0;
+}
+
+int convert(int argc, char **argv) {
+    unsigned threads = std::thread::hardware_concurrency();
+    const char *out = NULL;
+
+    int opt;
+    while ((opt = getopt(argc, argv, "j:o:")) != -1) {
+        switch (opt) {
+            case 'j': threads = (unsigned) atoi(optarg); break;
+            case 'o': out = optarg; break;
+            default: return -1;
+        }
+    }
+    if (out == NULL || optind >= argc) {
+        return -1;
+    }
+
+    // log:label, a path with a colon keeps it when the part after the last one is not a number
+    std::vector<std::string> inputs;
+    std::vector<int16_t> labels;
+    for (int i = optind; i < argc; i++) {
+        std::string arg = argv[i];
+        size_t colon = arg.rfind(':');
+        char *end = NULL;
+        long label = colon == std::string::npos ? -1 : strtol(arg.c_str() + colon + 1, &end, 10);
+        if (end != NULL && end != arg.c_str() + colon + 1 && *end == '\0') {
+            inputs.push_back(arg.substr(0, colon));
+            labels.push_back((int16_t) label);
+        } else {
+            inputs.push_back(arg);
+            labels.push_back(-1);
+        }
+    }
+
+    csi_convert_stats_t st;
+    if (!csi_convert(inputs, labels, out, threads, &st)) {
+        return 1;
+    }
+    printf("%.1f MB in %.3f s (%.2f GB/s parse, %.3f s write) with %u threads\n", st.bytes / 1e6,
+           st.parse_s + st.write_s, st.bytes / 1e9 / st.parse_s, st.write_s, threads);
+    printf("%llu lines: %llu rows in %u tables, %llu other, %llu rejected\n", (unsigned long long) st.lines,
+           (unsigned long long) st.rows, (unsigned) st.tables, (unsigned long long) st.other,
+           (unsigned long long) st.rejected);
+
+    // The store must hold exactly the rows that were parsed, and every line must be accounted for
+    csi_store_t s;
+    if (!csi_store_open(&s, out)) {
+        return 1;
+    }
+    uint64_t stored = 0;
+    for (const csi_store_table_t &t : s.tables) {
+        stored += t.rows;
+    }
+    csi_store_close(&s);
+    if (stored != st.rows || st.rows + st.other + st.rejected != st.lines) {
+        printf("ERROR: row count mismatch: %llu stored, %llu parsed\n", (unsigned long long) stored,
+               (unsigned long long) st.rows);
+        return 1;
+    }
+    return 0;
+}
+
+// A station log: ESP log lines, one frame per AP and a CSI_DATA line per round
+void make_log(const std::string &path, uint64_t bytes) {
+    FILE *f = fopen(path.c_str(), "w");
+    std::mt19937 rng(11);
+    uint64_t written = 0;
+    int64_t ms = 589;
+    for (int round = 0; written < bytes; round++) {
+        std::string all = "CSI_DATA ";
+        for (int ap = 0; ap < 3; ap++) {
+            ms += 1 + rng() % 200;
+            written += fprintf(f, "I (%lld) wifi station: SSID: AP%d\n", (long long) ms, ap + 1);
+            std::string line = "AP" + std::to_string(ap + 1) + ",-" + std::to_string(30 + rng() % 60) + ",384,[";
+            for (int k = 0; k < 128; k++) {
+                std::string v = std::to_string((int) (rng() % 61) - 30);
+                line += v + " ";
+                all += v + " ";
+            }
+            line += "]\n";
+            written += fwrite(line.data(), 1, line.size(), f);
+        }
+        written += fprintf(f, "E (%lld) wifi station: Round %d ---------------------------------------->\n",
+                           (long long) ms, round + 1);
+        all += "\n";
+        written += fwrite(all.data(), 1, all.size(), f);
+    }
+    fclose(f);
+}
+
+// The old way: one line at a time through fgets and strtol
+uint64_t baseline_rows(const std::string &path, int64_t *checksum) {
+    FILE *f = fopen(path.c_str(), "r");
+    static char line[1 << 16];
+    uint64_t rows = 0;
+    while (fgets(line, sizeof(line), f) != NULL) {
+        char *p = strchr(line, '[');
+        if (strncmp(line, "CSI_DATA", 8) == 0) {
+            p = line + 8;
+        } else if (p == NULL) {
+            continue;
+        } else {
+            p++;
+        }
+        char *end;
+        while (true) {
+            long v = strtol(p, &end, 10);
+            if (end == p) {
+                break;
+            }
+            *checksum += v;
+            p = end;
+        }
+        rows++;
+    }
+    fclose(f);
+    return rows;
+}
+
+// Amplitudes past int8 keep their values, rows that cannot be stored are rejected and make no table
+bool check_edge_rows(const std::string &dir) {
+    std::string log = dir + "/csi_convert_edge.txt";
+    std::string store = dir + "/csi_convert_edge.csit";
+    FILE *f = fopen(log.c_str(), "w");
+    fprintf(f, "AMP,-50,4,[0 181 255 -300]\nBAD,-50,2,[1 x]\nBIG,-50,1,[40000]\nAMP,-51,1,[32767]\n");
+    fclose(f);
+
+    csi_convert_stats_t st;
+    csi_store_t s;
+    bool ok = csi_convert({log}, {-1}, store.c_str(), 1, &st) && csi_store_open(&s, store.c_str());
+    if (ok) {
+        const int16_t expected[] = {0, 181, 255, -300, 32767, 0, 0, 0};
+        const csi_store_table_t &t = s.tables[0];
+        ok = st.rows == 2 && st.rejected == 2 && s.tables.size() == 1 && strcmp(t.name, "AMP") == 0 &&
+             t.rows == 2 && t.width == 4 && t.count[0] == 4 && t.count[1] == 1 &&
+             memcmp(t.values, expected, sizeof(expected)) == 0;
+        csi_store_close(&s);
+    }
+    printf("edge rows: amplitudes kept, rows outside int16 or unparsable rejected without a table %s\n",
+           ok ? "OK" : "FAILED");
+    unlink(log.c_str());
+    unlink(store.c_str());
+    return ok;
+}
+
+int bench(int argc, char **argv) {
+    uint64_t mb = 256;
+    unsigned threads = std::thread::hardware_concurrency();
+    std::string dir = "/tmp";
+
+    int opt;
+    while ((opt = getopt(argc, argv, "m:j:o:")) != -1) {
+        switch (opt) {
+            case 'm': mb = strtoull(optarg, NULL, 10); break;
+            case 'j': threads = (unsigned) atoi(optarg); break;
+            case 'o': dir = optarg; break;
+            default:
+                fprintf(stderr, "usage: csi_convert bench [-m MB] [-j threads] [-o dir]\n");
+                return 1;
+        }
+    }
+
+    std::string log = dir + "/csi_convert_bench.txt";
+    std::string store = dir + "/csi_convert_bench.csit";
+    make_log(log, mb * 1000000);
+
+    int64_t expected_sum = 0;
+    double start = _csi_store_now_s();
+    uint64_t expected_rows = baseline_rows(log, &expected_sum);
+    double baseline_s = _csi_store_now_s() - start;
+
+    csi_convert_stats_t st;
+    int rc = 0;
+    for (unsigned j : {1u, threads}) {
+        if (!csi_convert({log}, {0}, store.c_str(), j, &st)) {
+            return 1;
+        }
+        csi_store_t s;
+        if (!csi_store_open(&s, store.c_str())) {
+            return 1;
+        }
+        uint64_t rows = 0;
+        int64_t sum = 0;
+        for (const csi_store_table_t &t : s.tables) {
+            rows += t.rows;
+            for (uint64_t r = 0; r < t.rows; r++) {
+                for (uint16_t k = 0; k < t.count[r]; k++) {
+                    sum += t.values[r * t.width + k];
+                }
+            }
+        }
+        csi_store_close(&s);
+        bool same = rows == expected_rows && sum == expected_sum && st.rejected == 0;
+        rc |= same ? 0 : 1;
+        printf("converter, %u threads: %.2f GB/s parse, %.2f GB/s end to end, %llu rows in %u tables %s\n", j,
+               st.bytes / 1e9 / st.parse_s, st.bytes / 1e9 / (st.parse_s + st.write_s), (unsigned long long) rows,
+               (unsigned) st.tables, same ? "(rows and values match)" : "(MISMATCH)");
+        if (j == threads) {
+            break;
+        }
+    }
+    printf("line by line (fgets + strtol): %.2f GB/s, %llu rows, %.1f MB log\n", st.bytes / 1e9 / baseline_s,
+           (unsigned long long) expected_rows, st.bytes / 1e6);
+
+    unlink(log.c_str());
+    unlink(store.c_str());
+    rc |= check_edge_rows(dir) ? 0 : 1;
+    return rc;
+}
+
+int main(int argc, char **argv) {
+    if (argc >= 3 && strcmp(argv[1], "info") == 0) {
+        return info(argv[2]);
+    }
+    if (argc >= 2 && strcmp(argv[1], "bench") == 0) {
+        return bench(argc - 1, argv + 1);
+    }
+    int rc = convert(argc, argv);
+    if (rc < 0) {
+        fprintf(stderr, "usage: %s [-j threads] -o out.csit log[:label]... | info <store.csit> | bench [-m MB] [-j threads] [-o dir]\n",
+                argv[0]);
+        return 1;
+    }
+    return rc;
+}
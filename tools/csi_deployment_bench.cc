@@ -0,0 +1,221 @@
+/*
+ * Benchmarks the deployment sketches' per-frame and per-inference code natively (deployments/ components
+ * through hal_component.h), fed with synthetic frames (csi_synth.h) through hal_csi_inject.
+ *
+ *   callback     _wifi_csi_cb per frame, and for the first frame of an AP, which also fills csi_buffer
+ *   features     csi_complete, what run_classifier reads the features through: the whole signal at once
+ *                and in the chunks a DSP block asks for
+ *   normalization standardizing the features as a float pass after csi_complete (what the model's DSP
+ *                block does) against the fixed-point tables applied while csi_complete assembles them
+ *                (norm_component.h, fitted here on the benchmark's frames as tools/csi_norm would)
+ *   formatting   _csi_text_render
+ *   sockets      _build_csi_packet, delta coded (CONFIG_CSI_COMPRESSION)
+ *
+ * usage: csi_deployment_bench [-n iterations] [-c chunk] [-S seed]
+ */
+#define CONFIG_CSI_COMPRESSION 1
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <vector>
+
+#include "csi_synth.h"
+#include "sockets_component.h"
+#include "csi_bench.h"
+
+#define BENCH_APS 3
+#define BENCH_FEATURES (BENCH_APS * CSI_FEATURES_PER_AP) // SIZE_SUB_ARRAY of the sketches
+
+// What the sketch defines
+int csi_buffer[BENCH_FEATURES];
+size_t csi_buffer_size = BENCH_FEATURES;
+int csi_buffer_index = 0;
+int rssi_chain[BENCH_APS];
+bool send_csi = true;
+
+typedef struct {
+    wifi_csi_info_t info;
+    int8_t buf[3 * SYNTH_LTF_BYTES];
+} frame_t;
+
+void count_output(void *ctx, const char *, size_t len) {
+    *(uint64_t *) ctx += len;
+}
+
+int main(int argc, char **argv) {
+    long n = 20000;
+    size_t chunk = 32;
+    uint64_t seed = 1;
+
+    int opt;
+    while ((opt = getopt(argc, argv, "n:c:S:")) != -1) {
+        switch (opt) {
+            case 'n': n = std::max(100L, atol(optarg)); break;
+            case 'c': chunk = (size_t) std::max(1, std::min(BENCH_FEATURES, atoi(optarg))); break;
+            case 'S': seed = strtoull(optarg, NULL, 10); break;
+            default:
+                fprintf(stderr, "usage: %s [-n iterations] [-c chunk] [-S seed]\n", argv[0]);
+                return 1;
+        }
+    }
+
+    synth_t *s = new synth_t();
+    synth_init(s, seed);
+    for (int i = 0; i < BENCH_APS; i++) {
+        char name[16];
+        snprintf(name, sizeof(name), "AP%d", i + 1);
+        synth_add_ap(s, name, 4 * cos(2 * M_PI * i / BENCH_APS), 4 * sin(2 * M_PI * i / BENCH_APS), 6, 100);
+    }
+    synth_add_scatterers(s, 12, 0.6, -5, -5, 5, 5);
+    synth_set_position(s, 0.5, 0.5);
+    std::vector<frame_t> frames(1024);
+    for (frame_t &f : frames) {
+        const wifi_csi_info_t *info = synth_next(s);
+        f.info = *info;
+        memcpy(f.buf, info->buf, info->len);
+        f.info.buf = f.buf;
+    }
+    printf("%ld iterations per row, %d APs, %d features (seed %llu)\n", n, BENCH_APS, BENCH_FEATURES,
+           (unsigned long long) seed);
+
+    uint64_t log_bytes = 0;
+    log_start(&log_ring, &count_output, &log_bytes);
+    csi_init((char *) "STA");
+    get_AP(s->aps[0].name);
+
+    bench_header("callback (hal_csi_inject -> _wifi_csi_cb)");
+    data_collected = true;
+    bench_run("stream queue", n, [&](long i) {
+        hal_csi_inject(&frames[i % frames.size()].info);
+    });
+    bench_run("first frame of an AP (csi_buffer)", n, [&](long i) {
+        if (i % BENCH_APS == 0) {
+            csi_buffer_index = 0; // reset_csi_buffer() after an inference
+        }
+        data_collected = false; // As after get_AP
+        hal_csi_inject(&frames[i % frames.size()].info);
+    });
+    log_flush(&log_ring);
+    data_collected = true;
+
+    bench_header("features (csi_complete)");
+    for (int i = 0; i < BENCH_APS; i++) {
+        rssi_chain[i] = frames[i].info.rx_ctrl.rssi;
+    }
+    float features[BENCH_FEATURES];
+    char note[96];
+    bench_run("whole signal", n, [&](long) {
+        csi_complete(0, BENCH_FEATURES, features);
+    });
+    snprintf(note, sizeof(note), "%zu calls per signal", (BENCH_FEATURES + chunk - 1) / chunk);
+    bench_run("in chunks", n, [&](long) {
+        for (size_t offset = 0; offset < BENCH_FEATURES; offset += chunk) {
+            csi_complete(offset, std::min(chunk, BENCH_FEATURES - offset), features + offset);
+        }
+    }, note);
+
+    // The chunks must assemble the same signal, RSSI first in every AP's block
+    float whole[BENCH_FEATURES];
+    csi_complete(0, BENCH_FEATURES, whole);
+    bool ok = memcmp(whole, features, sizeof(whole)) == 0 && csi_complete(1, BENCH_FEATURES, features) == -1;
+    for (int i = 0; i < BENCH_APS; i++) {
+        ok = ok && whole[i * CSI_FEATURES_PER_AP] == (float) rssi_chain[i] &&
+             whole[i * CSI_FEATURES_PER_AP + 1] == (float) csi_buffer[i * CSI_STREAM_LEN];
+    }
+    printf("  layout: %s\n", ok ? "rssi + 128 values per AP, chunks match" : "MISMATCH");
+
+    bench_header("normalization");
+    // Mean and deviation of every feature over the frames, each AP's block from the frames of that AP
+    std::vector<double> sum(BENCH_FEATURES, 0), sum2(BENCH_FEATURES, 0);
+    for (size_t f = 0; f < frames.size(); f++) {
+        size_t base = (f % BENCH_APS) * CSI_FEATURES_PER_AP;
+        for (size_t k = 0; k < CSI_FEATURES_PER_AP; k++) {
+            double x = k == 0 ? frames[f].info.rx_ctrl.rssi : frames[f].buf[k - 1];
+            sum[base + k] += x;
+            sum2[base + k] += x * x;
+        }
+    }
+    float mean[BENCH_FEATURES], inv_scale[BENCH_FEATURES];
+    int32_t mul[BENCH_FEATURES], add[BENCH_FEATURES];
+    double per_ap = (double) frames.size() / BENCH_APS;
+    for (int i = 0; i < BENCH_FEATURES; i++) {
+        mean[i] = (float) (sum[i] / per_ap);
+        float scale = (float) std::max((double) NORM_MIN_SCALE, sqrt(std::max(0.0, sum2[i] / per_ap - mean[i] * mean[i])));
+        inv_scale[i] = 1 / scale;
+        norm_coefficients(mean[i], scale, &mul[i], &add[i]);
+    }
+    norm_table_t table = {BENCH_FEATURES, mul, add};
+
+    std::vector<int64_t> float_ns = bench_samples(n, [&](long) {
+        csi_complete(0, BENCH_FEATURES, features);
+        for (int i = 0; i < BENCH_FEATURES; i++) {
+            features[i] = (features[i] - mean[i]) * inv_scale[i];
+        }
+    });
+    float reference[BENCH_FEATURES];
+    memcpy(reference, features, sizeof(reference));
+    ok = ok && csi_set_normalization(&table);
+    std::vector<int64_t> fused_ns = bench_samples(n, [&](long) {
+        csi_complete(0, BENCH_FEATURES, features);
+    });
+    int16_t q[BENCH_FEATURES];
+    std::vector<int64_t> q_ns = bench_samples(n, [&](long) {
+        csi_complete_q(0, BENCH_FEATURES, q);
+    });
+    double max_error = 0;
+    for (int i = 0; i < BENCH_FEATURES; i++) {
+        max_error = std::max(max_error, (double) fabsf(features[i] - reference[i]));
+        ok = ok && features[i] == q[i] * NORM_Q_TO_FLOAT;
+    }
+    double float_mean = 0, fused_mean = 0;
+    for (size_t i = 0; i < float_ns.size(); i++) {
+        float_mean += (double) float_ns[i] / float_ns.size();
+        fused_mean += (double) fused_ns[i] / fused_ns.size();
+    }
+    bench_report("csi_complete + float pass", float_ns, "");
+    snprintf(note, sizeof(note), "%+.0f ns per signal against the float pass", fused_mean - float_mean);
+    bench_report("csi_complete, fixed point fused", fused_ns, note);
+    bench_report("csi_complete_q (int16)", q_ns, "");
+    bool norm_ok = max_error <= NORM_ERROR_BOUND + 1e-6;
+    printf("  fused vs float: max error %.5f (bound %.5f) %s\n", max_error, NORM_ERROR_BOUND, norm_ok ? "OK" : "FAILED");
+    ok = ok && norm_ok;
+    csi_set_normalization(NULL);
+
+    bench_header("formatting");
+    csi_text_slot_t *slot = &csi_text_slots[0];
+    slot->rssi = frames[0].info.rx_ctrl.rssi;
+    slot->len = frames[0].info.len;
+    memcpy(slot->buf, frames[0].buf, CSI_STREAM_LEN);
+    char line[LOG_LINE_MAX];
+    bench_run("_csi_text_render", n, [&](long) {
+        slot->busy = true;
+        slot->cycle = csi_cycle;
+        _csi_text_render(slot, line, sizeof(line));
+        if (csi_line_count == CSI_MAX_LINES) {
+            csi_cycle_reset();
+        }
+    });
+
+    bench_header("sockets");
+    size_t per_datagram = csi_packet_records_per_mtu(CSI_STREAM_LEN);
+    long queued = 0;
+    std::vector<int64_t> ns;
+    for (long d = 0; d < n / (long) per_datagram; d++) {
+        for (size_t k = 0; k < per_datagram; k++) {
+            hal_csi_inject(&frames[queued++ % frames.size()].info);
+        }
+        int64_t t0 = bench_now_ns();
+        _build_csi_packet();
+        ns.push_back(bench_now_ns() - t0);
+    }
+    snprintf(note, sizeof(note), "%zu records each", per_datagram);
+    bench_report("_build_csi_packet", ns, note);
+
+    csi_deinit();
+    log_stop(&log_ring);
+    delete s;
+    printf("\n%s\n", ok ? "OK" : "FAILED");
+    return ok ? 0 : 1;
+}
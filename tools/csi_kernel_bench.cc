@@ -0,0 +1,203 @@
+/*
+ * Checks the integer kernels of deployments/kernel_component.h against their reference and times them.
+ *
+ *   equivalence  every kernel's _opt path and the dispatched one against _ansi on random vectors: lengths
+ *                0 to 600 at every alignment, values drawn with their extremes overweighted, GEMV biases
+ *                near the int32 limits so the saturation is hit; all must be equal
+ *   timing       each kernel and path on a signal of the sketches (387 values) and a single stream (128),
+ *                next to the float loop the same computation took before
+ *
+ * usage: csi_kernel_bench [-n iterations] [-t trials] [-S seed]
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <limits>
+#include <random>
+#include <vector>
+
+#include "kernel_component.h"
+#include "csi_bench.h"
+
+#define BENCH_MAX_LEN 600
+#define BENCH_ROWS 64 // Outputs of a GEMV, a hidden layer
+
+volatile int64_t bench_sink;
+
+struct rng_t {
+    std::mt19937_64 gen;
+
+    // Uniform in [lo, hi], with the limits themselves one time in eight
+    int64_t value(int64_t lo, int64_t hi) {
+        uint64_t r = gen();
+        if ((r & 7) == 0) {
+            return (r & 8) ? hi : lo;
+        }
+        return lo + (int64_t) ((r >> 4) % (uint64_t) (hi - lo + 1));
+    }
+
+    template<typename T>
+    void fill(T *p, size_t n) {
+        for (size_t i = 0; i < n; i++) {
+            p[i] = (T) value(std::numeric_limits<T>::min(), std::numeric_limits<T>::max());
+        }
+    }
+};
+
+typedef struct {
+    const char *name;
+    uint64_t trials;
+    uint64_t mismatches;
+} check_t;
+
+void check(check_t *c, bool equal) {
+    c->trials++;
+    c->mismatches += !equal;
+}
+
+int main(int argc, char **argv) {
+    long n = 100000;
+    long trials = 20000;
+    uint64_t seed = 1;
+
+    int opt;
+    while ((opt = getopt(argc, argv, "n:t:S:")) != -1) {
+        switch (opt) {
+            case 'n': n = std::max(100L, atol(optarg)); break;
+            case 't': trials = std::max(1L, atol(optarg)); break;
+            case 'S': seed = strtoull(optarg, NULL, 10); break;
+            default:
+                fprintf(stderr, "usage: %s [-n iterations] [-t trials] [-S seed]\n", argv[0]);
+                return 1;
+        }
+    }
+    printf("kernel path %s, %ld trials, %ld iterations per row (seed %llu)\n", KERNEL_PATH, trials, n,
+           (unsigned long long) seed);
+
+    rng_t rng;
+    rng.gen.seed(seed);
+    // Room for every alignment, and a GEMV's rows
+    std::vector<int8_t> a(BENCH_MAX_LEN + 16), b(BENCH_MAX_LEN + 16), w(BENCH_ROWS * BENCH_MAX_LEN + 16);
+    std::vector<int16_t> x(BENCH_MAX_LEN + 16), y(BENCH_MAX_LEN + 16), s_ansi(BENCH_MAX_LEN), s_opt(BENCH_MAX_LEN);
+    std::vector<uint16_t> p_ansi(BENCH_MAX_LEN), p_opt(BENCH_MAX_LEN);
+    std::vector<int32_t> bias(BENCH_ROWS), g_ansi(BENCH_ROWS), g_opt(BENCH_ROWS);
+
+    check_t checks[] = {{"kernel_dot_s8", 0, 0}, {"kernel_dot_s8s16", 0, 0}, {"kernel_l1_s8", 0, 0},
+                        {"kernel_l2_s8", 0, 0}, {"kernel_power_s8", 0, 0}, {"kernel_add_sat_s16", 0, 0},
+                        {"kernel_gemv_s8s16", 0, 0}};
+    for (long t = 0; t < trials; t++) {
+        size_t len = (size_t) rng.value(0, BENCH_MAX_LEN);
+        size_t oa = (size_t) rng.value(0, 15), ob = (size_t) rng.value(0, 15);
+        rng.fill(a.data(), a.size());
+        rng.fill(b.data(), b.size());
+        rng.fill(x.data(), x.size());
+        rng.fill(y.data(), y.size());
+        const int8_t *pa = a.data() + oa, *pb = b.data() + ob;
+        const int16_t *px = x.data() + ob, *py = y.data() + oa;
+
+        int32_t dot = kernel_dot_s8_ansi(pa, pb, len);
+        check(&checks[0], kernel_dot_s8_opt(pa, pb, len) == dot && kernel_dot_s8(pa, pb, len) == dot);
+        int64_t dot16 = kernel_dot_s8s16_ansi(pa, px, len);
+        check(&checks[1], kernel_dot_s8s16_opt(pa, px, len) == dot16 && kernel_dot_s8s16(pa, px, len) == dot16);
+        uint32_t l1 = kernel_l1_s8_ansi(pa, pb, len);
+        check(&checks[2], kernel_l1_s8_opt(pa, pb, len) == l1 && kernel_l1_s8(pa, pb, len) == l1);
+        uint32_t l2 = kernel_l2_s8_ansi(pa, pb, len);
+        check(&checks[3], kernel_l2_s8_opt(pa, pb, len) == l2 && kernel_l2_s8(pa, pb, len) == l2);
+        kernel_power_s8_ansi(pa, p_ansi.data(), len / 2);
+        kernel_power_s8_opt(pa, p_opt.data(), len / 2);
+        check(&checks[4], memcmp(p_ansi.data(), p_opt.data(), len / 2 * sizeof(uint16_t)) == 0);
+        kernel_add_sat_s16_ansi(px, py, s_ansi.data(), len);
+        kernel_add_sat_s16(px, py, s_opt.data(), len);
+        check(&checks[5], memcmp(s_ansi.data(), s_opt.data(), len * sizeof(int16_t)) == 0);
+
+        if (t % 16 == 0) {
+            size_t rows = (size_t) rng.value(1, BENCH_ROWS);
+            rng.fill(w.data(), w.size());
+            for (int32_t &v : bias) {
+                v = (int32_t) rng.value(INT32_MIN, INT32_MAX);
+            }
+            const int8_t *pw = w.data() + oa;
+            for (size_t r = 0; r < rows; r++) {
+                g_ansi[r] = _kernel_sat32((int64_t) bias[r] + kernel_dot_s8s16_ansi(pw + r * len, px, len));
+            }
+            kernel_gemv_s8s16(pw, px, rows, len, bias.data(), g_opt.data());
+            check(&checks[6], memcmp(g_ansi.data(), g_opt.data(), rows * sizeof(int32_t)) == 0);
+        }
+    }
+
+    bool ok = true;
+    printf("\nequivalence (against _ansi)\n");
+    for (const check_t &c : checks) {
+        printf("  %-22s %8llu trials, %llu mismatches %s\n", c.name, (unsigned long long) c.trials,
+               (unsigned long long) c.mismatches, c.mismatches == 0 ? "OK" : "FAILED");
+        ok = ok && c.mismatches == 0;
+    }
+
+    std::vector<float> fa(BENCH_MAX_LEN), fb(BENCH_MAX_LEN), fo(BENCH_MAX_LEN);
+    for (size_t i = 0; i < BENCH_MAX_LEN; i++) {
+        fa[i] = a[i];
+        fb[i] = b[i];
+    }
+    for (size_t len : {(size_t) 387, (size_t) 128}) {
+        char title[64];
+        snprintf(title, sizeof(title), "%zu values", len);
+        bench_header(title);
+        const int8_t *pa = a.data(), *pb = b.data();
+        const int16_t *px = x.data(), *py = y.data();
+        const float *qa = fa.data(), *qb = fb.data();
+        bench_run("float dot", n, [&](long) {
+            float sum = 0;
+            for (size_t i = 0; i < len; i++) {
+                sum += qa[i] * qb[i];
+            }
+            bench_sink = (int64_t) sum;
+        });
+        bench_run("kernel_dot_s8_ansi", n, [&](long) { bench_sink = kernel_dot_s8_ansi(pa, pb, len); });
+        bench_run("kernel_dot_s8_opt", n, [&](long) { bench_sink = kernel_dot_s8_opt(pa, pb, len); });
+        bench_run("kernel_dot_s8s16_ansi", n, [&](long) { bench_sink = kernel_dot_s8s16_ansi(pa, px, len); });
+        bench_run("kernel_dot_s8s16_opt", n, [&](long) { bench_sink = kernel_dot_s8s16_opt(pa, px, len); });
+        bench_run("float L2 distance", n, [&](long) {
+            float sum = 0;
+            for (size_t i = 0; i < len; i++) {
+                sum += (qa[i] - qb[i]) * (qa[i] - qb[i]);
+            }
+            bench_sink = (int64_t) sum;
+        });
+        bench_run("kernel_l1_s8_ansi", n, [&](long) { bench_sink = kernel_l1_s8_ansi(pa, pb, len); });
+        bench_run("kernel_l1_s8_opt", n, [&](long) { bench_sink = kernel_l1_s8_opt(pa, pb, len); });
+        bench_run("kernel_l2_s8_ansi", n, [&](long) { bench_sink = kernel_l2_s8_ansi(pa, pb, len); });
+        bench_run("kernel_l2_s8_opt", n, [&](long) { bench_sink = kernel_l2_s8_opt(pa, pb, len); });
+        bench_run("float amplitude", n, [&](long) {
+            for (size_t i = 0; i < len / 2; i++) {
+                fo[i] = qa[2 * i] * qa[2 * i] + qa[2 * i + 1] * qa[2 * i + 1];
+            }
+            bench_sink = (int64_t) fo[len / 4];
+        });
+        bench_run("kernel_power_s8_ansi", n, [&](long) {
+            kernel_power_s8_ansi(pa, p_ansi.data(), len / 2);
+            bench_sink = p_ansi[len / 4];
+        });
+        bench_run("kernel_power_s8_opt", n, [&](long) {
+            kernel_power_s8_opt(pa, p_opt.data(), len / 2);
+            bench_sink = p_opt[len / 4];
+        });
+        bench_run("kernel_add_sat_s16_ansi", n, [&](long) {
+            kernel_add_sat_s16_ansi(px, py, s_ansi.data(), len);
+            bench_sink = s_ansi[len / 2];
+        });
+        bench_run("kernel_add_sat_s16_opt", n, [&](long) {
+            kernel_add_sat_s16_opt(px, py, s_opt.data(), len);
+            bench_sink = s_opt[len / 2];
+        });
+        char note[64];
+        snprintf(note, sizeof(note), "%d rows", BENCH_ROWS);
+        bench_run("kernel_gemv_s8s16", n / BENCH_ROWS, [&](long) {
+            kernel_gemv_s8s16(w.data(), px, BENCH_ROWS, len, bias.data(), g_opt.data());
+            bench_sink = g_opt[0];
+        }, note);
+    }
+
+    printf("\n%s\n", ok ? "OK" : "FAILED");
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,190 @@
+/*
+ * Load generator for csi_collector: simulates many stations streaming CSI over UDP.
+ *
+ * Every simulated station produces records at a fixed rate and sends them in MTU sized batches,
+ * exactly like the firmware transmitter. Loss and reordering can be injected so the collector's
+ * gap detection can be checked against the totals printed at the end.
+ *
+ * usage: csi_loadgen [-h host] [-p port] [-n stations] [-r records_per_s] [-d duration_s]
+ *                    [-l loss_fraction] [-x reorder_fraction]
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <chrono>
+#include <random>
+#include <thread>
+#include <vector>
+
+#include "csi_packet_component.h"
+
+#define LOADGEN_RECORD_LEN 128
+#define LOADGEN_SEND_BATCH 64 // Datagrams per sendmmsg call
+
+typedef struct {
+    uint16_t device_id;
+    uint32_t seq;
+    uint8_t held[CSI_PACKET_MTU]; // Datagram held back to be sent out of order
+    size_t held_size;
+    int8_t payload[LOADGEN_RECORD_LEN];
+} station_t;
+
+int64_t now_us() {
+    return std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::system_clock::now().time_since_epoch()).count();
+}
+
+int main(int argc, char **argv) {
+    const char *host = "127.0.0.1";
+    int port = 2223;
+    int num_stations = 300;
+    double rate = 100.0;
+    double duration_s = 10.0;
+    double loss = 0.0;
+    double reorder = 0.0;
+
+    int opt;
+    while ((opt = getopt(argc, argv, "h:p:n:r:d:l:x:")) != -1) {
+        switch (opt) {
+            case 'h': host = optarg; break;
+            case 'p': port = atoi(optarg); break;
+            case 'n': num_stations = atoi(optarg); break;
+            case 'r': rate = atof(optarg); break;
+            case 'd': duration_s = atof(optarg); break;
+            case 'l': loss = atof(optarg); break;
+            case 'x': reorder = atof(optarg); break;
+            default:
+                fprintf(stderr, "usage: %s [-h host] [-p port] [-n stations] [-r records_per_s] [-d duration_s] "
+                                "[-l loss_fraction] [-x reorder_fraction]\n", argv[0]);
+                return 1;
+        }
+    }
+
+    int socket_fd = socket(AF_INET, SOCK_DGRAM, 0);
+    struct sockaddr_in caddr;
+    memset(&caddr, 0, sizeof(caddr));
+    caddr.sin_family = AF_INET;
+    caddr.sin_port = htons(port);
+    if (socket_fd == -1 || inet_aton(host, &caddr.sin_addr) == 0 ||
+        connect(socket_fd, (const struct sockaddr *) &caddr, sizeof(caddr)) == -1) {
+        fprintf(stderr, "ERROR: cannot reach %s:%d [%s]\n", host, port, strerror(errno));
+        return 1;
+    }
+
+    std::mt19937 rng(1234);
+    std::uniform_real_distribution<double> coin(0.0, 1.0);
+
+    std::vector<station_t> stations(num_stations);
+    for (int i = 0; i < num_stations; i++) {
+        stations[i].device_id = (uint16_t) (i + 1);
+        stations[i].seq = 0;
+        stations[i].held_size = 0;
+        for (int k = 0; k < LOADGEN_RECORD_LEN; k++) {
+            stations[i].payload[k] = (int8_t) (rng() & 0x3F);
+        }
+    }
+
+    // Each tick every station emits one full datagram worth of records
+    size_t per_packet = csi_packet_records_per_mtu(LOADGEN_RECORD_LEN);
+    double ticks_per_s = rate / per_packet;
+    auto tick = std::chrono::microseconds((int64_t) (1e6 / ticks_per_s));
+
+    std::vector<uint8_t> storage(LOADGEN_SEND_BATCH * CSI_PACKET_MTU);
+    uint8_t *buffers[LOADGEN_SEND_BATCH];
+    for (int i = 0; i < LOADGEN_SEND_BATCH; i++) {
+        buffers[i] = storage.data() + i * CSI_PACKET_MTU;
+    }
+    struct mmsghdr msgs[LOADGEN_SEND_BATCH];
+    struct iovec iovecs[LOADGEN_SEND_BATCH];
+    memset(msgs, 0, sizeof(msgs));
+
+    uint64_t records_made = 0, records_dropped = 0, packets_sent = 0, packets_reordered = 0, send_errors = 0;
+    auto start = std::chrono::steady_clock::now();
+    auto deadline = start + std::chrono::microseconds((int64_t) (duration_s * 1e6));
+    auto next_tick = start;
+
+    while (std::chrono::steady_clock::now() < deadline) {
+        int n = 0;
+        auto flush = [&]() {
+            int sent = 0;
+            while (sent < n) {
+                int r = sendmmsg(socket_fd, msgs + sent, n - sent, 0);
+                if (r <= 0) {
+                    send_errors += n - sent;
+                    break;
+                }
+                sent += r;
+            }
+            packets_sent += sent;
+            n = 0;
+        };
+
+        for (station_t &s : stations) {
+            csi_packet_writer_t writer;
+            csi_packet_begin(&writer, buffers[n], CSI_PACKET_MTU, s.device_id);
+            int64_t t = now_us();
+            for (size_t k = 0; k < per_packet; k++) {
+                csi_record_t r;
+                r.seq = s.seq++;
+                r.timestamp_us = t;
+                r.device_id = s.device_id;
+                r.ap_id = (uint8_t) (k % 3);
+                r.rssi = -50;
+                r.flags = CSI_RECORD_FLAG_RAW;
+                r.len = LOADGEN_RECORD_LEN;
+                r.data = s.payload;
+                records_made++;
+                if (coin(rng) < loss) {
+                    records_dropped++; // Station never sends it, the collector must count a gap
+                    continue;
+                }
+                csi_packet_append(&writer, &r);
+            }
+            size_t size = csi_packet_finish(&writer);
+
+            if (s.held_size == 0 && coin(rng) < reorder) {
+                memcpy(s.held, buffers[n], size); // Hold this one and send it after the next datagram
+                s.held_size = size;
+                packets_reordered++;
+                continue;
+            }
+
+            iovecs[n].iov_base = buffers[n];
+            iovecs[n].iov_len = size;
+            msgs[n].msg_hdr.msg_iov = &iovecs[n];
+            msgs[n].msg_hdr.msg_iovlen = 1;
+            if (++n == LOADGEN_SEND_BATCH) {
+                flush();
+            }
+
+            if (s.held_size > 0) {
+                memcpy(buffers[n], s.held, s.held_size);
+                iovecs[n].iov_base = buffers[n];
+                iovecs[n].iov_len = s.held_size;
+                msgs[n].msg_hdr.msg_iov = &iovecs[n];
+                msgs[n].msg_hdr.msg_iovlen = 1;
+                s.held_size = 0;
+                if (++n == LOADGEN_SEND_BATCH) {
+                    flush();
+                }
+            }
+        }
+        flush();
+
+        next_tick += tick;
+        std::this_thread::sleep_until(next_tick);
+    }
+
+    double elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    printf("stations %d  records %llu (%.0f/s)  dropped %llu  packets %llu (%.0f/s)  reordered %llu  send_errors %llu\n",
+           num_stations, (unsigned long long) records_made, records_made / elapsed,
+           (unsigned long long) records_dropped, (unsigned long long) packets_sent, packets_sent / elapsed,
+           (unsigned long long) packets_reordered, (unsigned long long) send_errors);
+
+    close(socket_fd);
+    return 0;
+}
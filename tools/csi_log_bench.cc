@@ -0,0 +1,281 @@
+/*
+ * Measures what a log call costs the caller with the deferred log ring (log_component.h) against printf,
+ * and checks the ring under concurrent producers.
+ *
+ * The console is a pipe drained at the UART's byte rate (-b baud, 10 bits per byte) with a small pipe
+ * buffer (-k bytes) standing in for the UART driver's TX buffer. The same message is logged -r times per
+ * second for -n messages:
+ *   printf /dev/null    formatting only
+ *   printf console      printf + fflush on the slow console, the way the callbacks used to print
+ *   LOG_I console       queued in the ring, formatted and written by the log task on the slow console
+ * and a compiled-out LOG_D, whose arguments must not even be evaluated.
+ *
+ * The check (-p producers) logs from several threads into a ring drained as fast as possible and parses the
+ * lines back: every message is either written intact and in order per producer or counted as dropped, and
+ * the drop notices add up to the drop counter.
+ *
+ * usage: csi_log_bench [-n messages] [-r rate] [-b baud] [-k pipe_bytes] [-p producers]
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <algorithm>
+#include <chrono>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "log_component.h"
+
+typedef struct {
+    int fd;
+    int baud;
+    std::atomic<uint64_t> bytes;
+} console_t;
+
+// Read the console pipe no faster than the UART would send it
+void console_loop(console_t *c) {
+    char buf[256];
+    double bytes_per_s = c->baud / 10.0;
+    auto start = std::chrono::steady_clock::now();
+    while (true) {
+        ssize_t n = read(c->fd, buf, sizeof(buf));
+        if (n <= 0) {
+            break;
+        }
+        c->bytes += n;
+        std::this_thread::sleep_until(start + std::chrono::microseconds((int64_t) (c->bytes * 1e6 / bytes_per_s)));
+    }
+}
+
+int64_t percentile(std::vector<int64_t> &v, double q) {
+    if (v.empty()) {
+        return 0;
+    }
+    size_t i = (size_t) (q * (v.size() - 1));
+    std::nth_element(v.begin(), v.begin() + i, v.end());
+    return v[i];
+}
+
+void report(const char *name, std::vector<int64_t> &ns, const char *extra) {
+    int64_t sum = 0;
+    for (int64_t v : ns) {
+        sum += v;
+    }
+    printf("%-18s mean %8.0f ns  p50 %8lld ns  p99 %10lld ns  max %10lld ns  %s\n", name,
+           ns.empty() ? 0.0 : (double) sum / ns.size(), (long long) percentile(ns, 0.5),
+           (long long) percentile(ns, 0.99), (long long) percentile(ns, 1.0), extra);
+}
+
+// Call `log` n times at `rate` per second and return the time each call took
+template <typename F>
+std::vector<int64_t> run_paced(int n, double rate, F log) {
+    std::vector<int64_t> ns;
+    ns.reserve(n);
+    auto start = std::chrono::steady_clock::now();
+    for (int i = 0; i < n; i++) {
+        auto t0 = std::chrono::steady_clock::now();
+        log(i);
+        ns.push_back(std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - t0).count());
+        if (rate > 0) {
+            std::this_thread::sleep_until(start + std::chrono::microseconds((int64_t) ((i + 1) * 1e6 / rate)));
+        }
+    }
+    return ns;
+}
+
+// Start draining a new console, returns the end to write to or -1
+int open_console(console_t *c, int baud, int pipe_bytes, std::thread *reader) {
+    int fds[2];
+    if (pipe(fds) == -1) {
+        printf("ERROR: pipe [%s]\n", strerror(errno));
+        return -1;
+    }
+    fcntl(fds[1], F_SETPIPE_SZ, pipe_bytes); // Rounded up to a page
+    c->fd = fds[0];
+    c->baud = baud;
+    c->bytes = 0;
+    *reader = std::thread(console_loop, c);
+    return fds[1];
+}
+
+void fd_output(void *ctx, const char *text, size_t len) {
+    int fd = *(int *) ctx;
+    while (len > 0) {
+        ssize_t n = write(fd, text, len);
+        if (n <= 0) {
+            return;
+        }
+        text += n;
+        len -= n;
+    }
+}
+
+typedef struct {
+    int producers;
+    std::vector<int64_t> next; // Next message number expected from each producer
+    uint64_t lines;
+    uint64_t out_of_order;
+    uint64_t malformed;
+    uint64_t drops_reported;
+} check_t;
+
+void check_output(void *ctx, const char *text, size_t len) {
+    check_t *c = (check_t *) ctx;
+    std::string line(text, len);
+    unsigned long long dropped;
+    int producer;
+    long long n;
+    double value;
+    if (sscanf(line.c_str(), "W (%*d) log: %llu messages dropped", &dropped) == 1) {
+        c->drops_reported += dropped;
+    } else if (sscanf(line.c_str(), "I (%*d) check: producer %d message %lld value %lf", &producer, &n, &value) == 3 &&
+               producer >= 0 && producer < c->producers && value == n * 0.5) {
+        if (n < c->next[producer]) {
+            c->out_of_order++;
+        }
+        c->next[producer] = n + 1;
+        c->lines++;
+    } else {
+        c->malformed++;
+    }
+}
+
+// Several threads log flat out, the task parses what it writes
+bool check(int producers, int n) {
+    log_ring_t *l = new log_ring_t();
+    check_t c;
+    c.producers = producers;
+    c.next.assign(producers, 0);
+    c.lines = c.out_of_order = c.malformed = c.drops_reported = 0;
+    log_start(l, &check_output, &c);
+
+    std::vector<std::thread> threads;
+    for (int p = 0; p < producers; p++) {
+        threads.emplace_back([l, p, n]() {
+            for (int i = 0; i < n; i++) {
+                if (!log_write(l, LOG_LEVEL_INFO, "check", "producer %d message %lld value %.1f", p, (long long) i, i * 0.5)) {
+                    std::this_thread::yield(); // Full, let the task catch up a little
+                }
+            }
+        });
+    }
+    for (auto &t : threads) {
+        t.join();
+    }
+    log_flush(l);
+    log_stop(l);
+
+    log_stats_t stats;
+    log_get_stats(l, &stats);
+    uint64_t total = (uint64_t) producers * n;
+    bool ok = stats.written + stats.dropped == total && stats.emitted == stats.written && c.lines == stats.emitted &&
+              c.out_of_order == 0 && c.malformed == 0 && c.drops_reported == stats.dropped;
+    printf("check: %d producers x %d messages: written %llu  dropped %llu  parsed %llu  out of order %llu  "
+           "malformed %llu  drops reported %llu  %s\n", producers, n, (unsigned long long) stats.written,
+           (unsigned long long) stats.dropped, (unsigned long long) c.lines, (unsigned long long) c.out_of_order,
+           (unsigned long long) c.malformed, (unsigned long long) c.drops_reported, ok ? "OK" : "FAILED");
+    delete l;
+    return ok;
+}
+
+int main(int argc, char **argv) {
+    int messages = 5000;
+    double rate = 1000;
+    int baud = 115200;
+    int pipe_bytes = 4096;
+    int producers = 4;
+
+    int opt;
+    while ((opt = getopt(argc, argv, "n:r:b:k:p:")) != -1) {
+        switch (opt) {
+            case 'n': messages = atoi(optarg); break;
+            case 'r': rate = atof(optarg); break;
+            case 'b': baud = atoi(optarg); break;
+            case 'k': pipe_bytes = atoi(optarg); break;
+            case 'p': producers = atoi(optarg); break;
+            default:
+                fprintf(stderr, "usage: %s [-n messages] [-r rate] [-b baud] [-k pipe_bytes] [-p producers]\n", argv[0]);
+                return 1;
+        }
+    }
+    printf("%d messages at %.0f/s, console %d baud with a %d byte buffer\n", messages, rate, baud, pipe_bytes);
+
+    // The message the transmit loop prints every TX_STATS_EVERY packets
+    const char *format = "rate %.1f/s (target %d), jitter mean %.0f us, stddev %.0f us, max %lld us, skipped %llu\n";
+    char extra[128];
+
+    // What measuring a call costs by itself
+    std::vector<int64_t> ns = run_paced(messages, 0, [](int) {});
+    report("empty call", ns, "");
+
+    FILE *null = fopen("/dev/null", "w");
+    ns = run_paced(messages, rate, [&](int i) {
+        fprintf(null, format, 99.5, 100, 120.0, 35.0, (long long) i, (unsigned long long) i);
+        fflush(null);
+    });
+    fclose(null);
+    report("printf /dev/null", ns, "");
+
+    // printf on the slow console
+    {
+        console_t console;
+        std::thread reader;
+        int fd = open_console(&console, baud, pipe_bytes, &reader);
+        if (fd < 0) {
+            return 1;
+        }
+        FILE *out = fdopen(fd, "w");
+        auto start = std::chrono::steady_clock::now();
+        ns = run_paced(messages, rate, [&](int i) {
+            fprintf(out, format, 99.5, 100, 120.0, 35.0, (long long) i, (unsigned long long) i);
+            fflush(out);
+        });
+        double elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        fclose(out);
+        reader.join();
+        close(console.fd);
+        snprintf(extra, sizeof(extra), "caller ran at %.0f msg/s", messages / elapsed);
+        report("printf console", ns, extra);
+    }
+
+    // LOG_I on the slow console
+    {
+        console_t console;
+        std::thread reader;
+        int fd = open_console(&console, baud, pipe_bytes, &reader);
+        if (fd < 0) {
+            return 1;
+        }
+        log_start(&log_ring, &fd_output, &fd);
+        auto start = std::chrono::steady_clock::now();
+        ns = run_paced(messages, rate, [&](int i) {
+            LOG_I("tx", "rate %.1f/s (target %d), jitter mean %.0f us, stddev %.0f us, max %lld us, skipped %llu", 99.5,
+                  100, 120.0, 35.0, (long long) i, (unsigned long long) i);
+        });
+        double elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        log_stop(&log_ring);
+        close(fd);
+        reader.join();
+        close(console.fd);
+        log_stats_t stats;
+        log_get_stats(&log_ring, &stats);
+        snprintf(extra, sizeof(extra), "caller ran at %.0f msg/s, written %llu, dropped %llu", messages / elapsed,
+                 (unsigned long long) stats.emitted, (unsigned long long) stats.dropped);
+        report("LOG_I console", ns, extra);
+    }
+
+    // Compiled out: the argument has a side effect that must not happen
+    int evaluated = 0;
+    ns = run_paced(messages, 0, [&](int i) {
+        LOG_D("tx", "message %d", evaluated += i + 1);
+        (void) i;
+    });
+    snprintf(extra, sizeof(extra), "arguments evaluated %d times %s", evaluated, evaluated == 0 ? "OK" : "FAILED");
+    report("LOG_D (level 3)", ns, extra);
+
+    bool ok = check(producers, 50000) && evaluated == 0;
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,400 @@
+/*
+ * Receives the metrics snapshots of metrics_component.h and checks and times the registry itself.
+ *
+ *   csi_metrics listen [-p port]
+ *       print every snapshot a station sends (the exporter, METRICS <ip> [port] [interval ms]) with the
+ *       rates since the previous one of the same station: counters per second, histograms of the interval
+ *   csi_metrics bench [-n iterations] [-t threads]
+ *       accuracy    values drawn from a few distributions: each percentile of a histogram must bound the
+ *                   exact one from above by at most 25 %, count, sum and max exact
+ *       export      a snapshot sent by the exporter over loopback UDP and decoded must equal the table, and
+ *                   a counter that wrapped past 2^32 between two snapshots must give the right rate
+ *       timing      ns per recording (batches, so the clock read is amortized) next to a plain increment,
+ *                   threads recording into one counter slot and into a slot each, and the exports
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <algorithm>
+#include <cmath>
+#include <functional>
+#include <map>
+#include <memory>
+#include <random>
+#include <thread>
+#include <vector>
+
+#include "metrics_component.h"
+#include "csi_bench.h"
+
+// A station's previous snapshot, the base of its rates
+typedef struct {
+    bool valid;
+    metrics_snapshot_t snap;
+} metrics_source_t;
+
+const metric_value_t *find_metric(const metrics_snapshot_t *snap, const metric_value_t *m) {
+    for (uint8_t i = 0; i < snap->metric_count; i++) {
+        if (snap->metrics[i].kind == m->kind && strcmp(snap->metrics[i].name, m->name) == 0) {
+            return &snap->metrics[i];
+        }
+    }
+    return NULL;
+}
+
+// Counters and sums since the previous snapshot, modulo 2^32 as the station counts them
+inline uint32_t metric_delta(uint32_t now, uint32_t before) {
+    return now - before;
+}
+
+void print_snapshot(const metrics_snapshot_t *snap, const metrics_snapshot_t *prev, const char *from) {
+    double seconds = prev != NULL ? (snap->uptime_us - prev->uptime_us) / 1e6 : 0;
+    printf("\nsnapshot %u from %s (device %04x), up %.1f s", (unsigned) snap->seq, from, (unsigned) snap->device_id,
+           snap->uptime_us / 1e6);
+    if (prev != NULL) {
+        printf(", rates over %.1f s\n", seconds);
+    } else {
+        printf(", totals since boot\n");
+    }
+    for (uint8_t i = 0; i < snap->metric_count; i++) {
+        const metric_value_t *m = &snap->metrics[i];
+        const metric_value_t *p = prev != NULL ? find_metric(prev, m) : NULL;
+        if (m->kind == METRIC_GAUGE) {
+            printf("  %-22s %12d  max %d\n", m->name, (int) (int32_t) m->values[0], (int) (int32_t) m->values[1]);
+        } else if (m->kind == METRIC_COUNTER) {
+            uint32_t total = 0;
+            for (uint8_t s = 0; s < m->slots; s++) {
+                total += m->values[s];
+            }
+            printf("  %-22s %12u", m->name, (unsigned) total);
+            if (p != NULL) {
+                uint32_t delta = 0;
+                for (uint8_t s = 0; s < m->slots; s++) {
+                    delta += metric_delta(m->values[s], s < p->slots ? p->values[s] : 0);
+                }
+                printf("  %10.1f/s", delta / seconds);
+                for (uint8_t s = 0; m->slots > 1 && s < m->slots; s++) {
+                    printf("  %u:%.1f", (unsigned) s,
+                           metric_delta(m->values[s], s < p->slots ? p->values[s] : 0) / seconds);
+                }
+            }
+            printf("\n");
+        } else {
+            // The interval's own histogram, or the one since boot for the first snapshot
+            uint32_t buckets[METRICS_BUCKETS];
+            uint32_t count = m->values[METRIC_HISTOGRAM_COUNT];
+            uint32_t sum = m->values[METRIC_HISTOGRAM_SUM];
+            uint32_t max = m->values[METRIC_HISTOGRAM_MAX];
+            for (int b = 0; b < METRICS_BUCKETS; b++) {
+                buckets[b] = p != NULL ? metric_delta(m->buckets[b], p->buckets[b]) : m->buckets[b];
+            }
+            if (p != NULL) {
+                count = metric_delta(count, p->values[METRIC_HISTOGRAM_COUNT]);
+                sum = metric_delta(sum, p->values[METRIC_HISTOGRAM_SUM]);
+            }
+            printf("  %-22s %12u", m->name, (unsigned) m->values[METRIC_HISTOGRAM_COUNT]);
+            if (p != NULL) {
+                printf("  %10.1f/s", count / seconds);
+            }
+            printf("  p50 %u p90 %u p99 %u mean %.1f max %u\n",
+                   (unsigned) histogram_percentile(buckets, count, max, 0.5),
+                   (unsigned) histogram_percentile(buckets, count, max, 0.9),
+                   (unsigned) histogram_percentile(buckets, count, max, 0.99),
+                   count > 0 ? (double) sum / count : 0.0, (unsigned) max);
+        }
+    }
+}
+
+int listen_snapshots(int argc, char **argv) {
+    uint16_t port = METRICS_UDP_PORT;
+    int opt;
+    while ((opt = getopt(argc, argv, "p:")) != -1) {
+        switch (opt) {
+            case 'p': port = (uint16_t) atoi(optarg); break;
+            default: return -1;
+        }
+    }
+
+    int fd = socket(PF_INET, SOCK_DGRAM, 0);
+    struct sockaddr_in addr = {};
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(port);
+    addr.sin_addr.s_addr = htonl(INADDR_ANY);
+    if (fd == -1 || bind(fd, (const struct sockaddr *) &addr, sizeof(addr)) == -1) {
+        printf("ERROR: cannot bind UDP %u [%s]\n", port, strerror(errno));
+        return 1;
+    }
+    printf("listening for metrics snapshots on UDP %u\n", port);
+
+    uint8_t buf[METRICS_SNAPSHOT_MAX];
+    std::unique_ptr<metrics_snapshot_t> snap(new metrics_snapshot_t());
+    std::map<uint64_t, std::unique_ptr<metrics_source_t>> sources; // By address and device id
+    while (true) {
+        struct sockaddr_in from;
+        socklen_t from_len = sizeof(from);
+        ssize_t len = recvfrom(fd, buf, sizeof(buf), 0, (struct sockaddr *) &from, &from_len);
+        if (len < 0) {
+            printf("ERROR: recvfrom [%s]\n", strerror(errno));
+            return 1;
+        }
+        if (!metrics_decode(buf, (size_t) len, snap.get())) {
+            printf("ignored a %zd byte datagram from %s that is no snapshot\n", len, inet_ntoa(from.sin_addr));
+            continue;
+        }
+        std::unique_ptr<metrics_source_t> &source =
+                sources[((uint64_t) ntohl(from.sin_addr.s_addr) << 16) | snap->device_id];
+        if (!source) {
+            source.reset(new metrics_source_t());
+        }
+        // A station that rebooted counts from zero again
+        bool rates = source->valid && snap->uptime_us > source->snap.uptime_us;
+        print_snapshot(snap.get(), rates ? &source->snap : NULL, inet_ntoa(from.sin_addr));
+        fflush(stdout);
+        source->snap = *snap;
+        source->valid = true;
+    }
+}
+
+#if CONFIG_METRICS
+
+METRICS_COUNTER(bench_counter, "bench.counter", 4);
+METRICS_COUNTER(bench_threads, "bench.threads", METRICS_MAX_SLOTS);
+METRICS_GAUGE(bench_gauge, "bench.gauge");
+METRICS_HISTOGRAM(bench_histogram, "bench.histogram_us");
+METRICS_HISTOGRAM(bench_scope, "bench.scope_us");
+
+volatile uint32_t bench_plain;
+volatile int64_t bench_sink;
+
+struct distribution_t {
+    const char *name;
+    std::function<uint32_t(std::mt19937 &)> draw;
+};
+
+// The exact values against what the histogram says about them
+bool check_accuracy(std::mt19937 &gen) {
+    std::vector<distribution_t> distributions = {
+            {"constant 37 us", [](std::mt19937 &) { return 37u; }},
+            {"uniform 0-15 us", [](std::mt19937 &g) { return (uint32_t) (g() % 16); }},
+            {"uniform 100-5000 us", [](std::mt19937 &g) { return (uint32_t) (100 + g() % 4901); }},
+            {"lognormal around 2 ms", [](std::mt19937 &g) {
+                return (uint32_t) std::lognormal_distribution<double>(std::log(2000.0), 0.6)(g);
+            }},
+            {"bimodal 40 us / 80 ms", [](std::mt19937 &g) { return g() % 10 == 0 ? 80000u + g() % 1000 : 40u; }},
+            {"near 2^32", [](std::mt19937 &g) { return (uint32_t) (UINT32_MAX - g() % 1000000); }},
+    };
+
+    const int values = 5000;
+    bool ok = true;
+    printf("\naccuracy (%d values each)\n", values);
+    for (const distribution_t &d : distributions) {
+        metrics_reset();
+        std::vector<uint32_t> all;
+        uint32_t sum = 0;
+        for (int i = 0; i < values; i++) {
+            uint32_t v = d.draw(gen);
+            metric_observe(&bench_histogram, v);
+            all.push_back(v);
+            sum += v; // Wraps as the histogram's does
+        }
+        std::sort(all.begin(), all.end());
+        const std::atomic<uint32_t> *v = bench_histogram.values;
+        uint32_t count = v[METRIC_HISTOGRAM_COUNT], max = v[METRIC_HISTOGRAM_MAX];
+        bool good = count == (uint32_t) values && v[METRIC_HISTOGRAM_SUM] == sum && max == all.back();
+        double worst = 0;
+        for (double q : {0.5, 0.9, 0.99}) {
+            uint32_t exact = all[(size_t) std::ceil(q * values) - 1];
+            uint32_t bound = histogram_percentile(v + METRIC_HISTOGRAM_BUCKETS, count, max, q);
+            double over = exact > 0 ? (double) (bound - exact) / exact : bound;
+            worst = std::max(worst, over);
+            good = good && bound >= exact && over <= 0.25;
+        }
+        printf("  %-24s p50 %10u (exact %10u), worst percentile %4.1f %% over %s\n", d.name,
+               (unsigned) histogram_percentile(v + METRIC_HISTOGRAM_BUCKETS, count, max, 0.5),
+               (unsigned) all[values / 2 - 1], 100 * worst, good ? "OK" : "FAILED");
+        ok = ok && good;
+    }
+    return ok;
+}
+
+// A snapshot from the exporter, over loopback
+bool receive_snapshot(int rx, metrics_snapshot_t *snap, size_t *len) {
+    uint8_t buf[METRICS_SNAPSHOT_MAX];
+    ssize_t n = -1;
+    if (metrics_exporter_send(&metrics_exporter)) {
+        n = recv(rx, buf, sizeof(buf), 0);
+    }
+    *len = n > 0 ? (size_t) n : 0;
+    return n > 0 && metrics_decode(buf, (size_t) n, snap);
+}
+
+bool check_export(std::mt19937 &gen) {
+    int rx = socket(PF_INET, SOCK_DGRAM, 0);
+    struct sockaddr_in addr = {};
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    socklen_t addr_len = sizeof(addr);
+    if (rx == -1 || bind(rx, (const struct sockaddr *) &addr, sizeof(addr)) == -1 ||
+        getsockname(rx, (struct sockaddr *) &addr, &addr_len) == -1 ||
+        !metrics_exporter_start(&metrics_exporter, "127.0.0.1", ntohs(addr.sin_port), 1000, 0x0107)) {
+        printf("ERROR: cannot open loopback UDP [%s]\n", strerror(errno));
+        return false;
+    }
+
+    metrics_reset();
+    for (int i = 0; i < 1000; i++) {
+        metric_add(&bench_counter, (uint8_t) (gen() % 3));
+        metric_observe(&bench_histogram, 100 + gen() % 5000);
+        metric_set(&bench_gauge, (int32_t) (gen() % 64) - 8);
+    }
+    std::unique_ptr<metrics_snapshot_t> snap(new metrics_snapshot_t());
+    size_t len;
+    bool ok = receive_snapshot(rx, snap.get(), &len) && snap->device_id == 0x0107 &&
+              snap->metric_count == metrics_count;
+    for (uint8_t i = 0; ok && i < snap->metric_count; i++) {
+        const metric_t *m = metrics_table[i];
+        const metric_value_t *d = &snap->metrics[i];
+        ok = d->kind == m->kind && strcmp(d->name, m->name) == 0;
+        if (m->kind == METRIC_COUNTER) {
+            ok = ok && d->slots == _metrics_used_slots(m);
+            for (uint8_t s = 0; s < m->slots; s++) {
+                ok = ok && (s < d->slots ? d->values[s] : 0) == m->values[s];
+            }
+        } else if (m->kind == METRIC_GAUGE) {
+            ok = ok && d->values[0] == m->values[0] && d->values[1] == m->values[1];
+        } else {
+            for (int v = 0; v < METRIC_HISTOGRAM_BUCKETS; v++) {
+                ok = ok && d->values[v] == m->values[v];
+            }
+            for (int b = 0; b < METRICS_BUCKETS; b++) {
+                ok = ok && d->buckets[b] == m->values[METRIC_HISTOGRAM_BUCKETS + b];
+            }
+        }
+    }
+    printf("\nexport\n  %zu byte snapshot of %u metrics over loopback UDP, decoded %s\n", len,
+           (unsigned) snap->metric_count, ok ? "OK" : "FAILED");
+
+    // A counter about to wrap, then 0x30 more: the collector's difference must still be 0x30
+    bench_counter.values[0] = UINT32_MAX - 0x0F;
+    std::unique_ptr<metrics_snapshot_t> before(new metrics_snapshot_t());
+    bool wrap_ok = receive_snapshot(rx, before.get(), &len);
+    metric_add(&bench_counter, 0, 0x30);
+    wrap_ok = wrap_ok && receive_snapshot(rx, snap.get(), &len) &&
+              metric_delta(snap->metrics[0].values[0], before->metrics[0].values[0]) == 0x30 &&
+              snap->metrics[0].values[0] == 0x20 && snap->seq == before->seq + 1;
+    printf("  counter wrapped from %u to %u between two snapshots, difference %u %s\n",
+           (unsigned) before->metrics[0].values[0], (unsigned) snap->metrics[0].values[0],
+           (unsigned) metric_delta(snap->metrics[0].values[0], before->metrics[0].values[0]),
+           wrap_ok ? "OK" : "FAILED");
+    metrics_print(stdout);
+    metrics_exporter_stop(&metrics_exporter);
+    close(rx);
+    return ok && wrap_ok;
+}
+
+// Mean ns of op(i), run in batches of BENCH_BATCH between two clock reads
+#define BENCH_BATCH 1000
+
+template <typename F>
+double ns_per_op(long n, F op) {
+    int64_t t0 = bench_now_ns();
+    for (long i = 0; i < n; i += BENCH_BATCH) {
+        for (long k = i, end = std::min(n, i + BENCH_BATCH); k < end; k++) {
+            op(k);
+        }
+    }
+    return (double) (bench_now_ns() - t0) / n;
+}
+
+void report(const char *name, double ns, const char *note = "") {
+    printf("  %-40s %8.1f %14.0f  %s\n", name, ns, ns > 0 ? 1e9 / ns : 0, note);
+}
+
+// Every thread adds n times, into slot 0 or into a slot of its own; ns per add as one thread sees it
+double threaded_adds(int threads, long n, bool own_slot) {
+    std::vector<std::thread> workers;
+    std::vector<double> ns(threads);
+    for (int t = 0; t < threads; t++) {
+        workers.emplace_back([&, t] {
+            uint8_t slot = own_slot ? (uint8_t) t : 0;
+            ns[t] = ns_per_op(n, [&](long) { metric_add(&bench_threads, slot); });
+        });
+    }
+    double sum = 0;
+    for (int t = 0; t < threads; t++) {
+        workers[t].join();
+        sum += ns[t];
+    }
+    return sum / threads;
+}
+
+int bench(int argc, char **argv) {
+    long n = 2000000;
+    int threads = (int) std::max(2u, std::min(4u, std::thread::hardware_concurrency()));
+    int opt;
+    while ((opt = getopt(argc, argv, "n:t:")) != -1) {
+        switch (opt) {
+            case 'n': n = std::max((long) BENCH_BATCH, atol(optarg) / BENCH_BATCH * BENCH_BATCH); break;
+            case 't': threads = std::max(1, std::min(METRICS_MAX_SLOTS, atoi(optarg))); break;
+            default: return -1;
+        }
+    }
+
+    std::mt19937 gen(1);
+    bool ok = check_accuracy(gen);
+    ok = check_export(gen) && ok;
+
+    printf("\ntiming, batches of %d\n  %-40s %8s %14s\n", BENCH_BATCH, "", "ns/op", "ops/s");
+    report("plain increment", ns_per_op(n, [](long) { bench_plain = bench_plain + 1; }), "no atomic, the floor");
+    report("metric_add", ns_per_op(n, [](long) { metric_add(&bench_counter); }));
+    report("metric_add, per AP slot", ns_per_op(n, [](long i) { metric_add(&bench_counter, (uint8_t) (i & 3)); }));
+    report("metric_set", ns_per_op(n, [](long i) { metric_set(&bench_gauge, (int32_t) (i & 63)); }),
+           "also tracks the max");
+    report("metric_observe", ns_per_op(n, [](long i) { metric_observe(&bench_histogram, (uint32_t) (i * 37) & 8191); }));
+    report("METRICS_SCOPE", ns_per_op(n / 10, [](long i) {
+        METRICS_SCOPE(bench_scope);
+        bench_sink = i;
+    }), "two clock reads and an observe");
+    char name[64];
+    snprintf(name, sizeof(name), "metric_add, %d threads, one slot", threads);
+    report(name, threaded_adds(threads, n, false), "contended");
+    snprintf(name, sizeof(name), "metric_add, %d threads, a slot each", threads);
+    report(name, threaded_adds(threads, n, true), "slots share cache lines");
+
+    uint8_t buf[METRICS_SNAPSHOT_MAX];
+    FILE *null = fopen("/dev/null", "w");
+    report("metrics_encode", ns_per_op(BENCH_BATCH, [&](long i) { bench_sink = metrics_encode(buf, sizeof(buf), 0, i); }),
+           "one snapshot");
+    report("metrics_print", ns_per_op(BENCH_BATCH, [&](long) { metrics_print(null); }), "every metric, one line each");
+    fclose(null);
+
+    printf("\n%s\n", ok ? "OK" : "FAILED");
+    return ok ? 0 : 1;
+}
+
+#else
+
+int bench(int, char **) {
+    printf("metrics compiled out (CONFIG_METRICS 0), nothing to measure\n");
+    return 0;
+}
+
+#endif
+
+int main(int argc, char **argv) {
+    int rc = -1;
+    if (argc >= 2 && strcmp(argv[1], "listen") == 0) {
+        rc = listen_snapshots(argc - 1, argv + 1);
+    } else if (argc >= 2 && strcmp(argv[1], "bench") == 0) {
+        rc = bench(argc - 1, argv + 1);
+    }
+    if (rc < 0) {
+        fprintf(stderr, "usage: %s listen [-p port]\n"
+                        "       %s bench [-n iterations] [-t threads]\n", argv[0], argv[0]);
+        return 1;
+    }
+    return rc;
+}
@@ -0,0 +1,383 @@
+/*
+ * Trains the location models the deployment sketches run with the native engine (model_component.h),
+ * converts them to its fixed-point weight blob and measures the engine against the float model.
+ *
+ * A sample is one cycle as the sketch assembles it: a frame of every AP (in -a order, by default the
+ * capture's AP table) labeled with the same survey point, standardized with the table csi_norm fits on the
+ * training capture and quantized as csi_complete_q delivers it. The model regresses the point's x and y in
+ * plan units, or with -c classifies the survey points.
+ *
+ *   csi_model fit [-a AP1,AP2,...] [-H hidden] [-c] [-b 8|16] [-e epochs] [-S seed] [-V version]
+ *                 [-o csi_model.csmc] [-x csi_model_container.h] [-t csi_norm_table.h] <train.csi>
+ *       train a linear model (or one hidden ReLU layer of -H units) in float, convert it to -b bit weights
+ *       and write it in the container model_store_component.h loads (with the normalization table its
+ *       inputs need and probes of a few training samples) as model -V (by default the time); -x also
+ *       writes the container as a header for the sketch to build in and -t the normalization table alone
+ *   csi_model bench [fit options] <train.csi> [test.csi]
+ *       train, convert to int8 and int16 and compare the engine with the float model on test.csi (by
+ *       default every 4th sample of train.csi, left out of training): latency per inference, weight and
+ *       working memory, and accuracy against the labels and against the float model. Fails if the engine
+ *       loses more than 0.5% (int16) or 2% (int8) of accuracy
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <math.h>
+#include <time.h>
+#include <map>
+#include <random>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "csi_model.h"
+#include "csi_bench.h"
+
+bool write_container_header(const char *path, const char *capture, const std::vector<uint8_t> &container) {
+    FILE *f = fopen(path, "w");
+    if (f == NULL) {
+        printf("ERROR: cannot create %s [%s]\n", path, strerror(errno));
+        return false;
+    }
+    fprintf(f, "// Generated by csi_model fit from %s, loaded with model_store_component.h\n", capture);
+    fprintf(f, "#ifndef CSI_MODEL_CONTAINER_H\n#define CSI_MODEL_CONTAINER_H\n\n#include <stdint.h>\n\n");
+    fprintf(f, "alignas(%d) const uint8_t csi_model_container[%zu] = {", MODEL_STORE_ALIGN, container.size());
+    for (size_t i = 0; i < container.size(); i++) {
+        fprintf(f, "%s0x%02x,", i % 16 == 0 ? "\n    " : " ", container[i]);
+    }
+    fprintf(f, "\n};\n\n#endif //CSI_MODEL_CONTAINER_H\n");
+    bool ok = fclose(f) == 0;
+    if (!ok) {
+        printf("ERROR: cannot write %s [%s]\n", path, strerror(errno));
+    }
+    return ok;
+}
+
+bool parse_options(int argc, char **argv, options_t *o) {
+    o->classify = false;
+    o->hidden = 0;
+    o->bits = 8;
+    o->epochs = 30;
+    o->seed = 1;
+    o->version = (uint32_t) time(NULL);
+    o->output = "csi_model.csmc";
+    o->container_header = NULL;
+    o->norm_header = NULL;
+    int opt;
+    while ((opt = getopt(argc, argv, "a:H:cb:e:S:V:o:x:t:")) != -1) {
+        switch (opt) {
+            case 'a': norm_parse_aps(optarg, &o->aps); break;
+            case 'H': o->hidden = std::max(0, std::min(MODEL_MAX_WIDTH, atoi(optarg))); break;
+            case 'c': o->classify = true; break;
+            case 'b': o->bits = atoi(optarg) == 16 ? 16 : 8; break;
+            case 'e': o->epochs = std::max(1, atoi(optarg)); break;
+            case 'S': o->seed = strtoull(optarg, NULL, 10); break;
+            case 'V': o->version = (uint32_t) strtoul(optarg, NULL, 10); break;
+            case 'o': o->output = optarg; break;
+            case 'x': o->container_header = optarg; break;
+            case 't': o->norm_header = optarg; break;
+            default: return false;
+        }
+    }
+    return optind < argc;
+}
+
+// Standardization and samples of the training capture, and the model's labels
+bool prepare(const char *capture, options_t *o, norm_fit_t *fit, norm_result_t *norm, points_t *points,
+             std::vector<sample_t> *samples, std::vector<std::string> *labels) {
+    fit->aps = o->aps;
+    fit->robust = false;
+    if (!norm_fit_capture(capture, fit, norm)) {
+        return false;
+    }
+    o->aps = fit->aps;
+    if (o->aps.size() > 16 || norm->table.features > MODEL_MAX_WIDTH) {
+        printf("ERROR: %zu APs, the engine takes at most %d inputs\n", o->aps.size(), MODEL_MAX_WIDTH);
+        return false;
+    }
+    if (!load_samples(capture, o->aps, &norm->table, points, true, samples)) {
+        return false;
+    }
+    if (samples->size() < 8) {
+        printf("ERROR: %s has %zu labeled samples with a frame of every AP\n", capture, samples->size());
+        return false;
+    }
+    if (o->classify && points->size() > MODEL_MAX_OUTPUTS) {
+        printf("ERROR: %zu survey points, the engine has at most %d outputs\n", points->size(), MODEL_MAX_OUTPUTS);
+        return false;
+    }
+
+    labels->clear();
+    if (o->classify) {
+        labels->resize(points->size());
+        for (auto &p : *points) {
+            char name[MODEL_LABEL_LEN];
+            snprintf(name, sizeof(name), "%d,%d", p.first.first, p.first.second);
+            (*labels)[p.second] = name;
+        }
+    } else {
+        *labels = {"x", "y"};
+    }
+    return true;
+}
+
+int fit(int argc, char **argv) {
+    options_t o;
+    if (!parse_options(argc, argv, &o) || optind != argc - 1) {
+        return -1;
+    }
+    const char *capture = argv[optind];
+    norm_fit_t norm_fit;
+    norm_result_t norm;
+    points_t points;
+    std::vector<sample_t> samples;
+    std::vector<std::string> labels;
+    if (!prepare(capture, &o, &norm_fit, &norm, &points, &samples, &labels)) {
+        return 1;
+    }
+
+    std::vector<const sample_t *> all;
+    for (const sample_t &s : samples) {
+        all.push_back(&s);
+    }
+    mlp_t mlp;
+    train(&mlp, all, &o, (int) labels.size());
+    std::vector<uint8_t> blob = convert(&mlp, o.bits, o.classify, labels, all);
+    model_t *model = new model_t();
+    bool ok = model_load(model, blob.data(), blob.size());
+
+    double error = 0;
+    model_result_t result;
+    for (const sample_t &s : samples) {
+        model_run(model, s.q.data(), &result);
+        if (o.classify) {
+            int best = 0;
+            for (int k = 1; k < result.count; k++) {
+                best = result.classification[k].value > result.classification[best].value ? k : best;
+            }
+            error += best != s.point;
+        } else {
+            error += hypot(result.classification[0].value - s.target[0], result.classification[1].value - s.target[1]);
+        }
+    }
+    printf("%s: %zu samples of %zu APs, %zu points, %u inputs\n", capture, samples.size(), o.aps.size(), points.size(),
+           (unsigned) norm.table.features);
+    printf("%s model, %d bit weights, %zu byte blob: training %s %.3f\n", o.hidden > 0 ? "MLP" : "linear", o.bits,
+           blob.size(), o.classify ? "error rate" : "mean error (plan units)", error / samples.size());
+    delete model;
+
+    // Probes spread over the capture, and the container checked the way the sketch loads it
+    std::vector<const sample_t *> probes;
+    for (size_t i = 0; i < FIT_PROBES; i++) {
+        probes.push_back(all[i * all.size() / FIT_PROBES]);
+    }
+    std::vector<uint8_t> container = pack(MODEL_STORE_SECTION_MODEL, blob, &norm.table, probes, o.version);
+    model_store_t *store = new model_store_t();
+    model_store_init(store, NULL);
+    ok = model_store_stage_memory(store, container.data(), container.size(), o.output) && ok;
+    delete store;
+    printf("model version %u, %zu byte container with %zu probes\n", (unsigned) o.version, container.size(),
+           probes.size());
+
+    FILE *f = fopen(o.output, "wb");
+    if (f == NULL || fwrite(container.data(), 1, container.size(), f) != container.size() || fclose(f) != 0) {
+        printf("ERROR: cannot write %s [%s]\n", o.output, strerror(errno));
+        return 1;
+    }
+    printf("wrote %s\n", o.output);
+    if (o.container_header != NULL) {
+        ok = write_container_header(o.container_header, capture, container) && ok;
+        printf("wrote %s\n", o.container_header);
+    }
+    if (o.norm_header != NULL) {
+        ok = norm_write_header(o.norm_header, capture, &norm_fit, &norm) && ok;
+        printf("wrote %s\n", o.norm_header);
+    }
+    return ok ? 0 : 1;
+}
+
+typedef struct {
+    const char *name;
+    std::vector<int64_t> ns;
+    double error; // Against the labels: mean distance, or error rate
+    double deviation; // Against the float model: mean distance, or disagreement rate
+    double max_deviation;
+    size_t weight_bytes;
+    size_t working_bytes;
+} variant_t;
+
+int bench(int argc, char **argv) {
+    options_t o;
+    if (!parse_options(argc, argv, &o) || argc - optind > 2) {
+        return -1;
+    }
+    const char *capture = argv[optind];
+    const char *test_capture = optind + 1 < argc ? argv[optind + 1] : NULL;
+    norm_fit_t norm_fit;
+    norm_result_t norm;
+    points_t points;
+    std::vector<sample_t> samples, test_samples;
+    std::vector<std::string> labels;
+    if (!prepare(capture, &o, &norm_fit, &norm, &points, &samples, &labels)) {
+        return 1;
+    }
+
+    std::vector<const sample_t *> train_set, test_set;
+    if (test_capture != NULL) {
+        if (!load_samples(test_capture, o.aps, &norm.table, &points, false, &test_samples)) {
+            return 1;
+        }
+        for (const sample_t &s : samples) {
+            train_set.push_back(&s);
+        }
+        for (const sample_t &s : test_samples) {
+            test_set.push_back(&s);
+        }
+    } else {
+        for (size_t i = 0; i < samples.size(); i++) {
+            (i % 4 == 3 ? test_set : train_set).push_back(&samples[i]);
+        }
+    }
+    if (test_set.empty()) {
+        printf("ERROR: no test samples\n");
+        return 1;
+    }
+
+    int64_t start = bench_now_ns();
+    mlp_t mlp;
+    train(&mlp, train_set, &o, (int) labels.size());
+    printf("%s: %zu training and %zu test samples of %zu APs, %zu points, %u inputs; %s trained in %.1f s\n",
+           capture, train_set.size(), test_set.size(), o.aps.size(), points.size(), (unsigned) norm.table.features,
+           o.hidden > 0 ? "MLP" : "linear model", (bench_now_ns() - start) / 1e9);
+
+    // Float reference on every test sample
+    size_t params = 0, widest = 0;
+    for (size_t l = 0; l < mlp.w.size(); l++) {
+        params += mlp.w[l].size() + mlp.b[l].size();
+        widest += mlp.sizes[l + 1];
+    }
+    std::vector<std::vector<float>> inputs, reference;
+    for (const sample_t *s : test_set) {
+        inputs.push_back(sample_input(s));
+    }
+    variant_t fl = {"float", {}, 0, 0, 0, params * sizeof(float), (mlp.sizes[0] + widest) * sizeof(float)};
+    std::vector<std::vector<float>> acts;
+    auto best_of = [](const float *v, int n) {
+        return (int) (std::max_element(v, v + n) - v);
+    };
+    for (size_t i = 0; i < test_set.size(); i++) {
+        int64_t t0 = bench_now_ns();
+        mlp_forward(&mlp, inputs[i].data(), &acts);
+        fl.ns.push_back(bench_now_ns() - t0);
+        const std::vector<float> &y = acts.back();
+        reference.push_back(y);
+        if (o.classify) {
+            fl.error += best_of(y.data(), (int) y.size()) != test_set[i]->point;
+        } else {
+            fl.error += hypot(y[0] - test_set[i]->target[0], y[1] - test_set[i]->target[1]);
+        }
+    }
+    fl.error /= test_set.size();
+
+    std::vector<variant_t> variants = {fl};
+    bool ok = true;
+    for (int bits : {16, 8}) {
+        std::vector<uint8_t> blob = convert(&mlp, bits, o.classify, labels, train_set);
+        model_t *model = new model_t();
+        if (!model_load(model, blob.data(), blob.size())) {
+            delete model;
+            return 1;
+        }
+        variant_t v = {bits == 16 ? "int16 engine" : "int8 engine", {}, 0, 0, 0, blob.size(), sizeof(model_t)};
+        model_result_t result;
+        float y[MODEL_MAX_OUTPUTS];
+        for (size_t i = 0; i < test_set.size(); i++) {
+            int64_t t0 = bench_now_ns();
+            model_run(model, test_set[i]->q.data(), &result);
+            v.ns.push_back(bench_now_ns() - t0);
+            for (int k = 0; k < result.count; k++) {
+                y[k] = result.classification[k].value;
+            }
+            const std::vector<float> &r = reference[i];
+            if (o.classify) {
+                int best = best_of(y, result.count);
+                v.error += best != test_set[i]->point;
+                v.deviation += best != best_of(r.data(), (int) r.size());
+            } else {
+                v.error += hypot(y[0] - test_set[i]->target[0], y[1] - test_set[i]->target[1]);
+                double d = hypot(y[0] - r[0], y[1] - r[1]);
+                v.deviation += d;
+                v.max_deviation = std::max(v.max_deviation, d);
+            }
+        }
+        v.error /= test_set.size();
+        v.deviation /= test_set.size();
+        variants.push_back(v);
+        delete model;
+    }
+
+    bench_header("latency per inference");
+    for (variant_t &v : variants) {
+        bench_report(v.name, v.ns, "");
+    }
+    printf("\nmemory                              weights B   working B\n");
+    for (const variant_t &v : variants) {
+        printf("  %-32s %10zu %11zu\n", v.name, v.weight_bytes, v.working_bytes);
+    }
+
+    // The engine may lose at most 0.5% (int16) or 2% (int8) of accuracy against the labels: error rate, or
+    // mean distance as a share of the test points' spread. Near ties of an unsure classifier may flip.
+    double spread = 0;
+    if (!o.classify) {
+        for (int k = 0; k < 2; k++) {
+            double sum = 0, sum2 = 0;
+            for (const sample_t *s : test_set) {
+                sum += s->target[k];
+                sum2 += (double) s->target[k] * s->target[k];
+            }
+            double mean = sum / test_set.size();
+            spread += std::max(0.0, sum2 / test_set.size() - mean * mean);
+        }
+        spread = std::max(1.0, sqrt(spread));
+    }
+    printf("\naccuracy on %zu test samples\n", test_set.size());
+    for (size_t i = 0; i < variants.size(); i++) {
+        const variant_t &v = variants[i];
+        if (o.classify) {
+            printf("  %-32s error rate %6.3f", v.name, v.error);
+            if (i > 0) {
+                bool kept = v.error - fl.error <= (i == 1 ? 0.005 : 0.02);
+                printf("   disagrees with float on %5.2f%% %s", 100 * v.deviation, kept ? "OK" : "FAILED");
+                ok = ok && kept;
+            }
+        } else {
+            printf("  %-32s mean error %7.3f", v.name, v.error);
+            if (i > 0) {
+                bool kept = v.error - fl.error <= (i == 1 ? 0.005 : 0.02) * spread;
+                printf("   from float: mean %6.3f, max %6.3f (%.1f%% of the %.1f spread) %s", v.deviation,
+                       v.max_deviation, 100 * v.deviation / spread, spread, kept ? "OK" : "FAILED");
+                ok = ok && kept;
+            }
+        }
+        printf("\n");
+    }
+    printf("\n%s\n", ok ? "OK" : "FAILED");
+    return ok ? 0 : 1;
+}
+
+int main(int argc, char **argv) {
+    int rc = -1;
+    if (argc >= 2 && strcmp(argv[1], "fit") == 0) {
+        rc = fit(argc - 1, argv + 1);
+    } else if (argc >= 2 && strcmp(argv[1], "bench") == 0) {
+        rc = bench(argc - 1, argv + 1);
+    }
+    if (rc < 0) {
+        fprintf(stderr, "usage: %s fit [-a AP1,AP2,...] [-H hidden] [-c] [-b 8|16] [-e epochs] [-S seed] [-V version] "
+                        "[-o csi_model.csmc] [-x csi_model_container.h] [-t csi_norm_table.h] <train.csi>\n"
+                        "       %s bench [fit options] <train.csi> [test.csi]\n", argv[0], argv[0]);
+        return 1;
+    }
+    return rc;
+}
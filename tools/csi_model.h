@@ -0,0 +1,418 @@
+#ifndef CSI_TOOLS_MODEL_H
+#define CSI_TOOLS_MODEL_H
+
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+#include <algorithm>
+#include <map>
+#include <random>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "csi_norm.h"
+#include "model_store_component.h"
+
+/*
+ * Training the location models of the native engine (model_component.h) on a labeled capture and packing
+ * them into model_store_component.h containers, shared by csi_model and csi_cascade.
+ *
+ * A sample is one cycle as the sketch assembles it: a frame of every AP labeled with the same survey point,
+ * standardized with a csi_norm table and quantized as csi_complete_q delivers it.
+ */
+
+typedef struct {
+    std::vector<int16_t> q; // Inputs as csi_complete_q delivers them
+    float target[2]; // x, y of the survey point
+    int point; // Class, index into the points of the training capture
+} sample_t;
+
+typedef struct {
+    std::vector<std::string> aps;
+    bool classify;
+    int hidden;
+    int bits;
+    int epochs;
+    uint64_t seed;
+    uint32_t version;
+    const char *output;
+    const char *container_header;
+    const char *norm_header;
+} options_t;
+
+typedef struct {
+    std::vector<int> sizes; // Inputs, then the outputs of every layer
+    std::vector<std::vector<float>> w; // Per layer, row per output
+    std::vector<std::vector<float>> b;
+} mlp_t;
+
+typedef std::map<std::pair<int, int>, int> points_t; // Survey point (x, y) -> class
+
+#define FIT_PROBES 4 // Samples the container carries to check the model where it is loaded
+
+// Samples of a capture: a labeled frame of every AP, all with the same point and round
+inline bool load_samples(const char *path, std::vector<std::string> &aps, const norm_table_t *table,
+                         points_t *points, bool add_points, std::vector<sample_t> *samples) {
+    std::vector<int16_t> current(table->features, 0);
+    uint32_t have = 0;
+    uint32_t full = (uint32_t) ((1ull << aps.size()) - 1);
+    int label_point = -1, label_round = -1;
+    uint64_t skipped = 0;
+    return norm_for_each_record(path, aps, &skipped, [&](size_t block, const csi_record_t *r) {
+        if (!(r->flags & CSI_RECORD_FLAG_LABELED)) {
+            have = 0; // Walking between points
+            return;
+        }
+        if (r->point != label_point || r->round != label_round) {
+            have = 0;
+            label_point = r->point;
+            label_round = r->round;
+        }
+        for (size_t k = 0; k < NORM_FEATURES_PER_AP; k++) {
+            size_t i = block * NORM_FEATURES_PER_AP + k;
+            current[i] = norm_apply(table, i, norm_record_feature(r, k));
+        }
+        have |= 1u << block;
+        if (have != full) {
+            return;
+        }
+        have = 0;
+
+        std::pair<int, int> xy(r->x, r->y);
+        auto it = points->find(xy);
+        if (it == points->end()) {
+            if (!add_points) {
+                return; // A point the classifier was not trained on
+            }
+            it = points->emplace(xy, (int) points->size()).first;
+        }
+        sample_t s;
+        s.q = current;
+        s.target[0] = r->x;
+        s.target[1] = r->y;
+        s.point = it->second;
+        samples->push_back(s);
+    });
+}
+
+// Outputs of every layer for input `x`, ReLU on all but the last
+inline void mlp_forward(const mlp_t *m, const float *x, std::vector<std::vector<float>> *acts) {
+    acts->resize(m->w.size());
+    const float *in = x;
+    for (size_t l = 0; l < m->w.size(); l++) {
+        int n = m->sizes[l], outputs = m->sizes[l + 1];
+        std::vector<float> &out = (*acts)[l];
+        out.resize(outputs);
+        for (int o = 0; o < outputs; o++) {
+            const float *w = &m->w[l][(size_t) o * n];
+            float sum = m->b[l][o];
+            for (int i = 0; i < n; i++) {
+                sum += w[i] * in[i];
+            }
+            out[o] = l + 1 < m->w.size() ? std::max(0.0f, sum) : sum;
+        }
+        in = out.data();
+    }
+}
+
+inline std::vector<float> sample_input(const sample_t *s) {
+    std::vector<float> x(s->q.size());
+    for (size_t i = 0; i < x.size(); i++) {
+        x[i] = s->q[i] * NORM_Q_TO_FLOAT;
+    }
+    return x;
+}
+
+// Mini-batch Adam on mean squared error (regression, targets standardized while training) or softmax cross
+// entropy (classification)
+inline void train(mlp_t *m, const std::vector<const sample_t *> &samples, const options_t *o, int outputs) {
+    std::mt19937_64 rng(o->seed);
+    m->sizes = {(int) samples[0]->q.size()};
+    if (o->hidden > 0) {
+        m->sizes.push_back(o->hidden);
+    }
+    m->sizes.push_back(outputs);
+    size_t layers = m->sizes.size() - 1;
+    m->w.resize(layers);
+    m->b.resize(layers);
+    for (size_t l = 0; l < layers; l++) {
+        std::normal_distribution<float> init(0, sqrtf(2.0f / m->sizes[l]));
+        m->w[l].resize((size_t) m->sizes[l] * m->sizes[l + 1]);
+        for (float &w : m->w[l]) {
+            w = init(rng);
+        }
+        m->b[l].assign(m->sizes[l + 1], 0);
+    }
+
+    float target_mean[2] = {0, 0}, target_scale[2] = {1, 1};
+    if (!o->classify) {
+        for (int k = 0; k < 2; k++) {
+            double sum = 0, sum2 = 0;
+            for (const sample_t *s : samples) {
+                sum += s->target[k];
+                sum2 += (double) s->target[k] * s->target[k];
+            }
+            target_mean[k] = (float) (sum / samples.size());
+            target_scale[k] = (float) std::max(1e-3, sqrt(std::max(0.0, sum2 / samples.size() - target_mean[k] * target_mean[k])));
+        }
+    }
+
+    std::vector<std::vector<float>> inputs;
+    for (const sample_t *s : samples) {
+        inputs.push_back(sample_input(s));
+    }
+    std::vector<std::vector<float>> gw(layers), gb(layers), mw(layers), vw(layers), mb(layers), vb(layers);
+    for (size_t l = 0; l < layers; l++) {
+        gw[l].assign(m->w[l].size(), 0);
+        mw[l].assign(m->w[l].size(), 0);
+        vw[l].assign(m->w[l].size(), 0);
+        gb[l].assign(m->b[l].size(), 0);
+        mb[l].assign(m->b[l].size(), 0);
+        vb[l].assign(m->b[l].size(), 0);
+    }
+
+    const size_t batch = 32;
+    const float rate = 1e-3f, beta1 = 0.9f, beta2 = 0.999f, decay = 1e-4f;
+    std::vector<size_t> order(samples.size());
+    for (size_t i = 0; i < order.size(); i++) {
+        order[i] = i;
+    }
+    std::vector<std::vector<float>> acts;
+    std::vector<float> delta, prev_delta;
+    int step = 0;
+    for (int epoch = 0; epoch < o->epochs; epoch++) {
+        std::shuffle(order.begin(), order.end(), rng);
+        for (size_t start = 0; start < order.size(); start += batch) {
+            size_t end = std::min(order.size(), start + batch);
+            for (size_t l = 0; l < layers; l++) {
+                std::fill(gw[l].begin(), gw[l].end(), 0.0f);
+                std::fill(gb[l].begin(), gb[l].end(), 0.0f);
+            }
+            for (size_t j = start; j < end; j++) {
+                const sample_t *s = samples[order[j]];
+                const std::vector<float> &x = inputs[order[j]];
+                mlp_forward(m, x.data(), &acts);
+                std::vector<float> &y = acts[layers - 1];
+                delta.assign(outputs, 0);
+                if (o->classify) {
+                    float max = *std::max_element(y.begin(), y.end()), sum = 0;
+                    for (int k = 0; k < outputs; k++) {
+                        delta[k] = expf(y[k] - max);
+                        sum += delta[k];
+                    }
+                    for (int k = 0; k < outputs; k++) {
+                        delta[k] = delta[k] / sum - (k == s->point ? 1.0f : 0.0f);
+                    }
+                } else {
+                    for (int k = 0; k < outputs; k++) {
+                        delta[k] = y[k] - (s->target[k] - target_mean[k]) / target_scale[k];
+                    }
+                }
+                for (size_t l = layers; l-- > 0;) {
+                    const float *in = l == 0 ? x.data() : acts[l - 1].data();
+                    int n = m->sizes[l];
+                    prev_delta.assign(n, 0);
+                    for (int k = 0; k < m->sizes[l + 1]; k++) {
+                        float *g = &gw[l][(size_t) k * n];
+                        const float *w = &m->w[l][(size_t) k * n];
+                        for (int i = 0; i < n; i++) {
+                            g[i] += delta[k] * in[i];
+                            prev_delta[i] += delta[k] * w[i];
+                        }
+                        gb[l][k] += delta[k];
+                    }
+                    if (l > 0) {
+                        for (int i = 0; i < n; i++) {
+                            prev_delta[i] = acts[l - 1][i] > 0 ? prev_delta[i] : 0; // ReLU
+                        }
+                        delta.swap(prev_delta);
+                    }
+                }
+            }
+
+            step++;
+            float scale = 1.0f / (end - start);
+            float correction1 = 1 - powf(beta1, step), correction2 = 1 - powf(beta2, step);
+            auto adam = [&](std::vector<float> &p, std::vector<float> &g, std::vector<float> &mom, std::vector<float> &var,
+                            float weight_decay) {
+                for (size_t i = 0; i < p.size(); i++) {
+                    float grad = g[i] * scale + weight_decay * p[i];
+                    mom[i] = beta1 * mom[i] + (1 - beta1) * grad;
+                    var[i] = beta2 * var[i] + (1 - beta2) * grad * grad;
+                    p[i] -= rate * (mom[i] / correction1) / (sqrtf(var[i] / correction2) + 1e-8f);
+                }
+            };
+            for (size_t l = 0; l < layers; l++) {
+                adam(m->w[l], gw[l], mw[l], vw[l], decay);
+                adam(m->b[l], gb[l], mb[l], vb[l], 0);
+            }
+        }
+    }
+
+    if (!o->classify) {
+        // Fold the target standardization into the last layer, the model outputs plan units
+        std::vector<float> &w = m->w[layers - 1];
+        int n = m->sizes[layers - 1];
+        for (int k = 0; k < outputs; k++) {
+            for (int i = 0; i < n; i++) {
+                w[(size_t) k * n + i] *= target_scale[k];
+            }
+            m->b[layers - 1][k] = m->b[layers - 1][k] * target_scale[k] + target_mean[k];
+        }
+    }
+}
+
+// Largest number of fraction bits that keeps `max` below `limit`
+inline int frac_bits(double max, double limit, int lo, int hi) {
+    if (max <= 0) {
+        return hi;
+    }
+    return std::max(lo, std::min(hi, (int) floor(log2(limit / max))));
+}
+
+// The model in the engine's blob format with `bits` bit weights. Fraction bits of every layer's outputs come
+// from the largest value it produces on `calibration`, with 25% headroom.
+inline std::vector<uint8_t> convert(const mlp_t *m, int bits, bool classify, const std::vector<std::string> &labels,
+                                    const std::vector<const sample_t *> &calibration) {
+    size_t layers = m->w.size();
+    std::vector<double> max_out(layers, 0);
+    std::vector<std::vector<float>> acts;
+    for (const sample_t *s : calibration) {
+        std::vector<float> x = sample_input(s);
+        mlp_forward(m, x.data(), &acts);
+        for (size_t l = 0; l < layers; l++) {
+            for (float v : acts[l]) {
+                max_out[l] = std::max(max_out[l], (double) fabsf(v));
+            }
+        }
+    }
+
+    int outputs = m->sizes[layers];
+    std::vector<uint8_t> blob(MODEL_HEADER_SIZE + MODEL_LABEL_LEN * outputs, 0);
+    _csi_put_u32(&blob[0], MODEL_MAGIC);
+    _csi_put_u16(&blob[4], MODEL_VERSION);
+    _csi_put_u16(&blob[6], (uint16_t) layers);
+    _csi_put_u16(&blob[8], (uint16_t) m->sizes[0]);
+    _csi_put_u16(&blob[10], (uint16_t) outputs);
+    blob[12] = NORM_FRAC_BITS;
+    blob[13] = classify ? MODEL_OUTPUT_SOFTMAX : MODEL_OUTPUT_REGRESSION;
+    for (int k = 0; k < outputs; k++) {
+        strncpy((char *) &blob[MODEL_HEADER_SIZE + MODEL_LABEL_LEN * k], labels[k].c_str(), MODEL_LABEL_LEN - 1);
+    }
+
+    int in_frac = NORM_FRAC_BITS;
+    int qmax = bits == 8 ? INT8_MAX : INT16_MAX;
+    for (size_t l = 0; l < layers; l++) {
+        int n = m->sizes[l], count = m->sizes[l + 1];
+        double w_max = 0, b_max = 0;
+        for (float w : m->w[l]) {
+            w_max = std::max(w_max, (double) fabsf(w));
+        }
+        for (float b : m->b[l]) {
+            b_max = std::max(b_max, (double) fabsf(b));
+        }
+        int out_frac = frac_bits(1.25 * max_out[l], INT16_MAX, 0, 15);
+        int w_frac = frac_bits(w_max, qmax, 0, 40);
+        w_frac = std::min(w_frac, frac_bits(b_max, 1 << 30, 0, 40) - in_frac); // Bias fits the accumulator
+        w_frac = std::max(w_frac, 0);
+        out_frac = std::min(out_frac, in_frac + w_frac);
+
+        size_t offset = blob.size();
+        size_t weight_bytes = ((size_t) n * count * (bits / 8) + 3) & ~(size_t) 3;
+        blob.resize(offset + MODEL_LAYER_HEADER_SIZE + 4 * count + weight_bytes, 0);
+        uint8_t *p = &blob[offset];
+        _csi_put_u16(p, (uint16_t) n);
+        _csi_put_u16(p + 2, (uint16_t) count);
+        p[4] = (uint8_t) bits;
+        p[5] = l + 1 < layers ? MODEL_ACTIVATION_RELU : MODEL_ACTIVATION_NONE;
+        p[6] = (uint8_t) (in_frac + w_frac - out_frac);
+        p[7] = (uint8_t) out_frac;
+        for (int k = 0; k < count; k++) {
+            double b = ldexp(m->b[l][k], in_frac + w_frac);
+            _csi_put_u32(p + MODEL_LAYER_HEADER_SIZE + 4 * k, (uint32_t) (int32_t) std::max(-2147483648.0, std::min(2147483647.0, round(b))));
+        }
+        uint8_t *weights = p + MODEL_LAYER_HEADER_SIZE + 4 * count;
+        for (size_t i = 0; i < m->w[l].size(); i++) {
+            long q = lround(ldexp(m->w[l][i], w_frac));
+            q = std::max((long) -qmax, std::min((long) qmax, q));
+            if (bits == 8) {
+                weights[i] = (uint8_t) (int8_t) q;
+            } else {
+                _csi_put_u16(weights + 2 * i, (uint16_t) (int16_t) q);
+            }
+        }
+        in_frac = out_frac;
+    }
+
+    blob.resize(blob.size() + 4);
+    _csi_put_u32(&blob[blob.size() - 4], capture_crc32(0, blob.data(), blob.size() - 4));
+    return blob;
+}
+
+// Append a section to the container, at the next multiple of MODEL_STORE_ALIGN
+inline void pack_section(std::vector<uint8_t> *c, int index, uint16_t type, const std::vector<uint8_t> &data) {
+    size_t offset = (c->size() + MODEL_STORE_ALIGN - 1) & ~(size_t) (MODEL_STORE_ALIGN - 1);
+    uint8_t *entry = &(*c)[MODEL_STORE_HEADER_SIZE + index * MODEL_STORE_SECTION_SIZE];
+    _csi_put_u16(entry, type);
+    _csi_put_u32(entry + 4, (uint32_t) offset);
+    _csi_put_u32(entry + 8, (uint32_t) data.size());
+    c->resize(offset);
+    c->insert(c->end(), data.begin(), data.end());
+}
+
+// The model_store_component.h container of a blob (MODEL_STORE_SECTION_MODEL or _KNN): the blob, the
+// normalization table of its inputs and the outputs the blob gives on `probes`
+inline std::vector<uint8_t> pack(uint16_t type, const std::vector<uint8_t> &blob, const norm_table_t *norm,
+                                 const std::vector<const sample_t *> &probes, uint32_t version) {
+    std::vector<uint8_t> c(MODEL_STORE_HEADER_SIZE + 3 * MODEL_STORE_SECTION_SIZE, 0);
+    pack_section(&c, 0, type, blob);
+
+    std::vector<uint8_t> table(4 + 8 * (size_t) norm->features, 0);
+    _csi_put_u16(&table[0], norm->features);
+    for (size_t i = 0; i < norm->features; i++) {
+        _csi_put_u32(&table[4 + 4 * i], (uint32_t) norm->mul[i]);
+        _csi_put_u32(&table[4 + 4 * (norm->features + i)], (uint32_t) norm->add[i]);
+    }
+    pack_section(&c, 1, MODEL_STORE_SECTION_NORM, table);
+
+    model_slot_t *slot = new model_slot_t();
+    slot->knn.count = 0;
+    if (type == MODEL_STORE_SECTION_KNN) {
+        knn_load(&slot->knn, blob.data(), blob.size());
+    } else {
+        model_load(&slot->model, blob.data(), blob.size());
+    }
+    uint16_t inputs = model_slot_inputs(slot), outputs = model_slot_outputs(slot);
+    size_t input_bytes = ((size_t) inputs * 2 + 3) & ~(size_t) 3;
+    std::vector<uint8_t> section(4, 0);
+    _csi_put_u16(&section[0], (uint16_t) probes.size());
+    for (const sample_t *s : probes) {
+        size_t offset = section.size();
+        section.resize(offset + input_bytes + 4 * outputs, 0);
+        for (size_t i = 0; i < inputs; i++) {
+            _csi_put_u16(&section[offset + 2 * i], (uint16_t) s->q[i]);
+        }
+        model_result_t result;
+        model_slot_run(slot, s->q.data(), &result);
+        for (uint16_t o = 0; o < outputs; o++) {
+            uint32_t bits;
+            memcpy(&bits, &result.classification[o].value, 4);
+            _csi_put_u32(&section[offset + input_bytes + 4 * o], bits);
+        }
+    }
+    delete slot;
+    pack_section(&c, 2, MODEL_STORE_SECTION_PROBE, section);
+
+    _csi_put_u32(&c[0], MODEL_STORE_MAGIC);
+    _csi_put_u16(&c[4], MODEL_STORE_VERSION);
+    _csi_put_u16(&c[6], 3);
+    _csi_put_u32(&c[8], version);
+    _csi_put_u32(&c[12], (uint32_t) c.size());
+    _csi_put_u32(&c[16], capture_crc32(0, &c[MODEL_STORE_HEADER_SIZE], c.size() - MODEL_STORE_HEADER_SIZE));
+    _csi_put_u32(&c[20], capture_crc32(0, c.data(), MODEL_STORE_HEADER_SIZE - 4));
+    return c;
+}
+
+
+#endif //CSI_TOOLS_MODEL_H
@@ -0,0 +1,331 @@
+/*
+ * Loads the model containers of model_store_component.h the way the deployment sketches do (natively
+ * hal_map_file and hal_map_partition mmap them) and measures swapping models while inferences run.
+ *
+ *   csi_model_store info <container.csmc>...
+ *       check every container as the sketch would and print its version, model and probes
+ *   csi_model_store bench [-n swaps] <a.csmc> <b.csmc>
+ *       two containers of models with the same inputs (csi_model fit twice) that give different outputs:
+ *       stage       mapping a container (file, flash partition image, built-in), CRCs, model_load and
+ *                   probes, on the task that stages
+ *       swap        model_store_commit of a staged model and model_store_rollback, what the inference
+ *                   task pays between two cycles
+ *       under load  an inference thread runs model_store_run back to back while a and b are staged in
+ *                   turn n times: every result must be exactly a's or b's, and the rows compare the
+ *                   inferences that swapped with the others
+ *       failures    corrupt, truncated and refused containers must leave the running model in place, and a
+ *                   model failing its first run must be rolled back
+ *       The copies go to csi_model_store_bench/, which also stands for the flash partitions.
+ */
+#define CONFIG_HAL_PARTITION_DIR "csi_model_store_bench"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <algorithm>
+#include <atomic>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "model_store_component.h"
+#include "csi_bench.h"
+
+#define BENCH_PARTITION_SIZE (64 * 1024) // Flash is mapped in 64 KB pages, the rest of the partition erased
+
+// What the sketch's activate hook checks, and what get_data delivers
+uint16_t bench_inputs = 0;
+uint32_t bench_refused_version = 0;
+std::vector<int16_t> bench_input;
+std::atomic<int> bench_failures(0); // get_data calls left to fail
+
+bool bench_activate(const model_slot_t *slot) {
+    return slot->model.inputs == bench_inputs && slot->version != bench_refused_version;
+}
+
+int bench_get_data(size_t offset, size_t length, int16_t *out) {
+    if (bench_failures > 0) {
+        bench_failures--;
+        return -1;
+    }
+    memcpy(out, bench_input.data() + offset, length * sizeof(int16_t));
+    return 0;
+}
+
+bool read_file(const char *path, std::vector<uint8_t> *data) {
+    hal_map_t m;
+    if (!hal_map_file(path, &m)) {
+        return false;
+    }
+    data->assign(m.data, m.data + m.size);
+    hal_unmap(&m);
+    return true;
+}
+
+bool write_file(const std::string &path, const std::vector<uint8_t> &data) {
+    FILE *f = fopen(path.c_str(), "wb");
+    if (f == NULL || fwrite(data.data(), 1, data.size(), f) != data.size() || fclose(f) != 0) {
+        printf("ERROR: cannot write %s [%s]\n", path.c_str(), strerror(errno));
+        return false;
+    }
+    return true;
+}
+
+// A copy of a container under another model version, with its header CRC redone
+std::vector<uint8_t> restamp(std::vector<uint8_t> c, uint32_t version) {
+    _csi_put_u32(&c[8], version);
+    _csi_put_u32(&c[20], capture_crc32(0, c.data(), MODEL_STORE_HEADER_SIZE - 4));
+    return c;
+}
+
+int info(int argc, char **argv) {
+    if (argc < 2) {
+        return -1;
+    }
+    model_store_t *store = new model_store_t();
+    bool ok = true;
+    for (int i = 1; i < argc; i++) {
+        model_store_init(store, NULL);
+        if (!model_store_stage_file(store, argv[i]) || !model_store_commit(store)) {
+            printf("%s: FAILED\n", argv[i]);
+            ok = false;
+            continue;
+        }
+        const model_slot_t *slot = model_store_active(store);
+        const model_t *m = &slot->model;
+        const knn_t *n = &slot->knn;
+        if (n->count > 0) {
+            printf("%s: version %u, %u byte container, kNN of %u bytes: %u fingerprints of %u features, k %u, %u outputs,"
+                   " normalization %s, %u probes OK\n", argv[i], (unsigned) slot->version,
+                   _csi_get_u32(slot->map.data + 12), (unsigned) n->blob_size, (unsigned) n->count,
+                   (unsigned) n->features, (unsigned) n->k, (unsigned) n->outputs,
+                   slot->norm.features > 0 ? "included" : "missing", (unsigned) slot->probes);
+        } else {
+            printf("%s: version %u, %u byte container, model of %u bytes: %u inputs, %u layers (%u bit), %u %s"
+                   " outputs, normalization %s, %u probes OK\n", argv[i], (unsigned) slot->version,
+                   _csi_get_u32(slot->map.data + 12), (unsigned) m->blob_size, (unsigned) m->inputs,
+                   (unsigned) m->layer_count, (unsigned) m->layers[0].weight_bits, (unsigned) m->outputs,
+                   m->output_kind == MODEL_OUTPUT_SOFTMAX ? "softmax" : "regression",
+                   slot->norm.features > 0 ? "included" : "missing", (unsigned) slot->probes);
+        }
+        model_store_rollback(store);
+        hal_unmap(&store->slots[0].map);
+        hal_unmap(&store->slots[1].map);
+    }
+    delete store;
+    return ok ? 0 : 1;
+}
+
+uint32_t swaps(model_store_t *s) {
+    std::lock_guard<std::mutex> lock(s->mutex);
+    return s->swaps;
+}
+
+// Outputs of model_store_run on the bench input
+std::vector<float> outputs(const model_result_t *r) {
+    std::vector<float> v(r->count);
+    for (uint16_t o = 0; o < r->count; o++) {
+        v[o] = r->classification[o].value;
+    }
+    return v;
+}
+
+int bench(int argc, char **argv) {
+    long n = 200;
+    int opt;
+    while ((opt = getopt(argc, argv, "n:")) != -1) {
+        switch (opt) {
+            case 'n': n = std::max(10L, atol(optarg)); break;
+            default: return -1;
+        }
+    }
+    if (optind != argc - 2) {
+        return -1;
+    }
+    const char *path[2] = {argv[optind], argv[optind + 1]};
+    std::vector<uint8_t> container[2];
+    if (!read_file(path[0], &container[0]) || !read_file(path[1], &container[1])) {
+        return 1;
+    }
+    if (mkdir(CONFIG_HAL_PARTITION_DIR, 0755) != 0 && errno != EEXIST) {
+        printf("ERROR: cannot create %s [%s]\n", CONFIG_HAL_PARTITION_DIR, strerror(errno));
+        return 1;
+    }
+    // b as it lies in a flash partition, erased bytes after it
+    std::vector<uint8_t> partition = container[1];
+    partition.resize((partition.size() + BENCH_PARTITION_SIZE - 1) / BENCH_PARTITION_SIZE * BENCH_PARTITION_SIZE, 0xff);
+    if (!write_file(CONFIG_HAL_PARTITION_DIR "/model.bin", partition)) {
+        return 1;
+    }
+
+    model_store_t *store = new model_store_t();
+    model_store_init(store, &bench_activate);
+    if (!model_store_stage_file(store, path[0])) {
+        return 1;
+    }
+    bench_inputs = store->staged->model.inputs; // The sketch's SIZE_SUB_ARRAY
+    model_store_commit(store);
+    std::mt19937 rng(1);
+    std::uniform_int_distribution<int> standardized(-(3 << NORM_FRAC_BITS), 3 << NORM_FRAC_BITS);
+    bench_input.resize(bench_inputs);
+    for (int16_t &x : bench_input) {
+        x = (int16_t) standardized(rng);
+    }
+
+    // The outputs of each model on the input, to tell them apart under load
+    std::vector<float> expected[2];
+    uint32_t version[2];
+    model_result_t result;
+    for (int k = 0; k < 2; k++) {
+        if (k == 1 && (!model_store_stage_file(store, path[1]) || !model_store_commit(store))) {
+            printf("ERROR: %s does not swap in for %s\n", path[1], path[0]);
+            return 1;
+        }
+        version[k] = model_store_active(store)->version;
+        model_store_run(store, &bench_get_data, &result);
+        expected[k] = outputs(&result);
+    }
+    bool distinct = expected[0] != expected[1] && version[0] != version[1];
+    printf("%s: version %u, %s: version %u, %u inputs, %zu byte containers%s\n", path[0], (unsigned) version[0],
+           path[1], (unsigned) version[1], (unsigned) bench_inputs, container[1].size(),
+           distinct ? "" : " (the models cannot be told apart, under load is not checked)");
+    bool ok = true;
+
+    bench_header("stage (model_store_stage_*)");
+    char note[96];
+    snprintf(note, sizeof(note), "%zu bytes, mmap", container[0].size());
+    bench_run("file", n, [&](long i) { model_store_stage_file(store, path[i % 2]); }, note);
+    snprintf(note, sizeof(note), "%zu KB partition", partition.size() / 1024);
+    bench_run("partition", n, [&](long) { model_store_stage_partition(store, "model"); }, note);
+    bench_run("memory (built into the sketch)", n, [&](long i) {
+        model_store_stage_memory(store, container[i % 2].data(), container[i % 2].size(), "memory");
+    });
+
+    bench_header("swap");
+    std::vector<int64_t> commit_ns, rollback_ns;
+    for (long i = 0; i < n; i++) {
+        ok = ok && model_store_stage_file(store, path[i % 2]);
+        int64_t t0 = bench_now_ns();
+        ok = ok && model_store_commit(store);
+        commit_ns.push_back(bench_now_ns() - t0);
+        if (i % 2 == 1) {
+            t0 = bench_now_ns();
+            ok = ok && model_store_rollback(store);
+            rollback_ns.push_back(bench_now_ns() - t0);
+        }
+    }
+    bench_report("model_store_commit", commit_ns, "");
+    bench_report("model_store_rollback", rollback_ns, "");
+    std::vector<int64_t> run_ns = bench_samples(n * 10, [&](long) {
+        model_store_run(store, &bench_get_data, &result);
+    });
+    bench_report("model_store_run, nothing staged", run_ns, "");
+    printf("  swaps %s\n", ok ? "OK" : "FAILED");
+
+    bench_header("under load");
+    std::atomic<bool> stop(false);
+    std::vector<int64_t> plain_ns, swap_ns;
+    uint64_t mixed = 0, runs[2] = {0, 0};
+    std::thread inference([&]() {
+        model_result_t r;
+        while (!stop) {
+            uint32_t before = swaps(store);
+            int64_t t0 = bench_now_ns();
+            int rc = model_store_run(store, &bench_get_data, &r);
+            int64_t ns = bench_now_ns() - t0;
+            (swaps(store) != before ? swap_ns : plain_ns).push_back(ns);
+            std::vector<float> v = outputs(&r);
+            if (rc != 0 || (distinct && v != expected[0] && v != expected[1])) {
+                mixed++;
+            } else {
+                runs[v == expected[1]]++;
+            }
+        }
+    });
+    for (long i = 0; i < n; i++) {
+        uint32_t before = swaps(store);
+        if (!model_store_stage_file(store, path[i % 2])) {
+            ok = false;
+            break;
+        }
+        while (swaps(store) == before) {
+            hal_sleep_us(10);
+        }
+    }
+    stop = true;
+    inference.join();
+    bench_report("model_store_run", plain_ns, "");
+    snprintf(note, sizeof(note), "%zu swaps", swap_ns.size());
+    bench_report("model_store_run with a swap", swap_ns, note);
+    bool load_ok = ok && mixed == 0 && (long) swap_ns.size() == n;
+    printf("  %llu inferences of a, %llu of b, %llu neither %s\n", (unsigned long long) runs[0],
+           (unsigned long long) runs[1], (unsigned long long) mixed, load_ok ? "OK" : "FAILED");
+    ok = ok && load_ok;
+
+    printf("\nfailures\n");
+    // Start from a running
+    model_store_stage_file(store, path[0]);
+    model_store_commit(store);
+    std::vector<uint8_t> corrupt = container[1];
+    corrupt[corrupt.size() / 2] ^= 0x10;
+    std::vector<uint8_t> truncated(container[1].begin(), container[1].end() - 64);
+    std::vector<uint8_t> header = container[1];
+    header[8] ^= 1; // Version changed without redoing the header CRC
+    bench_refused_version = version[1] + 1000;
+    std::vector<uint8_t> refused = restamp(container[1], bench_refused_version);
+    struct {
+        const char *name;
+        std::vector<uint8_t> *data;
+        bool stages;
+    } cases[] = {
+            {"payload bit flip", &corrupt, false},
+            {"truncated", &truncated, false},
+            {"header bit flip", &header, false},
+            {"refused by activate", &refused, true},
+    };
+    for (auto &c : cases) {
+        std::string file = std::string(CONFIG_HAL_PARTITION_DIR "/") + c.name + ".csmc";
+        std::replace(file.begin(), file.end(), ' ', '_');
+        bool staged = write_file(file, *c.data) && model_store_stage_file(store, file.c_str());
+        bool committed = model_store_commit(store);
+        int rc = model_store_run(store, &bench_get_data, &result);
+        bool case_ok = staged == c.stages && !committed && rc == 0 && outputs(&result) == expected[0] &&
+                       model_store_active(store)->version == version[0];
+        printf("  %-22s %s, a still runs %s\n", c.name, staged ? "staged, not swapped in" : "rejected",
+               case_ok ? "OK" : "FAILED");
+        ok = ok && case_ok;
+    }
+    model_store_stage_file(store, path[1]);
+    uint32_t rollbacks = store->rollbacks;
+    bench_failures = 1;
+    int rc = model_store_run(store, &bench_get_data, &result);
+    bool rollback_ok = rc == 0 && store->rollbacks == rollbacks + 1 && outputs(&result) == expected[0] &&
+                       model_store_active(store)->version == version[0];
+    printf("  %-22s rolled back to a %s\n", "b fails its first run", rollback_ok ? "OK" : "FAILED");
+    ok = ok && rollback_ok;
+    printf("  %u swaps, %u rollbacks, %u containers rejected\n", (unsigned) store->swaps, (unsigned) store->rollbacks,
+           (unsigned) store->rejected);
+
+    hal_unmap(&store->slots[0].map);
+    hal_unmap(&store->slots[1].map);
+    delete store;
+    printf("\n%s\n", ok ? "OK" : "FAILED");
+    return ok ? 0 : 1;
+}
+
+int main(int argc, char **argv) {
+    int rc = -1;
+    if (argc >= 2 && strcmp(argv[1], "info") == 0) {
+        rc = info(argc - 1, argv + 1);
+    } else if (argc >= 2 && strcmp(argv[1], "bench") == 0) {
+        rc = bench(argc - 1, argv + 1);
+    }
+    if (rc < 0) {
+        fprintf(stderr, "usage: %s info <container.csmc>...\n"
+                        "       %s bench [-n swaps] <a.csmc> <b.csmc>\n", argv[0], argv[0]);
+        return 1;
+    }
+    return rc;
+}
@@ -0,0 +1,217 @@
+/*
+ * Runs the MQTT result publisher (deployments/mqtt_publisher_component.h) against a minimal broker
+ * stand-in on loopback and reports publish latency and throughput.
+ *
+ * The stand-in accepts one client at a time, answers CONNECT and PINGREQ, and decodes every PUBLISH
+ * payload. Latency is measured per result, from the timestamp set at submit to the moment the broker
+ * parsed it. The broker can be made slow (-s, a delay per PUBLISH) to exercise coalescing, and can drop
+ * the connection every -k publishes to exercise the background reconnect.
+ *
+ * usage: csi_mqtt_bench [-n results] [-r rate] [-s stall_us] [-k kill_every] [-p port]
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <algorithm>
+#include <atomic>
+#include <vector>
+
+#include "mqtt_publisher_component.h"
+
+static std::atomic<bool> broker_running(true);
+static std::mutex latency_mutex;
+static std::vector<int64_t> latencies;
+static std::atomic<uint64_t> broker_publishes(0);
+static std::atomic<uint64_t> broker_results(0);
+static std::atomic<uint64_t> broker_sessions(0);
+static std::atomic<int64_t> broker_last_us(0);
+
+bool always_connected() {
+    return true;
+}
+
+bool read_exact(int fd, uint8_t *buf, size_t size) {
+    return size == 0 || recv(fd, buf, size, MSG_WAITALL) == (ssize_t) size;
+}
+
+// Reads one MQTT control packet, returns false when the client is gone
+bool read_packet(int fd, uint8_t *type, std::vector<uint8_t> &body) {
+    uint8_t b;
+    if (!read_exact(fd, type, 1)) {
+        return false;
+    }
+    size_t length = 0;
+    int shift = 0;
+    do {
+        if (!read_exact(fd, &b, 1)) {
+            return false;
+        }
+        length |= (size_t) (b & 0x7F) << shift;
+        shift += 7;
+    } while (b & 0x80);
+    body.resize(length);
+    return read_exact(fd, body.data(), length);
+}
+
+void handle_publish(const std::vector<uint8_t> &body) {
+    int64_t now = _mqtt_now_us();
+    size_t topic_len = ((size_t) body[0] << 8) | body[1];
+    const uint8_t *payload = body.data() + 2 + topic_len;
+    size_t count = payload[1];
+    const uint8_t *r = payload + MQTT_PAYLOAD_HEADER_SIZE;
+
+    std::lock_guard<std::mutex> lock(latency_mutex);
+    for (size_t i = 0; i < count; i++, r += MQTT_RESULT_SIZE) {
+        uint64_t ts = 0;
+        for (int j = 0; j < 8; j++) {
+            ts |= (uint64_t) r[j] << (8 * j);
+        }
+        latencies.push_back(now - (int64_t) ts);
+    }
+    broker_results += count;
+    broker_publishes++;
+    broker_last_us = now;
+}
+
+void broker_loop(int listen_fd, int64_t stall_us, uint64_t kill_every) {
+    while (broker_running) {
+        int fd = accept(listen_fd, NULL, NULL);
+        if (fd == -1) {
+            continue; // Accept timeout, check broker_running again
+        }
+        broker_sessions++;
+
+        uint8_t type;
+        std::vector<uint8_t> body;
+        uint64_t session_publishes = 0;
+        while (broker_running && read_packet(fd, &type, body)) {
+            if ((type & 0xF0) == 0x10) {
+                uint8_t connack[4] = {0x20, 0x02, 0x00, 0x00};
+                send(fd, connack, sizeof(connack), 0);
+            } else if ((type & 0xF0) == 0x30) {
+                if (stall_us > 0) {
+                    std::this_thread::sleep_for(std::chrono::microseconds(stall_us));
+                }
+                handle_publish(body);
+                if (kill_every > 0 && ++session_publishes == kill_every) {
+                    break; // Drop the client
+                }
+            } else if ((type & 0xF0) == 0xC0) {
+                uint8_t pingresp[2] = {0xD0, 0x00};
+                send(fd, pingresp, sizeof(pingresp), 0);
+            }
+        }
+        close(fd);
+    }
+}
+
+int open_listener(int port) {
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    int reuse = 1;
+    setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
+    struct timeval timeout = {.tv_sec = 0, .tv_usec = 100000};
+    setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    addr.sin_port = htons(port);
+    if (bind(fd, (const struct sockaddr *) &addr, sizeof(addr)) == -1 || listen(fd, 4) == -1) {
+        fprintf(stderr, "ERROR: cannot listen on port %d [%s]\n", port, strerror(errno));
+        exit(1);
+    }
+    return fd;
+}
+
+int64_t percentile(std::vector<int64_t> &v, double q) {
+    if (v.empty()) {
+        return 0;
+    }
+    size_t i = (size_t) (q * (v.size() - 1));
+    std::nth_element(v.begin(), v.begin() + i, v.end());
+    return v[i];
+}
+
+int main(int argc, char **argv) {
+    int results = 20000;
+    double rate = 0; // 0 = as fast as possible
+    int64_t stall_us = 0;
+    uint64_t kill_every = 0;
+    int port = 18830;
+
+    int opt;
+    while ((opt = getopt(argc, argv, "n:r:s:k:p:")) != -1) {
+        switch (opt) {
+            case 'n': results = atoi(optarg); break;
+            case 'r': rate = atof(optarg); break;
+            case 's': stall_us = atoll(optarg); break;
+            case 'k': kill_every = strtoull(optarg, NULL, 10); break;
+            case 'p': port = atoi(optarg); break;
+            default:
+                fprintf(stderr, "usage: %s [-n results] [-r rate] [-s stall_us] [-k kill_every] [-p port]\n", argv[0]);
+                return 1;
+        }
+    }
+
+    int listen_fd = open_listener(port);
+    std::thread broker(broker_loop, listen_fd, stall_us, kill_every);
+
+    mqtt_publisher_t *p = new mqtt_publisher_t();
+    mqtt_publisher_start(p, "127.0.0.1", port, "csi/inference", "csi_mqtt_bench", 1, &always_connected);
+
+    // Labels change every few results, like a person moving between rooms
+    srand(42);
+    uint8_t label = 0;
+    int64_t interval_us = rate > 0 ? (int64_t) (1e6 / rate) : 0;
+    int64_t start = _mqtt_now_us();
+    int64_t submit_ns = 0;
+    for (int i = 0; i < results; i++) {
+        if (rand() % 8 == 0) {
+            label = rand() % 6;
+        }
+        auto t0 = std::chrono::steady_clock::now();
+        mqtt_publisher_submit_label(p, label, (rand() % 1000) / 1000.0f);
+        submit_ns += std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - t0).count();
+        if (interval_us > 0) {
+            std::this_thread::sleep_until(std::chrono::system_clock::time_point(
+                std::chrono::microseconds(start + (i + 1) * interval_us)));
+        }
+    }
+
+    // Wait for the queue to drain
+    mqtt_publisher_stats_t stats;
+    uint64_t last = (uint64_t) -1;
+    while (true) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(200));
+        mqtt_publisher_get_stats(p, &stats);
+        if (stats.published + stats.dropped + stats.coalesced >= stats.submitted || broker_results == last) {
+            break;
+        }
+        last = broker_results;
+    }
+    double elapsed_s = (broker_last_us - start) / 1e6;
+
+    mqtt_publisher_stop(p);
+    broker_running = false;
+    broker.join();
+    close(listen_fd);
+
+    std::lock_guard<std::mutex> lock(latency_mutex);
+    uint64_t received = broker_results;
+    printf("submitted %llu results, %.0f ns/submit\n", (unsigned long long) stats.submitted,
+           (double) submit_ns / results);
+    printf("broker: %llu results in %llu publishes (%.1f results/publish), %.0f results/s, sessions %llu\n",
+           (unsigned long long) received, (unsigned long long) broker_publishes.load(),
+           broker_publishes > 0 ? (double) received / broker_publishes : 0.0, received / elapsed_s,
+           (unsigned long long) broker_sessions.load());
+    printf("latency: p50 %lld us  p99 %lld us  max %lld us\n", (long long) percentile(latencies, 0.5),
+           (long long) percentile(latencies, 0.99), (long long) percentile(latencies, 1.0));
+    printf("publisher: coalesced %llu  dropped %llu  lost in broken sessions %llu  connects %u  failures %u\n",
+           (unsigned long long) stats.coalesced, (unsigned long long) stats.dropped,
+           (unsigned long long) (stats.published - std::min<uint64_t>(stats.published, received)),
+           stats.connects, stats.connect_failures);
+    delete p;
+    return 0;
+}
@@ -0,0 +1,162 @@
+/*
+ * Fits the feature standardization of the deployment sketches (norm_component.h) on a training capture and
+ * writes it as a header the sketch includes, so the device standardizes while csi_complete assembles the
+ * features instead of in the model's float DSP block.
+ * The fitting itself is in csi_norm.h.
+ *
+ *   csi_norm fit [-a AP1,AP2,...] [-m standard|robust] [-o csi_norm_table.h] <capture.csi>
+ *       per-feature mean and standard deviation (standard), or median and interquartile range / 1.349
+ *       (robust, for captures with outliers); -a lists the APs in the sketch's order, by default the
+ *       capture's AP table
+ *   csi_norm check [-a ...] [-m ...] <capture.csi>
+ *       standardize every record of the capture in fixed point and in float and check that they agree
+ *       within NORM_ERROR_BOUND, and that the standardized features have mean 0 and deviation 1
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <math.h>
+
+#include "csi_norm.h"
+
+bool parse_options(int argc, char **argv, norm_fit_t *fit, const char **output) {
+    int opt;
+    while ((opt = getopt(argc, argv, "a:m:o:")) != -1) {
+        switch (opt) {
+            case 'a': norm_parse_aps(optarg, &fit->aps); break;
+            case 'm':
+                if (strcmp(optarg, "standard") != 0 && strcmp(optarg, "robust") != 0) {
+                    return false;
+                }
+                fit->robust = strcmp(optarg, "robust") == 0;
+                break;
+            case 'o':
+                if (output == NULL) {
+                    return false;
+                }
+                *output = optarg;
+                break;
+            default:
+                return false;
+        }
+    }
+    return optind == argc - 1;
+}
+
+int fit(int argc, char **argv) {
+    norm_fit_t f;
+    f.robust = false;
+    const char *output = "csi_norm_table.h";
+    if (!parse_options(argc, argv, &f, &output)) {
+        return -1;
+    }
+    const char *capture = argv[optind];
+    norm_result_t r;
+    if (!norm_fit_capture(capture, &f, &r) || !norm_write_header(output, capture, &f, &r)) {
+        return 1;
+    }
+
+    printf("%s: %llu records of %zu APs (%llu skipped), %u features\n", capture, (unsigned long long) f.records,
+           f.aps.size(), (unsigned long long) f.skipped, (unsigned) r.table.features);
+    for (size_t b = 0; b < f.aps.size(); b++) {
+        size_t base = b * NORM_FEATURES_PER_AP;
+        double csi_scale = 0;
+        for (size_t k = 1; k < NORM_FEATURES_PER_AP; k++) {
+            csi_scale += r.scale[base + k] / NORM_STREAM_LEN;
+        }
+        printf("  %-16s rssi %7.2f +- %5.2f   csi mean scale %6.2f\n", f.aps[b].c_str(), r.mean[base], r.scale[base],
+               csi_scale);
+    }
+    printf("wrote %s\n", output);
+    return 0;
+}
+
+int check(int argc, char **argv) {
+    norm_fit_t f;
+    f.robust = false;
+    if (!parse_options(argc, argv, &f, NULL)) {
+        return -1;
+    }
+    const char *capture = argv[optind];
+    norm_result_t r;
+    if (!norm_fit_capture(capture, &f, &r)) {
+        return 1;
+    }
+
+    // Fixed point against float on every value of the capture, and the moments of the standardized features
+    size_t n = r.table.features;
+    std::vector<double> sum(n, 0), sum2(n, 0);
+    std::vector<uint64_t> count(n, 0);
+    double max_error = 0, total_error = 0;
+    uint64_t values = 0, saturated = 0, skipped = 0;
+    std::vector<std::string> aps = f.aps;
+    norm_for_each_record(capture, aps, &skipped, [&](size_t block, const csi_record_t *rec) {
+        for (size_t k = 0; k < NORM_FEATURES_PER_AP; k++) {
+            size_t i = block * NORM_FEATURES_PER_AP + k;
+            int32_t x = norm_record_feature(rec, k);
+            double exact = (x - (double) r.mean[i]) / r.scale[i];
+            int16_t q = norm_apply(&r.table, i, x);
+            if (q == INT16_MIN || q == INT16_MAX) {
+                saturated++;
+                continue;
+            }
+            double error = fabs(q * (double) NORM_Q_TO_FLOAT - exact);
+            max_error = std::max(max_error, error);
+            total_error += error;
+            values++;
+            sum[i] += exact;
+            sum2[i] += exact * exact;
+            count[i]++;
+        }
+    });
+
+    double worst_mean = 0, min_sd = 1e9, max_sd = 0;
+    size_t constant = 0;
+    for (size_t i = 0; i < n; i++) {
+        if (count[i] == 0) {
+            continue;
+        }
+        double mean = sum[i] / count[i];
+        double sd = sqrt(std::max(0.0, sum2[i] / count[i] - mean * mean));
+        if (r.scale[i] <= NORM_MIN_SCALE && sd < 1e-9) {
+            constant++; // Null subcarriers, left at 0
+            continue;
+        }
+        worst_mean = std::max(worst_mean, fabs(f.robust ? 0 : mean));
+        min_sd = std::min(min_sd, sd);
+        max_sd = std::max(max_sd, sd);
+    }
+
+    bool error_ok = values > 0 && max_error <= NORM_ERROR_BOUND;
+    printf("%s: %llu records, %u features (%zu constant), %s scaling\n", capture, (unsigned long long) f.records,
+           (unsigned) n, constant, f.robust ? "robust" : "standard");
+    printf("fixed point vs float %s  max error %.5f, mean %.5f (bound %.5f), %llu values, %llu saturated\n",
+           error_ok ? "OK    " : "FAILED", max_error, values > 0 ? total_error / values : 0, NORM_ERROR_BOUND,
+           (unsigned long long) values, (unsigned long long) saturated);
+    bool moments_ok = true;
+    if (!f.robust) {
+        // Scales floored at NORM_MIN_SCALE leave nearly constant features below a deviation of 1
+        moments_ok = worst_mean < 1e-4 && max_sd < 1 + 1e-4;
+        printf("standardized         %s  |mean| <= %.2g, deviation %.3f..%.3f\n", moments_ok ? "OK    " : "FAILED",
+               worst_mean, min_sd, max_sd);
+    }
+    bool ok = error_ok && moments_ok;
+    printf("%s\n", ok ? "OK" : "FAILED");
+    return ok ? 0 : 1;
+}
+
+int main(int argc, char **argv) {
+    int rc = -1;
+    if (argc >= 2 && strcmp(argv[1], "fit") == 0) {
+        rc = fit(argc - 1, argv + 1);
+    } else if (argc >= 2 && strcmp(argv[1], "check") == 0) {
+        rc = check(argc - 1, argv + 1);
+    }
+    if (rc < 0) {
+        fprintf(stderr, "usage: %s fit [-a AP1,AP2,...] [-m standard|robust] [-o csi_norm_table.h] <capture.csi>\n"
+                        "       %s check [-a AP1,AP2,...] [-m standard|robust] <capture.csi>\n", argv[0], argv[0]);
+        return 1;
+    }
+    return rc;
+}
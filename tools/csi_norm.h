@@ -0,0 +1,213 @@
+#ifndef CSI_TOOLS_NORM_H
+#define CSI_TOOLS_NORM_H
+
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <math.h>
+#include <algorithm>
+#include <functional>
+#include <string>
+#include <vector>
+
+#include "capture_component.h"
+#include "norm_component.h"
+
+/*
+ * Fitting the deployment sketches' feature standardization (norm_component.h) on a capture, shared by
+ * csi_norm and csi_model. Features are laid out as csi_complete reads them: for every AP of the cycle its
+ * RSSI, then the first NORM_STREAM_LEN values of its CSI buffer. Each AP's records give the statistics of
+ * its block.
+ */
+
+#define NORM_STREAM_LEN 128 // CSI_STREAM_LEN of the deployments csi_component.h
+#define NORM_FEATURES_PER_AP (1 + NORM_STREAM_LEN)
+#define NORM_BINS 256 // Every raw value is an int8
+
+typedef struct {
+    std::vector<std::string> aps; // Feature blocks in order
+    std::vector<std::vector<uint64_t>> hist; // Per feature, value + 128
+    uint64_t records;
+    uint64_t skipped; // Records of other APs or delta coded
+    bool robust;
+} norm_fit_t;
+
+typedef struct {
+    std::vector<float> mean;
+    std::vector<float> scale;
+    std::vector<int32_t> mul;
+    std::vector<int32_t> add;
+    norm_table_t table;
+} norm_result_t;
+
+// Raw value of feature `k` of an AP's block in a record
+inline int32_t norm_record_feature(const csi_record_t *r, size_t k) {
+    if (k == 0) {
+        return r->rssi;
+    }
+    return k - 1 < r->len ? r->data[k - 1] : 0; // The sketch reads the buffer as delivered, zeros past len
+}
+
+// Calls body(block, record) for every raw record of an AP in `aps`
+template <typename F>
+bool norm_for_each_record(const char *path, std::vector<std::string> &aps, uint64_t *skipped, F body) {
+    capture_reader_t rd;
+    if (!capture_reader_open(&rd, path)) {
+        return false;
+    }
+    if (aps.empty()) {
+        for (int i = 0; i < rd.ap_count && i < CAPTURE_MAX_APS; i++) {
+            aps.push_back(rd.ap_names[i]);
+        }
+    }
+    int block_of[CAPTURE_MAX_APS];
+    for (int i = 0; i < CAPTURE_MAX_APS; i++) {
+        block_of[i] = -1;
+        for (size_t b = 0; b < aps.size() && i < rd.ap_count; b++) {
+            if (aps[b] == rd.ap_names[i]) {
+                block_of[i] = (int) b;
+            }
+        }
+    }
+
+    for (size_t i = 0; i < capture_reader_chunks(&rd); i++) {
+        capture_chunk_t c;
+        csi_record_t record;
+        if (!capture_reader_load_chunk(&rd, i, &c)) {
+            printf("ERROR: chunk %zu failed verification\n", i);
+            continue;
+        }
+        while (capture_chunk_next(&c, &record)) {
+            if (record.ap_id >= CAPTURE_MAX_APS || block_of[record.ap_id] < 0 ||
+                (record.flags & ~CSI_RECORD_FLAG_LABELED) != CSI_RECORD_FLAG_RAW) {
+                (*skipped)++;
+                continue;
+            }
+            body((size_t) block_of[record.ap_id], &record);
+        }
+    }
+    capture_reader_close(&rd);
+    return true;
+}
+
+// Value at quantile q of a histogram
+inline double norm_hist_quantile(const std::vector<uint64_t> &h, uint64_t total, double q) {
+    uint64_t target = (uint64_t) (q * (total - 1));
+    uint64_t seen = 0;
+    for (int v = 0; v < NORM_BINS; v++) {
+        seen += h[v];
+        if (seen > target) {
+            return v - 128;
+        }
+    }
+    return 127;
+}
+
+inline bool norm_fit_capture(const char *path, norm_fit_t *f, norm_result_t *out) {
+    f->records = f->skipped = 0;
+    bool read = norm_for_each_record(path, f->aps, &f->skipped, [&](size_t block, const csi_record_t *r) {
+        if (f->hist.empty()) {
+            f->hist.assign(f->aps.size() * NORM_FEATURES_PER_AP, std::vector<uint64_t>(NORM_BINS, 0));
+        }
+        for (size_t k = 0; k < NORM_FEATURES_PER_AP; k++) {
+            f->hist[block * NORM_FEATURES_PER_AP + k][norm_record_feature(r, k) + 128]++;
+        }
+        f->records++;
+    });
+    if (!read) {
+        return false;
+    }
+    if (f->records == 0) {
+        printf("ERROR: %s has no raw records of the selected APs\n", path);
+        return false;
+    }
+
+    size_t features = f->hist.size();
+    out->mean.assign(features, 0);
+    out->scale.assign(features, NORM_MIN_SCALE);
+    out->mul.assign(features, 0);
+    out->add.assign(features, 0);
+    for (size_t i = 0; i < features; i++) {
+        const std::vector<uint64_t> &h = f->hist[i];
+        uint64_t n = 0;
+        double sum = 0, sum2 = 0;
+        for (int v = 0; v < NORM_BINS; v++) {
+            n += h[v];
+            sum += (double) h[v] * (v - 128);
+            sum2 += (double) h[v] * (v - 128) * (v - 128);
+        }
+        if (n == 0) {
+            continue; // AP never seen, its block passes through unscaled
+        }
+        double mean = sum / n;
+        double scale = sqrt(std::max(0.0, sum2 / n - mean * mean));
+        if (f->robust) {
+            mean = norm_hist_quantile(h, n, 0.5);
+            scale = (norm_hist_quantile(h, n, 0.75) - norm_hist_quantile(h, n, 0.25)) / 1.349;
+        }
+        out->mean[i] = (float) mean;
+        out->scale[i] = (float) std::max((double) NORM_MIN_SCALE, scale);
+        norm_coefficients(out->mean[i], out->scale[i], &out->mul[i], &out->add[i]);
+    }
+    out->table.features = (uint16_t) features;
+    out->table.mul = out->mul.data();
+    out->table.add = out->add.data();
+    return true;
+}
+
+inline void _norm_write_array(FILE *f, const char *type, const char *name, size_t n, const std::function<void(size_t)> &value) {
+    fprintf(f, "constexpr %s %s[CSI_NORM_FEATURES] = {", type, name);
+    for (size_t i = 0; i < n; i++) {
+        fprintf(f, "%s", i % 8 == 0 ? "\n    " : " ");
+        value(i);
+        fprintf(f, ",");
+    }
+    fprintf(f, "\n};\n\n");
+}
+
+inline bool norm_write_header(const char *path, const char *capture, const norm_fit_t *fit, const norm_result_t *r) {
+    FILE *f = fopen(path, "w");
+    if (f == NULL) {
+        printf("ERROR: cannot create %s [%s]\n", path, strerror(errno));
+        return false;
+    }
+    std::string aps;
+    for (const std::string &ap : fit->aps) {
+        aps += (aps.empty() ? "" : ", ") + ap;
+    }
+    size_t n = r->table.features;
+    fprintf(f, "// Generated by csi_norm fit from %s: %llu records, %s scaling\n", capture,
+            (unsigned long long) fit->records, fit->robust ? "robust" : "standard");
+    fprintf(f, "// Feature blocks (RSSI, then %d CSI values) in this AP order: %s\n", NORM_STREAM_LEN, aps.c_str());
+    fprintf(f, "// csi_set_normalization(&csi_norm_table) has csi_complete standardize with it.\n");
+    fprintf(f, "#ifndef CSI_NORM_TABLE_H\n#define CSI_NORM_TABLE_H\n\n#include \"norm_component.h\"\n\n");
+    fprintf(f, "#define CSI_NORM_FEATURES %zu\n\n", n);
+    _norm_write_array(f, "int32_t", "csi_norm_mul", n, [&](size_t i) { fprintf(f, "%d", r->mul[i]); });
+    _norm_write_array(f, "int32_t", "csi_norm_add", n, [&](size_t i) { fprintf(f, "%d", r->add[i]); });
+    fprintf(f, "// What the coefficients were computed from, for float reference implementations\n");
+    _norm_write_array(f, "float", "csi_norm_mean", n, [&](size_t i) { fprintf(f, "%.9g", r->mean[i]); });
+    _norm_write_array(f, "float", "csi_norm_scale", n, [&](size_t i) { fprintf(f, "%.9g", r->scale[i]); });
+    fprintf(f, "const norm_table_t csi_norm_table = {CSI_NORM_FEATURES, csi_norm_mul, csi_norm_add};\n\n");
+    fprintf(f, "#endif //CSI_NORM_TABLE_H\n");
+    bool ok = fclose(f) == 0;
+    if (!ok) {
+        printf("ERROR: cannot write %s [%s]\n", path, strerror(errno));
+    }
+    return ok;
+}
+
+// Comma separated AP names (-a) appended to `aps`
+inline void norm_parse_aps(const char *list, std::vector<std::string> *aps) {
+    std::string s = list;
+    size_t start = 0;
+    while (start <= s.size()) {
+        size_t end = s.find(',', start);
+        end = end == std::string::npos ? s.size() : end;
+        if (end > start) {
+            aps->push_back(s.substr(start, end - start));
+        }
+        start = end + 1;
+    }
+}
+
+#endif //CSI_TOOLS_NORM_H
@@ -0,0 +1,112 @@
+/*
+ * Runs the TX pacer against a simulated FreeRTOS clock and compares it with the old
+ * `vTaskDelay(floor(1000.0 / CONFIG_PACKET_RATE - lag))` computation.
+ *
+ * The fake clock models a scheduler tick (10 ms with CONFIG_FREERTOS_HZ=100): a sleep of n ticks wakes
+ * on a tick boundary, every clock read costs a little time and every send takes a random duration.
+ * The clock starts off a tick boundary, as the station's would. Fails if the pacer misses the target
+ * rate by more than 1% or busy-waits a tick plus its spin margin or longer for any packet.
+ *
+ * usage: csi_pacer_sim [-r rate] [-n packets] [-t tick_us] [-s max_send_us]
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+#include <unistd.h>
+#include <random>
+
+#include "pacer_component.h"
+
+typedef struct {
+    int64_t now_us;
+    int64_t tick_us;
+    int64_t read_cost_us;
+    int64_t slept_us; // Total time spent in fake_sleep
+} fake_clock_t;
+
+int64_t fake_clock(void *ctx) {
+    fake_clock_t *c = (fake_clock_t *) ctx;
+    c->now_us += c->read_cost_us;
+    return c->now_us;
+}
+
+// vTaskDelay(n): wakes on the n-th tick boundary from now
+void fake_delay_ticks(fake_clock_t *c, int64_t ticks) {
+    if (ticks <= 0) {
+        return;
+    }
+    int64_t next_tick = (c->now_us / c->tick_us + 1) * c->tick_us;
+    c->now_us = next_tick + (ticks - 1) * c->tick_us;
+}
+
+void fake_sleep(void *ctx, int64_t duration_us) {
+    fake_clock_t *c = (fake_clock_t *) ctx;
+    int64_t before = c->now_us;
+    fake_delay_ticks(c, duration_us / c->tick_us);
+    c->slept_us += c->now_us - before;
+}
+
+int main(int argc, char **argv) {
+    double rate = 100.0;
+    int packets = 10000;
+    int64_t tick_us = 10000;
+    int64_t max_send_us = 800;
+
+    int opt;
+    while ((opt = getopt(argc, argv, "r:n:t:s:")) != -1) {
+        switch (opt) {
+            case 'r': rate = atof(optarg); break;
+            case 'n': packets = atoi(optarg); break;
+            case 't': tick_us = atoll(optarg); break;
+            case 's': max_send_us = atoll(optarg); break;
+            default:
+                fprintf(stderr, "usage: %s [-r rate] [-n packets] [-t tick_us] [-s max_send_us]\n", argv[0]);
+                return 1;
+        }
+    }
+
+    std::mt19937 rng(42);
+    std::uniform_int_distribution<int64_t> send_cost(max_send_us / 4, max_send_us);
+
+    // Old computation: the result in ms is passed to vTaskDelay as ticks
+    fake_clock_t old_clock = {0, tick_us, 1, 0};
+    double lag = 0.0;
+    int64_t old_start = old_clock.now_us;
+    for (int i = 0; i < packets; i++) {
+        int64_t start = fake_clock(&old_clock);
+        old_clock.now_us += send_cost(rng);
+        double wait_duration = (1000.0 / rate) - lag;
+        fake_delay_ticks(&old_clock, (int64_t) floor(wait_duration));
+        lag = (fake_clock(&old_clock) - start) / 1e6; // Seconds subtracted from milliseconds, as before
+    }
+    double old_rate = (packets - 1) * 1e6 / (old_clock.now_us - old_start);
+
+    fake_clock_t clock = {tick_us / 3 + 17, tick_us, 1, 0};
+    pacer_t pacer;
+    pacer_init_with_clock(&pacer, rate, 4, tick_us, &fake_clock, &fake_sleep, &clock);
+    int64_t busy_us = 0, busy_max_us = 0;
+    for (int i = 0; i < packets; i++) {
+        int64_t start = clock.now_us, slept = clock.slept_us;
+        pacer_wait(&pacer);
+        int64_t busy = (clock.now_us - start) - (clock.slept_us - slept); // Time pacer_wait spent awake
+        busy_us += busy;
+        busy_max_us = busy > busy_max_us ? busy : busy_max_us;
+        clock.now_us += send_cost(rng);
+    }
+    pacer_stats_t stats;
+    pacer_get_stats(&pacer, &stats);
+    double busy_mean_us = (double) busy_us / packets;
+    bool rate_ok = fabs(stats.rate - rate) <= rate * 0.01;
+    bool busy_ok = busy_max_us <= tick_us + pacer.spin_us + clock.read_cost_us; // The spin ends one read late
+
+    printf("target %.1f/s, tick %lld us, send cost up to %lld us, %d packets\n",
+           rate, (long long) tick_us, (long long) max_send_us, packets);
+    printf("old vTaskDelay(lag): %.1f/s\n", old_rate);
+    printf("pacer:               %.1f/s  jitter mean %.1f us  stddev %.1f us  max %lld us  skipped %llu\n",
+           stats.rate, stats.jitter_mean_us, stats.jitter_stddev_us, (long long) stats.jitter_max_us,
+           (unsigned long long) stats.skipped);
+    printf("pacer busy-wait:     mean %.1f us  max %lld us per packet (tick %lld us, spin %lld us)\n", busy_mean_us,
+           (long long) busy_max_us, (long long) tick_us, (long long) pacer.spin_us);
+    printf("rate %s, busy-wait %s\n", rate_ok ? "OK" : "FAILED", busy_ok ? "OK" : "FAILED");
+    return rate_ok && busy_ok ? 0 : 1;
+}
@@ -0,0 +1,243 @@
+/*
+ * Checks and times the CSI datagram of csi_packet_component.h, the encoder the stations send with and the
+ * decoder the collector reads with.
+ *
+ *   round trip  datagrams of 0, 1, a few and as many records as fit the MTU, for the payload lengths
+ *               esp_wifi reports, unlabeled and labeled: every field must decode as it was encoded (seq,
+ *               timestamp, device id, AP id, RSSI, flags, label, payload), and a full datagram must refuse
+ *               one more record
+ *   rejects     a datagram with a bad magic or version, or shorter than its header, must not open; one cut
+ *               anywhere inside its records must decode fewer records than its header counts, each of them
+ *               intact; a record longer than CSI_RECORD_MAX_LEN must not decode
+ *   timing      encode and decode per record, over many full datagrams of each payload length
+ *
+ * usage: csi_packet_check [-n datagrams] [-S seed]
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <algorithm>
+#include <chrono>
+#include <random>
+#include <vector>
+
+#include "csi_packet_component.h"
+
+volatile int64_t bench_sink;
+
+// Records with random fields, the payloads in `payloads`
+void make_records(std::mt19937 &gen, size_t count, uint16_t len, bool labeled, std::vector<int8_t> &payloads,
+                  std::vector<csi_record_t> &records) {
+    payloads.resize(count * len + 1);
+    records.resize(count);
+    for (size_t i = 0; i < count * len; i++) {
+        payloads[i] = (int8_t) gen();
+    }
+    for (size_t i = 0; i < count; i++) {
+        csi_record_t &r = records[i];
+        r.seq = (uint32_t) gen();
+        r.timestamp_us = (int64_t) (((uint64_t) gen() << 32) | gen()) >> 1;
+        r.device_id = (uint16_t) gen();
+        r.ap_id = (uint8_t) gen();
+        r.rssi = (int8_t) (-20 - (int) (gen() % 80));
+        r.flags = labeled ? CSI_RECORD_FLAG_LABELED : CSI_RECORD_FLAG_RAW;
+        r.len = len;
+        r.data = payloads.data() + i * len;
+        r.point = labeled ? (uint16_t) gen() : 0;
+        r.round = labeled ? (uint16_t) gen() : 0;
+        r.x = labeled ? (int16_t) gen() : 0;
+        r.y = labeled ? (int16_t) gen() : 0;
+    }
+}
+
+bool same_record(const csi_record_t *a, const csi_record_t *b) {
+    return a->seq == b->seq && a->timestamp_us == b->timestamp_us && a->device_id == b->device_id &&
+           a->ap_id == b->ap_id && a->rssi == b->rssi && a->flags == b->flags && a->len == b->len &&
+           a->point == b->point && a->round == b->round && a->x == b->x && a->y == b->y &&
+           memcmp(a->data, b->data, a->len) == 0;
+}
+
+size_t encode(uint8_t *buf, uint16_t device_id, const std::vector<csi_record_t> &records) {
+    csi_packet_writer_t w;
+    csi_packet_begin(&w, buf, CSI_PACKET_MTU, device_id);
+    for (const csi_record_t &r : records) {
+        if (!csi_packet_append(&w, &r)) {
+            return 0;
+        }
+    }
+    return csi_packet_finish(&w);
+}
+
+// Records of the datagram that decode and match `records`, in order; -1 if it does not open
+int decode_matching(const uint8_t *buf, size_t size, const std::vector<csi_record_t> &records) {
+    csi_packet_reader_t rd;
+    if (!csi_packet_open(&rd, buf, size)) {
+        return -1;
+    }
+    csi_record_t r;
+    int n = 0;
+    while (csi_packet_next(&rd, &r)) {
+        if ((size_t) n >= records.size() || !same_record(&r, &records[n])) {
+            return -2;
+        }
+        n++;
+    }
+    return n;
+}
+
+bool check_round_trip(std::mt19937 &gen) {
+    bool ok = true;
+    printf("\nround trip\n  %-22s %8s %8s %10s\n", "payload", "records", "bytes", "decoded");
+    std::vector<int8_t> payloads;
+    std::vector<csi_record_t> records;
+    uint8_t buf[CSI_PACKET_MTU];
+    for (uint16_t len : {(uint16_t) 0, (uint16_t) 128, (uint16_t) 256, (uint16_t) CSI_RECORD_MAX_LEN}) {
+        for (bool labeled : {false, true}) {
+            size_t full = (CSI_PACKET_MTU - CSI_PACKET_HEADER_SIZE) /
+                          (csi_record_wire_size(len) + (labeled ? CSI_RECORD_LABEL_SIZE : 0));
+            full = full > 255 ? 255 : full;
+            size_t counts[] = {0, 1, 3, full};
+            for (size_t c = 0; c < 4; c++) {
+                size_t count = counts[c];
+                if (c == 2 && count >= full) {
+                    continue; // Only three fit, the full datagram covers it
+                }
+                make_records(gen, count, len, labeled, payloads, records);
+                uint16_t device_id = (uint16_t) gen();
+                size_t size = encode(buf, device_id, records);
+                csi_packet_reader_t rd;
+                bool good = size > 0 && csi_packet_open(&rd, buf, size) && rd.header.count == count &&
+                            rd.header.device_id == device_id && rd.header.version == CSI_PACKET_VERSION &&
+                            decode_matching(buf, size, records) == (int) count;
+                if (count == full) {
+                    // One more record must be refused and leave the datagram as it was
+                    csi_packet_writer_t w;
+                    csi_packet_begin(&w, buf, CSI_PACKET_MTU, device_id);
+                    for (const csi_record_t &r : records) {
+                        csi_packet_append(&w, &r);
+                    }
+                    size_t before = w.size;
+                    good = good && !csi_packet_append(&w, &records[0]) && w.size == before &&
+                           w.count == count && (labeled || count == csi_packet_records_per_mtu(len));
+                }
+                char name[32];
+                snprintf(name, sizeof(name), "%u B%s", (unsigned) len, labeled ? ", labeled" : "");
+                printf("  %-22s %8zu %8zu %10s%s\n", name, count, size, good ? "OK" : "FAILED",
+                       count == full ? "  MTU full" : "");
+                ok = ok && good;
+            }
+        }
+    }
+    return ok;
+}
+
+bool check_rejects(std::mt19937 &gen) {
+    std::vector<int8_t> payloads;
+    std::vector<csi_record_t> records;
+    uint8_t buf[CSI_PACKET_MTU];
+    make_records(gen, 5, 128, false, payloads, records);
+    size_t size = encode(buf, 7, records);
+    printf("\nrejects\n");
+
+    bool ok = true;
+    uint8_t bad[CSI_PACKET_MTU];
+    memcpy(bad, buf, size);
+    bad[0] ^= 0xFF;
+    bool magic = decode_matching(bad, size, records) == -1;
+    memcpy(bad, buf, size);
+    bad[2] = CSI_PACKET_VERSION + 1;
+    bool version = decode_matching(bad, size, records) == -1;
+    bool header = true;
+    for (size_t cut = 0; cut < CSI_PACKET_HEADER_SIZE; cut++) {
+        header = header && decode_matching(buf, cut, records) == -1;
+    }
+    printf("  bad magic %s, bad version %s, shorter than the header %s\n", magic ? "OK" : "FAILED",
+           version ? "OK" : "FAILED", header ? "OK" : "FAILED");
+    ok = magic && version && header;
+
+    // Cut at every length inside the records: only the whole records before the cut may decode
+    bool truncated = true;
+    size_t record_size = csi_record_wire_size(128);
+    for (size_t cut = CSI_PACKET_HEADER_SIZE; cut < size; cut++) {
+        truncated = truncated && decode_matching(buf, cut, records) == (int) ((cut - CSI_PACKET_HEADER_SIZE) / record_size);
+    }
+    printf("  cut at each of %zu lengths, only the whole records before the cut decode %s\n",
+           size - CSI_PACKET_HEADER_SIZE, truncated ? "OK" : "FAILED");
+
+    // A record that claims more payload than any esp_wifi buffer
+    memcpy(bad, buf, size);
+    _csi_put_u16(bad + CSI_PACKET_HEADER_SIZE + 18, CSI_RECORD_MAX_LEN + 1);
+    csi_record_t oversized = records[0];
+    oversized.len = CSI_RECORD_MAX_LEN + 1;
+    uint8_t out[CSI_PACKET_MTU];
+    csi_packet_writer_t w;
+    csi_packet_begin(&w, out, sizeof(out), 7);
+    bool too_long = decode_matching(bad, size, records) == 0 && !csi_packet_append(&w, &oversized);
+    printf("  record longer than %d B neither decodes nor encodes %s\n", CSI_RECORD_MAX_LEN,
+           too_long ? "OK" : "FAILED");
+    return ok && truncated && too_long;
+}
+
+inline int64_t now_ns() {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+void time_codec(std::mt19937 &gen, long n) {
+    printf("\ntiming, %ld full datagrams\n  %-26s %8s %16s %16s %14s\n", n, "payload", "records", "encode ns/record",
+           "decode ns/record", "decode MB/s");
+    std::vector<int8_t> payloads;
+    std::vector<csi_record_t> records;
+    uint8_t buf[CSI_PACKET_MTU];
+    for (uint16_t len : {(uint16_t) 128, (uint16_t) 256, (uint16_t) CSI_RECORD_MAX_LEN}) {
+        size_t count = csi_packet_records_per_mtu(len);
+        make_records(gen, count, len, false, payloads, records);
+        size_t size = 0;
+        int64_t t0 = now_ns();
+        for (long i = 0; i < n; i++) {
+            size = encode(buf, (uint16_t) i, records);
+            asm volatile("" : : "r"(buf) : "memory"); // Keeps every datagram written
+        }
+        int64_t t1 = now_ns();
+        int64_t sum = 0;
+        for (long i = 0; i < n; i++) {
+            asm volatile("" : : "r"(buf) : "memory"); // And every one read again
+            csi_packet_reader_t rd;
+            csi_record_t r;
+            bool open = csi_packet_open(&rd, buf, size);
+            while (open && csi_packet_next(&rd, &r)) {
+                sum += r.data[r.len - 1];
+            }
+        }
+        int64_t t2 = now_ns();
+        bench_sink = sum;
+        double enc_ns = (double) (t1 - t0) / n, dec_ns = (double) (t2 - t1) / n;
+        char name[32];
+        snprintf(name, sizeof(name), "%u B", (unsigned) len);
+        printf("  %-26s %8zu %16.1f %16.1f %14.0f\n", name, count, enc_ns / count, dec_ns / count,
+               dec_ns > 0 ? size * 1e3 / dec_ns : 0.0);
+    }
+}
+
+int main(int argc, char **argv) {
+    long n = 100000;
+    uint64_t seed = 1;
+    int opt;
+    while ((opt = getopt(argc, argv, "n:S:")) != -1) {
+        switch (opt) {
+            case 'n': n = std::max(100L, atol(optarg)); break;
+            case 'S': seed = strtoull(optarg, NULL, 10); break;
+            default:
+                fprintf(stderr, "usage: %s [-n datagrams] [-S seed]\n", argv[0]);
+                return 1;
+        }
+    }
+
+    std::mt19937 gen((uint32_t) seed);
+    bool ok = check_round_trip(gen);
+    ok = check_rejects(gen) && ok;
+    time_codec(gen, n);
+
+    printf("\n%s\n", ok ? "OK" : "FAILED");
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,268 @@
+/*
+ * Receives the per-stage timing snapshots of profile_component.h and checks and times the profiler itself.
+ *
+ *   csi_profile listen [-p port]
+ *       print every snapshot a station sends (profile_send, the sketch's "PROFILE <ip> [port]")
+ *   csi_profile bench [-n iterations]
+ *       accuracy    cycles drawn from a few distributions: each percentile of the rolling histogram must
+ *                   bound the exact one of the window from above by at most 25 %, min, max and mean exact
+ *       export      a snapshot encoded, sent over loopback UDP and decoded must equal the profiler's state
+ *       timing      what recording adds to a cycle: a scope, a timed get_data call, the cycle's end, and
+ *                   the exports (with CONFIG_PROFILE 0 all of it compiles to nothing)
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <algorithm>
+#include <cmath>
+#include <functional>
+#include <random>
+#include <vector>
+
+#include "profile_component.h"
+#include "csi_bench.h"
+
+volatile int64_t bench_sink;
+int16_t bench_features[512];
+
+// What a get_data call does: copy a block of features
+int bench_get_data(size_t offset, size_t length, int16_t *out) {
+    memcpy(out, bench_features + offset, length * sizeof(int16_t));
+    return 0;
+}
+
+void print_snapshot(const profile_snapshot_t *snap, const char *from) {
+    printf("\nsnapshot %u from %s, up %.1f s, last %u cycles\n", (unsigned) snap->seq, from,
+           snap->uptime_us / 1e6, (unsigned) snap->window);
+    printf("  %-10s %8s %11s %9s %9s %9s %9s %9s\n", "stage", "cycles", "calls/cycle", "p50 us", "p90 us",
+           "p99 us", "max us", "mean us");
+    for (uint8_t i = 0; i < snap->stage_count; i++) {
+        const profile_summary_t *s = &snap->stages[i];
+        printf("  %-10s %8u %11.1f %9u %9u %9u %9u %9.1f\n", profile_stage_names[s->id], (unsigned) s->cycles,
+               s->cycles > 0 ? (double) s->calls / s->cycles : 0.0, (unsigned) profile_percentile(s, 0.5),
+               (unsigned) profile_percentile(s, 0.9), (unsigned) profile_percentile(s, 0.99),
+               (unsigned) s->max_us, s->samples > 0 ? (double) s->sum_us / s->samples : 0.0);
+    }
+}
+
+int listen_snapshots(int argc, char **argv) {
+    uint16_t port = PROFILE_UDP_PORT;
+    int opt;
+    while ((opt = getopt(argc, argv, "p:")) != -1) {
+        switch (opt) {
+            case 'p': port = (uint16_t) atoi(optarg); break;
+            default: return -1;
+        }
+    }
+
+    int fd = socket(PF_INET, SOCK_DGRAM, 0);
+    struct sockaddr_in addr = {};
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(port);
+    addr.sin_addr.s_addr = htonl(INADDR_ANY);
+    if (fd == -1 || bind(fd, (const struct sockaddr *) &addr, sizeof(addr)) == -1) {
+        printf("ERROR: cannot bind UDP %u [%s]\n", port, strerror(errno));
+        return 1;
+    }
+    printf("listening for profile snapshots on UDP %u\n", port);
+
+    uint8_t buf[PROFILE_SNAPSHOT_MAX];
+    profile_snapshot_t snap;
+    while (true) {
+        struct sockaddr_in from;
+        socklen_t from_len = sizeof(from);
+        ssize_t len = recvfrom(fd, buf, sizeof(buf), 0, (struct sockaddr *) &from, &from_len);
+        if (len < 0) {
+            printf("ERROR: recvfrom [%s]\n", strerror(errno));
+            return 1;
+        }
+        if (!profile_decode(buf, (size_t) len, &snap)) {
+            printf("ignored a %zd byte datagram from %s that is no snapshot\n", len, inet_ntoa(from.sin_addr));
+            continue;
+        }
+        print_snapshot(&snap, inet_ntoa(from.sin_addr));
+        fflush(stdout);
+    }
+}
+
+#if CONFIG_PROFILE
+
+struct distribution_t {
+    const char *name;
+    std::function<uint32_t(std::mt19937 &)> draw;
+};
+
+// The window's exact values against what the histogram says about them
+bool check_accuracy(std::mt19937 &gen) {
+    std::vector<distribution_t> distributions = {
+            {"constant 37 us", [](std::mt19937 &) { return 37u; }},
+            {"uniform 0-15 us", [](std::mt19937 &g) { return (uint32_t) (g() % 16); }},
+            {"uniform 100-5000 us", [](std::mt19937 &g) { return (uint32_t) (100 + g() % 4901); }},
+            {"lognormal around 2 ms", [](std::mt19937 &g) {
+                return (uint32_t) std::lognormal_distribution<double>(std::log(2000.0), 0.6)(g);
+            }},
+            {"bimodal 40 us / 80 ms", [](std::mt19937 &g) { return g() % 10 == 0 ? 80000u + g() % 1000 : 40u; }},
+    };
+
+    bool ok = true;
+    printf("\naccuracy (%d cycle window, after %d cycles)\n", PROFILE_WINDOW, 3 * PROFILE_WINDOW + 17);
+    for (const distribution_t &d : distributions) {
+        profile_reset();
+        std::vector<uint32_t> all;
+        for (int c = 0; c < 3 * PROFILE_WINDOW + 17; c++) {
+            // Split over several calls, as get_data is
+            uint32_t v = d.draw(gen);
+            profile_add(PROFILE_FETCH, v / 3);
+            profile_add(PROFILE_FETCH, v - v / 3);
+            profile_cycle_end();
+            all.push_back(v);
+        }
+        std::vector<uint32_t> window(all.end() - PROFILE_WINDOW, all.end());
+        std::sort(window.begin(), window.end());
+        uint64_t sum = 0;
+        for (uint32_t v : window) {
+            sum += v;
+        }
+
+        profile_summary_t s;
+        _profile_summarize(PROFILE_FETCH, &s);
+        bool good = s.samples == PROFILE_WINDOW && s.calls == 2 * all.size() && s.min_us == window.front() &&
+                    s.max_us == window.back() && s.sum_us == sum;
+        double worst = 0;
+        for (double q : {0.5, 0.9, 0.99}) {
+            uint32_t exact = window[(size_t) std::ceil(q * PROFILE_WINDOW) - 1];
+            uint32_t bound = profile_percentile(&s, q);
+            double over = exact > 0 ? (double) (bound - exact) / exact : bound;
+            worst = std::max(worst, over);
+            good = good && bound >= exact && over <= 0.25;
+        }
+        printf("  %-24s p50 %6u us (exact %6u), worst percentile %4.1f %% over %s\n", d.name,
+               (unsigned) profile_percentile(&s, 0.5), (unsigned) window[PROFILE_WINDOW / 2 - 1], 100 * worst,
+               good ? "OK" : "FAILED");
+        ok = ok && good;
+    }
+    return ok;
+}
+
+bool check_export() {
+    int rx = socket(PF_INET, SOCK_DGRAM, 0), tx = socket(PF_INET, SOCK_DGRAM, 0);
+    struct sockaddr_in addr = {};
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    socklen_t addr_len = sizeof(addr);
+    if (rx == -1 || tx == -1 || bind(rx, (const struct sockaddr *) &addr, sizeof(addr)) == -1 ||
+        getsockname(rx, (struct sockaddr *) &addr, &addr_len) == -1) {
+        printf("ERROR: cannot open loopback UDP [%s]\n", strerror(errno));
+        return false;
+    }
+
+    uint8_t buf[PROFILE_SNAPSHOT_MAX];
+    ssize_t len = -1;
+    profile_snapshot_t snap = {};
+    if (profile_send(tx, &addr)) {
+        len = recv(rx, buf, sizeof(buf), 0);
+    }
+    close(rx);
+    close(tx);
+
+    bool ok = len > 0 && profile_decode(buf, (size_t) len, &snap);
+    uint8_t ran = 0;
+    for (uint8_t id = 0; ok && id < PROFILE_STAGES; id++) {
+        if (profile.stages[id].samples == 0) {
+            continue;
+        }
+        profile_summary_t s;
+        _profile_summarize(id, &s);
+        const profile_summary_t *d = &snap.stages[ran++];
+        ok = ok && d->id == id && d->samples == s.samples && d->cycles == s.cycles && d->calls == s.calls &&
+             d->min_us == s.min_us && d->max_us == s.max_us && d->sum_us == s.sum_us &&
+             memcmp(d->counts, s.counts, sizeof(s.counts)) == 0;
+    }
+    ok = ok && ran == snap.stage_count;
+    char csv[2048];
+    profile_write_csv(csv, sizeof(csv));
+    printf("\nexport\n  %zd byte snapshot of %u stages over loopback UDP, decoded %s\n\n%s", len,
+           (unsigned) snap.stage_count, ok ? "OK" : "FAILED", csv);
+    return ok;
+}
+
+int bench(int argc, char **argv) {
+    long n = 200000;
+    int opt;
+    while ((opt = getopt(argc, argv, "n:")) != -1) {
+        switch (opt) {
+            case 'n': n = std::max(1000L, atol(optarg)); break;
+            default: return -1;
+        }
+    }
+
+    std::mt19937 gen(1);
+    bool ok = check_accuracy(gen);
+
+    // A cycle shaped like the sketch's: get_data once per block of a 387 feature signal, then the stages
+    profile_reset();
+    for (int c = 0; c < 200; c++) {
+        for (size_t o = 0; o < 387; o += 128) {
+            PROFILE_GET_DATA(int16_t, bench_get_data)(o, std::min((size_t) 128, 387 - o), bench_features);
+        }
+        profile_add(PROFILE_DSP, 150 + gen() % 40);
+        profile_add(PROFILE_INFERENCE, 900 + gen() % 300);
+        profile_add(PROFILE_CLASSIFIER, 1100 + gen() % 300);
+        profile_add(PROFILE_PUBLISH, 2500 + gen() % 900);
+        profile_add(PROFILE_CYCLE, 3800 + gen() % 1200);
+        profile_cycle_end();
+    }
+    ok = check_export() && ok;
+
+    bench_header("timing");
+    bench_run("empty block", n, [&](long i) { bench_sink = i; });
+    bench_run("PROFILE_SCOPE", n, [&](long i) {
+        PROFILE_SCOPE(PROFILE_POST);
+        bench_sink = i;
+    });
+    bench_run("get_data, 128 features", n, [&](long) { bench_sink = bench_get_data(0, 128, bench_features); });
+    bench_run("PROFILE_GET_DATA, 128 features", n, [&](long) {
+        bench_sink = PROFILE_GET_DATA(int16_t, bench_get_data)(0, 128, bench_features);
+    });
+    bench_run("profile_add", n, [&](long i) { profile_add(PROFILE_DSP, i & 1023); });
+    bench_run("profile_cycle_end, 8 stages", n / 10, [&](long i) {
+        for (uint8_t s = 0; s < PROFILE_STAGES; s++) {
+            profile_add(s, (i * 37 + s) & 4095);
+        }
+        profile_cycle_end();
+    });
+    uint8_t buf[PROFILE_SNAPSHOT_MAX];
+    char csv[2048];
+    bench_run("profile_encode", n / 100, [&](long) { bench_sink = profile_encode(buf, sizeof(buf)); });
+    bench_run("profile_write_csv", n / 100, [&](long) { bench_sink = profile_write_csv(csv, sizeof(csv)); });
+
+    printf("\n%s\n", ok ? "OK" : "FAILED");
+    return ok ? 0 : 1;
+}
+
+#else
+
+int bench(int, char **) {
+    printf("profiling compiled out (CONFIG_PROFILE 0), nothing to measure\n");
+    return 0;
+}
+
+#endif
+
+int main(int argc, char **argv) {
+    int rc = -1;
+    if (argc >= 2 && strcmp(argv[1], "listen") == 0) {
+        rc = listen_snapshots(argc - 1, argv + 1);
+    } else if (argc >= 2 && strcmp(argv[1], "bench") == 0) {
+        rc = bench(argc - 1, argv + 1);
+    }
+    if (rc < 0) {
+        fprintf(stderr, "usage: %s listen [-p port]\n"
+                        "       %s bench [-n iterations]\n", argv[0], argv[0]);
+        return 1;
+    }
+    return rc;
+}
@@ -0,0 +1,180 @@
+/*
+ * Compares the old SD logging path with the double-buffered writer (sd_writer_component.h) on a Linux file.
+ *
+ * old:  vfprintf into a FILE, and every -f lines sd_flush() as it was: fflush + fclose + fopen("a")
+ * new:  sd_writer_printf into the write buffers, a writer thread does one write() per full buffer and
+ *       syncs every -i ms
+ *
+ * With -l/-b both paths run on a backend that also sleeps like a slow card would: a fixed latency per
+ * write, sync and reopen, plus a bandwidth limit. The old path reaches it through fopencookie().
+ *
+ * The producer retries a line the writer had to drop, so the numbers are sustainable throughput; the
+ * retries are reported as stalls.
+ *
+ * usage: csi_sd_bench [-n lines] [-f lines_per_flush] [-i sync_ms] [-l write_latency_us] [-b card_MBps] [-o dir]
+ */
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE // fopencookie
+#endif
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <string>
+
+#include "sd_writer_component.h"
+
+typedef struct {
+    sd_writer_backend_t file;
+    int64_t latency_us;
+    double bytes_per_us;
+} slow_card_t;
+
+ssize_t slow_card_write(void *ctx, const void *buf, size_t size) {
+    slow_card_t *c = (slow_card_t *) ctx;
+    int64_t delay = c->latency_us + (c->bytes_per_us > 0 ? (int64_t) (size / c->bytes_per_us) : 0);
+    std::this_thread::sleep_for(std::chrono::microseconds(delay));
+    return c->file.write(c->file.ctx, buf, size);
+}
+
+int slow_card_sync(void *ctx) {
+    slow_card_t *c = (slow_card_t *) ctx;
+    std::this_thread::sleep_for(std::chrono::microseconds(c->latency_us));
+    return c->file.sync(c->file.ctx);
+}
+
+void slow_card_close(void *ctx) {
+    slow_card_t *c = (slow_card_t *) ctx;
+    c->file.close(c->file.ctx);
+}
+
+ssize_t cookie_write(void *ctx, const char *buf, size_t size) {
+    return slow_card_write(ctx, buf, size);
+}
+
+// fclose() as sd_flush() used it: the data is committed to the card
+int cookie_close(void *ctx) {
+    slow_card_sync(ctx);
+    slow_card_close(ctx);
+    return 0;
+}
+
+FILE *old_open(slow_card_t *card, const char *path) {
+    std::this_thread::sleep_for(std::chrono::microseconds(card->latency_us)); // Directory lookup
+    if (!sd_writer_open_file(&card->file, path)) {
+        exit(1);
+    }
+    cookie_io_functions_t io = {NULL, &cookie_write, NULL, &cookie_close};
+    return fopencookie(card, "a", io);
+}
+
+// One CSI line as the stations print it: metadata and 128 signed values
+std::string make_line(int i) {
+    std::string line = "CSI_DATA,AP" + std::to_string(i % 4) + ",AA:BB:CC:DD:EE:FF,-" + std::to_string(40 + i % 30) + ",11,1,";
+    line += std::to_string(i) + ",128,[";
+    for (int k = 0; k < 128; k++) {
+        line += std::to_string((i * 7 + k * 13) % 64 - 32);
+        line += k < 127 ? " " : "]\n";
+    }
+    return line;
+}
+
+double now_s() {
+    return _sd_writer_now_us() / 1e6;
+}
+
+int main(int argc, char **argv) {
+    int lines = 200000;
+    int lines_per_flush = 100;
+    int sync_ms = CONFIG_SD_FSYNC_INTERVAL_MS;
+    int64_t latency_us = 0;
+    double card_mbps = 0;
+    std::string dir = "/tmp";
+
+    int opt;
+    while ((opt = getopt(argc, argv, "n:f:i:l:b:o:")) != -1) {
+        switch (opt) {
+            case 'n': lines = atoi(optarg); break;
+            case 'f': lines_per_flush = atoi(optarg); break;
+            case 'i': sync_ms = atoi(optarg); break;
+            case 'l': latency_us = atoll(optarg); break;
+            case 'b': card_mbps = atof(optarg); break;
+            case 'o': dir = optarg; break;
+            default:
+                fprintf(stderr, "usage: %s [-n lines] [-f lines_per_flush] [-i sync_ms] [-l write_latency_us] [-b card_MBps] [-o dir]\n", argv[0]);
+                return 1;
+        }
+    }
+
+    std::string templates[64];
+    for (int i = 0; i < 64; i++) {
+        templates[i] = make_line(i);
+    }
+
+    slow_card_t card;
+    card.latency_us = latency_us;
+    card.bytes_per_us = card_mbps;
+
+    // Old path
+    std::string old_path = dir + "/csi_sd_bench_old.csv";
+    unlink(old_path.c_str());
+    FILE *f = old_open(&card, old_path.c_str());
+    uint64_t bytes = 0;
+    double start = now_s();
+    for (int i = 0; i < lines; i++) {
+        bytes += fprintf(f, "%s", templates[i % 64].c_str());
+        if ((i + 1) % lines_per_flush == 0) {
+            fflush(f);
+            fclose(f);
+            f = old_open(&card, old_path.c_str());
+        }
+    }
+    fclose(f);
+    double old_s = now_s() - start;
+
+    // New path
+    std::string new_path = dir + "/csi_sd_bench_new.csv";
+    unlink(new_path.c_str());
+    if (!sd_writer_open_file(&card.file, new_path.c_str())) {
+        return 1;
+    }
+    sd_writer_backend_t backend = card.file;
+    if (latency_us > 0 || card_mbps > 0) {
+        backend = {&card, &slow_card_write, &slow_card_sync, &slow_card_close};
+    }
+
+    sd_writer_t *w = new sd_writer_t();
+    sd_writer_start(w, &backend, sync_ms);
+    int64_t max_call_ns = 0;
+    uint64_t stalls = 0;
+    start = now_s();
+    for (int i = 0; i < lines; i++) {
+        auto t0 = std::chrono::steady_clock::now();
+        while (!sd_writer_printf(w, "%s", templates[i % 64].c_str())) {
+            stalls++;
+            std::this_thread::yield();
+        }
+        int64_t ns = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - t0).count();
+        if (ns > max_call_ns) {
+            max_call_ns = ns;
+        }
+    }
+    double produce_s = now_s() - start;
+    sd_writer_flush(w);
+    double new_s = now_s() - start;
+    sd_writer_stats_t stats;
+    sd_writer_get_stats(w, &stats);
+    sd_writer_stop(w);
+    delete w;
+
+    printf("%d lines, %.1f MB, write buffers 2 x %d KB\n", lines, bytes / 1e6, SD_WRITER_BUFFER_SIZE / 1024);
+    printf("old vfprintf + close/reopen every %d lines: %7.1f MB/s  %6.0f ns/line\n",
+           lines_per_flush, bytes / 1e6 / old_s, old_s * 1e9 / lines);
+    printf("double-buffered writer, sync every %d ms:   %7.1f MB/s  %6.0f ns/line (max %lld ns)\n",
+           sync_ms, stats.written_bytes / 1e6 / new_s, produce_s * 1e9 / lines, (long long) max_call_ns);
+    printf("  writes %llu (%.0f KB each)  syncs %llu  stalls %llu  max write %lld us  max sync %lld us\n",
+           (unsigned long long) stats.writes, stats.writes > 0 ? stats.written_bytes / 1024.0 / stats.writes : 0.0,
+           (unsigned long long) stats.syncs, (unsigned long long) stalls,
+           (long long) stats.max_write_us, (long long) stats.max_sync_us);
+    return 0;
+}
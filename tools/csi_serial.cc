@@ -0,0 +1,438 @@
+/*
+ * Reads the binary CSI stream a station sends over serial with CONFIG_SERIAL_BINARY_CSI
+ * (serial_frame_component.h).
+ *
+ *   csi_serial read [-b baud] [-o capture.csi] [-q] <tty>
+ *       decode frames from a serial port, print the log lines that come between them to stderr and write the
+ *       records to a binary capture (capture_component.h, readable with csi_capture). Ctrl-C finishes the
+ *       capture. Every second a status line shows records/s and frames lost or broken.
+ *   csi_serial bench [-n records] [-c corrupt_per_byte] [-l log_every] [-b baud]
+ *       stream records through a pty pair with the station's serial link on one end and the decoder on the
+ *       other, with log lines written to the same port in between. On a clean wire (the default) every log
+ *       line must arrive and no frame may fail its CRC; with -c bytes are corrupted on the way, and every
+ *       frame must be either delivered intact or counted as lost. Reports records/s, the cost of submitting
+ *       a record against formatting the old text line, and the rates both formats reach at `baud`.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <pty.h>
+#include <signal.h>
+#include <termios.h>
+#include <atomic>
+#include <chrono>
+#include <random>
+#include <sstream>
+#include <string>
+
+#include "serial_frame_component.h"
+
+double now_s() {
+    return std::chrono::duration<double>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+speed_t baud_constant(int baud) {
+    switch (baud) {
+        case 115200: return B115200;
+        case 230400: return B230400;
+        case 460800: return B460800;
+        case 921600: return B921600;
+        case 1000000: return B1000000;
+        case 1500000: return B1500000;
+        case 2000000: return B2000000;
+        case 3000000: return B3000000;
+        default: return 0;
+    }
+}
+
+// Byte stream like the UART: no echo, no line editing, no translation of 0x00 or \r
+bool set_raw(int fd, int baud) {
+    struct termios t;
+    if (tcgetattr(fd, &t) == -1) {
+        printf("ERROR: tcgetattr [%s]\n", strerror(errno));
+        return false;
+    }
+    cfmakeraw(&t);
+    if (baud > 0) {
+        speed_t speed = baud_constant(baud);
+        if (speed == 0) {
+            printf("ERROR: unsupported baud rate %d\n", baud);
+            return false;
+        }
+        cfsetispeed(&t, speed);
+        cfsetospeed(&t, speed);
+    }
+    return tcsetattr(fd, TCSANOW, &t) == 0;
+}
+
+typedef struct {
+    FILE *file;
+    capture_writer_t *capture;
+    bool capture_started;
+    bool quiet;
+    uint64_t records;
+    char ap_names[CAPTURE_MAX_APS][CAPTURE_AP_NAME_LEN]; // Names announced before the first record
+} reader_t;
+
+bool file_sink(void *ctx, const void *data, size_t size) {
+    return fwrite(data, 1, size, (FILE *) ctx) == size;
+}
+
+void reader_record(void *ctx, const csi_record_t *r) {
+    reader_t *rd = (reader_t *) ctx;
+    rd->records++;
+    if (rd->capture == NULL) {
+        return;
+    }
+    if (!rd->capture_started) {
+        capture_writer_begin(rd->capture, CAPTURE_CHUNK_SIZE, r->device_id, r->timestamp_us, &file_sink, rd->file);
+        rd->capture_started = true;
+        for (uint8_t id = 0; id < CAPTURE_MAX_APS; id++) {
+            if (rd->ap_names[id][0] != '\0') {
+                capture_writer_set_ap(rd->capture, id, rd->ap_names[id]);
+            }
+        }
+    }
+    capture_writer_append(rd->capture, r);
+}
+
+void reader_ap(void *ctx, uint8_t ap_id, const char *name) {
+    reader_t *rd = (reader_t *) ctx;
+    if (rd->capture != NULL && rd->capture_started) {
+        capture_writer_set_ap(rd->capture, ap_id, name);
+    } else if (ap_id < CAPTURE_MAX_APS) {
+        snprintf(rd->ap_names[ap_id], CAPTURE_AP_NAME_LEN, "%s", name);
+    }
+}
+
+void reader_text(void *ctx, const char *text, size_t len) {
+    if (!((reader_t *) ctx)->quiet) {
+        fwrite(text, 1, len, stderr);
+    }
+}
+
+std::atomic<bool> running{true};
+
+void handle_signal(int) {
+    running = false;
+}
+
+int read_tty(int argc, char **argv) {
+    int baud = CONFIG_SERIAL_CSI_BAUD;
+    const char *out = NULL;
+    bool quiet = false;
+    int opt;
+    while ((opt = getopt(argc, argv, "b:o:q")) != -1) {
+        switch (opt) {
+            case 'b': baud = atoi(optarg); break;
+            case 'o': out = optarg; break;
+            case 'q': quiet = true; break;
+            default: return -1;
+        }
+    }
+    if (optind >= argc) {
+        return -1;
+    }
+
+    int fd = open(argv[optind], O_RDONLY | O_NOCTTY);
+    if (fd == -1) {
+        printf("ERROR: cannot open %s [%s]\n", argv[optind], strerror(errno));
+        return 1;
+    }
+    if (!set_raw(fd, baud)) {
+        return 1;
+    }
+
+    reader_t rd = {};
+    rd.quiet = quiet;
+    if (out != NULL) {
+        rd.file = fopen(out, "wb");
+        if (rd.file == NULL) {
+            printf("ERROR: cannot create %s [%s]\n", out, strerror(errno));
+            return 1;
+        }
+        rd.capture = new capture_writer_t();
+    }
+    serial_handlers_t handlers = {&reader_record, &reader_ap, &reader_text, &rd};
+    serial_decoder_t *d = new serial_decoder_t();
+    serial_decoder_init(d);
+    signal(SIGINT, handle_signal);
+    signal(SIGTERM, handle_signal);
+
+    uint8_t buf[4096];
+    double last_report = now_s();
+    uint64_t last_records = 0;
+    while (running) {
+        struct pollfd p = {fd, POLLIN, 0};
+        if (poll(&p, 1, 200) > 0) {
+            ssize_t n = read(fd, buf, sizeof(buf));
+            if (n <= 0) {
+                break; // Device unplugged
+            }
+            serial_decoder_feed(d, buf, n, &handlers);
+        }
+        double now = now_s();
+        if (now - last_report >= 1.0) {
+            fprintf(stderr, "[csi_serial] %.0f records/s, %llu records, %llu lost, %llu crc errors, %llu bad frames\n",
+                    (rd.records - last_records) / (now - last_report), (unsigned long long) rd.records,
+                    (unsigned long long) d->stats.lost, (unsigned long long) d->stats.crc_errors,
+                    (unsigned long long) d->stats.bad_frames);
+            last_report = now;
+            last_records = rd.records;
+        }
+    }
+
+    if (rd.capture != NULL) {
+        if (rd.capture_started) {
+            capture_writer_finish(rd.capture);
+        }
+        fclose(rd.file);
+        delete rd.capture;
+    }
+    printf("%llu records in %llu frames, %llu lost, %llu crc errors, %llu bad frames, %llu resyncs, %llu text bytes\n",
+           (unsigned long long) rd.records, (unsigned long long) d->stats.frames, (unsigned long long) d->stats.lost,
+           (unsigned long long) d->stats.crc_errors, (unsigned long long) d->stats.bad_frames,
+           (unsigned long long) d->stats.resyncs, (unsigned long long) d->stats.text_bytes);
+    delete d;
+    close(fd);
+    return 0;
+}
+
+void fill_payload(int8_t *payload, size_t len, uint32_t seq) {
+    for (size_t k = 0; k < len; k++) {
+        payload[k] = (int8_t) (((seq * 7 + k) & 0x3F) - 32);
+    }
+}
+
+// The text line _wifi_csi_cb prints, built the same way
+std::string text_line(const csi_record_t *r) {
+    std::stringstream ss;
+    ss << "AP1" << "," << (int) r->rssi << "," << 384 << ",[";
+    for (int i = 0; i < r->len; i++) {
+        ss << (int) r->data[i] << " ";
+    }
+    ss << "]\n";
+    return ss.str();
+}
+
+typedef struct {
+    int in; // Read end of the pipe the link writes to
+    int out; // pty slave
+    double corrupt;
+    std::atomic<uint64_t> corrupted{0};
+} relay_t;
+
+// The wire: passes bytes on, flipping a few of them
+void relay_loop(relay_t *r) {
+    std::mt19937_64 rng(9);
+    std::geometric_distribution<uint64_t> gap(r->corrupt > 0 ? r->corrupt : 1e-18);
+    uint64_t next = gap(rng);
+    uint8_t buf[4096];
+    while (true) {
+        ssize_t n = read(r->in, buf, sizeof(buf));
+        if (n <= 0) {
+            break;
+        }
+        while (r->corrupt > 0 && next < (uint64_t) n) {
+            buf[next] ^= (uint8_t) (1 + rng() % 255);
+            r->corrupted++;
+            next += 1 + gap(rng);
+        }
+        next -= r->corrupt > 0 ? n : 0;
+        for (ssize_t done = 0; done < n;) {
+            ssize_t w = write(r->out, buf + done, n - done);
+            if (w <= 0) {
+                return;
+            }
+            done += w;
+        }
+    }
+}
+
+typedef struct {
+    uint64_t records;
+    uint64_t bad_payloads;
+    uint64_t text_lines;
+} bench_reader_t;
+
+void bench_record(void *ctx, const csi_record_t *r) {
+    bench_reader_t *b = (bench_reader_t *) ctx;
+    int8_t expected[CSI_RECORD_MAX_LEN];
+    fill_payload(expected, r->len, r->seq);
+    b->records++;
+    if (memcmp(expected, r->data, r->len) != 0) {
+        b->bad_payloads++;
+    }
+}
+
+void bench_text(void *ctx, const char *text, size_t len) {
+    for (size_t i = 0; i < len; i++) {
+        ((bench_reader_t *) ctx)->text_lines += text[i] == '\n';
+    }
+}
+
+int bench(int argc, char **argv) {
+    int records = 200000;
+    double corrupt = 0;
+    int log_every = 100;
+    int baud = CONFIG_SERIAL_CSI_BAUD;
+    int opt;
+    while ((opt = getopt(argc, argv, "n:c:l:b:")) != -1) {
+        switch (opt) {
+            case 'n': records = atoi(optarg); break;
+            case 'c': corrupt = atof(optarg); break;
+            case 'l': log_every = atoi(optarg); break;
+            case 'b': baud = atoi(optarg); break;
+            default:
+                fprintf(stderr, "usage: csi_serial bench [-n records] [-c corrupt_per_byte] [-l log_every] [-b baud]\n");
+                return 1;
+        }
+    }
+
+    int master, slave, wire[2];
+    if (openpty(&master, &slave, NULL, NULL, NULL) == -1 || pipe(wire) == -1) {
+        printf("ERROR: openpty [%s]\n", strerror(errno));
+        return 1;
+    }
+    set_raw(slave, 0);
+    set_raw(master, 0);
+
+    relay_t relay;
+    relay.in = wire[0];
+    relay.out = slave;
+    relay.corrupt = corrupt;
+    std::thread relay_thread(relay_loop, &relay);
+
+    serial_link_t *link = new serial_link_t();
+    serial_link_start(link, wire[1]);
+
+    // Decoder on the other end of the pty, until the link has gone quiet
+    bench_reader_t reader = {0, 0, 0};
+    serial_handlers_t handlers = {&bench_record, NULL, &bench_text, &reader};
+    serial_decoder_t *d = new serial_decoder_t();
+    serial_decoder_init(d);
+    d->synced = true; // The stream starts at seq 0, so a lost first frame counts too
+    std::atomic<bool> producing{true};
+    std::thread decoder_thread([&] {
+        uint8_t buf[4096];
+        while (true) {
+            struct pollfd p = {master, POLLIN, 0};
+            if (poll(&p, 1, 300) <= 0) {
+                if (!producing) {
+                    break;
+                }
+                continue;
+            }
+            ssize_t n = read(master, buf, sizeof(buf));
+            if (n <= 0) {
+                break;
+            }
+            serial_decoder_feed(d, buf, n, &handlers);
+        }
+    });
+
+    // Producer: records as fast as the link takes them, log lines written to the same port in between
+    int8_t payload[128]; // LLTF, what the station streams
+    csi_record_t r = {0, 1700000000000000LL, 42, 0, -50, CSI_RECORD_FLAG_RAW, sizeof(payload), payload, 0, 0, 0, 0};
+    double submit_s = 0;
+    uint64_t logs = 0;
+    double start = now_s();
+    for (int i = 0; i < records; i++) {
+        r.seq = i;
+        r.timestamp_us += 10000;
+        r.ap_id = i % 3;
+        fill_payload(payload, sizeof(payload), r.seq);
+        double t = now_s();
+        serial_link_submit(link, &r, r.ap_id == 0 ? "AP1" : r.ap_id == 1 ? "AP2" : "AP3");
+        submit_s += now_s() - t;
+        if (log_every > 0 && i % log_every == 0) {
+            char line[96];
+            int len = snprintf(line, sizeof(line), "I (%d) wifi station: SSID: AP%d\n", i / 10, i % 3 + 1);
+            if (write(wire[1], line, len) == len) {
+                logs++;
+            }
+        }
+        if (i % 64 == 0) {
+            std::this_thread::yield(); // Let the writer run on a single core
+        }
+    }
+    while (true) {
+        std::lock_guard<std::mutex> lock(link->mutex);
+        if (link->count == 0) {
+            break;
+        }
+    }
+    double produce_s = now_s() - start;
+    producing = false;
+    decoder_thread.join();
+    double total_s = now_s() - start;
+    serial_link_stop(link);
+    close(wire[1]);
+    relay_thread.join();
+
+    serial_link_stats_t ls;
+    serial_link_get_stats(link, &ls);
+    uint64_t detected = d->stats.lost + (link->seq - d->next_seq); // Gaps, plus frames missing at the end
+    uint64_t missing = ls.submitted - d->stats.frames;
+
+    // The callback's cost for the old text line: formatting only, the UART time comes on top
+    double text_s = now_s();
+    size_t text_bytes = 0;
+    for (int i = 0; i < 20000; i++) {
+        r.seq = i;
+        text_bytes += text_line(&r).size();
+    }
+    text_s = (now_s() - text_s) / 20000;
+    size_t text_size = text_bytes / 20000;
+    size_t frame_size = (size_t) ls.bytes / ls.written; // Includes the AP frames, amortized
+
+    printf("%d records of %zu bytes through a pty, %.1e corruptions/byte (%llu flipped), a log line every %d records\n",
+           records, sizeof(payload), corrupt, (unsigned long long) relay.corrupted.load(), log_every);
+    printf("link: %llu frames submitted, %llu dropped (buffer full), %.1f MB written in %.2f s\n",
+           (unsigned long long) ls.submitted, (unsigned long long) ls.dropped, ls.bytes / 1e6, produce_s);
+    printf("decoder: %llu records (%.0f/s), %llu crc errors, %llu bad frames, %llu log lines of %llu\n",
+           (unsigned long long) reader.records, reader.records / total_s, (unsigned long long) d->stats.crc_errors,
+           (unsigned long long) d->stats.bad_frames, (unsigned long long) reader.text_lines, (unsigned long long) logs);
+    printf("loss: %llu frames missing, %llu detected by seq, %llu delivered with a wrong payload\n",
+           (unsigned long long) missing, (unsigned long long) detected, (unsigned long long) reader.bad_payloads);
+    printf("callback cost: submit %.2f us/record, text line formatting %.2f us/record\n", submit_s / records * 1e6,
+           text_s * 1e6);
+    printf("at %d baud: text %zu bytes/record -> %.0f records/s, binary %zu bytes/record -> %.0f records/s\n", baud,
+           text_size, baud / 10.0 / text_size, frame_size, baud / 10.0 / frame_size);
+    if (baud != 115200) {
+        printf("at 115200 baud: text %.0f records/s, binary %.0f records/s\n", 11520.0 / text_size, 11520.0 / frame_size);
+    }
+
+    bool ok = detected == missing && reader.bad_payloads == 0 && reader.records > 0;
+    if (corrupt > 0) {
+        printf("%s\n", ok ? "every frame delivered intact or counted as lost" : "FAILED");
+    } else {
+        // Nothing on the wire breaks a frame, so a CRC error can only be text written into one
+        ok = ok && d->stats.crc_errors == 0 && d->stats.bad_frames == 0 && reader.text_lines == logs;
+        printf("%s\n", ok ? "every log line and frame intact on a clean wire" : "FAILED");
+    }
+    delete d;
+    delete link;
+    close(master);
+    close(slave);
+    close(wire[0]);
+    return ok ? 0 : 1;
+}
+
+int main(int argc, char **argv) {
+    int rc = -1;
+    if (argc >= 2 && strcmp(argv[1], "read") == 0) {
+        rc = read_tty(argc - 1, argv + 1);
+    } else if (argc >= 2 && strcmp(argv[1], "bench") == 0) {
+        rc = bench(argc - 1, argv + 1);
+    }
+    if (rc < 0) {
+        fprintf(stderr, "usage: %s read [-b baud] [-o capture.csi] [-q] <tty> | bench [-n records] [-c corrupt_per_byte] "
+                        "[-l log_every] [-b baud]\n", argv[0]);
+        return 1;
+    }
+    return rc;
+}
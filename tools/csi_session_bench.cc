@@ -0,0 +1,167 @@
+/*
+ * Boot-to-first-write latency of the SD session selection on a host directory with thousands of sessions.
+ *
+ * old:      stat() <n>.csv from 0 upward until one is missing, as _sd_pick_next_file did
+ * manifest: session_open() with the SESSION.A/B manifest (session_component.h)
+ * rebuild:  session_open() after both manifest copies were deleted (one directory scan)
+ *
+ * Each measurement ends with the first record written to the new file. A last run checks the rotation:
+ * with a size limit the oldest sessions must go and the total must fit.
+ *
+ * usage: csi_session_bench [-n sessions] [-s session_bytes] [-o dir]
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <chrono>
+#include <string>
+#include <vector>
+
+#include "session_component.h"
+
+double now_us() {
+    return std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+void write_first_record(const char *path) {
+    int fd = open(path, O_WRONLY | O_CREAT | O_APPEND, 0644);
+    char record[CSI_RECORD_HEADER_SIZE + 128] = {0};
+    if (fd < 0 || write(fd, record, sizeof(record)) != (ssize_t) sizeof(record)) {
+        fprintf(stderr, "ERROR: cannot write %s\n", path);
+        exit(1);
+    }
+    close(fd);
+}
+
+void make_sessions(const std::string &dir, const char *ext, int sessions, size_t bytes) {
+    std::vector<char> data(bytes, 'x');
+    for (int i = 0; i < sessions; i++) {
+        std::string path = dir + "/" + std::to_string(i) + "." + ext;
+        FILE *f = fopen(path.c_str(), "wb");
+        fwrite(data.data(), 1, data.size(), f);
+        fclose(f);
+    }
+}
+
+void remove_dir(const std::string &dir) {
+    DIR *d = opendir(dir.c_str());
+    if (d == NULL) {
+        return;
+    }
+    struct dirent *entry;
+    while ((entry = readdir(d)) != NULL) {
+        if (entry->d_name[0] != '.') {
+            unlink((dir + "/" + entry->d_name).c_str());
+        }
+    }
+    closedir(d);
+    rmdir(dir.c_str());
+}
+
+int main(int argc, char **argv) {
+    int sessions = 5000;
+    size_t session_bytes = 4096;
+    std::string base = "/tmp";
+
+    int opt;
+    while ((opt = getopt(argc, argv, "n:s:o:")) != -1) {
+        switch (opt) {
+            case 'n': sessions = atoi(optarg); break;
+            case 's': session_bytes = strtoull(optarg, NULL, 10); break;
+            case 'o': base = optarg; break;
+            default:
+                fprintf(stderr, "usage: %s [-n sessions] [-s session_bytes] [-o dir]\n", argv[0]);
+                return 1;
+        }
+    }
+
+    std::string dir = base + "/csi_session_bench";
+    remove_dir(dir);
+    mkdir(dir.c_str(), 0755);
+    make_sessions(dir, "csv", sessions, session_bytes);
+    make_sessions(dir, "csi", sessions, session_bytes);
+
+    // Old: linear stat() scan
+    double start = now_us();
+    char path[SESSION_PATH_LEN];
+    struct stat st;
+    int i = 0;
+    while (true) {
+        snprintf(path, sizeof(path), "%s/%i.csv", dir.c_str(), i);
+        if (stat(path, &st) != 0) {
+            break;
+        }
+        i++;
+    }
+    write_first_record(path);
+    double old_us = now_us() - start;
+
+    // Manifest missing: scanned once
+    session_store_t store;
+    start = now_us();
+    if (!session_open(&store, dir.c_str(), "csi", 0, 0, path)) {
+        return 1;
+    }
+    write_first_record(path);
+    double rebuild_us = now_us() - start;
+    bool rebuilt = store.rebuilt;
+    std::string rebuilt_path = path;
+
+    // Manifest present
+    start = now_us();
+    if (!session_open(&store, dir.c_str(), "csi", 0, 0, path)) {
+        return 1;
+    }
+    write_first_record(path);
+    double manifest_us = now_us() - start;
+
+    printf("%d sessions on disk\n", sessions);
+    printf("old stat() scan:      %10.1f us to first write (%d stat calls)\n", old_us, i + 1);
+    printf("manifest rebuild:     %10.1f us to first write (%s -> %s)\n", rebuild_us, rebuilt ? "scanned" : "not scanned",
+           rebuilt_path.c_str() + dir.size() + 1);
+    printf("manifest:             %10.1f us to first write (%s)\n", manifest_us, path + dir.size() + 1);
+
+    // A torn manifest write: the newer copy is corrupt, the older one must be used
+    char manifest[SESSION_PATH_LEN];
+    _session_manifest_path(&store, store.slot, manifest);
+    FILE *f = fopen(manifest, "r+b");
+    fseek(f, 10, SEEK_SET);
+    fputc(0xFF, f);
+    fclose(f);
+    uint32_t expected = store.manifest.next - 1; // The older copy still points at the previous session
+    session_open(&store, dir.c_str(), "csi", 0, 0, path);
+    printf("torn manifest: fell back to the older copy, session %s (expected %u.csi)\n", path + dir.size() + 1,
+           (unsigned) expected);
+
+    // Rotation: keep at most a quarter of the sessions
+    uint64_t limit = (uint64_t) sessions / 4 * session_bytes;
+    start = now_us();
+    session_open(&store, dir.c_str(), "csi", limit, session_bytes, path);
+    double rotate_us = now_us() - start;
+    uint32_t deleted = store.deleted;
+    write_first_record(path);
+    start = now_us();
+    session_open(&store, dir.c_str(), "csi", limit, session_bytes, path);
+    double steady_us = now_us() - start;
+
+    uint64_t on_disk = 0;
+    int files = 0;
+    DIR *d = opendir(dir.c_str());
+    struct dirent *entry;
+    while ((entry = readdir(d)) != NULL) {
+        if (_session_number(entry->d_name, "csi") >= 0) {
+            stat((dir + "/" + entry->d_name).c_str(), &st);
+            on_disk += st.st_size;
+            files++;
+        }
+    }
+    closedir(d);
+    printf("rotation to %llu bytes: deleted %u sessions in %.1f us, next start %.1f us (deleted %u), "
+           "%d sessions / %llu bytes left %s\n",
+           (unsigned long long) limit, (unsigned) deleted, rotate_us, steady_us, (unsigned) store.deleted, files,
+           (unsigned long long) on_disk, on_disk + session_bytes <= limit + CSI_RECORD_HEADER_SIZE + 128 ? "(fits)" : "(OVER LIMIT)");
+
+    remove_dir(dir);
+    return 0;
+}
@@ -0,0 +1,343 @@
+/*
+ * Benchmarks the station's per-frame code natively. training/vs_for_automatic_training/_components builds
+ * for Linux through hal_component.h; synthetic frames (csi_synth.h) go in through hal_csi_inject, which
+ * calls the station's own _wifi_csi_cb as the Wi-Fi task would.
+ *
+ *   callback     _wifi_csi_cb per frame: UDP queue only, UDP queue and SD capture, and the first frame of
+ *                an AP, whose text line is handed to the log task
+ *   formatting   _csi_text_render, the text line of a frame
+ *   parsing      collect_all_csi_data over one line per AP, and a command line through command_dispatch; a
+ *                line formatted after its round was reset must not be stored
+ *   storage      sd_capture_record into the SD writer, with a directory (csi_bench_sdcard in the working
+ *                directory) standing in for the card; a few records must reach the file with the next
+ *                periodic sync, and sd_deinit while records keep arriving must leave a capture whose
+ *                index and chunks all read back
+ *   sockets      _build_csi_packet + transmitter_submit per datagram, sent over loopback to a receiver that
+ *                decodes them
+ *
+ * usage: csi_station_bench [-n iterations] [-a aps] [-S seed]
+ */
+#define CONFIG_CSI_DEVICE_ID 7
+#define CONFIG_CSI_COMPRESSION 1
+#define CONFIG_SEND_CSI_TO_SD 1
+#define CONFIG_SD_BINARY_CAPTURE 1
+#define CONFIG_SD_MAX_CAPTURE_MB 64
+#define CONFIG_SD_FSYNC_INTERVAL_MS 100
+#define CONFIG_HAL_FS_ROOT "csi_bench_sdcard"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <atomic>
+#include <thread>
+#include <vector>
+
+#include "csi_synth.h"
+#include "sockets_component.h"
+#include "sd_component.h"
+#include "csi_bench.h"
+
+typedef struct {
+    wifi_csi_info_t info;
+    int8_t buf[3 * SYNTH_LTF_BYTES];
+} frame_t;
+
+bool always_connected() {
+    return true;
+}
+
+void count_output(void *ctx, const char *, size_t len) {
+    *(uint64_t *) ctx += len;
+}
+
+// Frames generated up front, so the generator's cost stays out of the measurements
+std::vector<frame_t> make_frames(synth_t *s, size_t n) {
+    std::vector<frame_t> frames(n);
+    for (size_t i = 0; i < n; i++) {
+        const wifi_csi_info_t *info = synth_next(s);
+        frames[i].info = *info;
+        memcpy(frames[i].buf, info->buf, info->len);
+    }
+    for (frame_t &f : frames) {
+        f.info.buf = f.buf;
+    }
+    return frames;
+}
+
+typedef struct {
+    int fd;
+    std::atomic<bool> running;
+    uint64_t datagrams;
+    uint64_t records;
+    uint64_t malformed;
+} receiver_t;
+
+void receiver_loop(receiver_t *r) {
+    uint8_t buf[CSI_PACKET_MTU];
+    while (r->running) {
+        ssize_t n = recv(r->fd, buf, sizeof(buf), 0);
+        if (n <= 0) {
+            continue; // Timeout, check running
+        }
+        csi_packet_reader_t rd;
+        csi_record_t record;
+        if (!csi_packet_open(&rd, buf, (size_t) n)) {
+            r->malformed++;
+            continue;
+        }
+        r->datagrams++;
+        while (csi_packet_next(&rd, &record)) {
+            r->records++;
+        }
+    }
+}
+
+int main(int argc, char **argv) {
+    long n = 20000;
+    int aps = 3;
+    uint64_t seed = 1;
+
+    int opt;
+    while ((opt = getopt(argc, argv, "n:a:S:")) != -1) {
+        switch (opt) {
+            case 'n': n = std::max(100L, atol(optarg)); break;
+            case 'a': aps = std::max(1, std::min(SYNTH_MAX_APS, atoi(optarg))); break;
+            case 'S': seed = strtoull(optarg, NULL, 10); break;
+            default:
+                fprintf(stderr, "usage: %s [-n iterations] [-a aps] [-S seed]\n", argv[0]);
+                return 1;
+        }
+    }
+
+    synth_t *s = new synth_t();
+    synth_init(s, seed);
+    for (int i = 0; i < aps; i++) {
+        char name[16];
+        snprintf(name, sizeof(name), "AP%d", i + 1);
+        synth_add_ap(s, name, 4 * cos(2 * M_PI * i / aps), 4 * sin(2 * M_PI * i / aps), 6, 100);
+    }
+    synth_add_scatterers(s, 12, 0.6, -5, -5, 5, 5);
+    synth_set_position(s, 0.5, 0.5);
+    std::vector<frame_t> frames = make_frames(s, 1024);
+    printf("%ld iterations per row, %d APs, %u byte frames (seed %llu)\n", n, aps, (unsigned) frames[0].info.len,
+           (unsigned long long) seed);
+
+    uint64_t log_bytes = 0;
+    log_start(&log_ring, &count_output, &log_bytes);
+    csi_init((char *) "STA");
+    get_AP(s->aps[0].name);
+    char note[160];
+
+    bench_header("callback (hal_csi_inject -> _wifi_csi_cb)");
+    csi_sinks = CSI_SINK_UDP;
+    data_collected = true;
+    uint32_t dropped_before = csi_stream_dropped;
+    std::vector<int64_t> ns = bench_samples(n, [&](long i) {
+        hal_csi_inject(&frames[i % frames.size()].info);
+    });
+    snprintf(note, sizeof(note), "%u records overwritten in the full queue", csi_stream_dropped - dropped_before);
+    bench_report("UDP queue", ns, note);
+
+    bool sd_ok = false;
+    sd_init();
+    if (sd_writer_ready) {
+        sd_ok = true;
+        csi_record_sink = &sd_capture_record;
+        csi_sinks = CSI_SINK_UDP | CSI_SINK_SD;
+        bench_run("UDP queue + SD capture", n, [&](long i) {
+            hal_csi_inject(&frames[i % frames.size()].info);
+        }, filename);
+        csi_record_sink = NULL;
+    } else {
+        printf("  UDP queue + SD capture: skipped, %s could not be opened\n", HAL_FS_ROOT);
+    }
+
+    csi_sinks = CSI_SINK_UDP;
+    log_stats_t log_before, log_after;
+    log_get_stats(&log_ring, &log_before);
+    ns = bench_samples(n, [&](long i) {
+        data_collected = false; // As after get_AP
+        hal_csi_inject(&frames[i % frames.size()].info);
+    });
+    log_flush(&log_ring);
+    log_get_stats(&log_ring, &log_after);
+    snprintf(note, sizeof(note), "%llu text lines formatted by the log task",
+             (unsigned long long) (log_after.emitted - log_before.emitted));
+    bench_report("first frame of an AP (text line)", ns, note);
+    data_collected = true;
+
+    bench_header("formatting");
+    csi_text_slot_t *slot = &csi_text_slots[0];
+    slot->ap_name = s->aps[0].name;
+    slot->rssi = frames[0].info.rx_ctrl.rssi;
+    slot->len = frames[0].info.len;
+    memcpy(slot->buf, frames[0].buf, CSI_STREAM_LEN);
+    char line[LOG_LINE_MAX];
+    size_t line_len = 0;
+    csi_sinks = CSI_SINK_SERIAL | CSI_SINK_UDP; // The line is only returned for the serial sink
+    bench_run("_csi_text_render", n, [&](long) {
+        slot->busy = true;
+        slot->cycle = csi_cycle;
+        line_len = _csi_text_render(slot, line, sizeof(line));
+        if (csi_line_count == CSI_MAX_LINES) {
+            csi_cycle_reset();
+        }
+    });
+    printf("  %zu byte line: %.60s...\n", line_len, line);
+    csi_sinks = CSI_SINK_UDP;
+
+    bench_header("parsing");
+    csi_cycle_reset();
+    for (int i = 0; i < aps; i++) { // One line per AP, as after a cycle
+        slot->busy = true;
+        slot->cycle = csi_cycle;
+        _csi_text_render(slot, line, sizeof(line));
+    }
+    fflush(stdout);
+    int saved_stdout = dup(STDOUT_FILENO);
+    int null_fd = open("/dev/null", O_WRONLY);
+    dup2(null_fd, STDOUT_FILENO); // collect_all_csi_data prints the CSI_DATA line
+    ns = bench_samples(n / 10, [&](long) {
+        collect_all_csi_data();
+    });
+    fflush(stdout);
+    dup2(saved_stdout, STDOUT_FILENO);
+    close(null_fd);
+    close(saved_stdout);
+    snprintf(note, sizeof(note), "%d lines, %zu values", aps, all_csi_data_count);
+    bench_report("collect_all_csi_data", ns, note);
+    csi_cycle_reset();
+
+    // A frame captured before csi_cycle_reset whose line is formatted after it
+    slot->busy = true;
+    slot->cycle = csi_cycle;
+    csi_cycle_reset();
+    _csi_text_render(slot, line, sizeof(line));
+    bool stale_ok = csi_line_count == 0;
+    printf("  line of a round reset before it was formatted is not stored: %s\n", stale_ok ? "OK" : "FAILED");
+
+    register_station_commands();
+    char command[64], reply[COMMAND_REPLY_MAX];
+    bench_run("command_dispatch \"RATE 100\"", n, [&](long) {
+        strcpy(command, "RATE 100");
+        command_dispatch(command, reply, sizeof(reply));
+    }, reply);
+
+    bench_header("storage");
+    bool storage_ok = true;
+    if (sd_ok) {
+        csi_record_t record = {};
+        record.device_id = csi_device_id;
+        record.len = CSI_STREAM_LEN;
+        record.data = frames[0].buf;
+        sd_writer_stats_t before, after;
+        sd_writer_get_stats(&sd_writer, &before);
+        int64_t start = bench_now_ns();
+        ns = bench_samples(n, [&](long i) {
+            record.seq = (uint32_t) i;
+            record.timestamp_us = i * 1000;
+            record.ap_id = (uint8_t) (i % aps);
+            record.data = frames[i % frames.size()].buf;
+            sd_capture_record(&record, s->aps[record.ap_id].name);
+        });
+        sd_flush();
+        double seconds = (bench_now_ns() - start) / 1e9;
+        sd_writer_get_stats(&sd_writer, &after);
+        snprintf(note, sizeof(note), "%.1f MB/s to the file including the flush, %llu dropped",
+                 (after.written_bytes - before.written_bytes) / seconds / 1e6,
+                 (unsigned long long) (after.dropped_records - before.dropped_records));
+        bench_report("sd_capture_record", ns, note);
+
+        // A partial chunk is sealed by the periodic sync, without sd_flush
+        sd_writer_get_stats(&sd_writer, &before);
+        for (long i = 0; i < 3; i++) {
+            sd_capture_record(&record, s->aps[0].name);
+        }
+        usleep(3 * CONFIG_SD_FSYNC_INTERVAL_MS * 1000);
+        sd_writer_get_stats(&sd_writer, &after);
+        bool sealed = after.written_bytes - before.written_bytes >= CAPTURE_CHUNK_SIZE && after.syncs > before.syncs;
+        printf("  3 records on the file after the next periodic sync: %s\n", sealed ? "OK" : "FAILED");
+
+        // Records still arriving from another thread while the capture is closed
+        std::atomic<bool> arriving(true);
+        std::thread wifi([&]() {
+            while (arriving) {
+                sd_capture_record(&record, s->aps[0].name);
+            }
+        });
+        usleep(20000);
+        sd_deinit();
+        arriving = false;
+        wifi.join();
+        capture_reader_t reader;
+        bool closed = capture_reader_open(&reader, filename) && !reader.recovered && capture_reader_chunks(&reader) > 0;
+        capture_chunk_t chunk;
+        for (size_t i = 0; closed && i < capture_reader_chunks(&reader); i++) {
+            closed = capture_reader_load_chunk(&reader, i, &chunk);
+        }
+        capture_reader_close(&reader);
+        printf("  sd_deinit while records arrive, index and %zu chunks read back: %s\n",
+               capture_reader_chunks(&reader), closed ? "OK" : "FAILED");
+        storage_ok = sealed && closed;
+    } else {
+        printf("  skipped, %s could not be opened\n", HAL_FS_ROOT);
+    }
+
+    bench_header("sockets (loopback)");
+    receiver_t receiver;
+    receiver.fd = socket(AF_INET, SOCK_DGRAM, 0);
+    receiver.running = true;
+    receiver.datagrams = receiver.records = receiver.malformed = 0;
+    struct sockaddr_in addr = {};
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    socklen_t addr_len = sizeof(addr);
+    struct timeval timeout = {0, 100000};
+    setsockopt(receiver.fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+    if (bind(receiver.fd, (struct sockaddr *) &addr, sizeof(addr)) != 0 ||
+        getsockname(receiver.fd, (struct sockaddr *) &addr, &addr_len) != 0) {
+        printf("ERROR: receiver socket [%s]\n", strerror(errno));
+        return 1;
+    }
+    std::thread receiver_thread(receiver_loop, &receiver);
+    if (!transmitter_start(&transmitter, "127.0.0.1", ntohs(addr.sin_port), &always_connected)) {
+        return 1;
+    }
+    transmitter_ready = true;
+
+    size_t per_datagram = csi_packet_records_per_mtu(CSI_STREAM_LEN);
+    long datagrams = n / (long) per_datagram;
+    uint64_t queued = 0;
+    ns.clear();
+    for (long d = 0; d < datagrams; d++) {
+        for (size_t k = 0; k < per_datagram; k++) { // Frames captured since the last datagram
+            hal_csi_inject(&frames[queued++ % frames.size()].info);
+        }
+        int64_t t0 = bench_now_ns();
+        size_t size = _build_csi_packet();
+        transmitter_submit(&transmitter, packet_buffer, size);
+        ns.push_back(bench_now_ns() - t0);
+        std::this_thread::sleep_for(std::chrono::microseconds(50)); // Leave the sender thread its turn
+    }
+    hal_delay_ms(300);
+    transmitter_stats_t tx_stats;
+    transmitter_get_stats(&transmitter, &tx_stats);
+    transmitter_stop(&transmitter);
+    receiver.running = false;
+    receiver_thread.join();
+    close(receiver.fd);
+    snprintf(note, sizeof(note), "%zu records each, %llu sent, %llu received (%llu records), %llu dropped",
+             per_datagram, (unsigned long long) tx_stats.sent, (unsigned long long) receiver.datagrams,
+             (unsigned long long) receiver.records, (unsigned long long) tx_stats.dropped);
+    bench_report("_build_csi_packet + submit", ns, note);
+    printf("  codec: %.0f%% of the raw payload\n", codec.raw_bytes > 0 ? 100.0 * codec.coded_bytes / codec.raw_bytes : 0);
+
+    hal_csi_stop();
+    log_stop(&log_ring);
+    delete s;
+    bool ok = stale_ok && storage_ok && receiver.malformed == 0 && receiver.datagrams == tx_stats.sent;
+    printf("\n%s\n", ok ? "OK" : "FAILED");
+    return ok ? 0 : 1;
+}
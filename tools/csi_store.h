@@ -0,0 +1,591 @@
+#ifndef CSI_TOOLS_STORE_H
+#define CSI_TOOLS_STORE_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <algorithm>
+#include <chrono>
+#include <map>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "csi_packet_component.h"
+
+/*
+ * Columnar training store built from the text CSI logs, and the parallel converter that produces it.
+ *
+ * Input lines (anything else is counted and skipped):
+ *
+ *   AP3,-52,384,[12 -3 7 ... ]         one frame, printed by _wifi_csi_cb: AP, rssi, len, values
+ *   CSI_DATA 12 -3 7 ...               one round of all APs, printed by collect_all_csi_data
+ *   I (12345) wifi station: ...        ESP log line, its millisecond stamp dates the rows that follow
+ *
+ * Every AP name (and CSI_DATA) becomes a table. The file is meant to be mmap'ed as is, e.g. with numpy:
+ *
+ *   header (64):  magic "CSIT" (4) | version (4) | table_count (4) | reserved (4) | total_rows (8) | 0 (40)
+ *   table (128):  name (32) | rows (8) | width (4) | reserved (4)
+ *                 | values_offset (8) | count_offset (8) | rssi_offset (8) | label_offset (8) | timestamp_offset (8) | 0 (40)
+ *   columns:      values int16[rows][width] (zero padded) | count uint16[rows] | rssi int8[rows]
+ *                 | label int16[rows] | timestamp_us int64[rows], each starting on a 64 byte boundary
+ *
+ * All fields are little endian. `count` is the number of values the row really had, `label` the label
+ * given for its input file (-1 if none), `timestamp_us` the stamp of the last ESP log line before the
+ * row (-1 if none). Values are int16, so amplitude logs (0..181 and more) keep theirs; a row with a value
+ * outside int16 is rejected, and a table only appears once one of its rows parsed.
+ */
+
+#define CSI_STORE_MAGIC 0x54495343 // "CSIT"
+#define CSI_STORE_VERSION 2
+#define CSI_STORE_HEADER_SIZE 64
+#define CSI_STORE_TABLE_SIZE 128
+#define CSI_STORE_ALIGN 64
+#define CSI_STORE_NAME_LEN 32
+#define CSI_STORE_MAX_WIDTH 4096 // Longer rows are rejected
+#define CSI_STORE_NO_TIME INT64_MIN // Row before the first log line of its part, resolved after the parse
+
+#if !defined(__BYTE_ORDER__) || __BYTE_ORDER__ != __ORDER_LITTLE_ENDIAN__
+#error "csi_store.h maps the columns directly and needs a little endian host"
+#endif
+
+// Rows of one table parsed by one thread, values are compact until the table width is known
+typedef struct {
+    std::vector<int16_t> values;
+    std::vector<uint16_t> count;
+    std::vector<int8_t> rssi;
+    std::vector<int64_t> timestamp_us;
+    uint16_t width = 0;
+} csi_table_part_t;
+
+// What one thread got out of its slice of an input file
+typedef struct {
+    const char *begin;
+    const char *end;
+    std::map<std::string, size_t> table_ids; // Name -> index into names/tables, in order of appearance
+    std::vector<std::string> names;
+    std::vector<csi_table_part_t> tables;
+    std::vector<int16_t> row; // Values of the row being parsed, before it has a table
+    int64_t last_log_us = CSI_STORE_NO_TIME;
+
+    uint64_t lines = 0;
+    uint64_t rows = 0;
+    uint64_t other = 0; // Lines that are no data rows (logs, blank lines)
+    uint64_t rejected = 0; // Data rows that could not be parsed
+} csi_parse_part_t;
+
+typedef struct {
+    uint64_t bytes = 0;
+    uint64_t lines = 0;
+    uint64_t rows = 0;
+    uint64_t other = 0;
+    uint64_t rejected = 0;
+    uint32_t tables = 0;
+    double parse_s = 0;
+    double write_s = 0;
+} csi_convert_stats_t;
+
+typedef struct {
+    char name[CSI_STORE_NAME_LEN];
+    uint64_t rows;
+    uint32_t width;
+    const int16_t *values;
+    const uint16_t *count;
+    const int8_t *rssi;
+    const int16_t *label;
+    const int64_t *timestamp_us;
+} csi_store_table_t;
+
+typedef struct {
+    void *map = NULL;
+    size_t size = 0;
+    uint64_t total_rows = 0;
+    std::vector<csi_store_table_t> tables;
+} csi_store_t;
+
+inline bool _csi_is_digit(char c) {
+    return (unsigned char) (c - '0') < 10;
+}
+
+/*
+ * Value of the digits at the start of `w` (8 bytes of text, first character in the low byte) and their
+ * number in `len`, 0 if `w` starts with a non-digit and 8 if it has no terminator. Branch-free: one pass
+ * flags the non-digit bytes, the digits are shifted to the top and folded in three multiplies.
+ */
+inline uint32_t _csi_swar_digits(uint64_t w, uint32_t *len) {
+    uint64_t x = w ^ 0x3030303030303030ULL; // Digits become 0..9
+    uint64_t other = (((x & 0x7F7F7F7F7F7F7F7FULL) + 0x7676767676767676ULL) | x) & 0x8080808080808080ULL;
+    *len = other == 0 ? 8 : (uint32_t) __builtin_ctzll(other) / 8;
+    if (*len == 0 || *len == 8) {
+        return 0;
+    }
+    x <<= 64 - 8 * *len; // Leading zeros in the low bytes
+    x = (x & 0x0F0F0F0F0F0F0F0FULL) * 2561 >> 8;
+    x = (x & 0x00FF00FF00FF00FFULL) * 6553601 >> 16;
+    x = (x & 0x0000FFFF0000FFFFULL) * 42949672960001ULL >> 32;
+    return (uint32_t) x;
+}
+
+/*
+ * Parse the space separated integers of one row, up to ']' or the end of the line. No locale and no
+ * strtol: away from the end of the slice every value is read with one 8 byte load (_csi_swar_digits),
+ * the last few bytes go through the plain loop. The output is sized once for the most values the row can
+ * hold, (end - p + 1) / 2, so the loop does no bounds checks on it.
+ */
+inline bool _csi_parse_values(const char *p, const char *end, std::vector<int16_t> *out, uint16_t *n) {
+    size_t before = out->size();
+    size_t most = std::min((size_t) (end - p + 1) / 2, (size_t) CSI_STORE_MAX_WIDTH + 1);
+    out->resize(before + most);
+    int16_t *dst = out->data() + before;
+    int16_t *limit = dst + most;
+    int16_t *v0 = dst;
+
+    while (true) {
+        while (p < end && (*p == ' ' || *p == ',' || *p == '\t')) {
+            p++;
+        }
+        if (p >= end || *p == ']' || *p == '\r') {
+            break;
+        }
+
+        int32_t negative = *p == '-';
+        p += negative;
+        int32_t v = 0;
+        uint32_t len = 0;
+        if (end - p >= 8) {
+            uint64_t w;
+            memcpy(&w, p, sizeof(w));
+            v = (int32_t) _csi_swar_digits(w, &len);
+        }
+        if (len == 0 || len == 8) {
+            // Near the end of the slice, or a number too long for one load
+            len = 0;
+            while (p + len < end && _csi_is_digit(p[len])) {
+                v = len < 6 ? v * 10 + (p[len] - '0') : v;
+                len++;
+            }
+        }
+        if (len == 0 || dst == limit) {
+            out->resize(before);
+            return false;
+        }
+        p += len;
+
+        v = negative ? -v : v;
+        if (v > INT16_MAX || v < INT16_MIN) {
+            out->resize(before);
+            return false;
+        }
+        *dst++ = (int16_t) v;
+    }
+
+    size_t count = dst - v0;
+    out->resize(before + count);
+    if (count > CSI_STORE_MAX_WIDTH) {
+        out->resize(before);
+        return false;
+    }
+    *n = (uint16_t) count;
+    return true;
+}
+
+// ESP log line "I (12345) tag: ...", optionally behind an ANSI color code; returns the stamp in us or -1
+inline int64_t _csi_log_time_us(const char *p, const char *end) {
+    if (p < end && *p == '\033') {
+        while (p < end && *p != 'm') {
+            p++;
+        }
+        p++;
+    }
+    if (end - p < 4 || (*p != 'I' && *p != 'W' && *p != 'E' && *p != 'D' && *p != 'V') || p[1] != ' ' || p[2] != '(') {
+        return -1;
+    }
+    p += 3;
+    int64_t ms = 0;
+    const char *digits = p;
+    while (p < end && _csi_is_digit(*p)) {
+        ms = ms * 10 + (*p - '0');
+        p++;
+    }
+    return p > digits && p < end && *p == ')' ? ms * 1000 : -1;
+}
+
+inline csi_table_part_t *_csi_part_table(csi_parse_part_t *part, const char *name, size_t len) {
+    std::string key(name, std::min(len, (size_t) CSI_STORE_NAME_LEN - 1));
+    auto it = part->table_ids.find(key);
+    if (it != part->table_ids.end()) {
+        return &part->tables[it->second];
+    }
+    part->table_ids[key] = part->names.size();
+    part->names.push_back(key);
+    part->tables.emplace_back();
+    return &part->tables.back();
+}
+
+inline void _csi_part_add_row(csi_parse_part_t *part, const char *name, size_t name_len, int8_t rssi,
+                              const char *values, const char *end) {
+    uint16_t n = 0;
+    part->row.clear();
+    if (!_csi_parse_values(values, end, &part->row, &n) || n == 0) {
+        part->rejected++;
+        return;
+    }
+    csi_table_part_t *t = _csi_part_table(part, name, name_len);
+    t->values.insert(t->values.end(), part->row.begin(), part->row.end());
+    t->count.push_back(n);
+    t->rssi.push_back(rssi);
+    t->timestamp_us.push_back(part->last_log_us);
+    t->width = std::max(t->width, n);
+    part->rows++;
+}
+
+// Parse one slice of whole lines
+inline void csi_parse_part(csi_parse_part_t *part) {
+    const char *p = part->begin;
+    while (p < part->end) {
+        const char *eol = (const char *) memchr(p, '\n', part->end - p);
+        if (eol == NULL) {
+            eol = part->end;
+        }
+        size_t line_len = eol - p;
+        part->lines++;
+
+        // Log lines first: their ANSI color codes contain '[' too
+        int64_t ts = _csi_log_time_us(p, eol);
+        const char *open = ts >= 0 || *p == '\033' ? NULL : (const char *) memchr(p, '[', line_len);
+        if (ts >= 0) {
+            part->last_log_us = ts;
+            part->other++;
+        } else if (line_len >= 8 && memcmp(p, "CSI_DATA", 8) == 0) {
+            const char *v = p + 8;
+            while (v < eol && (*v == ' ' || *v == ',' || *v == '[')) {
+                v++;
+            }
+            _csi_part_add_row(part, "CSI_DATA", 8, 0, v, eol);
+        } else if (open != NULL) {
+            // AP,rssi,len,[...]: the AP name ends at the first comma, rssi follows it
+            const char *comma = (const char *) memchr(p, ',', open - p);
+            const char *r = comma == NULL ? NULL : comma + 1;
+            bool negative = r != NULL && *r == '-';
+            r += negative;
+            int32_t rssi = 0;
+            const char *digits = r;
+            while (r != NULL && r < open && _csi_is_digit(*r)) {
+                rssi = rssi * 10 + (*r - '0');
+                r++;
+            }
+            if (comma == NULL || comma == p || r == digits || *r != ',') {
+                part->rejected++;
+            } else {
+                rssi = negative ? -rssi : rssi;
+                _csi_part_add_row(part, p, comma - p, (int8_t) std::max(-128, std::min(127, rssi)), open + 1, eol);
+            }
+        } else {
+            part->other++;
+        }
+        p = eol + 1;
+    }
+}
+
+// Split [data, data + size) into `threads` slices on line boundaries
+inline std::vector<csi_parse_part_t> _csi_split(const char *data, size_t size, unsigned threads) {
+    std::vector<csi_parse_part_t> parts;
+    const char *begin = data;
+    const char *end = data + size;
+    for (unsigned i = 0; i < threads && begin < end; i++) {
+        const char *cut = i + 1 == threads ? end : data + size * (i + 1) / threads;
+        if (cut < begin) {
+            cut = begin;
+        }
+        if (cut < end) {
+            const char *eol = (const char *) memchr(cut, '\n', end - cut);
+            cut = eol == NULL ? end : eol + 1;
+        }
+        parts.emplace_back();
+        parts.back().begin = begin;
+        parts.back().end = cut;
+        begin = cut;
+    }
+    return parts;
+}
+
+inline uint64_t _csi_align(uint64_t v) {
+    return (v + CSI_STORE_ALIGN - 1) / CSI_STORE_ALIGN * CSI_STORE_ALIGN;
+}
+
+inline double _csi_store_now_s() {
+    return std::chrono::duration<double>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+/*
+ * Convert text logs to a store at `out_path`. `labels[i]` is the label of `inputs[i]` (-1 = none).
+ * Each file is mmap'ed and parsed by `threads` threads; the store is written through a mapping of the
+ * output file, one thread per slice again. Returns false on I/O errors; per-row problems are only counted.
+ */
+inline bool csi_convert(const std::vector<std::string> &inputs, const std::vector<int16_t> &labels,
+                        const char *out_path, unsigned threads, csi_convert_stats_t *stats) {
+    *stats = csi_convert_stats_t();
+    threads = std::max(1u, threads);
+
+    // Parse
+    double start = _csi_store_now_s();
+    std::vector<std::vector<csi_parse_part_t>> files(inputs.size());
+    std::vector<std::pair<void *, size_t>> maps;
+    bool ok = true;
+    for (size_t f = 0; f < inputs.size() && ok; f++) {
+        int fd = open(inputs[f].c_str(), O_RDONLY);
+        struct stat st;
+        if (fd < 0 || fstat(fd, &st) != 0) {
+            printf("ERROR: cannot open %s [%s]\n", inputs[f].c_str(), strerror(errno));
+            ok = false;
+            break;
+        }
+        if (st.st_size == 0) {
+            close(fd);
+            continue;
+        }
+        void *map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        close(fd);
+        if (map == MAP_FAILED) {
+            printf("ERROR: cannot map %s [%s]\n", inputs[f].c_str(), strerror(errno));
+            ok = false;
+            break;
+        }
+        madvise(map, st.st_size, MADV_SEQUENTIAL);
+        maps.push_back({map, (size_t) st.st_size});
+        stats->bytes += st.st_size;
+
+        files[f] = _csi_split((const char *) map, st.st_size, threads);
+        std::vector<std::thread> workers;
+        for (csi_parse_part_t &part : files[f]) {
+            workers.emplace_back(csi_parse_part, &part);
+        }
+        for (std::thread &t : workers) {
+            t.join();
+        }
+
+        // Rows before the first log line of a slice belong to the last log line of the slices before it
+        int64_t carry = -1;
+        for (csi_parse_part_t &part : files[f]) {
+            for (csi_table_part_t &t : part.tables) {
+                for (size_t i = 0; i < t.timestamp_us.size() && t.timestamp_us[i] == CSI_STORE_NO_TIME; i++) {
+                    t.timestamp_us[i] = carry;
+                }
+            }
+            if (part.last_log_us != CSI_STORE_NO_TIME) {
+                carry = part.last_log_us;
+            }
+        }
+    }
+    for (auto &m : maps) {
+        munmap(m.first, m.second);
+    }
+    if (!ok) {
+        return false;
+    }
+    stats->parse_s = _csi_store_now_s() - start;
+
+    // Lay out the tables in order of first appearance
+    start = _csi_store_now_s();
+    std::map<std::string, size_t> table_ids;
+    std::vector<std::string> names;
+    std::vector<uint64_t> rows;
+    std::vector<uint32_t> widths;
+    for (auto &parts : files) {
+        for (csi_parse_part_t &part : parts) {
+            stats->lines += part.lines;
+            stats->rows += part.rows;
+            stats->other += part.other;
+            stats->rejected += part.rejected;
+            for (size_t i = 0; i < part.names.size(); i++) {
+                auto it = table_ids.find(part.names[i]);
+                if (it == table_ids.end()) {
+                    it = table_ids.insert({part.names[i], names.size()}).first;
+                    names.push_back(part.names[i]);
+                    rows.push_back(0);
+                    widths.push_back(0);
+                }
+                rows[it->second] += part.tables[i].count.size();
+                widths[it->second] = std::max(widths[it->second], (uint32_t) part.tables[i].width);
+            }
+        }
+    }
+    stats->tables = names.size();
+
+    struct layout_t {
+        uint64_t values, count, rssi, label, timestamp;
+    };
+    std::vector<layout_t> layout(names.size());
+    uint64_t offset = _csi_align(CSI_STORE_HEADER_SIZE + CSI_STORE_TABLE_SIZE * names.size());
+    for (size_t t = 0; t < names.size(); t++) {
+        layout[t].values = offset;
+        offset = _csi_align(offset + rows[t] * widths[t] * sizeof(int16_t));
+        layout[t].count = offset;
+        offset = _csi_align(offset + rows[t] * sizeof(uint16_t));
+        layout[t].rssi = offset;
+        offset = _csi_align(offset + rows[t]);
+        layout[t].label = offset;
+        offset = _csi_align(offset + rows[t] * sizeof(int16_t));
+        layout[t].timestamp = offset;
+        offset = _csi_align(offset + rows[t] * sizeof(int64_t));
+    }
+
+    int fd = open(out_path, O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0 || ftruncate(fd, offset) != 0) {
+        printf("ERROR: cannot create %s [%s]\n", out_path, strerror(errno));
+        if (fd >= 0) {
+            close(fd);
+        }
+        return false;
+    }
+    uint8_t *out = (uint8_t *) mmap(NULL, offset, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (out == MAP_FAILED) {
+        printf("ERROR: cannot map %s [%s]\n", out_path, strerror(errno));
+        close(fd);
+        return false;
+    }
+
+    _csi_put_u32(out, CSI_STORE_MAGIC);
+    _csi_put_u32(out + 4, CSI_STORE_VERSION);
+    _csi_put_u32(out + 8, (uint32_t) names.size());
+    _csi_put_u64(out + 16, stats->rows);
+    for (size_t t = 0; t < names.size(); t++) {
+        uint8_t *d = out + CSI_STORE_HEADER_SIZE + CSI_STORE_TABLE_SIZE * t;
+        memcpy(d, names[t].c_str(), names[t].size());
+        _csi_put_u64(d + 32, rows[t]);
+        _csi_put_u32(d + 40, widths[t]);
+        _csi_put_u64(d + 48, layout[t].values);
+        _csi_put_u64(d + 56, layout[t].count);
+        _csi_put_u64(d + 64, layout[t].rssi);
+        _csi_put_u64(d + 72, layout[t].label);
+        _csi_put_u64(d + 80, layout[t].timestamp);
+    }
+
+    // Every slice knows where its rows go once the slices before it are counted
+    struct job_t {
+        const csi_parse_part_t *part;
+        int16_t label;
+        std::vector<uint64_t> first_row; // Per local table
+    };
+    std::vector<job_t> jobs;
+    std::vector<uint64_t> next_row(names.size(), 0);
+    for (size_t f = 0; f < files.size(); f++) {
+        for (const csi_parse_part_t &part : files[f]) {
+            job_t job = {&part, f < labels.size() ? labels[f] : (int16_t) -1, {}};
+            for (size_t i = 0; i < part.names.size(); i++) {
+                size_t t = table_ids[part.names[i]];
+                job.first_row.push_back(next_row[t]);
+                next_row[t] += part.tables[i].count.size();
+            }
+            jobs.push_back(std::move(job));
+        }
+    }
+
+    auto fill = [&](size_t from, size_t to) {
+        for (size_t j = from; j < to; j++) {
+            const job_t &job = jobs[j];
+            for (size_t i = 0; i < job.part->names.size(); i++) {
+                size_t t = table_ids.at(job.part->names[i]);
+                const csi_table_part_t &src = job.part->tables[i];
+                uint64_t row = job.first_row[i];
+                uint32_t width = widths[t];
+                const int16_t *v = src.values.data();
+                for (size_t r = 0; r < src.count.size(); r++, row++) {
+                    int16_t *dst = (int16_t *) (out + layout[t].values) + row * width;
+                    memcpy(dst, v, src.count[r] * sizeof(int16_t));
+                    v += src.count[r]; // The padding is already zero: ftruncate
+                    ((int16_t *) (out + layout[t].label))[row] = job.label;
+                }
+                row = job.first_row[i];
+                memcpy(out + layout[t].count + row * sizeof(uint16_t), src.count.data(), src.count.size() * sizeof(uint16_t));
+                memcpy(out + layout[t].rssi + row, src.rssi.data(), src.rssi.size());
+                memcpy(out + layout[t].timestamp + row * sizeof(int64_t), src.timestamp_us.data(),
+                       src.timestamp_us.size() * sizeof(int64_t));
+            }
+        }
+    };
+    std::vector<std::thread> workers;
+    for (unsigned i = 0; i < threads; i++) {
+        workers.emplace_back(fill, jobs.size() * i / threads, jobs.size() * (i + 1) / threads);
+    }
+    for (std::thread &t : workers) {
+        t.join();
+    }
+
+    ok = munmap(out, offset) == 0 && fsync(fd) == 0;
+    close(fd);
+    stats->write_s = _csi_store_now_s() - start;
+    if (!ok) {
+        printf("ERROR: cannot write %s [%s]\n", out_path, strerror(errno));
+    }
+    return ok;
+}
+
+// Map a store read-only and check that every column lies inside the file
+inline bool csi_store_open(csi_store_t *s, const char *path) {
+    int fd = open(path, O_RDONLY);
+    struct stat st;
+    if (fd < 0 || fstat(fd, &st) != 0 || st.st_size < CSI_STORE_HEADER_SIZE) {
+        printf("ERROR: cannot open %s\n", path);
+        if (fd >= 0) {
+            close(fd);
+        }
+        return false;
+    }
+    s->size = st.st_size;
+    s->map = mmap(NULL, s->size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (s->map == MAP_FAILED) {
+        s->map = NULL;
+        return false;
+    }
+
+    const uint8_t *p = (const uint8_t *) s->map;
+    uint32_t count = _csi_get_u32(p + 8);
+    if (_csi_get_u32(p) != CSI_STORE_MAGIC || _csi_get_u32(p + 4) != CSI_STORE_VERSION ||
+        CSI_STORE_HEADER_SIZE + (uint64_t) CSI_STORE_TABLE_SIZE * count > s->size) {
+        printf("ERROR: %s is not a CSI store\n", path);
+        return false;
+    }
+    s->total_rows = _csi_get_u64(p + 16);
+    s->tables.clear();
+    for (uint32_t i = 0; i < count; i++) {
+        const uint8_t *d = p + CSI_STORE_HEADER_SIZE + CSI_STORE_TABLE_SIZE * i;
+        csi_store_table_t t;
+        memcpy(t.name, d, CSI_STORE_NAME_LEN);
+        t.name[CSI_STORE_NAME_LEN - 1] = '\0';
+        t.rows = _csi_get_u64(d + 32);
+        t.width = _csi_get_u32(d + 40);
+        uint64_t offsets[5];
+        uint64_t sizes[5] = {t.rows * t.width * 2, t.rows * 2, t.rows, t.rows * 2, t.rows * 8};
+        for (int k = 0; k < 5; k++) {
+            offsets[k] = _csi_get_u64(d + 48 + 8 * k);
+            if (offsets[k] > s->size || sizes[k] > s->size - offsets[k]) {
+                printf("ERROR: %s: table %s is truncated\n", path, t.name);
+                return false;
+            }
+        }
+        t.values = (const int16_t *) (p + offsets[0]);
+        t.count = (const uint16_t *) (p + offsets[1]);
+        t.rssi = (const int8_t *) (p + offsets[2]);
+        t.label = (const int16_t *) (p + offsets[3]);
+        t.timestamp_us = (const int64_t *) (p + offsets[4]);
+        s->tables.push_back(t);
+    }
+    return true;
+}
+
+inline void csi_store_close(csi_store_t *s) {
+    if (s->map != NULL) {
+        munmap(s->map, s->size);
+        s->map = NULL;
+    }
+    s->tables.clear();
+}
+
+#endif //CSI_TOOLS_STORE_H
@@ -0,0 +1,379 @@
+/*
+ * Runs and inspects labeled surveys (survey_component.h).
+ *
+ *   csi_survey sim [-P plan | -p plan_file] [-r rounds] [-s settle_ms] [-f frames_per_s] [-a aps]
+ *                  [-w walk_speed] [-o capture.csi] [-u collector_ip[:port]] [-S seed]
+ *       walk a survey on a simulated clock with synthetic CSI (csi_synth.h, one plan unit is 10 cm, APs on a
+ *       circle around the plan, scatterers over it). A simulated person carries the station to
+ *       each announced point at `walk_speed` plan units per second while the station keeps capturing
+ *       `frames_per_s` frames from `aps` APs; every record goes through survey_tag and is written to a
+ *       capture file and/or streamed to a collector, exactly as the station does. Checks that every point
+ *       of every round got its dwell, that labels come in plan order with the plan's coordinates, and counts
+ *       frames labeled while the carrier was still walking (settle time too short). Reports labeled frames
+ *       per minute of survey time, and reads the capture back to check the labels survived the encoding.
+ *   csi_survey report <capture.csi>
+ *       labeled frames per round and point of a capture, e.g. one copied from a station's SD card
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <chrono>
+#include <map>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "survey_component.h"
+#include "capture_component.h"
+#include "csi_synth.h"
+
+#define SIM_DEFAULT_PLAN "0,0,300; 0,20,300; 0,40,300; 20,40,300; 20,20,300; 20,0,300; 40,0,300; 40,20,300; 40,40,300"
+#define SIM_METRES_PER_UNIT 0.1
+
+double now_s() {
+    return std::chrono::duration<double>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+typedef struct {
+    int64_t now_us;
+    double x, y; // Where the carrier is
+    double target_x, target_y; // Where the survey sent it
+} sim_world_t;
+
+int64_t sim_clock(void *ctx) {
+    return ((sim_world_t *) ctx)->now_us;
+}
+
+void sim_move(void *ctx, uint16_t, uint16_t, const survey_point_t *p) {
+    sim_world_t *w = (sim_world_t *) ctx;
+    w->target_x = p->x;
+    w->target_y = p->y;
+}
+
+bool file_sink(void *ctx, const void *data, size_t size) {
+    return fwrite(data, 1, size, (FILE *) ctx) == size;
+}
+
+typedef struct {
+    uint64_t frames;
+    int16_t x, y;
+} label_count_t;
+
+typedef std::map<std::pair<uint16_t, uint16_t>, label_count_t> label_counts_t; // (round, point)
+
+void count_label(label_counts_t *counts, const csi_record_t *r) {
+    label_count_t &c = (*counts)[std::make_pair(r->round, r->point)];
+    c.frames++;
+    c.x = r->x;
+    c.y = r->y;
+}
+
+int sim(int argc, char **argv) {
+    std::string plan = SIM_DEFAULT_PLAN;
+    int rounds = 2;
+    int settle_ms = 5000;
+    double frame_rate = 100;
+    int aps = 3;
+    double walk_speed = 10;
+    const char *output = NULL;
+    const char *collector = NULL;
+    uint64_t seed = 1;
+
+    int opt;
+    while ((opt = getopt(argc, argv, "P:p:r:s:f:a:w:o:u:S:")) != -1) {
+        switch (opt) {
+            case 'P': plan = optarg; break;
+            case 'p': {
+                FILE *f = fopen(optarg, "r");
+                if (f == NULL) {
+                    printf("ERROR: cannot open %s [%s]\n", optarg, strerror(errno));
+                    return 1;
+                }
+                plan.clear();
+                char line[256];
+                while (fgets(line, sizeof(line), f) != NULL) {
+                    plan += line;
+                }
+                fclose(f);
+                break;
+            }
+            case 'r': rounds = atoi(optarg); break;
+            case 's': settle_ms = atoi(optarg); break;
+            case 'f': frame_rate = atof(optarg); break;
+            case 'a': aps = std::max(1, std::min(CAPTURE_MAX_APS, atoi(optarg))); break;
+            case 'w': walk_speed = atof(optarg); break;
+            case 'o': output = optarg; break;
+            case 'u': collector = optarg; break;
+            case 'S': seed = strtoull(optarg, NULL, 10); break;
+            default:
+                return -1;
+        }
+    }
+
+    survey_point_t points[SURVEY_MAX_POINTS];
+    char error[64];
+    int point_count = survey_parse_plan(plan.c_str(), points, SURVEY_MAX_POINTS, error, sizeof(error));
+    if (point_count <= 0) {
+        printf("ERROR: plan [%s]\n", point_count < 0 ? error : "no points");
+        return 1;
+    }
+    for (int i = 0; i < point_count; i++) {
+        if (points[i].dwell == 0) {
+            printf("ERROR: point %d has no dwell, the simulation would never end\n", i + 1);
+            return 1;
+        }
+    }
+
+    // APs on a circle around the surveyed area, scatterers over it
+    double cx = 0, cy = 0, x0 = points[0].x, y0 = points[0].y, x1 = x0, y1 = y0;
+    for (int i = 0; i < point_count; i++) {
+        cx += points[i].x / (double) point_count;
+        cy += points[i].y / (double) point_count;
+        x0 = std::min(x0, (double) points[i].x);
+        y0 = std::min(y0, (double) points[i].y);
+        x1 = std::max(x1, (double) points[i].x);
+        y1 = std::max(y1, (double) points[i].y);
+    }
+    synth_t *synth = new synth_t();
+    synth_init(synth, seed);
+    for (int i = 0; i < aps; i++) {
+        char name[16];
+        snprintf(name, sizeof(name), "AP%d", i + 1);
+        synth_add_ap(synth, name, (cx + 50 * cos(2 * M_PI * i / aps)) * SIM_METRES_PER_UNIT,
+                     (cy + 50 * sin(2 * M_PI * i / aps)) * SIM_METRES_PER_UNIT, 6, frame_rate / aps);
+    }
+    synth_add_scatterers(synth, 12, 0.6, (x0 - 20) * SIM_METRES_PER_UNIT, (y0 - 20) * SIM_METRES_PER_UNIT,
+                         (x1 + 20) * SIM_METRES_PER_UNIT, (y1 + 20) * SIM_METRES_PER_UNIT);
+
+    FILE *capture_file = NULL;
+    capture_writer_t *cw = NULL;
+    if (output != NULL) {
+        capture_file = fopen(output, "wb");
+        if (capture_file == NULL) {
+            printf("ERROR: cannot create %s [%s]\n", output, strerror(errno));
+            return 1;
+        }
+        cw = new capture_writer_t();
+        capture_writer_begin(cw, CAPTURE_CHUNK_SIZE, 1, 0, &file_sink, capture_file);
+        for (int i = 0; i < aps; i++) {
+            capture_writer_set_ap(cw, (uint8_t) i, synth->aps[i].name);
+        }
+    }
+
+    int udp_fd = -1;
+    struct sockaddr_in udp_addr = {};
+    uint8_t packet[CSI_PACKET_MTU];
+    csi_packet_writer_t writer;
+    if (collector != NULL) {
+        std::string host = collector;
+        int port = 2223;
+        size_t colon = host.find(':');
+        if (colon != std::string::npos) {
+            port = atoi(host.c_str() + colon + 1);
+            host.resize(colon);
+        }
+        udp_fd = socket(AF_INET, SOCK_DGRAM, 0);
+        udp_addr.sin_family = AF_INET;
+        udp_addr.sin_port = htons(port);
+        if (udp_fd == -1 || inet_pton(AF_INET, host.c_str(), &udp_addr.sin_addr) != 1) {
+            printf("ERROR: bad collector address %s\n", collector);
+            return 1;
+        }
+        csi_packet_begin(&writer, packet, sizeof(packet), 1);
+    }
+    uint64_t datagrams = 0;
+
+    sim_world_t world = {};
+    world.x = world.target_x = points[0].x;
+    world.y = world.target_y = points[0].y;
+    survey.clock = &sim_clock;
+    survey.clock_ctx = &world;
+    survey.on_move = &sim_move;
+    survey.move_ctx = &world;
+    log_start(&log_ring, NULL, NULL);
+    survey_start(&survey, points, point_count, (uint16_t) rounds, settle_ms);
+
+    csi_record_t r = {};
+    r.device_id = 1;
+    label_counts_t produced;
+    uint64_t frames = 0, walking_labeled = 0, out_of_order = 0, wrong_coordinates = 0;
+    std::pair<uint16_t, uint16_t> last_label(0, 0);
+
+    double start = now_s();
+    while (survey_active(&survey)) {
+        // Walk until the next frame is due, then receive it there
+        int64_t next_us = synth_next_us(synth);
+        double step = walk_speed * (next_us - world.now_us) / 1e6;
+        world.now_us = next_us;
+        double dx = world.target_x - world.x, dy = world.target_y - world.y;
+        double remaining = sqrt(dx * dx + dy * dy);
+        if (remaining <= step) {
+            world.x = world.target_x;
+            world.y = world.target_y;
+        } else {
+            world.x += dx / remaining * step;
+            world.y += dy / remaining * step;
+        }
+
+        synth_set_position(synth, world.x * SIM_METRES_PER_UNIT, world.y * SIM_METRES_PER_UNIT);
+        const wifi_csi_info_t *info = synth_next(synth);
+
+        r.seq = (uint32_t) frames++;
+        r.timestamp_us = world.now_us;
+        r.ap_id = (uint8_t) synth->ap;
+        r.rssi = (int8_t) info->rx_ctrl.rssi;
+        r.flags = CSI_RECORD_FLAG_RAW;
+        r.len = info->len;
+        r.data = info->buf;
+        if (survey_tag(&survey, &r)) {
+            std::pair<uint16_t, uint16_t> label(r.round, r.point);
+            out_of_order += label < last_label;
+            last_label = label;
+            wrong_coordinates += r.x != points[r.point].x || r.y != points[r.point].y;
+            walking_labeled += world.x != r.x || world.y != r.y;
+            count_label(&produced, &r);
+        }
+
+        if (cw != NULL) {
+            capture_writer_append(cw, &r);
+        }
+        if (udp_fd != -1 && !csi_packet_append(&writer, &r)) {
+            size_t size = csi_packet_finish(&writer);
+            sendto(udp_fd, packet, size, 0, (const struct sockaddr *) &udp_addr, sizeof(udp_addr));
+            datagrams++;
+            csi_packet_begin(&writer, packet, sizeof(packet), 1);
+            csi_packet_append(&writer, &r);
+        }
+    }
+    double elapsed = now_s() - start;
+    if (udp_fd != -1) {
+        size_t size = csi_packet_finish(&writer);
+        sendto(udp_fd, packet, size, 0, (const struct sockaddr *) &udp_addr, sizeof(udp_addr));
+        datagrams++;
+        close(udp_fd);
+    }
+    if (cw != NULL) {
+        capture_writer_finish(cw);
+        fclose(capture_file);
+        delete cw;
+    }
+    log_stop(&log_ring);
+    delete synth;
+
+    survey_stats_t stats;
+    survey_get_stats(&survey, &stats);
+    uint64_t missing = 0;
+    for (int round = 0; round < rounds; round++) {
+        for (int p = 0; p < point_count; p++) {
+            auto it = produced.find(std::make_pair((uint16_t) round, (uint16_t) p));
+            uint64_t got = it == produced.end() ? 0 : it->second.frames;
+            missing += got != points[p].dwell;
+        }
+    }
+    printf("survey: %d points x %d rounds, %llu frames (%llu labeled, %llu while settling) in %.1f min of survey time\n",
+           point_count, rounds, (unsigned long long) frames, (unsigned long long) stats.labeled,
+           (unsigned long long) stats.unlabeled, stats.elapsed_us / 60e6);
+    printf("rate: %.0f labeled/min overall, %.0f labeled/min while dwelling (capture %.0f frames/min)\n",
+           stats.samples_per_min, stats.dwell_samples_per_min, frame_rate * 60);
+    printf("labels: %llu points with the wrong count, %llu out of order, %llu wrong coordinates, %llu labeled while "
+           "still walking\n", (unsigned long long) missing, (unsigned long long) out_of_order,
+           (unsigned long long) wrong_coordinates, (unsigned long long) walking_labeled);
+    printf("simulated %.0f frames/s (%.0fx real time)", frames / elapsed, stats.elapsed_us / 1e6 / elapsed);
+    if (udp_fd != -1) {
+        printf(", %llu datagrams to %s", (unsigned long long) datagrams, collector);
+    }
+    printf("\n");
+
+    bool ok = missing == 0 && out_of_order == 0 && wrong_coordinates == 0;
+    if (output != NULL) {
+        capture_reader_t rd;
+        label_counts_t read;
+        if (!capture_reader_open(&rd, output)) {
+            return 1;
+        }
+        for (size_t i = 0; i < capture_reader_chunks(&rd); i++) {
+            capture_chunk_t c;
+            csi_record_t record;
+            if (capture_reader_load_chunk(&rd, i, &c)) {
+                while (capture_chunk_next(&c, &record)) {
+                    if (record.flags & CSI_RECORD_FLAG_LABELED) {
+                        count_label(&read, &record);
+                    }
+                }
+            }
+        }
+        capture_reader_close(&rd);
+        bool same = read.size() == produced.size();
+        for (auto &e : produced) {
+            auto it = read.find(e.first);
+            same = same && it != read.end() && it->second.frames == e.second.frames && it->second.x == e.second.x &&
+                   it->second.y == e.second.y;
+        }
+        printf("capture %s: labels read back %s\n", output, same ? "match" : "DIFFER");
+        ok = ok && same;
+    }
+    if (walking_labeled > 0) {
+        double longest = 0; // Walk between consecutive points, the last one back to the first for the next round
+        for (int i = 0; i < point_count; i++) {
+            const survey_point_t &a = points[i], &b = points[(i + 1) % point_count];
+            longest = std::max(longest, hypot(a.x - b.x, a.y - b.y) / walk_speed);
+        }
+        printf("note: the longest walk takes %.1f s, raise -s above it\n", longest);
+    }
+    printf("%s\n", ok ? "OK" : "FAILED");
+    return ok ? 0 : 1;
+}
+
+int report(const char *path) {
+    capture_reader_t rd;
+    if (!capture_reader_open(&rd, path)) {
+        return 1;
+    }
+    label_counts_t counts;
+    uint64_t unlabeled = 0;
+    for (size_t i = 0; i < capture_reader_chunks(&rd); i++) {
+        capture_chunk_t c;
+        csi_record_t record;
+        if (!capture_reader_load_chunk(&rd, i, &c)) {
+            printf("ERROR: chunk %zu failed verification\n", i);
+            continue;
+        }
+        while (capture_chunk_next(&c, &record)) {
+            if (record.flags & CSI_RECORD_FLAG_LABELED) {
+                count_label(&counts, &record);
+            } else {
+                unlabeled++;
+            }
+        }
+    }
+    capture_reader_close(&rd);
+
+    printf("%-6s %-6s %8s %8s %10s\n", "round", "point", "x", "y", "frames");
+    for (auto &e : counts) {
+        printf("%-6u %-6u %8d %8d %10llu\n", e.first.first + 1, e.first.second + 1, e.second.x, e.second.y,
+               (unsigned long long) e.second.frames);
+    }
+    printf("%zu labeled points, %llu unlabeled frames\n", counts.size(), (unsigned long long) unlabeled);
+    return 0;
+}
+
+int main(int argc, char **argv) {
+    int rc = -1;
+    if (argc >= 2 && strcmp(argv[1], "sim") == 0) {
+        rc = sim(argc - 1, argv + 1);
+    } else if (argc == 3 && strcmp(argv[1], "report") == 0) {
+        rc = report(argv[2]);
+    }
+    if (rc < 0) {
+        fprintf(stderr, "usage: %s sim [-P plan | -p plan_file] [-r rounds] [-s settle_ms] [-f frames_per_s] [-a aps] "
+                        "[-w walk_speed] [-o capture.csi] [-u collector_ip[:port]] [-S seed] | report <capture.csi>\n",
+                argv[0]);
+        return 1;
+    }
+    return rc;
+}
@@ -0,0 +1,522 @@
+/*
+ * Synthetic CSI (csi_synth.h) for testing the capture path without a board.
+ *
+ * The scene is a room of -W x -H metres with an AP in each corner (more APs go along the walls), -m random
+ * scatterers and a receiver walking a loop around the room at -v m/s. Each AP sends -r frames per second.
+ *
+ *   csi_synth gen [scene] [-n frames] [-o capture.csi] [-t]
+ *       generate frames into a capture file and/or as the station's text lines on stdout (-t), and print
+ *       the stream's fingerprint (CRC-32 of every frame's rx_ctrl, MAC and buffer)
+ *   csi_synth bench [scene] [-x speedup] [-d seconds]
+ *       feed frames at `speedup` times the scene's real rate through what the station does per frame: copy
+ *       into a record, delta code it, add it to a UDP packet, append it to a capture chunk and frame it for
+ *       the serial link. Reports the cost of each stage, how busy that keeps one core and how far behind it
+ *       fell, then the unpaced maximum. Fails if it fell further behind than the station's stream queue
+ *       (CSI_STREAM_QUEUE_LEN records) holds, i.e. the station would have overwritten records.
+ *   csi_synth check [scene] [-F fingerprint]
+ *       checks the generator: the same seed gives the same stream (and -F fingerprint, if given, pins it),
+ *       another seed a different one; per-AP frame rates, RSSI against distance, null subcarriers, flat
+ *       amplitude without scatterers and frequency selective with them
+ *
+ * scene: [-S seed] [-a aps] [-r rate_per_ap] [-m scatterers] [-l ltfs] [-W width] [-H height] [-v speed]
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <unistd.h>
+#include <algorithm>
+#include <chrono>
+#include <thread>
+#include <vector>
+
+#include "csi_synth.h"
+#include "csi_codec_component.h"
+#include "capture_component.h"
+#include "serial_frame_component.h"
+
+typedef struct {
+    uint64_t seed;
+    int aps;
+    double rate;
+    int scatterers;
+    int ltfs;
+    double width, height;
+    double speed;
+} scene_t;
+
+// Parse the scene options, leaving the others to the mode. Returns false on a bad option.
+bool scene_option(scene_t *sc, int opt, const char *arg) {
+    switch (opt) {
+        case 'S': sc->seed = strtoull(arg, NULL, 10); return true;
+        case 'a': sc->aps = std::max(1, std::min(SYNTH_MAX_APS, atoi(arg))); return true;
+        case 'r': sc->rate = atof(arg); return sc->rate > 0;
+        case 'm': sc->scatterers = std::max(0, std::min(SYNTH_MAX_SCATTERERS, atoi(arg))); return true;
+        case 'l': sc->ltfs = std::max(1, std::min(3, atoi(arg))); return true;
+        case 'W': sc->width = atof(arg); return sc->width > 0;
+        case 'H': sc->height = atof(arg); return sc->height > 0;
+        case 'v': sc->speed = atof(arg); return sc->speed > 0;
+        default: return false;
+    }
+}
+
+#define SCENE_OPTIONS "S:a:r:m:l:W:H:v:"
+
+scene_t scene_defaults() {
+    scene_t sc;
+    sc.seed = 1;
+    sc.aps = 3;
+    sc.rate = 100;
+    sc.scatterers = 12;
+    sc.ltfs = 1;
+    sc.width = 8;
+    sc.height = 6;
+    sc.speed = 1.0;
+    return sc;
+}
+
+void scene_build(synth_t *s, const scene_t *sc) {
+    synth_init(s, sc->seed);
+    s->ltfs = (uint8_t) sc->ltfs;
+    const double corners[4][2] = {{0, 0}, {sc->width, 0}, {sc->width, sc->height}, {0, sc->height}};
+    for (int i = 0; i < sc->aps; i++) {
+        char name[16];
+        snprintf(name, sizeof(name), "AP%d", i + 1);
+        double x, y;
+        if (i < 4) {
+            x = corners[i][0];
+            y = corners[i][1];
+        } else { // Halfway along the walls, then further round
+            int wall = i % 4;
+            double f = 0.5 / (1 + (i - 4) / 4);
+            x = corners[wall][0] + (corners[(wall + 1) % 4][0] - corners[wall][0]) * f;
+            y = corners[wall][1] + (corners[(wall + 1) % 4][1] - corners[wall][1]) * f;
+        }
+        synth_add_ap(s, name, x, y, (uint8_t) (1 + 5 * (i % 3)), sc->rate);
+    }
+    // Walls and furniture, some of it just outside the room
+    synth_add_scatterers(s, sc->scatterers, 0.6, -1, -1, sc->width + 1, sc->height + 1);
+    // A loop one metre in from the walls
+    synth_add_waypoint(s, 1, 1, 0);
+    synth_add_waypoint(s, sc->width - 1, 1, sc->speed);
+    synth_add_waypoint(s, sc->width - 1, sc->height - 1, sc->speed);
+    synth_add_waypoint(s, 1, sc->height - 1, sc->speed);
+}
+
+uint32_t frame_crc(uint32_t crc, const wifi_csi_info_t *info) {
+    const wifi_pkt_rx_ctrl_t &rx = info->rx_ctrl;
+    int32_t fields[] = {rx.rssi, (int32_t) rx.rate, (int32_t) rx.sig_mode, (int32_t) rx.mcs, (int32_t) rx.stbc,
+                        rx.noise_floor, (int32_t) rx.channel, (int32_t) rx.timestamp, (int32_t) rx.sig_len, info->len};
+    crc = capture_crc32(crc, fields, sizeof(fields));
+    crc = capture_crc32(crc, info->mac, sizeof(info->mac));
+    return capture_crc32(crc, info->buf, info->len);
+}
+
+// What _csi_stream_push makes of a frame
+void frame_record(const synth_t *s, const wifi_csi_info_t *info, uint32_t seq, int8_t *payload, csi_record_t *r) {
+    memcpy(payload, info->buf, info->len);
+    memset(r, 0, sizeof(*r));
+    r->seq = seq;
+    r->timestamp_us = s->now_us;
+    r->device_id = 1;
+    r->ap_id = (uint8_t) s->ap;
+    r->rssi = (int8_t) info->rx_ctrl.rssi;
+    r->flags = CSI_RECORD_FLAG_RAW;
+    r->len = info->len;
+    r->data = payload;
+}
+
+bool file_sink(void *ctx, const void *data, size_t size) {
+    return fwrite(data, 1, size, (FILE *) ctx) == size;
+}
+
+bool count_sink(void *ctx, const void *, size_t size) {
+    *(uint64_t *) ctx += size;
+    return true;
+}
+
+int gen(int argc, char **argv) {
+    scene_t sc = scene_defaults();
+    long frames = 10000;
+    const char *output = NULL;
+    bool text = false;
+
+    int opt;
+    while ((opt = getopt(argc, argv, SCENE_OPTIONS "n:o:t")) != -1) {
+        switch (opt) {
+            case 'n': frames = atol(optarg); break;
+            case 'o': output = optarg; break;
+            case 't': text = true; break;
+            default:
+                if (!scene_option(&sc, opt, optarg)) {
+                    return -1;
+                }
+        }
+    }
+
+    synth_t *s = new synth_t();
+    scene_build(s, &sc);
+
+    FILE *capture_file = NULL;
+    capture_writer_t *cw = NULL;
+    if (output != NULL) {
+        capture_file = fopen(output, "wb");
+        if (capture_file == NULL) {
+            printf("ERROR: cannot create %s [%s]\n", output, strerror(errno));
+            return 1;
+        }
+        cw = new capture_writer_t();
+        capture_writer_begin(cw, CAPTURE_CHUNK_SIZE, 1, 0, &file_sink, capture_file);
+        for (size_t i = 0; i < s->ap_count; i++) {
+            capture_writer_set_ap(cw, (uint8_t) i, s->aps[i].name);
+        }
+    }
+
+    FILE *summary = text ? stderr : stdout; // Keep stdout to the frames
+    uint32_t crc = 0;
+    int8_t payload[CSI_RECORD_MAX_LEN];
+    csi_record_t r;
+    for (long i = 0; i < frames; i++) {
+        const wifi_csi_info_t *info = synth_next(s);
+        crc = frame_crc(crc, info);
+        if (cw != NULL) {
+            frame_record(s, info, (uint32_t) i, payload, &r);
+            capture_writer_append(cw, &r);
+        }
+        if (text) { // The line _csi_text_render prints with CSI_RAW
+            printf("%s,%d,%d,[", s->aps[s->ap].name, (int) info->rx_ctrl.rssi, (int) info->len);
+            for (int k = 0; k < std::min<int>(info->len, 128); k++) {
+                printf("%d ", info->buf[k]);
+            }
+            printf("]\n");
+        }
+    }
+    if (cw != NULL) {
+        capture_writer_finish(cw);
+        fclose(capture_file);
+        delete cw;
+    }
+    fprintf(summary, "%ld frames from %zu APs over %.1f s, %d byte buffers, seed %llu: fingerprint %08x\n", frames,
+            s->ap_count, s->now_us / 1e6, sc.ltfs * SYNTH_LTF_BYTES, (unsigned long long) sc.seed, crc);
+    delete s;
+    return 0;
+}
+
+int64_t percentile(std::vector<int64_t> &v, double q) {
+    if (v.empty()) {
+        return 0;
+    }
+    size_t i = (size_t) (q * (v.size() - 1));
+    std::nth_element(v.begin(), v.begin() + i, v.end());
+    return v[i];
+}
+
+#define STAGES 6
+#define BENCH_QUEUE_LEN 32 // CSI_STREAM_QUEUE_LEN
+const char *stage_names[STAGES] = {"synth", "record", "codec", "packet", "capture", "serial"};
+
+typedef struct {
+    synth_t *s;
+    csi_codec_t *codec;
+    capture_writer_t *capture;
+    uint64_t capture_bytes;
+    uint8_t packet[CSI_PACKET_MTU];
+    csi_packet_writer_t writer;
+    uint64_t datagrams;
+    uint8_t body[CSI_RECORD_HEADER_SIZE + CSI_RECORD_LABEL_SIZE + CSI_RECORD_MAX_LEN];
+    uint8_t frame[SERIAL_FRAME_MAX_ENCODED];
+    uint64_t serial_bytes;
+    int8_t payload[CSI_RECORD_MAX_LEN];
+    uint8_t coded[CSI_CODEC_MAX_ENCODED];
+    uint32_t seq;
+} pipeline_t;
+
+pipeline_t *pipeline_create(const scene_t *sc) {
+    pipeline_t *p = new pipeline_t();
+    p->s = new synth_t();
+    scene_build(p->s, sc);
+    p->codec = new csi_codec_t();
+    csi_codec_init(p->codec, CONFIG_CSI_KEYFRAME_INTERVAL);
+    p->capture = new capture_writer_t();
+    capture_writer_begin(p->capture, CAPTURE_CHUNK_SIZE, 1, 0, &count_sink, &p->capture_bytes);
+    csi_packet_begin(&p->writer, p->packet, sizeof(p->packet), 1);
+    return p;
+}
+
+void pipeline_destroy(pipeline_t *p) {
+    capture_writer_finish(p->capture);
+    delete p->capture;
+    delete p->codec;
+    delete p->s;
+    delete p;
+}
+
+// One frame through every stage, adding each stage's time to `ns`
+void pipeline_frame(pipeline_t *p, int64_t *ns) {
+    auto t0 = std::chrono::steady_clock::now();
+    const wifi_csi_info_t *info = synth_next(p->s);
+    auto t1 = std::chrono::steady_clock::now();
+    csi_record_t r, coded;
+    frame_record(p->s, info, p->seq++, p->payload, &r);
+    auto t2 = std::chrono::steady_clock::now();
+    csi_codec_encode(p->codec, &r, &coded, p->coded);
+    auto t3 = std::chrono::steady_clock::now();
+    if (!csi_packet_append(&p->writer, &coded)) {
+        csi_packet_finish(&p->writer);
+        p->datagrams++;
+        csi_packet_begin(&p->writer, p->packet, sizeof(p->packet), 1);
+        csi_packet_append(&p->writer, &coded);
+    }
+    auto t4 = std::chrono::steady_clock::now();
+    capture_writer_append(p->capture, &r);
+    auto t5 = std::chrono::steady_clock::now();
+    csi_record_put(p->body, &r);
+    p->serial_bytes += serial_frame_encode(SERIAL_FRAME_RECORD, r.seq, p->body, csi_record_encoded_size(&r), p->frame);
+    auto t6 = std::chrono::steady_clock::now();
+
+    std::chrono::steady_clock::time_point t[] = {t0, t1, t2, t3, t4, t5, t6};
+    for (int i = 0; i < STAGES; i++) {
+        ns[i] = std::chrono::duration_cast<std::chrono::nanoseconds>(t[i + 1] - t[i]).count();
+    }
+}
+
+int bench(int argc, char **argv) {
+    scene_t sc = scene_defaults();
+    double speedup = 10;
+    double seconds = 5;
+
+    int opt;
+    while ((opt = getopt(argc, argv, SCENE_OPTIONS "x:d:")) != -1) {
+        switch (opt) {
+            case 'x': speedup = atof(optarg); break;
+            case 'd': seconds = atof(optarg); break;
+            default:
+                if (!scene_option(&sc, opt, optarg)) {
+                    return -1;
+                }
+        }
+    }
+    double real_rate = sc.aps * sc.rate;
+    double rate = real_rate * speedup;
+    long frames = (long) (rate * seconds);
+    printf("%d APs x %.0f frames/s = %.0f frames/s real, paced at %.0fx = %.0f frames/s for %.0f s, %d byte buffers\n",
+           sc.aps, sc.rate, real_rate, speedup, rate, seconds, sc.ltfs * SYNTH_LTF_BYTES);
+
+    // Paced: the frames arrive on the synthetic clock sped up, like a callback firing
+    pipeline_t *p = pipeline_create(&sc);
+    std::vector<int64_t> stage_ns[STAGES], total_ns;
+    for (int i = 0; i < STAGES; i++) {
+        stage_ns[i].reserve(frames);
+    }
+    total_ns.reserve(frames);
+    long late = 0; // Frames handled after the queue would have overflowed
+    int64_t busy_ns = 0, max_lag_us = 0;
+    int64_t interval_us = (int64_t) (1e6 / rate);
+    auto start = std::chrono::steady_clock::now();
+    for (long i = 0; i < frames; i++) {
+        auto due = start + std::chrono::microseconds((int64_t) (synth_next_us(p->s) / speedup));
+        auto now = std::chrono::steady_clock::now();
+        if (now < due) {
+            std::this_thread::sleep_until(due);
+        } else {
+            int64_t lag_us = std::chrono::duration_cast<std::chrono::microseconds>(now - due).count();
+            max_lag_us = std::max(max_lag_us, lag_us);
+            late += lag_us > BENCH_QUEUE_LEN * interval_us;
+        }
+        int64_t ns[STAGES], total = 0;
+        pipeline_frame(p, ns);
+        for (int k = 0; k < STAGES; k++) {
+            stage_ns[k].push_back(ns[k]);
+            total += ns[k];
+        }
+        total_ns.push_back(total);
+        busy_ns += total;
+    }
+    double elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    uint64_t capture_bytes = p->capture_bytes, serial_bytes = p->serial_bytes, datagrams = p->datagrams;
+    double ratio = p->codec->raw_bytes > 0 ? (double) p->codec->coded_bytes / p->codec->raw_bytes : 0;
+    pipeline_destroy(p);
+
+    for (int k = 0; k < STAGES; k++) {
+        int64_t sum = 0;
+        for (int64_t v : stage_ns[k]) {
+            sum += v;
+        }
+        printf("  %-8s mean %7.0f ns  p50 %7lld ns  p99 %8lld ns\n", stage_names[k], (double) sum / frames,
+               (long long) percentile(stage_ns[k], 0.5), (long long) percentile(stage_ns[k], 0.99));
+    }
+    printf("  %-8s mean %7.0f ns  p50 %7lld ns  p99 %8lld ns\n", "total", (double) busy_ns / frames,
+           (long long) percentile(total_ns, 0.5), (long long) percentile(total_ns, 0.99));
+    printf("paced: %ld frames in %.2f s (%.0f frames/s), one core %.1f%% busy, at most %.1f frames behind, %ld past "
+           "the %d record queue\n", frames, elapsed, frames / elapsed, 100.0 * busy_ns / (elapsed * 1e9),
+           (double) max_lag_us / interval_us, late, BENCH_QUEUE_LEN);
+    printf("output: %llu datagrams, capture %.0f KiB/s, serial %.0f kbit/s, codec %.0f%% of raw\n",
+           (unsigned long long) datagrams, capture_bytes / elapsed / 1024, serial_bytes * 10 / elapsed / 1000,
+           100 * ratio);
+
+    // Unpaced: as fast as it goes
+    p = pipeline_create(&sc);
+    start = std::chrono::steady_clock::now();
+    for (long i = 0; i < frames; i++) {
+        int64_t ns[STAGES];
+        pipeline_frame(p, ns);
+    }
+    elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    pipeline_destroy(p);
+    printf("unpaced: %.0f frames/s, %.0fx the real rate\n", frames / elapsed, frames / elapsed / real_rate);
+
+    bool ok = late == 0;
+    printf("%s\n", ok ? "OK" : "FAILED: could not keep up");
+    return ok ? 0 : 1;
+}
+
+// Amplitude spread across the LLTF's occupied subcarriers, standard deviation over mean
+double amplitude_spread(const wifi_csi_info_t *info) {
+    double sum = 0, sum2 = 0;
+    int n = 0;
+    for (int i = 0; i < SYNTH_SUBCARRIERS; i++) {
+        if (_synth_occupied(synth_subcarrier(i), false)) {
+            double a = hypot(info->buf[2 * i], info->buf[2 * i + 1]);
+            sum += a;
+            sum2 += a * a;
+            n++;
+        }
+    }
+    double mean = sum / n;
+    return sqrt(std::max(0.0, sum2 / n - mean * mean)) / mean;
+}
+
+bool report_check(const char *name, bool ok, const char *detail) {
+    printf("%-24s %-6s %s\n", name, ok ? "OK" : "FAILED", detail);
+    return ok;
+}
+
+int check(int argc, char **argv) {
+    scene_t sc = scene_defaults();
+    const char *pinned = NULL;
+
+    int opt;
+    while ((opt = getopt(argc, argv, SCENE_OPTIONS "F:")) != -1) {
+        if (opt == 'F') {
+            pinned = optarg;
+        } else if (!scene_option(&sc, opt, optarg)) {
+            return -1;
+        }
+    }
+    const long frames = 20000;
+    char detail[160];
+    bool ok = true;
+
+    // Determinism
+    uint32_t crc[3] = {0, 0, 0};
+    for (int run = 0; run < 3; run++) {
+        scene_t other = sc;
+        other.seed = run < 2 ? sc.seed : sc.seed + 1;
+        synth_t *s = new synth_t();
+        scene_build(s, &other);
+        for (long i = 0; i < frames; i++) {
+            crc[run] = frame_crc(crc[run], synth_next(s));
+        }
+        delete s;
+    }
+    snprintf(detail, sizeof(detail), "seed %llu: %08x, %08x; seed %llu: %08x", (unsigned long long) sc.seed, crc[0],
+             crc[1], (unsigned long long) sc.seed + 1, crc[2]);
+    ok &= report_check("same seed, same frames", crc[0] == crc[1] && crc[0] != crc[2], detail);
+    if (pinned != NULL) {
+        uint32_t expected = (uint32_t) strtoul(pinned, NULL, 16);
+        snprintf(detail, sizeof(detail), "expected %08x, got %08x", expected, crc[0]);
+        ok &= report_check("fingerprint", crc[0] == expected, detail);
+    }
+
+    // Rates, lengths and null subcarriers
+    synth_t *s = new synth_t();
+    scene_build(s, &sc);
+    std::vector<long> per_ap(s->ap_count, 0);
+    long bad_layout = 0, backwards = 0;
+    int64_t last_us = 0;
+    for (long i = 0; i < frames; i++) {
+        const wifi_csi_info_t *info = synth_next(s);
+        per_ap[s->ap]++;
+        backwards += s->now_us < last_us;
+        last_us = s->now_us;
+        bad_layout += info->len != sc.ltfs * SYNTH_LTF_BYTES || info->rx_ctrl.channel != s->aps[s->ap].channel ||
+                      memcmp(info->mac, s->aps[s->ap].mac, 6) != 0;
+        for (int ltf = 0; ltf < sc.ltfs; ltf++) {
+            for (int k = 0; k < SYNTH_SUBCARRIERS; k++) {
+                const int8_t *iq = info->buf + ltf * SYNTH_LTF_BYTES + 2 * k;
+                bad_layout += !_synth_occupied(synth_subcarrier(k), ltf > 0) && (iq[0] != 0 || iq[1] != 0);
+            }
+        }
+    }
+    double seconds = s->now_us / 1e6;
+    double worst = 0;
+    for (long n : per_ap) {
+        worst = std::max(worst, fabs(n / seconds - sc.rate) / sc.rate);
+    }
+    snprintf(detail, sizeof(detail), "%zu APs over %.1f s, worst AP %.1f%% off %.0f/s", per_ap.size(), seconds,
+             100 * worst, sc.rate);
+    ok &= report_check("per-AP rate", worst < 0.02 && backwards == 0, detail);
+    snprintf(detail, sizeof(detail), "%ld frames with a wrong length, channel, MAC or non-zero null subcarrier",
+             bad_layout);
+    ok &= report_check("frame layout", bad_layout == 0, detail);
+    delete s;
+
+    // RSSI falls with distance: a receiver parked at 1, 3 and 9 m from a lone AP
+    double rssi[3];
+    const double distances[3] = {1, 3, 9};
+    for (int d = 0; d < 3; d++) {
+        s = new synth_t();
+        synth_init(s, sc.seed);
+        synth_add_ap(s, "AP1", 0, 0, 6, sc.rate);
+        synth_set_position(s, distances[d], 0);
+        double sum = 0;
+        for (int i = 0; i < 1000; i++) {
+            sum += synth_next(s)->rx_ctrl.rssi;
+        }
+        rssi[d] = sum / 1000;
+        delete s;
+    }
+    snprintf(detail, sizeof(detail), "%.1f dBm at 1 m, %.1f at 3 m, %.1f at 9 m", rssi[0], rssi[1], rssi[2]);
+    ok &= report_check("RSSI against distance", rssi[0] > rssi[1] + 6 && rssi[1] > rssi[2] + 6, detail);
+
+    // Multipath makes the channel frequency selective, a lone direct path leaves it flat
+    double spread[2];
+    for (int m = 0; m < 2; m++) {
+        scene_t one = sc;
+        one.scatterers = m == 0 ? 0 : 24;
+        s = new synth_t();
+        scene_build(s, &one);
+        double sum = 0;
+        for (int i = 0; i < 2000; i++) {
+            sum += amplitude_spread(synth_next(s));
+        }
+        spread[m] = sum / 2000;
+        delete s;
+    }
+    snprintf(detail, sizeof(detail), "amplitude spread %.2f without scatterers, %.2f with 24", spread[0], spread[1]);
+    ok &= report_check("multipath", spread[0] < 0.1 && spread[1] > 2 * spread[0], detail);
+
+    printf("%s\n", ok ? "OK" : "FAILED");
+    return ok ? 0 : 1;
+}
+
+int main(int argc, char **argv) {
+    int rc = -1;
+    if (argc >= 2 && strcmp(argv[1], "gen") == 0) {
+        rc = gen(argc - 1, argv + 1);
+    } else if (argc >= 2 && strcmp(argv[1], "bench") == 0) {
+        rc = bench(argc - 1, argv + 1);
+    } else if (argc >= 2 && strcmp(argv[1], "check") == 0) {
+        rc = check(argc - 1, argv + 1);
+    }
+    if (rc == -1) {
+        fprintf(stderr,
+                "usage: %s gen [scene] [-n frames] [-o capture.csi] [-t]\n"
+                "       %s bench [scene] [-x speedup] [-d seconds]\n"
+                "       %s check [scene] [-F fingerprint]\n"
+                "scene: [-S seed] [-a aps] [-r rate_per_ap] [-m scatterers] [-l ltfs] [-W width] [-H height] "
+                "[-v speed]\n", argv[0], argv[0], argv[0]);
+        return 1;
+    }
+    return rc;
+}
@@ -0,0 +1,383 @@
+#ifndef CSI_TOOLS_SYNTH_H
+#define CSI_TOOLS_SYNTH_H
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+#include <algorithm>
+
+#include "hal_component.h" // wifi_csi_info_t on the host
+
+/*
+ * Synthetic CSI for running the capture, codec and inference code without a board.
+ *
+ * A scene has APs, point scatterers (walls, furniture) and a receiver that follows a path of waypoints. Each
+ * frame comes from the AP whose next transmission is due (per-AP rate with jitter). Its channel is the sum
+ * of the direct path and one bounce off every scatterer, each with free-space loss, the scatterer's
+ * reflectivity and its delay. It is evaluated on the 64 subcarriers of a 20 MHz channel, then put through
+ * what the ESP32 does to it:
+ *   - a random common phase and a linear phase slope per frame (carrier phase and timing offset),
+ *   - AGC, which scales the channel to a fixed level whatever the RSSI,
+ *   - noise at the frame's SNR (RSSI over the noise floor),
+ *   - int8 quantization in esp_wifi's layout: imaginary then real per subcarrier, subcarriers 0..31 then
+ *     -32..-1, null subcarriers zero.
+ * The result is a wifi_csi_info_t with its rx_ctrl (rssi, rate, sig_mode, mcs, noise_floor, channel,
+ * timestamp, sig_len), the AP's MAC and 128, 256 or 384 bytes of LLTF / HT-LTF / STBC-HT-LTF.
+ *
+ * Everything random comes from one xorshift generator seeded by synth_init, so a seed always gives the
+ * same frames (the generator does not use std:: distributions, whose output differs between libraries).
+ *
+ *   synth_t *s = new synth_t();
+ *   synth_init(s, 42);
+ *   synth_add_ap(s, "AP1", 0, 0, 6, 100);
+ *   synth_add_scatterers(s, 8, 0.8, -5, -5, 5, 5);
+ *   synth_add_waypoint(s, 1, 1, 0); synth_add_waypoint(s, 4, 1, 1.0);
+ *   const wifi_csi_info_t *frame = synth_next(s); // s->now_us, s->ap, s->x, s->y describe it
+ */
+
+#define SYNTH_MAX_APS 16
+#define SYNTH_MAX_SCATTERERS 64
+#define SYNTH_MAX_WAYPOINTS 64
+#define SYNTH_SUBCARRIERS 64
+#define SYNTH_LTF_BYTES (2 * SYNTH_SUBCARRIERS)
+#define SYNTH_SUBCARRIER_SPACING_HZ 312500.0
+#define SYNTH_SPEED_OF_LIGHT 299792458.0
+#define SYNTH_AGC_LEVEL 24.0 // RMS magnitude esp_wifi reports after AGC, whatever the RSSI
+
+typedef struct {
+    char name[32];
+    double x, y; // Metres
+    uint8_t mac[6];
+    uint8_t channel; // 1..13
+    double tx_power_dbm;
+    double rate_hz; // Frames per second
+    int64_t next_us; // When it sends next
+} synth_ap_t;
+
+typedef struct {
+    double x, y;
+    double reflectivity; // Amplitude kept by a bounce, 0..1
+} synth_scatterer_t;
+
+typedef struct {
+    double x, y;
+    double speed; // Metres per second on the way here from the previous waypoint
+} synth_waypoint_t;
+
+typedef struct {
+    uint64_t state;
+    double spare; // Second value of the last Box-Muller pair
+    bool has_spare;
+} synth_rng_t;
+
+typedef struct {
+    synth_ap_t aps[SYNTH_MAX_APS];
+    size_t ap_count;
+    synth_scatterer_t scatterers[SYNTH_MAX_SCATTERERS];
+    size_t scatterer_count;
+    synth_waypoint_t path[SYNTH_MAX_WAYPOINTS];
+    double path_time_s[SYNTH_MAX_WAYPOINTS]; // Time the receiver reaches each waypoint
+    size_t path_count;
+    bool path_loop; // Walk back to the first waypoint and start over, instead of stopping at the last
+
+    double noise_floor_dbm;
+    double shadowing_db; // RSSI jitter per frame
+    double path_loss_exponent; // Extra loss beyond free space: (exponent - 2) * 10 dB per decade
+    double jitter; // Per-AP frame interval jitter, as a fraction of the interval
+    double timing_offset; // Largest timing offset per frame, in samples (the phase slope across subcarriers)
+    uint8_t ltfs; // 1 = LLTF (128 bytes), 2 = + HT-LTF (256), 3 = + STBC HT-LTF (384)
+    uint8_t station_mac[6];
+
+    synth_rng_t rng;
+    int64_t now_us; // Time of the last frame
+    size_t ap; // AP of the last frame
+    double x, y; // Receiver position of the last frame
+    double distance; // From the last frame's AP
+    uint64_t frames;
+
+    int8_t buf[3 * SYNTH_LTF_BYTES];
+    wifi_csi_info_t info;
+} synth_t;
+
+inline uint64_t synth_rng_next(synth_rng_t *r) {
+    r->state ^= r->state >> 12;
+    r->state ^= r->state << 25;
+    r->state ^= r->state >> 27;
+    return r->state * 0x2545F4914F6CDD1DULL;
+}
+
+// Uniform in [0, 1)
+inline double synth_uniform(synth_rng_t *r) {
+    return (synth_rng_next(r) >> 11) * (1.0 / 9007199254740992.0);
+}
+
+// Standard normal (Box-Muller, both values of a pair are used)
+inline double synth_gauss(synth_rng_t *r) {
+    if (r->has_spare) {
+        r->has_spare = false;
+        return r->spare;
+    }
+    double radius = sqrt(-2.0 * log(1.0 - synth_uniform(r)));
+    double angle = 2 * M_PI * synth_uniform(r);
+    r->spare = radius * sin(angle);
+    r->has_spare = true;
+    return radius * cos(angle);
+}
+
+// Empty scene with indoor defaults. The whole scene is derived from `seed`.
+inline void synth_init(synth_t *s, uint64_t seed) {
+    memset(s, 0, sizeof(*s));
+    s->rng.state = seed * 0x9E3779B97F4A7C15ULL + 0x632BE59BD9B4E019ULL; // Never zero
+    s->noise_floor_dbm = -92;
+    s->shadowing_db = 1.5;
+    s->path_loss_exponent = 2.8;
+    s->jitter = 0.1;
+    s->timing_offset = 0.5;
+    s->ltfs = 1;
+    s->path_loop = true;
+    s->station_mac[0] = 0x24;
+    s->station_mac[1] = 0x0A;
+    s->station_mac[2] = 0xC4;
+    for (int i = 3; i < 6; i++) {
+        s->station_mac[i] = (uint8_t) synth_rng_next(&s->rng);
+    }
+}
+
+// Add an AP at (x, y) metres sending `rate_hz` frames per second. Returns its index, or -1 if full.
+inline int synth_add_ap(synth_t *s, const char *name, double x, double y, uint8_t channel, double rate_hz) {
+    if (s->ap_count == SYNTH_MAX_APS) {
+        return -1;
+    }
+    synth_ap_t *ap = &s->aps[s->ap_count];
+    snprintf(ap->name, sizeof(ap->name), "%s", name);
+    ap->x = x;
+    ap->y = y;
+    ap->channel = channel;
+    ap->tx_power_dbm = 20;
+    ap->rate_hz = rate_hz;
+    ap->next_us = (int64_t) (synth_uniform(&s->rng) * 1e6 / rate_hz); // APs do not start in step
+    ap->mac[0] = 0x02; // Locally administered
+    for (int i = 1; i < 6; i++) {
+        ap->mac[i] = (uint8_t) synth_rng_next(&s->rng);
+    }
+    return (int) s->ap_count++;
+}
+
+// Scatter `count` reflectors over the rectangle (x0, y0)-(x1, y1), reflectivity up to `reflectivity`
+inline void synth_add_scatterers(synth_t *s, size_t count, double reflectivity, double x0, double y0, double x1,
+                                 double y1) {
+    for (size_t i = 0; i < count && s->scatterer_count < SYNTH_MAX_SCATTERERS; i++) {
+        synth_scatterer_t *sc = &s->scatterers[s->scatterer_count++];
+        sc->x = x0 + (x1 - x0) * synth_uniform(&s->rng);
+        sc->y = y0 + (y1 - y0) * synth_uniform(&s->rng);
+        sc->reflectivity = reflectivity * (0.3 + 0.7 * synth_uniform(&s->rng));
+    }
+}
+
+// Append a waypoint, reached at `speed` m/s from the previous one (the first one is the start)
+inline bool synth_add_waypoint(synth_t *s, double x, double y, double speed) {
+    if (s->path_count == SYNTH_MAX_WAYPOINTS) {
+        return false;
+    }
+    size_t i = s->path_count++;
+    s->path[i].x = x;
+    s->path[i].y = y;
+    s->path[i].speed = speed;
+    s->path_time_s[i] = 0;
+    if (i > 0) {
+        double d = hypot(x - s->path[i - 1].x, y - s->path[i - 1].y);
+        s->path_time_s[i] = s->path_time_s[i - 1] + (speed > 0 ? d / speed : 0);
+    }
+    if (i == 0) {
+        s->x = x;
+        s->y = y;
+    }
+    return true;
+}
+
+// Place the receiver directly, for callers that move it themselves (no waypoints)
+inline void synth_set_position(synth_t *s, double x, double y) {
+    s->x = x;
+    s->y = y;
+}
+
+// When the next frame is due, e.g. to move the receiver there first with synth_set_position
+inline int64_t synth_next_us(const synth_t *s) {
+    int64_t next = s->aps[0].next_us;
+    for (size_t i = 1; i < s->ap_count; i++) {
+        next = std::min(next, s->aps[i].next_us);
+    }
+    return next;
+}
+
+// Receiver position at `t_s` seconds along the path
+inline void _synth_path_position(const synth_t *s, double t_s, double *x, double *y) {
+    size_t n = s->path_count;
+    double total = s->path_time_s[n - 1];
+    if (s->path_loop && n > 1) {
+        double back = hypot(s->path[0].x - s->path[n - 1].x, s->path[0].y - s->path[n - 1].y) /
+                      (s->path[1].speed > 0 ? s->path[1].speed : 1);
+        double period = total + back;
+        t_s = period > 0 ? fmod(t_s, period) : 0;
+        if (t_s > total) {
+            double f = back > 0 ? (t_s - total) / back : 1;
+            *x = s->path[n - 1].x + (s->path[0].x - s->path[n - 1].x) * f;
+            *y = s->path[n - 1].y + (s->path[0].y - s->path[n - 1].y) * f;
+            return;
+        }
+    }
+    if (t_s >= total) {
+        *x = s->path[n - 1].x;
+        *y = s->path[n - 1].y;
+        return;
+    }
+    size_t i = 1;
+    while (s->path_time_s[i] < t_s) {
+        i++;
+    }
+    double span = s->path_time_s[i] - s->path_time_s[i - 1];
+    double f = span > 0 ? (t_s - s->path_time_s[i - 1]) / span : 1;
+    *x = s->path[i - 1].x + (s->path[i].x - s->path[i - 1].x) * f;
+    *y = s->path[i - 1].y + (s->path[i].y - s->path[i - 1].y) * f;
+}
+
+// Subcarrier index (-32..31) of position `i` in esp_wifi's buffer order
+inline int synth_subcarrier(int i) {
+    return i < SYNTH_SUBCARRIERS / 2 ? i : i - SYNTH_SUBCARRIERS;
+}
+
+/*
+ * Channel from `ap` to (x, y) on every subcarrier, `re`/`im` indexed like the buffer. Returns the received
+ * power relative to the transmitted one, in dB.
+ */
+inline double synth_channel(const synth_t *s, const synth_ap_t *ap, double x, double y, double *re, double *im) {
+    double fc = (2407.0 + 5.0 * ap->channel) * 1e6;
+    double lambda = SYNTH_SPEED_OF_LIGHT / fc;
+    for (int i = 0; i < SYNTH_SUBCARRIERS; i++) {
+        re[i] = im[i] = 0;
+    }
+
+    double power = 0;
+    for (size_t p = 0; p <= s->scatterer_count; p++) {
+        double d, gain;
+        if (p == 0) {
+            d = std::max(0.1, hypot(x - ap->x, y - ap->y));
+            gain = 1;
+        } else {
+            const synth_scatterer_t *sc = &s->scatterers[p - 1];
+            d = std::max(0.1, hypot(sc->x - ap->x, sc->y - ap->y)) + std::max(0.1, hypot(x - sc->x, y - sc->y));
+            gain = sc->reflectivity;
+        }
+        // Free space, plus the indoor excess loss
+        double amplitude = gain * lambda / (4 * M_PI * d) * pow(d, -(s->path_loss_exponent - 2) / 2);
+        double delay = d / SYNTH_SPEED_OF_LIGHT;
+        power += amplitude * amplitude;
+        // e^(-j 2pi (fc + k df) delay), stepping k from -32 by multiplying with the per-subcarrier rotation
+        double phase = -2 * M_PI * (fc - SYNTH_SUBCARRIERS / 2 * SYNTH_SUBCARRIER_SPACING_HZ) * delay;
+        double step = -2 * M_PI * SYNTH_SUBCARRIER_SPACING_HZ * delay;
+        double pr = amplitude * cos(phase), pi = amplitude * sin(phase);
+        double sr = cos(step), si = sin(step);
+        for (int k = -SYNTH_SUBCARRIERS / 2; k < SYNTH_SUBCARRIERS / 2; k++) {
+            int i = k < 0 ? k + SYNTH_SUBCARRIERS : k;
+            re[i] += pr;
+            im[i] += pi;
+            double t = pr * sr - pi * si;
+            pi = pr * si + pi * sr;
+            pr = t;
+        }
+    }
+    return 10 * log10(power);
+}
+
+// Subcarriers that carry the LTF: -26..26 without DC for the LLTF, -28..28 for the HT-LTF
+inline bool _synth_occupied(int k, bool ht) {
+    return k != 0 && (ht ? (k >= -28 && k <= 28) : (k >= -26 && k <= 26));
+}
+
+// Generate the next frame. The returned info and its buffer stay valid until the next call.
+inline const wifi_csi_info_t *synth_next(synth_t *s) {
+    // The AP whose frame is due first
+    size_t a = 0;
+    for (size_t i = 1; i < s->ap_count; i++) {
+        if (s->aps[i].next_us < s->aps[a].next_us) {
+            a = i;
+        }
+    }
+    synth_ap_t *ap = &s->aps[a];
+    s->now_us = ap->next_us;
+    double interval_us = 1e6 / ap->rate_hz;
+    ap->next_us += (int64_t) std::max(1.0, interval_us * (1 + s->jitter * (2 * synth_uniform(&s->rng) - 1)));
+    s->ap = a;
+    if (s->path_count > 0) {
+        _synth_path_position(s, s->now_us / 1e6, &s->x, &s->y);
+    }
+    s->distance = hypot(s->x - ap->x, s->y - ap->y);
+
+    double re[SYNTH_SUBCARRIERS], im[SYNTH_SUBCARRIERS];
+    double gain_db = synth_channel(s, ap, s->x, s->y, re, im);
+    double rssi = ap->tx_power_dbm + gain_db + s->shadowing_db * synth_gauss(&s->rng);
+    rssi = std::max(s->noise_floor_dbm + 1, std::min(-10.0, rssi));
+    double snr_db = rssi - s->noise_floor_dbm;
+
+    // AGC: scale to a fixed RMS level over the occupied subcarriers
+    double sum = 0;
+    int occupied = 0;
+    for (int i = 0; i < SYNTH_SUBCARRIERS; i++) {
+        if (_synth_occupied(synth_subcarrier(i), false)) {
+            sum += re[i] * re[i] + im[i] * im[i];
+            occupied++;
+        }
+    }
+    double scale = SYNTH_AGC_LEVEL / sqrt(sum / occupied);
+    double noise = SYNTH_AGC_LEVEL / sqrt(2.0) / pow(10, snr_db / 20);
+
+    for (uint8_t ltf = 0; ltf < s->ltfs; ltf++) {
+        // Each LTF sees its own carrier phase and timing offset
+        double common = 2 * M_PI * synth_uniform(&s->rng);
+        double slope = 2 * M_PI * s->timing_offset * (2 * synth_uniform(&s->rng) - 1) / SYNTH_SUBCARRIERS;
+        double rot_re[SYNTH_SUBCARRIERS], rot_im[SYNTH_SUBCARRIERS];
+        double cr = cos(common - slope * SYNTH_SUBCARRIERS / 2), ci = sin(common - slope * SYNTH_SUBCARRIERS / 2);
+        double sr = cos(slope), si = sin(slope);
+        for (int k = -SYNTH_SUBCARRIERS / 2; k < SYNTH_SUBCARRIERS / 2; k++) {
+            int i = k < 0 ? k + SYNTH_SUBCARRIERS : k;
+            rot_re[i] = cr;
+            rot_im[i] = ci;
+            double t = cr * sr - ci * si;
+            ci = cr * si + ci * sr;
+            cr = t;
+        }
+        int8_t *out = s->buf + ltf * SYNTH_LTF_BYTES;
+        for (int i = 0; i < SYNTH_SUBCARRIERS; i++) {
+            if (!_synth_occupied(synth_subcarrier(i), ltf > 0)) {
+                out[2 * i] = out[2 * i + 1] = 0;
+                continue;
+            }
+            double c = rot_re[i], sn = rot_im[i];
+            double vr = scale * (re[i] * c - im[i] * sn) + noise * synth_gauss(&s->rng);
+            double vi = scale * (re[i] * sn + im[i] * c) + noise * synth_gauss(&s->rng);
+            out[2 * i] = (int8_t) std::max(-128.0, std::min(127.0, round(vi)));
+            out[2 * i + 1] = (int8_t) std::max(-128.0, std::min(127.0, round(vr)));
+        }
+    }
+
+    wifi_csi_info_t *info = &s->info;
+    memset(info, 0, sizeof(*info));
+    info->rx_ctrl.rssi = (int) lround(rssi);
+    info->rx_ctrl.rate = s->ltfs > 1 ? 0 : 11; // 11 = 6 Mbit/s legacy
+    info->rx_ctrl.sig_mode = s->ltfs > 1 ? 1 : 0; // HT
+    info->rx_ctrl.mcs = s->ltfs > 1 ? 7 : 0;
+    info->rx_ctrl.stbc = s->ltfs > 2 ? 1 : 0;
+    info->rx_ctrl.noise_floor = (int) s->noise_floor_dbm;
+    info->rx_ctrl.channel = ap->channel;
+    info->rx_ctrl.timestamp = (uint32_t) s->now_us;
+    info->rx_ctrl.sig_len = 100 + (unsigned) (synth_rng_next(&s->rng) % 1400);
+    memcpy(info->mac, ap->mac, 6);
+    memcpy(info->dmac, s->station_mac, 6);
+    info->buf = s->buf;
+    info->len = (uint16_t) (s->ltfs * SYNTH_LTF_BYTES);
+    s->frames++;
+    return info;
+}
+
+#endif //CSI_TOOLS_SYNTH_H
@@ -0,0 +1,289 @@
+/*
+ * Reference time server for the station time sync (time_component.h), and a loopback benchmark of it.
+ *
+ *   csi_time_sync serve [-p port]
+ *       answer sync requests with this host's system clock (UDP 2224 by default, next to the collector)
+ *   csi_time_sync bench [-n rounds] [-i interval_ms] [-d delay_us] [-j jitter_us] [-s spike_prob]
+ *                       [-o offset_us] [-r drift_ppm]
+ *       run the sync against a server on loopback that delays every request and response by
+ *       delay + uniform(0, jitter), plus 10 x jitter with probability spike_prob (queueing). The station
+ *       clock is simulated with a fixed offset and drift. Before every round the error of the synced time
+ *       against the true reference is measured, next to a naive sync that trusts one exchange per round and
+ *       ignores drift. Also reports the cost of a round and of time_sync_now_us().
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <random>
+#include <thread>
+#include <vector>
+
+#include "time_component.h"
+
+#define REFERENCE_EPOCH_US 1700000000000000LL // The simulated reference clock reads steady + this
+
+typedef struct {
+    int64_t start_us;
+    int64_t offset_us;
+    double drift_ppm;
+} station_clock_t;
+
+int64_t true_us() {
+    return std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+int64_t reference_clock(void *) {
+    return true_us() + REFERENCE_EPOCH_US;
+}
+
+// Local time of the simulated station at true time `t`
+int64_t station_at(const station_clock_t *c, int64_t t) {
+    return c->offset_us + t + (int64_t) ((t - c->start_us) * c->drift_ppm * 1e-6);
+}
+
+int64_t station_clock(void *ctx) {
+    return station_at((const station_clock_t *) ctx, true_us());
+}
+
+int open_server(uint16_t port) {
+    int fd = socket(PF_INET, SOCK_DGRAM, 0);
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(port);
+    addr.sin_addr.s_addr = htonl(INADDR_ANY);
+    if (fd == -1 || bind(fd, (const struct sockaddr *) &addr, sizeof(addr)) == -1) {
+        printf("ERROR: cannot bind UDP %u [%s]\n", port, strerror(errno));
+        return -1;
+    }
+    return fd;
+}
+
+int serve(int argc, char **argv) {
+    uint16_t port = TIME_SYNC_PORT;
+    int opt;
+    while ((opt = getopt(argc, argv, "p:")) != -1) {
+        switch (opt) {
+            case 'p': port = (uint16_t) atoi(optarg); break;
+            default:
+                fprintf(stderr, "usage: csi_time_sync serve [-p port]\n");
+                return 1;
+        }
+    }
+    int fd = open_server(port);
+    if (fd == -1) {
+        return 1;
+    }
+    printf("time reference on UDP %u\n", port);
+    uint64_t answered = 0;
+    while (true) {
+        if (time_server_handle(fd, NULL, NULL) && ++answered % 1000 == 0) {
+            printf("%llu requests answered\n", (unsigned long long) answered);
+        }
+    }
+}
+
+typedef struct {
+    int fd;
+    int64_t delay_us;
+    int64_t jitter_us;
+    double spike_prob;
+    std::atomic<bool> running{true};
+} bench_server_t;
+
+int64_t one_way_delay(bench_server_t *s, std::mt19937 *rng) {
+    std::uniform_real_distribution<double> u(0, 1);
+    int64_t d = s->delay_us + (int64_t) (u(*rng) * s->jitter_us);
+    if (u(*rng) < s->spike_prob) {
+        d += 10 * s->jitter_us;
+    }
+    return d;
+}
+
+// Hold the request before stamping t2 (uplink) and the response after stamping t3 (downlink)
+void bench_server_loop(bench_server_t *s) {
+    std::mt19937 rng(5);
+    struct timeval timeout = {0, 100000};
+    setsockopt(s->fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+    uint8_t buf[TIME_SYNC_MESSAGE_SIZE];
+    while (s->running) {
+        struct sockaddr_in from;
+        socklen_t from_len = sizeof(from);
+        ssize_t len = recvfrom(s->fd, buf, sizeof(buf), 0, (struct sockaddr *) &from, &from_len);
+        uint32_t seq;
+        int64_t t1, t2, t3;
+        if (!_time_sync_decode(buf, len, TIME_SYNC_REQUEST, &seq, &t1, &t2, &t3)) {
+            continue;
+        }
+        std::this_thread::sleep_for(std::chrono::microseconds(one_way_delay(s, &rng)));
+        t2 = reference_clock(NULL);
+        t3 = reference_clock(NULL);
+        std::this_thread::sleep_for(std::chrono::microseconds(one_way_delay(s, &rng)));
+        _time_sync_encode(buf, TIME_SYNC_RESPONSE, seq, t1, t2, t3);
+        sendto(s->fd, buf, sizeof(buf), 0, (const struct sockaddr *) &from, from_len);
+    }
+}
+
+// The naive sync: one exchange, its offset is used as is until the next round
+bool naive_exchange(int fd, const struct sockaddr_in *server, station_clock_t *clock, int64_t *offset) {
+    uint8_t buf[TIME_SYNC_MESSAGE_SIZE];
+    int64_t t1 = station_clock(clock);
+    _time_sync_encode(buf, TIME_SYNC_REQUEST, 0xFFFFFFFF, t1, 0, 0);
+    sendto(fd, buf, sizeof(buf), 0, (const struct sockaddr *) server, sizeof(*server));
+    while (true) {
+        ssize_t len = recv(fd, buf, sizeof(buf), 0);
+        int64_t t4 = station_clock(clock);
+        uint32_t seq;
+        int64_t echo, t2, t3;
+        if (len < 0) {
+            return false;
+        }
+        if (_time_sync_decode(buf, len, TIME_SYNC_RESPONSE, &seq, &echo, &t2, &t3) && echo == t1) {
+            *offset = ((t2 - t1) + (t3 - t4)) / 2;
+            return true;
+        }
+    }
+}
+
+typedef struct {
+    std::vector<double> errors;
+
+    void add(int64_t e) {
+        errors.push_back((double) e);
+    }
+
+    void print(const char *name) {
+        std::vector<double> a;
+        for (double e : errors) {
+            a.push_back(std::fabs(e));
+        }
+        std::sort(a.begin(), a.end());
+        double mean = 0;
+        for (double e : errors) {
+            mean += e;
+        }
+        mean /= errors.size();
+        printf("%-28s |error| p50 %6.0f us  p95 %6.0f us  max %6.0f us  (mean signed %+.0f us)\n", name,
+               a[a.size() / 2], a[a.size() * 95 / 100], a.back(), mean);
+    }
+} error_stats_t;
+
+int bench(int argc, char **argv) {
+    int rounds = 16;
+    int interval_ms = 1000;
+    bench_server_t server;
+    server.delay_us = 200;
+    server.jitter_us = 400;
+    server.spike_prob = 0.2;
+    station_clock_t clock = {true_us(), -123456789, 100.0};
+
+    int opt;
+    while ((opt = getopt(argc, argv, "n:i:d:j:s:o:r:")) != -1) {
+        switch (opt) {
+            case 'n': rounds = atoi(optarg); break;
+            case 'i': interval_ms = atoi(optarg); break;
+            case 'd': server.delay_us = atoll(optarg); break;
+            case 'j': server.jitter_us = atoll(optarg); break;
+            case 's': server.spike_prob = atof(optarg); break;
+            case 'o': clock.offset_us = atoll(optarg); break;
+            case 'r': clock.drift_ppm = atof(optarg); break;
+            default:
+                fprintf(stderr, "usage: csi_time_sync bench [-n rounds] [-i interval_ms] [-d delay_us] [-j jitter_us] "
+                                "[-s spike_prob] [-o offset_us] [-r drift_ppm]\n");
+                return 1;
+        }
+    }
+    if (rounds < 3) {
+        rounds = 3;
+    }
+
+    server.fd = open_server(0);
+    if (server.fd == -1) {
+        return 1;
+    }
+    struct sockaddr_in addr;
+    socklen_t addr_len = sizeof(addr);
+    getsockname(server.fd, (struct sockaddr *) &addr, &addr_len);
+    uint16_t port = ntohs(addr.sin_port);
+    std::thread server_thread(bench_server_loop, &server);
+
+    time_sync_t *sync = new time_sync_t();
+    if (!time_sync_init(sync, "127.0.0.1", port, &station_clock, &clock)) {
+        return 1;
+    }
+    int naive_fd = socket(PF_INET, SOCK_DGRAM, 0);
+    struct timeval timeout = {0, TIME_SYNC_TIMEOUT_MS * 1000};
+    setsockopt(naive_fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+
+    error_stats_t synced, naive;
+    std::vector<double> round_us;
+    int64_t naive_offset = 0;
+    bool naive_ok = false;
+    for (int i = 0; i < rounds; i++) {
+        // Error just before the next round: the longest the estimate has to hold
+        if (i >= 2) {
+            int64_t t = true_us();
+            int64_t local = station_at(&clock, t);
+            int64_t truth = t + REFERENCE_EPOCH_US;
+            synced.add(time_sync_to_reference(sync, local) - truth);
+            if (naive_ok) {
+                naive.add(local + naive_offset - truth);
+            }
+        }
+
+        if (!time_sync_round(sync)) {
+            printf("round %d: no response\n", i);
+        }
+        time_sync_stats_t st;
+        time_sync_get_stats(sync, &st);
+        round_us.push_back((double) st.round_us);
+        naive_ok = naive_exchange(naive_fd, &sync->server, &clock, &naive_offset) || naive_ok;
+        std::this_thread::sleep_for(std::chrono::milliseconds(interval_ms));
+    }
+
+    time_sync_stats_t st;
+    time_sync_get_stats(sync, &st);
+    printf("one-way delay %lld + U(0, %lld) us, spikes +%lld us at p=%.2f; station offset %lld us, drift %.1f ppm\n",
+           (long long) server.delay_us, (long long) server.jitter_us, (long long) (10 * server.jitter_us),
+           server.spike_prob, (long long) clock.offset_us, clock.drift_ppm);
+    printf("%d rounds every %d ms, %d requests per round\n", rounds, interval_ms, TIME_SYNC_BURST);
+    synced.print("min-RTT burst + drift fit:");
+    naive.print("one exchange, no drift:");
+    printf("estimated drift %.1f ppm (true %.1f), last kept rtt %lld us, timeouts %llu\n", st.drift_ppm,
+           clock.drift_ppm, (long long) st.last_rtt_us, (unsigned long long) st.timeouts);
+
+    std::sort(round_us.begin(), round_us.end());
+    int calls = 1000000;
+    int64_t start = true_us();
+    int64_t sink = 0;
+    for (int i = 0; i < calls; i++) {
+        sink += time_sync_now_us(sync) & 1;
+    }
+    double now_ns = (true_us() - start) * 1000.0 / calls;
+    printf("overhead: round p50 %.0f us, %d bytes on the wire per round (UDP payload), time_sync_now_us %.0f ns (%lld)\n",
+           round_us[round_us.size() / 2], 2 * TIME_SYNC_BURST * TIME_SYNC_MESSAGE_SIZE, now_ns, (long long) (sink & 1));
+
+    server.running = false;
+    server_thread.join();
+    time_sync_close(sync);
+    close(naive_fd);
+    close(server.fd);
+    delete sync;
+    return 0;
+}
+
+int main(int argc, char **argv) {
+    if (argc >= 2 && strcmp(argv[1], "serve") == 0) {
+        return serve(argc - 1, argv + 1);
+    }
+    if (argc >= 2 && strcmp(argv[1], "bench") == 0) {
+        return bench(argc - 1, argv + 1);
+    }
+    fprintf(stderr, "usage: %s serve [-p port] | bench [-n rounds] [-i interval_ms] [-d delay_us] [-j jitter_us] "
+                    "[-s spike_prob] [-o offset_us] [-r drift_ppm]\n", argv[0]);
+    return 1;
+}
@@ -0,0 +1,188 @@
+/*
+ * Measures what the persistent transmitter saves over the old per-cycle socket setup, and exercises its
+ * reconnect path, on loopback.
+ *
+ * 1. old:  inet_aton + socket + connect + sendto + close for every datagram (socket_transmitter_sta_loop before)
+ *    new:  transmitter_submit into the queue, the sender thread reuses one socket
+ * 2. the link flag is dropped while datagrams are submitted and raised again; the datagrams held in the
+ *    queue must arrive afterwards and the socket must be rebound rather than re-created.
+ * 3. accounting: datagrams submitted while the link is down, more than the queue holds, are dropped when
+ *    overwritten or when the transmitter stops; every submitted datagram must be counted as sent, dropped
+ *    or a send error.
+ *
+ * usage: csi_tx_bench [-n datagrams] [-p port]
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <atomic>
+#include <chrono>
+#include <thread>
+
+#include "csi_packet_component.h"
+#include "transmitter_component.h"
+
+static std::atomic<bool> link_flag(true);
+
+bool fake_is_connected() {
+    return link_flag;
+}
+
+int open_receiver(int port) {
+    int fd = socket(AF_INET, SOCK_DGRAM, 0);
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    addr.sin_port = htons(port);
+    int rcvbuf = 16 * 1024 * 1024;
+    setsockopt(fd, SOL_SOCKET, SO_RCVBUF, &rcvbuf, sizeof(rcvbuf));
+    struct timeval timeout = {.tv_sec = 0, .tv_usec = 100000};
+    setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+    if (bind(fd, (const struct sockaddr *) &addr, sizeof(addr)) == -1) {
+        fprintf(stderr, "ERROR: bind to port %d failed [%s]\n", port, strerror(errno));
+        exit(1);
+    }
+    return fd;
+}
+
+static std::atomic<int> received(0);
+static std::atomic<bool> receiving(true);
+
+// Counts datagrams as they arrive so the socket buffer never overflows
+void receive_loop(int fd) {
+    uint8_t buf[CSI_PACKET_MTU];
+    while (receiving) {
+        if (recv(fd, buf, sizeof(buf), 0) > 0) {
+            received++;
+        }
+    }
+}
+
+// Datagrams received since the last call, once the stream has gone quiet
+int drain() {
+    int last = -1;
+    while (received != last) {
+        last = received;
+        std::this_thread::sleep_for(std::chrono::milliseconds(50));
+    }
+    return received.exchange(0);
+}
+
+double elapsed_ns(std::chrono::steady_clock::time_point start) {
+    return std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count();
+}
+
+int main(int argc, char **argv) {
+    int datagrams = 20000;
+    int port = 22230;
+
+    int opt;
+    while ((opt = getopt(argc, argv, "n:p:")) != -1) {
+        switch (opt) {
+            case 'n': datagrams = atoi(optarg); break;
+            case 'p': port = atoi(optarg); break;
+            default:
+                fprintf(stderr, "usage: %s [-n datagrams] [-p port]\n", argv[0]);
+                return 1;
+        }
+    }
+
+    int receiver = open_receiver(port);
+    std::thread receiver_thread(receive_loop, receiver);
+    uint8_t packet[CSI_PACKET_MTU] = {0};
+    size_t packet_size = 1300;
+
+    // Old: a socket per datagram
+    struct sockaddr_in caddr;
+    memset(&caddr, 0, sizeof(caddr));
+    caddr.sin_family = AF_INET;
+    caddr.sin_port = htons(port);
+    auto start = std::chrono::steady_clock::now();
+    for (int i = 0; i < datagrams; i++) {
+        inet_aton("127.0.0.1", &caddr.sin_addr);
+        int fd = socket(PF_INET, SOCK_DGRAM, 0);
+        connect(fd, (const struct sockaddr *) &caddr, sizeof(caddr));
+        sendto(fd, packet, packet_size, 0, (const struct sockaddr *) &caddr, sizeof(caddr));
+        close(fd);
+    }
+    double old_ns = elapsed_ns(start) / datagrams;
+    int old_received = drain();
+
+    // The part of the old cycle the persistent transmitter no longer pays
+    start = std::chrono::steady_clock::now();
+    for (int i = 0; i < datagrams; i++) {
+        inet_aton("127.0.0.1", &caddr.sin_addr);
+        int fd = socket(PF_INET, SOCK_DGRAM, 0);
+        connect(fd, (const struct sockaddr *) &caddr, sizeof(caddr));
+        close(fd);
+    }
+    double setup_ns = elapsed_ns(start) / datagrams;
+
+    // New: persistent transmitter
+    transmitter_t *t = new transmitter_t();
+    transmitter_start(t, "127.0.0.1", port, &fake_is_connected);
+    double submit_total_ns = 0;
+    start = std::chrono::steady_clock::now();
+    for (int i = 0; i < datagrams; i++) {
+        auto submit_start = std::chrono::steady_clock::now();
+        transmitter_submit(t, packet, packet_size);
+        submit_total_ns += elapsed_ns(submit_start);
+        while (transmitter_pending(t) >= TRANSMITTER_QUEUE_LEN / 2) {
+            std::this_thread::yield(); // Keep the queue from overflowing, as the pacer does on the station
+        }
+    }
+    double submit_ns = submit_total_ns / datagrams;
+    while (transmitter_pending(t) > 0) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+    double new_ns = elapsed_ns(start) / datagrams;
+    int new_received = drain();
+
+    transmitter_stats_t stats;
+    transmitter_get_stats(t, &stats);
+    printf("per-cycle socket setup:  %8.0f ns/datagram  received %d/%d (setup alone %.0f ns)\n",
+           old_ns, old_received, datagrams, setup_ns);
+    printf("persistent transmitter:  %8.0f ns/submit, %6.0f ns/datagram end to end  received %d/%d (dropped in queue %llu)\n",
+           submit_ns, new_ns, new_received, datagrams, (unsigned long long) stats.dropped);
+
+    // Reconnect: link goes down, datagrams wait in the queue, link comes back
+    link_flag = false;
+    std::this_thread::sleep_for(std::chrono::milliseconds(2 * TRANSMITTER_LINK_POLL_MS));
+    for (int i = 0; i < TRANSMITTER_QUEUE_LEN / 2; i++) {
+        transmitter_submit(t, packet, packet_size);
+    }
+    std::this_thread::sleep_for(std::chrono::milliseconds(2 * TRANSMITTER_LINK_POLL_MS));
+    int while_down = drain();
+    link_flag = true;
+    std::this_thread::sleep_for(std::chrono::milliseconds(3 * TRANSMITTER_LINK_POLL_MS));
+    int after_up = drain();
+
+    transmitter_get_stats(t, &stats);
+    bool reconnect_ok = while_down == 0 && after_up == TRANSMITTER_QUEUE_LEN / 2 && stats.sockets_opened == 1;
+    printf("reconnect: received %d while down, %d/%d after the link came back, sockets opened %u, rebinds %u %s\n",
+           while_down, after_up, TRANSMITTER_QUEUE_LEN / 2, stats.sockets_opened, stats.rebinds,
+           reconnect_ok ? "OK" : "FAILED");
+
+    // Accounting: stop with the link down and a full queue
+    link_flag = false;
+    std::this_thread::sleep_for(std::chrono::milliseconds(2 * TRANSMITTER_LINK_POLL_MS));
+    for (int i = 0; i < TRANSMITTER_QUEUE_LEN + 2; i++) {
+        transmitter_submit(t, packet, packet_size);
+    }
+    transmitter_stop(t);
+    transmitter_get_stats(t, &stats);
+    bool accounting_ok = stats.submitted == stats.sent + stats.dropped + stats.send_errors &&
+                         transmitter_pending(t) == 0;
+    printf("accounting: submitted %llu = sent %llu + dropped %llu + send errors %llu %s\n",
+           (unsigned long long) stats.submitted, (unsigned long long) stats.sent,
+           (unsigned long long) stats.dropped, (unsigned long long) stats.send_errors,
+           accounting_ok ? "OK" : "FAILED");
+
+    delete t;
+    receiving = false;
+    receiver_thread.join();
+    close(receiver);
+    return reconnect_ok && accounting_ok ? 0 : 1;
+}
@@ -0,0 +1,164 @@
+#ifndef ESP32_CSI_ARENA_COMPONENT_H
+#define ESP32_CSI_ARENA_COMPONENT_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <atomic>
+
+#include "hal_component.h"
+
+#if defined(ESP_PLATFORM) && CONFIG_ARENA_CHECK_HEAP
+#include "esp_attr.h"
+#endif
+
+/*
+ * Memory for one localization cycle without the heap. The buffers a cycle fills (the text line of each AP's
+ * first frame, the values collect_all_csi_data parses out of them) come from an arena: a static block handed
+ * out front to back and released at once by arena_reset() when the cycle ends. Nothing on the hot path
+ * allocates from the heap, so a long run cannot fragment it. The block is sized at compile time; an
+ * allocation that does not fit returns NULL and is counted, it never falls back to the heap.
+ *
+ * An arena counts its allocations and keeps the most it used in any cycle (high_water). arena_report()
+ * prints those next to the heap's free bytes and low-water mark (hal_heap_info), for sizing the block.
+ *
+ * CONFIG_ARENA_CHECK_HEAP 1 is a debug mode that proves the steady state allocation free: every heap
+ * allocation made inside an ARENA_NO_HEAP scope (the CSI callback, the text line, collect_all_csi_data) is
+ * counted, and arena_reset() aborts when a cycle past the first CONFIG_ARENA_WARMUP_CYCLES made any. The
+ * warm-up leaves room for what is set up lazily once, such as the stdout buffer. The count comes from an
+ * allocation hook: ESP-IDF's heap hooks on the station (needs CONFIG_HEAP_USE_HOOKS, IDF 5.1 and later), a
+ * replaced malloc on Linux (tools/csi_alloc_check).
+ */
+
+#ifndef CONFIG_ARENA_CHECK_HEAP
+#define CONFIG_ARENA_CHECK_HEAP 0
+#endif
+
+#ifndef CONFIG_ARENA_WARMUP_CYCLES
+#define CONFIG_ARENA_WARMUP_CYCLES 2 // Cycles that may still allocate with CONFIG_ARENA_CHECK_HEAP
+#endif
+
+#define ARENA_ALIGN 8 // Alignment of every allocation
+
+typedef struct {
+    const char *name;
+    uint8_t *base;
+    size_t size;
+    size_t used;
+    size_t high_water; // Most bytes used in one cycle
+    uint32_t allocs; // In the current cycle
+    uint32_t failures; // Allocations that did not fit, since arena_init
+    uint32_t cycles; // Completed, arena_reset calls
+    uint32_t heap_allocs; // Heap allocations inside ARENA_NO_HEAP scopes in the last cycle (CONFIG_ARENA_CHECK_HEAP)
+    uint32_t heap_allocs_at_reset;
+} arena_t;
+
+// Static initializer of an arena over `buffer`, an array
+#define ARENA_INITIALIZER(name, buffer) {name, buffer, sizeof(buffer), 0, 0, 0, 0, 0, 0, 0}
+
+#if CONFIG_ARENA_CHECK_HEAP
+std::atomic<uint32_t> arena_heap_allocs{0}; // Heap allocations made inside ARENA_NO_HEAP scopes
+thread_local int _arena_no_heap_depth = 0;
+
+// For the allocation hook: count an allocation if the calling thread is inside an ARENA_NO_HEAP scope
+inline void arena_count_heap_alloc() {
+    if (_arena_no_heap_depth > 0) {
+        arena_heap_allocs++;
+    }
+}
+
+struct _arena_no_heap_scope_t {
+    _arena_no_heap_scope_t() { _arena_no_heap_depth++; }
+    ~_arena_no_heap_scope_t() { _arena_no_heap_depth--; }
+};
+
+// Code from here to the end of the block must not allocate from the heap
+#define ARENA_NO_HEAP _arena_no_heap_scope_t _arena_no_heap_scope
+
+#ifdef ESP_PLATFORM
+#if !CONFIG_HEAP_USE_HOOKS
+#error "CONFIG_ARENA_CHECK_HEAP needs CONFIG_HEAP_USE_HOOKS in sdkconfig"
+#endif
+extern "C" IRAM_ATTR void esp_heap_trace_alloc_hook(void *, size_t, uint32_t) {
+    arena_count_heap_alloc();
+}
+
+extern "C" IRAM_ATTR void esp_heap_trace_free_hook(void *) {
+}
+#endif
+#else
+#define ARENA_NO_HEAP
+#endif
+
+inline void arena_init(arena_t *a, const char *name, void *buffer, size_t size) {
+    memset(a, 0, sizeof(*a));
+    a->name = name;
+    a->base = (uint8_t *) buffer;
+    a->size = size;
+}
+
+// `size` bytes aligned to ARENA_ALIGN, valid until the next arena_reset. NULL if the arena is full.
+inline void *arena_alloc(arena_t *a, size_t size) {
+    size_t start = (a->used + ARENA_ALIGN - 1) & ~(size_t) (ARENA_ALIGN - 1);
+    if (start > a->size || size > a->size - start) {
+        a->failures++;
+        return NULL;
+    }
+    a->used = start + size;
+    a->allocs++;
+    if (a->used > a->high_water) {
+        a->high_water = a->used;
+    }
+    return a->base + start;
+}
+
+template <typename T>
+inline T *arena_alloc_array(arena_t *a, size_t count) {
+    if (count > SIZE_MAX / sizeof(T)) {
+        a->failures++;
+        return NULL;
+    }
+    return (T *) arena_alloc(a, count * sizeof(T));
+}
+
+// A copy of the first `len` characters of `s`, NUL terminated
+inline char *arena_strndup(arena_t *a, const char *s, size_t len) {
+    char *copy = arena_alloc_array<char>(a, len + 1);
+    if (copy != NULL) {
+        memcpy(copy, s, len);
+        copy[len] = '\0';
+    }
+    return copy;
+}
+
+// End the cycle: everything allocated since the last reset is released
+inline void arena_reset(arena_t *a) {
+#if CONFIG_ARENA_CHECK_HEAP
+    uint32_t heap_allocs = arena_heap_allocs;
+    a->heap_allocs = heap_allocs - a->heap_allocs_at_reset;
+    a->heap_allocs_at_reset = heap_allocs;
+    if (a->heap_allocs > 0 && a->cycles >= CONFIG_ARENA_WARMUP_CYCLES) {
+        printf("ERROR: %u heap allocations in cycle %u of arena %s, the steady state must make none\n",
+               (unsigned) a->heap_allocs, (unsigned) a->cycles, a->name);
+        fflush(stdout);
+        abort();
+    }
+#endif
+    a->used = 0;
+    a->allocs = 0;
+    a->cycles++;
+}
+
+// One line on the arena and the heap, e.g. for a HEAP command. Returns its length as snprintf.
+inline int arena_report(const arena_t *a, char *out, size_t size) {
+    hal_heap_t heap;
+    hal_heap_info(&heap);
+    return snprintf(out, size, "arena %s %u/%u B, high water %u B, %u allocs, %u failed, %u cycles; "
+                               "heap free %u B, low water %u B, largest block %u B",
+                    a->name, (unsigned) a->used, (unsigned) a->size, (unsigned) a->high_water, (unsigned) a->allocs,
+                    (unsigned) a->failures, (unsigned) a->cycles, (unsigned) heap.free_bytes,
+                    (unsigned) heap.min_free_bytes, (unsigned) heap.largest_free_block);
+}
+
+#endif //ESP32_CSI_ARENA_COMPONENT_H
@@ -0,0 +1,227 @@
+#ifndef ESP32_CSI_CODEC_COMPONENT_H
+#define ESP32_CSI_CODEC_COMPONENT_H
+
+#include <stdint.h>
+#include <string.h>
+#include "csi_packet_component.h"
+
+/*
+ * Delta codec for CSI records on the wire.
+ *
+ * Consecutive frames from the same AP differ very little per subcarrier, so instead of the raw int8
+ * buffer a record can carry the difference to the previous frame from that AP:
+ *
+ *   payload:  raw_len (varint) | reference_seq (varint) | zigzag(delta[i]) (nibble varint) * raw_len
+ *
+ * A byte varint could never beat the raw int8 value, so the deltas use 4-bit units instead
+ * (3 value bits + continuation bit, low nibble first): |delta| <= 4 takes half a byte,
+ * |delta| <= 32 one byte and anything else a byte and a half.
+ * Every `keyframe_interval` frames (and whenever the delta would not be smaller) the raw buffer is
+ * sent instead. A decoder only applies a delta if it holds the exact reference frame, so after a
+ * lost datagram it drops frames from that AP until the next keyframe.
+ */
+
+#ifndef CONFIG_CSI_KEYFRAME_INTERVAL
+#define CONFIG_CSI_KEYFRAME_INTERVAL 32
+#endif
+
+#define CSI_RECORD_FLAG_DELTA 0x01 // Payload is delta coded against the frame with reference_seq
+#define CSI_CODEC_MAX_APS 16
+#define CSI_CODEC_MAX_ENCODED (CSI_RECORD_MAX_LEN * 3 / 2 + 10)
+
+// Per AP state, the same structure is used by the encoder and the decoder
+typedef struct {
+    int8_t prev[CSI_RECORD_MAX_LEN];
+    uint16_t prev_len;
+    uint32_t prev_seq;
+    uint32_t since_keyframe;
+    bool valid;
+} csi_codec_channel_t;
+
+typedef struct {
+    csi_codec_channel_t channels[CSI_CODEC_MAX_APS];
+    uint32_t keyframe_interval;
+    uint64_t raw_bytes; // Payload bytes before coding
+    uint64_t coded_bytes; // Payload bytes after coding
+    uint32_t keyframes;
+    uint32_t deltas;
+    uint32_t undecodable; // Decoder only: deltas whose reference was missing
+} csi_codec_t;
+
+inline void csi_codec_init(csi_codec_t *c, uint32_t keyframe_interval) {
+    memset(c, 0, sizeof(*c));
+    c->keyframe_interval = keyframe_interval > 0 ? keyframe_interval : 1;
+}
+
+inline size_t _csi_put_varint(uint8_t *p, uint32_t v) {
+    size_t n = 0;
+    while (v >= 0x80) {
+        p[n++] = (uint8_t) (v | 0x80);
+        v >>= 7;
+    }
+    p[n++] = (uint8_t) v;
+    return n;
+}
+
+// Returns the number of bytes read, 0 if the varint runs past `end`
+inline size_t _csi_get_varint(const uint8_t *p, const uint8_t *end, uint32_t *v) {
+    uint32_t result = 0;
+    for (size_t n = 0; n < 5 && p + n < end; n++) {
+        result |= (uint32_t) (p[n] & 0x7F) << (7 * n);
+        if ((p[n] & 0x80) == 0) {
+            *v = result;
+            return n + 1;
+        }
+    }
+    return 0;
+}
+
+// Append zigzag value `v` to the nibble stream at `p`, `nibbles` counts the nibbles written so far
+inline void _csi_put_nibble_varint(uint8_t *p, size_t *nibbles, uint32_t v) {
+    do {
+        uint8_t unit = v & 0x07;
+        v >>= 3;
+        if (v != 0) {
+            unit |= 0x08;
+        }
+        if ((*nibbles & 1) == 0) {
+            p[*nibbles / 2] = unit;
+        } else {
+            p[*nibbles / 2] |= unit << 4;
+        }
+        (*nibbles)++;
+    } while (v != 0);
+}
+
+// Returns false if the stream of `total` nibbles ends in the middle of a value
+inline bool _csi_get_nibble_varint(const uint8_t *p, size_t *nibbles, size_t total, uint32_t *v) {
+    uint32_t result = 0;
+    for (int shift = 0; shift < 12 && *nibbles < total; shift += 3) {
+        uint8_t unit = (p[*nibbles / 2] >> ((*nibbles & 1) * 4)) & 0x0F;
+        (*nibbles)++;
+        result |= (uint32_t) (unit & 0x07) << shift;
+        if ((unit & 0x08) == 0) {
+            *v = result;
+            return true;
+        }
+    }
+    return false;
+}
+
+inline uint32_t _csi_zigzag(int32_t v) {
+    return ((uint32_t) v << 1) ^ (uint32_t) (v >> 31);
+}
+
+inline int32_t _csi_unzigzag(uint32_t v) {
+    return (int32_t) (v >> 1) ^ -(int32_t) (v & 1);
+}
+
+/*
+ * Encode `in` into `out` (which must hold CSI_CODEC_MAX_ENCODED bytes).
+ * `out` receives the record to put on the wire; its data points either into `buf` or at in->data.
+ */
+inline void csi_codec_encode(csi_codec_t *c, const csi_record_t *in, csi_record_t *out, uint8_t *buf) {
+    *out = *in;
+    c->raw_bytes += in->len;
+
+    csi_codec_channel_t *ch = in->ap_id < CSI_CODEC_MAX_APS ? &c->channels[in->ap_id] : NULL;
+    bool delta = ch != NULL && ch->valid && ch->prev_len == in->len && ch->since_keyframe + 1 < c->keyframe_interval;
+
+    if (delta) {
+        size_t n = _csi_put_varint(buf, in->len);
+        n += _csi_put_varint(buf + n, ch->prev_seq);
+        size_t nibbles = 0;
+        for (uint16_t i = 0; i < in->len; i++) {
+            _csi_put_nibble_varint(buf + n, &nibbles, _csi_zigzag((int32_t) in->data[i] - ch->prev[i]));
+        }
+        n += (nibbles + 1) / 2;
+
+        if (n < in->len) {
+            out->flags = in->flags | CSI_RECORD_FLAG_DELTA;
+            out->len = (uint16_t) n;
+            out->data = (const int8_t *) buf;
+            ch->since_keyframe++;
+        } else {
+            delta = false; // Not worth it, send a keyframe
+        }
+    }
+
+    if (!delta) {
+        out->flags = in->flags & ~CSI_RECORD_FLAG_DELTA;
+        if (ch != NULL) {
+            ch->since_keyframe = 0;
+        }
+    }
+
+    if (ch != NULL) {
+        memcpy(ch->prev, in->data, in->len);
+        ch->prev_len = in->len;
+        ch->prev_seq = in->seq;
+        ch->valid = true;
+    }
+
+    c->coded_bytes += out->len;
+    if (delta) {
+        c->deltas++;
+    } else {
+        c->keyframes++;
+    }
+}
+
+/*
+ * Decode a record produced by csi_codec_encode. `buf` must hold CSI_RECORD_MAX_LEN bytes.
+ * Returns false if the record is a delta whose reference frame this decoder does not have.
+ * Records must be fed per device in the order they were received; use one codec per device.
+ */
+inline bool csi_codec_decode(csi_codec_t *c, const csi_record_t *in, csi_record_t *out, int8_t *buf) {
+    *out = *in;
+    csi_codec_channel_t *ch = in->ap_id < CSI_CODEC_MAX_APS ? &c->channels[in->ap_id] : NULL;
+
+    if ((in->flags & CSI_RECORD_FLAG_DELTA) == 0) {
+        if (ch != NULL) {
+            memcpy(ch->prev, in->data, in->len);
+            ch->prev_len = in->len;
+            ch->prev_seq = in->seq;
+            ch->valid = true;
+        }
+        c->keyframes++;
+        return true;
+    }
+
+    const uint8_t *p = (const uint8_t *) in->data;
+    const uint8_t *end = p + in->len;
+    uint32_t raw_len = 0, reference_seq = 0;
+    size_t n = _csi_get_varint(p, end, &raw_len);
+    size_t m = n > 0 ? _csi_get_varint(p + n, end, &reference_seq) : 0;
+
+    if (ch == NULL || m == 0 || !ch->valid || ch->prev_seq != reference_seq || ch->prev_len != raw_len) {
+        if (ch != NULL) {
+            ch->valid = false; // Wait for the next keyframe
+        }
+        c->undecodable++;
+        return false;
+    }
+
+    p += n + m;
+    size_t nibbles = 0;
+    size_t total = (size_t) (end - p) * 2;
+    for (uint32_t i = 0; i < raw_len; i++) {
+        uint32_t z;
+        if (!_csi_get_nibble_varint(p, &nibbles, total, &z)) {
+            ch->valid = false;
+            c->undecodable++;
+            return false;
+        }
+        buf[i] = (int8_t) (ch->prev[i] + _csi_unzigzag(z));
+    }
+
+    memcpy(ch->prev, buf, raw_len);
+    ch->prev_seq = in->seq;
+    out->flags = in->flags & ~CSI_RECORD_FLAG_DELTA;
+    out->len = (uint16_t) raw_len;
+    out->data = buf;
+    c->deltas++;
+    return true;
+}
+
+#endif //ESP32_CSI_CODEC_COMPONENT_H
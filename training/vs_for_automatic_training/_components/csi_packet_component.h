@@ -0,0 +1,243 @@
+#ifndef ESP32_CSI_PACKET_COMPONENT_H
+#define ESP32_CSI_PACKET_COMPONENT_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+
+/*
+ * Binary datagram used to stream CSI from a station to the collector.
+ *
+ * One UDP datagram carries a batch of records and never exceeds CSI_PACKET_MTU bytes.
+ *
+ *   packet:  magic (2) | version (1) | count (1) | device_id (2) | flags (2) | record * count
+ *   record:  seq (4) | timestamp_us (8) | device_id (2) | ap_id (1) | rssi (1) | flags (1) | reserved (1)
+ *            | len (2) | label (8, only with CSI_RECORD_FLAG_LABELED) | payload (len)
+ *   label:   point (2) | round (2) | x (2) | y (2)
+ *
+ * All fields are little endian. The payload is the raw int8 CSI buffer as delivered by esp_wifi.
+ * The stations only stream its first CSI_STREAM_LEN (128) bytes, the LLTF part (csi_component.h):
+ * len is the number of bytes carried, not the length esp_wifi reported, so the HT-LTF and STBC parts
+ * of a longer buffer never reach the collector. The format itself takes up to CSI_RECORD_MAX_LEN.
+ * The label marks a frame captured while the station stood at a survey point (survey_component.h);
+ * unlabeled records are encoded exactly as before the label existed.
+ * This header has no ESP-IDF dependencies so it can be shared with the Linux collector.
+ * tools/csi_packet_check round-trips and times it.
+ */
+
+#define CSI_PACKET_MAGIC 0x4943 // "CI" on the wire
+#define CSI_PACKET_VERSION 1
+#define CSI_PACKET_HEADER_SIZE 8
+#define CSI_RECORD_HEADER_SIZE 20
+#define CSI_PACKET_MTU 1472 // 1500 byte MTU minus IPv4 (20) and UDP (8) headers
+#define CSI_RECORD_MAX_LEN 384 // LLTF + HT-LTF + STBC-HT-LTF, the largest buffer esp_wifi reports
+
+// Each record's payload may be the raw buffer or something a codec produced from it
+#define CSI_RECORD_FLAG_RAW 0x00
+#define CSI_RECORD_FLAG_LABELED 0x02 // The record carries a survey label
+#define CSI_RECORD_LABEL_SIZE 8
+
+typedef struct {
+    uint32_t seq; // Per-device sequence number, incremented for every captured frame
+    int64_t timestamp_us; // Capture time in microseconds
+    uint16_t device_id; // Station that captured the frame
+    uint8_t ap_id; // Index of the AP the frame was received from
+    int8_t rssi; // RSSI reported in rx_ctrl
+    uint8_t flags; // CSI_RECORD_FLAG_*
+    uint16_t len; // Payload length in bytes
+    const int8_t *data; // Payload (points into the packet when decoding)
+    uint16_t point; // Survey label, only valid with CSI_RECORD_FLAG_LABELED: index of the point in the plan,
+    uint16_t round; // the survey round,
+    int16_t x; // and the point's coordinates
+    int16_t y;
+} csi_record_t;
+
+typedef struct {
+    uint8_t version;
+    uint8_t count;
+    uint16_t device_id;
+    uint16_t flags;
+} csi_packet_header_t;
+
+typedef struct {
+    uint8_t *buf;
+    size_t capacity;
+    size_t size;
+    uint8_t count;
+} csi_packet_writer_t;
+
+typedef struct {
+    const uint8_t *buf;
+    size_t size;
+    size_t offset;
+    uint8_t remaining;
+    csi_packet_header_t header;
+} csi_packet_reader_t;
+
+inline void _csi_put_u16(uint8_t *p, uint16_t v) {
+    p[0] = (uint8_t) v;
+    p[1] = (uint8_t) (v >> 8);
+}
+
+inline void _csi_put_u32(uint8_t *p, uint32_t v) {
+    _csi_put_u16(p, (uint16_t) v);
+    _csi_put_u16(p + 2, (uint16_t) (v >> 16));
+}
+
+inline void _csi_put_u64(uint8_t *p, uint64_t v) {
+    _csi_put_u32(p, (uint32_t) v);
+    _csi_put_u32(p + 4, (uint32_t) (v >> 32));
+}
+
+inline uint16_t _csi_get_u16(const uint8_t *p) {
+    return (uint16_t) (p[0] | (p[1] << 8));
+}
+
+inline uint32_t _csi_get_u32(const uint8_t *p) {
+    return (uint32_t) _csi_get_u16(p) | ((uint32_t) _csi_get_u16(p + 2) << 16);
+}
+
+inline uint64_t _csi_get_u64(const uint8_t *p) {
+    return (uint64_t) _csi_get_u32(p) | ((uint64_t) _csi_get_u32(p + 4) << 32);
+}
+
+// Size an unlabeled record occupies on the wire
+inline size_t csi_record_wire_size(uint16_t len) {
+    return CSI_RECORD_HEADER_SIZE + len;
+}
+
+// Size `r` occupies on the wire, with its label if it has one
+inline size_t csi_record_encoded_size(const csi_record_t *r) {
+    return csi_record_wire_size(r->len) + ((r->flags & CSI_RECORD_FLAG_LABELED) ? CSI_RECORD_LABEL_SIZE : 0);
+}
+
+// Encode a record at `p`, which must have room for csi_record_encoded_size(r) bytes
+inline void csi_record_put(uint8_t *p, const csi_record_t *r) {
+    _csi_put_u32(p, r->seq);
+    _csi_put_u64(p + 4, (uint64_t) r->timestamp_us);
+    _csi_put_u16(p + 12, r->device_id);
+    p[14] = r->ap_id;
+    p[15] = (uint8_t) r->rssi;
+    p[16] = r->flags;
+    p[17] = 0;
+    _csi_put_u16(p + 18, r->len);
+    size_t offset = CSI_RECORD_HEADER_SIZE;
+    if (r->flags & CSI_RECORD_FLAG_LABELED) {
+        _csi_put_u16(p + offset, r->point);
+        _csi_put_u16(p + offset + 2, r->round);
+        _csi_put_u16(p + offset + 4, (uint16_t) r->x);
+        _csi_put_u16(p + offset + 6, (uint16_t) r->y);
+        offset += CSI_RECORD_LABEL_SIZE;
+    }
+    memcpy(p + offset, r->data, r->len);
+}
+
+// Decode the record at `p` without copying the payload. Returns its wire size, or 0 if it is malformed
+// or does not fit in the `available` bytes.
+inline size_t csi_record_get(const uint8_t *p, size_t available, csi_record_t *r) {
+    if (available < CSI_RECORD_HEADER_SIZE) {
+        return 0;
+    }
+    uint16_t len = _csi_get_u16(p + 18);
+    uint8_t flags = p[16];
+    size_t size = csi_record_wire_size(len) + ((flags & CSI_RECORD_FLAG_LABELED) ? CSI_RECORD_LABEL_SIZE : 0);
+    if (len > CSI_RECORD_MAX_LEN || size > available) {
+        return 0;
+    }
+
+    r->seq = _csi_get_u32(p);
+    r->timestamp_us = (int64_t) _csi_get_u64(p + 4);
+    r->device_id = _csi_get_u16(p + 12);
+    r->ap_id = p[14];
+    r->rssi = (int8_t) p[15];
+    r->flags = flags;
+    r->len = len;
+    if (flags & CSI_RECORD_FLAG_LABELED) {
+        r->point = _csi_get_u16(p + CSI_RECORD_HEADER_SIZE);
+        r->round = _csi_get_u16(p + CSI_RECORD_HEADER_SIZE + 2);
+        r->x = (int16_t) _csi_get_u16(p + CSI_RECORD_HEADER_SIZE + 4);
+        r->y = (int16_t) _csi_get_u16(p + CSI_RECORD_HEADER_SIZE + 6);
+    } else {
+        r->point = r->round = 0;
+        r->x = r->y = 0;
+    }
+    r->data = (const int8_t *) (p + size - len);
+    return size;
+}
+
+// Number of records with a payload of `len` bytes that fit in one datagram
+inline size_t csi_packet_records_per_mtu(uint16_t len) {
+    size_t n = (CSI_PACKET_MTU - CSI_PACKET_HEADER_SIZE) / csi_record_wire_size(len);
+    return n > 255 ? 255 : n;
+}
+
+// Start a new packet in `buf`. `capacity` is normally CSI_PACKET_MTU.
+inline void csi_packet_begin(csi_packet_writer_t *w, uint8_t *buf, size_t capacity, uint16_t device_id) {
+    w->buf = buf;
+    w->capacity = capacity < CSI_PACKET_MTU ? capacity : CSI_PACKET_MTU;
+    w->size = CSI_PACKET_HEADER_SIZE;
+    w->count = 0;
+
+    _csi_put_u16(buf, CSI_PACKET_MAGIC);
+    buf[2] = CSI_PACKET_VERSION;
+    buf[3] = 0;
+    _csi_put_u16(buf + 4, device_id);
+    _csi_put_u16(buf + 6, 0);
+}
+
+// Returns false (and leaves the packet untouched) when the record does not fit
+inline bool csi_packet_append(csi_packet_writer_t *w, const csi_record_t *r) {
+    if (r->len > CSI_RECORD_MAX_LEN || w->count == 255) {
+        return false;
+    }
+    if (w->size + csi_record_encoded_size(r) > w->capacity) {
+        return false;
+    }
+
+    csi_record_put(w->buf + w->size, r);
+    w->size += csi_record_encoded_size(r);
+    w->count++;
+    return true;
+}
+
+// Patches the record count into the header and returns the datagram length
+inline size_t csi_packet_finish(csi_packet_writer_t *w) {
+    w->buf[3] = w->count;
+    return w->size;
+}
+
+// Validates the packet header. Returns false for foreign or truncated datagrams.
+inline bool csi_packet_open(csi_packet_reader_t *rd, const uint8_t *buf, size_t size) {
+    if (size < CSI_PACKET_HEADER_SIZE || _csi_get_u16(buf) != CSI_PACKET_MAGIC || buf[2] != CSI_PACKET_VERSION) {
+        return false;
+    }
+
+    rd->buf = buf;
+    rd->size = size;
+    rd->offset = CSI_PACKET_HEADER_SIZE;
+    rd->header.version = buf[2];
+    rd->header.count = buf[3];
+    rd->header.device_id = _csi_get_u16(buf + 4);
+    rd->header.flags = _csi_get_u16(buf + 6);
+    rd->remaining = rd->header.count;
+    return true;
+}
+
+// Decodes the next record without copying the payload. Returns false at the end or on a malformed record.
+inline bool csi_packet_next(csi_packet_reader_t *rd, csi_record_t *r) {
+    if (rd->remaining == 0) {
+        return false;
+    }
+
+    size_t size = csi_record_get(rd->buf + rd->offset, rd->size - rd->offset, r);
+    if (size == 0) {
+        rd->remaining = 0;
+        return false;
+    }
+
+    rd->offset += size;
+    rd->remaining--;
+    return true;
+}
+
+#endif //ESP32_CSI_PACKET_COMPONENT_H
@@ -2,41 +2,31 @@
 #define ESP32_CSI_INPUT_COMPONENT_H
 
 #include "csi_component.h"
+#include "command_component.h"
 
-char input_buffer[256];
-int input_buffer_pointer = 0;
+// Polled console input, for builds that do not run command_start. Lines go through the command table
+// (so "SETTIME: <sec>.<usec>" still sets the clock) and are bounded to COMMAND_LINE_MAX bytes.
+command_reader_t input_reader;
 
-void _handle_input() {
-    if (match_set_timestamp_template(input_buffer)) {
-        printf("Setting local time to %s\n", input_buffer);
-        time_set(input_buffer);
-    } else {
-        printf("Unable to handle input %s\n", input_buffer);
-    }
+void _print_reply(void *, const char *reply) {
+    printf("%s\n", reply);
 }
 
 void input_check() {
     uint8_t ch = fgetc(stdin);
 
     while (ch != 0xFF) {
-        if (ch == '\n') {
-            _handle_input();
-            input_buffer[0] = '\0';
-            input_buffer_pointer = 0;
-        } else {
-            input_buffer[input_buffer_pointer] = ch;
-            input_buffer[input_buffer_pointer + 1] = '\0';
-            input_buffer_pointer++;
-        }
-
+        char c = (char) ch;
+        command_feed(&input_reader, &c, 1, &_print_reply, NULL);
         ch = fgetc(stdin);
     }
 }
 
 void input_loop() {
+    command_register_builtins();
     while (true) {
         input_check();
-        vTaskDelay(10 / portTICK_PERIOD_MS);
+        hal_delay_ms(10);
     }
 }
 
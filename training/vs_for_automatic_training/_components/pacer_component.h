@@ -0,0 +1,146 @@
+#ifndef ESP32_CSI_PACER_COMPONENT_H
+#define ESP32_CSI_PACER_COMPONENT_H
+
+#include <stdint.h>
+#include <string.h>
+#include <math.h>
+
+#include "hal_component.h"
+
+/*
+ * Packet pacer based on absolute deadlines.
+ *
+ * Packet n is due at start + n * interval. The caller blocks in pacer_wait() until its deadline:
+ * whole scheduler ticks are slept away as long as they end `spin_us` before it, and the rest is
+ * busy-waited. A sleep of n ticks wakes on the n-th tick boundary, up to a tick early, so the ticks left
+ * after it are slept again: the busy-wait is less than a tick plus `spin_us`, and rates above the tick
+ * rate (CONFIG_FREERTOS_HZ=100 means 10 ms ticks) still work.
+ * Because deadlines are absolute, time spent sending is not added on top of the interval and the
+ * error does not accumulate. After a stall at most `burst` packets are sent back to back to catch up,
+ * the rest of the missed slots are dropped (token bucket with depth `burst`).
+ *
+ * The clock and the sleep are function pointers so the pacer can run against a fake clock on a host.
+ */
+
+typedef int64_t (*pacer_clock_t)(void *ctx); // Current time in microseconds
+typedef void (*pacer_sleep_t)(void *ctx, int64_t duration_us); // Coarse sleep, may be rounded down to ticks
+
+typedef struct {
+    int64_t interval_us; // 1e6 / rate
+    int64_t tick_us; // Sleep granularity of the platform
+    int64_t spin_us; // Extra margin that is always busy-waited
+    uint32_t burst; // Maximum packets sent back to back after a stall
+    int64_t next_deadline_us;
+
+    pacer_clock_t clock;
+    pacer_sleep_t sleep;
+    void *ctx;
+
+    // Statistics
+    uint64_t packets;
+    uint64_t skipped; // Slots dropped because the sender fell more than `burst` packets behind
+    int64_t first_us;
+    int64_t last_us;
+    double jitter_sum_us; // Sum of (release time - deadline)
+    double jitter_sq_sum_us;
+    int64_t jitter_max_us;
+} pacer_t;
+
+typedef struct {
+    double rate; // Achieved packets per second
+    double jitter_mean_us;
+    double jitter_stddev_us;
+    int64_t jitter_max_us;
+    uint64_t packets;
+    uint64_t skipped;
+} pacer_stats_t;
+
+inline int64_t _pacer_default_clock(void *) {
+    return hal_monotonic_us();
+}
+
+inline void _pacer_default_sleep(void *, int64_t duration_us) {
+    hal_sleep_us(duration_us);
+}
+
+#define PACER_DEFAULT_TICK_US HAL_SLEEP_RESOLUTION_US
+
+inline void pacer_init_with_clock(pacer_t *p, double rate, uint32_t burst, int64_t tick_us,
+                                  pacer_clock_t clock, pacer_sleep_t sleep, void *ctx) {
+    memset(p, 0, sizeof(*p));
+    p->interval_us = rate > 0 ? (int64_t) (1000000.0 / rate) : 0;
+    p->tick_us = tick_us > 0 ? tick_us : 1;
+    p->spin_us = 200;
+    p->burst = burst > 0 ? burst : 1;
+    p->clock = clock;
+    p->sleep = sleep;
+    p->ctx = ctx;
+    p->next_deadline_us = -1;
+}
+
+inline void pacer_init(pacer_t *p, double rate, uint32_t burst) {
+    pacer_init_with_clock(p, rate, burst, PACER_DEFAULT_TICK_US, &_pacer_default_clock, &_pacer_default_sleep, NULL);
+}
+
+// Change the rate without losing statistics, the new interval applies from the next packet
+inline void pacer_set_rate(pacer_t *p, double rate) {
+    p->interval_us = rate > 0 ? (int64_t) (1000000.0 / rate) : 0;
+}
+
+// Block until the next packet may be sent
+inline void pacer_wait(pacer_t *p) {
+    int64_t now = p->clock(p->ctx);
+    if (p->interval_us <= 0) {
+        return; // Unpaced
+    }
+
+    if (p->next_deadline_us < 0) {
+        p->next_deadline_us = now; // First packet goes out immediately
+        p->first_us = now;
+    }
+
+    // Never let more than `burst` slots pile up
+    int64_t earliest = now - (int64_t) (p->burst - 1) * p->interval_us;
+    if (p->next_deadline_us < earliest) {
+        p->skipped += (uint64_t) ((earliest - p->next_deadline_us) / p->interval_us);
+        p->next_deadline_us = earliest;
+    }
+
+    // Sleep the whole ticks that end before the last spin_us. Once a sleep woke on a tick boundary, the
+    // next one lasts exactly its ticks.
+    int64_t ticks;
+    while ((ticks = (p->next_deadline_us - now - p->spin_us) / p->tick_us) > 0) {
+        p->sleep(p->ctx, ticks * p->tick_us);
+        now = p->clock(p->ctx);
+    }
+    do {
+        now = p->clock(p->ctx);
+    } while (now < p->next_deadline_us);
+
+    int64_t jitter = now - p->next_deadline_us;
+    p->jitter_sum_us += jitter;
+    p->jitter_sq_sum_us += (double) jitter * jitter;
+    if (jitter > p->jitter_max_us) {
+        p->jitter_max_us = jitter;
+    }
+    p->packets++;
+    p->last_us = now;
+    p->next_deadline_us += p->interval_us;
+}
+
+inline void pacer_get_stats(const pacer_t *p, pacer_stats_t *s) {
+    memset(s, 0, sizeof(*s));
+    s->packets = p->packets;
+    s->skipped = p->skipped;
+    s->jitter_max_us = p->jitter_max_us;
+    if (p->packets > 0) {
+        s->jitter_mean_us = p->jitter_sum_us / p->packets;
+        double var = p->jitter_sq_sum_us / p->packets - s->jitter_mean_us * s->jitter_mean_us;
+        s->jitter_stddev_us = var > 0 ? sqrt(var) : 0;
+    }
+    if (p->packets > 1 && p->last_us > p->first_us) {
+        s->rate = (p->packets - 1) * 1000000.0 / (p->last_us - p->first_us);
+    }
+}
+
+#endif //ESP32_CSI_PACER_COMPONENT_H
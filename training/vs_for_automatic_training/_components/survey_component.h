@@ -0,0 +1,379 @@
+#ifndef ESP32_CSI_SURVEY_COMPONENT_H
+#define ESP32_CSI_SURVEY_COMPONENT_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <mutex>
+
+#include "csi_packet_component.h"
+#include "time_component.h"
+#include "log_component.h"
+#include "command_component.h"
+
+/*
+ * Labeled collection over a survey plan: a list of points, each with its coordinates and the number of
+ * frames to collect there (its dwell), walked `rounds` times.
+ *
+ *   plan:  "x,y,dwell; x,y,dwell; ..."   (';', spaces or newlines between points, '#' starts a comment)
+ *
+ * Capture never stops. While the station dwells at a point every captured record gets the label
+ * (point, round, x, y) before it goes to the UDP, SD and serial sinks (CSI_RECORD_FLAG_LABELED). When the
+ * point has its dwell the survey announces the next one and waits `settle` for the person or robot
+ * carrying the station to get there; records captured meanwhile go out unlabeled. After the last point of
+ * the last round the survey is done and records are unlabeled again.
+ *
+ * get_location() and SURVEY AT x,y label everything with a single point until the survey is stopped.
+ *
+ *   SURVEY                                    state, progress and labeled frames per minute
+ *   SURVEY START                              walk CONFIG_SURVEY_PLAN
+ *   SURVEY RUN rounds settle_ms plan          walk another plan, e.g. SURVEY RUN 2 3000 0,0,300;0,5,300
+ *   SURVEY AT x,y | NEXT | STOP
+ */
+
+#define SURVEY_MAX_POINTS 64
+
+#ifndef CONFIG_SURVEY_PLAN
+#define CONFIG_SURVEY_PLAN ""
+#endif
+#ifndef CONFIG_SURVEY_ROUNDS
+#define CONFIG_SURVEY_ROUNDS 1
+#endif
+#ifndef CONFIG_SURVEY_SETTLE_MS
+#define CONFIG_SURVEY_SETTLE_MS 5000
+#endif
+
+typedef struct {
+    int16_t x;
+    int16_t y;
+    uint32_t dwell; // Labeled frames to collect, 0 = until the survey is stopped
+} survey_point_t;
+
+typedef enum {
+    SURVEY_IDLE,
+    SURVEY_SETTLING, // Moving to the current point
+    SURVEY_DWELLING, // Labeling at the current point
+    SURVEY_DONE
+} survey_state_t;
+
+typedef struct {
+    survey_state_t state;
+    uint16_t point;
+    uint16_t round;
+    uint16_t rounds;
+    uint32_t samples; // Labeled frames at the current point
+    uint64_t labeled; // Labeled frames since the start
+    uint64_t unlabeled; // Frames captured while settling
+    int64_t elapsed_us; // Since the start (until done)
+    int64_t dwell_us; // Time spent dwelling
+    double samples_per_min; // Labeled frames per minute over the whole survey, settling included
+    double dwell_samples_per_min; // Labeled frames per minute while dwelling
+} survey_stats_t;
+
+// Called when the survey moves on, e.g. to tell the operator or a robot where to go. It runs on the
+// capturing task with the survey locked.
+typedef void (*survey_move_t)(void *ctx, uint16_t point, uint16_t round, const survey_point_t *p);
+
+typedef struct {
+    survey_point_t points[SURVEY_MAX_POINTS];
+    size_t point_count;
+    uint16_t rounds;
+    int64_t settle_us;
+    survey_move_t on_move;
+    void *move_ctx;
+    time_clock_t clock; // NULL = time_monotonic_us, the simulator runs the survey on its own clock
+    void *clock_ctx;
+
+    survey_state_t state;
+    uint16_t point;
+    uint16_t round;
+    uint32_t samples;
+    int64_t state_since_us;
+    int64_t started_us;
+    int64_t finished_us;
+    uint64_t labeled;
+    uint64_t unlabeled;
+    int64_t dwell_us;
+
+    std::mutex mutex; // survey_tag runs on the Wi-Fi task, the commands on the command task
+} survey_t;
+
+survey_t survey;
+
+/*
+ * Parse a plan into `points`. Returns the number of points, or -1 with a message in `error` if the plan
+ * is malformed or has more than `max` points.
+ */
+inline int survey_parse_plan(const char *text, survey_point_t *points, size_t max, char *error, size_t error_size) {
+    size_t count = 0;
+    const char *p = text;
+    while (*p != '\0') {
+        if (*p == '#') {
+            while (*p != '\0' && *p != '\n') {
+                p++;
+            }
+            continue;
+        }
+        if (*p == ';' || *p == ' ' || *p == '\t' || *p == '\r' || *p == '\n') {
+            p++;
+            continue;
+        }
+
+        char *end;
+        long v[3];
+        for (int i = 0; i < 3; i++) {
+            v[i] = strtol(p, &end, 10);
+            if (end == p || (i < 2 && *end != ',')) {
+                snprintf(error, error_size, "point %u: expected x,y,dwell", (unsigned) count + 1);
+                return -1;
+            }
+            p = i < 2 ? end + 1 : end;
+        }
+        if (v[0] < INT16_MIN || v[0] > INT16_MAX || v[1] < INT16_MIN || v[1] > INT16_MAX || v[2] < 0) {
+            snprintf(error, error_size, "point %u: out of range", (unsigned) count + 1);
+            return -1;
+        }
+        if (count == max) {
+            snprintf(error, error_size, "more than %u points", (unsigned) max);
+            return -1;
+        }
+        points[count].x = (int16_t) v[0];
+        points[count].y = (int16_t) v[1];
+        points[count].dwell = (uint32_t) v[2];
+        count++;
+    }
+    return (int) count;
+}
+
+inline int64_t _survey_now(survey_t *s) {
+    return s->clock != NULL ? s->clock(s->clock_ctx) : time_monotonic_us();
+}
+
+inline void _survey_enter(survey_t *s, survey_state_t state, int64_t now_us) {
+    if (s->state == SURVEY_DWELLING) {
+        s->dwell_us += now_us - s->state_since_us;
+    }
+    s->state = state;
+    s->state_since_us = now_us;
+    if (state == SURVEY_DONE) {
+        s->finished_us = now_us;
+    }
+}
+
+inline void _survey_announce(survey_t *s) {
+    const survey_point_t *p = &s->points[s->point];
+    if (p->dwell > 0) {
+        LOG_I("survey", "round %u point %u/%u: go to (%d, %d), %u frames there", s->round + 1, s->point + 1,
+              (unsigned) s->point_count, p->x, p->y, p->dwell);
+    } else {
+        LOG_I("survey", "labeling at (%d, %d) until stopped", p->x, p->y);
+    }
+    if (s->on_move != NULL) {
+        s->on_move(s->move_ctx, s->point, s->round, p);
+    }
+}
+
+// Go to the next point, or the next round, or finish (the caller holds the mutex)
+inline void _survey_advance(survey_t *s, int64_t now_us) {
+    s->samples = 0;
+    if (++s->point == s->point_count) {
+        s->point = 0;
+        s->round++;
+    }
+    if (s->round == s->rounds) {
+        _survey_enter(s, SURVEY_DONE, now_us);
+        LOG_I("survey", "done: %llu frames labeled", (unsigned long long) s->labeled);
+        return;
+    }
+    _survey_enter(s, s->settle_us > 0 ? SURVEY_SETTLING : SURVEY_DWELLING, now_us);
+    _survey_announce(s);
+}
+
+/*
+ * Start walking `points` `rounds` times, waiting `settle_ms` before each point (the first included).
+ * Replaces a survey in progress.
+ */
+inline void survey_start(survey_t *s, const survey_point_t *points, size_t count, uint16_t rounds, int settle_ms) {
+    std::lock_guard<std::mutex> lock(s->mutex);
+    int64_t now = _survey_now(s);
+    memcpy(s->points, points, count * sizeof(survey_point_t));
+    s->point_count = count;
+    s->rounds = rounds > 0 ? rounds : 1;
+    s->settle_us = (int64_t) settle_ms * 1000;
+    s->point = 0;
+    s->round = 0;
+    s->samples = 0;
+    s->labeled = 0;
+    s->unlabeled = 0;
+    s->dwell_us = 0;
+    s->state = SURVEY_IDLE;
+    s->started_us = now;
+    s->finished_us = 0;
+    if (count == 0) {
+        _survey_enter(s, SURVEY_DONE, now);
+        return;
+    }
+    _survey_enter(s, s->settle_us > 0 ? SURVEY_SETTLING : SURVEY_DWELLING, now);
+    _survey_announce(s);
+}
+
+// Label everything with one location until the survey is stopped or restarted
+inline void survey_set_location(survey_t *s, int16_t x, int16_t y) {
+    survey_point_t p = {x, y, 0};
+    survey_start(s, &p, 1, 1, 0);
+}
+
+inline void survey_stop(survey_t *s) {
+    std::lock_guard<std::mutex> lock(s->mutex);
+    if (s->state != SURVEY_IDLE && s->state != SURVEY_DONE) {
+        _survey_enter(s, SURVEY_DONE, _survey_now(s));
+    }
+}
+
+// Skip the rest of the current point
+inline void survey_next(survey_t *s) {
+    std::lock_guard<std::mutex> lock(s->mutex);
+    if (s->state == SURVEY_SETTLING || s->state == SURVEY_DWELLING) {
+        _survey_advance(s, _survey_now(s));
+    }
+}
+
+/*
+ * Label a captured record if the survey is dwelling at a point, and move the survey on. Called for every
+ * frame before it is handed to the sinks. Returns true if the record was labeled.
+ */
+inline bool survey_tag(survey_t *s, csi_record_t *r) {
+    std::lock_guard<std::mutex> lock(s->mutex);
+    if (s->state == SURVEY_IDLE || s->state == SURVEY_DONE) {
+        return false;
+    }
+    int64_t now_us = _survey_now(s);
+    if (s->state == SURVEY_SETTLING && now_us - s->state_since_us >= s->settle_us) {
+        _survey_enter(s, SURVEY_DWELLING, s->state_since_us + s->settle_us);
+    }
+    if (s->state == SURVEY_SETTLING) {
+        s->unlabeled++;
+        return false;
+    }
+
+    const survey_point_t *p = &s->points[s->point];
+    r->flags |= CSI_RECORD_FLAG_LABELED;
+    r->point = s->point;
+    r->round = s->round;
+    r->x = p->x;
+    r->y = p->y;
+    s->samples++;
+    s->labeled++;
+    if (p->dwell > 0 && s->samples >= p->dwell) {
+        _survey_advance(s, now_us);
+    }
+    return true;
+}
+
+inline bool survey_active(survey_t *s) {
+    std::lock_guard<std::mutex> lock(s->mutex);
+    return s->state == SURVEY_SETTLING || s->state == SURVEY_DWELLING;
+}
+
+inline void survey_get_stats(survey_t *s, survey_stats_t *stats) {
+    std::lock_guard<std::mutex> lock(s->mutex);
+    int64_t now = s->state == SURVEY_DONE ? s->finished_us : _survey_now(s);
+    stats->state = s->state;
+    stats->point = s->point;
+    stats->round = s->round;
+    stats->rounds = s->rounds;
+    stats->samples = s->samples;
+    stats->labeled = s->labeled;
+    stats->unlabeled = s->unlabeled;
+    stats->elapsed_us = s->state == SURVEY_IDLE ? 0 : now - s->started_us;
+    stats->dwell_us = s->dwell_us + (s->state == SURVEY_DWELLING ? now - s->state_since_us : 0);
+    stats->samples_per_min = stats->elapsed_us > 0 ? s->labeled * 60e6 / stats->elapsed_us : 0;
+    stats->dwell_samples_per_min = stats->dwell_us > 0 ? s->labeled * 60e6 / stats->dwell_us : 0;
+}
+
+// Start the survey configured in CONFIG_SURVEY_PLAN, if there is one. Returns false if there is none.
+inline bool survey_start_configured(survey_t *s) {
+    survey_point_t points[SURVEY_MAX_POINTS];
+    char error[64];
+    int count = survey_parse_plan(CONFIG_SURVEY_PLAN, points, SURVEY_MAX_POINTS, error, sizeof(error));
+    if (count < 0) {
+        printf("ERROR: survey plan [%s]\n", error);
+        return false;
+    }
+    if (count == 0) {
+        return false;
+    }
+    survey_start(s, points, count, CONFIG_SURVEY_ROUNDS, CONFIG_SURVEY_SETTLE_MS);
+    return true;
+}
+
+inline bool _command_survey_start(survey_t *s, const char *plan, long rounds, long settle_ms, char *reply,
+                                  size_t reply_size) {
+    survey_point_t points[SURVEY_MAX_POINTS];
+    char error[64];
+    int count = survey_parse_plan(plan, points, SURVEY_MAX_POINTS, error, sizeof(error));
+    if (count <= 0) {
+        snprintf(reply, reply_size, "%s", count < 0 ? error : "empty plan");
+        return false;
+    }
+    survey_start(s, points, count, (uint16_t) rounds, (int) settle_ms);
+    snprintf(reply, reply_size, "survey of %d points x %ld rounds started", count, rounds);
+    return true;
+}
+
+// SURVEY [START | RUN rounds settle_ms plan | AT x,y | NEXT | STOP]
+inline bool _command_survey(int argc, char **argv, char *reply, size_t reply_size) {
+    if (argc == 2 && strcasecmp(argv[1], "START") == 0) {
+        return _command_survey_start(&survey, CONFIG_SURVEY_PLAN, CONFIG_SURVEY_ROUNDS, CONFIG_SURVEY_SETTLE_MS, reply,
+                                     reply_size);
+    }
+    if (argc >= 4 && strcasecmp(argv[1], "RUN") == 0) {
+        long rounds, settle_ms;
+        if (!command_parse_int(argv[2], 1, 1000, &rounds) || !command_parse_int(argv[3], 0, 600000, &settle_ms)) {
+            return false;
+        }
+        char plan[COMMAND_LINE_MAX] = "";
+        for (int i = 4; i < argc; i++) {
+            command_appendf(plan, sizeof(plan), "%s ", argv[i]);
+        }
+        return _command_survey_start(&survey, plan, rounds, settle_ms, reply, reply_size);
+    }
+    if (argc == 3 && strcasecmp(argv[1], "AT") == 0) {
+        long x, y;
+        char *comma = strchr(argv[2], ',');
+        if (comma == NULL) {
+            return false;
+        }
+        *comma = '\0';
+        if (!command_parse_int(argv[2], INT16_MIN, INT16_MAX, &x) || !command_parse_int(comma + 1, INT16_MIN, INT16_MAX, &y)) {
+            return false;
+        }
+        survey_set_location(&survey, (int16_t) x, (int16_t) y);
+        snprintf(reply, reply_size, "labeling every frame until SURVEY STOP");
+        return true;
+    }
+    if (argc == 2 && strcasecmp(argv[1], "NEXT") == 0) {
+        survey_next(&survey);
+    } else if (argc == 2 && strcasecmp(argv[1], "STOP") == 0) {
+        survey_stop(&survey);
+    } else if (argc != 1) {
+        return false;
+    }
+
+    static const char *states[] = {"idle", "settling", "dwelling", "done"};
+    survey_stats_t stats;
+    survey_get_stats(&survey, &stats);
+    if (stats.state == SURVEY_SETTLING || stats.state == SURVEY_DWELLING) {
+        snprintf(reply, reply_size, "%s round %u/%u point %u (%u frames), ", states[stats.state], stats.round + 1,
+                 stats.rounds, stats.point + 1, stats.samples);
+    } else {
+        snprintf(reply, reply_size, "%s, ", states[stats.state]);
+    }
+    command_appendf(reply, reply_size, "labeled %llu, unlabeled %llu, %.1f/min (%.1f/min dwelling)",
+                    (unsigned long long) stats.labeled, (unsigned long long) stats.unlabeled, stats.samples_per_min,
+                    stats.dwell_samples_per_min);
+    return true;
+}
+
+#endif //ESP32_CSI_SURVEY_COMPONENT_H
@@ -16,6 +16,8 @@
 #include "../../_components/time_component.h"
 #include "../../_components/input_component.h"
 #include "../../_components/sockets_component.h"
+#include "../../_components/command_component.h"
+#include "../../_components/log_component.h"
 
 // Definitions
 #define CONFIG_ESP_MAXIMUM_RETRY 5 // Max retries to connect to Wi-Fi
@@ -26,6 +28,24 @@
 static const char *TAG = "wifi_station"; // Tag for logging
 static int s_retry_num = 0; // Retry counter for Wi-Fi connection
 static bool wifi_connected = false; // Wi-Fi connection status flag
+static int64_t wifi_connect_start_us = 0; // When esp_wifi_start was called
+
+METRICS_HISTOGRAM(wifi_connect_metric, "wifi.connect_ms"); // esp_wifi_start to an IP address
+METRICS_COUNTER(wifi_retries_metric, "wifi.retries", 1);
+METRICS_COUNTER(wifi_failures_metric, "wifi.failures", 1); // Gave up after CONFIG_ESP_MAXIMUM_RETRY
+
+// APs visited every round. APS replaces the round list, it takes effect when the next round starts.
+typedef struct {
+    char ssid[33];
+    char pass[65];
+} station_ap_t;
+
+station_ap_t ap_pool[CSI_MAX_APS] = {{"AP4", "12345678"}}; // Append only, get_AP keeps pointers to the names
+size_t ap_pool_count = 1;
+uint8_t ap_round[CSI_MAX_APS] = {0, 0, 0}; // Indices into ap_pool, in visiting order
+size_t ap_round_count = 3;
+std::mutex ap_round_mutex;
+command_channel_t commands; // Console and UDP commands
 
 // HTTP Event Handler: Handles HTTP responses
 esp_err_t _http_event_handle(esp_http_client_event_t *evt) {
@@ -34,12 +54,12 @@ esp_err_t _http_event_handle(esp_http_client_event_t *evt) {
             ESP_LOGI(TAG, "HTTP_EVENT_ON_DATA, len=%d", evt->data_len);
             if (!esp_http_client_is_chunked_response(evt->client)) {
                 if (!real_time_set) {
-                    // If real-time data is not set, allocate memory and copy the response data
-                    char *data = (char *) malloc(evt->data_len + 1);
-                    strncpy(data, (char *) evt->data, evt->data_len);
-                    data[evt->data_len] = '\0';
+                    // If real-time data is not set, copy the response data (a timestamp, longer ones are cut)
+                    char data[64];
+                    size_t len = std::min((size_t) evt->data_len, sizeof(data) - 1);
+                    memcpy(data, evt->data, len);
+                    data[len] = '\0';
                     time_set(data); // Set the time using the response data
-                    free(data); // Free the allocated memory
                 }
             }
             break;
@@ -58,9 +78,11 @@ static void event_handler(void* arg, esp_event_base_t event_base, int32_t event_
         if (s_retry_num < CONFIG_ESP_MAXIMUM_RETRY) {
             esp_wifi_connect();
             s_retry_num++;
+            metric_add(&wifi_retries_metric);
             ESP_LOGI(TAG, "Reconnecting to the AP");
         } else {
             wifi_connected = false;
+            metric_add(&wifi_failures_metric);
             ESP_LOGI(TAG, "Failed to connect to the AP");
         }
     } else if (event_base == IP_EVENT && event_id == IP_EVENT_STA_GOT_IP) {
@@ -68,6 +90,9 @@ static void event_handler(void* arg, esp_event_base_t event_base, int32_t event_
         ip_event_got_ip_t* event = (ip_event_got_ip_t*) event_data;
         ESP_LOGI(TAG, "IP obtained: " IPSTR, IP2STR(&event->ip_info.ip));
         s_retry_num = 0; // Reset the retry counter
+        if (!wifi_connected) {
+            metric_observe(&wifi_connect_metric, (uint32_t) ((hal_monotonic_us() - wifi_connect_start_us) / 1000));
+        }
         wifi_connected = true; // Set the connection flag to true
     }
 }
@@ -101,6 +126,7 @@ void wifi_init_sta(const char *ssid_name, const char *pass_name) {
 
     ESP_ERROR_CHECK(esp_wifi_set_mode(WIFI_MODE_STA)); // Set Wi-Fi mode to station
     ESP_ERROR_CHECK(esp_wifi_set_config(WIFI_IF_STA, &wifi_config)); // Apply Wi-Fi configuration
+    wifi_connect_start_us = hal_monotonic_us();
     ESP_ERROR_CHECK(esp_wifi_start()); // Start Wi-Fi
 
     ESP_LOGI(TAG, "wifi_init_sta finished.");
@@ -123,27 +149,90 @@ void wifi_disconnect() {
     s_retry_num = 0; // Reset the retry counter
 }
 
-extern "C" void app_main(void) {
-    const char *ssid_list[] = { "AP4", "AP4", "AP4" }; // List of SSIDs to connect to
-    const char *pass_list[] = { "12345678", "12345678", "12345678" }; // Corresponding passwords
+// APS ssid[:password] ... (a known SSID keeps its password when none is given)
+bool _command_aps(int argc, char **argv, char *reply, size_t reply_size) {
+    if (argc < 2) {
+        return false;
+    }
+    uint8_t round[CSI_MAX_APS];
+    size_t count = 0;
+    for (int i = 1; i < argc; i++) {
+        char *pass = strchr(argv[i], ':');
+        if (pass != NULL) {
+            *pass++ = '\0';
+        }
+        if (strlen(argv[i]) == 0 || strlen(argv[i]) >= sizeof(ap_pool[0].ssid) ||
+            (pass != NULL && strlen(pass) >= sizeof(ap_pool[0].pass))) {
+            snprintf(reply, reply_size, "bad SSID or password for AP %d", i);
+            return false;
+        }
+
+        std::lock_guard<std::mutex> lock(ap_round_mutex);
+        size_t id = 0;
+        while (id < ap_pool_count && strcmp(ap_pool[id].ssid, argv[i]) != 0) {
+            id++;
+        }
+        if (id == ap_pool_count) {
+            if (ap_pool_count == CSI_MAX_APS) {
+                snprintf(reply, reply_size, "no room for AP %.32s (max %d distinct)", argv[i], CSI_MAX_APS);
+                return false;
+            }
+            strlcpy(ap_pool[id].ssid, argv[i], sizeof(ap_pool[id].ssid));
+            ap_pool[id].pass[0] = '\0';
+            ap_pool_count++;
+        }
+        if (pass != NULL) {
+            strlcpy(ap_pool[id].pass, pass, sizeof(ap_pool[id].pass));
+        }
+        round[count++] = (uint8_t) id;
+    }
+
+    std::lock_guard<std::mutex> lock(ap_round_mutex);
+    memcpy(ap_round, round, count);
+    ap_round_count = count;
+    snprintf(reply, reply_size, "%u APs from the next round", (unsigned) count);
+    return true;
+}
 
+extern "C" void app_main(void) {
     int n_pack = 5; // Number of connection attempts
     int vuelta = 0; // Counter for the number of connection rounds
 
+    log_start(&log_ring, NULL, NULL); // Hot paths queue their messages, this task prints them
     nvs_init(); // Initialize NVS
     init_func(); // Initialize the network interface
-    for (int j = 0; j < n_pack; j++) {
-        // Clear CSI data before each connection round
-        all_csi_data.clear();
-        csi_data_vector.clear();
+    sd_init(); // Mount the SD card and open the next capture file (CONFIG_SEND_CSI_TO_SD)
+    csi_record_sink = &sd_capture_record; // Every captured frame also goes to the SD capture
+    register_station_commands();
+    command_register("SYNC", "", &sd_command_sync);
+    command_register("APS", "ssid[:password] ...", &_command_aps);
+    command_start(&commands, STDIN_FILENO, STDOUT_FILENO, COMMAND_UDP_PORT); // Retune without restarting
+    survey_start_configured(&survey); // Label the records with CONFIG_SURVEY_PLAN's points, if there is one
+    for (int j = 0; j < n_pack || survey_active(&survey); j++) { // A survey keeps the rounds going until it is done
+        // Release the last round's CSI data before each connection round
+        csi_cycle_reset();
 
-        for (int i = 0; i < 3; i++) {
-            get_AP(ssid_list[i]); // Get the current AP details
+        // This round's APs, an APS command during the round applies to the next one
+        uint8_t round[CSI_MAX_APS];
+        size_t round_count;
+        {
+            std::lock_guard<std::mutex> lock(ap_round_mutex);
+            memcpy(round, ap_round, ap_round_count);
+            round_count = ap_round_count;
+        }
+
+        for (size_t i = 0; i < round_count; i++) {
+            station_ap_t ap; // APS may change the password meanwhile
+            {
+                std::lock_guard<std::mutex> lock(ap_round_mutex);
+                ap = ap_pool[round[i]];
+            }
+            get_AP(ap_pool[round[i]].ssid); // Get the current AP details (the pool name never changes)
             ESP_LOGI(TAG, "ESP_WIFI_MODE_STA");
-            ESP_LOGI(TAG, "SSID: %s", ssid_list[i]);
-            ESP_LOGI(TAG, "Password: %s", pass_list[i]);
+            ESP_LOGI(TAG, "SSID: %s", ap.ssid);
+            ESP_LOGI(TAG, "Password: %s", ap.pass);
 
-            wifi_init_sta(ssid_list[i], pass_list[i]); // Initialize and connect to the Wi-Fi network
+            wifi_init_sta(ap.ssid, ap.pass); // Initialize and connect to the Wi-Fi network
 
             csi_init((char *)"STA"); // Initialize CSI (Channel State Information)
 
@@ -164,5 +253,6 @@ extern "C" void app_main(void) {
         // Reset the flag indicating data collection is complete
         reset_data_collected_flag();
     }
+    sd_deinit(); // Write the capture index and close the file
     ESP_LOGE(TAG, "<---------------------------------------- COMPLETED ---------------------------------------->");
 }
@@ -0,0 +1,363 @@
+#ifndef ESP32_CSI_COMMAND_COMPONENT_H
+#define ESP32_CSI_COMMAND_COMPONENT_H
+
+#include <stdio.h>
+#include <stdarg.h>
+#include <string.h>
+#include <strings.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/select.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <atomic>
+#include <mutex>
+#include <thread>
+
+#ifdef ESP_PLATFORM
+#include "driver/uart.h"
+#include "esp_vfs_dev.h"
+#endif
+
+#include "time_component.h"
+
+/*
+ * Text command channel for retuning a running station.
+ *
+ * A command is one line, "NAME arg arg ...", case-insensitive name, at most COMMAND_LINE_MAX bytes. Lines
+ * come from the serial console or from UDP datagrams (one or more lines each) on COMMAND_UDP_PORT, and
+ * every line gets exactly one reply line, "OK ..." or "ERR ...", on the channel it came from.
+ *
+ * Commands live in a table: components register a name, a usage string and a handler. Handlers run one
+ * at a time on the channel thread, so they should only store the new setting; the capture loops pick it
+ * up at their next packet. Built in: HELP and SETTIME (the old "SETTIME: <sec>.<usec>" line).
+ *
+ * A line longer than COMMAND_LINE_MAX is dropped whole and answered with an error; nothing is ever
+ * written past the buffer.
+ */
+
+#define COMMAND_LINE_MAX 128
+#define COMMAND_MAX_ARGS 8
+#define COMMAND_TABLE_LEN 24
+#define COMMAND_REPLY_MAX 256
+#define COMMAND_UDP_PORT 2225
+#define COMMAND_POLL_MS 200 // How often the channel thread checks whether it should stop
+
+typedef bool (*command_handler_t)(int argc, char **argv, char *reply, size_t reply_size);
+typedef void (*command_reply_t)(void *ctx, const char *reply);
+
+typedef struct {
+    const char *name;
+    const char *usage;
+    command_handler_t handler;
+} command_t;
+
+// Assembles lines from a byte stream
+typedef struct {
+    char line[COMMAND_LINE_MAX];
+    size_t len;
+    bool overflow; // Dropping the rest of a line that did not fit
+} command_reader_t;
+
+typedef struct {
+    uint64_t lines;
+    uint64_t failed; // Unknown command or the handler refused it
+    uint64_t overflows; // Lines dropped for being too long
+} command_stats_t;
+
+typedef struct {
+    int uart_in;
+    int uart_out;
+    int udp_fd;
+    uint16_t udp_port; // Port actually bound (useful when 0 was asked for)
+    command_reader_t uart;
+    std::thread thread;
+    std::atomic<bool> running;
+} command_channel_t;
+
+command_t command_table[COMMAND_TABLE_LEN];
+size_t command_count = 0;
+std::mutex command_mutex; // Guards the table and serializes the handlers
+command_stats_t command_stats;
+
+inline bool command_register(const char *name, const char *usage, command_handler_t handler) {
+    std::lock_guard<std::mutex> lock(command_mutex);
+    for (size_t i = 0; i < command_count; i++) {
+        if (strcasecmp(command_table[i].name, name) == 0) {
+            command_table[i].usage = usage;
+            command_table[i].handler = handler;
+            return true;
+        }
+    }
+    if (command_count == COMMAND_TABLE_LEN) {
+        printf("ERROR: command table full, %s not registered\n", name);
+        return false;
+    }
+    command_table[command_count++] = {name, usage, handler};
+    return true;
+}
+
+// snprintf that appends to a reply and never overflows it
+inline void command_appendf(char *reply, size_t reply_size, const char *format, ...) {
+    size_t used = strnlen(reply, reply_size);
+    if (used + 1 >= reply_size) {
+        return;
+    }
+    va_list args;
+    va_start(args, format);
+    vsnprintf(reply + used, reply_size - used, format, args);
+    va_end(args);
+}
+
+// Parse a decimal integer argument within [min, max]
+inline bool command_parse_int(const char *arg, long min, long max, long *out) {
+    char *end;
+    errno = 0;
+    long v = strtol(arg, &end, 10);
+    if (end == arg || *end != '\0' || errno != 0 || v < min || v > max) {
+        return false;
+    }
+    *out = v;
+    return true;
+}
+
+inline bool command_parse_float(const char *arg, float min, float max, float *out) {
+    char *end;
+    float v = strtof(arg, &end);
+    if (end == arg || *end != '\0' || !(v >= min && v <= max)) {
+        return false;
+    }
+    *out = v;
+    return true;
+}
+
+// Split `line` in place and run the command; `reply` receives "OK ..." or "ERR ..."
+inline bool command_dispatch(char *line, char *reply, size_t reply_size) {
+    char *argv[COMMAND_MAX_ARGS];
+    int argc = 0;
+    char *save = NULL;
+    for (char *tok = strtok_r(line, " \t\r", &save); tok != NULL; tok = strtok_r(NULL, " \t\r", &save)) {
+        if (argc == COMMAND_MAX_ARGS) {
+            snprintf(reply, reply_size, "ERR too many arguments (max %d)", COMMAND_MAX_ARGS - 1);
+            std::lock_guard<std::mutex> lock(command_mutex);
+            command_stats.lines++;
+            command_stats.failed++;
+            return false;
+        }
+        argv[argc++] = tok;
+    }
+    if (argc == 0) {
+        reply[0] = '\0'; // Blank line, no reply
+        return true;
+    }
+
+    // "SETTIME:" and "settime" are the same command
+    size_t name_len = strlen(argv[0]);
+    if (name_len > 1 && argv[0][name_len - 1] == ':') {
+        argv[0][name_len - 1] = '\0';
+    }
+
+    std::lock_guard<std::mutex> lock(command_mutex);
+    command_stats.lines++;
+    for (size_t i = 0; i < command_count; i++) {
+        if (strcasecmp(command_table[i].name, argv[0]) != 0) {
+            continue;
+        }
+        char message[COMMAND_REPLY_MAX - 8] = ""; // Leaves room for "ERR "
+        if (command_table[i].handler(argc, argv, message, sizeof(message))) {
+            snprintf(reply, reply_size, "OK%s%s", message[0] ? " " : "", message);
+            return true;
+        }
+        // The handler explains what is wrong, or the usage is shown
+        if (message[0] != '\0') {
+            snprintf(reply, reply_size, "ERR %s", message);
+        } else {
+            snprintf(reply, reply_size, "ERR usage: %s %s", command_table[i].name, command_table[i].usage);
+        }
+        command_stats.failed++;
+        return false;
+    }
+    snprintf(reply, reply_size, "ERR unknown command %.32s, try HELP", argv[0]);
+    command_stats.failed++;
+    return false;
+}
+
+// Feed received bytes; every complete line is dispatched and answered through `reply`
+inline size_t command_feed(command_reader_t *r, const char *data, size_t len, command_reply_t reply, void *ctx) {
+    size_t lines = 0;
+    char answer[COMMAND_REPLY_MAX];
+    for (size_t i = 0; i < len; i++) {
+        char c = data[i];
+        if (c == '\n' || c == '\0') {
+            if (r->overflow) {
+                snprintf(answer, sizeof(answer), "ERR line too long (max %d bytes)", COMMAND_LINE_MAX - 1);
+                std::lock_guard<std::mutex> lock(command_mutex);
+                command_stats.overflows++;
+            } else {
+                r->line[r->len] = '\0';
+                command_dispatch(r->line, answer, sizeof(answer));
+            }
+            if (answer[0] != '\0') {
+                reply(ctx, answer);
+            }
+            r->len = 0;
+            r->overflow = false;
+            lines++;
+        } else if (r->len + 1 < COMMAND_LINE_MAX) {
+            r->line[r->len++] = c;
+        } else {
+            r->overflow = true;
+        }
+    }
+    return lines;
+}
+
+inline bool _command_help(int, char **, char *reply, size_t reply_size) {
+    for (size_t i = 0; i < command_count; i++) {
+        command_appendf(reply, reply_size, "%s%s", i > 0 ? ", " : "", command_table[i].name);
+    }
+    return true;
+}
+
+// Parsed into locals first: a bad argument leaves the clock and real_time_set as they were
+inline bool _command_settime(int argc, char **argv, char *reply, size_t reply_size) {
+    long int tv_sec;
+    long int tv_usec = 0;
+    if (argc != 2 || sscanf(argv[1], SET_TIMESTAMP_SIMPLE_TEMPLATE, &tv_sec, &tv_usec) <= 0 || tv_usec < 0 ||
+        tv_usec >= 1000000) {
+        return false;
+    }
+    struct timeval now = {.tv_sec = tv_sec, .tv_usec = tv_usec};
+    settimeofday(&now, NULL);
+    real_time_set = true;
+    snprintf(reply, reply_size, "time %lld us", (long long) time_system_us());
+    return true;
+}
+
+inline void command_register_builtins() {
+    command_register("HELP", "", &_command_help);
+    command_register("SETTIME", "<sec>.<usec>", &_command_settime);
+}
+
+inline void _command_write_reply(void *ctx, const char *reply) {
+    int fd = *(int *) ctx;
+    char line[COMMAND_REPLY_MAX + 1];
+    int len = snprintf(line, sizeof(line), "%s\n", reply);
+    if (write(fd, line, len) < 0) {
+        // Console gone, nothing to do
+    }
+}
+
+typedef struct {
+    int fd;
+    struct sockaddr_in to;
+    socklen_t to_len;
+} _command_udp_peer_t;
+
+inline void _command_udp_reply(void *ctx, const char *reply) {
+    _command_udp_peer_t *peer = (_command_udp_peer_t *) ctx;
+    sendto(peer->fd, reply, strlen(reply), 0, (const struct sockaddr *) &peer->to, peer->to_len);
+}
+
+inline void _command_loop(command_channel_t *c) {
+    char buf[COMMAND_LINE_MAX * 2];
+    while (c->running) {
+        fd_set readable;
+        FD_ZERO(&readable);
+        int max_fd = -1;
+        if (c->uart_in >= 0) {
+            FD_SET(c->uart_in, &readable);
+            max_fd = c->uart_in;
+        }
+        if (c->udp_fd >= 0) {
+            FD_SET(c->udp_fd, &readable);
+            max_fd = c->udp_fd > max_fd ? c->udp_fd : max_fd;
+        }
+        struct timeval timeout = {0, COMMAND_POLL_MS * 1000};
+        if (select(max_fd + 1, &readable, NULL, NULL, &timeout) <= 0) {
+            continue;
+        }
+
+        if (c->uart_in >= 0 && FD_ISSET(c->uart_in, &readable)) {
+            ssize_t n = read(c->uart_in, buf, sizeof(buf));
+            if (n > 0) {
+                command_feed(&c->uart, buf, n, &_command_write_reply, &c->uart_out);
+            }
+        }
+        if (c->udp_fd >= 0 && FD_ISSET(c->udp_fd, &readable)) {
+            _command_udp_peer_t peer;
+            peer.fd = c->udp_fd;
+            peer.to_len = sizeof(peer.to);
+            ssize_t n = recvfrom(c->udp_fd, buf, sizeof(buf) - 1, 0, (struct sockaddr *) &peer.to, &peer.to_len);
+            if (n > 0) {
+                // A datagram is self-contained: its last line needs no newline
+                command_reader_t datagram = {};
+                buf[n] = '\n';
+                command_feed(&datagram, buf, n + 1, &_command_udp_reply, &peer);
+            }
+        }
+    }
+}
+
+/*
+ * Listen for commands on `uart_in` (replies to `uart_out`) and on UDP `udp_port`; -1 / 0 leave a side
+ * out. On the station pass STDIN_FILENO and STDOUT_FILENO: the console UART is switched to the interrupt
+ * driven driver so the channel thread sleeps in select() instead of polling.
+ */
+inline bool command_start(command_channel_t *c, int uart_in, int uart_out, int udp_port) {
+    c->uart_in = uart_in;
+    c->uart_out = uart_out;
+    c->udp_fd = -1;
+    c->udp_port = 0;
+    c->uart.len = 0;
+    c->uart.overflow = false;
+
+    if (uart_in >= 0) {
+#ifdef ESP_PLATFORM
+        if (uart_in == STDIN_FILENO && !uart_is_driver_installed(CONFIG_ESP_CONSOLE_UART_NUM)) {
+            uart_driver_install(CONFIG_ESP_CONSOLE_UART_NUM, 256, 0, 0, NULL, 0);
+            esp_vfs_dev_uart_use_driver(CONFIG_ESP_CONSOLE_UART_NUM);
+        }
+#endif
+        fcntl(uart_in, F_SETFL, fcntl(uart_in, F_GETFL, 0) | O_NONBLOCK);
+    }
+
+    if (udp_port >= 0) {
+        c->udp_fd = socket(PF_INET, SOCK_DGRAM, 0);
+        struct sockaddr_in addr;
+        memset(&addr, 0, sizeof(addr));
+        addr.sin_family = AF_INET;
+        addr.sin_port = htons((uint16_t) udp_port);
+        addr.sin_addr.s_addr = htonl(INADDR_ANY);
+        socklen_t addr_len = sizeof(addr);
+        if (c->udp_fd == -1 || bind(c->udp_fd, (const struct sockaddr *) &addr, sizeof(addr)) == -1 ||
+            getsockname(c->udp_fd, (struct sockaddr *) &addr, &addr_len) == -1) {
+            printf("ERROR: command socket on UDP %d [%s]\n", udp_port, strerror(errno));
+            if (c->udp_fd != -1) {
+                close(c->udp_fd);
+            }
+            return false;
+        }
+        c->udp_port = ntohs(addr.sin_port);
+    }
+
+    command_register_builtins();
+    c->running = true;
+    c->thread = std::thread(_command_loop, c);
+    return true;
+}
+
+inline void command_stop(command_channel_t *c) {
+    c->running = false;
+    if (c->thread.joinable()) {
+        c->thread.join();
+    }
+    if (c->udp_fd != -1) {
+        close(c->udp_fd);
+        c->udp_fd = -1;
+    }
+}
+
+#endif //ESP32_CSI_COMMAND_COMPONENT_H
@@ -1,240 +1,468 @@
 #ifndef ESP32_CSI_CSI_COMPONENT_H
 #define ESP32_CSI_CSI_COMPONENT_H
 
+#include "hal_component.h"
 #include "time_component.h"
+#include "csi_packet_component.h"
+#include "log_component.h"
+#include "survey_component.h"
+#include "arena_component.h"
+#include "metrics_component.h"
+#ifdef CONFIG_SERIAL_BINARY_CSI
+#include "serial_frame_component.h"
+#endif
 #include "math.h"
-#include <sstream>
-#include <iostream>
-#include <mutex> // Include for std::mutex to handle concurrent access
-#include <thread> // Include for std::this_thread::sleep_for to simulate delays
-#include <vector> // Include for std::vector to store CSI data
+#include <mutex> // Include for std::mutex (to protect shared data)
+#include <atomic>
+#include <string>
+#include <algorithm>
+
+std::mutex mutex; // Mutex to protect access to the data
+
+char *project_type; // Project type identifier
 
-std::vector<std::string> csi_data_vector; // Vector to store the CSI data
-std::vector<int> all_csi_data; // Vector to store all collected CSI data
-std::mutex mutex; // Mutex to protect access to data (synchronization)
+#define CSI_RAW 1 // Option for raw CSI data
+#define CSI_AMPLITUDE 0 // Option for CSI amplitude data
+#define CSI_PHASE 0 // Option for CSI phase data
 
-char *project_type;
+#define CSI_TYPE CSI_RAW // Define the type of CSI data to be used (e.g., raw)
 
-#define CSI_RAW 1
-#define CSI_AMPLITUDE 0
-#define CSI_PHASE 0
+int x = 0; // Example value for X coordinate
+int y = 0; // Example value for Y coordinate
+const char *current_AP = ""; // Variable to store the current AP (Access Point) connected
 
-#define CSI_TYPE CSI_RAW // Define which type of CSI data to collect
+#define CSI_MAX_APS 16 // Maximum number of distinct APs in the AP table
+#define CSI_STREAM_QUEUE_LEN 32 // Number of CSI records buffered for the socket transmitter
+#define CSI_STREAM_LEN 128 // Bytes of each CSI buffer that are streamed (LLTF)
+
+#define CSI_MAX_LINES CSI_MAX_APS // Text lines stored per round, one per AP visit
+#define CSI_TEXT_LINE_MAX 720 // Longest text line: AP name, RSSI, length and 128 values of up to 4 characters
+#ifndef CONFIG_CSI_ARENA_SIZE
+#define CONFIG_CSI_ARENA_SIZE (16 * 1024) // Per-round memory: a round of CSI_MAX_APS visits with typical values
+#endif
 
-int x = 0; // Example: value of X
-int y = 0; // Example: value of Y
-const char *current_AP = ""; // The current access point connected
+// The round's text lines and the values parsed out of them live in csi_arena, released by csi_cycle_reset
+alignas(ARENA_ALIGN) uint8_t csi_arena_buffer[CONFIG_CSI_ARENA_SIZE];
+arena_t csi_arena = ARENA_INITIALIZER("csi", csi_arena_buffer);
+const char *csi_lines[CSI_MAX_LINES]; // Text line of each AP's first frame this round
+size_t csi_line_count = 0;
+uint32_t csi_cycle = 0; // Counts csi_cycle_reset calls, a deferred line from an earlier round is not stored
+int *all_csi_data = NULL; // Values collect_all_csi_data parsed out of the lines
+size_t all_csi_data_count = 0;
+size_t all_csi_data_capacity = 0;
+char csi_text_line[CSI_TEXT_LINE_MAX]; // Formatting scratch of the log task
+
+const char *ap_table[CSI_MAX_APS]; // Names of the APs seen so far, indexed by AP id
+uint8_t ap_count = 0; // Number of entries in the AP table
+uint8_t current_AP_id = 0; // AP id of the current AP
+uint16_t csi_device_id = 0; // Station identifier sent with every CSI record
+
+// A CSI record together with its own copy of the payload
+typedef struct {
+    csi_record_t record;
+    int8_t payload[CSI_RECORD_MAX_LEN];
+} csi_stream_entry_t;
+
+csi_stream_entry_t csi_stream_queue[CSI_STREAM_QUEUE_LEN]; // Ring of records waiting to be sent
+size_t csi_stream_head = 0; // Index of the oldest record in the ring
+size_t csi_stream_count = 0; // Number of records in the ring
+uint32_t csi_stream_seq = 0; // Sequence number of the next captured record
+uint32_t csi_stream_dropped = 0; // Records overwritten before the transmitter picked them up
+
+METRICS_COUNTER(csi_rx_metric, "csi.rx", CSI_MAX_APS); // Frames the callback got, per AP id
+METRICS_COUNTER(csi_accepted_metric, "csi.accepted", CSI_MAX_APS); // Queued for UDP or handed to a sink
+METRICS_COUNTER(csi_dropped_metric, "csi.dropped", CSI_MAX_APS); // Overwritten in the queue, by their AP
+METRICS_COUNTER(csi_skipped_metric, "csi.skipped", CSI_MAX_APS); // Not in the text lines, the AP's line was taken
+METRICS_COUNTER(csi_line_busy_metric, "csi.line_busy", 1); // First frames passed over, the log task was behind
+METRICS_COUNTER(csi_lines_lost_metric, "csi.lines_lost", 1); // Text lines that did not fit the arena
+METRICS_GAUGE(csi_queue_metric, "csi.queue"); // Records waiting for the transmitter
+METRICS_HISTOGRAM(csi_cb_metric, "csi.cb_us"); // Time in _wifi_csi_cb
+
+void (*csi_record_sink)(const csi_record_t *record, const char *ap_name) = NULL; // Also receives every captured record, e.g. sd_capture_record
+
+#define CSI_SINK_SERIAL 0x01 // CSI lines printed on the console
+#define CSI_SINK_UDP 0x02 // Records queued for the socket transmitter
+#define CSI_SINK_SD 0x04 // Records handed to csi_record_sink
+std::atomic<uint8_t> csi_sinks{CSI_SINK_SERIAL | CSI_SINK_UDP | CSI_SINK_SD}; // Where captured frames go, changed at runtime by SINK
+csi_stream_entry_t csi_unqueued_entry; // Scratch record when UDP is off
+
+#ifdef CONFIG_SERIAL_BINARY_CSI
+#define CSI_SERIAL_TEXT 0 // The serial sink streams every frame as a binary record instead
+serial_link_t serial_link;
+bool serial_link_ready = false;
+#else
+#define CSI_SERIAL_TEXT CSI_SINK_SERIAL // The serial sink is the text line printed for the first frame per AP
+#endif
 
 bool data_collected = false; // Flag to indicate if data has been collected
-bool all_aps_collected = false; // Flag to indicate if data from all APs has been collected
+bool all_aps_collected = false; // Flag to indicate if all APs' data have been collected
 
-// Function to get the current location (for position tracking)
+// Function to update the location coordinates, every record captured from now on is labeled with them
 void get_location(int &ub_x, int &ub_y) {
-    x = ub_x; // Example: value of X
-    y = ub_y; // Example: value of Y
+    x = ub_x; // Update X coordinate
+    y = ub_y; // Update Y coordinate
+    survey_set_location(&survey, (int16_t) x, (int16_t) y);
 }
 
-// Function to update the current access point (AP)
+// Function to update the current Access Point (AP) connected
 void get_AP(const char *ACCES_POINT){
-    std::lock_guard<std::mutex> lock(mutex); // Lock the mutex to prevent race conditions
-    if (strcmp(current_AP, ACCES_POINT) != 0) { // If the current AP is different, update it
-        current_AP = ACCES_POINT;
+    std::lock_guard<std::mutex> lock(mutex); // Lock the mutex to protect shared data
+    if (strcmp(current_AP, ACCES_POINT) != 0) {
+        current_AP = ACCES_POINT; // Update the AP if it's different
+    }
+
+    // Look the AP up in the AP table, adding it if it is new
+    uint8_t id = 0;
+    while (id < ap_count && strcmp(ap_table[id], ACCES_POINT) != 0) {
+        id++;
     }
-    data_collected = false; // Reset data collected flag when switching APs
+    if (id == ap_count && ap_count < CSI_MAX_APS) {
+        ap_table[ap_count++] = ACCES_POINT;
+    }
+    current_AP_id = id;
+
+    data_collected = false; // Reset the data collected flag when AP changes
 }
 
-// Callback function to handle CSI data collection
-void _wifi_csi_cb(void *ctx, wifi_csi_info_t *data) {
-    std::lock_guard<std::mutex> lock(mutex); // Lock the mutex to ensure thread safety
+// Capture time of a CSI frame in microseconds: the collector's timebase once time_sync has a fit
+int64_t _csi_timestamp_us() {
+    return time_now_us();
+}
 
-    if (!data_collected) { // Collect data only once for each AP change
-        std::stringstream ss;
+// Hand a raw CSI record, labeled if a survey is running, to the socket transmitter, the SD capture and the binary serial stream (the caller must hold the mutex)
+void _csi_stream_push(wifi_csi_info_t *data) {
+    uint8_t sinks = csi_sinks;
+    sinks &= ~CSI_SERIAL_TEXT; // The text line is printed by the callback
+    if (sinks == 0) {
+        return;
+    }
 
-        wifi_csi_info_t d = data[0];
-        char mac[20] = {0};
-        sprintf(mac, "%02X:%02X:%02X:%02X:%02X:%02X", d.mac[0], d.mac[1], d.mac[2], d.mac[3], d.mac[4], d.mac[5]);
+    size_t slot;
+    if (!(sinks & CSI_SINK_UDP)) {
+        slot = CSI_STREAM_QUEUE_LEN; // Not queued, only recorded
+    } else if (csi_stream_count == CSI_STREAM_QUEUE_LEN) {
+        slot = csi_stream_head; // Overwrite the oldest record, the collector sees the gap in seq
+        csi_stream_head = (csi_stream_head + 1) % CSI_STREAM_QUEUE_LEN;
+        csi_stream_dropped++;
+        metric_add(&csi_dropped_metric, csi_stream_queue[slot].record.ap_id);
+    } else {
+        slot = (csi_stream_head + csi_stream_count) % CSI_STREAM_QUEUE_LEN;
+        csi_stream_count++;
+    }
+    metric_add(&csi_accepted_metric, current_AP_id);
+    metric_set(&csi_queue_metric, (int32_t) csi_stream_count);
+
+    csi_stream_entry_t *e = slot < CSI_STREAM_QUEUE_LEN ? &csi_stream_queue[slot] : &csi_unqueued_entry;
+    uint16_t len = data->len < CSI_STREAM_LEN ? data->len : CSI_STREAM_LEN;
+    memcpy(e->payload, data->buf, len);
+
+    e->record.seq = csi_stream_seq++;
+    e->record.timestamp_us = _csi_timestamp_us();
+    e->record.device_id = csi_device_id;
+    e->record.ap_id = current_AP_id;
+    e->record.rssi = data->rx_ctrl.rssi;
+    e->record.flags = CSI_RECORD_FLAG_RAW;
+    e->record.len = len;
+    e->record.data = e->payload;
+    survey_tag(&survey, &e->record); // Location and round while a survey dwells at a point
+
+    if (csi_record_sink != NULL && (sinks & CSI_SINK_SD)) {
+        csi_record_sink(&e->record, current_AP);
+    }
+#ifdef CONFIG_SERIAL_BINARY_CSI
+    if (sinks & CSI_SINK_SERIAL) {
+        serial_link_submit(&serial_link, &e->record, current_AP);
+    }
+#endif
+}
 
-        ss << "4B" << "," 
-            //<<current_AP << ","  // Uncomment if AP info is needed in the log
-           << d.rx_ctrl.rssi << ","; // Include the RSSI value
+// Take the oldest queued CSI record. Returns false if there is none.
+bool csi_stream_pop(csi_stream_entry_t *out) {
+    std::lock_guard<std::mutex> lock(mutex); // Lock the mutex to protect shared data
+    if (csi_stream_count == 0) {
+        return false;
+    }
 
-        int data_len = 128; // Length of the CSI data
+    csi_stream_entry_t *e = &csi_stream_queue[csi_stream_head];
+    out->record = e->record;
+    memcpy(out->payload, e->payload, e->record.len);
+    out->record.data = out->payload;
 
-        int8_t *my_ptr;
+    csi_stream_head = (csi_stream_head + 1) % CSI_STREAM_QUEUE_LEN;
+    csi_stream_count--;
+    metric_set(&csi_queue_metric, (int32_t) csi_stream_count);
+    return true;
+}
+
+#define CSI_TEXT_SLOTS 4 // First frames per AP waiting for the log task to format them
+
+// Copy of a frame whose text line is formatted on the log task
+typedef struct {
+    std::atomic<bool> busy;
+    uint32_t cycle; // csi_cycle when the frame was captured
+    const char *ap_name;
+    int rssi;
+    uint16_t len;
+    int8_t buf[CSI_STREAM_LEN];
+} csi_text_slot_t;
+
+csi_text_slot_t csi_text_slots[CSI_TEXT_SLOTS];
+
+// Append v and a space to the line in `out` (snprintf without its cost, the line is formatted per frame)
+inline void _csi_append_int(char *out, size_t size, size_t *len, int v) {
+    char digits[12];
+    size_t n = 0;
+    unsigned u = v < 0 ? 0u - (unsigned) v : (unsigned) v;
+    do {
+        digits[n++] = (char) ('0' + u % 10);
+        u /= 10;
+    } while (u > 0);
+    if (v < 0) {
+        digits[n++] = '-';
+    }
+    if (*len + n + 1 >= size) {
+        return; // Does not fit, CSI_TEXT_LINE_MAX is sized so that it always does
+    }
+    while (n > 0) {
+        out[(*len)++] = digits[--n];
+    }
+    out[(*len)++] = ' ';
+}
+
+// The values of a frame as the text lines show them (CSI_TYPE), each followed by a space
+inline size_t _csi_format_values(char *out, size_t size, size_t len, const int8_t *my_ptr) {
+    int data_len = CSI_STREAM_LEN; // Set the data length (adjust if needed)
 #if CSI_RAW
-        // If CSI_RAW is selected, append the raw data values
-        my_ptr = data->buf;
-        for (int i = 0; i < data_len; i++) {
-            ss << (int)my_ptr[i] << " ";
-        }
+    for (int i = 0; i < data_len; i++) {
+        _csi_append_int(out, size, &len, my_ptr[i]); // Add each raw CSI value
+    }
 #endif
 #if CSI_AMPLITUDE
-        // If CSI_AMPLITUDE is selected, compute the amplitude and append it
-        my_ptr = data->buf;
-        for (int i = 0; i < data_len / 2; i++) {
-            ss << (int)sqrt(pow(my_ptr[i * 2], 2) + pow(my_ptr[(i * 2) + 1], 2)) << " ";
-        }
+    for (int i = 0; i < data_len / 2; i++) {
+        _csi_append_int(out, size, &len, (int)sqrt(pow(my_ptr[i * 2], 2) + pow(my_ptr[(i * 2) + 1], 2))); // Calculate the amplitude and add it
+    }
 #endif
 #if CSI_PHASE
-        // If CSI_PHASE is selected, compute the phase and append it
-        my_ptr = data->buf;
-        for (int i = 0; i < data_len / 2; i++) {
-            ss << (int)atan2(my_ptr[i * 2], my_ptr[(i * 2) + 1]) << " ";
-        }
+    for (int i = 0; i < data_len / 2; i++) {
+        _csi_append_int(out, size, &len, (int)atan2(my_ptr[i * 2], my_ptr[(i * 2) + 1])); // Calculate the phase and add it
+    }
 #endif
-        ss << "\n"; // End the line for this data packet
+    return len;
+}
 
-        csi_data_vector.push_back(ss.str()); // Store the collected CSI data in the vector
+// Keep a text line of round `cycle` in the arena for collect_all_csi_data (the caller must hold the mutex)
+void _csi_store_line(const char *line, size_t len, uint32_t cycle) {
+    if (cycle != csi_cycle) {
+        return; // Formatted after csi_cycle_reset, the line belongs to a round that is gone
+    }
+    char *copy = csi_line_count < CSI_MAX_LINES ? arena_strndup(&csi_arena, line, len) : NULL;
+    if (copy == NULL) {
+        metric_add(&csi_lines_lost_metric);
+        LOG_E("csi", "no room for the text line of %s, %u of %u arena bytes used", current_AP,
+              (unsigned) csi_arena.used, (unsigned) csi_arena.size);
+        return;
+    }
+    csi_lines[csi_line_count++] = copy;
+}
 
-        printf("%s", ss.str().c_str()); // Print the data to the console
-        fflush(stdout); // Ensure data is immediately printed
+// Format the text line of a captured frame, store it for collect_all_csi_data and print it (runs on the log task)
+size_t _csi_text_render(void *ctx, char *out, size_t size) {
+    ARENA_NO_HEAP;
+    csi_text_slot_t *slot = (csi_text_slot_t *) ctx;
+    char *line = csi_text_line;
+    int prefix = snprintf(line, CSI_TEXT_LINE_MAX, "%s,%d,%u,[", // AP, RSSI and length of the data
+                          slot->ap_name, slot->rssi, (unsigned) slot->len);
+    size_t len = std::min((size_t) prefix, (size_t) CSI_TEXT_LINE_MAX - 3);
+    len = _csi_format_values(line, CSI_TEXT_LINE_MAX - 2, len, slot->buf); // Leaves room for "]\n"
+    line[len++] = ']'; // Close the CSI data list
+    line[len++] = '\n';
+    line[len] = '\0';
+    uint32_t cycle = slot->cycle;
+    slot->busy = false;
+
+    {
+        std::lock_guard<std::mutex> lock(mutex); // Lock the mutex to protect shared data
+        _csi_store_line(line, len, cycle); // Store the formatted CSI data for the round
+    }
 
-        data_collected = true; // Mark data as collected for this AP
+    if (!(csi_sinks & CSI_SERIAL_TEXT)) {
+        return 0;
     }
+    len = len < size ? len : size - 1;
+    memcpy(out, line, len); // Printed as is, without a log prefix
+    return len;
+}
+
+/*
+ * Callback function for handling CSI data. It runs on the Wi-Fi task, so it only copies: the text line of
+ * the first frame per AP is formatted and printed by the log task.
+ */
+void _wifi_csi_cb(void *, wifi_csi_info_t *data) {
+    ARENA_NO_HEAP;
+    METRICS_SCOPE(csi_cb_metric);
+    std::lock_guard<std::mutex> lock(mutex); // Lock the mutex to protect shared data
+    metric_add(&csi_rx_metric, current_AP_id);
+
+    _csi_stream_push(data); // Every frame is streamed, not only the first one per AP
+
+    if (data_collected) {
+        metric_add(&csi_skipped_metric, current_AP_id);
+    } else { // If data has not been collected yet
+        csi_text_slot_t *slot = NULL;
+        for (int i = 0; i < CSI_TEXT_SLOTS && slot == NULL; i++) {
+            bool expected = false;
+            if (csi_text_slots[i].busy.compare_exchange_strong(expected, true)) {
+                slot = &csi_text_slots[i];
+            }
+        }
+        if (slot == NULL) {
+            metric_add(&csi_line_busy_metric);
+            return; // The log task is behind, take a later frame
+        }
 
-    std::this_thread::sleep_for(std::chrono::milliseconds(10)); // Simulate a delay to avoid overloading the system
+        uint16_t len = data->len < CSI_STREAM_LEN ? data->len : CSI_STREAM_LEN;
+        memcpy(slot->buf, data->buf, len);
+        memset(slot->buf + len, 0, CSI_STREAM_LEN - len);
+        slot->cycle = csi_cycle;
+        slot->ap_name = current_AP;
+        slot->rssi = data->rx_ctrl.rssi;
+        slot->len = data->len;
+
+        if (!log_deferred(&log_ring, LOG_LEVEL_INFO, &_csi_text_render, slot)) {
+            slot->busy = false; // Ring full, take a later frame
+            metric_add(&csi_line_busy_metric);
+            return;
+        }
+        data_collected = true; // Set the flag to true after data is collected
+    }
 }
 
-// Function to check if a string represents a numeric value
+// Function to check if a string is numeric
 bool is_numeric(const std::string& str) {
-    if (str.empty()) return false; // Return false for empty strings
+    if (str.empty()) return false; // Return false if the string is empty
 
     for (char c : str) {
-        if (!std::isdigit(c) && c != '-') return false; // Allow '-' for negative numbers
+        if (!std::isdigit(c) && c != '-') return false; // Return false if the character is not a digit or a minus sign
     }
-    return true;
+    return true; // Return true if all characters are digits or minus sign
 }
 
-// Function to collect all CSI data and format it for transmission
+// Function to collect all CSI data and store it in `all_csi_data`
 void collect_all_csi_data() {
-    std::lock_guard<std::mutex> lock(mutex); // Lock the mutex to avoid concurrent access issues
-
-    all_csi_data.clear(); // Clear the previous collected data before filling it with new data
-
-    // Process each entry in csi_data_vector
-    for (const auto& data_str : csi_data_vector) {
-        std::stringstream ss(data_str);
-        std::string item;
-
-        std::getline(ss, item, '['); // Skip the opening bracket '['
-
-        // Read the data values between spaces and store them in all_csi_data
-        while (std::getline(ss, item, ' ')) {
-            if (!item.empty() && item.back() == ']') { // Remove the closing bracket ']'
-                item.pop_back();
-                if (!item.empty()) {
-                    int value;
-                    if (std::istringstream(item) >> value) { // Convert string to integer
-                        all_csi_data.push_back(value);
-                    } else {
-                        printf("Error: Invalid argument for string to integer conversion.\n");
-                    }
-                }
+    log_flush(&log_ring); // The text lines of this round are stored by the log task
+    ARENA_NO_HEAP;
+    std::lock_guard<std::mutex> lock(mutex); // Lock the mutex to protect shared data
+
+    all_csi_data_count = 0; // Clear `all_csi_data` before collecting new data
+    if (all_csi_data_capacity < csi_line_count * CSI_STREAM_LEN) {
+        all_csi_data = arena_alloc_array<int>(&csi_arena, csi_line_count * CSI_STREAM_LEN);
+        all_csi_data_capacity = all_csi_data != NULL ? csi_line_count * CSI_STREAM_LEN : 0;
+        if (all_csi_data == NULL) {
+            printf("ERROR: no room in the arena for the values of %u lines\n", (unsigned) csi_line_count);
+        }
+    }
+
+    for (size_t l = 0; l < csi_line_count; l++) { // Iterate over all stored CSI data
+        const char *p = strchr(csi_lines[l], '['); // Skip the part before the opening bracket
+        if (p == NULL) {
+            continue;
+        }
+        p++;
+        while (true) { // Read each value between spaces
+            while (*p == ' ') {
+                p++;
+            }
+            if (*p == ']' || *p == '\n' || *p == '\0') { // Closing bracket
                 break;
             }
-            if (!item.empty()) {
-                int value;
-                if (std::istringstream(item) >> value) { // Convert string to integer
-                    all_csi_data.push_back(value);
-                } else {
-                    printf("Error: Invalid argument for string to integer conversion.\n");
-                }
+            char *end;
+            long value = strtol(p, &end, 10);
+            if (end == p) {
+                printf("Error: Invalid argument for string to integer conversion.\n"); // Handle invalid conversion
+            } else if (all_csi_data_count < all_csi_data_capacity) {
+                all_csi_data[all_csi_data_count++] = (int) value; // Add the integer to `all_csi_data`
+            }
+            p = end;
+            while (*p != ' ' && *p != ']' && *p != '\0') { // Skip the rest of the item
+                p++;
             }
         }
     }
 
-    // Format the data for final output
-    std::stringstream final_ss;
-    final_ss << "CSI_DATA,["; 
-    for (const auto& val : all_csi_data) {
-        final_ss << val << " "; // Append each value
+    // Print "CSI_DATA v1 v2 ... vn " in pieces, without building the whole line
+    char chunk[256];
+    size_t len = 9;
+    memcpy(chunk, "CSI_DATA ", len);
+    for (size_t i = 0; i < all_csi_data_count; i++) {
+        if (len + 16 > sizeof(chunk)) {
+            fwrite(chunk, 1, len, stdout);
+            len = 0;
+        }
+        _csi_append_int(chunk, sizeof(chunk), &len, all_csi_data[i]); // Add each value and a space
     }
-    std::string final_str = final_ss.str();
-    if (!all_csi_data.empty()) {
-        final_str.pop_back(); // Remove the last space
+    if (all_csi_data_count == 0) {
+        chunk[len++] = ' '; // The line always ends in a space
     }
-    final_str += "]"; // Add closing bracket
+    chunk[len++] = '\n';
+    fwrite(chunk, 1, len, stdout); // Print the final formatted CSI data
+    fflush(stdout); // Ensure the output is printed immediately
 
-    // Print the final formatted data
-    printf("%s\n", final_str.c_str());
-    fflush(stdout); // Ensure immediate printing
-
-    // Clear the data vector after collecting all APs
+    // Clear the values once all AP data has been collected
     if (all_aps_collected) {
-        all_csi_data.clear(); // Clear all data after collection is complete
+        all_csi_data_count = 0;
         all_aps_collected = false; // Reset the flag for the next cycle
     }
 }
 
+// Release the round's text lines and values, before the next round's first frame
+void csi_cycle_reset() {
+    std::lock_guard<std::mutex> lock(mutex); // Lock the mutex to protect shared data
+    arena_reset(&csi_arena);
+    csi_line_count = 0;
+    csi_cycle++;
+    all_csi_data = NULL;
+    all_csi_data_count = 0;
+    all_csi_data_capacity = 0;
+}
+
 // Function to mark that all APs have been collected
 void mark_all_aps_collected() {
-    std::lock_guard<std::mutex> lock(mutex);
+    std::lock_guard<std::mutex> lock(mutex); // Lock the mutex to protect shared data
     all_aps_collected = true; // Set the flag to true
 }
 
 // Function to reset the data collected flag
 void reset_data_collected_flag() {
-    std::lock_guard<std::mutex> lock(mutex);
+    std::lock_guard<std::mutex> lock(mutex); // Lock the mutex to protect shared data
     data_collected = false; // Reset the flag
 }
 
-// Function to collect CSI data and store it in an array
-void collect_csi_data(wifi_csi_info_t *data) {
-    std::lock_guard<std::mutex> lock(mutex); // Lock the mutex to ensure thread safety
-
-    if (!data_collected) { // Collect data only once for each AP change
-        std::stringstream ss;
-
-        int data_len = 128; // Length of the CSI data
-
-        int8_t *my_ptr;
-#if CSI_RAW
-        my_ptr = data->buf; // Get the raw data buffer
-        for (int i = 0; i < data_len; i++) {
-            ss << (int)my_ptr[i] << " "; // Add each raw data byte to the stringstream
-        }
-#endif
-#if CSI_AMPLITUDE
-        my_ptr = data->buf;
-        for (int i = 0; i < data_len / 2; i++) {
-            ss << (int)sqrt(pow(my_ptr[i * 2], 2) + pow(my_ptr[(i * 2) + 1], 2)) << " "; // Add amplitude data
-        }
-#endif
-#if CSI_PHASE
-        my_ptr = data->buf;
-        for (int i = 0; i < data_len / 2; i++) {
-            ss << (int)atan2(my_ptr[i * 2], my_ptr[(i * 2) + 1]) << " "; // Add phase data
-        }
-#endif
-        ss << "]"; // Close the data section
-
-        csi_data_vector.push_back(ss.str()); // Store the CSI data in the vector
-    }
-}
-
 // Function to print all stored CSI data
 void print_stored_csi_data() {
     std::lock_guard<std::mutex> lock(mutex); // Lock the mutex
-    for (const auto &data : csi_data_vector) {
-        printf("%s\n", data.c_str());
+    for (size_t i = 0; i < csi_line_count; i++) {
+        printf("%s\n", csi_lines[i]);
     }
 }
 
 void csi_init(char *type) {
     project_type = type;
 
-    ESP_ERROR_CHECK(esp_wifi_set_csi(1));
+#if defined CONFIG_CSI_DEVICE_ID && (CONFIG_CSI_DEVICE_ID > 0)
+    csi_device_id = CONFIG_CSI_DEVICE_ID;
+#else
+    uint8_t sta_mac[6];
+    hal_station_mac(sta_mac);
+    csi_device_id = (sta_mac[4] << 8) | sta_mac[5]; // Low bytes of the station MAC
+#endif
 
-    wifi_csi_config_t configuration_csi;
-    configuration_csi.lltf_en = 1;
-    configuration_csi.htltf_en = 1;
-    configuration_csi.stbc_htltf2_en = 1;
-    configuration_csi.ltf_merge_en = 1;
-    configuration_csi.channel_filter_en = 0;
-    configuration_csi.manu_scale = 0;
+#ifdef CONFIG_SERIAL_BINARY_CSI
+    if (!serial_link_ready) {
+        serial_link_ready = serial_link_start(&serial_link, STDOUT_FILENO);
+    }
+#endif
 
-    ESP_ERROR_CHECK(esp_wifi_set_csi_config(&configuration_csi));
-    ESP_ERROR_CHECK(esp_wifi_set_csi_rx_cb(&_wifi_csi_cb, NULL));
+    hal_csi_start(&_wifi_csi_cb, NULL);
 }
 
 #endif // ESP32_CSI_CSI_COMPONENT_H
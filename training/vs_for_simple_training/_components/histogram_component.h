@@ -0,0 +1,52 @@
+#ifndef ESP32_CSI_HISTOGRAM_COMPONENT_H
+#define ESP32_CSI_HISTOGRAM_COMPONENT_H
+
+#include <stdint.h>
+
+/*
+ * Log-linear histogram buckets, shared by the metrics (metrics_component.h) and the cycle profile
+ * (profile_component.h): values below 16 have a bucket each, larger ones four per power of two, 128 buckets
+ * up to 2^32. The largest value of a bucket is within 25 % of its smallest, so a percentile read from the
+ * buckets is too.
+ */
+
+#define HISTOGRAM_BUCKETS 128
+
+inline uint8_t histogram_bucket(uint32_t v) {
+    if (v < 16) {
+        return (uint8_t) v;
+    }
+    int e = 31 - __builtin_clz(v); // >= 4
+    return (uint8_t) (16 + (e - 4) * 4 + ((v >> (e - 2)) & 3));
+}
+
+// Largest value that falls into bucket b
+inline uint32_t histogram_bucket_max(uint8_t b) {
+    if (b < 16) {
+        return b;
+    }
+    int e = (b - 16) / 4 + 4;
+    uint64_t low = (uint64_t) (4 + (b - 16) % 4) << (e - 2);
+    return (uint32_t) (low + ((uint64_t) 1 << (e - 2)) - 1);
+}
+
+// Upper bound of the q quantile of `count` values in `buckets` (HISTOGRAM_BUCKETS), clipped to `max`
+template <typename T>
+uint32_t histogram_percentile(const T *buckets, uint32_t count, uint32_t max, double q) {
+    if (count == 0) {
+        return 0;
+    }
+    uint32_t rank = (uint32_t) (q * count + 0.999999);
+    rank = rank == 0 ? 1 : rank;
+    uint32_t seen = 0;
+    for (int b = 0; b < HISTOGRAM_BUCKETS; b++) {
+        seen += (uint32_t) buckets[b];
+        if (seen >= rank) {
+            uint32_t v = histogram_bucket_max((uint8_t) b);
+            return v < max ? v : max;
+        }
+    }
+    return max;
+}
+
+#endif //ESP32_CSI_HISTOGRAM_COMPONENT_H
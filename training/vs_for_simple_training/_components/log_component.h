@@ -0,0 +1,375 @@
+#ifndef ESP32_CSI_LOG_COMPONENT_H
+#define ESP32_CSI_LOG_COMPONENT_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <atomic>
+#include <chrono>
+#include <thread>
+#include <type_traits>
+
+#ifdef ESP_PLATFORM
+#include "esp_pthread.h"
+#endif
+
+#include "time_component.h"
+
+/*
+ * Deferred logging for code that must not wait on the console (Wi-Fi callback, capture and inference loops).
+ *
+ *   LOG_I("csi", "frame %u from %s, rssi %d", seq, "AP1", rssi);
+ *
+ * A call stores the format string pointer, the timestamp and up to LOG_MAX_ARGS raw arguments in a
+ * lock-free ring and returns; nothing is formatted. A low priority task (log_start) formats the entries
+ * with the usual printf conversions and writes them as ESP log lines, "I (ms) tag: message". When the ring
+ * is full the entry is dropped and counted, and the task reports the count with the next line it writes.
+ *
+ * Arguments are numbers or pointers. A string argument is only a pointer, so it must outlive the call:
+ * string literals, AP names from the AP table, model labels. Anything built on the fly goes through
+ * log_deferred(), which hands the task a callback that renders the whole line.
+ *
+ * Levels above CONFIG_LOG_DEFERRED_LEVEL compile to nothing, arguments included.
+ */
+
+#define LOG_LEVEL_NONE 0
+#define LOG_LEVEL_ERROR 1
+#define LOG_LEVEL_WARN 2
+#define LOG_LEVEL_INFO 3
+#define LOG_LEVEL_DEBUG 4
+#define LOG_LEVEL_VERBOSE 5
+
+#ifndef CONFIG_LOG_DEFERRED_LEVEL
+#define CONFIG_LOG_DEFERRED_LEVEL LOG_LEVEL_INFO
+#endif
+#ifndef CONFIG_LOG_DEFERRED_PRIORITY
+#define CONFIG_LOG_DEFERRED_PRIORITY 1 // Just above idle
+#endif
+
+#define LOG_RING_LEN 128 // Entries, a power of two
+#define LOG_MAX_ARGS 6
+#define LOG_LINE_MAX 640 // Longest line written, enough for a text CSI line
+#define LOG_POLL_MS 10 // How often the log task looks for new entries when the ring is empty
+
+typedef union {
+    int64_t i;
+    double d;
+    const void *p;
+} log_arg_t;
+
+// Renders a deferred line into `out` (including its newline), returns its length
+typedef size_t (*log_render_t)(void *ctx, char *out, size_t size);
+typedef void (*log_output_t)(void *ctx, const char *text, size_t len);
+
+typedef struct {
+    // Producers and the task hand the entry back and forth through this counter. It is kept relative to
+    // the entry's index, so a zero-initialized ring is ready before log_start() runs.
+    std::atomic<uint32_t> turn;
+    uint8_t level;
+    uint8_t argc;
+    const char *tag;
+    const char *format; // NULL for log_deferred(): args[0] is the log_render_t, args[1] its context
+    int64_t timestamp_us;
+    log_arg_t args[LOG_MAX_ARGS];
+} log_entry_t;
+
+typedef struct {
+    uint64_t written;
+    uint64_t dropped; // Ring full
+    uint64_t emitted; // Lines the task wrote
+} log_stats_t;
+
+typedef struct {
+    log_entry_t ring[LOG_RING_LEN];
+    std::atomic<uint32_t> enqueue;
+    std::atomic<uint32_t> dequeue; // Only the task moves it
+    std::atomic<uint64_t> written;
+    std::atomic<uint64_t> dropped;
+    std::atomic<uint64_t> emitted;
+    uint64_t reported_drops;
+
+    log_output_t output;
+    void *output_ctx;
+    char line[LOG_LINE_MAX]; // Kept off the task's stack
+    std::thread thread;
+    std::atomic<bool> running;
+} log_ring_t;
+
+log_ring_t log_ring;
+
+template <typename T>
+inline typename std::enable_if<std::is_integral<T>::value || std::is_enum<T>::value, log_arg_t>::type _log_arg(T v) {
+    log_arg_t a;
+    a.i = (int64_t) v;
+    return a;
+}
+
+template <typename T>
+inline typename std::enable_if<std::is_floating_point<T>::value, log_arg_t>::type _log_arg(T v) {
+    log_arg_t a;
+    a.d = (double) v;
+    return a;
+}
+
+template <typename T>
+inline log_arg_t _log_arg(const T *v) {
+    log_arg_t a;
+    a.p = (const void *) v;
+    return a;
+}
+
+// Claim an entry, fill it and publish it. Never blocks: a full ring drops the entry.
+inline bool _log_push(log_ring_t *l, uint8_t level, const char *tag, const char *format, const log_arg_t *args,
+                      uint8_t argc) {
+    uint32_t pos = l->enqueue.load(std::memory_order_relaxed);
+    log_entry_t *e;
+    while (true) {
+        e = &l->ring[pos & (LOG_RING_LEN - 1)];
+        uint32_t turn = e->turn.load(std::memory_order_acquire) + (pos & (LOG_RING_LEN - 1));
+        int32_t diff = (int32_t) (turn - pos);
+        if (diff == 0) {
+            if (l->enqueue.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+                break;
+            }
+        } else if (diff < 0) {
+            l->dropped.fetch_add(1, std::memory_order_relaxed);
+            return false;
+        } else {
+            pos = l->enqueue.load(std::memory_order_relaxed);
+        }
+    }
+
+    e->level = level;
+    e->argc = argc;
+    e->tag = tag;
+    e->format = format;
+    e->timestamp_us = time_monotonic_us();
+    memcpy(e->args, args, argc * sizeof(log_arg_t));
+    e->turn.store(pos + 1 - (pos & (LOG_RING_LEN - 1)), std::memory_order_release);
+    l->written.fetch_add(1, std::memory_order_relaxed);
+    return true;
+}
+
+template <typename... Args>
+inline bool log_write(log_ring_t *l, uint8_t level, const char *tag, const char *format, Args... args) {
+    static_assert(sizeof...(Args) <= LOG_MAX_ARGS, "too many log arguments");
+    log_arg_t packed[sizeof...(Args) + 1] = {_log_arg(args)...};
+    return _log_push(l, level, tag, format, packed, (uint8_t) sizeof...(Args));
+}
+
+// Queue a line that `render` builds on the log task, e.g. from a record copied into a slot owned by the caller
+inline bool log_deferred(log_ring_t *l, uint8_t level, log_render_t render, void *ctx) {
+    log_arg_t args[2];
+    args[0].p = (const void *) render;
+    args[1].p = ctx;
+    return _log_push(l, level, NULL, NULL, args, 2);
+}
+
+#if CONFIG_LOG_DEFERRED_LEVEL >= LOG_LEVEL_ERROR
+#define LOG_E(tag, format, ...) log_write(&log_ring, LOG_LEVEL_ERROR, tag, format, ##__VA_ARGS__)
+#else
+#define LOG_E(tag, format, ...) do {} while (0)
+#endif
+#if CONFIG_LOG_DEFERRED_LEVEL >= LOG_LEVEL_WARN
+#define LOG_W(tag, format, ...) log_write(&log_ring, LOG_LEVEL_WARN, tag, format, ##__VA_ARGS__)
+#else
+#define LOG_W(tag, format, ...) do {} while (0)
+#endif
+#if CONFIG_LOG_DEFERRED_LEVEL >= LOG_LEVEL_INFO
+#define LOG_I(tag, format, ...) log_write(&log_ring, LOG_LEVEL_INFO, tag, format, ##__VA_ARGS__)
+#else
+#define LOG_I(tag, format, ...) do {} while (0)
+#endif
+#if CONFIG_LOG_DEFERRED_LEVEL >= LOG_LEVEL_DEBUG
+#define LOG_D(tag, format, ...) log_write(&log_ring, LOG_LEVEL_DEBUG, tag, format, ##__VA_ARGS__)
+#else
+#define LOG_D(tag, format, ...) do {} while (0)
+#endif
+#if CONFIG_LOG_DEFERRED_LEVEL >= LOG_LEVEL_VERBOSE
+#define LOG_V(tag, format, ...) log_write(&log_ring, LOG_LEVEL_VERBOSE, tag, format, ##__VA_ARGS__)
+#else
+#define LOG_V(tag, format, ...) do {} while (0)
+#endif
+
+/*
+ * printf with the stored arguments, one conversion at a time: every integer conversion is rewritten to
+ * take a long long and every floating one a double, which is how the arguments were stored. Conversions
+ * without an argument left print as "?".
+ */
+inline size_t _log_format(char *out, size_t size, const char *format, const log_arg_t *args, uint8_t argc) {
+    size_t o = 0;
+    uint8_t next = 0;
+    const char *p = format;
+    while (*p != '\0' && o + 1 < size) {
+        if (*p != '%') {
+            out[o++] = *p++;
+            continue;
+        }
+        if (p[1] == '%') {
+            out[o++] = '%';
+            p += 2;
+            continue;
+        }
+
+        // Copy flags, width and precision, skip the length modifier
+        char spec[24];
+        size_t s = 0;
+        const char *q = p + 1;
+        spec[s++] = '%';
+        while (*q != '\0' && strchr("-+ #0123456789.", *q) != NULL && s < sizeof(spec) - 4) {
+            spec[s++] = *q++;
+        }
+        while (*q != '\0' && strchr("hlLqjzt", *q) != NULL) {
+            q++;
+        }
+        char conversion = *q;
+        if (conversion == '\0') {
+            break;
+        }
+        p = q + 1;
+
+        int n;
+        log_arg_t a = next < argc ? args[next++] : log_arg_t{};
+        if (next > argc || strchr("diouxXcsfFeEgGaAp", conversion) == NULL) {
+            n = snprintf(out + o, size - o, "?");
+        } else if (strchr("di", conversion) != NULL) {
+            spec[s++] = 'l';
+            spec[s++] = 'l';
+            spec[s++] = conversion;
+            spec[s] = '\0';
+            n = snprintf(out + o, size - o, spec, (long long) a.i);
+        } else if (strchr("ouxX", conversion) != NULL) {
+            spec[s++] = 'l';
+            spec[s++] = 'l';
+            spec[s++] = conversion;
+            spec[s] = '\0';
+            n = snprintf(out + o, size - o, spec, (unsigned long long) a.i);
+        } else if (conversion == 'c') {
+            spec[s++] = 'c';
+            spec[s] = '\0';
+            n = snprintf(out + o, size - o, spec, (int) a.i);
+        } else if (conversion == 's') {
+            spec[s++] = 's';
+            spec[s] = '\0';
+            n = snprintf(out + o, size - o, spec, a.p != NULL ? (const char *) a.p : "(null)");
+        } else if (conversion == 'p') {
+            spec[s++] = 'p';
+            spec[s] = '\0';
+            n = snprintf(out + o, size - o, spec, a.p);
+        } else {
+            spec[s++] = conversion;
+            spec[s] = '\0';
+            n = snprintf(out + o, size - o, spec, a.d);
+        }
+        if (n > 0) {
+            o += (size_t) n < size - o ? (size_t) n : size - o - 1;
+        }
+    }
+    out[o] = '\0';
+    return o;
+}
+
+inline void _log_write_stdout(void *, const char *text, size_t len) {
+    fwrite(text, 1, len, stdout);
+}
+
+inline size_t _log_render(log_ring_t *l, const log_entry_t *e) {
+    if (e->format == NULL) {
+        log_render_t render = (log_render_t) e->args[0].p;
+        return render((void *) e->args[1].p, l->line, sizeof(l->line));
+    }
+    static const char levels[] = "?EWIDV";
+    int n = snprintf(l->line, sizeof(l->line), "%c (%lld) %s: ", levels[e->level <= LOG_LEVEL_VERBOSE ? e->level : 0],
+                     (long long) (e->timestamp_us / 1000), e->tag);
+    size_t len = n > 0 && (size_t) n < sizeof(l->line) ? (size_t) n : 0;
+    len += _log_format(l->line + len, sizeof(l->line) - len - 1, e->format, e->args, e->argc);
+    l->line[len++] = '\n';
+    return len;
+}
+
+// Write every published entry. Returns the number written.
+inline size_t _log_drain(log_ring_t *l) {
+    size_t count = 0;
+    while (true) {
+        uint32_t pos = l->dequeue.load(std::memory_order_relaxed);
+        log_entry_t *e = &l->ring[pos & (LOG_RING_LEN - 1)];
+        uint32_t turn = e->turn.load(std::memory_order_acquire) + (pos & (LOG_RING_LEN - 1));
+        if ((int32_t) (turn - (pos + 1)) < 0) {
+            break;
+        }
+
+        uint64_t dropped = l->dropped.load(std::memory_order_relaxed);
+        if (dropped != l->reported_drops) {
+            int n = snprintf(l->line, sizeof(l->line), "W (%lld) log: %llu messages dropped\n",
+                             (long long) (time_monotonic_us() / 1000), (unsigned long long) (dropped - l->reported_drops));
+            l->output(l->output_ctx, l->line, n);
+            l->reported_drops = dropped;
+        }
+
+        size_t len = _log_render(l, e);
+        l->output(l->output_ctx, l->line, len);
+        e->turn.store(pos + LOG_RING_LEN - (pos & (LOG_RING_LEN - 1)), std::memory_order_release);
+        l->dequeue.store(pos + 1, std::memory_order_release);
+        l->emitted.fetch_add(1, std::memory_order_relaxed);
+        count++;
+    }
+    return count;
+}
+
+inline void _log_loop(log_ring_t *l) {
+    while (l->running) {
+        if (_log_drain(l) > 0) {
+            if (l->output == &_log_write_stdout) {
+                fflush(stdout);
+            }
+        } else {
+            std::this_thread::sleep_for(std::chrono::milliseconds(LOG_POLL_MS));
+        }
+    }
+    _log_drain(l);
+}
+
+/*
+ * Start the log task; `output` NULL writes to stdout. Entries queued before the start are kept (up to
+ * LOG_RING_LEN) and written first.
+ */
+inline void log_start(log_ring_t *l, log_output_t output, void *ctx) {
+    l->output = output != NULL ? output : &_log_write_stdout;
+    l->output_ctx = ctx;
+    l->running = true;
+#ifdef ESP_PLATFORM
+    esp_pthread_cfg_t cfg = esp_pthread_get_default_config();
+    cfg.prio = CONFIG_LOG_DEFERRED_PRIORITY;
+    cfg.thread_name = "log";
+    esp_pthread_set_cfg(&cfg);
+    l->thread = std::thread(_log_loop, l);
+    cfg = esp_pthread_get_default_config();
+    esp_pthread_set_cfg(&cfg);
+#else
+    l->thread = std::thread(_log_loop, l);
+#endif
+}
+
+// Wait until everything queued so far has been written
+inline void log_flush(log_ring_t *l) {
+    uint32_t target = l->enqueue.load(std::memory_order_acquire);
+    while (l->running && (int32_t) (l->dequeue.load(std::memory_order_acquire) - target) < 0) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+}
+
+inline void log_get_stats(log_ring_t *l, log_stats_t *stats) {
+    stats->written = l->written.load(std::memory_order_relaxed);
+    stats->dropped = l->dropped.load(std::memory_order_relaxed);
+    stats->emitted = l->emitted.load(std::memory_order_relaxed);
+}
+
+// Write what is left and stop the task
+inline void log_stop(log_ring_t *l) {
+    l->running = false;
+    if (l->thread.joinable()) {
+        l->thread.join();
+    }
+}
+
+#endif //ESP32_CSI_LOG_COMPONENT_H
@@ -1,16 +1,10 @@
 #ifndef ESP32_CSI_NVS_COMPONENT_H
 #define ESP32_CSI_NVS_COMPONENT_H
 
-#include "nvs_flash.h"
+#include "hal_component.h"
 
 void nvs_init() {
-    //Initialize NVS
-    esp_err_t ret = nvs_flash_init();
-    if (ret == ESP_ERR_NVS_NO_FREE_PAGES || ret == ESP_ERR_NVS_NEW_VERSION_FOUND) {
-        ESP_ERROR_CHECK(nvs_flash_erase());
-        ret = nvs_flash_init();
-    }
-    ESP_ERROR_CHECK(ret);
+    hal_nvs_init(); // Erased and initialized again if it is full or from another IDF version
 }
 
 #endif //ESP32_CSI_NVS_COMPONENT_H
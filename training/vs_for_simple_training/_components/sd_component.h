@@ -5,102 +5,165 @@
 #include <string.h>
 #include <sys/unistd.h>
 #include <sys/stat.h>
-#include "esp_err.h"
-#include "esp_log.h"
-#include "esp_vfs_fat.h"
-#include "driver/sdmmc_host.h"
-#include "driver/sdspi_host.h"
-#include "sdmmc_cmd.h"
+#include <mutex>
+#include "hal_component.h"
+#include "sd_writer_component.h"
+#include "capture_component.h"
+#include "session_component.h"
 
 #define PIN_NUM_MISO 2
 #define PIN_NUM_MOSI 15
 #define PIN_NUM_CLK  14
 #define PIN_NUM_CS   13
 
-FILE *f;
-char filename[24] = {0};
+#ifdef CONFIG_SD_BINARY_CAPTURE
+#define SD_FILE_EXTENSION "csi" // Chunked binary capture, see capture_component.h
+#else
+#define SD_FILE_EXTENSION "csv"
+#endif
 
-void _sd_pick_next_file() {
-    int i = -1;
-    struct stat st;
-    while (true) {
-        i++;
-        printf("Checking %i.csv\n", i);
-        sprintf(filename, "/sdcard/%i.csv", i);
+#ifndef CONFIG_SD_MAX_CAPTURE_MB
+#define CONFIG_SD_MAX_CAPTURE_MB 0
+#endif
 
-        if (stat(filename, &st) != 0) {
-            break;
-        }
+#define SD_SESSION_RESERVE_BYTES (8 * 1024 * 1024) // Room kept free for the new session when rotating
+
+sd_writer_t sd_writer;
+bool sd_writer_ready = false;
+capture_writer_t sd_capture;
+bool sd_capture_started = false;
+std::mutex sd_capture_mutex; // sd_capture is appended to on the Wi-Fi task and flushed from other tasks
+bool sd_capture_closed = false; // Set by sd_deinit(), records that arrive later are ignored
+session_store_t sd_sessions;
+char filename[SESSION_PATH_LEN] = {0};
+
+/*
+ * Runs on the SD writer thread before every sync, CONFIG_SD_FSYNC_INTERVAL_MS: seals the open chunk so the
+ * records in it are synced as well instead of waiting for the chunk to fill. If the Wi-Fi task is
+ * appending a record right then (or sd_deinit() is finishing the capture), the next sync seals it.
+ */
+void _sd_capture_seal(void *) {
+    std::unique_lock<std::mutex> lock(sd_capture_mutex, std::try_to_lock);
+    if (lock.owns_lock() && sd_capture_started) {
+        capture_writer_flush(&sd_capture);
+    }
+}
 
-        printf("File size: %li\n", st.st_size);
+// Next HAL_FS_ROOT/<n>.<ext> from the session manifest, deleting the oldest sessions past CONFIG_SD_MAX_CAPTURE_MB
+bool _sd_pick_next_file() {
+    if (!session_open(&sd_sessions, HAL_FS_ROOT, SD_FILE_EXTENSION, (uint64_t) CONFIG_SD_MAX_CAPTURE_MB * 1024 * 1024,
+                      SD_SESSION_RESERVE_BYTES, filename)) {
+        return false;
     }
+    printf("Session file %s (%llu bytes of older sessions%s, %u deleted)\n", filename,
+           (unsigned long long) sd_sessions.total_bytes, sd_sessions.rebuilt ? ", manifest rebuilt" : "",
+           (unsigned) sd_sessions.deleted);
+    return true;
 }
 
 void sd_init() {
 #ifdef CONFIG_SEND_CSI_TO_SD
-    sdmmc_host_t host = SDSPI_HOST_DEFAULT();
-    sdspi_slot_config_t slot_config = SDSPI_SLOT_CONFIG_DEFAULT();
-    slot_config.gpio_miso = (gpio_num_t) PIN_NUM_MISO;
-    slot_config.gpio_mosi = (gpio_num_t) PIN_NUM_MOSI;
-    slot_config.gpio_sck = (gpio_num_t) PIN_NUM_CLK;
-    slot_config.gpio_cs = (gpio_num_t) PIN_NUM_CS;
-
-    esp_vfs_fat_sdmmc_mount_config_t mount_config = {
-            .format_if_mount_failed = false,
-            .max_files = 1,
-            .allocation_unit_size = 16 * 1024
-    };
-
-    sdmmc_card_t *card;
-    esp_err_t ret = esp_vfs_fat_sdmmc_mount("/sdcard", &host, &slot_config, &mount_config, &card);
-
-    if (ret != ESP_OK) {
-        if (ret == ESP_FAIL) {
-            ESP_LOGE("sd.h",
-                     "Failed to mount filesystem. "
-                     "  If you want the card to be formatted, set format_if_mount_failed = true."
-            );
-        } else {
-            ESP_LOGE("sd.h",
-                     "Failed to initialize the card (%s). "
-                     "  If you do not have an SD card attached, please ignore this message."
-                     "  Make sure SD card lines have pull-up resistors in place.", esp_err_to_name(ret));
-        }
+    hal_sd_pins_t pins = {PIN_NUM_MISO, PIN_NUM_MOSI, PIN_NUM_CLK, PIN_NUM_CS};
+    if (!hal_fs_mount(&pins, SD_ALLOCATION_UNIT_SIZE)) {
         return;
-    } else {
-        sdmmc_card_print_info(stdout, card);
+    }
 
-        _sd_pick_next_file();
-        f = fopen(filename, "a");
+    sd_capture_closed = false;
+    sd_writer_backend_t backend;
+    if (_sd_pick_next_file() && sd_writer_open_file(&backend, filename)) {
+        sd_writer_ready = sd_writer_start(&sd_writer, &backend, CONFIG_SD_FSYNC_INTERVAL_MS);
+    }
+#ifdef CONFIG_SD_BINARY_CAPTURE
+    if (sd_writer_ready) {
+        sd_writer_on_sync(&sd_writer, &_sd_capture_seal, NULL); // Records in the open chunk are synced too
     }
 #endif
+#endif
+}
+
+bool _sd_capture_sink(void *ctx, const void *data, size_t size) {
+    return sd_writer_append((sd_writer_t *) ctx, data, size);
+}
+
+// Used for the index at the end of a capture, which must not be dropped
+bool _sd_capture_sink_wait(void *ctx, const void *data, size_t size) {
+    while (!sd_writer_append((sd_writer_t *) ctx, data, size)) {
+        sd_writer_flush((sd_writer_t *) ctx);
+    }
+    return true;
 }
 
 /*
- * Printf for both serial AND sd card (if available and configured)
+ * Append a CSI record to the binary capture (CONFIG_SD_BINARY_CAPTURE). The capture header is written
+ * with the first record, so it carries the station's device id.
  */
-void outprintf(const char *format, ...) {
-    va_list args;
-    va_start(args, format);
-
-#ifdef CONFIG_SEND_CSI_TO_SERIAL
-    vprintf(format, args);
+void sd_capture_record(const csi_record_t *record, const char *ap_name) {
+#if defined CONFIG_SEND_CSI_TO_SD && defined CONFIG_SD_BINARY_CAPTURE
+    std::lock_guard<std::mutex> lock(sd_capture_mutex);
+    if (sd_capture_closed || !sd_writer_ready) {
+        return; // sd_deinit() may be closing the file on another task
+    }
+    if (!sd_capture_started) {
+        int64_t now_us = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::system_clock::now().time_since_epoch()).count();
+        sd_capture_started = capture_writer_begin(&sd_capture, CAPTURE_CHUNK_SIZE, record->device_id, now_us,
+                                                  &_sd_capture_sink, &sd_writer);
+        if (!sd_capture_started) {
+            return;
+        }
+    }
+    capture_writer_set_ap(&sd_capture, record->ap_id, ap_name);
+    capture_writer_append(&sd_capture, record);
 #endif
+}
 
+/*
+ * Blocks until everything written so far is on the card. Periodic syncs happen anyway every
+ * CONFIG_SD_FSYNC_INTERVAL_MS, so this is only needed before power is cut (the SYNC command).
+ */
+void sd_flush() {
 #ifdef CONFIG_SEND_CSI_TO_SD
-    if (f != NULL) {
-        vfprintf(f, format, args);
+    {
+        std::lock_guard<std::mutex> lock(sd_capture_mutex);
+        if (sd_capture_started) {
+            capture_writer_flush(&sd_capture); // Seals the partial chunk, the next record starts a new one
+        }
+    }
+    if (sd_writer_ready) {
+        sd_writer_flush(&sd_writer); // Outside the lock, the Wi-Fi task must not wait for the card
     }
 #endif
+}
 
-    va_end(args);
+// SYNC: put everything captured so far on the card, e.g. before switching the station off
+bool sd_command_sync(int, char **, char *reply, size_t reply_size) {
+    if (!sd_writer_ready) {
+        snprintf(reply, reply_size, "no SD capture running");
+        return false;
+    }
+    sd_flush();
+    snprintf(reply, reply_size, "%s synced", filename);
+    return true;
 }
 
-void sd_flush() {
+/*
+ * Finish the capture (index and footer) and close the file. CSI may still be arriving: the capture is
+ * closed under sd_capture_mutex, so a record either makes it into the capture or is ignored.
+ */
+void sd_deinit() {
 #ifdef CONFIG_SEND_CSI_TO_SD
-    fflush(f);
-    fclose(f);
-    f = fopen(filename, "a");
+    {
+        std::lock_guard<std::mutex> lock(sd_capture_mutex);
+        sd_capture_closed = true;
+        if (sd_capture_started) {
+            sd_capture.sink = &_sd_capture_sink_wait; // Waits for the writer, which never needs this lock
+            capture_writer_finish(&sd_capture);
+            sd_capture_started = false;
+        }
+    }
+    if (sd_writer_ready) {
+        sd_writer_stop(&sd_writer);
+        sd_writer_ready = false;
+    }
 #endif
 }
 
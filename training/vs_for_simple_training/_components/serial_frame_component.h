@@ -0,0 +1,434 @@
+#ifndef ESP32_CSI_SERIAL_FRAME_COMPONENT_H
+#define ESP32_CSI_SERIAL_FRAME_COMPONENT_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+
+#ifdef ESP_PLATFORM
+#include "driver/uart.h"
+#endif
+
+#include "csi_packet_component.h"
+#include "capture_component.h"
+
+/*
+ * Binary CSI stream over the serial console, replacing the printf'ed text lines.
+ *
+ *   frame:  0x00 | COBS(type (1) | seq (4) | body | crc32 (4)) | 0x00
+ *   body:   SERIAL_FRAME_RECORD  a CSI record, encoded as in csi_packet_component.h
+ *           SERIAL_FRAME_AP      ap_id (1) | name_len (1) | name
+ *
+ * COBS (consistent overhead byte stuffing) removes every 0x00 from the frame, so 0x00 only ever marks
+ * frame boundaries and a reader that starts mid-stream or loses bytes resyncs at the next one. seq counts
+ * frames on the link, so the reader sees every frame lost to a full buffer or to line noise as a gap. The
+ * CRC is the one capture files use. All fields are little endian.
+ *
+ * ESP_LOG output and command replies share the UART. The writer thread only ever hands it whole frames, one
+ * write() per batch, and the UART driver does not let another task's write() into the middle of one (nor
+ * does a Linux tty, or a pipe for writes up to PIPE_BUF). Text therefore lands between frames; it never
+ * contains 0x00, so the reader gets it as separate text segments, a line possibly in pieces.
+ *
+ * A 128 byte LLTF record takes 160 bytes on the wire against about 470 for the text line, and nothing is
+ * formatted on the Wi-Fi callback: serial_link_submit() only copies the frame into a ring buffer that a
+ * writer thread drains.
+ */
+
+#define SERIAL_FRAME_RECORD 0x01
+#define SERIAL_FRAME_AP 0x02
+#define SERIAL_FRAME_OVERHEAD 9 // type, seq and crc32
+#define SERIAL_FRAME_MAX (SERIAL_FRAME_OVERHEAD + CSI_RECORD_HEADER_SIZE + CSI_RECORD_LABEL_SIZE + CSI_RECORD_MAX_LEN)
+#define SERIAL_FRAME_MAX_ENCODED (SERIAL_FRAME_MAX + SERIAL_FRAME_MAX / 254 + 3) // COBS plus both delimiters
+#define SERIAL_LINK_BUFFER (8 * 1024) // Frames waiting for the UART, 70 ms at 921600 baud
+#define SERIAL_LINK_BATCH 1024 // Most bytes per write(), whole frames only
+#define SERIAL_LINK_AP_REPEAT 1000 // Repeat the AP names every N frames for readers that attach late
+
+#ifndef CONFIG_SERIAL_CSI_BAUD
+#define CONFIG_SERIAL_CSI_BAUD 921600
+#endif
+
+// Incremental COBS encoder, so a frame can be encoded from its parts without assembling it first
+typedef struct {
+    uint8_t *out;
+    size_t o;
+    size_t code_at;
+    uint8_t code;
+} serial_cobs_t;
+
+inline void serial_cobs_begin(serial_cobs_t *c, uint8_t *out) {
+    c->out = out;
+    c->code_at = 0;
+    c->o = 1;
+    c->code = 1;
+}
+
+inline void serial_cobs_put(serial_cobs_t *c, const uint8_t *in, size_t size) {
+    for (size_t i = 0; i < size; i++) {
+        if (in[i] != 0) {
+            c->out[c->o++] = in[i];
+            c->code++;
+        }
+        if (in[i] == 0 || c->code == 0xFF) {
+            c->out[c->code_at] = c->code;
+            c->code = 1;
+            c->code_at = c->o++;
+        }
+    }
+}
+
+// Returns the encoded size (at most size + size / 254 + 1)
+inline size_t serial_cobs_finish(serial_cobs_t *c) {
+    c->out[c->code_at] = c->code;
+    return c->o;
+}
+
+// Decode a COBS block (without its delimiters) into `out`. Returns the decoded size, or 0 if it is malformed.
+inline size_t serial_cobs_decode(const uint8_t *in, size_t size, uint8_t *out, size_t capacity) {
+    size_t o = 0;
+    size_t i = 0;
+    while (i < size) {
+        uint8_t code = in[i++];
+        if (code == 0 || i + code - 1 > size || o + code - 1 > capacity) {
+            return 0;
+        }
+        memcpy(out + o, in + i, code - 1);
+        o += code - 1;
+        i += code - 1;
+        if (code != 0xFF && i < size) {
+            if (o == capacity) {
+                return 0;
+            }
+            out[o++] = 0;
+        }
+    }
+    return o;
+}
+
+// Build a complete frame in `out` (SERIAL_FRAME_MAX_ENCODED bytes). Returns its size on the wire.
+inline size_t serial_frame_encode(uint8_t type, uint32_t seq, const uint8_t *body, size_t body_size, uint8_t *out) {
+    uint8_t head[5];
+    uint8_t crc[4];
+    head[0] = type;
+    _csi_put_u32(head + 1, seq);
+    _csi_put_u32(crc, capture_crc32(capture_crc32(0, head, sizeof(head)), body, body_size));
+
+    serial_cobs_t c;
+    out[0] = 0;
+    serial_cobs_begin(&c, out + 1);
+    serial_cobs_put(&c, head, sizeof(head));
+    serial_cobs_put(&c, body, body_size);
+    serial_cobs_put(&c, crc, sizeof(crc));
+    size_t size = 1 + serial_cobs_finish(&c);
+    out[size++] = 0;
+    return size;
+}
+
+typedef struct {
+    uint64_t submitted;
+    uint64_t written; // Frames handed to the UART
+    uint64_t dropped; // Frames that did not fit in the buffer
+    uint64_t bytes;
+    uint64_t write_errors;
+} serial_link_stats_t;
+
+typedef struct {
+    int fd;
+    uint32_t seq;
+    uint32_t since_ap_repeat;
+    bool ap_sent[CAPTURE_MAX_APS];
+
+    uint8_t ring[SERIAL_LINK_BUFFER];
+    size_t head;
+    size_t count;
+    // Record being framed and the frame itself, kept off the Wi-Fi task's small stack
+    uint8_t body[CSI_RECORD_HEADER_SIZE + CSI_RECORD_LABEL_SIZE + CSI_RECORD_MAX_LEN];
+    uint8_t frame[SERIAL_FRAME_MAX_ENCODED];
+
+    std::mutex mutex;
+    std::condition_variable cv;
+    std::thread thread;
+    bool running;
+
+    serial_link_stats_t stats;
+} serial_link_t;
+
+static_assert(SERIAL_LINK_BATCH >= SERIAL_FRAME_MAX_ENCODED, "a batch must hold the largest frame");
+
+/*
+ * Size of the whole frames at the front of the ring that fit in `limit` bytes. Frames sit back to back,
+ * each one 0x00 | COBS | 0x00, so the first 0x00 after a frame's opening one closes it.
+ */
+inline size_t _serial_link_whole_frames(const serial_link_t *l, size_t limit) {
+    size_t size = 0;
+    size_t i = 1;
+    while (i < l->count && size < limit) {
+        if (l->ring[(l->head + i) % SERIAL_LINK_BUFFER] == 0) {
+            if (i + 1 > limit) {
+                break;
+            }
+            size = i + 1;
+            i++; // The next frame's opening delimiter
+        }
+        i++;
+    }
+    return size;
+}
+
+inline void _serial_link_loop(serial_link_t *l) {
+    uint8_t chunk[SERIAL_LINK_BATCH];
+    while (true) {
+        size_t size;
+        {
+            std::unique_lock<std::mutex> lock(l->mutex);
+            l->cv.wait(lock, [l] { return l->count > 0 || !l->running; });
+            if (!l->running) {
+                break;
+            }
+            size = _serial_link_whole_frames(l, sizeof(chunk));
+            size_t first = SERIAL_LINK_BUFFER - l->head < size ? SERIAL_LINK_BUFFER - l->head : size;
+            memcpy(chunk, l->ring + l->head, first);
+            memcpy(chunk + first, l->ring, size - first);
+            l->head = (l->head + size) % SERIAL_LINK_BUFFER;
+            l->count -= size;
+        }
+
+        // Blocks for as long as the UART needs, the producers keep filling the ring meanwhile. Only a short
+        // write, which the UART driver does not do, would let other text into the batch.
+        size_t done = 0;
+        while (done < size) {
+            ssize_t n = write(l->fd, chunk + done, size - done);
+            if (n <= 0) {
+                if (n < 0 && errno == EINTR) {
+                    continue;
+                }
+                std::lock_guard<std::mutex> lock(l->mutex);
+                l->stats.write_errors++;
+                break;
+            }
+            done += n;
+        }
+        std::lock_guard<std::mutex> lock(l->mutex);
+        l->stats.bytes += done;
+    }
+}
+
+/*
+ * Start streaming frames to `fd`. On the station pass STDOUT_FILENO: the console UART is switched to
+ * CONFIG_SERIAL_CSI_BAUD, so the serial monitor and csi_serial must use the same rate.
+ */
+inline bool serial_link_start(serial_link_t *l, int fd) {
+    l->fd = fd;
+    l->seq = 0;
+    l->since_ap_repeat = 0;
+    memset(l->ap_sent, 0, sizeof(l->ap_sent));
+    l->head = 0;
+    l->count = 0;
+    memset(&l->stats, 0, sizeof(l->stats));
+#ifdef ESP_PLATFORM
+    if (fd == STDOUT_FILENO) {
+        fflush(stdout);
+        uart_set_baudrate((uart_port_t) CONFIG_ESP_CONSOLE_UART_NUM, CONFIG_SERIAL_CSI_BAUD);
+    }
+#endif
+    l->running = true;
+    l->thread = std::thread(_serial_link_loop, l);
+    return true;
+}
+
+// Copy a frame into the ring (the caller holds the mutex). A frame that does not fit is dropped whole.
+inline bool _serial_link_push(serial_link_t *l, uint8_t type, const uint8_t *body, size_t body_size) {
+    size_t size = serial_frame_encode(type, l->seq++, body, body_size, l->frame);
+    l->stats.submitted++;
+    if (SERIAL_LINK_BUFFER - l->count < size) {
+        l->stats.dropped++;
+        return false;
+    }
+    size_t tail = (l->head + l->count) % SERIAL_LINK_BUFFER;
+    size_t first = SERIAL_LINK_BUFFER - tail < size ? SERIAL_LINK_BUFFER - tail : size;
+    memcpy(l->ring + tail, l->frame, first);
+    memcpy(l->ring, l->frame + first, size - first);
+    l->count += size;
+    l->stats.written++;
+    return true;
+}
+
+// Queue a record without blocking, preceded by its AP's name the first time the AP shows up
+inline bool serial_link_submit(serial_link_t *l, const csi_record_t *r, const char *ap_name) {
+    if (r->len > CSI_RECORD_MAX_LEN) {
+        return false;
+    }
+
+    bool ok;
+    {
+        std::lock_guard<std::mutex> lock(l->mutex);
+        if (++l->since_ap_repeat >= SERIAL_LINK_AP_REPEAT) {
+            memset(l->ap_sent, 0, sizeof(l->ap_sent));
+            l->since_ap_repeat = 0;
+        }
+        if (ap_name != NULL && r->ap_id < CAPTURE_MAX_APS && !l->ap_sent[r->ap_id]) {
+            size_t name_len = strnlen(ap_name, CAPTURE_AP_NAME_LEN - 1);
+            l->body[0] = r->ap_id;
+            l->body[1] = (uint8_t) name_len;
+            memcpy(l->body + 2, ap_name, name_len);
+            l->ap_sent[r->ap_id] = _serial_link_push(l, SERIAL_FRAME_AP, l->body, 2 + name_len);
+        }
+        csi_record_put(l->body, r);
+        ok = _serial_link_push(l, SERIAL_FRAME_RECORD, l->body, csi_record_encoded_size(r));
+    }
+    l->cv.notify_one();
+    return ok;
+}
+
+inline void serial_link_get_stats(serial_link_t *l, serial_link_stats_t *stats) {
+    std::lock_guard<std::mutex> lock(l->mutex);
+    *stats = l->stats;
+}
+
+// Stop the writer thread. Frames still in the ring are discarded.
+inline void serial_link_stop(serial_link_t *l) {
+    {
+        std::lock_guard<std::mutex> lock(l->mutex);
+        l->running = false;
+    }
+    l->cv.notify_one();
+    if (l->thread.joinable()) {
+        l->thread.join();
+    }
+}
+
+typedef void (*serial_record_cb_t)(void *ctx, const csi_record_t *record);
+typedef void (*serial_ap_cb_t)(void *ctx, uint8_t ap_id, const char *name);
+typedef void (*serial_text_cb_t)(void *ctx, const char *text, size_t len);
+
+typedef struct {
+    serial_record_cb_t on_record;
+    serial_ap_cb_t on_ap;
+    serial_text_cb_t on_text; // Log lines and command replies between frames, may be NULL
+    void *ctx;
+} serial_handlers_t;
+
+typedef struct {
+    uint64_t bytes;
+    uint64_t frames; // Frames with a good CRC
+    uint64_t records;
+    uint64_t crc_errors;
+    uint64_t bad_frames; // Not COBS, too long or too short
+    uint64_t lost; // Frames missing from the seq sequence: dropped on the station or broken on the wire
+    uint64_t resyncs; // seq jumped backwards or far ahead, e.g. the station rebooted
+    uint64_t text_bytes;
+} serial_decoder_stats_t;
+
+// Reassembles frames from a byte stream
+typedef struct {
+    uint8_t segment[SERIAL_FRAME_MAX_ENCODED];
+    size_t len;
+    bool overflow;
+    bool synced; // next_seq is known
+    uint32_t next_seq;
+    uint8_t decoded[SERIAL_FRAME_MAX];
+    serial_decoder_stats_t stats;
+} serial_decoder_t;
+
+inline void serial_decoder_init(serial_decoder_t *d) {
+    memset(d, 0, sizeof(*d));
+}
+
+inline bool _serial_is_text(const uint8_t *p, size_t len) {
+    for (size_t i = 0; i < len; i++) {
+        if (p[i] < 0x20 && p[i] != '\n' && p[i] != '\r' && p[i] != '\t' && p[i] != 0x1B) {
+            return false;
+        }
+    }
+    return true;
+}
+
+inline void _serial_emit_text(serial_decoder_t *d, const serial_handlers_t *h) {
+    d->stats.text_bytes += d->len;
+    if (h->on_text != NULL) {
+        h->on_text(h->ctx, (const char *) d->segment, d->len);
+    }
+}
+
+inline void _serial_decode_segment(serial_decoder_t *d, const serial_handlers_t *h) {
+    if (d->overflow) {
+        d->stats.bad_frames++;
+        return;
+    }
+    // Whatever is not a frame with a good CRC is text when it looks like text
+    size_t size = serial_cobs_decode(d->segment, d->len, d->decoded, sizeof(d->decoded));
+    uint8_t *f = d->decoded;
+    if (size < SERIAL_FRAME_OVERHEAD || _csi_get_u32(f + size - 4) != capture_crc32(0, f, size - 4)) {
+        if (_serial_is_text(d->segment, d->len)) {
+            _serial_emit_text(d, h);
+        } else if (size < SERIAL_FRAME_OVERHEAD) {
+            d->stats.bad_frames++;
+        } else {
+            d->stats.crc_errors++;
+        }
+        return;
+    }
+    d->stats.frames++;
+
+    uint32_t seq = _csi_get_u32(f + 1);
+    if (d->synced && seq != d->next_seq) {
+        uint32_t gap = seq - d->next_seq;
+        if (gap < 0x10000) {
+            d->stats.lost += gap;
+        } else {
+            d->stats.resyncs++;
+        }
+    }
+    d->synced = true;
+    d->next_seq = seq + 1;
+
+    const uint8_t *body = f + 5;
+    size_t body_size = size - SERIAL_FRAME_OVERHEAD;
+    if (f[0] == SERIAL_FRAME_RECORD) {
+        csi_record_t r;
+        if (csi_record_get(body, body_size, &r) == body_size) {
+            d->stats.records++;
+            if (h->on_record != NULL) {
+                h->on_record(h->ctx, &r);
+            }
+        } else {
+            d->stats.bad_frames++;
+        }
+    } else if (f[0] == SERIAL_FRAME_AP && body_size >= 2 && body[1] < CAPTURE_AP_NAME_LEN && body_size == 2u + body[1]) {
+        char name[CAPTURE_AP_NAME_LEN];
+        memcpy(name, body + 2, body[1]);
+        name[body[1]] = '\0';
+        if (h->on_ap != NULL) {
+            h->on_ap(h->ctx, body[0], name);
+        }
+    }
+}
+
+// Feed bytes read from the serial port; every complete frame or text segment goes to the handlers
+inline void serial_decoder_feed(serial_decoder_t *d, const uint8_t *data, size_t len, const serial_handlers_t *h) {
+    d->stats.bytes += len;
+    for (size_t i = 0; i < len; i++) {
+        if (data[i] == 0) {
+            if (d->len > 0 || d->overflow) {
+                _serial_decode_segment(d, h);
+            }
+            d->len = 0;
+            d->overflow = false;
+        } else if (d->len < sizeof(d->segment)) {
+            d->segment[d->len++] = data[i];
+        } else if (!d->overflow && _serial_is_text(d->segment, d->len)) {
+            // Longer than any frame but text, e.g. log lines written while no frame went out: pass it on
+            _serial_emit_text(d, h);
+            d->len = 0;
+            d->segment[d->len++] = data[i];
+        } else {
+            d->overflow = true; // Garbage, dropped at the next delimiter
+        }
+    }
+}
+
+#endif //ESP32_CSI_SERIAL_FRAME_COMPONENT_H
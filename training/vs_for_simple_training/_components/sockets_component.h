@@ -7,103 +7,231 @@
 #include <sys/socket.h>
 #include <netinet/in.h>
 #include <arpa/inet.h>
-#include "esp_system.h"
-#include "esp_wifi.h"
-#include <esp_http_server.h>
+#include "hal_component.h"
+#include "csi_component.h"
+#include "csi_packet_component.h"
+#include "csi_codec_component.h"
+#include "pacer_component.h"
+#include "transmitter_component.h"
+#include "time_component.h"
+#include "command_component.h"
+#include "log_component.h"
+#include "survey_component.h"
 
-// Define a global array to store intermediate CSI data
-#define DATA_SIZE 128
-float intermediate_buffer[DATA_SIZE];  // Buffer for holding CSI data
-int current_index = 0;  // Current index to keep track of data storage
+#define TX_DESTINATION_IP "192.168.4.1" // Collector address
+#define TX_DESTINATION_PORT 2223
+#define TX_PACKETS_PER_CALL 1 // Default datagrams submitted per socket_transmitter_sta_loop call (one AP visit)
+#define TX_PACKETS_PER_CALL_MAX 10000
 
-// Declaration of the function to collect CSI data
-void collect_csi_data(wifi_csi_info_t *data);
+#if defined CONFIG_PACKET_RATE && (CONFIG_PACKET_RATE > 0)
+#define TX_PACKET_RATE CONFIG_PACKET_RATE
+#else
+#define TX_PACKET_RATE 100 // Default TX rate if no rate configuration is provided
+#endif
+#define TX_PACKET_BURST 4 // Packets that may go out back to back after a stall
+#define TX_STATS_EVERY 1000 // Print pacing statistics every N packets
 
-void socket_transmitter_sta_loop(bool (*is_wifi_connected)()) {
-    int socket_fd = -1;  // Socket file descriptor
-    int num_packages_sent = 0;  // Number of packages sent
-    bool flag = true;  // Control flag for main loop
-
-    // Define a variable to store CSI data
-    wifi_csi_info_t csi_info;
-    
-    // Define the target IP address and port for communication
-    char *ip = (char *) "192.168.4.1";  // IP address of the receiver
-    struct sockaddr_in caddr;
-    caddr.sin_family = AF_INET;  // Address family is IPv4
-    caddr.sin_port = htons(2223);  // Port number in network byte order
-    
-    // Main loop that keeps sending CSI data
-    while (flag) {
-        // Check if the device is connected to Wi-Fi
-        if (!is_wifi_connected()) {
-            printf("wifi not connected. waiting...\n");  // Wait if Wi-Fi is not connected
-            vTaskDelay(1000 / portTICK_PERIOD_MS);  // Delay for 1 second
-            continue;
-        }
-        printf("initial wifi connection established.\n");
-        
-        // Convert the IP address string to in_addr format
-        if (inet_aton(ip, &caddr.sin_addr) == 0) {
-            printf("ERROR: inet_aton\n");
-            continue;
+uint8_t packet_buffer[CSI_PACKET_MTU]; // Datagram being assembled from queued CSI records
+csi_stream_entry_t stream_entry; // Record taken from the CSI stream queue
+csi_record_t wire_record; // stream_entry as it goes on the wire (possibly delta coded)
+bool wire_record_pending = false; // wire_record did not fit in the previous datagram
+
+transmitter_t transmitter; // Owns the UDP socket across Wi-Fi reconnects and AP cycles
+pacer_t tx_pacer; // Paces the datagrams to TX_PACKET_RATE, kept across calls
+bool transmitter_ready = false;
+std::atomic<uint32_t> tx_requested_rate{TX_PACKET_RATE}; // Set by RATE, applied before the next packet
+uint32_t tx_applied_rate = TX_PACKET_RATE; // Rate tx_pacer runs at
+std::atomic<int> tx_packets_per_call{TX_PACKETS_PER_CALL}; // Set by WINDOW
+
+#ifdef CONFIG_CSI_COMPRESSION
+csi_codec_t codec; // Delta encoder state, one channel per AP
+uint8_t codec_buffer[CSI_CODEC_MAX_ENCODED]; // Encoded payload of wire_record
+bool codec_ready = false;
+#endif
+
+// Take the next queued CSI record and prepare it for the wire. Returns false if none is queued.
+bool _next_wire_record() {
+    if (!csi_stream_pop(&stream_entry)) {
+        return false;
+    }
+#ifdef CONFIG_CSI_COMPRESSION
+    if (!codec_ready) {
+        csi_codec_init(&codec, CONFIG_CSI_KEYFRAME_INTERVAL);
+        codec_ready = true;
+    }
+    csi_codec_encode(&codec, &stream_entry.record, &wire_record, codec_buffer);
+#else
+    wire_record = stream_entry.record;
+#endif
+    return true;
+}
+
+// Batch queued CSI records into `packet_buffer`. Returns the datagram length.
+// With nothing queued an empty packet is built, which still serves as a probe for the AP.
+size_t _build_csi_packet() {
+    csi_packet_writer_t writer;
+    csi_packet_begin(&writer, packet_buffer, sizeof(packet_buffer), csi_device_id);
+
+    while (wire_record_pending || _next_wire_record()) {
+        if (!csi_packet_append(&writer, &wire_record)) {
+            wire_record_pending = true; // Goes first in the next datagram
+            break;
         }
+        wire_record_pending = false;
+    }
 
-        // Create a UDP socket
-        socket_fd = socket(PF_INET, SOCK_DGRAM, 0);  // UDP socket creation
-        if (socket_fd == -1) {
-            printf("ERROR: Socket creation error [%s]\n", strerror(errno));  // Handle socket creation error
-            continue;
+    return csi_packet_finish(&writer);
+}
+
+// Start the transmitter the first time it is needed, it then lives across AP cycles
+bool _ensure_transmitter(bool (*is_wifi_connected)()) {
+    if (!transmitter_ready) {
+        if (!transmitter_start(&transmitter, TX_DESTINATION_IP, TX_DESTINATION_PORT, is_wifi_connected)) {
+            return false;
         }
-        
-        // Connect the socket to the specified address and port
-        if (connect(socket_fd, (const struct sockaddr *) &caddr, sizeof(struct sockaddr)) == -1) {
-            printf("ERROR: socket connection error [%s]\n", strerror(errno));  // Handle connection error
-            close(socket_fd);  // Close the socket
-            continue;
+        pacer_init(&tx_pacer, TX_PACKET_RATE, TX_PACKET_BURST);
+        time_sync_init(&time_sync, TX_DESTINATION_IP, TIME_SYNC_PORT, NULL, NULL); // Reference server runs next to the collector
+        metrics_exporter_start(&metrics_exporter, TX_DESTINATION_IP, METRICS_UDP_PORT, CONFIG_METRICS_INTERVAL_MS,
+                               csi_device_id); // tools/csi_metrics listen, METRICS retargets it
+        transmitter_ready = true;
+    }
+    return true;
+}
+
+// Function to transmit data using the persistent transmitter
+void socket_transmitter_sta_loop(bool (*is_wifi_connected)()) {
+    int num_packages_sent = 0; // Number of packages submitted in this call
+
+    // Wait until the WiFi is connected
+    while (!is_wifi_connected()) {
+        printf("wifi not connected. waiting...\n");
+        hal_delay_ms(1000); // Delay and check again
+    }
+
+    if (!_ensure_transmitter(is_wifi_connected)) {
+        return;
+    }
+
+    // Keep the CSI timestamps on the collector's timebase (every CONFIG_TIME_SYNC_INTERVAL_MS)
+    if (time_sync_maybe_round(&time_sync)) {
+        time_sync_stats_t sync_stats;
+        time_sync_get_stats(&time_sync, &sync_stats);
+        LOG_I("time", "sync offset %lld us, rtt %lld us, drift %.1f ppm, %llu timeouts",
+              (long long) sync_stats.last_offset_us, (long long) sync_stats.last_rtt_us, sync_stats.drift_ppm,
+              (unsigned long long) sync_stats.timeouts);
+    }
+    metrics_exporter_poll(&metrics_exporter); // A snapshot every CONFIG_METRICS_INTERVAL_MS
+
+    while (num_packages_sent < tx_packets_per_call && is_wifi_connected()) {
+        // Pick up a RATE command, the schedule restarts from the next slot
+        if (tx_requested_rate != tx_applied_rate) {
+            tx_applied_rate = tx_requested_rate;
+            pacer_set_rate(&tx_pacer, tx_applied_rate);
         }
 
-        printf("sending frames.\n");
-        bool flag2 = true;  // Control flag for inner loop
-        
-        // Loop to keep sending the data
-        while (flag2) {
-            // Check Wi-Fi connection again
-            if (!is_wifi_connected()) {
-                printf("ERROR: wifi is not connected\n");
-                break;  // Exit the loop if Wi-Fi is not connected
-            }
+        // Wait for this packet's slot
+        pacer_wait(&tx_pacer);
 
-            // Call the function to collect CSI data
-            collect_csi_data(&csi_info);  // Function to collect CSI data
-            
-            // Fill the intermediate buffer with simulated data (replace with actual CSI data)
-            for (int i = 0; i < DATA_SIZE; i++) {
-                intermediate_buffer[i] = i;  // Example: populate buffer with incremental values
-            }
+        // Batch the CSI records captured so far into one datagram and hand it to the sender thread
+        size_t packet_size = _build_csi_packet();
+        transmitter_submit(&transmitter, packet_buffer, packet_size);
+        num_packages_sent++; // Increment the sent package counter
 
-            // Send the data in the intermediate buffer to the target address
-            if (sendto(socket_fd, intermediate_buffer, sizeof(intermediate_buffer), 0, (const struct sockaddr *) &caddr, sizeof(caddr)) != sizeof(intermediate_buffer)) {
-                printf("ERROR: Failed to send data [%s]\n", strerror(errno));  // Handle send error
-                vTaskDelay(1);  // Small delay before retrying
-                continue;
+        if (tx_pacer.packets % TX_STATS_EVERY == 0) {
+            pacer_stats_t stats;
+            transmitter_stats_t tx_stats;
+            pacer_get_stats(&tx_pacer, &stats);
+            transmitter_get_stats(&transmitter, &tx_stats);
+            LOG_I("tx", "rate %.1f/s (target %d), jitter mean %.0f us, stddev %.0f us, max %lld us, skipped %llu",
+                  stats.rate, (int) tx_requested_rate, stats.jitter_mean_us, stats.jitter_stddev_us,
+                  (long long) stats.jitter_max_us, (unsigned long long) stats.skipped);
+            LOG_I("tx", "sent %llu, dropped %llu, errors %llu, sockets opened %u, rebinds %u",
+                  (unsigned long long) tx_stats.sent, (unsigned long long) tx_stats.dropped,
+                  (unsigned long long) tx_stats.send_errors, tx_stats.sockets_opened, tx_stats.rebinds);
+            if (survey_active(&survey)) {
+                survey_stats_t survey_stats;
+                survey_get_stats(&survey, &survey_stats);
+                LOG_I("survey", "round %u point %u, %llu labeled, %.1f/min (%.1f/min dwelling)", survey_stats.round + 1,
+                      survey_stats.point + 1, (unsigned long long) survey_stats.labeled, survey_stats.samples_per_min,
+                      survey_stats.dwell_samples_per_min);
             }
-            num_packages_sent++;  // Increment the number of packages sent
-
-            // Packet sending rate control (if configured)
-            #if defined CONFIG_PACKET_RATE && (CONFIG_PACKET_RATE > 0)
-                double end_time = get_steady_clock_timestamp();  // Get timestamp after sending packet
-                double wait_duration = (1000.0 / CONFIG_PACKET_RATE) - lag;  // Calculate wait time
-                int w = floor(wait_duration);  // Wait for the calculated duration
-                vTaskDelay(w);  // Delay before sending the next packet
-            #else
-                vTaskDelay(10);  // Default delay if no rate control is configured
-            #endif
-            
-            flag2 = false;  // Exit the loop after sending one package (this can be modified as per the logic)
         }
+    }
+}
 
-        close(socket_fd);  // Close the socket after sending the data
-        flag = false;  // Exit the main loop after sending the required number of packages
+inline bool _command_rate(int argc, char **argv, char *reply, size_t reply_size) {
+    long rate;
+    if (argc != 2 || !command_parse_int(argv[1], 1, 1000, &rate)) {
+        return false;
     }
+    tx_requested_rate = (uint32_t) rate;
+    snprintf(reply, reply_size, "rate %ld/s", rate);
+    return true;
+}
+
+inline bool _command_window(int argc, char **argv, char *reply, size_t reply_size) {
+    long packets;
+    if (argc != 2 || !command_parse_int(argv[1], 1, TX_PACKETS_PER_CALL_MAX, &packets)) {
+        return false;
+    }
+    tx_packets_per_call = (int) packets;
+    snprintf(reply, reply_size, "window %ld datagrams per AP", packets);
+    return true;
+}
+
+inline bool _command_sink(int argc, char **argv, char *reply, size_t reply_size) {
+    if (argc != 2) {
+        return false;
+    }
+    uint8_t sinks = 0;
+    char *save = NULL;
+    for (char *name = strtok_r(argv[1], ",", &save); name != NULL; name = strtok_r(NULL, ",", &save)) {
+        if (strcasecmp(name, "serial") == 0) {
+            sinks |= CSI_SINK_SERIAL;
+        } else if (strcasecmp(name, "udp") == 0) {
+            sinks |= CSI_SINK_UDP;
+        } else if (strcasecmp(name, "sd") == 0) {
+            sinks |= CSI_SINK_SD;
+        } else if (strcasecmp(name, "all") == 0) {
+            sinks |= CSI_SINK_SERIAL | CSI_SINK_UDP | CSI_SINK_SD;
+        } else if (strcasecmp(name, "none") != 0) {
+            snprintf(reply, reply_size, "unknown sink %.32s", name);
+            return false;
+        }
+    }
+    csi_sinks = sinks;
+    snprintf(reply, reply_size, "sinks%s%s%s", sinks & CSI_SINK_SERIAL ? " serial" : "",
+             sinks & CSI_SINK_UDP ? " udp" : "", sinks & CSI_SINK_SD ? " sd" : "");
+    return true;
+}
+
+inline bool _command_stats(int, char **, char *reply, size_t reply_size) {
+    pacer_stats_t stats;
+    transmitter_stats_t tx_stats;
+    time_sync_stats_t sync_stats;
+    pacer_get_stats(&tx_pacer, &stats);
+    transmitter_get_stats(&transmitter, &tx_stats);
+    time_sync_get_stats(&time_sync, &sync_stats);
+    snprintf(reply, reply_size, "rate %.1f/s target %u window %d sent %llu dropped %llu queue_drops %u sync_offset %lld us",
+             stats.rate, (unsigned) tx_requested_rate, (int) tx_packets_per_call, (unsigned long long) tx_stats.sent,
+             (unsigned long long) tx_stats.dropped, (unsigned) csi_stream_dropped, (long long) sync_stats.last_offset_us);
+    return true;
+}
+
+// The round's arena and the heap's low-water mark
+inline bool _command_heap(int, char **, char *reply, size_t reply_size) {
+    std::lock_guard<std::mutex> lock(mutex);
+    arena_report(&csi_arena, reply, reply_size);
+    return true;
+}
+
+// RATE, WINDOW, SINK, STATS, HEAP and METRICS for command_start
+inline void register_station_commands() {
+    command_register("RATE", "<packets per second, 1..1000>", &_command_rate);
+    command_register("WINDOW", "<datagrams per AP visit>", &_command_window);
+    command_register("SINK", "serial,udp,sd | all | none", &_command_sink);
+    command_register("STATS", "", &_command_stats);
+    command_register("HEAP", "", &_command_heap);
+    command_register("METRICS", "[ip [port] [interval ms] | OFF]", &metrics_command);
+    command_register("SURVEY", "[START | RUN rounds settle_ms x,y,dwell;... | AT x,y | NEXT | STOP]", &_command_survey);
 }
@@ -16,6 +16,8 @@
 #include "../../_components/time_component.h"
 #include "../../_components/input_component.h"
 #include "../../_components/sockets_component.h"
+#include "../../_components/command_component.h"
+#include "../../_components/log_component.h"
 
 // Definitions
 #define CONFIG_ESP_MAXIMUM_RETRY 5     // Maximum number of retry attempts for WiFi connection
@@ -26,6 +28,11 @@
 static const char *TAG = "wifi_station";  // Tag used for WiFi logs
 static int s_retry_num = 0;               // WiFi retry attempt counter
 static bool wifi_connected = false;       // WiFi connection status
+static int64_t wifi_connect_start_us = 0; // When esp_wifi_start was called
+
+METRICS_HISTOGRAM(wifi_connect_metric, "wifi.connect_ms");  // esp_wifi_start to an IP address
+METRICS_COUNTER(wifi_retries_metric, "wifi.retries", 1);
+METRICS_COUNTER(wifi_failures_metric, "wifi.failures", 1);  // Gave up after CONFIG_ESP_MAXIMUM_RETRY
 
 // HTTP Event Handler
 esp_err_t _http_event_handle(esp_http_client_event_t *evt) {
@@ -34,11 +41,11 @@ esp_err_t _http_event_handle(esp_http_client_event_t *evt) {
             ESP_LOGI(TAG, "HTTP_EVENT_ON_DATA, len=%d", evt->data_len);
             if (!esp_http_client_is_chunked_response(evt->client)) {
                 if (!real_time_set) {   // If time hasn't been set yet
-                    char *data = (char *) malloc(evt->data_len + 1);
-                    strncpy(data, (char *) evt->data, evt->data_len);
-                    data[evt->data_len] = '\0';
+                    char data[64];  // A timestamp, longer responses are cut
+                    size_t len = std::min((size_t) evt->data_len, sizeof(data) - 1);
+                    memcpy(data, evt->data, len);
+                    data[len] = '\0';
                     time_set(data);  // Set time using the received data
-                    free(data);
                 }
             }
             break;
@@ -56,15 +63,20 @@ static void event_handler(void* arg, esp_event_base_t event_base, int32_t event_
         if (s_retry_num < CONFIG_ESP_MAXIMUM_RETRY) {
             esp_wifi_connect();
             s_retry_num++;
+            metric_add(&wifi_retries_metric);
             ESP_LOGI(TAG, "Retrying connection to AP");
         } else {
             wifi_connected = false;
+            metric_add(&wifi_failures_metric);
             ESP_LOGI(TAG, "Failed to connect to AP");
         }
     } else if (event_base == IP_EVENT && event_id == IP_EVENT_STA_GOT_IP) {
         ip_event_got_ip_t* event = (ip_event_got_ip_t*) event_data;
         ESP_LOGI(TAG, "Got IP: " IPSTR, IP2STR(&event->ip_info.ip));
         s_retry_num = 0;
+        if (!wifi_connected) {
+            metric_observe(&wifi_connect_metric, (uint32_t) ((hal_monotonic_us() - wifi_connect_start_us) / 1000));
+        }
         wifi_connected = true;  // Update connection status
     }
 }
@@ -101,6 +113,7 @@ void wifi_init_sta(const char *ssid_name, const char *pass_name) {
     // Set WiFi mode to station and start the connection
     ESP_ERROR_CHECK(esp_wifi_set_mode(WIFI_MODE_STA));
     ESP_ERROR_CHECK(esp_wifi_set_config(WIFI_IF_STA, &wifi_config));
+    wifi_connect_start_us = hal_monotonic_us();
     ESP_ERROR_CHECK(esp_wifi_start());
 
     ESP_LOGI(TAG, "wifi_init_sta finished.");
@@ -125,20 +138,28 @@ void wifi_disconnect() {
     s_retry_num = 0; // Reset retry counter
 }
 
+command_channel_t commands; // Console and UDP commands
+
 extern "C" void app_main(void) {
     const char *ssid_list[] = { "AP4"};
     const char *pass_list[] = { "12345678"};
 
     int n_pack = 2500;  // Number of packets to send
 
+    log_start(&log_ring, NULL, NULL); // Hot paths queue their messages, this task prints them
     nvs_init();  // Initialize the NVS system (non-volatile storage)
     init_func(); // Initialize network
+    sd_init(); // Mount the SD card and open the next capture file (CONFIG_SEND_CSI_TO_SD)
+    csi_record_sink = &sd_capture_record; // Every captured frame also goes to the SD capture
+    register_station_commands();
+    command_register("SYNC", "", &sd_command_sync);
+    command_start(&commands, STDIN_FILENO, STDOUT_FILENO, COMMAND_UDP_PORT); // Retune without restarting
+    survey_start_configured(&survey); // Label the records with CONFIG_SURVEY_PLAN's points, if there is one
     wifi_init_sta(ssid_list[0], pass_list[0]);
 
     for (int j = 0; j < n_pack; j++) {
-        // Clear the collected CSI data at the beginning of each loop
-        all_csi_data.clear();
-        csi_data_vector.clear();
+        // Release the collected CSI data at the beginning of each loop
+        csi_cycle_reset();
 
         // Collect CSI data in 3 iterations
         for (int i = 0; i < 3; i++) {
@@ -158,5 +179,6 @@ extern "C" void app_main(void) {
         }
     
     }
+    sd_deinit(); // Write the capture index and close the file
     ESP_LOGE(TAG, "<---------------------------------------- FINISHED ---------------------------------------->");
 }